@@ -0,0 +1,11 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+cd "$(dirname "$0")"
+
+# IDE_SRC=path/to/ide.c builds the bench against another ide.c, to compare.
+gcc ${OPT_LEVEL:--O2} -Wall -Wextra ${CPUFLAGS:-} -D_FILE_OFFSET_BITS=64 -D_LARGEFILE64_SOURCE \
+  -I. -Isrc tools/ide_bench.c "${IDE_SRC:-src/ide/ide.c}" \
+  -Wl,--wrap=read,--wrap=write,--wrap=pread,--wrap=pread64,--wrap=pwrite,--wrap=pwrite64 \
+  -lpthread -o ide_bench
+echo "Built ./ide_bench"
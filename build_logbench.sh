@@ -0,0 +1,7 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+cd "$(dirname "$0")"
+
+gcc -O2 -Wall -Wextra -I. -Isrc tools/log_bench.c src/log.c -o log_bench -lpthread
+echo "Built ./log_bench"
@@ -0,0 +1,14 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+cd "$(dirname "$0")"
+
+gcc ${OPT_LEVEL:--O2} -Wall -Wextra ${CPUFLAGS:-} -D_FILE_OFFSET_BITS=64 -D_LARGEFILE64_SOURCE \
+  -DPISTORM_ZLIB -I. -Isrc -Isrc/musashi tools/piscsi_cache_bench.c tools/piscsi_stubs.c \
+  src/platforms/amiga/piscsi/piscsi-cache.c src/platforms/amiga/piscsi/piscsi-mmap.c \
+  src/platforms/amiga/piscsi/piscsi-overlay.c src/platforms/amiga/piscsi/piscsi-zhdf.c \
+  src/platforms/amiga/piscsi/piscsi-io.c \
+  -Wl,--wrap=pread,--wrap=pread64,--wrap=pwrite,--wrap=pwrite64,--wrap=pwritev \
+  -Wl,--wrap=pwritev64,--wrap=fdatasync -lpthread -lz \
+  -o piscsi_cache_bench
+echo "Built ./piscsi_cache_bench"
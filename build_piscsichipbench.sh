@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+cd "$(dirname "$0")"
+
+gcc ${OPT_LEVEL:--O2} -Wall -Wextra ${CPUFLAGS:-} -D_FILE_OFFSET_BITS=64 -D_LARGEFILE64_SOURCE \
+  -DPISTORM_ZLIB -I. -Isrc -Isrc/musashi tools/piscsi_chip_bench.c tools/piscsi_stubs.c \
+  src/platforms/amiga/piscsi/piscsi.c src/platforms/amiga/piscsi/piscsi-async.c \
+  src/platforms/amiga/piscsi/piscsi-cache.c src/platforms/amiga/piscsi/piscsi-mmap.c \
+  src/platforms/amiga/piscsi/piscsi-overlay.c src/platforms/amiga/piscsi/piscsi-zhdf.c \
+  src/platforms/amiga/piscsi/piscsi-io.c \
+  src/platforms/amiga/piscsi/piscsi-media.c src/platforms/amiga/piscsi/piscsi-trace.c \
+  src/platforms/amiga/piscsi/piscsi-meta.c \
+  src/platforms/amiga/hunk-reloc.c -lpthread -lz \
+  -o piscsi_chip_bench
+echo "Built ./piscsi_chip_bench"
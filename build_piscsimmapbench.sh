@@ -0,0 +1,11 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+cd "$(dirname "$0")"
+
+gcc ${OPT_LEVEL:--O2} -Wall -Wextra ${CPUFLAGS:-} -D_FILE_OFFSET_BITS=64 -D_LARGEFILE64_SOURCE \
+  -DPISTORM_ZLIB -I. -Isrc -Isrc/musashi tools/piscsi_mmap_bench.c tools/piscsi_stubs.c \
+  src/platforms/amiga/piscsi/piscsi-mmap.c src/platforms/amiga/piscsi/piscsi-overlay.c \
+  src/platforms/amiga/piscsi/piscsi-zhdf.c src/platforms/amiga/piscsi/piscsi-io.c \
+  -lpthread -lz -o piscsi_mmap_bench
+echo "Built ./piscsi_mmap_bench"
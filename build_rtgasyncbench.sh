@@ -0,0 +1,9 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+cd "$(dirname "$0")"
+
+gcc ${OPT_LEVEL:--Os -ffast-math} -Wall -Wextra ${CPUFLAGS:-} -I. -Isrc -Isrc/musashi tools/rtg_async_bench.c \
+  src/platforms/amiga/rtg/rtg.c src/platforms/amiga/rtg/rtg-gfx.c \
+  src/platforms/amiga/rtg/rtg-output-null.c -lpthread -o rtg_async_bench
+echo "Built ./rtg_async_bench"
@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+cd "$(dirname "$0")"
+
+gcc -O3 -Wall -Wextra ${CPUFLAGS:-} -I. -Isrc tools/rtg_convert_bench.c \
+  src/platforms/amiga/rtg/rtg-convert.c -o rtg_convert_bench
+echo "Built ./rtg_convert_bench"
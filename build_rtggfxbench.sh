@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+cd "$(dirname "$0")"
+
+gcc ${OPT_LEVEL:--Os -ffast-math} -Wall -Wextra ${CPUFLAGS:-} -I. -Isrc -Isrc/musashi tools/rtg_gfx_bench.c \
+  src/platforms/amiga/rtg/rtg-gfx.c -lpthread -o rtg_gfx_bench
+echo "Built ./rtg_gfx_bench"
@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+cd "$(dirname "$0")"
+
+gcc ${OPT_LEVEL:--O2} -Wall -Wextra ${CPUFLAGS:-} -I. tools/rtg_shader_check.c \
+  src/platforms/amiga/rtg/rtg-convert.c -lEGL -lGLESv2 -o rtg_shader_check
+echo "Built ./rtg_shader_check"
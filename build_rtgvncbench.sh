@@ -0,0 +1,10 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+cd "$(dirname "$0")"
+
+gcc ${OPT_LEVEL:--Os -ffast-math} -Wall -Wextra ${CPUFLAGS:-} -I. -Isrc -Isrc/musashi tools/rtg_vnc_bench.c \
+  src/platforms/amiga/rtg/rtg.c src/platforms/amiga/rtg/rtg-gfx.c \
+  src/platforms/amiga/rtg/rtg-convert.c src/platforms/amiga/rtg/rtg-output-headless.c \
+  src/platforms/amiga/rtg/rtg-vnc.c -lpthread -o rtg_vnc_bench
+echo "Built ./rtg_vnc_bench"
@@ -1431,7 +1431,7 @@ void a314_set_mem_base_size(unsigned int base, unsigned int size) {
 void a314_process_events() {
     if (ca.a_events & ca.a_enable) {
         ps_write_16(0xdff09c, 0x8008);
-        m68k_set_irq(2);
+        cpu_irq_preempt(2);
     }
 }
 
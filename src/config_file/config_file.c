@@ -12,6 +12,8 @@
 
 #define M68K_CPU_TYPES M68K_CPU_TYPE_SCC68070
 #define PI_AFFINITY_ENV "PISTORM_AFFINITY"
+#define PI_METRICS_ENV "PISTORM_METRICS"
+#define PI_IRQ_LATENCY_ENV "PISTORM_IRQ_LATENCY"
 #define PI_RT_ENV "PISTORM_RT"
 
 const char* cpu_types[M68K_CPU_TYPES] = {
@@ -26,7 +28,7 @@ const char* map_type_names[MAPTYPE_NUM] = {
 const char* config_item_names[CONFITEM_NUM] = {
     "NONE",     "cpu",      "map",      "loopcycles", "jit",    "jitfpu",
     "mouse",    "keyboard", "platform", "setvar",     "kbfile", "affinity",
-    "rtprio",
+    "rtprio",   "metrics",  "irqlatency",
 };
 
 const char* mapcmd_names[MAPCMD_NUM] = {
@@ -362,6 +364,24 @@ mapid[sizeof(mapid) - 1] = '\0';  // Ensure null termination
     setenv(PI_RT_ENV, cur_cmd, 1);
     printf("[CFG] Set RT priorities: %s.\n", cur_cmd);
     break;
+  case CONFITEM_METRICS:
+    get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+    if (!strlen(cur_cmd)) {
+      printf("[CFG] metrics command requires a listen spec (port or unix:/path).\n");
+      break;
+    }
+    setenv(PI_METRICS_ENV, cur_cmd, 1);
+    printf("[CFG] Metrics endpoint: %s.\n", cur_cmd);
+    break;
+  case CONFITEM_IRQ_LATENCY:
+    get_next_string(parse_line, cur_cmd, &str_pos, ' ');
+    if (strlen(cur_cmd) && (strcmp(cur_cmd, "0") == 0 || strcmp(cur_cmd, "off") == 0)) {
+      unsetenv(PI_IRQ_LATENCY_ENV);
+      break;
+    }
+    setenv(PI_IRQ_LATENCY_ENV, "1", 1);
+    printf("[CFG] IRQ latency sampling enabled.\n");
+    break;
   case CONFITEM_PLATFORM: {
     char platform_name[128], platform_sub[128];
     memset(platform_name, 0x00, sizeof(platform_name));
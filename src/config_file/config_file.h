@@ -50,6 +50,8 @@ typedef enum {
   CONFITEM_KBFILE,
   CONFITEM_AFFINITY,
   CONFITEM_RTPRIO,
+  CONFITEM_METRICS,
+  CONFITEM_IRQ_LATENCY,
   CONFITEM_NUM,
 } config_items;
 
@@ -10,7 +10,10 @@
 #include "platforms/amiga/amiga-registers.h"
 #include "platforms/amiga/amiga-interrupts.h"
 #include "platforms/amiga/rtg/rtg.h"
+#include "platforms/amiga/rtg/rtg-native.h"
 #include "platforms/amiga/hunk-reloc.h"
+#include "platforms/amiga/piscsi/piscsi-async.h"
+#include "platforms/amiga/piscsi/piscsi-media.h"
 #include "platforms/amiga/piscsi/piscsi.h"
 #include "platforms/amiga/piscsi/piscsi-enums.h"
 #include "platforms/amiga/net/pi-net.h"
@@ -21,6 +24,9 @@
 #include "platforms/amiga/pistorm-dev/pistorm-dev-enums.h"
 #include "gpio/ps_protocol.h"
 #include "log.h"
+#include "metrics/metrics.h"
+#include "metrics/irq_latency.h"
+#include "pistorm_trace.h"
 #include "cpu_backend.h"
 
 #include <assert.h>
@@ -114,6 +120,8 @@ int gayleirq;
 
 #define PI_AFFINITY_ENV "PISTORM_AFFINITY" // e.g. "cpu=1, ipl=2, input=3, keyboard=3, mouse=3"
 #define PI_RT_ENV "PISTORM_RT"             // e.g. "cpu=60, ipl=40, input=80, keyboard=90"
+#define PI_METRICS_ENV "PISTORM_METRICS"   // e.g. "9100", "127.0.0.1:9100" or "unix:/run/pistorm.sock"
+#define PI_IRQ_LATENCY_ENV "PISTORM_IRQ_LATENCY" // "1" to sample IRQ latency from startup
 
 #define PISTORM64_NAME "KERNEL PiStorm64"
 #define PISTORM64_TAGLINE "JANUS BUS ENGINE"
@@ -193,6 +201,17 @@ unsigned int amiga_reset = 0;
 unsigned int amiga_reset_last = 0;
 unsigned int do_reset = 0;
 
+// Called from device threads when they raise an emulated interrupt. Ends the
+// current slice the same way the IPL thread does for a hardware IPL change, so
+// the CPU thread re-evaluates the interrupt level without waiting out the slice.
+void cpu_irq_preempt(uint8_t ipl) {
+  if (ipl_enabled[ipl & 7] && !irq) {
+    irq_lat_mark_edge();
+    irq = 1;
+    M68K_END_TIMESLICE;
+  }
+}
+
 static void amiga_warmup_bus(void) {
   for (int i = 0; i < 64; i++) {
     (void)ps_read_status_reg();
@@ -292,6 +311,7 @@ static void* ipl_task(void* args) {
       old_irq = irq_delay;
       // NOP
       if (!irq) {
+        irq_lat_mark_edge();
         M68K_END_TIMESLICE;
         NOP;
         irq = 1;
@@ -377,6 +397,8 @@ static inline void m68k_execute_bef(m68ki_cpu_core* state, int num_cycles) {
     m68ki_check_bus_error_trap();
 #endif
 
+    uint64_t insns = 0;
+
     /* Main loop.  Keep going until we run out of clock cycles */
     do {
       /* Set tracing according to T1. ( T0 is done inside instruction ) */
@@ -410,8 +432,12 @@ static inline void m68k_execute_bef(m68ki_cpu_core* state, int num_cycles) {
 
       /* Trace m68k_exception, if necessary */
       m68ki_exception_if_trace(state); /* auto-disable ( see m68kcpu.h ) */
+      insns++;
     } while (GET_CYCLES() > 0);
 
+    METRICS_ADD(cpu_instructions, insns);
+    METRICS_ADD(cpu_cycles, num_cycles - GET_CYCLES());
+
     /* set previous PC to current PC for the next entry into the loop */
     REG_PPC = REG_PC;
   } else {
@@ -476,6 +502,67 @@ static inline void cpu_backend_set_irq(int level) {
   }
 }
 
+// Remote input, queued by the VNC thread and handled on the CPU thread, which
+// also reads the keyboard queue and the mouse counters.
+#define REMOTE_INPUT_SIZE 256
+
+struct remote_input {
+  uint8_t mouse; // else a key
+  uint8_t pressed;
+  uint8_t buttons;
+  int8_t wheel;
+  uint16_t code;
+  int16_t dx, dy;
+};
+
+static struct remote_input remote_input[REMOTE_INPUT_SIZE];
+static unsigned int remote_head, remote_tail; // VNC thread writes head, CPU thread tail
+
+static void remote_input_push(const struct remote_input* ev) {
+  unsigned int head = __atomic_load_n(&remote_head, __ATOMIC_RELAXED);
+  if (head - __atomic_load_n(&remote_tail, __ATOMIC_ACQUIRE) == REMOTE_INPUT_SIZE) {
+    return; // the CPU thread is not keeping up, drop it
+  }
+  remote_input[head % REMOTE_INPUT_SIZE] = *ev;
+  __atomic_store_n(&remote_head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void remote_input_poll(void) {
+  unsigned int tail = __atomic_load_n(&remote_tail, __ATOMIC_RELAXED);
+  unsigned int head = __atomic_load_n(&remote_head, __ATOMIC_ACQUIRE);
+  if (tail == head) {
+    return;
+  }
+  for (; tail != head; tail++) {
+    const struct remote_input* ev = &remote_input[tail % REMOTE_INPUT_SIZE];
+    if (ev->mouse) {
+      if (!mouse_hook_enabled) {
+        mouse_hook_enabled = 1;
+        LOG_INFO("[MOUSE] Mouse hook enabled by remote input.\n");
+      }
+      // Same accumulating counters and button bits as get_mouse_status().
+      mouse_dx = (uint8_t)(mouse_dx + ev->dx);
+      mouse_dy = (uint8_t)(mouse_dy + ev->dy);
+      mouse_buttons = ev->buttons;
+      if (ev->wheel) {
+        mouse_extra = ev->wheel < 0 ? 0xff : 0x01;
+      }
+      continue;
+    }
+    if (!kb_hook_enabled) {
+      kb_hook_enabled = 1;
+      LOG_INFO("[KBD] Keyboard hook enabled by remote input.\n");
+    }
+    if (queue_keypress((uint8_t)ev->code, ev->pressed ? KEYPRESS_PRESS : KEYPRESS_RELEASE,
+                       cfg->platform->id)) {
+      if (cfg->platform->id == PLATFORM_AMIGA && last_irq != 2) {
+        amiga_emulate_irq(PORTS);
+      }
+    }
+  }
+  __atomic_store_n(&remote_tail, tail, __ATOMIC_RELEASE);
+}
+
 static void* cpu_task(void *arg) {
   (void)arg;
   m68ki_cpu_core* state = &m68ki_cpu;
@@ -508,13 +595,16 @@ cpu_loop:
     if (cpu_emulation_running) {
       unsigned int slice = loop_cycles > loop_cycles_cap ? loop_cycles_cap : loop_cycles;
       if (irq) {
-        cpu_backend_execute(state, 5);
-      } else {
-        cpu_backend_execute(state, (int)slice);
+        slice = 5;
       }
+      PS_TRACE2(slice_begin, slice, irq);
+      cpu_backend_execute(state, (int)slice);
+      PS_TRACE1(slice_end, slice);
     }
   }
 
+  METRICS_INC(cpu_slices);
+
   // Flush any pending batched operations before checking status
   ps_flush_batch_queue();
 
@@ -526,11 +616,17 @@ cpu_loop:
     }
     if (last_irq != 0 && last_irq != last_last_irq) {
       last_last_irq = last_irq;
+      METRICS_INC(cpu_irq_level_changes);
+      PS_TRACE1(irq_level, last_irq);
+      irq_lat_mark_set(last_irq);
       cpu_backend_set_irq((int)last_irq);
+    } else {
+      irq_lat_mark_set(0);
     }
   }
 
   if (!irq && last_last_irq != 0) {
+    irq_lat_mark_clear();
     cpu_backend_set_irq(0);
     last_last_irq = 0;
   }
@@ -547,6 +643,13 @@ cpu_loop:
   // Flush any pending batched operations at the end of each CPU loop iteration
   ps_flush_batch_queue();
 
+  if (rtg_native_enabled) {
+    rtg_native_step();
+  }
+  piscsi_async_poll();
+  piscsi_media_poll();
+  remote_input_poll();
+
   if (mouse_hook_enabled && (mouse_extra != 0x00)) {
     // mouse wheel events have occurred; unlike l/m/r buttons, these are queued as keypresses, so
     // add to end of buffer
@@ -748,6 +851,19 @@ mouse_loop:
   return (void*)NULL;
 }
 
+void emulator_remote_key(uint16_t code, uint8_t pressed) {
+  if (code > 0xFF) {
+    return;
+  }
+  struct remote_input ev = {.code = code, .pressed = pressed};
+  remote_input_push(&ev);
+}
+
+void emulator_remote_mouse(int16_t dx, int16_t dy, uint8_t buttons, int8_t wheel) {
+  struct remote_input ev = {.mouse = 1, .buttons = buttons, .wheel = wheel, .dx = dx, .dy = dy};
+  remote_input_push(&ev);
+}
+
 void stop_cpu_emulation(uint8_t disasm_cur) {
   M68K_END_TIMESLICE;
   if (disasm_cur) {
@@ -778,6 +894,11 @@ static void sigint_handler(int sig_num) {
   emulator_exiting = 1;
 }
 
+static void sigusr1_handler(int sig_num) {
+  (void)sig_num;
+  irq_lat_enable(!irq_lat_enabled);
+}
+
 int main(int argc, char* argv[]) {
   int g;
 
@@ -823,6 +944,14 @@ int main(int argc, char* argv[]) {
       } else {
         cli_add_line("rtprio %s", argv[++g]);
       }
+    } else if (strcmp(argv[g], "--metrics") == 0) {
+      if (g + 1 >= argc) {
+        printf("%s switch found, but no metrics listen spec provided.\n", argv[g]);
+      } else {
+        cli_add_line("metrics %s", argv[++g]);
+      }
+    } else if (strcmp(argv[g], "--irq-latency") == 0) {
+      cli_add_line("irqlatency");
     } else if (strcmp(argv[g], "--log-level") == 0 || strcmp(argv[g], "-l") == 0) {
       if (g + 1 >= argc) {
         printf("%s switch found, but no log level specified.\n", argv[g]);
@@ -941,6 +1070,9 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  // Hot-path LOG_EVENT()s are formatted and written out by this thread.
+  log_async_start();
+
 switch_config:
   srand((unsigned int)clock());
 
@@ -1062,6 +1194,10 @@ switch_config:
   InitGayle();
 
   signal(SIGINT, sigint_handler);
+  signal(SIGUSR1, sigusr1_handler);
+  if (getenv(PI_IRQ_LATENCY_ENV) && !irq_lat_enabled) {
+    irq_lat_enable(1);
+  }
 
   amiga_reset_and_wait("pre-cpu");
 
@@ -1106,6 +1242,13 @@ switch_config:
     }
   }
 
+  // Opt-in metrics endpoint; started once, survives config reloads.
+  static uint8_t metrics_started = 0;
+  if (!metrics_started && getenv(PI_METRICS_ENV)) {
+    metrics_started = 1;
+    metrics_start(getenv(PI_METRICS_ENV));
+  }
+
   // create cpu task
   err = pthread_create(&cpu_tid, NULL, &cpu_task, NULL);
   if (err != 0) {
@@ -1123,6 +1266,8 @@ switch_config:
     printf("IRQs triggered: %lu\n", (unsigned long)trig_irq);
     printf("IRQs serviced: %lu\n", (unsigned long)serv_irq);
     printf("Last serviced IRQ: %d\n", last_last_irq);
+    amiga_print_irq_stats();
+    irq_lat_print(stdout);
   }
 
   while (!emulator_exiting) {
@@ -1165,6 +1310,9 @@ switch_config:
 #endif
   #endif
 
+  metrics_stop();
+  log_async_stop();
+
   return 0;
 }
 
@@ -1254,7 +1402,7 @@ uint8_t cpu_read_byte(uint32_t addr) {
         // Just observe
         static uint32_t last_fc = 0xFFFFFFFF;
         if (current_fc != last_fc) {
-            printf("[FC] fc=%u addr=%08x\n", current_fc, addr);
+            LOG_FAST_INFO("[FC] fc=%u addr=%08x\n", current_fc, addr);
             last_fc = current_fc;
         }
     }
@@ -1482,18 +1630,21 @@ static inline int32_t platform_write_check(uint8_t type, uint32_t addr, uint32_t
       if (val & 0x10 && !ovl) {
         ovl = 1;
         m68ki_cpu.ovl = 1;
-        printf("[MAC] OVL on.\n");
+        LOG_FAST_INFO("[MAC] OVL on.\n");
         handle_ovl_mappings_mac68k(cfg);
       } else if (ovl) {
         ovl = 0;
         m68ki_cpu.ovl = 0;
-        printf("[MAC] OVL off.\n");
+        LOG_FAST_INFO("[MAC] OVL off.\n");
         handle_ovl_mappings_mac68k(cfg);
       }
       break;
     }
     break;
   case PLATFORM_AMIGA:
+    if (rtg_native_enabled && (addr & 0xFFFE00) == 0xDFF000) {
+      rtg_native_custom_write(addr, val, type);
+    }
     switch (addr) {
     case INTREQ:
       return amiga_handle_intrq_write(val);
@@ -1502,7 +1653,7 @@ static inline int32_t platform_write_check(uint8_t type, uint32_t addr, uint32_t
       if (ovl != (val & (1 << 0))) {
         ovl = (val & (1 << 0));
         m68ki_cpu.ovl = ovl;
-        printf("OVL:%x\n", ovl);
+        LOG_FAST_INFO("OVL:%x\n", ovl);
       }
       return 0;
       break;
@@ -1948,6 +2099,8 @@ static void print_help(const char* prog) {
   printf("  -l, --log-level <level>    Set log level (error|warn|info|debug)\n");
   printf("  --affinity <spec>          Thread affinity (e.g., cpu=3,ipl=2,keyboard=1,mouse=1)\n");
   printf("  --rtprio <spec>            RT priorities (SCHED_RR, e.g., cpu=80,ipl=70,keyboard=90)\n");
+  printf("  --metrics <spec>           Prometheus metrics on [127.0.0.1:]port or unix:/path\n");
+  printf("  --irq-latency              Sample IPL->vector latency (toggle at runtime with SIGUSR1)\n");
   printf("\n");
   printf("Config (.cfg equivalents):\n");
   printf("  -c, --config <file>        Load config file\n");
@@ -1967,8 +2120,8 @@ static void print_help(const char* prog) {
   printf("\n");
   printf("Notes:\n");
   printf("  - For complex setvar or multi-arg values, use a .cfg file.\n");
-  printf("  - You can also set %s and %s environment variables for the same specs.\n",
-         PI_AFFINITY_ENV, PI_RT_ENV);
+  printf("  - You can also set %s, %s and %s environment variables for the same specs.\n",
+         PI_AFFINITY_ENV, PI_RT_ENV, PI_METRICS_ENV);
   printf("  - input=... acts as a fallback for keyboard/mouse if those are not set.\n");
   printf("  - RT priorities require CAP_SYS_NICE or a non-zero RLIMIT_RTPRIO.\n");
 }
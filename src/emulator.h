@@ -22,6 +22,7 @@ uint16_t read8(uint32_t address);
 void cpu_pulse_reset(void);
 void m68ki_int_ack(uint8_t int_level);
 unsigned int cpu_irq_ack(int level);
+void cpu_irq_preempt(uint8_t ipl);
 /* Prototypes already provided by src/musashi/m68k.h
 unsigned int m68k_read_memory_8(unsigned int address);
 unsigned int m68k_read_memory_16(unsigned int address);
@@ -33,6 +34,15 @@ void m68k_write_memory_32(unsigned int address, unsigned int value);
 
 void stop_cpu_emulation(uint8_t disasm_cur);
 
+// Input from somewhere other than the local devices (the RTG VNC server).
+// Keys are Linux input key codes, as read from the keyboard; mouse motion is
+// relative, buttons use the PS/2 bits (0x01 left, 0x02 right, 0x04 middle)
+// and wheel is -1 for up, 1 for down. The first event turns the matching
+// keyboard or mouse hook on. Events are queued for the CPU thread, so these
+// may be called from one other thread.
+void emulator_remote_key(uint16_t code, uint8_t pressed);
+void emulator_remote_mouse(int16_t dx, int16_t dy, uint8_t buttons, int8_t wheel);
+
 
 void pistorm_selftest_alignment(void);
 
@@ -19,6 +19,12 @@
 
 #include "ps_protocol.h"
 #include "src/musashi/m68k.h"
+#include "src/metrics/metrics.h"
+#include "src/pistorm_trace.h"
+
+// Standalone tools (buptest, regtool, ...) link this file without
+// metrics.c; the emulator's strong definition wins when it is present.
+__attribute__((weak)) struct pistorm_metrics pistorm_metrics;
 
 volatile unsigned int *gpio;
 volatile unsigned int *gpclk;
@@ -91,6 +97,8 @@ void ps_setup_protocol() {
 }
 
 void ps_write_16(uint32_t address, uint16_t data) {
+  METRICS_INC(bus_writes[1]);
+  PS_TRACE3(bus_start, 0, 1, address);
   *(gpio + 0) = GPFSEL0_OUTPUT;
   *(gpio + 1) = GPFSEL1_OUTPUT;
   *(gpio + 2) = GPFSEL2_OUTPUT;
@@ -116,9 +124,13 @@ void ps_write_16(uint32_t address, uint16_t data) {
 
   while (*(gpio + 13) & (1 << PIN_TXN_IN_PROGRESS))
     ;
+
+  PS_TRACE4(bus_done, 0, 1, address, data);
 }
 
 void ps_write_8(uint32_t address, uint8_t data) {
+  METRICS_INC(bus_writes[0]);
+  PS_TRACE3(bus_start, 0, 0, address);
   unsigned int data_temp = data;
   if ((address & 1) == 0)
     data_temp = data_temp + (data_temp << 8);  // EVEN, A0=0,UDS
@@ -150,6 +162,8 @@ void ps_write_8(uint32_t address, uint8_t data) {
 
   while (*(gpio + 13) & (1 << PIN_TXN_IN_PROGRESS))
     ;
+
+  PS_TRACE4(bus_done, 0, 0, address, data);
 }
 
 void ps_write_32(uint32_t address, uint32_t value) {
@@ -158,6 +172,8 @@ void ps_write_32(uint32_t address, uint32_t value) {
 }
 
 uint16_t ps_read_16(uint32_t address) {
+  METRICS_INC(bus_reads[1]);
+  PS_TRACE3(bus_start, 1, 1, address);
   *(gpio + 0) = GPFSEL0_OUTPUT;
   *(gpio + 1) = GPFSEL1_OUTPUT;
   *(gpio + 2) = GPFSEL2_OUTPUT;
@@ -186,10 +202,13 @@ uint16_t ps_read_16(uint32_t address) {
 
   *(gpio + 10) = 0xffffec;
 
+  PS_TRACE4(bus_done, 1, 1, address, (value >> 8) & 0xffff);
   return (uint16_t)((value >> 8) & 0xffff);
 }
 
 uint8_t ps_read_8(uint32_t address) {
+  METRICS_INC(bus_reads[0]);
+  PS_TRACE3(bus_start, 1, 0, address);
   *(gpio + 0) = GPFSEL0_OUTPUT;
   *(gpio + 1) = GPFSEL1_OUTPUT;
   *(gpio + 2) = GPFSEL2_OUTPUT;
@@ -219,6 +238,7 @@ uint8_t ps_read_8(uint32_t address) {
   *(gpio + 10) = 0xffffec;
 
   value = (value >> 8) & 0xffff;
+  PS_TRACE4(bus_done, 1, 0, address, value);
 
   if ((address & 1) == 0)
     return (uint8_t)((value >> 8) & 0xff);  // EVEN, A0=0,UDS
@@ -232,7 +252,22 @@ uint32_t ps_read_32(uint32_t address) {
   return ((uint32_t)a << 16) | b;
 }
 
+void ps_read_block(uint32_t address, uint8_t* dst, uint32_t len) {
+  for (; len >= 2; len -= 2, address += 2, dst += 2) {
+    uint16_t v = ps_read_16(address);
+    dst[0] = (uint8_t)(v >> 8);
+    dst[1] = (uint8_t)v;
+  }
+}
+
+void ps_write_block(uint32_t address, const uint8_t* src, uint32_t len) {
+  for (; len >= 2; len -= 2, address += 2, src += 2) {
+    ps_write_16(address, (uint16_t)(src[0] << 8 | src[1]));
+  }
+}
+
 void ps_write_status_reg(uint16_t value) {
+  METRICS_INC(bus_status_ops);
   *(gpio + 0) = GPFSEL0_OUTPUT;
   *(gpio + 1) = GPFSEL1_OUTPUT;
   *(gpio + 2) = GPFSEL2_OUTPUT;
@@ -250,6 +285,7 @@ void ps_write_status_reg(uint16_t value) {
 }
 
 uint16_t ps_read_status_reg() {
+  METRICS_INC(bus_status_ops);
   *(gpio + 7) = (REG_STATUS << PIN_A0);
   *(gpio + 7) = 1 << PIN_RD;
   *(gpio + 7) = 1 << PIN_RD;
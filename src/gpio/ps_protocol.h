@@ -73,6 +73,13 @@ void ps_write_8 (uint32_t address, uint8_t  data);
 void ps_write_16(uint32_t address, uint16_t data);
 void ps_write_32(uint32_t address, uint32_t data);
 
+// Read `len` bytes (even, from an even address) into `dst` in bus byte order.
+// The kmod backend issues the longword reads as batches, one ioctl each.
+void ps_read_block(uint32_t address, uint8_t* dst, uint32_t len);
+// Write `len` bytes (even, to an even address) from `src` in bus byte order,
+// batched the same way.
+void ps_write_block(uint32_t address, const uint8_t* src, uint32_t len);
+
 uint16_t ps_read_status_reg(void);
 void     ps_write_status_reg(uint16_t value);
 
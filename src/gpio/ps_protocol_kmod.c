@@ -13,6 +13,12 @@
 #include "ps_protocol.h"
 #include <linux/pistorm.h>
 #include "src/musashi/m68k.h"
+#include "src/metrics/metrics.h"
+#include "src/pistorm_trace.h"
+
+// Standalone tools (buptest, regtool, ...) link this file without
+// metrics.c; the emulator's strong definition wins when it is present.
+__attribute__((weak)) struct pistorm_metrics pistorm_metrics;
 
 // Compile-time toggle for batching - default to disabled to ensure stability
 #ifndef PISTORM_ENABLE_BATCH
@@ -47,7 +53,13 @@ static uint32_t g_opsq_n = 0;
 static inline int ps_busopq_flush(int ps_fd)
 {
     if (!g_opsq_n) return 0;
+    METRICS_INC(bus_batches);
+    METRICS_INC(bus_ioctls);
+    METRICS_ADD(bus_batch_ops, g_opsq_n);
+    PS_TRACE1(bus_batch, g_opsq_n);
+    metrics_max(&pistorm_metrics.bus_batch_max, g_opsq_n);
     int rc = ps_busop_batch(ps_fd, g_opsq, g_opsq_n);
+    PS_TRACE2(bus_batch_done, g_opsq_n, rc);
     g_opsq_n = 0;
     return rc;
 }
@@ -105,13 +117,20 @@ void ps_pulse_reset(void) {
 static int ps_busop(int is_read, int width, unsigned addr, unsigned *val, unsigned short flags) {
     if (ps_open_dev() < 0) return -1;
 
-#if PISTORM_ENABLE_BATCH
-    // For read operations, flush any pending writes first to maintain ordering
-    if (is_read && g_opsq_n > 0) {
-        ps_busopq_flush(ps_fd);
+    unsigned int w = 3;
+    if (flags & PISTORM_BUSOP_F_STATUS) {
+        METRICS_INC(bus_status_ops);
+    } else {
+        w = width == PISTORM_W8 ? 0 : (width == PISTORM_W16 ? 1 : 2);
+        if (is_read) {
+            METRICS_INC(bus_reads[w]);
+        } else {
+            METRICS_INC(bus_writes[w]);
+        }
     }
-
-    // For write operations, use batching to reduce ioctl calls
+#if PISTORM_ENABLE_BATCH
+    // For write operations, use batching to reduce ioctl calls. The write
+    // reaches the bus with the next flush, traced as bus_batch/bus_batch_done.
     if (!is_read) {
         struct pistorm_busop op = {
             .addr   = addr,
@@ -120,10 +139,20 @@ static int ps_busop(int is_read, int width, unsigned addr, unsigned *val, unsign
             .is_read= (unsigned char)is_read,
             .flags  = flags,
         };
+        PS_TRACE3(bus_queued, w, addr, op.value);
         return ps_busopq_push(ps_fd, &op);
     }
 #endif
 
+    PS_TRACE3(bus_start, is_read, w, addr);
+
+#if PISTORM_ENABLE_BATCH
+    // For read operations, flush any pending writes first to maintain ordering
+    if (g_opsq_n > 0) {
+        ps_busopq_flush(ps_fd);
+    }
+#endif
+
     // For read operations, we need immediate results, so use direct ioctl
     // Also use direct ioctl when batching is disabled
     struct pistorm_busop op = {
@@ -133,8 +162,10 @@ static int ps_busop(int is_read, int width, unsigned addr, unsigned *val, unsign
         .is_read= (unsigned char)is_read,
         .flags  = flags,
     };
+    METRICS_INC(bus_ioctls);
     int rc = ioctl(ps_fd, PISTORM_IOC_BUSOP, &op);
     if (rc == 0 && is_read && val) *val = op.value;
+    PS_TRACE4(bus_done, is_read, w, addr, op.value);
     return rc;
 }
 
@@ -171,6 +202,99 @@ void ps_write_32(uint32_t addr, uint32_t v) {
     ps_busop(0, PISTORM_W32, addr, &temp_v, 0);
 }
 
+// Longword reads or writes per PISTORM_IOC_BATCH; the module accepts up to 1024.
+#define PS_BLOCK_OPS 256
+
+void ps_read_block(uint32_t addr, uint8_t *dst, uint32_t len) {
+    struct pistorm_busop ops[PS_BLOCK_OPS];
+
+    if (ps_open_dev() < 0) {
+        memset(dst, 0, len);
+        return;
+    }
+#if PISTORM_ENABLE_BATCH
+    if (g_opsq_n > 0)
+        ps_busopq_flush(ps_fd);
+#endif
+    while (len >= 4) {
+        uint32_t n = len / 4 > PS_BLOCK_OPS ? PS_BLOCK_OPS : len / 4;
+        for (uint32_t i = 0; i < n; i++) {
+            ops[i] = (struct pistorm_busop){
+                .addr = addr + i * 4,
+                .value = 0,
+                .width = PISTORM_W32,
+                .is_read = 1,
+                .flags = 0,
+            };
+        }
+        struct pistorm_batch b = {
+            .ops_ptr = (uint64_t)(uintptr_t)ops,
+            .ops_count = n,
+            .reserved = 0,
+        };
+        METRICS_INC(bus_ioctls);
+        METRICS_ADD(bus_reads[2], n);
+        if (ioctl(ps_fd, PISTORM_IOC_BATCH, &b) < 0) {
+            // Older modules without read-back in batches: one op at a time.
+            for (uint32_t i = 0; i < n; i++)
+                ops[i].value = ps_read_32(ops[i].addr);
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            dst[0] = (uint8_t)(ops[i].value >> 24);
+            dst[1] = (uint8_t)(ops[i].value >> 16);
+            dst[2] = (uint8_t)(ops[i].value >> 8);
+            dst[3] = (uint8_t)ops[i].value;
+            dst += 4;
+        }
+        addr += n * 4;
+        len -= n * 4;
+    }
+    if (len >= 2) {
+        uint16_t v = ps_read_16(addr);
+        dst[0] = (uint8_t)(v >> 8);
+        dst[1] = (uint8_t)v;
+    }
+}
+
+void ps_write_block(uint32_t addr, const uint8_t *src, uint32_t len) {
+    struct pistorm_busop ops[PS_BLOCK_OPS];
+
+    if (ps_open_dev() < 0)
+        return;
+#if PISTORM_ENABLE_BATCH
+    if (g_opsq_n > 0)
+        ps_busopq_flush(ps_fd);
+#endif
+    while (len >= 4) {
+        uint32_t n = len / 4 > PS_BLOCK_OPS ? PS_BLOCK_OPS : len / 4;
+        for (uint32_t i = 0; i < n; i++, src += 4) {
+            ops[i] = (struct pistorm_busop){
+                .addr = addr + i * 4,
+                .value = (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 |
+                         (uint32_t)src[2] << 8 | src[3],
+                .width = PISTORM_W32,
+                .is_read = 0,
+                .flags = 0,
+            };
+        }
+        struct pistorm_batch b = {
+            .ops_ptr = (uint64_t)(uintptr_t)ops,
+            .ops_count = n,
+            .reserved = 0,
+        };
+        METRICS_INC(bus_ioctls);
+        METRICS_ADD(bus_writes[2], n);
+        if (ioctl(ps_fd, PISTORM_IOC_BATCH, &b) < 0) {
+            for (uint32_t i = 0; i < n; i++)
+                ps_write_32(ops[i].addr, ops[i].value);
+        }
+        addr += n * 4;
+        len -= n * 4;
+    }
+    if (len >= 2)
+        ps_write_16(addr, (uint16_t)(src[0] << 8 | src[1]));
+}
+
 // Additional functions that might be needed
 uint16_t ps_read_status_reg(void) {
     struct pistorm_busop op = {
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 
 #include "ide.h"
@@ -70,9 +71,15 @@
 #define IDE_CMD_SEEK		0x70
 #define IDE_CMD_EDD		0x90
 #define IDE_CMD_INTPARAMS	0x91
+#define IDE_CMD_READ_MULTIPLE	0xC4
+#define IDE_CMD_WRITE_MULTIPLE	0xC5
+#define IDE_CMD_SET_MULTIPLE	0xC6
+#define IDE_CMD_FLUSH_CACHE	0xE7
 #define IDE_CMD_IDENTIFY	0xEC
 #define IDE_CMD_SETFEATURES	0xEF
 
+#define IDE_MAX_MULTIPLE	128
+
 const uint8_t ide_magic[8] = {
   '1','D','E','D','1','5','C','0'
 };
@@ -133,6 +140,391 @@ static void ide_fault(struct ide_drive *d, const char *p)
 			(int)(d - d->controller->drive), p);
 }
 
+/*
+ *	Each drive moves sector data through two buffers the size of the
+ *	largest command. A read is filled by an I/O thread with a few large
+ *	preads while the host empties the data register, and BSY is shown
+ *	until the next DRQ block is in. When reads follow one another the
+ *	sectors after a read are read ahead into the other buffer. A write is
+ *	gathered and written with one pwrite by the thread once the command has
+ *	its data, and the command completes at once; a write that fails is
+ *	reported on the next command. Reads, FLUSH CACHE, reset and detach
+ *	wait for the writes before them.
+ *
+ *	With PISTORM_IDE_ASYNC=0 the same reads and writes are done on the
+ *	caller's thread as the command starts and ends, with no read-ahead.
+ */
+
+#define IDE_BUF_SECTORS		256	/* a count of 0 */
+#define IDE_FILL_SECTORS	16	/* first pread of a fill, doubling */
+#define IDE_AHEAD_SECTORS	64	/* least read-ahead */
+
+#define JOB_NONE	0
+#define JOB_FILL	1
+#define JOB_FLUSH	2
+
+#define BUF_EMPTY	0
+#define BUF_READ	1	/* sectors of the image, as far as done */
+#define BUF_WRITE	2	/* sectors for the image */
+
+struct ide_buf {
+  uint8_t *data;
+  off_t lba;
+  int count;
+  int first;		/* sectors of the first pread, doubling after */
+  int done;		/* sectors read in so far */
+  int seen;		/* of those, the ones the host side knows of */
+  int kind;
+  int job;
+  int cancel;
+  int failed;		/* the read of sector done failed, */
+  int err;		/* with this errno, 0 for end of file */
+};
+
+struct ide_io {
+  struct ide_drive *d;
+  struct ide_buf buf[2];
+  int queue[2];		/* buffers with a job, oldest first */
+  int queued;
+  int threaded;
+  int stop;
+  off_t next;		/* sector after the last read */
+  int werr;		/* errno of a write that failed */
+  off_t werr_lba;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t progress;
+};
+
+static void io_fill(struct ide_io *io, struct ide_buf *b)
+{
+  int i = 0, n = io->threaded ? b->first : b->count;
+  int stop = 0;
+
+  while (i < b->count && !stop) {
+    ssize_t len;
+    if (n > b->count - i)
+      n = b->count - i;
+    len = pread(io->d->fd, b->data + 512 * i, 512 * n, 512 * (b->lba + i));
+    pthread_mutex_lock(&io->lock);
+    if (len != 512 * n) {
+      b->err = len == -1 ? errno : 0;
+      if (len > 0)
+        b->done += len / 512;
+      b->failed = 1;
+    } else
+      b->done += n;
+    stop = b->failed || b->cancel;
+    pthread_cond_broadcast(&io->progress);
+    pthread_mutex_unlock(&io->lock);
+    i += n;
+    n *= 2;
+  }
+}
+
+static void io_flush(struct ide_io *io, struct ide_buf *b)
+{
+  size_t want = 512 * (size_t)b->count, done = 0;
+  ssize_t len = 0;
+
+  while (done < want) {
+    len = pwrite(io->d->fd, b->data + done, want - done, 512 * b->lba + done);
+    if (len <= 0)
+      break;
+    done += len;
+  }
+  pthread_mutex_lock(&io->lock);
+  if (done < want) {
+    io->werr = len == -1 ? errno : EIO;
+    io->werr_lba = b->lba + done / 512;
+    b->kind = BUF_EMPTY;
+  } else {
+    /* What was written is what a read would find */
+    b->kind = BUF_READ;
+    b->done = b->count;
+  }
+  pthread_mutex_unlock(&io->lock);
+}
+
+static void io_run(struct ide_io *io, struct ide_buf *b)
+{
+  if (b->job == JOB_FILL)
+    io_fill(io, b);
+  else
+    io_flush(io, b);
+}
+
+/* Called locked */
+static void io_finish(struct ide_io *io, struct ide_buf *b)
+{
+  if (b->cancel)
+    b->count = b->done;
+  b->cancel = 0;
+  b->job = JOB_NONE;
+  pthread_cond_broadcast(&io->progress);
+}
+
+static void *io_thread(void *arg)
+{
+  struct ide_io *io = arg;
+
+  pthread_mutex_lock(&io->lock);
+  for (;;) {
+    struct ide_buf *b;
+    while (io->queued == 0 && !io->stop)
+      pthread_cond_wait(&io->wake, &io->lock);
+    if (io->queued == 0)
+      break;
+    b = &io->buf[io->queue[0]];
+    if (!b->cancel) {
+      pthread_mutex_unlock(&io->lock);
+      io_run(io, b);
+      pthread_mutex_lock(&io->lock);
+    }
+    io->queue[0] = io->queue[1];
+    io->queued--;
+    io_finish(io, b);
+  }
+  pthread_mutex_unlock(&io->lock);
+  return NULL;
+}
+
+static void io_post(struct ide_io *io, struct ide_buf *b, int job)
+{
+  pthread_mutex_lock(&io->lock);
+  b->job = job;
+  b->cancel = 0;
+  if (io->threaded) {
+    io->queue[io->queued++] = b - io->buf;
+    pthread_cond_signal(&io->wake);
+    pthread_mutex_unlock(&io->lock);
+    return;
+  }
+  pthread_mutex_unlock(&io->lock);
+  io_run(io, b);
+  pthread_mutex_lock(&io->lock);
+  io_finish(io, b);
+  pthread_mutex_unlock(&io->lock);
+}
+
+/* Stop a fill of the buffer, or wait for its write */
+static void io_wait(struct ide_io *io, struct ide_buf *b)
+{
+  pthread_mutex_lock(&io->lock);
+  if (b->job == JOB_FILL)
+    b->cancel = 1;
+  while (b->job != JOB_NONE)
+    pthread_cond_wait(&io->progress, &io->lock);
+  pthread_mutex_unlock(&io->lock);
+}
+
+static void io_drain_writes(struct ide_io *io)
+{
+  pthread_mutex_lock(&io->lock);
+  while (io->buf[0].job == JOB_FLUSH || io->buf[1].job == JOB_FLUSH)
+    pthread_cond_wait(&io->progress, &io->lock);
+  pthread_mutex_unlock(&io->lock);
+}
+
+/* Called locked. The buffer holds, or is reading, all n sectors at lba */
+static int buf_has(struct ide_buf *b, off_t lba, int n)
+{
+  off_t end = b->lba + (b->failed ? b->done : b->count);
+  return b->kind == BUF_READ && lba >= b->lba && lba + n <= end;
+}
+
+/* Sectors up to n of the buffer are in: 1, being read: 0, failed: -1 */
+static int buf_ready(struct ide_io *io, struct ide_buf *b, int n, int wait)
+{
+  int r;
+  if (n <= b->seen)
+    return 1;
+  pthread_mutex_lock(&io->lock);
+  while (wait && b->done < n && b->job == JOB_FILL)
+    pthread_cond_wait(&io->progress, &io->lock);
+  b->seen = b->done;
+  if (b->done >= n)
+    r = 1;
+  else
+    r = b->job == JOB_FILL ? 0 : -1;
+  pthread_mutex_unlock(&io->lock);
+  return r;
+}
+
+static void buf_fill(struct ide_io *io, struct ide_buf *b, off_t lba, int n, int first)
+{
+  b->lba = lba;
+  b->count = n;
+  b->first = first;
+  b->done = b->seen = 0;
+  b->failed = b->err = 0;
+  b->kind = BUF_READ;
+  io_post(io, b, JOB_FILL);
+}
+
+/* Point the drive at the command's sectors, reading them if need be */
+static void ide_read_start(struct ide_drive *d)
+{
+  struct ide_io *io = d->io;
+  off_t lba = d->offset;
+  int n = d->length, i, hit = -1, sequential;
+
+  io_drain_writes(io);
+  pthread_mutex_lock(&io->lock);
+  for (i = 0; i < 2; i++)
+    if (buf_has(&io->buf[i], lba, n))
+      hit = i;
+  pthread_mutex_unlock(&io->lock);
+  if (hit == -1) {
+    io_wait(io, &io->buf[0]);
+    io_wait(io, &io->buf[1]);
+    hit = d->xfer == &io->buf[0];
+    buf_fill(io, &io->buf[hit], lba, n, IDE_FILL_SECTORS);
+  }
+  d->xfer = &io->buf[hit];
+
+  sequential = lba == io->next;
+  io->next = lba + n;
+  if (io->threaded && sequential) {
+    /* Read on from the end of what is in, or coming in */
+    struct ide_buf *b = &io->buf[!hit];
+    int ahead = n < IDE_AHEAD_SECTORS ? IDE_AHEAD_SECTORS : n;
+    off_t from = d->xfer->lba + d->xfer->count;
+    pthread_mutex_lock(&io->lock);
+    i = buf_has(b, from, ahead);
+    pthread_mutex_unlock(&io->lock);
+    if (!i) {
+      io_wait(io, b);
+      buf_fill(io, b, from, ahead, ahead);
+    }
+  }
+}
+
+/* Take a buffer for the command's sectors from the host */
+static void ide_write_start(struct ide_drive *d)
+{
+  struct ide_io *io = d->io;
+  off_t lba = d->offset;
+  int n = d->length, i, overlap, busy;
+  struct ide_buf *b;
+
+  /* Read-ahead stops, and what the write makes stale goes */
+  for (i = 0; i < 2; i++) {
+    b = &io->buf[i];
+    pthread_mutex_lock(&io->lock);
+    overlap = b->kind != BUF_EMPTY && b->lba < lba + n && lba < b->lba + b->count;
+    busy = b->job == JOB_FILL || (overlap && b->job != JOB_NONE);
+    pthread_mutex_unlock(&io->lock);
+    if (busy)
+      io_wait(io, b);
+    if (overlap)
+      b->kind = BUF_EMPTY;
+  }
+  pthread_mutex_lock(&io->lock);
+  while (io->buf[0].job != JOB_NONE && io->buf[1].job != JOB_NONE)
+    pthread_cond_wait(&io->progress, &io->lock);
+  b = &io->buf[io->buf[0].job != JOB_NONE];
+  pthread_mutex_unlock(&io->lock);
+
+  b->lba = lba;
+  b->count = n;
+  b->done = b->seen = 0;
+  b->failed = 0;
+  b->kind = BUF_WRITE;
+  d->xfer = b;
+  d->dptr = b->data;
+  d->dend = b->data + 512;
+}
+
+/* Write the sectors the host has given, count of them */
+static void ide_write_end(struct ide_drive *d, int count)
+{
+  struct ide_buf *b = d->xfer;
+
+  d->xfer = NULL;
+  if (count == 0) {
+    b->kind = BUF_EMPTY;
+    return;
+  }
+  b->count = count;
+  io_post(d->io, b, JOB_FLUSH);
+}
+
+/* Report a write that failed since the last command */
+static int ide_write_failed(struct ide_drive *d)
+{
+  struct ide_io *io = d->io;
+  int err;
+
+  pthread_mutex_lock(&io->lock);
+  err = io->werr;
+  io->werr = 0;
+  pthread_mutex_unlock(&io->lock);
+  if (err == 0)
+    return 0;
+  errno = err;
+  perror("ide_write_sector");
+  d->offset = io->werr_lba;
+  d->taskfile.status |= ST_ERR;
+  d->taskfile.status &= ~ST_DSC;
+  ide_xlate_errno(&d->taskfile, -1);
+  return 1;
+}
+
+static int ide_io_start(struct ide_drive *d)
+{
+  struct ide_io *io = calloc(1, sizeof(*io));
+  const char *env = getenv("PISTORM_IDE_ASYNC");
+  int i;
+
+  if (io == NULL)
+    return -1;
+  for (i = 0; i < 2; i++) {
+    io->buf[i].data = malloc(512 * IDE_BUF_SECTORS);
+    if (io->buf[i].data == NULL) {
+      free(io->buf[0].data);
+      free(io);
+      return -1;
+    }
+  }
+  io->d = d;
+  io->next = -1;
+  pthread_mutex_init(&io->lock, NULL);
+  pthread_cond_init(&io->wake, NULL);
+  pthread_cond_init(&io->progress, NULL);
+  if (env == NULL || strcmp(env, "0"))
+    io->threaded = pthread_create(&io->thread, NULL, io_thread, io) == 0;
+  d->io = io;
+  d->xfer = NULL;
+  return 0;
+}
+
+static void ide_io_stop(struct ide_drive *d)
+{
+  struct ide_io *io = d->io;
+
+  if (io == NULL)
+    return;
+  if (io->threaded) {
+    pthread_mutex_lock(&io->lock);
+    io->stop = 1;
+    pthread_cond_signal(&io->wake);
+    pthread_mutex_unlock(&io->lock);
+    pthread_join(io->thread, NULL);
+  }
+  if (io->werr)
+    ide_fault(d, "write lost on detach");
+  pthread_mutex_destroy(&io->lock);
+  pthread_cond_destroy(&io->wake);
+  pthread_cond_destroy(&io->progress);
+  free(io->buf[0].data);
+  free(io->buf[1].data);
+  free(io);
+  d->io = NULL;
+  d->xfer = NULL;
+}
+
 /* Disk translation */
 static off_t xlate_block(struct ide_taskfile *t)
 {
@@ -186,15 +578,41 @@ static void drive_failed(struct ide_taskfile *tf)
   ready(tf);
 }
 
+static int ide_read_sector(struct ide_drive *d);
+static void ide_set_error(struct ide_drive *d);
+
+/* DRQ once the sectors of the next block are in, BSY until then */
+static void block_status(struct ide_drive *d)
+{
+  struct ide_taskfile *tf = &d->taskfile;
+  struct ide_buf *b = d->xfer;
+  int r = b ? buf_ready(d->io, b, d->offset - b->lba + d->block, 0) : 1;
+  if (r == 0) {
+    tf->status |= ST_BSY;
+    tf->status &= ~ST_DRQ;
+    return;
+  }
+  tf->status &= ~ST_BSY;
+  tf->status |= ST_DRQ;
+  /* A block whose first sector could not be read fails now */
+  if (r < 0 && buf_ready(d->io, b, d->offset - b->lba + 1, 0) < 0 && ide_read_sector(d) < 0)
+    ide_set_error(d);
+}
+
+static void next_block(struct ide_drive *d)
+{
+  d->block = d->length < d->blocking ? d->length : d->blocking;
+}
+
 static void data_in_state(struct ide_taskfile *tf)
 {
   struct ide_drive *d = tf->drive;
   d->state = IDE_DATA_IN;
-  d->dptr = d->data + 512;
+  d->dptr = d->dend = NULL;
+  next_block(d);
   /* We don't clear DRDY here, drives may well accept a command at this
      point and at least one firmware for RC2014 assumes this */
-  tf->status &= ~ST_BSY;
-  tf->status |= ST_DRQ;
+  block_status(d);
   d->intrq = 1;			/* Double check */
 }
 
@@ -202,7 +620,7 @@ static void data_out_state(struct ide_taskfile *tf)
 {
   struct ide_drive *d = tf->drive;
   d->state = IDE_DATA_OUT;
-  d->dptr = d->data;
+  next_block(d);
   tf->status &= ~ (ST_BSY|ST_DRDY);
   tf->status |= ST_DRQ;
   d->intrq = 1;			/* Double check */
@@ -221,6 +639,10 @@ static void edd_setup(struct ide_taskfile *tf)
 
 void ide_reset(struct ide_controller *c)
 {
+  int i;
+  for (i = 0; i < 2; i++)
+    if (c->drive[i].present)
+      io_drain_writes(c->drive[i].io);
   if (c->drive[0].present) {
     edd_setup(&c->drive[0].taskfile);
     /* A drive could clear busy then set DRDY up to 2 minutes later if its
@@ -276,10 +698,12 @@ static void cmd_identify_complete(struct ide_taskfile *tf)
 {
   struct ide_drive *d = tf->drive;
   memcpy(d->data, d->identify, 512);
+  d->xfer = NULL;
+  d->length = d->blocking = 1;
   data_in_state(tf);
   /* Arrange to copy just the identify buffer */
   d->dptr = d->data;
-  d->length = 1;
+  d->dend = d->data + 512;
 }
 
 static void cmd_initparam_complete(struct ide_taskfile *tf)
@@ -298,6 +722,36 @@ static void cmd_initparam_complete(struct ide_taskfile *tf)
   completed(tf);
 }
 
+/* Sectors per DRQ block of a read or write, or abort one with no
+   multiple mode set */
+static int ide_blocking(struct ide_taskfile *tf)
+{
+  struct ide_drive *d = tf->drive;
+  if (tf->command != IDE_CMD_READ_MULTIPLE && tf->command != IDE_CMD_WRITE_MULTIPLE)
+    d->blocking = 1;
+  else if ((d->blocking = d->multiple) == 0) {
+    tf->status |= ST_ERR;
+    tf->error |= ERR_ABRT;
+    completed(tf);
+    return -1;
+  }
+  return 0;
+}
+
+static void cmd_setmultiple_complete(struct ide_taskfile *tf)
+{
+  struct ide_drive *d = tf->drive;
+  /* A power of two up to the maximum, 0 turns it off */
+  if (tf->count > IDE_MAX_MULTIPLE || (tf->count & (tf->count - 1))) {
+    tf->status |= ST_ERR;
+    tf->error |= ERR_ABRT;
+  } else {
+    d->multiple = tf->count;
+    d->identify[59] = le16(tf->count ? 0x100 | tf->count : 0);
+  }
+  completed(tf);
+}
+
 static void cmd_readsectors_complete(struct ide_taskfile *tf)
 {
   struct ide_drive *d = tf->drive;
@@ -306,6 +760,8 @@ static void cmd_readsectors_complete(struct ide_taskfile *tf)
     drive_failed(tf);
     return;
   }
+  if (ide_blocking(tf) < 0)
+    return;
   d->offset = xlate_block(tf);
   /* DRDY is not guaranteed here but at least one buggy RC2014 firmware
      expects it */
@@ -323,6 +779,7 @@ static void cmd_readsectors_complete(struct ide_taskfile *tf)
     return;
   }
   /* do the xfer */
+  ide_read_start(d);
   data_in_state(tf);
 }
 
@@ -407,6 +864,8 @@ static void cmd_writesectors_complete(struct ide_taskfile *tf)
     drive_failed(tf);
     return;
   }
+  if (ide_blocking(tf) < 0)
+    return;
   d->offset = xlate_block(tf);
   tf->status |= ST_DRQ;
   /* 0 = 256 sectors */
@@ -421,6 +880,7 @@ static void cmd_writesectors_complete(struct ide_taskfile *tf)
     return;
   }
   /* do the xfer */
+  ide_write_start(d);
   data_out_state(tf);
 }
 
@@ -447,36 +907,38 @@ static void ide_set_error(struct ide_drive *d)
   completed(&d->taskfile);
 }
 
-static int ide_read_sector(struct ide_drive *d)
+static void cmd_flush_complete(struct ide_taskfile *tf)
 {
-  int len;
-
-  d->dptr = d->data;
-  if ((len = read(d->fd, d->data, 512)) != 512) {
-    perror("ide_read_sector");
-    d->taskfile.status |= ST_ERR;
-    d->taskfile.status &= ~ST_DSC;
-    ide_xlate_errno(&d->taskfile, len);
-    return -1;
+  struct ide_drive *d = tf->drive;
+  io_drain_writes(d->io);
+  if (ide_write_failed(d)) {
+    ide_set_error(d);
+    return;
   }
-//  hexdump(d->data);
-  d->offset += 512;
-  return 0;
+  if (fsync(d->fd) == -1)
+    ide_xlate_errno(tf, -1);
+  completed(tf);
 }
 
-static int ide_write_sector(struct ide_drive *d)
+/* Wait for the next sector of the command's buffer */
+static int ide_read_sector(struct ide_drive *d)
 {
-  int len;
+  struct ide_buf *b = d->xfer;
+  int i = d->offset - b->lba;
 
-  d->dptr = d->data;
-  if ((len = write(d->fd, d->data, 512)) != 512) {
+  if (buf_ready(d->io, b, i + 1, 1) < 0) {
+    errno = b->err;
+    perror("ide_read_sector");
     d->taskfile.status |= ST_ERR;
     d->taskfile.status &= ~ST_DSC;
-    ide_xlate_errno(&d->taskfile, len);
+    ide_xlate_errno(&d->taskfile, b->err ? -1 : 0);
     return -1;
   }
-//  hexdump(d->data);
-  d->offset += 512;
+//  hexdump(b->data + 512 * i);
+  if (d->taskfile.status & ST_BSY)
+    block_status(d);
+  d->dptr = b->data + 512 * i;
+  d->dend = d->dptr + 512;
   return 0;
 }
 
@@ -484,7 +946,7 @@ static uint16_t ide_data_in(struct ide_drive *d, int len)
 {
   uint16_t v;
   if (d->state == IDE_DATA_IN) {
-    if (d->dptr == d->data + 512) {
+    if (d->dptr == d->dend) {
       if (ide_read_sector(d) < 0) {
         ide_set_error(d);	/* Set the LBA or CHS etc */
         return 0xFFFF;		/* and error bits set by read_sector */
@@ -498,12 +960,16 @@ static uint16_t ide_data_in(struct ide_drive *d, int len)
     } else
       d->dptr++;
     d->taskfile.data = v;
-    if (d->dptr == d->data + 512) {
+    if (d->dptr == d->dend) {
+      d->offset++;
       d->length--;
-      d->intrq = 1;		/* we don't yet emulate multimode */
       if (d->length == 0) {
         d->state = IDE_IDLE;
         completed(&d->taskfile);
+      } else if (--d->block == 0) {
+        next_block(d);
+        block_status(d);
+        d->intrq = 1;
       }
     }
   } else
@@ -528,17 +994,24 @@ static void ide_data_out(struct ide_drive *d, uint16_t v, int len)
       *d->dptr++ = v >> 8;
       d->taskfile.data = v >> 8;
     }
-    if (d->dptr == d->data + 512) {
-      if (ide_write_sector(d) < 0) {
-        ide_set_error(d);
-        return;	
-      }
+    if (d->dptr == d->dend) {
+      d->offset++;
       d->length--;
-      d->intrq = 1;
       if (d->length == 0) {
+        ide_write_end(d, d->xfer->count);
+        if (ide_write_failed(d)) {
+          ide_set_error(d);
+          return;
+        }
         d->state = IDE_IDLE;
         d->taskfile.status |= ST_DSC;
         completed(&d->taskfile);
+      } else {
+        d->dend += 512;
+        if (--d->block == 0) {
+          next_block(d);
+          d->intrq = 1;
+        }
       }
     }
   }
@@ -546,10 +1019,19 @@ static void ide_data_out(struct ide_drive *d, uint16_t v, int len)
 
 static void ide_issue_command(struct ide_taskfile *t)
 {
+  struct ide_drive *d = t->drive;
+
+  /* A write cut short keeps the sectors it had */
+  if (d->state == IDE_DATA_OUT && d->xfer)
+    ide_write_end(d, d->offset - d->xfer->lba);
   t->status &= ~(ST_ERR|ST_DRDY);
   t->status |= ST_BSY;
   t->error = 0;
   t->drive->state = IDE_CMD;
+  if (ide_write_failed(d)) {
+    ide_set_error(d);
+    return;
+  }
   
   /* We could complete with delays but don't do so yet */
   switch(t->command) {
@@ -564,6 +1046,7 @@ static void ide_issue_command(struct ide_taskfile *t)
       break;
     case IDE_CMD_READ:		/* 0x20 */
     case IDE_CMD_READ_NR:	/* 0x21 */
+    case IDE_CMD_READ_MULTIPLE:	/* 0xC4 */
       cmd_readsectors_complete(t);
       break;
     case IDE_CMD_SETFEATURES:	/* 0xEF */
@@ -575,8 +1058,15 @@ static void ide_issue_command(struct ide_taskfile *t)
       break;
     case IDE_CMD_WRITE:		/* 0x30 */
     case IDE_CMD_WRITE_NR:	/* 0x31 */
+    case IDE_CMD_WRITE_MULTIPLE:	/* 0xC5 */
       cmd_writesectors_complete(t);
       break;
+    case IDE_CMD_SET_MULTIPLE:	/* 0xC6 */
+      cmd_setmultiple_complete(t);
+      break;
+    case IDE_CMD_FLUSH_CACHE:	/* 0xE7 */
+      cmd_flush_complete(t);
+      break;
     default:
       if ((t->command & 0xF0) == IDE_CMD_CALIB)	/* 1x */
         cmd_recalibrate_complete(t);
@@ -617,6 +1107,8 @@ uint8_t ide_read8(struct ide_controller *c, uint8_t r)
     case ide_status_r:
       d->intrq = 0;		/* Acked */
     case ide_altst_r:
+      if (d->state == IDE_DATA_IN && (t->status & ST_BSY))
+        block_status(d);
       return t->status;
     default:
       ide_fault(d, "bogus register");
@@ -750,8 +1242,15 @@ int ide_attach(struct ide_controller *c, int drive, int fd)
     ide_fault(d, "bad magic");
     return -1;
   }
+  if (ide_io_start(d) < 0) {
+    ide_fault(d, "out of memory on attach");
+    return -1;
+  }
   d->fd = fd;
   d->present = 1;
+  d->multiple = 0;
+  d->identify[47] = le16(0x8000 | IDE_MAX_MULTIPLE);
+  d->identify[59] = 0;
   d->heads = d->identify[3];
   d->sectors = d->identify[6];
   d->cylinders = le16(d->identify[1]);
@@ -767,6 +1266,7 @@ int ide_attach(struct ide_controller *c, int drive, int fd)
  */
 void ide_detach(struct ide_drive *d)
 {
+  ide_io_stop(d);
   close(d->fd);
   d->fd = -1;
   d->present = 0;
@@ -855,7 +1355,7 @@ int ide_make_drive(uint8_t type, int fd)
   memset(ident, 0, 8);
   ident[0] = le16((1 << 15) | (1 << 6));	/* Non removable */
   make_serial(ident + 10);
-  ident[47] = 0; /* no read multi for now */
+  ident[47] = le16(0x8000 | IDE_MAX_MULTIPLE);
   ident[51] = le16(240 /* PIO2 */ << 8);	/* PIO cycle time */
   ident[53] = le16(1);		/* Geometry words are valid */
   
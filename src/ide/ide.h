@@ -42,6 +42,9 @@ struct ide_taskfile {
   struct ide_drive *drive;
 };
 
+struct ide_buf;
+struct ide_io;
+
 struct ide_drive {
   struct ide_controller *controller;
   struct ide_taskfile taskfile;
@@ -51,10 +54,16 @@ struct ide_drive {
   uint8_t data[512];
   uint16_t identify[256];
   uint8_t *dptr;
+  uint8_t *dend;		/* end of the sector being moved */
   int state;
   int fd;
   off_t offset;
   int length;
+  int block;			/* sectors left in this DRQ block */
+  uint8_t multiple;		/* sectors per block of READ/WRITE MULTIPLE */
+  uint8_t blocking;		/* sectors per block of this command */
+  struct ide_buf *xfer;		/* buffer of this command */
+  struct ide_io *io;		/* buffers and I/O thread */
 };
 
 struct ide_controller {
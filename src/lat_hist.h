@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Lock-free log2 latency histograms.
+ *
+ * Bucket i counts samples in [2^i, 2^(i+1)) nanoseconds, so 32 buckets cover
+ * everything from 1ns to ~4s. Samples may be recorded from any thread; all
+ * updates are relaxed atomics, which is enough for statistics and never
+ * blocks the CPU thread.
+ */
+
+#ifndef PISTORM_LAT_HIST_H
+#define PISTORM_LAT_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define LAT_HIST_BUCKETS 32
+
+struct lat_hist {
+  uint64_t bucket[LAT_HIST_BUCKETS];
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t max_ns;
+};
+
+static inline uint64_t lat_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline unsigned int lat_hist_bucket(uint64_t ns) {
+  if (ns < 2) {
+    return 0;
+  }
+  unsigned int b = 63u - (unsigned int)__builtin_clzll(ns);
+  return b >= LAT_HIST_BUCKETS ? LAT_HIST_BUCKETS - 1 : b;
+}
+
+static inline void lat_hist_add(struct lat_hist* h, uint64_t ns) {
+  __atomic_fetch_add(&h->bucket[lat_hist_bucket(ns)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+
+  uint64_t cur = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+  while (ns > cur &&
+         !__atomic_compare_exchange_n(&h->max_ns, &cur, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static inline void lat_hist_reset(struct lat_hist* h) {
+  for (unsigned int i = 0; i < LAT_HIST_BUCKETS; i++) {
+    __atomic_store_n(&h->bucket[i], 0, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&h->count, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->sum_ns, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->max_ns, 0, __ATOMIC_RELAXED);
+}
+
+// Upper bound of the bucket holding the given percentile (0-100), in ns.
+static inline uint64_t lat_hist_percentile(const struct lat_hist* h, unsigned int pct) {
+  uint64_t total = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+  if (!total) {
+    return 0;
+  }
+  uint64_t want = (total * pct + 99u) / 100u;
+  uint64_t seen = 0;
+  for (unsigned int i = 0; i < LAT_HIST_BUCKETS; i++) {
+    seen += __atomic_load_n(&h->bucket[i], __ATOMIC_RELAXED);
+    if (seen >= want) {
+      return 2ull << i;
+    }
+  }
+  return __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+}
+
+static inline void lat_hist_print(FILE* out, const char* name, const struct lat_hist* h) {
+  uint64_t n = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+  if (!n) {
+    fprintf(out, "%s: no samples\n", name);
+    return;
+  }
+  fprintf(out, "%s: n=%llu avg=%lluus p50<=%lluus p90<=%lluus p99<=%lluus max=%lluus\n", name,
+          (unsigned long long)n,
+          (unsigned long long)(__atomic_load_n(&h->sum_ns, __ATOMIC_RELAXED) / n / 1000u),
+          (unsigned long long)(lat_hist_percentile(h, 50) / 1000u),
+          (unsigned long long)(lat_hist_percentile(h, 90) / 1000u),
+          (unsigned long long)(lat_hist_percentile(h, 99) / 1000u),
+          (unsigned long long)(__atomic_load_n(&h->max_ns, __ATOMIC_RELAXED) / 1000u));
+}
+
+#endif /* PISTORM_LAT_HIST_H */
@@ -1,10 +1,16 @@
 // SPDX-License-Identifier: MIT
 
+#define _GNU_SOURCE // pthread_setname_np
+
 #include "log.h"
 
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
+#include <unistd.h>
 
 static int log_level = LOG_LEVEL_INFO;
 static FILE* log_fp = NULL;
@@ -117,3 +123,353 @@ void log_message(int level, const char* fmt, ...) {
     fflush(log_fp);
   }
 }
+
+/*
+ * Deferred event logging. Each producing thread claims one single-producer /
+ * single-consumer ring on its first LOG_EVENT() and gives it back when it
+ * exits; the rings are static so the hot path never allocates. A ring handed
+ * to a new thread keeps any events still queued in it. A thread that finds
+ * them all taken drops its events and tries again once another thread has
+ * given a ring back. The writer thread merges the rings by timestamp so
+ * output from different threads stays in order.
+ */
+
+#define LOG_RING_COUNT 16
+#define LOG_RING_SIZE 512 // entries, power of two
+#define LOG_LINE_MAX 512
+
+struct log_event_entry {
+  uint64_t ts_ns;
+  const char* fmt;
+  uint64_t args[LOG_EVENT_MAX_ARGS];
+  uint8_t level;
+  uint8_t nargs;
+};
+
+struct log_ring {
+  uint32_t head; // written by the producer
+  uint32_t tail; // written by the writer thread
+  uint8_t owned; // a thread produces into it
+  uint64_t dropped;
+  struct log_event_entry ev[LOG_RING_SIZE];
+};
+
+static struct log_ring log_rings[LOG_RING_COUNT];
+static uint32_t log_rings_used = 0; // one past the highest ring ever claimed
+static uint64_t log_no_ring_dropped = 0;
+static uint32_t log_rings_released = 0; // bumped whenever a thread gives its ring back
+static __thread struct log_ring* log_tls_ring = NULL;
+static __thread uint8_t log_tls_claim_failed = 0;
+static __thread uint32_t log_tls_claim_released; // log_rings_released at the failed claim
+static pthread_key_t log_ring_key;
+static pthread_once_t log_ring_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_t log_writer_tid;
+static uint8_t log_async_running = 0;
+static uint8_t log_async_exit = 0;
+
+static void log_release_ring(void* ring) {
+  __atomic_store_n(&((struct log_ring*)ring)->owned, 0, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&log_rings_released, 1, __ATOMIC_RELEASE);
+}
+
+static void log_make_ring_key(void) {
+  pthread_key_create(&log_ring_key, log_release_ring);
+}
+
+// Takes the first ring no running thread owns, or NULL if all are taken.
+static struct log_ring* log_claim_ring(void) {
+  pthread_once(&log_ring_key_once, log_make_ring_key);
+  for (uint32_t i = 0; i < LOG_RING_COUNT; i++) {
+    uint8_t unowned = 0;
+    if (__atomic_compare_exchange_n(&log_rings[i].owned, &unowned, 1, 0, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_RELAXED)) {
+      uint32_t used = __atomic_load_n(&log_rings_used, __ATOMIC_RELAXED);
+      while (used <= i && !__atomic_compare_exchange_n(&log_rings_used, &used, i + 1, 0,
+                                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+      }
+      pthread_setspecific(log_ring_key, &log_rings[i]);
+      return &log_rings[i];
+    }
+  }
+  return NULL;
+}
+
+static uint64_t log_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+
+// The 64-bit argument slot cut back to the width its length modifier names,
+// so a negative int printed with %x shows 32 bits, not 64.
+static uint64_t log_arg_unsigned(uint64_t v, unsigned int bytes) {
+  return bytes < sizeof(v) ? v & ((1ull << (bytes * 8)) - 1) : v;
+}
+
+static long long log_arg_signed(uint64_t v, unsigned int bytes) {
+  if (bytes >= sizeof(v)) {
+    return (long long)v;
+  }
+  uint64_t sign = 1ull << (bytes * 8 - 1);
+  v = log_arg_unsigned(v, bytes);
+  return (long long)(v ^ sign) - (long long)sign;
+}
+
+// Formats one event. Each conversion spec is rebuilt with an "ll" length
+// modifier so the 64-bit argument slot is passed with a matching type, after
+// narrowing it to the type the original modifier stood for.
+static void log_format_event(char* out, size_t out_len, const char* fmt, const uint64_t* args,
+                             unsigned int nargs) {
+  size_t o = 0;
+  unsigned int a = 0;
+
+#define LOG_PUT(...)                                                                               \
+  do {                                                                                             \
+    if (o < out_len) {                                                                             \
+      int n_ = snprintf(out + o, out_len - o, __VA_ARGS__);                                        \
+      if (n_ > 0) {                                                                                \
+        o += (size_t)n_;                                                                           \
+      }                                                                                            \
+    }                                                                                              \
+  } while (0)
+
+  while (*fmt && o + 1 < out_len) {
+    if (*fmt != '%') {
+      out[o++] = *fmt++;
+      continue;
+    }
+    if (fmt[1] == '%') {
+      out[o++] = '%';
+      fmt += 2;
+      continue;
+    }
+
+    char spec[32];
+    size_t s = 0;
+    spec[s++] = *fmt++;
+    while (*fmt && strchr("-+ #0123456789.", *fmt) && s < sizeof(spec) - 4) {
+      spec[s++] = *fmt++;
+    }
+    unsigned int bytes = sizeof(int);
+    if (*fmt == 'h') {
+      bytes = fmt[1] == 'h' ? sizeof(char) : sizeof(short);
+    } else if (*fmt == 'l') {
+      bytes = fmt[1] == 'l' ? sizeof(long long) : sizeof(long);
+    } else if (*fmt == 'z') {
+      bytes = sizeof(size_t);
+    } else if (*fmt == 'j' || *fmt == 'L') {
+      bytes = sizeof(long long);
+    } else if (*fmt == 't') {
+      bytes = sizeof(ptrdiff_t);
+    }
+    while (*fmt && strchr("hlzjtL", *fmt)) {
+      fmt++;
+    }
+    char conv = *fmt;
+    if (!conv) {
+      break;
+    }
+    fmt++;
+
+    uint64_t v = a < nargs ? args[a] : 0;
+    a++;
+    switch (conv) {
+    case 'd':
+    case 'i':
+      spec[s++] = 'l';
+      spec[s++] = 'l';
+      spec[s++] = conv;
+      spec[s] = 0;
+      LOG_PUT(spec, log_arg_signed(v, bytes));
+      break;
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      spec[s++] = 'l';
+      spec[s++] = 'l';
+      spec[s++] = conv;
+      spec[s] = 0;
+      LOG_PUT(spec, (unsigned long long)log_arg_unsigned(v, bytes));
+      break;
+    case 'c':
+      spec[s++] = 'c';
+      spec[s] = 0;
+      LOG_PUT(spec, (int)v);
+      break;
+    case 's':
+      spec[s++] = 's';
+      spec[s] = 0;
+      LOG_PUT(spec, v ? (const char*)(uintptr_t)v : "(null)");
+      break;
+    case 'p':
+      LOG_PUT("0x%llx", (unsigned long long)v);
+      break;
+    default:
+      LOG_PUT("%%%c", conv);
+      break;
+    }
+  }
+#undef LOG_PUT
+
+  if (o >= out_len) {
+    o = out_len - 1;
+  }
+  out[o] = 0;
+}
+
+#pragma GCC diagnostic pop
+
+static void log_emit_line(int level, const char* line) {
+  fprintf(stdout, "[%s] %s", log_level_name(level), line);
+  if (log_fp) {
+    fprintf(log_fp, "[%s] %s", log_level_name(level), line);
+  }
+}
+
+// Writes out everything currently queued. Returns the number of events.
+static unsigned int log_drain(void) {
+  char line[LOG_LINE_MAX];
+  unsigned int written = 0;
+  uint32_t used = __atomic_load_n(&log_rings_used, __ATOMIC_ACQUIRE);
+  if (used > LOG_RING_COUNT) {
+    used = LOG_RING_COUNT;
+  }
+
+  for (;;) {
+    struct log_ring* next = NULL;
+    uint64_t next_ts = UINT64_MAX;
+
+    for (uint32_t i = 0; i < used; i++) {
+      struct log_ring* r = &log_rings[i];
+      uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+      if (r->tail != head) {
+        const struct log_event_entry* e = &r->ev[r->tail & (LOG_RING_SIZE - 1)];
+        if (e->ts_ns < next_ts) {
+          next_ts = e->ts_ns;
+          next = r;
+        }
+      }
+    }
+    if (!next) {
+      break;
+    }
+
+    const struct log_event_entry* e = &next->ev[next->tail & (LOG_RING_SIZE - 1)];
+    log_format_event(line, sizeof(line), e->fmt, e->args, e->nargs);
+    log_emit_line(e->level, line);
+    __atomic_store_n(&next->tail, next->tail + 1, __ATOMIC_RELEASE);
+    written++;
+  }
+
+  if (written) {
+    fflush(stdout);
+    if (log_fp) {
+      fflush(log_fp);
+    }
+  }
+  return written;
+}
+
+static void* log_writer_task(void* args) {
+  (void)args;
+  while (!__atomic_load_n(&log_async_exit, __ATOMIC_ACQUIRE)) {
+    if (!log_drain()) {
+      usleep(1000);
+    }
+  }
+  log_drain();
+  return NULL;
+}
+
+void log_event(int level, const char* fmt, const uint64_t* args, unsigned int nargs) {
+  if (level > log_level) {
+    return;
+  }
+  if (nargs > LOG_EVENT_MAX_ARGS) {
+    nargs = LOG_EVENT_MAX_ARGS;
+  }
+
+  if (!__atomic_load_n(&log_async_running, __ATOMIC_ACQUIRE)) {
+    char line[LOG_LINE_MAX];
+    log_format_event(line, sizeof(line), fmt, args, nargs);
+    log_emit_line(level, line);
+    fflush(stdout);
+    if (log_fp) {
+      fflush(log_fp);
+    }
+    return;
+  }
+
+  struct log_ring* r = log_tls_ring;
+  if (!r) {
+    // After a failed claim, only look again once a ring has been given back.
+    uint32_t released = __atomic_load_n(&log_rings_released, __ATOMIC_ACQUIRE);
+    if (!log_tls_claim_failed || released != log_tls_claim_released) {
+      log_tls_ring = r = log_claim_ring();
+      log_tls_claim_failed = r == NULL;
+      log_tls_claim_released = released;
+    }
+    if (!r) {
+      __atomic_fetch_add(&log_no_ring_dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+
+  uint32_t head = r->head;
+  if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE) {
+    __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  struct log_event_entry* e = &r->ev[head & (LOG_RING_SIZE - 1)];
+  e->ts_ns = log_now_ns();
+  e->fmt = fmt;
+  e->level = (uint8_t)level;
+  e->nargs = (uint8_t)nargs;
+  for (unsigned int i = 0; i < nargs; i++) {
+    e->args[i] = args[i];
+  }
+  __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void log_async_start(void) {
+  if (log_async_running) {
+    return;
+  }
+  log_async_exit = 0;
+  int err = pthread_create(&log_writer_tid, NULL, &log_writer_task, NULL);
+  if (err != 0) {
+    log_message(LOG_LEVEL_WARN, "[LOG] Cannot create log writer thread: [%s]\n", strerror(err));
+    return;
+  }
+  pthread_setname_np(log_writer_tid, "pistorm64: log");
+  __atomic_store_n(&log_async_running, 1, __ATOMIC_RELEASE);
+}
+
+void log_async_stop(void) {
+  if (!log_async_running) {
+    return;
+  }
+  __atomic_store_n(&log_async_running, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&log_async_exit, 1, __ATOMIC_RELEASE);
+  pthread_join(log_writer_tid, NULL);
+
+  uint64_t dropped = log_async_dropped();
+  if (dropped) {
+    log_message(LOG_LEVEL_WARN, "[LOG] %llu deferred log events were dropped.\n",
+                (unsigned long long)dropped);
+  }
+}
+
+uint64_t log_async_dropped(void) {
+  uint64_t dropped = __atomic_load_n(&log_no_ring_dropped, __ATOMIC_RELAXED);
+  for (uint32_t i = 0; i < LOG_RING_COUNT; i++) {
+    dropped += __atomic_load_n(&log_rings[i].dropped, __ATOMIC_RELAXED);
+  }
+  return dropped;
+}
@@ -4,6 +4,7 @@
 #define PISTORM_LOG_H
 
 #include <stdarg.h>
+#include <stdint.h>
 
 enum log_level {
   LOG_LEVEL_ERROR = 0,
@@ -22,4 +23,56 @@ void log_message(int level, const char* fmt, ...);
 #define LOG_INFO(...) log_message(LOG_LEVEL_INFO, __VA_ARGS__)
 #define LOG_DEBUG(...) log_message(LOG_LEVEL_DEBUG, __VA_ARGS__)
 
+/*
+ * Deferred binary logging for hot paths (CPU thread, bus handlers, device
+ * command tracing). LOG_EVENT() stores the format pointer and up to
+ * LOG_EVENT_MAX_ARGS integer arguments into a per-thread lock-free ring; a
+ * background thread started with log_async_start() does the formatting and
+ * the console/file I/O. When a ring is full the event is counted as dropped
+ * instead of blocking the caller.
+ *
+ * Rules for callers: the format string must be a literal (only the pointer is
+ * kept), every argument must be an integer or pointer, and %s arguments must
+ * point to static storage. Integer conversions may use any length modifier;
+ * arguments travel as 64 bits and are cut back to the modifier's width when
+ * formatted. A thread's ring is released when the thread exits. If the async thread is not
+ * running, events are formatted synchronously like log_message().
+ */
+#define LOG_EVENT_MAX_ARGS 6
+
+void log_event(int level, const char* fmt, const uint64_t* args, unsigned int nargs);
+void log_async_start(void);
+void log_async_stop(void);
+uint64_t log_async_dropped(void);
+
+static inline __attribute__((format(printf, 1, 2))) void log_event_format_check(const char* fmt, ...) {
+  (void)fmt;
+}
+
+#define LOG_EVENT_NARG_(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+#define LOG_EVENT_NARG(...) LOG_EVENT_NARG_(_, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_EVENT_A(x) , (uint64_t)(x)
+#define LOG_EVENT_ARGS_0()
+#define LOG_EVENT_ARGS_1(a) LOG_EVENT_A(a)
+#define LOG_EVENT_ARGS_2(a, ...) LOG_EVENT_A(a) LOG_EVENT_ARGS_1(__VA_ARGS__)
+#define LOG_EVENT_ARGS_3(a, ...) LOG_EVENT_A(a) LOG_EVENT_ARGS_2(__VA_ARGS__)
+#define LOG_EVENT_ARGS_4(a, ...) LOG_EVENT_A(a) LOG_EVENT_ARGS_3(__VA_ARGS__)
+#define LOG_EVENT_ARGS_5(a, ...) LOG_EVENT_A(a) LOG_EVENT_ARGS_4(__VA_ARGS__)
+#define LOG_EVENT_ARGS_6(a, ...) LOG_EVENT_A(a) LOG_EVENT_ARGS_5(__VA_ARGS__)
+#define LOG_EVENT_CAT_(a, b) a##b
+#define LOG_EVENT_CAT(a, b) LOG_EVENT_CAT_(a, b)
+
+#define LOG_EVENT(level, fmt, ...)                                                                 \
+  do {                                                                                             \
+    if (0) {                                                                                       \
+      log_event_format_check(fmt, ##__VA_ARGS__);                                                  \
+    }                                                                                              \
+    const uint64_t log_event_args_[] = {                                                           \
+        0 LOG_EVENT_CAT(LOG_EVENT_ARGS_, LOG_EVENT_NARG(__VA_ARGS__))(__VA_ARGS__)};               \
+    log_event((level), (fmt), log_event_args_ + 1, LOG_EVENT_NARG(__VA_ARGS__));                  \
+  } while (0)
+
+#define LOG_FAST_INFO(...) LOG_EVENT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_FAST_DEBUG(...) LOG_EVENT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
 #endif
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: MIT
+
+#include "irq_latency.h"
+
+uint8_t irq_lat_enabled = 0;
+uint64_t irq_lat_edge_ns = 0;
+uint64_t irq_lat_set_ns[IRQ_LAT_LEVELS];
+uint64_t irq_lat_set_edge_ns[IRQ_LAT_LEVELS];
+struct lat_hist irq_lat_hist[IRQ_LAT_LEVELS][IRQ_LAT_STAGES];
+
+static const char* stage_names[IRQ_LAT_STAGES] = {
+    "edge->set",
+    "set->vector",
+    "edge->vector",
+};
+
+const char* irq_lat_stage_name(enum irq_lat_stage stage) {
+  return stage < IRQ_LAT_STAGES ? stage_names[stage] : "?";
+}
+
+void irq_lat_enable(int enable) {
+  if (enable) {
+    // Stop sampling while the tables are wiped; stale stamps would otherwise
+    // turn into multi-second samples.
+    __atomic_store_n(&irq_lat_enabled, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&irq_lat_edge_ns, 0, __ATOMIC_RELAXED);
+    for (unsigned int l = 0; l < IRQ_LAT_LEVELS; l++) {
+      __atomic_store_n(&irq_lat_set_ns[l], 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&irq_lat_set_edge_ns[l], 0, __ATOMIC_RELAXED);
+      for (unsigned int s = 0; s < IRQ_LAT_STAGES; s++) {
+        lat_hist_reset(&irq_lat_hist[l][s]);
+      }
+    }
+  }
+  __atomic_store_n(&irq_lat_enabled, enable ? 1 : 0, __ATOMIC_RELEASE);
+}
+
+void irq_lat_print(FILE* out) {
+  for (unsigned int l = 1; l < IRQ_LAT_LEVELS; l++) {
+    if (!__atomic_load_n(&irq_lat_hist[l][IRQ_LAT_SET_TO_VECTOR].count, __ATOMIC_RELAXED) &&
+        !__atomic_load_n(&irq_lat_hist[l][IRQ_LAT_EDGE_TO_SET].count, __ATOMIC_RELAXED)) {
+      continue;
+    }
+    for (unsigned int s = 0; s < IRQ_LAT_STAGES; s++) {
+      char name[48];
+      snprintf(name, sizeof(name), "[IRQ] Level %u %s", l, stage_names[s]);
+      lat_hist_print(out, name, &irq_lat_hist[l][s]);
+    }
+  }
+}
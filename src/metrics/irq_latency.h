@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_IRQ_LATENCY_H
+#define PISTORM_IRQ_LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "lat_hist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Interrupt path latency, per 68k interrupt level.
+ *
+ * Three points are timestamped:
+ *   edge   - the IPL thread (or an emulated source) first sees IPL asserted
+ *   set    - the CPU thread hands the new level to the core (M68K_SET_IRQ)
+ *   vector - Musashi takes the interrupt exception
+ *
+ * and three histograms are kept per level: edge->set, set->vector and the
+ * end-to-end edge->vector. Sampling is off by default and costs one
+ * predictable branch per hook while off; it can be toggled at runtime so
+ * loop_cycles / IPL NOP count / affinity settings can be compared on the
+ * same running system.
+ */
+
+#define IRQ_LAT_LEVELS 8
+
+enum irq_lat_stage {
+  IRQ_LAT_EDGE_TO_SET,
+  IRQ_LAT_SET_TO_VECTOR,
+  IRQ_LAT_EDGE_TO_VECTOR,
+  IRQ_LAT_STAGES,
+};
+
+extern uint8_t irq_lat_enabled;
+
+// Pending edge, written by the IPL/device threads and consumed by the CPU
+// thread. Only the first edge of an assertion is kept.
+extern uint64_t irq_lat_edge_ns;
+
+// CPU thread only.
+extern uint64_t irq_lat_set_ns[IRQ_LAT_LEVELS];
+extern uint64_t irq_lat_set_edge_ns[IRQ_LAT_LEVELS];
+extern struct lat_hist irq_lat_hist[IRQ_LAT_LEVELS][IRQ_LAT_STAGES];
+
+static inline void irq_lat_mark_edge(void) {
+  if (__builtin_expect(!irq_lat_enabled, 1)) {
+    return;
+  }
+  uint64_t none = 0;
+  __atomic_compare_exchange_n(&irq_lat_edge_ns, &none, lat_now_ns(), 0, __ATOMIC_RELEASE,
+                              __ATOMIC_RELAXED);
+}
+
+// Called by the CPU thread each time it re-evaluates the interrupt level.
+// level is the new level if it changed, or 0 if the edge was absorbed
+// without a level change (already pending, spurious).
+static inline void irq_lat_mark_set(unsigned int level) {
+  if (__builtin_expect(!irq_lat_enabled, 1)) {
+    return;
+  }
+  uint64_t edge = __atomic_exchange_n(&irq_lat_edge_ns, 0, __ATOMIC_ACQUIRE);
+  if (!level || level >= IRQ_LAT_LEVELS) {
+    return;
+  }
+  uint64_t now = lat_now_ns();
+  if (edge && now >= edge) {
+    lat_hist_add(&irq_lat_hist[level][IRQ_LAT_EDGE_TO_SET], now - edge);
+  }
+  // Keep the oldest stamp if the level is re-set before it is serviced.
+  if (!irq_lat_set_ns[level]) {
+    irq_lat_set_ns[level] = now;
+    irq_lat_set_edge_ns[level] = edge;
+  }
+}
+
+static inline void irq_lat_mark_vector(unsigned int level) {
+  if (__builtin_expect(!irq_lat_enabled, 1) || level >= IRQ_LAT_LEVELS) {
+    return;
+  }
+  uint64_t set = irq_lat_set_ns[level];
+  if (!set) {
+    return;
+  }
+  uint64_t now = lat_now_ns();
+  lat_hist_add(&irq_lat_hist[level][IRQ_LAT_SET_TO_VECTOR], now - set);
+  if (irq_lat_set_edge_ns[level]) {
+    lat_hist_add(&irq_lat_hist[level][IRQ_LAT_EDGE_TO_VECTOR], now - irq_lat_set_edge_ns[level]);
+  }
+  irq_lat_set_ns[level] = 0;
+  irq_lat_set_edge_ns[level] = 0;
+}
+
+// The level was dropped before the core serviced it.
+static inline void irq_lat_mark_clear(void) {
+  if (__builtin_expect(!irq_lat_enabled, 1)) {
+    return;
+  }
+  for (unsigned int i = 0; i < IRQ_LAT_LEVELS; i++) {
+    irq_lat_set_ns[i] = 0;
+    irq_lat_set_edge_ns[i] = 0;
+  }
+}
+
+// Enabling resets the histograms so every window starts clean. Safe to call
+// from a signal handler.
+void irq_lat_enable(int enable);
+const char* irq_lat_stage_name(enum irq_lat_stage stage);
+void irq_lat_print(FILE* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PISTORM_IRQ_LATENCY_H */
@@ -0,0 +1,395 @@
+// SPDX-License-Identifier: MIT
+
+#define _GNU_SOURCE // pthread_setname_np
+
+#include "metrics.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "health/rpi_health.h"
+#include "irq_latency.h"
+#include "log.h"
+#include "platforms/amiga/amiga-interrupts.h"
+
+#define METRICS_BUF_SIZE 32768
+
+struct pistorm_metrics pistorm_metrics;
+
+static const char* width_names[3] = {"8", "16", "32"};
+
+static int metrics_fd = -1;
+static char metrics_unix_path[108];
+static pthread_t metrics_tid;
+static uint8_t metrics_running = 0;
+static uint8_t metrics_exit = 0;
+
+struct metrics_out {
+  char* buf;
+  unsigned int len;
+  unsigned int pos;
+};
+
+static __attribute__((format(printf, 2, 3))) void mo_printf(struct metrics_out* o, const char* fmt, ...) {
+  if (o->pos >= o->len) {
+    return;
+  }
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(o->buf + o->pos, o->len - o->pos, fmt, args);
+  va_end(args);
+  if (n > 0) {
+    o->pos += (unsigned int)n;
+    if (o->pos > o->len) {
+      o->pos = o->len;
+    }
+  }
+}
+
+static uint64_t ld(const uint64_t* p) {
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static void mo_counter(struct metrics_out* o, const char* name, const char* help, uint64_t v) {
+  mo_printf(o, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name,
+            (unsigned long long)v);
+}
+
+static void mo_gauge(struct metrics_out* o, const char* name, const char* help, uint64_t v) {
+  mo_printf(o, "# HELP %s %s\n# TYPE %s gauge\n%s %llu\n", name, help, name, name,
+            (unsigned long long)v);
+}
+
+unsigned int metrics_format(char* buf, unsigned int len) {
+  struct metrics_out o = {buf, len, 0};
+  const struct pistorm_metrics* m = &pistorm_metrics;
+
+  mo_printf(&o, "# HELP pistorm_bus_ops_total Bus operations issued to the Amiga side.\n");
+  mo_printf(&o, "# TYPE pistorm_bus_ops_total counter\n");
+  for (int w = 0; w < 3; w++) {
+    mo_printf(&o, "pistorm_bus_ops_total{dir=\"read\",width=\"%s\"} %llu\n", width_names[w],
+              (unsigned long long)ld(&m->bus_reads[w]));
+    mo_printf(&o, "pistorm_bus_ops_total{dir=\"write\",width=\"%s\"} %llu\n", width_names[w],
+              (unsigned long long)ld(&m->bus_writes[w]));
+  }
+  mo_counter(&o, "pistorm_bus_status_ops_total", "Status register reads and writes.",
+             ld(&m->bus_status_ops));
+  mo_counter(&o, "pistorm_bus_ioctls_total", "ioctl() calls made for bus traffic.",
+             ld(&m->bus_ioctls));
+  mo_counter(&o, "pistorm_bus_batches_total", "Batched bus op submissions.", ld(&m->bus_batches));
+  mo_counter(&o, "pistorm_bus_batch_ops_total", "Bus ops submitted through batches.",
+             ld(&m->bus_batch_ops));
+  mo_gauge(&o, "pistorm_bus_batch_max", "Largest batch submitted so far.", ld(&m->bus_batch_max));
+
+  mo_counter(&o, "pistorm_cpu_slices_total", "CPU execution slices run.", ld(&m->cpu_slices));
+  mo_counter(&o, "pistorm_cpu_instructions_total", "Emulated 68k instructions executed.",
+             ld(&m->cpu_instructions));
+  mo_counter(&o, "pistorm_cpu_cycles_total", "Emulated 68k cycles consumed (slice budget when a slice is cut short).", ld(&m->cpu_cycles));
+  mo_counter(&o, "pistorm_cpu_irq_level_changes_total", "Interrupt level changes handed to the CPU core.",
+             ld(&m->cpu_irq_level_changes));
+
+  mo_printf(&o, "# HELP pistorm_emulated_irqs_total Emulated interrupts raised, per INTREQ source.\n");
+  mo_printf(&o, "# TYPE pistorm_emulated_irqs_total counter\n");
+  struct amiga_irq_stats st[AMIGA_IRQ_COUNT];
+  for (int i = 0; i < AMIGA_IRQ_COUNT; i++) {
+    amiga_get_irq_stats((AMIGA_IRQ)i, &st[i]);
+    mo_printf(&o, "pistorm_emulated_irqs_total{source=\"%s\"} %llu\n", amiga_irq_name((AMIGA_IRQ)i),
+              (unsigned long long)st[i].raised);
+  }
+  mo_printf(&o, "# HELP pistorm_emulated_irq_ack_seconds Raise to acknowledge latency, per source.\n");
+  mo_printf(&o, "# TYPE pistorm_emulated_irq_ack_seconds summary\n");
+  for (int i = 0; i < AMIGA_IRQ_COUNT; i++) {
+    if (!st[i].acked) {
+      continue;
+    }
+    mo_printf(&o, "pistorm_emulated_irq_ack_seconds{source=\"%s\",quantile=\"0.5\"} %.9f\n",
+              amiga_irq_name((AMIGA_IRQ)i), (double)st[i].ack_p50_ns / 1e9);
+    mo_printf(&o, "pistorm_emulated_irq_ack_seconds{source=\"%s\",quantile=\"0.99\"} %.9f\n",
+              amiga_irq_name((AMIGA_IRQ)i), (double)st[i].ack_p99_ns / 1e9);
+    mo_printf(&o, "pistorm_emulated_irq_ack_seconds{source=\"%s\",quantile=\"1\"} %.9f\n",
+              amiga_irq_name((AMIGA_IRQ)i), (double)st[i].ack_max_ns / 1e9);
+    mo_printf(&o, "pistorm_emulated_irq_ack_seconds_count{source=\"%s\"} %llu\n",
+              amiga_irq_name((AMIGA_IRQ)i), (unsigned long long)st[i].acked);
+  }
+
+  static const char* lat_stage[IRQ_LAT_STAGES] = {"edge_to_set", "set_to_vector", "edge_to_vector"};
+  mo_gauge(&o, "pistorm_irq_latency_enabled", "IPL edge to vector sampling active (SIGUSR1 toggles).",
+           __atomic_load_n(&irq_lat_enabled, __ATOMIC_RELAXED));
+  mo_printf(&o, "# HELP pistorm_irq_latency_seconds IPL edge, M68K_SET_IRQ and vector latency, per level.\n");
+  mo_printf(&o, "# TYPE pistorm_irq_latency_seconds summary\n");
+  for (unsigned int l = 1; l < IRQ_LAT_LEVELS; l++) {
+    for (unsigned int s = 0; s < IRQ_LAT_STAGES; s++) {
+      const struct lat_hist* h = &irq_lat_hist[l][s];
+      uint64_t n = ld(&h->count);
+      if (!n) {
+        continue;
+      }
+      static const unsigned int pct[] = {50, 90, 99};
+      for (unsigned int q = 0; q < sizeof(pct) / sizeof(pct[0]); q++) {
+        mo_printf(&o, "pistorm_irq_latency_seconds{level=\"%u\",stage=\"%s\",quantile=\"0.%u\"} %.9f\n", l,
+                  lat_stage[s], pct[q], (double)lat_hist_percentile(h, pct[q]) / 1e9);
+      }
+      mo_printf(&o, "pistorm_irq_latency_seconds{level=\"%u\",stage=\"%s\",quantile=\"1\"} %.9f\n", l,
+                lat_stage[s], (double)ld(&h->max_ns) / 1e9);
+      mo_printf(&o, "pistorm_irq_latency_seconds_sum{level=\"%u\",stage=\"%s\"} %.9f\n", l, lat_stage[s],
+                (double)ld(&h->sum_ns) / 1e9);
+      mo_printf(&o, "pistorm_irq_latency_seconds_count{level=\"%u\",stage=\"%s\"} %llu\n", l,
+                lat_stage[s], (unsigned long long)n);
+    }
+  }
+
+  mo_counter(&o, "pistorm_rtg_frames_rendered_total", "RTG frames presented.",
+             ld(&m->rtg_frames_rendered));
+  mo_counter(&o, "pistorm_rtg_frames_skipped_total", "RTG frames not presented.",
+             ld(&m->rtg_frames_skipped));
+  mo_counter(&o, "pistorm_rtg_rows_uploaded_total", "Framebuffer rows converted and uploaded.",
+             ld(&m->rtg_rows_uploaded));
+  mo_printf(&o, "# HELP pistorm_rtg_thread_cpu_seconds_total CPU time used by the RTG output thread.\n"
+                "# TYPE pistorm_rtg_thread_cpu_seconds_total counter\n"
+                "pistorm_rtg_thread_cpu_seconds_total %.6f\n",
+            (double)ld(&m->rtg_thread_cpu_ns) / 1e9);
+  mo_counter(&o, "pistorm_rtg_async_ops_total", "PiGFX commands queued to the RTG command worker.",
+             ld(&m->rtg_async_ops));
+  mo_counter(&o, "pistorm_rtg_async_fences_total",
+             "Times the CPU thread waited for queued PiGFX commands.", ld(&m->rtg_async_fences));
+  mo_printf(&o, "# HELP pistorm_rtg_async_stall_seconds_total CPU thread time spent waiting for queued PiGFX commands.\n"
+                "# TYPE pistorm_rtg_async_stall_seconds_total counter\n"
+                "pistorm_rtg_async_stall_seconds_total %.6f\n",
+            (double)ld(&m->rtg_async_stall_ns) / 1e9);
+
+  mo_printf(&o, "# HELP pistorm_piscsi_ops_total PiSCSI read/write commands.\n");
+  mo_printf(&o, "# TYPE pistorm_piscsi_ops_total counter\n");
+  mo_printf(&o, "pistorm_piscsi_ops_total{dir=\"read\"} %llu\n",
+            (unsigned long long)ld(&m->piscsi_reads));
+  mo_printf(&o, "pistorm_piscsi_ops_total{dir=\"write\"} %llu\n",
+            (unsigned long long)ld(&m->piscsi_writes));
+  mo_printf(&o, "# HELP pistorm_piscsi_bytes_total PiSCSI bytes transferred.\n");
+  mo_printf(&o, "# TYPE pistorm_piscsi_bytes_total counter\n");
+  mo_printf(&o, "pistorm_piscsi_bytes_total{dir=\"read\"} %llu\n",
+            (unsigned long long)ld(&m->piscsi_read_bytes));
+  mo_printf(&o, "pistorm_piscsi_bytes_total{dir=\"write\"} %llu\n",
+            (unsigned long long)ld(&m->piscsi_write_bytes));
+  mo_counter(&o, "pistorm_piscsi_async_ops_total",
+             "PiSCSI transfers handed to the background I/O workers.", ld(&m->piscsi_async_ops));
+  mo_printf(&o, "# HELP pistorm_piscsi_stall_seconds_total CPU thread time spent in synchronous PiSCSI transfers.\n"
+                "# TYPE pistorm_piscsi_stall_seconds_total counter\n"
+                "pistorm_piscsi_stall_seconds_total %.6f\n",
+            (double)ld(&m->piscsi_stall_ns) / 1e9);
+  mo_counter(&o, "pistorm_piscsi_cache_hits_total", "PiSCSI cache lines found in the cache.",
+             ld(&m->piscsi_cache_hits));
+  mo_counter(&o, "pistorm_piscsi_cache_misses_total", "PiSCSI cache lines read from the image.",
+             ld(&m->piscsi_cache_misses));
+  mo_counter(&o, "pistorm_piscsi_cache_readahead_bytes_total",
+             "Bytes read ahead of sequential PiSCSI readers.", ld(&m->piscsi_cache_readahead_bytes));
+  mo_counter(&o, "pistorm_piscsi_cache_writeback_bytes_total",
+             "Dirty PiSCSI cache bytes written to the image.", ld(&m->piscsi_cache_writeback_bytes));
+  mo_counter(&o, "pistorm_piscsi_cache_flushes_total", "PiSCSI cache flushes that wrote data.",
+             ld(&m->piscsi_cache_flushes));
+
+  mo_counter(&o, "pistorm_ahi_underruns_total", "Pi-AHI ALSA playback underruns.",
+             ld(&m->ahi_underruns));
+
+  rpi_health_t h;
+  if (rpi_read_health(&h) == 0) {
+    mo_printf(&o, "# HELP pistorm_soc_temperature_celsius SoC temperature.\n");
+    mo_printf(&o, "# TYPE pistorm_soc_temperature_celsius gauge\n");
+    mo_printf(&o, "pistorm_soc_temperature_celsius %.1f\n", (double)h.temp_c);
+    mo_gauge(&o, "pistorm_soc_throttled_flags", "get_throttled flags (under-voltage, capping, throttling).",
+             h.throttled);
+    mo_gauge(&o, "pistorm_soc_arm_clock_hz", "Current ARM clock.", h.arm_hz);
+  }
+
+  if (o.pos >= len) {
+    o.pos = len ? len - 1 : 0;
+  }
+  return o.pos;
+}
+
+static void write_all(int fd, const char* buf, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+}
+
+static void serve_client(int fd, char* body) {
+  char req[1024];
+  int is_http = 0;
+
+  // Wait briefly for a request line; plain socket clients may send nothing.
+  struct pollfd p = {fd, POLLIN, 0};
+  if (poll(&p, 1, 100) > 0) {
+    ssize_t n = read(fd, req, sizeof(req) - 1);
+    if (n > 0) {
+      req[n] = 0;
+      is_http = strncmp(req, "GET ", 4) == 0 || strncmp(req, "HEAD ", 5) == 0;
+    }
+  }
+
+  unsigned int len = metrics_format(body, METRICS_BUF_SIZE);
+  if (is_http) {
+    char hdr[160];
+    int hlen = snprintf(hdr, sizeof(hdr),
+                        "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: %u\r\n"
+                        "Connection: close\r\n\r\n",
+                        len);
+    write_all(fd, hdr, (size_t)hlen);
+  }
+  write_all(fd, body, len);
+}
+
+static void* metrics_task(void* args) {
+  (void)args;
+  char* body = malloc(METRICS_BUF_SIZE);
+  if (!body) {
+    return NULL;
+  }
+
+  while (!__atomic_load_n(&metrics_exit, __ATOMIC_ACQUIRE)) {
+    struct pollfd p = {metrics_fd, POLLIN, 0};
+    if (poll(&p, 1, 500) <= 0) {
+      continue;
+    }
+    int fd = accept(metrics_fd, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+    serve_client(fd, body);
+    close(fd);
+  }
+
+  free(body);
+  return NULL;
+}
+
+static int metrics_listen_unix(const char* path) {
+  struct sockaddr_un sa;
+  if (strlen(path) >= sizeof(sa.sun_path)) {
+    LOG_ERROR("[METRICS] Socket path too long: %s\n", path);
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  strcpy(sa.sun_path, path);
+  unlink(path);
+  if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0 || listen(fd, 4) < 0) {
+    LOG_ERROR("[METRICS] Cannot listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  strcpy(metrics_unix_path, path);
+  LOG_INFO("[METRICS] Serving metrics on unix:%s\n", path);
+  return fd;
+}
+
+static int metrics_listen_tcp(const char* spec) {
+  char host[64] = "127.0.0.1";
+  const char* port_str = spec;
+  const char* colon = strrchr(spec, ':');
+  if (colon) {
+    size_t hl = (size_t)(colon - spec);
+    if (hl == 0 || hl >= sizeof(host)) {
+      LOG_ERROR("[METRICS] Invalid listen address %s\n", spec);
+      return -1;
+    }
+    memcpy(host, spec, hl);
+    host[hl] = 0;
+    port_str = colon + 1;
+  }
+  long port = strtol(port_str, NULL, 10);
+  if (port <= 0 || port > 65535) {
+    LOG_ERROR("[METRICS] Invalid port in %s\n", spec);
+    return -1;
+  }
+
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons((uint16_t)port);
+  if (inet_pton(AF_INET, host, &sa.sin_addr) != 1) {
+    LOG_ERROR("[METRICS] Invalid listen address %s\n", host);
+    return -1;
+  }
+  if (strcmp(host, "127.0.0.1") != 0) {
+    LOG_WARN("[METRICS] Listening on %s, not loopback; metrics are unauthenticated.\n", host);
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0 || listen(fd, 4) < 0) {
+    LOG_ERROR("[METRICS] Cannot listen on %s:%ld: %s\n", host, port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  LOG_INFO("[METRICS] Serving metrics on http://%s:%ld/metrics\n", host, port);
+  return fd;
+}
+
+int metrics_start(const char* spec) {
+  if (metrics_running || !spec || !spec[0]) {
+    return -1;
+  }
+
+  if (strncmp(spec, "unix:", 5) == 0) {
+    metrics_fd = metrics_listen_unix(spec + 5);
+  } else {
+    metrics_fd = metrics_listen_tcp(spec);
+  }
+  if (metrics_fd < 0) {
+    return -1;
+  }
+
+  metrics_exit = 0;
+  int err = pthread_create(&metrics_tid, NULL, &metrics_task, NULL);
+  if (err != 0) {
+    LOG_ERROR("[METRICS] Cannot create metrics thread: [%s]\n", strerror(err));
+    close(metrics_fd);
+    metrics_fd = -1;
+    return -1;
+  }
+  pthread_setname_np(metrics_tid, "pistorm64: http");
+  metrics_running = 1;
+  return 0;
+}
+
+void metrics_stop(void) {
+  if (!metrics_running) {
+    return;
+  }
+  __atomic_store_n(&metrics_exit, 1, __ATOMIC_RELEASE);
+  pthread_join(metrics_tid, NULL);
+  close(metrics_fd);
+  metrics_fd = -1;
+  if (metrics_unix_path[0]) {
+    unlink(metrics_unix_path);
+    metrics_unix_path[0] = 0;
+  }
+  metrics_running = 0;
+}
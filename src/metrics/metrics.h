@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_METRICS_H
+#define PISTORM_METRICS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Process-wide counters for the opt-in metrics endpoint.
+ *
+ * Producers only do relaxed atomic adds on these fields: no locks and no
+ * syscalls, so they are safe on the CPU thread. Everything else (formatting,
+ * SoC health mailbox reads, socket I/O) happens on the metrics thread when a
+ * client scrapes the endpoint.
+ */
+struct pistorm_metrics {
+  // Bus, indexed by width: 0 = byte, 1 = word, 2 = longword.
+  uint64_t bus_reads[3];
+  uint64_t bus_writes[3];
+  uint64_t bus_status_ops;
+  uint64_t bus_ioctls;
+  uint64_t bus_batches;
+  uint64_t bus_batch_ops;
+  uint64_t bus_batch_max;
+
+  // CPU
+  uint64_t cpu_slices;
+  uint64_t cpu_instructions;
+  uint64_t cpu_cycles;
+  uint64_t cpu_irq_level_changes;
+
+  // RTG
+  uint64_t rtg_frames_rendered;
+  uint64_t rtg_frames_skipped;
+  uint64_t rtg_rows_uploaded;
+  uint64_t rtg_thread_cpu_ns;
+  uint64_t rtg_async_ops;
+  uint64_t rtg_async_fences;
+  uint64_t rtg_async_stall_ns;
+
+  // PiSCSI
+  uint64_t piscsi_reads;
+  uint64_t piscsi_writes;
+  uint64_t piscsi_read_bytes;
+  uint64_t piscsi_write_bytes;
+  uint64_t piscsi_async_ops;
+  uint64_t piscsi_stall_ns;
+  uint64_t piscsi_cache_hits;
+  uint64_t piscsi_cache_misses;
+  uint64_t piscsi_cache_readahead_bytes;
+  uint64_t piscsi_cache_writeback_bytes;
+  uint64_t piscsi_cache_flushes;
+
+  // Pi-AHI
+  uint64_t ahi_underruns;
+};
+
+extern struct pistorm_metrics pistorm_metrics;
+
+#define METRICS_ADD(field, n) __atomic_fetch_add(&pistorm_metrics.field, (uint64_t)(n), __ATOMIC_RELAXED)
+#define METRICS_INC(field) METRICS_ADD(field, 1)
+
+static inline void metrics_max(uint64_t* field, uint64_t v) {
+  uint64_t cur = __atomic_load_n(field, __ATOMIC_RELAXED);
+  while (v > cur && !__atomic_compare_exchange_n(field, &cur, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+/*
+ * Start the endpoint. spec is either "unix:/path/to/socket" or
+ * "[127.0.0.1:]port" for a loopback TCP listener. Both speak enough HTTP for
+ * a Prometheus scrape; a client that sends no request line just gets the
+ * text body. Returns 0 on success.
+ */
+int metrics_start(const char* spec);
+void metrics_stop(void);
+
+// Renders the Prometheus text exposition into buf, returns its length.
+unsigned int metrics_format(char* buf, unsigned int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PISTORM_METRICS_H */
@@ -214,6 +214,15 @@ void m68k_add_ram_range(uint32_t addr, uint32_t upper, unsigned char *ptr);
 void m68k_add_rom_range(uint32_t addr, uint32_t upper, unsigned char *ptr);
 void m68k_remove_range(unsigned char *ptr);
 void m68k_clear_ranges(void);
+/* Attach a dirty page map to the RAM range backed by ptr: every CPU write into
+ * the range sets map[offset >> M68K_DIRTY_PAGE_SHIFT] to 0xFF (release store).
+ * Consumers clear their own bits of an entry. Pass NULL to detach. */
+#define M68K_DIRTY_PAGE_SHIFT 10
+void m68k_set_ram_range_dirty_map(unsigned char *ptr, unsigned char *map);
+/* Hide the range backed by ptr from the fast paths without dropping its slot
+ * or dirty map, so accesses fall through to m68k_read/write_memory_*. A
+ * non-zero suspend hides it, zero restores it. CPU thread only. */
+void m68k_suspend_ram_range(unsigned char *ptr, int suspend);
 
 /* Special call to simulate undocumented 68k behavior when move.l with a
  * predecrement destination mode is executed.
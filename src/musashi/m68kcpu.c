@@ -1348,6 +1348,7 @@ void m68k_add_ram_range(uint32_t addr, uint32_t upper, unsigned char *ptr)
 		m68ki_cpu.write_addr[m68ki_cpu.write_ranges] = addr;
 		m68ki_cpu.write_upper[m68ki_cpu.write_ranges] = upper;
 		m68ki_cpu.write_data[m68ki_cpu.write_ranges] = ptr;
+		m68ki_cpu.write_dirty[m68ki_cpu.write_ranges] = NULL;
 		m68ki_cpu.write_ranges++;
 		printf("[MUSASHI] Mapped write range %d: %.8X-%.8X (%p)\n", m68ki_cpu.write_ranges, addr, upper, (void *)ptr);
 	}
@@ -1404,6 +1405,7 @@ void m68k_remove_range(unsigned char *ptr) {
 
 	m68ki_cpu.code_translation_cache.lower = 0;
 	m68ki_cpu.code_translation_cache.upper = 0;
+	m68ki_cpu.fc_write_translation_cache.offset = NULL;
 
 	// FIXME: Replace the 8 with a #define, such as MAX_MUSASHI_RANGES
 	for (int i = 0; i < 8; i++) {
@@ -1416,10 +1418,12 @@ void m68k_remove_range(unsigned char *ptr) {
 				m68ki_cpu.read_data[j] = m68ki_cpu.read_data[j + 1];
 				m68ki_cpu.read_addr[j] = m68ki_cpu.read_addr[j + 1];
 				m68ki_cpu.read_upper[j] = m68ki_cpu.read_upper[j + 1];
+				m68ki_cpu.read_upper_suspended[j] = m68ki_cpu.read_upper_suspended[j + 1];
 			}
 			m68ki_cpu.read_data[8 - 1] = NULL;
 			m68ki_cpu.read_addr[8 - 1] = 0;
 			m68ki_cpu.read_upper[8 - 1] = 0;
+			m68ki_cpu.read_upper_suspended[8 - 1] = 0;
 			m68ki_cpu.read_ranges--;
 		}
 		if (m68ki_cpu.write_data[i] == ptr) {
@@ -1429,17 +1433,69 @@ void m68k_remove_range(unsigned char *ptr) {
 			printf("[MUSASHI] Unmapped write range %d.\n", i);
 			for (int j = i; j < 8 - 1; j++) {
 				m68ki_cpu.write_data[j] = m68ki_cpu.write_data[j + 1];
+				m68ki_cpu.write_dirty[j] = m68ki_cpu.write_dirty[j + 1];
 				m68ki_cpu.write_addr[j] = m68ki_cpu.write_addr[j + 1];
 				m68ki_cpu.write_upper[j] = m68ki_cpu.write_upper[j + 1];
+				m68ki_cpu.write_upper_suspended[j] = m68ki_cpu.write_upper_suspended[j + 1];
 			}
 			m68ki_cpu.write_data[8 - 1] = NULL;
+			m68ki_cpu.write_dirty[8 - 1] = NULL;
 			m68ki_cpu.write_addr[8 - 1] = 0;
 			m68ki_cpu.write_upper[8 - 1] = 0;
+			m68ki_cpu.write_upper_suspended[8 - 1] = 0;
 			m68ki_cpu.write_ranges--;
 		}
 	}
 }
 
+void m68k_set_ram_range_dirty_map(unsigned char *ptr, unsigned char *map)
+{
+	for (int i = 0; i < m68ki_cpu.write_ranges; i++) {
+		if (m68ki_cpu.write_data[i] == ptr) {
+			m68ki_cpu.write_dirty[i] = map;
+			/* Force the next write to reload the cached range with the map. */
+			m68ki_cpu.fc_write_translation_cache.offset = NULL;
+			return;
+		}
+	}
+}
+
+void m68k_suspend_ram_range(unsigned char *ptr, int suspend)
+{
+	if (!ptr)
+		return;
+
+	/* An empty [addr, addr) window misses every lookup; the real upper bound
+	 * is parked in *_upper_suspended until the range is resumed. */
+	for (int i = 0; i < m68ki_cpu.read_ranges; i++) {
+		if (m68ki_cpu.read_data[i] != ptr)
+			continue;
+		if (suspend && !m68ki_cpu.read_upper_suspended[i]) {
+			m68ki_cpu.read_upper_suspended[i] = m68ki_cpu.read_upper[i];
+			m68ki_cpu.read_upper[i] = m68ki_cpu.read_addr[i];
+		} else if (!suspend && m68ki_cpu.read_upper_suspended[i]) {
+			m68ki_cpu.read_upper[i] = m68ki_cpu.read_upper_suspended[i];
+			m68ki_cpu.read_upper_suspended[i] = 0;
+		}
+	}
+	for (int i = 0; i < m68ki_cpu.write_ranges; i++) {
+		if (m68ki_cpu.write_data[i] != ptr)
+			continue;
+		if (suspend && !m68ki_cpu.write_upper_suspended[i]) {
+			m68ki_cpu.write_upper_suspended[i] = m68ki_cpu.write_upper[i];
+			m68ki_cpu.write_upper[i] = m68ki_cpu.write_addr[i];
+		} else if (!suspend && m68ki_cpu.write_upper_suspended[i]) {
+			m68ki_cpu.write_upper[i] = m68ki_cpu.write_upper_suspended[i];
+			m68ki_cpu.write_upper_suspended[i] = 0;
+		}
+	}
+
+	m68ki_cpu.code_translation_cache.lower = 0;
+	m68ki_cpu.code_translation_cache.upper = 0;
+	m68ki_cpu.fc_read_translation_cache.offset = NULL;
+	m68ki_cpu.fc_write_translation_cache.offset = NULL;
+}
+
 void m68k_clear_ranges(void)
 {
 	printf("[MUSASHI] Clearing all reads/write memory ranges.\n");
@@ -1447,14 +1503,18 @@ void m68k_clear_ranges(void)
 		m68ki_cpu.read_upper[i] = 0;
 		m68ki_cpu.read_addr[i] = 0;
 		m68ki_cpu.read_data[i] = NULL;
+		m68ki_cpu.read_upper_suspended[i] = 0;
 		m68ki_cpu.write_upper[i] = 0;
+		m68ki_cpu.write_upper_suspended[i] = 0;
 		m68ki_cpu.write_addr[i] = 0;
 		m68ki_cpu.write_data[i] = NULL;
+		m68ki_cpu.write_dirty[i] = NULL;
 	}
 	m68ki_cpu.write_ranges = 0;
 	m68ki_cpu.read_ranges = 0;
 	m68ki_cpu.code_translation_cache.lower = 0;
 	m68ki_cpu.code_translation_cache.upper = 0;
+	m68ki_cpu.fc_write_translation_cache.offset = NULL;
 }
 
 /* ======================================================================== */
@@ -45,6 +45,8 @@ extern "C" {
 #include <setjmp.h>
 #include <stdio.h>
 #include "gpio/ps_protocol.h"
+#include "pistorm_trace.h"
+#include "metrics/irq_latency.h"
 
 /* included to ensure CPU is alligned (16) on fpr[8] */
 #include <stddef.h>
@@ -976,6 +978,7 @@ typedef struct
     unsigned int lower;
     unsigned int upper;
     unsigned char *offset;
+    unsigned char *dirty;
 } address_translation_cache;
 
 
@@ -1095,11 +1098,14 @@ typedef struct __attribute__((aligned(16))) m68ki_cpu_core
 	unsigned char read_ranges;
 	unsigned int read_addr[8];
 	unsigned int read_upper[8];
+	unsigned int read_upper_suspended[8];
 	unsigned char *read_data[8];
 	unsigned char write_ranges;
 	unsigned int write_addr[8];
 	unsigned int write_upper[8];
+	unsigned int write_upper_suspended[8];
 	unsigned char *write_data[8];
+	unsigned char *write_dirty[8];
 	address_translation_cache code_translation_cache;
 	address_translation_cache fc_read_translation_cache;
 	address_translation_cache fc_write_translation_cache;
@@ -1306,7 +1312,15 @@ static inline uint m68ki_read_imm_32(m68ki_cpu_core *state)
 #define SET_FC_WRITE_TRANSLATION_CACHE_VALUES \
 	cache->lower = state->write_addr[i]; \
 	cache->upper = state->write_upper[i]; \
-	cache->offset = state->write_data[i];
+	cache->offset = state->write_data[i]; \
+	cache->dirty = state->write_dirty[i];
+
+static inline void m68ki_mark_dirty(unsigned char *map, uint offset, uint size)
+{
+	__atomic_store_n(&map[offset >> M68K_DIRTY_PAGE_SHIFT], 0xFF, __ATOMIC_RELEASE);
+	if (size > 1)
+		__atomic_store_n(&map[(offset + size - 1) >> M68K_DIRTY_PAGE_SHIFT], 0xFF, __ATOMIC_RELEASE);
+}
 
 // M68KI_READ_8_FC
 static inline uint m68ki_read_8_fc(m68ki_cpu_core *state, uint address, uint fc)
@@ -1442,6 +1456,8 @@ static inline void m68ki_write_8_fc(m68ki_cpu_core *state, uint address, uint fc
 	if(cache->offset && address >= cache->lower && address < cache->upper)
 	{
 		cache->offset[address - cache->lower] = (unsigned char)value;
+		if (cache->dirty)
+			m68ki_mark_dirty(cache->dirty, address - cache->lower, 1);
 		return;
 	}
 
@@ -1449,6 +1465,8 @@ static inline void m68ki_write_8_fc(m68ki_cpu_core *state, uint address, uint fc
 		if(address >= state->write_addr[i] && address < state->write_upper[i]) {
 			SET_FC_WRITE_TRANSLATION_CACHE_VALUES
 			state->write_data[i][address - state->write_addr[i]] = (unsigned char)value;
+			if (cache->dirty)
+				m68ki_mark_dirty(cache->dirty, address - cache->lower, 1);
 			return;
 		}
 	}
@@ -1481,6 +1499,8 @@ static inline void m68ki_write_16_fc(m68ki_cpu_core *state, uint address, uint f
 	if(cache->offset && address >= cache->lower && address < cache->upper)
 	{
 		ps_store_u16(cache->offset + (address - cache->lower), htobe16(value));
+		if (cache->dirty)
+			m68ki_mark_dirty(cache->dirty, address - cache->lower, 2);
 		return;
 	}
 
@@ -1488,6 +1508,8 @@ static inline void m68ki_write_16_fc(m68ki_cpu_core *state, uint address, uint f
 		if(address >= state->write_addr[i] && address < state->write_upper[i]) {
 			SET_FC_WRITE_TRANSLATION_CACHE_VALUES
 			ps_store_u16(state->write_data[i] + (address - state->write_addr[i]), htobe16(value));
+			if (cache->dirty)
+				m68ki_mark_dirty(cache->dirty, address - cache->lower, 2);
 			return;
 		}
 	}
@@ -1525,6 +1547,8 @@ static inline void m68ki_write_32_fc(m68ki_cpu_core *state, uint address, uint f
 	if(cache->offset && address >= cache->lower && address < cache->upper)
 	{
 		ps_store_u32(cache->offset + (address - cache->lower), htobe32(value));
+		if (cache->dirty)
+			m68ki_mark_dirty(cache->dirty, address - cache->lower, 4);
 		return;
 	}
 
@@ -1532,6 +1556,8 @@ static inline void m68ki_write_32_fc(m68ki_cpu_core *state, uint address, uint f
 		if(address >= state->write_addr[i] && address < state->write_upper[i]) {
 			SET_FC_WRITE_TRANSLATION_CACHE_VALUES
 			ps_store_u32(state->write_data[i] + (address - state->write_addr[i]), htobe32(value));
+			if (cache->dirty)
+				m68ki_mark_dirty(cache->dirty, address - cache->lower, 4);
 			return;
 		}
 	}
@@ -2518,6 +2544,9 @@ static inline void m68ki_exception_interrupt(m68ki_cpu_core *state, uint int_lev
 		return;
 	}
 
+	PS_TRACE3(irq_take, int_level, vector, REG_PC);
+	irq_lat_mark_vector(int_level);
+
 	/* Start exception processing */
 	sr = m68ki_init_exception(state);
 
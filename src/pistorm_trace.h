@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * USDT static tracepoints (provider "pistorm").
+ *
+ * Built with USE_USDT=1 (the default) and <sys/sdt.h> from systemtap-sdt-dev
+ * available, each PS_TRACEn() is a single nop plus an ELF note; nothing runs
+ * until perf/bpftrace attaches to it, so production builds keep them. The
+ * arguments are still evaluated, so only pass values that are already at
+ * hand. Without sdt.h the macros compile away entirely.
+ *
+ * List them with:   bpftrace -l 'usdt:./emulator:pistorm:*'
+ * Example:          bpftrace -e 'usdt:./emulator:pistorm:bus_start { @s[tid] = nsecs; }
+ *                     usdt:./emulator:pistorm:bus_done /@s[tid]/ {
+ *                       @lat[arg1] = hist(nsecs - @s[tid]); delete(@s[tid]); }'
+ *
+ * Probes:
+ *   bus_start(is_read, width, addr)            width: 0 = 8, 1 = 16, 2 = 32 bit, 3 = status
+ *   bus_done(is_read, width, addr, value)
+ *   bus_queued(width, addr, value)             write queued for a batch (PISTORM_ENABLE_BATCH)
+ *                                              instead of bus_start/bus_done
+ *   bus_batch(count)                           batched writes flushed in one ioctl
+ *   bus_batch_done(count, result)              that ioctl returned
+ *   slice_begin(cycles, irq)
+ *   slice_end(cycles)
+ *   irq_raise(source, ipl)                     emulated INTREQ source raised
+ *   irq_ack(mask)                              emulated sources acknowledged
+ *   irq_level(level)                           interrupt level handed to the CPU core
+ *   irq_take(level, vector, pc)                CPU takes the interrupt exception
+ *   piscsi_start(cmd, unit, lba, len, tag)     PiSCSI read/write, before the file I/O
+ *   piscsi_end(cmd, unit, result, tag)         bytes transferred, or -1 on error; a
+ *                                              queued request ends on a worker thread,
+ *                                              so pair on tag when it is non-zero
+ *   rtg_cmd(cmd, x, y, w, h)                   PiGFX command dispatch (RTG_COMMAND)
+ *   rtg_cmd_done(cmd)
+ *   irtg_cmd(cmd)                              PiGFX command dispatch (IRTG_COMMAND)
+ *   irtg_cmd_done(cmd)
+ *   ahi_submit(frames)                         ALSA buffer write
+ *   ahi_submit_done(result)
+ */
+
+#ifndef PISTORM_TRACE_H
+#define PISTORM_TRACE_H
+
+#if defined(PISTORM_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PISTORM_USDT_ENABLED 1
+#endif
+#endif
+
+#ifdef PISTORM_USDT_ENABLED
+#define PS_TRACE0(name) STAP_PROBE(pistorm, name)
+#define PS_TRACE1(name, a) STAP_PROBE1(pistorm, name, a)
+#define PS_TRACE2(name, a, b) STAP_PROBE2(pistorm, name, a, b)
+#define PS_TRACE3(name, a, b, c) STAP_PROBE3(pistorm, name, a, b, c)
+#define PS_TRACE4(name, a, b, c, d) STAP_PROBE4(pistorm, name, a, b, c, d)
+#define PS_TRACE5(name, a, b, c, d, e) STAP_PROBE5(pistorm, name, a, b, c, d, e)
+#else
+#define PS_TRACE0(name) do { } while (0)
+#define PS_TRACE1(name, a) do { } while (0)
+#define PS_TRACE2(name, a, b) do { } while (0)
+#define PS_TRACE3(name, a, b, c) do { } while (0)
+#define PS_TRACE4(name, a, b, c, d) do { } while (0)
+#define PS_TRACE5(name, a, b, c, d, e) do { } while (0)
+#endif
+
+#endif /* PISTORM_TRACE_H */
@@ -9,6 +9,9 @@
 #include "config_file/config_file.h"
 #include <pthread.h>
 #include "gpio/ps_protocol.h"
+#include "log.h"
+#include "metrics/metrics.h"
+#include "pistorm_trace.h"
 #include "platforms/amiga/amiga-interrupts.h"
 #include "pi_ahi.h"
 #include "pi-ahi-enums.h"
@@ -31,7 +34,7 @@ static const char* op_type_names[4] = {
     "LONGWORD",
     "MEM",
 };
-#define DEBUG printf
+#define DEBUG LOG_FAST_DEBUG
 #define PRINT_AHI_DEBUGMSG print_ahi_debugmsg
 #define PRINT_AHI_SAMPLE_TYPE print_ahi_sample_type
 #else
@@ -73,19 +76,6 @@ static struct timespec diff(struct timespec start, struct timespec end) {
   return temp;
 }
 
-extern uint16_t emulated_irqs;
-extern uint8_t emulated_ipl;
-static const uint8_t IPL[14] = {1, 1, 1, 2, 3, 3, 3, 4, 4, 4, 4, 5, 5, 6};
-
-static inline void emulate_irq(unsigned int irq) {
-  emulated_irqs |= 1 << irq;
-  uint8_t ipl = IPL[irq];
-
-  if (emulated_ipl < ipl) {
-    emulated_ipl = ipl;
-  }
-}
-
 static void* ahi_timing_task(void* args) {
   printf("[AHI] Thread running.\n");
 
@@ -106,7 +96,7 @@ static void* ahi_timing_task(void* args) {
       }
 
       if (!irq_disabled) {
-        emulate_irq(13);
+        amiga_emulate_irq(EXTER);
         ahi_interrupt_triggered = 1;
         ahi_ints_triggered++;
       }
@@ -312,7 +302,9 @@ static void pi_ahi_do_cmd(uint32_t val) {
       sndbuf_offset += bsize;
       while (sndbuf_offset >= old_sndbuf_offset + buff_size) {
         // printf("Writing %d bytes to the PCM...\n", buff_size);
+        PS_TRACE1(ahi_submit, frames);
         res = snd_pcm_writei(pcm_handle, shitbuf + old_sndbuf_offset, frames);
+        PS_TRACE1(ahi_submit_done, res);
         old_sndbuf_offset = old_sndbuf_offset + buff_size;
         if (old_sndbuf_offset >= 127 * SIZE_KILO) {
           // printf("Buffer wrap.\n");
@@ -323,6 +315,7 @@ static void pi_ahi_do_cmd(uint32_t val) {
         }
         if (res == -EPIPE) {
           // printf("PCM epipe.\n");
+          METRICS_INC(ahi_underruns);
           snd_pcm_prepare(pcm_handle);
         } else if (res < 0) {
           printf("ERROR. Can't write to PCM device. %s\n", snd_strerror((int)res));
@@ -409,7 +402,7 @@ void handle_pi_ahi_write(uint32_t addr_, uint32_t val, uint8_t type) {
   case AHI_INTCHK:
     switch (val) {
     case 1:
-      amiga_clear_emulating_irq();
+      amiga_clear_emulated_irq(EXTER);
       DEBUG("Interrupt handler triggered. IRQ enabled: %d\n", irq_enabled);
       break;
     case 2:
@@ -4,7 +4,7 @@
 #include <stdint.h>
 #include "platforms/amiga/ahi/pi_ahi.h"
 
-uint32_t pi_ahi_init(char* dev) {
+uint32_t pi_ahi_init(const char* dev) {
   (void)dev;
   return 1; // success
 }
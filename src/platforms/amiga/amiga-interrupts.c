@@ -1,59 +1,120 @@
 // SPDX-License-Identifier: MIT
 
 #include <stdint.h>
+#include <stdio.h>
 #include "config_file/config_file.h"
 #include "amiga-registers.h"
 #include "amiga-interrupts.h"
 #include "gpio/ps_protocol.h"
+#include "emulator.h"
+#include "lat_hist.h"
+#include "pistorm_trace.h"
 
-static const uint8_t IPL[14] = {1, 1, 1, 2, 3, 3, 3, 4, 4, 4, 4, 5, 5, 6};
+static const uint8_t IPL[AMIGA_IRQ_COUNT] = {1, 1, 1, 2, 3, 3, 3, 4, 4, 4, 4, 5, 5, 6};
 
-uint16_t emulated_irqs = 0x0000;
-uint8_t emulated_ipl;
+static const char* irq_names[AMIGA_IRQ_COUNT] = {
+    "TBE", "DSKBLK", "SOFT", "PORTS", "COPER", "VERTB", "BLIT",
+    "AUD0", "AUD1", "AUD2", "AUD3", "RBF", "DSKSYN", "EXTER",
+};
+
+/*
+ * Pending emulated interrupt sources, one bit per INTREQ bit. Device threads
+ * (Pi-AHI timing, keyboard, ...) raise bits and the CPU thread clears them
+ * through INTREQ writes, so every access goes through atomics. The emulated
+ * IPL is derived from the mask on demand instead of being cached in a second
+ * variable that could go stale between the two stores.
+ */
+static uint16_t emulated_irqs = 0x0000;
+
+static uint64_t irq_raised[AMIGA_IRQ_COUNT];
+static uint64_t irq_coalesced[AMIGA_IRQ_COUNT];
+static uint64_t irq_raise_ns[AMIGA_IRQ_COUNT];
+static struct lat_hist irq_ack_lat[AMIGA_IRQ_COUNT];
+
+const char* amiga_irq_name(AMIGA_IRQ irq) {
+  return irq < AMIGA_IRQ_COUNT ? irq_names[irq] : "?";
+}
+
+static inline uint16_t pending_irqs(void) {
+  return __atomic_load_n(&emulated_irqs, __ATOMIC_ACQUIRE);
+}
+
+static inline uint8_t ipl_for_mask(uint16_t mask) {
+  if (!mask) {
+    return 0;
+  }
+  // IPL[] is monotonic, so the highest pending source decides the level.
+  return IPL[31 - __builtin_clz((unsigned int)mask)];
+}
+
+static void account_acked_irqs(uint16_t acked) {
+  if (!acked) {
+    return;
+  }
+  PS_TRACE1(irq_ack, acked);
+  uint64_t now = lat_now_ns();
+  for (int irq = 0; irq < AMIGA_IRQ_COUNT; irq++) {
+    if (acked & (1 << irq)) {
+      uint64_t raised = __atomic_load_n(&irq_raise_ns[irq], __ATOMIC_RELAXED);
+      if (raised && now >= raised) {
+        lat_hist_add(&irq_ack_lat[irq], now - raised);
+      }
+    }
+  }
+}
 
 void amiga_emulate_irq(AMIGA_IRQ irq) {
-  emulated_irqs |= 1 << irq;
-  uint8_t ipl = IPL[irq];
+  uint16_t bit = (uint16_t)(1 << irq);
 
-  if (emulated_ipl < ipl) {
-    emulated_ipl = ipl;
+  __atomic_fetch_add(&irq_raised[irq], 1, __ATOMIC_RELAXED);
+  if (pending_irqs() & bit) {
+    __atomic_fetch_add(&irq_coalesced[irq], 1, __ATOMIC_RELAXED);
+    return;
   }
+
+  PS_TRACE2(irq_raise, irq, IPL[irq]);
+
+  // Timestamp before publishing the bit so the acknowledging side sees it.
+  __atomic_store_n(&irq_raise_ns[irq], lat_now_ns(), __ATOMIC_RELAXED);
+  __atomic_fetch_or(&emulated_irqs, bit, __ATOMIC_RELEASE);
+
+  // Don't wait for the next IPL poll; cut the running slice short.
+  cpu_irq_preempt(IPL[irq]);
 }
 
 inline uint8_t amiga_emulated_ipl(void) {
-  return emulated_ipl;
+  return ipl_for_mask(pending_irqs());
 }
 
 inline int amiga_emulating_irq(AMIGA_IRQ irq) {
-  return emulated_irqs & (1 << irq);
+  return pending_irqs() & (1 << irq);
+}
+
+void amiga_clear_emulated_irq(AMIGA_IRQ irq) {
+  uint16_t bit = (uint16_t)(1 << irq);
+  uint16_t old = __atomic_fetch_and(&emulated_irqs, (uint16_t)~bit, __ATOMIC_ACQ_REL);
+  account_acked_irqs(old & bit);
 }
 
 void amiga_clear_emulating_irq(void) {
-  emulated_irqs = 0;
-  emulated_ipl = 0;
+  __atomic_store_n(&emulated_irqs, 0, __ATOMIC_RELEASE);
 }
 
 inline int amiga_handle_intrqr_read(uint32_t* res) {
-  if (emulated_irqs) {
-    *res = ps_read_16(INTREQR) | emulated_irqs;
+  uint16_t pending = pending_irqs();
+  if (pending) {
+    *res = ps_read_16(INTREQR) | pending;
     return 1;
   }
   return 0;
 }
 
 int amiga_handle_intrq_write(uint32_t val) {
-  if (emulated_irqs && !(val & 0x8000)) {
-    uint16_t previous_emulated_irqs = emulated_irqs;
-    uint16_t hardware_irqs_to_clear = val & ~emulated_irqs;
-    emulated_irqs &= ~val;
-    if (previous_emulated_irqs != emulated_irqs) {
-      emulated_ipl = 0;
-      for (int irq = 13; irq >= 0; irq--) {
-        if (emulated_irqs & (1 << irq)) {
-          emulated_ipl = IPL[irq];
-        }
-      }
-    }
+  uint16_t pending = pending_irqs();
+  if (pending && !(val & 0x8000)) {
+    uint16_t hardware_irqs_to_clear = (uint16_t)(val & ~pending);
+    uint16_t old = __atomic_fetch_and(&emulated_irqs, (uint16_t)~val, __ATOMIC_ACQ_REL);
+    account_acked_irqs((uint16_t)(old & val));
     if (hardware_irqs_to_clear) {
       ps_write_16(INTREQ, hardware_irqs_to_clear);
     }
@@ -61,3 +122,27 @@ int amiga_handle_intrq_write(uint32_t val) {
   }
   return 0;
 }
+
+void amiga_get_irq_stats(AMIGA_IRQ irq, struct amiga_irq_stats* out) {
+  out->raised = __atomic_load_n(&irq_raised[irq], __ATOMIC_RELAXED);
+  out->coalesced = __atomic_load_n(&irq_coalesced[irq], __ATOMIC_RELAXED);
+  out->acked = __atomic_load_n(&irq_ack_lat[irq].count, __ATOMIC_RELAXED);
+  out->ack_p50_ns = lat_hist_percentile(&irq_ack_lat[irq], 50);
+  out->ack_p99_ns = lat_hist_percentile(&irq_ack_lat[irq], 99);
+  out->ack_max_ns = __atomic_load_n(&irq_ack_lat[irq].max_ns, __ATOMIC_RELAXED);
+}
+
+void amiga_print_irq_stats(void) {
+  for (int irq = 0; irq < AMIGA_IRQ_COUNT; irq++) {
+    uint64_t raised = __atomic_load_n(&irq_raised[irq], __ATOMIC_RELAXED);
+    if (!raised) {
+      continue;
+    }
+    char name[48];
+    snprintf(name, sizeof(name), "[AMIGA] Emulated %s raise->ack", irq_names[irq]);
+    printf("[AMIGA] Emulated %s: raised %llu, coalesced %llu\n", irq_names[irq],
+           (unsigned long long)raised,
+           (unsigned long long)__atomic_load_n(&irq_coalesced[irq], __ATOMIC_RELAXED));
+    lat_hist_print(stdout, name, &irq_ack_lat[irq]);
+  }
+}
@@ -3,6 +3,12 @@
 #ifndef PISTORM_AMIGA_INTERRUPTS_H
 #define PISTORM_AMIGA_INTERRUPTS_H
 
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef enum {
   TBE,    // Serial port transmit buffer empty
   DSKBLK, // Disk block finished
@@ -18,13 +24,31 @@ typedef enum {
   RBF,    // Serial port receive buffer full
   DSKSYN, // Disk sync register (DSKSYNC) matches disk
   EXTER,  // External interrupt
+  AMIGA_IRQ_COUNT,
 } AMIGA_IRQ;
 
+struct amiga_irq_stats {
+  uint64_t raised;    // amiga_emulate_irq() calls
+  uint64_t coalesced; // raises that found the source already pending
+  uint64_t acked;     // pending -> cleared transitions (INTREQ write or explicit clear)
+  uint64_t ack_p50_ns;
+  uint64_t ack_p99_ns;
+  uint64_t ack_max_ns;
+};
+
 void amiga_emulate_irq(AMIGA_IRQ irq);
 uint8_t amiga_emulated_ipl(void);
 int amiga_emulating_irq(AMIGA_IRQ irq);
+void amiga_clear_emulated_irq(AMIGA_IRQ irq);
 void amiga_clear_emulating_irq(void);
 int amiga_handle_intrqr_read(uint32_t* res);
 int amiga_handle_intrq_write(uint32_t val);
+const char* amiga_irq_name(AMIGA_IRQ irq);
+void amiga_get_irq_stats(AMIGA_IRQ irq, struct amiga_irq_stats* out);
+void amiga_print_irq_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif // PISTORM_AMIGA_INTERRUPTS_H
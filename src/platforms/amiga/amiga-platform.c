@@ -13,7 +13,14 @@
 #include "hunk-reloc.h"
 #include "net/pi-net-enums.h"
 #include "net/pi-net.h"
+#include "piscsi/piscsi-async.h"
+#include "piscsi/piscsi-cache.h"
 #include "piscsi/piscsi-enums.h"
+#include "piscsi/piscsi-media.h"
+#include "piscsi/piscsi-meta.h"
+#include "piscsi/piscsi-mmap.h"
+#include "piscsi/piscsi-trace.h"
+#include "piscsi/piscsi-zhdf.h"
 #include "piscsi/piscsi.h"
 #include "ahi/pi_ahi.h"
 #include "ahi/pi-ahi-enums.h"
@@ -22,6 +29,8 @@
 #include "platforms/platforms.h"
 #include "platforms/shared/rtc.h"
 #include "rtg/rtg.h"
+#include "rtg/rtg-native.h"
+#include "rtg/rtg-vnc.h"
 #include "amiga-platform.h"
 #include "a314/a314.h"
 
@@ -567,15 +576,67 @@ void setvar_amiga(struct emulator_config* cfg, const char* var, const char* val)
     LOG_INFO("[AMIGA] CDTV mode enabled.\n");
     cdtv_mode = 1;
   }
+  if (CHKVAR("rtg-vram")) {
+    if (val && strlen(val) != 0) {
+      unsigned int mb = get_int(val);
+      if (mb == (unsigned int)-1) {
+        LOG_WARN("[AMIGA] Invalid rtg-vram size: %s\n", val);
+      } else {
+        if (mb >= SIZE_MEGA) {
+          // Given with an M/G suffix, i.e. in bytes.
+          mb /= SIZE_MEGA;
+        }
+        uint32_t vram = rtg_set_vram_size(mb);
+        LOG_INFO("[AMIGA] RTG VRAM size set to %uMB.\n", vram / SIZE_MEGA);
+      }
+    }
+  }
   if (CHKVAR("rtg") && !rtg_enabled) {
     if (init_rtg_data(cfg)) {
       LOG_INFO("[AMIGA] RTG Enabled.\n");
       rtg_enabled = 1;
       adjust_ranges_amiga(cfg);
+      // PISTORM_RTG_VNC starts the VNC server without a config entry.
+      rtg_vnc_start(NULL);
+      if (getenv("PISTORM_RTG_NATIVE_FPS")) {
+        rtg_native_start(RTG_NATIVE_DEFAULT_FPS);
+      }
     } else {
       LOG_WARN("[AMIGA] Failed to enable RTG.\n");
     }
   }
+  if (CHKVAR("rtg-async")) {
+    unsigned int enable = 1;
+    if (val && strlen(val) != 0) {
+      enable = get_int(val);
+    }
+    enable = (enable != 0 && enable != (unsigned int)-1);
+    rtg_set_async((uint8_t)enable);
+    LOG_INFO("[AMIGA] Asynchronous RTG commands %s.\n", enable ? "enabled" : "disabled");
+  }
+  if (CHKVAR("rtg-threads")) {
+    if (val && strlen(val) != 0) {
+      unsigned int threads = get_int(val);
+      if (threads == (unsigned int)-1 || threads == 0) {
+        threads = 1;
+      }
+      rtg_gfx_set_threads(threads);
+      LOG_INFO("[AMIGA] Large RTG operations use up to %u threads.\n", threads);
+    }
+  }
+  if (CHKVAR("rtg-vnc")) {
+    rtg_vnc_start(val ? val : "");
+  }
+  if (CHKVAR("rtg-native")) {
+    unsigned int fps = RTG_NATIVE_DEFAULT_FPS;
+    if (val && strlen(val) != 0) {
+      fps = get_int(val);
+      if (fps == (unsigned int)-1) {
+        fps = RTG_NATIVE_DEFAULT_FPS;
+      }
+    }
+    rtg_native_start(fps);
+  }
   if (CHKVAR("rtg-dpms")) {
     rtg_dpms = 1;
     LOG_INFO("[AMIGA] DPMS enabled for RTG.\n");
@@ -633,6 +694,47 @@ void setvar_amiga(struct emulator_config* cfg, const char* var, const char* val)
     adjust_ranges_amiga(cfg);
   }
   if (piscsi_enabled) {
+    if (CHKVAR("piscsi-async")) {
+      unsigned int threads = PISCSI_ASYNC_DEFAULT_THREADS;
+      if (val && strlen(val) != 0) {
+        threads = get_int(val);
+        if (threads == (unsigned int)-1) {
+          threads = PISCSI_ASYNC_DEFAULT_THREADS;
+        }
+      }
+      piscsi_async_start(threads);
+    }
+    if (CHKVAR("piscsi-cache")) {
+      int mb = (val && strlen(val) != 0) ? (int)get_int(val) : PISCSI_CACHE_DEFAULT_MB;
+      piscsi_cache_set_size(mb > 0 ? (unsigned int)mb : 0);
+    }
+    if (CHKVAR("piscsi-cache-policy") && val && strlen(val) != 0) {
+      if (piscsi_cache_set_policy(val) != 0) {
+        LOG_WARN("[AMIGA] Unknown PiSCSI cache policy %s, use through, back or update.\n", val);
+      }
+    }
+    if (CHKVAR("piscsi-cache-flush") && val && strlen(val) != 0) {
+      int seconds = (int)get_int(val);
+      piscsi_cache_set_flush(seconds > 0 ? (unsigned int)seconds : PISCSI_CACHE_DEFAULT_FLUSH);
+    }
+    if (CHKVAR("piscsi-mmap")) {
+      piscsi_mmap_set_enabled(!(val && strlen(val) != 0 && get_int(val) == 0));
+    }
+    if (CHKVAR("piscsi-mmap-window")) {
+      int mb = (val && strlen(val) != 0) ? (int)get_int(val) : PISCSI_MMAP_DEFAULT_WINDOW;
+      piscsi_mmap_set_window(mb > 0 ? (unsigned int)mb : 0);
+    }
+    if (CHKVAR("piscsi-readahead")) {
+      int kb = (val && strlen(val) != 0) ? (int)get_int(val) : PISCSI_CACHE_DEFAULT_READAHEAD;
+      piscsi_cache_set_readahead(kb >= 0 ? (unsigned int)kb : PISCSI_CACHE_DEFAULT_READAHEAD);
+    }
+    if (CHKVAR("piscsi-zhdf-cache")) {
+      int mb = (val && strlen(val) != 0) ? (int)get_int(val) : PISCSI_ZHDF_DEFAULT_CACHE;
+      piscsi_zhdf_set_cache(mb > 0 ? (unsigned int)mb : PISCSI_ZHDF_DEFAULT_CACHE);
+    }
+    if (CHKVAR("piscsi-meta-cache")) {
+      piscsi_meta_set_path(val && strlen(val) != 0 ? val : PISCSI_META_DEFAULT_PATH);
+    }
     if CHKVAR ("piscsi0") {
       piscsi_map_drive(val, 0);
     }
@@ -654,6 +756,17 @@ void setvar_amiga(struct emulator_config* cfg, const char* var, const char* val)
     if CHKVAR ("piscsi6") {
       piscsi_map_drive(val, 6);
     }
+    // piscsi-media0 to piscsi-media6, a disk for that removable unit each.
+    if (strncmp(var, "piscsi-media", 12) == 0 && var[12] >= '0' && var[12] <= '6' && !var[13] &&
+        val && strlen(val) != 0) {
+      piscsi_media_add((uint8_t)(var[12] - '0'), val);
+    }
+    if (CHKVAR("piscsi-media-ctl")) {
+      piscsi_media_set_ctl(val);
+    }
+    if (CHKVAR("piscsi-trace")) {
+      piscsi_trace_set_path(val);
+    }
   }
 
   // Pi-Net stuff
@@ -774,6 +887,8 @@ void shutdown_platform_amiga(struct emulator_config* cfg) {
     piscsi_shutdown();
     piscsi_enabled = 0;
   }
+  rtg_vnc_stop();
+  rtg_native_stop();
   if (rtg_enabled) {
     shutdown_rtg();
     rtg_enabled = 0;
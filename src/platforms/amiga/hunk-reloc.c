@@ -10,10 +10,6 @@
 #include "piscsi/piscsi-enums.h"
 #include "piscsi/piscsi.h"
 
-#ifdef FAKESTORM
-#define lseek64 lseek
-#endif
-
 #define DEBUG_SPAMMY(...)
 //#define DEBUG_SPAMMY printf
 #define DEBUG(...)
@@ -250,9 +246,9 @@ struct LoadSegBlock {
 };
 #define LOADSEG_IDENTIFIER 0x4C534547
 
-int load_lseg(int fd, uint8_t** buf_p, struct hunk_info* i, struct hunk_reloc* relocs,
-              uint32_t block_size) {
-  if (fd == -1)
+int load_lseg(lseg_read_fn read_fn, void* ctx, uint64_t offset, uint8_t** buf_p,
+              struct hunk_info* i, struct hunk_reloc* relocs, uint32_t block_size) {
+  if (!read_fn)
     return -1;
 
   if (block_size == 0)
@@ -267,7 +263,9 @@ int load_lseg(int fd, uint8_t** buf_p, struct hunk_info* i, struct hunk_reloc* r
   size_t lseg_size = 0;
   size_t lseg_capacity = 0;
 
-  read(fd, block, block_size);
+  if (read_fn(ctx, block, block_size, offset) != (ssize_t)block_size) {
+    goto fail;
+  }
   if (BE(lsb->lsb_ID) != LOADSEG_IDENTIFIER) {
     DEBUG("[LOAD_LSEG] Attempted to load a non LSEG-block: %.8X", BE(lsb->lsb_ID));
     goto fail;
@@ -305,8 +303,7 @@ int load_lseg(int fd, uint8_t** buf_p, struct hunk_info* i, struct hunk_reloc* r
     if (next_blk == 0xFFFFFFFF) {
       break;
     }
-    lseek64(fd, next_blk * block_size, SEEK_SET);
-    if (read(fd, block, block_size) <= 0) {
+    if (read_fn(ctx, block, block_size, (uint64_t)next_blk * block_size) <= 0) {
       goto fail;
     }
   } while (next_blk != 0xFFFFFFFF);
@@ -1,6 +1,9 @@
 #ifndef _HUNK_RELOC_H
 #define _HUNK_RELOC_H
 
+#include <stdint.h>
+#include <sys/types.h>
+
 struct hunk_reloc {
   uint32_t src_hunk;
   uint32_t target_hunk;
@@ -30,8 +33,11 @@ enum hunk_types {
 };
 
 int process_hunk(uint32_t index, struct hunk_info* info, FILE* f, struct hunk_reloc* r);
-int load_lseg(int fd, uint8_t** buf_p, struct hunk_info* i, struct hunk_reloc* relocs,
-              uint32_t block_size);
+// Reads `len` bytes of the disk at `offset` for load_lseg().
+typedef ssize_t (*lseg_read_fn)(void* ctx, uint8_t* buf, uint32_t len, uint64_t offset);
+// Load the LSEG blocks starting at disk offset `offset`.
+int load_lseg(lseg_read_fn read_fn, void* ctx, uint64_t offset, uint8_t** buf_p,
+              struct hunk_info* i, struct hunk_reloc* relocs, uint32_t block_size);
 
 void reloc_hunk(struct hunk_reloc* h, uint8_t* buf, struct hunk_info* i);
 void process_hunks(FILE* in, struct hunk_info* h_info, struct hunk_reloc* r, uint32_t offset);
@@ -8,12 +8,14 @@
 #include <exec/tasks.h>
 #include <exec/io.h>
 #include <exec/execbase.h>
+#include <exec/interrupts.h>
 
 #include <libraries/expansion.h>
 
 #include <devices/trackdisk.h>
 #include <devices/timer.h>
 #include <devices/scsidisk.h>
+#include <hardware/intbits.h>
 
 #include <dos/filehandler.h>
 
@@ -33,7 +35,7 @@
 #define DEVICE_DATE "(3 Feb 2021)"
 #define DEVICE_ID_STRING "PiSCSI " XSTR(DEVICE_VERSION) "." XSTR(DEVICE_REVISION) " " DEVICE_DATE
 #define DEVICE_VERSION 43
-#define DEVICE_REVISION 20
+#define DEVICE_REVISION 23
 #define DEVICE_PRIORITY 0
 
 #pragma pack(4)
@@ -54,7 +56,18 @@ struct piscsi_base {
     uint32_t c;
 
     uint32_t change_num;
+    // Removable units: TD_ADDCHANGEINT requests, whose interrupts are
+    // Cause()d when the Pi changes the disk.
+    uint8_t removable;
+    struct List change_ints;
   } units[NUM_UNITS];
+
+  // Non-zero when the Pi queues reads and writes in the background; the
+  // completions come in through the PORTS interrupt server, and so do disk
+  // changes when a unit is removable.
+  uint32_t async_depth;
+  uint8_t removable;
+  struct Interrupt async_irq;
 };
 
 struct ExecBase* SysBase;
@@ -254,6 +267,22 @@ uint8_t piscsi_perform_io(struct piscsi_unit* u, struct IORequest* io);
 uint8_t piscsi_rw(struct piscsi_unit* u, struct IORequest* io);
 uint8_t piscsi_scsi(struct piscsi_unit* u, struct IORequest* io);
 
+// piscsi_rw() result for a request the Pi has queued: the interrupt server
+// replies it, so begin_io() must not touch it again. Also kept TD_ADDCHANGEINT
+// requests, replied by TD_REMCHANGEINT.
+#define PISCSI_IO_QUEUED 0x80
+
+// Interrupt servers return with Z set to let the rest of the PORTS chain run.
+// The entry point sits inside a function so it lands in the code section
+// whatever the compiler emitted before it.
+static void __attribute__((used, noinline)) piscsi_async_server_stub(void) {
+  asm volatile("_piscsi_async_server:                     \n"
+               "       jsr     _piscsi_async_irq          \n"
+               "       tst.l   d0                         \n"
+               "       rts                                \n");
+}
+void piscsi_async_server(void);
+
 //#define uint32_t unsigned int
 //#define uint16_t unsigned short
 
@@ -275,6 +304,9 @@ static struct Library __attribute__((used)) *
 
   for (int i = 0; i < NUM_UNITS; i++) {
     uint16_t r = 0;
+    struct List* l = &dev_base->units[i].change_ints;
+    l->lh_Head = (struct Node*)&l->lh_Tail;
+    l->lh_TailPred = (struct Node*)&l->lh_Head;
     WRITESHORT(PISCSI_CMD_DRVNUM, (i));
     dev_base->units[i].regs_ptr = PISCSI_OFFSET;
     READSHORT(PISCSI_CMD_DRVTYPE, r);
@@ -292,10 +324,31 @@ static struct Library __attribute__((used)) *
       debugval(PISCSI_DBG_VAL2, dev_base->units[i].h);
       debugval(PISCSI_DBG_VAL3, dev_base->units[i].s);
       debug(PISCSI_DBG_MSG, DBG_CHS);
+
+      READSHORT(PISCSI_CMD_MEDIA, r);
+      dev_base->units[i].removable = (r & PISCSI_MEDIA_REMOVABLE) != 0;
+      dev_base->removable |= dev_base->units[i].removable;
     }
     dev_base->units[i].change_num++;
   }
 
+  READLONG(PISCSI_CMD_ASYNC, dev_base->async_depth);
+  if (dev_base->removable) {
+    // Drop changes from before the driver, then have the Pi signal them.
+    uint32_t changed;
+    READLONG(PISCSI_CMD_CHANGES, changed);
+    (void)changed;
+    WRITELONG(PISCSI_CMD_CHANGES, 1);
+  }
+  if (dev_base->async_depth || dev_base->removable) {
+    dev_base->async_irq.is_Node.ln_Type = NT_INTERRUPT;
+    dev_base->async_irq.is_Node.ln_Pri = 0;
+    dev_base->async_irq.is_Node.ln_Name = device_name;
+    dev_base->async_irq.is_Data = dev_base;
+    dev_base->async_irq.is_Code = piscsi_async_server;
+    AddIntServer(INTB_PORTS, &dev_base->async_irq);
+  }
+
   return dev;
 }
 
@@ -359,7 +412,11 @@ begin_io(struct Library* dev asm("a6"), struct IORequest* io asm("a1")) {
   debugval(PISCSI_DBG_VAL2, io->io_Flags);
   debugval(PISCSI_DBG_VAL3, (io->io_Flags & IOF_QUICK));
   debug(PISCSI_DBG_MSG, DBG_BEGINIO);
-  io->io_Error = piscsi_perform_io(u, io);
+  uint8_t err = piscsi_perform_io(u, io);
+  if (err == PISCSI_IO_QUEUED) {
+    return;
+  }
+  io->io_Error = err;
 
   if (!(io->io_Flags & IOF_QUICK)) {
     ReplyMsg(&io->io_Message);
@@ -376,6 +433,42 @@ abort_io(struct Library* dev asm("a6"), struct IORequest* io asm("a1")) {
   return IOERR_ABORTED;
 }
 
+// Signals disk changes and replies every request the Pi has finished.
+// Returns 0 so the other PORTS servers still run; the Pi raises PORTS again
+// if more complete meanwhile.
+uint32_t __attribute__((used)) piscsi_async_irq(void) {
+  uint32_t tag, err;
+
+  if (dev_base->removable) {
+    uint32_t changed;
+    READLONG(PISCSI_CMD_CHANGES, changed);
+    for (int i = 0; changed && i < NUM_UNITS; i++, changed >>= 1) {
+      if (changed & 1) {
+        struct piscsi_unit* u = &dev_base->units[i];
+        u->change_num++;
+        for (struct Node* n = u->change_ints.lh_Head; n->ln_Succ; n = n->ln_Succ) {
+          Cause((struct Interrupt*)((struct IOStdReq*)n)->io_Data);
+        }
+      }
+    }
+  }
+  if (!dev_base->async_depth) {
+    return 0;
+  }
+
+  READLONG(PISCSI_CMD_DONE, tag);
+  while (tag) {
+    struct IOStdReq* iostd = (struct IOStdReq*)tag;
+    READLONG(PISCSI_CMD_DONE_ERR, err);
+    iostd->io_Error = err;
+    iostd->io_Actual = err ? 0 : iostd->io_Length;
+    ReplyMsg(&iostd->io_Message);
+    READLONG(PISCSI_CMD_DONE, tag);
+  }
+
+  return 0;
+}
+
 uint8_t piscsi_rw(struct piscsi_unit* u, struct IORequest* io) {
   struct IOStdReq* iostd = (struct IOStdReq*)io;
   struct IOExtTD* iotd = (struct IOExtTD*)io;
@@ -385,6 +478,10 @@ uint8_t piscsi_rw(struct piscsi_unit* u, struct IORequest* io) {
   // uint32_t block, num_blocks;
   uint8_t sderr = 0;
   uint32_t block_size = 512;
+  uint16_t unit_num = u->unit_num;
+  uint32_t queued = 0, err = 0;
+  uint8_t quick = io->io_Flags & IOF_QUICK;
+  uint8_t type = io->io_Message.mn_Node.ln_Type;
 
   data = iotd->iotd_Req.io_Data;
   len = iotd->iotd_Req.io_Length;
@@ -400,6 +497,17 @@ uint8_t piscsi_rw(struct piscsi_unit* u, struct IORequest* io) {
     return IOERR_BADLENGTH;
   }
 
+  if (dev_base->async_depth) {
+    // The request may be replied from the interrupt server as soon as the
+    // command is written, so it has to look in flight before that. Keep the
+    // server from reading DONE_ERR between the command and our read of it.
+    Disable();
+    io->io_Flags &= ~IOF_QUICK;
+    io->io_Message.mn_Node.ln_Type = NT_MESSAGE;
+    WRITELONG(PISCSI_CMD_TAG, (uint32_t)io);
+    unit_num |= PISCSI_ASYNC_FLAG;
+  }
+
   switch (io->io_Command) {
   case TD_WRITE64:
   case NSCMD_TD_WRITE64:
@@ -409,7 +517,7 @@ uint8_t piscsi_rw(struct piscsi_unit* u, struct IORequest* io) {
     WRITELONG(PISCSI_CMD_ADDR2, len);
     WRITELONG(PISCSI_CMD_ADDR3, (uint32_t)data);
     WRITELONG(PISCSI_CMD_ADDR4, iostd->io_Actual);
-    WRITESHORT(PISCSI_CMD_WRITE64, u->unit_num);
+    WRITESHORT(PISCSI_CMD_WRITE64, unit_num);
     break;
   case TD_READ64:
   case NSCMD_TD_READ64:
@@ -417,23 +525,47 @@ uint8_t piscsi_rw(struct piscsi_unit* u, struct IORequest* io) {
     WRITELONG(PISCSI_CMD_ADDR2, len);
     WRITELONG(PISCSI_CMD_ADDR3, (uint32_t)data);
     WRITELONG(PISCSI_CMD_ADDR4, iostd->io_Actual);
-    WRITESHORT(PISCSI_CMD_READ64, u->unit_num);
+    WRITESHORT(PISCSI_CMD_READ64, unit_num);
     break;
   case TD_FORMAT:
   case CMD_WRITE:
     WRITELONG(PISCSI_CMD_ADDR1, iostd->io_Offset);
     WRITELONG(PISCSI_CMD_ADDR2, len);
     WRITELONG(PISCSI_CMD_ADDR3, (uint32_t)data);
-    WRITESHORT(PISCSI_CMD_WRITEBYTES, u->unit_num);
+    WRITESHORT(PISCSI_CMD_WRITEBYTES, unit_num);
     break;
   case CMD_READ:
     WRITELONG(PISCSI_CMD_ADDR1, iostd->io_Offset);
     WRITELONG(PISCSI_CMD_ADDR2, len);
     WRITELONG(PISCSI_CMD_ADDR3, (uint32_t)data);
-    WRITESHORT(PISCSI_CMD_READBYTES, u->unit_num);
+    WRITESHORT(PISCSI_CMD_READBYTES, unit_num);
     break;
   }
 
+  if (dev_base->async_depth) {
+    READLONG(PISCSI_CMD_TAG, queued);
+    if (queued) {
+      Enable();
+      return PISCSI_IO_QUEUED;
+    }
+    // Done synchronously after all (chip RAM buffer or a full queue).
+    READLONG(PISCSI_CMD_DONE_ERR, err);
+    io->io_Flags |= quick;
+    io->io_Message.mn_Node.ln_Type = type;
+    Enable();
+    if (err) {
+      iostd->io_Actual = 0;
+      return err;
+    }
+  } else if (u->removable) {
+    // No disk in, or a write protected one.
+    READLONG(PISCSI_CMD_DONE_ERR, err);
+    if (err) {
+      iostd->io_Actual = 0;
+      return err;
+    }
+  }
+
   if (sderr) {
     iostd->io_Actual = 0;
 
@@ -671,6 +803,15 @@ uint8_t piscsi_scsi(struct piscsi_unit* u, struct IORequest* io) {
     }
     break;
 
+  case SCSICMD_SYNCHRONIZE_CACHE_10:
+    // Keep the interrupt server from completing a request in between.
+    Disable();
+    WRITESHORT(PISCSI_CMD_UPDATE, u->unit_num);
+    READLONG(PISCSI_CMD_UPDATE, i);
+    Enable();
+    if (i)
+      err = HFERR_BadStatus;
+    break;
   case SCSICMD_READ_DEFECT_DATA_10:
     break;
   case SCSICMD_CHANGE_DEFINITION:
@@ -720,6 +861,7 @@ uint8_t piscsi_perform_io(struct piscsi_unit* u, struct IORequest* io) {
   // uint32_t len;
   // uint32_t offset;
   uint8_t err = 0;
+  uint16_t state;
 
   if (!u->enabled) {
     return IOERR_OPENFAIL;
@@ -755,16 +897,38 @@ uint8_t piscsi_perform_io(struct piscsi_unit* u, struct IORequest* io) {
     DUMMYCMD;
   case CMD_UPDATE:
     /* Flush write buffer */
+    Disable();
+    WRITESHORT(PISCSI_CMD_UPDATE, u->unit_num);
+    READLONG(PISCSI_CMD_UPDATE, err);
+    Enable();
     DUMMYCMD;
   case TD_PROTSTATUS:
-    DUMMYCMD;
+    WRITESHORT(PISCSI_CMD_DRVNUMX, u->unit_num);
+    READSHORT(PISCSI_CMD_MEDIA, state);
+    iostd->io_Actual = (state & PISCSI_MEDIA_PROTECTED) != 0;
+    break;
   case TD_CHANGENUM:
     iostd->io_Actual = u->change_num;
     break;
   case TD_REMOVE:
     DUMMYCMD;
   case TD_CHANGESTATE:
-    DUMMYCMD;
+    WRITESHORT(PISCSI_CMD_DRVNUMX, u->unit_num);
+    READSHORT(PISCSI_CMD_MEDIA, state);
+    iostd->io_Actual = (state & PISCSI_MEDIA_PRESENT) == 0;
+    break;
+  case TD_ADDCHANGEINT:
+    // Kept until TD_REMCHANGEINT; a fixed unit never changes.
+    io->io_Flags &= ~IOF_QUICK;
+    Disable();
+    AddTail(&u->change_ints, &io->io_Message.mn_Node);
+    Enable();
+    return PISCSI_IO_QUEUED;
+  case TD_REMCHANGEINT:
+    Disable();
+    Remove(&io->io_Message.mn_Node);
+    Enable();
+    break;
   case TD_GETDRIVETYPE:
     iostd->io_Actual = DG_DIRECT_ACCESS;
     break;
@@ -783,7 +947,7 @@ uint8_t piscsi_perform_io(struct piscsi_unit* u, struct IORequest* io) {
     res->dg_TrackSectors = u->s;
     res->dg_BufMemType = MEMF_PUBLIC;
     res->dg_DeviceType = 0;
-    res->dg_Flags = 0;
+    res->dg_Flags = u->removable ? DGF_REMOVABLE : 0;
 
     return 0;
     break;
@@ -0,0 +1,284 @@
+// SPDX-License-Identifier: MIT
+// Background PiSCSI I/O. See piscsi-async.h for the driver protocol.
+
+#define _GNU_SOURCE // pthread_setname_np
+
+#include "piscsi-async.h"
+#include "piscsi-cache.h"
+#include "piscsi-io.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "metrics/metrics.h"
+#include "pistorm_trace.h"
+#include "platforms/amiga/amiga-interrupts.h"
+#include "platforms/amiga/rtg/rtg.h"
+
+enum { SLOT_FREE, SLOT_QUEUED, SLOT_RUNNING, SLOT_DONE };
+
+// A request keeps its slot until the driver has popped its completion, so
+// the driver can never fall more than PISCSI_ASYNC_SLOTS completions behind.
+struct slot {
+  struct piscsi_async_req req;
+  uint64_t seq;      // submission order
+  uint64_t done_seq; // completion order
+  uint8_t state;
+  uint8_t error;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+static pthread_t workers[PISCSI_ASYNC_MAX_THREADS];
+static unsigned int num_workers;
+static uint8_t quit;
+
+static struct slot slots[PISCSI_ASYNC_SLOTS];
+static uint64_t next_seq, next_done_seq;
+static unsigned int inflight;
+static unsigned int done_count; // read without the lock by piscsi_async_poll()
+
+static struct piscsi_async_stats stats;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int overlaps(const struct piscsi_async_req* a, const struct piscsi_async_req* b) {
+  return a->unit == b->unit && (a->write || b->write) && a->offset < b->offset + b->len &&
+         b->offset < a->offset + a->len;
+}
+
+// The oldest queued request that no older request on its unit conflicts
+// with. Called with the lock held.
+static struct slot* next_runnable(void) {
+  struct slot* best = NULL;
+  for (unsigned int i = 0; i < PISCSI_ASYNC_SLOTS; i++) {
+    struct slot* s = &slots[i];
+    if (s->state != SLOT_QUEUED || (best && best->seq < s->seq)) {
+      continue;
+    }
+    int blocked = 0;
+    for (unsigned int j = 0; j < PISCSI_ASYNC_SLOTS && !blocked; j++) {
+      const struct slot* o = &slots[j];
+      blocked = (o->state == SLOT_QUEUED || o->state == SLOT_RUNNING) && o->seq < s->seq &&
+                overlaps(&o->req, &s->req);
+    }
+    if (blocked) {
+      stats.ordered++;
+      continue;
+    }
+    best = s;
+  }
+  return best;
+}
+
+static uint8_t do_io(const struct piscsi_async_req* r) {
+  ssize_t n = r->write ? piscsi_cache_write(r->unit, r->fd, r->data, r->len, r->offset)
+                       : piscsi_cache_read(r->unit, r->fd, r->data, r->len, r->offset);
+  PS_TRACE4(piscsi_end, r->cmd, r->unit, n == (ssize_t)r->len ? (int64_t)n : -1, r->tag);
+  if (n != (ssize_t)r->len) {
+    LOG_WARN("[PISCSI] Unit %u: %s of %u bytes at %llu failed: %s\n", r->unit,
+             r->write ? "write" : "read", r->len, (unsigned long long)r->offset,
+             n < 0 ? strerror(errno) : "end of file");
+    return PISCSI_ASYNC_IOERR;
+  }
+  if (!r->write) {
+    // A read into RTG VRAM has to reach the display.
+    rtg_mark_dirty_addr(r->address, r->len);
+  }
+  return 0;
+}
+
+static void* worker_task(void* arg) {
+  (void)arg;
+  pthread_mutex_lock(&lock);
+  while (!quit) {
+    struct slot* s = next_runnable();
+    if (!s) {
+      pthread_cond_wait(&work, &lock);
+      continue;
+    }
+    s->state = SLOT_RUNNING;
+    struct piscsi_async_req req = s->req;
+    pthread_mutex_unlock(&lock);
+
+    uint64_t t0 = now_ns();
+    uint8_t error = do_io(&req);
+    uint64_t t = now_ns() - t0;
+
+    pthread_mutex_lock(&lock);
+    stats.io_ns += t;
+    stats.errors += error != 0;
+    s->state = SLOT_DONE;
+    s->error = error;
+    s->done_seq = next_done_seq++;
+    inflight--;
+    __atomic_store_n(&done_count, done_count + 1, __ATOMIC_RELEASE);
+    // A finished request may unblock an overlapping one, and a drain may be
+    // waiting for it.
+    pthread_cond_broadcast(&work);
+    pthread_cond_broadcast(&idle);
+    pthread_mutex_unlock(&lock);
+    amiga_emulate_irq(PORTS);
+    pthread_mutex_lock(&lock);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+unsigned int piscsi_async_start(unsigned int threads) {
+  threads = piscsi_env_uint("PISTORM_PISCSI_ASYNC", threads);
+  if (threads > PISCSI_ASYNC_MAX_THREADS) {
+    threads = PISCSI_ASYNC_MAX_THREADS;
+  }
+  piscsi_async_stop();
+  if (!threads) {
+    return 0;
+  }
+
+  quit = 0;
+  for (unsigned int i = 0; i < threads; i++) {
+    if (pthread_create(&workers[i], NULL, worker_task, NULL) != 0) {
+      LOG_ERROR("[PISCSI] Could not start I/O worker %u.\n", i);
+      break;
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "pistorm64: io%u", i);
+    pthread_setname_np(workers[i], name);
+    num_workers++;
+  }
+  if (num_workers) {
+    LOG_INFO("[PISCSI] Asynchronous I/O with %u workers, %u requests in flight.\n", num_workers,
+             PISCSI_ASYNC_SLOTS);
+  }
+  return num_workers;
+}
+
+void piscsi_async_stop(void) {
+  if (!num_workers) {
+    return;
+  }
+  piscsi_async_drain(0xFF);
+  pthread_mutex_lock(&lock);
+  quit = 1;
+  pthread_cond_broadcast(&work);
+  pthread_mutex_unlock(&lock);
+  for (unsigned int i = 0; i < num_workers; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  num_workers = 0;
+  piscsi_async_reset();
+  if (stats.queued) {
+    LOG_INFO("[PISCSI] %llu asynchronous requests, %llu with the queue full, %llu errors, up "
+             "to %llu in flight.\n",
+             (unsigned long long)stats.queued, (unsigned long long)stats.queue_full,
+             (unsigned long long)stats.errors, (unsigned long long)stats.max_inflight);
+  }
+}
+
+uint32_t piscsi_async_depth(void) {
+  return num_workers ? PISCSI_ASYNC_SLOTS : 0;
+}
+
+int piscsi_async_submit(const struct piscsi_async_req* req) {
+  if (!num_workers) {
+    return 0;
+  }
+  pthread_mutex_lock(&lock);
+  struct slot* s = NULL;
+  for (unsigned int i = 0; i < PISCSI_ASYNC_SLOTS && !s; i++) {
+    if (slots[i].state == SLOT_FREE) {
+      s = &slots[i];
+    }
+  }
+  if (!s) {
+    stats.queue_full++;
+    pthread_mutex_unlock(&lock);
+    return 0;
+  }
+  s->req = *req;
+  s->seq = next_seq++;
+  s->state = SLOT_QUEUED;
+  inflight++;
+  stats.queued++;
+  METRICS_INC(piscsi_async_ops);
+  if (inflight > stats.max_inflight) {
+    stats.max_inflight = inflight;
+  }
+  pthread_cond_signal(&work);
+  pthread_mutex_unlock(&lock);
+  return 1;
+}
+
+void piscsi_async_drain(uint8_t unit) {
+  if (!num_workers) {
+    return;
+  }
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    int busy = 0;
+    for (unsigned int i = 0; i < PISCSI_ASYNC_SLOTS && !busy; i++) {
+      busy = (slots[i].state == SLOT_QUEUED || slots[i].state == SLOT_RUNNING) &&
+             (unit == 0xFF || slots[i].req.unit == unit);
+    }
+    if (!busy) {
+      break;
+    }
+    pthread_cond_wait(&idle, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void piscsi_async_reset(void) {
+  piscsi_async_drain(0xFF);
+  pthread_mutex_lock(&lock);
+  for (unsigned int i = 0; i < PISCSI_ASYNC_SLOTS; i++) {
+    slots[i].state = SLOT_FREE;
+  }
+  __atomic_store_n(&done_count, 0, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&lock);
+}
+
+uint32_t piscsi_async_pop(uint8_t* error) {
+  *error = 0;
+  if (!__atomic_load_n(&done_count, __ATOMIC_ACQUIRE)) {
+    return 0;
+  }
+  pthread_mutex_lock(&lock);
+  struct slot* first = NULL;
+  for (unsigned int i = 0; i < PISCSI_ASYNC_SLOTS; i++) {
+    if (slots[i].state == SLOT_DONE && (!first || slots[i].done_seq < first->done_seq)) {
+      first = &slots[i];
+    }
+  }
+  uint32_t tag = 0;
+  if (first) {
+    tag = first->req.tag;
+    *error = first->error;
+    first->state = SLOT_FREE;
+    __atomic_store_n(&done_count, done_count - 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&lock);
+  return tag;
+}
+
+void piscsi_async_poll(void) {
+  if (__atomic_load_n(&done_count, __ATOMIC_ACQUIRE) && !amiga_emulating_irq(PORTS)) {
+    amiga_emulate_irq(PORTS);
+  }
+}
+
+void piscsi_async_get_stats(struct piscsi_async_stats* out) {
+  pthread_mutex_lock(&lock);
+  *out = stats;
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_PISCSI_ASYNC_H
+#define PISTORM_PISCSI_ASYNC_H
+
+#include <stdint.h>
+
+/*
+ * Background I/O for PiSCSI. A driver that finds PISCSI_CMD_ASYNC non-zero
+ * writes the IORequest address to PISCSI_CMD_TAG and ORs PISCSI_ASYNC_FLAG
+ * (piscsi-enums.h) into the unit number it writes to a READ/WRITE command
+ * register, then reads PISCSI_CMD_TAG back:
+ *
+ *   1  the request is queued. A worker thread does the file I/O straight
+ *      into the Amiga buffer while the 68k keeps running, and a PORTS
+ *      interrupt announces the completion. The driver's interrupt server
+ *      reads PISCSI_CMD_DONE (the tag, 0 when there are no more) and then
+ *      PISCSI_CMD_DONE_ERR (io_Error) and replies the request.
+ *   0  the request was done synchronously, as without the flag; its
+ *      io_Error is in PISCSI_CMD_DONE_ERR. This happens for buffers the Pi
+ *      cannot address directly (chip RAM) and when the queue is full.
+ *
+ * Requests on different units, and reads of one unit, run in parallel. A
+ * request waits for earlier ones on the same unit whose byte range overlaps
+ * it when either side writes, and synchronous commands wait for everything
+ * queued on their unit, so the disk sees the order the driver issued.
+ *
+ *   setvar piscsi-async [threads]   worker threads (default 4), 0 disables
+ *   PISTORM_PISCSI_ASYNC            same, overrides the config file
+ *
+ * Without either, background I/O stays off: piscsi.rom still carries a
+ * driver from before this protocol, and one built from piscsi-amiga-2.c has
+ * to be loaded for it to be used.
+ */
+
+#define PISCSI_ASYNC_SLOTS 32
+#define PISCSI_ASYNC_DEFAULT_THREADS 4
+#define PISCSI_ASYNC_MAX_THREADS 16
+// io_Error for a failed or short transfer (TDERR_NotSpecified).
+#define PISCSI_ASYNC_IOERR 20
+
+struct piscsi_async_req {
+  uint32_t tag;     // handed back through PISCSI_CMD_DONE
+  uint16_t cmd;     // the command register, for the piscsi_end probe
+  uint8_t unit;
+  uint8_t write;
+  int fd;
+  uint64_t offset;
+  uint32_t len;
+  uint8_t* data;    // the Amiga buffer in Pi memory
+  uint32_t address; // and its 68k address, for the RTG dirty map
+};
+
+struct piscsi_async_stats {
+  uint64_t queued;      // requests run by the workers
+  uint64_t queue_full;  // async requests done synchronously for want of a slot
+  uint64_t errors;      // requests completed with an error
+  uint64_t ordered;     // times a worker passed over a request behind an overlapping one
+  uint64_t max_inflight;
+  uint64_t io_ns;       // summed worker time in pread/pwrite
+};
+
+// Start `threads` workers (0 stops them). PISTORM_PISCSI_ASYNC overrides
+// `threads`. Returns the number of workers running.
+unsigned int piscsi_async_start(unsigned int threads);
+void piscsi_async_stop(void);
+// Queue depth offered to the driver, 0 while async I/O is off.
+uint32_t piscsi_async_depth(void);
+
+// Queue a request. Returns 0 if it was not queued (async off or no free
+// slot); the caller then does it synchronously.
+int piscsi_async_submit(const struct piscsi_async_req* req);
+// Wait for every queued request on `unit` (all units for 0xFF) to finish.
+void piscsi_async_drain(uint8_t unit);
+// Wait for all requests and drop completions nobody popped; on Amiga reset
+// the driver that would have collected them is gone.
+void piscsi_async_reset(void);
+
+// Next completion for the driver: returns its tag, 0 if there is none.
+uint32_t piscsi_async_pop(uint8_t* error);
+// Raise PORTS again if completions are still waiting; the CPU loop calls
+// this so one arriving while the driver's server was finishing is not lost.
+void piscsi_async_poll(void);
+
+void piscsi_async_get_stats(struct piscsi_async_stats* stats);
+
+#endif /* PISTORM_PISCSI_ASYNC_H */
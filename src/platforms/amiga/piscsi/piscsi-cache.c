@@ -0,0 +1,814 @@
+// SPDX-License-Identifier: MIT
+// PiSCSI block cache. See piscsi-cache.h for the policies and settings.
+
+#define _GNU_SOURCE // pthread_setname_np
+
+#include "piscsi-cache.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics/metrics.h"
+#include "piscsi-io.h"
+#include "piscsi-mmap.h"
+#include "piscsi-overlay.h"
+#include "piscsi-zhdf.h"
+
+#define NUM_CACHE_UNITS 8
+#define SECTOR 512
+#define LINE_SECTORS (PISCSI_CACHE_LINE / SECTOR)
+#define FULL 0xFF
+// Lines read or written back by one file operation. The cache always holds
+// at least two runs, so the lines of a run in progress are never evicted.
+#define MAX_RUN 64
+#define MIN_LINES (2 * MAX_RUN)
+
+struct line {
+  uint64_t index; // file offset / PISCSI_CACHE_LINE
+  struct line* hnext;
+  struct line* prev; // LRU list, most recently used first
+  struct line* next;
+  uint8_t* data;
+  uint8_t valid; // per sector
+  uint8_t dirty; // per sector, always a subset of valid
+  uint8_t ahead; // read ahead and not used yet
+};
+
+struct unit_cache {
+  pthread_mutex_t lock;
+  int fd; // -1 while the unit is not cached
+  uint64_t size;
+  enum piscsi_cache_policy policy;
+  uint32_t readahead; // lines
+  uint32_t nlines;
+  struct line* lines;
+  struct line** hash;
+  uint32_t hash_mask;
+  struct line lru; // list head
+  uint32_t free_lines;
+  uint32_t ndirty;
+  uint8_t werr;      // a write-back failed since the driver was last told
+  uint64_t seq_next; // where a sequential reader continues
+  uint8_t* scratch;  // MAX_RUN lines
+};
+
+static struct unit_cache units[NUM_CACHE_UNITS];
+static pthread_once_t units_once = PTHREAD_ONCE_INIT;
+
+static unsigned int cfg_mb;
+static enum piscsi_cache_policy cfg_policy = PISCSI_CACHE_THROUGH;
+static unsigned int cfg_flush = PISCSI_CACHE_DEFAULT_FLUSH;
+static unsigned int cfg_readahead = PISCSI_CACHE_DEFAULT_READAHEAD;
+
+static pthread_mutex_t flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t flusher;
+static uint8_t flusher_running, flusher_quit;
+static unsigned int flusher_interval;
+
+static struct piscsi_cache_stats stats;
+#define STAT_ADD(field, n) __atomic_fetch_add(&stats.field, (uint64_t)(n), __ATOMIC_RELAXED)
+
+static const char* policy_names[] = {"through", "back", "update"};
+
+static void init_units(void) {
+  for (int i = 0; i < NUM_CACHE_UNITS; i++) {
+    pthread_mutex_init(&units[i].lock, NULL);
+    units[i].fd = -1;
+  }
+}
+
+static struct unit_cache* get_unit(uint8_t unit) {
+  pthread_once(&units_once, init_units);
+  return unit < NUM_CACHE_UNITS ? &units[unit] : NULL;
+}
+
+// The unit's image, through its overlay if it has one.
+static ssize_t image_read(struct unit_cache* c, uint8_t* buf, size_t len, uint64_t offset) {
+  return piscsi_overlay_read((uint8_t)(c - units), c->fd, buf, (uint32_t)len, offset);
+}
+
+static ssize_t image_write(struct unit_cache* c, const uint8_t* buf, size_t len,
+                           uint64_t offset) {
+  return piscsi_overlay_write((uint8_t)(c - units), c->fd, buf, (uint32_t)len, offset);
+}
+
+// Sectors of a line touched by bytes [lo, lo + len).
+static uint8_t sector_mask(uint32_t lo, uint32_t len) {
+  uint32_t first = lo / SECTOR, last = (lo + len - 1) / SECTOR;
+  return (uint8_t)(((1u << (last + 1)) - 1) & ~((1u << first) - 1));
+}
+
+// Sectors of a line entirely covered by bytes [lo, lo + len).
+static uint8_t sector_mask_full(uint32_t lo, uint32_t len) {
+  uint32_t first = (lo + SECTOR - 1) / SECTOR, end = (lo + len) / SECTOR;
+  return end > first ? (uint8_t)(((1u << end) - 1) & ~((1u << first) - 1)) : 0;
+}
+
+static uint32_t hash_index(const struct unit_cache* c, uint64_t index) {
+  return (uint32_t)((index * 0x9E3779B97F4A7C15ull) >> 32) & c->hash_mask;
+}
+
+static struct line* lookup(struct unit_cache* c, uint64_t index) {
+  for (struct line* l = c->hash[hash_index(c, index)]; l; l = l->hnext) {
+    if (l->index == index) {
+      return l;
+    }
+  }
+  return NULL;
+}
+
+static void lru_unlink(struct line* l) {
+  l->prev->next = l->next;
+  l->next->prev = l->prev;
+}
+
+static void touch(struct unit_cache* c, struct line* l) {
+  lru_unlink(l);
+  l->next = c->lru.next;
+  l->prev = &c->lru;
+  c->lru.next->prev = l;
+  c->lru.next = l;
+}
+
+// Write the dirty sectors of `l` to the image. Sectors that fail stay dirty
+// and are tried again on the next flush. Called with the lock held.
+static int write_back(struct unit_cache* c, struct line* l) {
+  uint64_t base = l->index * PISCSI_CACHE_LINE;
+  uint8_t failed = 0;
+  for (unsigned int s = 0; s < LINE_SECTORS;) {
+    if (!(l->dirty & (1u << s))) {
+      s++;
+      continue;
+    }
+    unsigned int e = s;
+    while (e < LINE_SECTORS && (l->dirty & (1u << e))) {
+      e++;
+    }
+    uint64_t off = base + s * SECTOR;
+    size_t len = (e - s) * SECTOR;
+    if (off + len > c->size) {
+      len = off < c->size ? (size_t)(c->size - off) : 0;
+    }
+    if (len && image_write(c, l->data + s * SECTOR, len, off) < 0) {
+      LOG_ERROR("[PISCSI] Cache write-back of %zu bytes at %llu failed: %s\n", len,
+                (unsigned long long)off, strerror(errno));
+      STAT_ADD(errors, 1);
+      failed |= l->dirty & (uint8_t)(((1u << e) - 1) & ~((1u << s) - 1));
+    } else {
+      STAT_ADD(writeback_bytes, len);
+      METRICS_ADD(piscsi_cache_writeback_bytes, len);
+    }
+    s = e;
+  }
+  l->dirty = failed;
+  if (failed) {
+    c->werr = 1;
+    return -1;
+  }
+  c->ndirty--;
+  return 0;
+}
+
+// Find the line for `index`, taking a free or the least recently used one if
+// it is not cached. A dirty line that cannot be written back is kept and the
+// next one up the LRU list is taken instead, looking at no more than MAX_RUN
+// of them so the run in progress is left alone. The line is moved to the
+// front of the LRU list. Returns NULL if there is no memory or no line that
+// can be evicted.
+static struct line* get_line(struct unit_cache* c, uint64_t index) {
+  struct line* l = lookup(c, index);
+  if (l) {
+    touch(c, l);
+    return l;
+  }
+  if (c->free_lines) {
+    l = &c->lines[c->nlines - c->free_lines];
+    if (!l->data && !(l->data = malloc(PISCSI_CACHE_LINE))) {
+      return NULL;
+    }
+    c->free_lines--;
+    l->prev = l->next = l;
+  } else {
+    l = c->lru.prev;
+    for (int tries = 0; l->dirty && write_back(c, l) < 0; l = l->prev) {
+      if (++tries == MAX_RUN) {
+        return NULL;
+      }
+    }
+    struct line** p = &c->hash[hash_index(c, l->index)];
+    while (*p != l) {
+      p = &(*p)->hnext;
+    }
+    *p = l->hnext;
+    STAT_ADD(evictions, 1);
+  }
+  l->index = index;
+  l->valid = l->dirty = l->ahead = 0;
+  uint32_t h = hash_index(c, index);
+  l->hnext = c->hash[h];
+  c->hash[h] = l;
+  touch(c, l);
+  return l;
+}
+
+// Make lines [index, index + count) valid with one read of the image. Lines
+// past `last` are read-ahead. Sectors that are already valid, dirty ones in
+// particular, are kept. Called with the lock held.
+static int fill_run(struct unit_cache* c, uint64_t index, uint32_t count, uint64_t last) {
+  struct line* run[MAX_RUN];
+  // Take every line first: an eviction writes back before the read below.
+  for (uint32_t i = 0; i < count; i++) {
+    if (!(run[i] = get_line(c, index + i))) {
+      return -1;
+    }
+  }
+  uint64_t off = index * PISCSI_CACHE_LINE;
+  size_t len = (size_t)count * PISCSI_CACHE_LINE;
+  if (off + len > c->size) {
+    len = (size_t)(c->size - off);
+  }
+  ssize_t got = image_read(c, c->scratch, len, off);
+  if (got < 0) {
+    LOG_WARN("[PISCSI] Cache read of %zu bytes at %llu failed: %s\n", len,
+             (unsigned long long)off, strerror(errno));
+    STAT_ADD(errors, 1);
+    return -1;
+  }
+  // Past the end of the image reads as zeroes.
+  memset(c->scratch + got, 0, (size_t)count * PISCSI_CACHE_LINE - (size_t)got);
+
+  for (uint32_t i = 0; i < count; i++) {
+    struct line* l = run[i];
+    const uint8_t* src = c->scratch + (size_t)i * PISCSI_CACHE_LINE;
+    if (!l->valid) {
+      memcpy(l->data, src, PISCSI_CACHE_LINE);
+    } else {
+      for (unsigned int s = 0; s < LINE_SECTORS; s++) {
+        if (!(l->valid & (1u << s))) {
+          memcpy(l->data + s * SECTOR, src + s * SECTOR, SECTOR);
+        }
+      }
+    }
+    l->valid = FULL;
+    if (index + i > last) {
+      l->ahead = 1;
+      STAT_ADD(readahead, 1);
+      METRICS_ADD(piscsi_cache_readahead_bytes, PISCSI_CACHE_LINE);
+    }
+  }
+  return 0;
+}
+
+static int cmp_lines(const void* a, const void* b) {
+  const struct line* x = *(struct line* const*)a;
+  const struct line* y = *(struct line* const*)b;
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// Dirty sectors of one line that a batch entry writes.
+struct piece {
+  struct line* line;
+  uint8_t mask;
+};
+
+// Write a batch of contiguous dirty sectors with one pwritev(), or piece by
+// piece if that fails or comes up short. Only the pieces that were written
+// are marked clean. Returns -1 if any failed.
+static int write_iov(struct unit_cache* c, struct iovec* iov, const struct piece* piece, int n,
+                     uint64_t off) {
+  size_t len = 0;
+  for (int i = 0; i < n; i++) {
+    len += iov[i].iov_len;
+  }
+  ssize_t r = -1;
+  // An overlay or a compressed image places each chunk itself.
+  if (!piscsi_overlay_active((uint8_t)(c - units)) && !piscsi_zhdf_active((uint8_t)(c - units))) {
+    do {
+      r = pwritev(c->fd, iov, n, (off_t)off);
+    } while (r < 0 && errno == EINTR);
+  }
+  int ret = 0;
+  if (r != (ssize_t)len) {
+    for (int i = 0; i < n; off += iov[i++].iov_len) {
+      if (image_write(c, iov[i].iov_base, iov[i].iov_len, off) < 0) {
+        LOG_ERROR("[PISCSI] Cache write-back of %zu bytes at %llu failed: %s\n", iov[i].iov_len,
+                  (unsigned long long)off, strerror(errno));
+        STAT_ADD(errors, 1);
+        len -= iov[i].iov_len;
+        ret = -1;
+      } else {
+        piece[i].line->dirty &= (uint8_t)~piece[i].mask;
+      }
+    }
+  } else {
+    for (int i = 0; i < n; i++) {
+      piece[i].line->dirty &= (uint8_t)~piece[i].mask;
+    }
+  }
+  STAT_ADD(writeback_bytes, len);
+  METRICS_ADD(piscsi_cache_writeback_bytes, len);
+  return ret;
+}
+
+// Write every dirty sector in file order, each stretch of contiguous dirty
+// sectors with one pwritev() even across lines, then fdatasync(). Sectors
+// that fail stay dirty for the next flush. Returns -1 if anything failed.
+// Called with the lock held.
+static int flush_unit(struct unit_cache* c) {
+  if (c->fd == -1 || !c->ndirty) {
+    return 0;
+  }
+  int ret = 0;
+  struct line** dirty = malloc(sizeof(*dirty) * c->ndirty);
+  if (!dirty) {
+    // Out of memory: write them one by one in LRU order instead.
+    for (struct line* l = c->lru.next; l != &c->lru; l = l->next) {
+      if (l->dirty && write_back(c, l) < 0) {
+        ret = -1;
+      }
+    }
+  } else {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < c->nlines - c->free_lines; i++) {
+      if (c->lines[i].dirty) {
+        dirty[n++] = &c->lines[i];
+      }
+    }
+    qsort(dirty, n, sizeof(*dirty), cmp_lines);
+    struct iovec iov[MAX_RUN];
+    struct piece piece[MAX_RUN];
+    int niov = 0;
+    uint64_t start = 0, next = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      struct line* l = dirty[i];
+      for (unsigned int s = 0; s < LINE_SECTORS;) {
+        if (!(l->dirty & (1u << s))) {
+          s++;
+          continue;
+        }
+        unsigned int e = s;
+        while (e < LINE_SECTORS && (l->dirty & (1u << e))) {
+          e++;
+        }
+        uint64_t off = l->index * PISCSI_CACHE_LINE + s * SECTOR;
+        size_t len = (e - s) * SECTOR;
+        if (off + len > c->size) {
+          len = off < c->size ? (size_t)(c->size - off) : 0;
+        }
+        uint8_t mask = (uint8_t)(((1u << e) - 1) & ~((1u << s) - 1));
+        if (niov && (off != next || niov == MAX_RUN)) {
+          if (write_iov(c, iov, piece, niov, start) < 0) {
+            ret = -1;
+          }
+          niov = 0;
+        }
+        if (len) {
+          if (!niov) {
+            start = off;
+          }
+          iov[niov].iov_base = l->data + s * SECTOR;
+          iov[niov].iov_len = len;
+          piece[niov].line = l;
+          piece[niov++].mask = mask;
+          next = off + len;
+        } else {
+          // Entirely past the end of the image, nothing to write.
+          l->dirty &= (uint8_t)~mask;
+        }
+        s = e;
+      }
+    }
+    if (niov && write_iov(c, iov, piece, niov, start) < 0) {
+      ret = -1;
+    }
+    c->ndirty = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      if (dirty[i]->dirty) {
+        c->ndirty++;
+      }
+    }
+    free(dirty);
+  }
+  if (piscsi_overlay_sync((uint8_t)(c - units), c->fd) < 0 && errno != EINVAL) {
+    LOG_WARN("[PISCSI] fdatasync failed: %s\n", strerror(errno));
+    STAT_ADD(errors, 1);
+    ret = -1;
+  }
+  if (ret < 0) {
+    c->werr = 1;
+  }
+  STAT_ADD(flushes, 1);
+  METRICS_INC(piscsi_cache_flushes);
+  return ret;
+}
+
+static void* flusher_task(void* arg) {
+  (void)arg;
+  pthread_mutex_lock(&flusher_lock);
+  while (!flusher_quit) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += flusher_interval;
+    pthread_cond_timedwait(&flusher_wake, &flusher_lock, &ts);
+    if (flusher_quit) {
+      break;
+    }
+    pthread_mutex_unlock(&flusher_lock);
+    for (int i = 0; i < NUM_CACHE_UNITS; i++) {
+      struct unit_cache* c = &units[i];
+      pthread_mutex_lock(&c->lock);
+      if (c->policy == PISCSI_CACHE_BACK) {
+        flush_unit(c);
+      }
+      pthread_mutex_unlock(&c->lock);
+    }
+    pthread_mutex_lock(&flusher_lock);
+  }
+  pthread_mutex_unlock(&flusher_lock);
+  return NULL;
+}
+
+static void start_flusher(unsigned int seconds) {
+  pthread_mutex_lock(&flusher_lock);
+  if (flusher_running) {
+    // One thread for all units, at the shortest interval asked for.
+    if (seconds < flusher_interval) {
+      flusher_interval = seconds;
+      pthread_cond_signal(&flusher_wake);
+    }
+    pthread_mutex_unlock(&flusher_lock);
+    return;
+  }
+  flusher_interval = seconds;
+  flusher_quit = 0;
+  if (pthread_create(&flusher, NULL, flusher_task, NULL) != 0) {
+    LOG_ERROR("[PISCSI] Could not start the cache flush thread, dirty data is only written "
+              "on eviction, reset and shutdown.\n");
+  } else {
+    pthread_setname_np(flusher, "pistorm64: sync");
+    flusher_running = 1;
+  }
+  pthread_mutex_unlock(&flusher_lock);
+}
+
+void piscsi_cache_set_size(unsigned int mb) {
+  cfg_mb = mb;
+}
+
+static int parse_policy(const char* name) {
+  for (unsigned int i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]); i++) {
+    if (strcasecmp(name, policy_names[i]) == 0) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+int piscsi_cache_set_policy(const char* name) {
+  int policy = parse_policy(name);
+  if (policy < 0) {
+    return -1;
+  }
+  cfg_policy = (enum piscsi_cache_policy)policy;
+  return 0;
+}
+
+void piscsi_cache_set_flush(unsigned int seconds) {
+  cfg_flush = seconds;
+}
+
+void piscsi_cache_set_readahead(unsigned int kb) {
+  cfg_readahead = kb;
+}
+
+void piscsi_cache_attach(uint8_t unit, int fd, uint64_t size) {
+  struct unit_cache* c = get_unit(unit);
+  if (!c) {
+    return;
+  }
+  piscsi_cache_detach(unit);
+
+  unsigned int mb = piscsi_env_uint("PISTORM_PISCSI_CACHE_MB", cfg_mb);
+  enum piscsi_cache_policy policy = cfg_policy;
+  const char* env = getenv("PISTORM_PISCSI_CACHE_POLICY");
+  if (env && *env) {
+    int p = parse_policy(env);
+    if (p < 0) {
+      LOG_WARN("[PISCSI] Unknown cache policy %s.\n", env);
+    } else {
+      policy = (enum piscsi_cache_policy)p;
+    }
+  }
+  unsigned int flush = piscsi_env_uint("PISTORM_PISCSI_CACHE_FLUSH", cfg_flush);
+  unsigned int readahead = piscsi_env_uint("PISTORM_PISCSI_READAHEAD", cfg_readahead);
+  if (!mb) {
+    return;
+  }
+
+  uint32_t nlines = (uint32_t)((uint64_t)mb * 1024 * 1024 / PISCSI_CACHE_LINE);
+  if (nlines < MIN_LINES) {
+    nlines = MIN_LINES;
+  }
+  uint32_t buckets = 1;
+  while (buckets < nlines) {
+    buckets <<= 1;
+  }
+
+  pthread_mutex_lock(&c->lock);
+  c->lines = calloc(nlines, sizeof(*c->lines));
+  c->hash = calloc(buckets, sizeof(*c->hash));
+  c->scratch = malloc((size_t)MAX_RUN * PISCSI_CACHE_LINE);
+  if (!c->lines || !c->hash || !c->scratch) {
+    LOG_ERROR("[PISCSI] Out of memory for the unit %u cache.\n", unit);
+    free(c->lines);
+    free(c->hash);
+    free(c->scratch);
+    c->lines = NULL;
+    c->hash = NULL;
+    c->scratch = NULL;
+    pthread_mutex_unlock(&c->lock);
+    return;
+  }
+  c->nlines = c->free_lines = nlines;
+  c->hash_mask = buckets - 1;
+  c->lru.next = c->lru.prev = &c->lru;
+  c->ndirty = 0;
+  c->werr = 0;
+  c->seq_next = UINT64_MAX;
+  c->readahead = readahead * 1024 / PISCSI_CACHE_LINE;
+  if (c->readahead > MAX_RUN - 1) {
+    c->readahead = MAX_RUN - 1;
+  }
+  c->policy = policy;
+  c->size = size;
+  c->fd = fd;
+  pthread_mutex_unlock(&c->lock);
+
+  if (policy == PISCSI_CACHE_BACK) {
+    start_flusher(flush ? flush : 1);
+  }
+  LOG_INFO("[PISCSI] Unit %u: %uMB cache, write-%s, %uKB read-ahead.\n", unit,
+           nlines * PISCSI_CACHE_LINE / (1024 * 1024), policy_names[policy],
+           c->readahead * PISCSI_CACHE_LINE / 1024);
+}
+
+void piscsi_cache_detach(uint8_t unit) {
+  struct unit_cache* c = get_unit(unit);
+  if (!c) {
+    return;
+  }
+  pthread_mutex_lock(&c->lock);
+  if (c->fd != -1) {
+    if (flush_unit(c) < 0 && c->ndirty) {
+      LOG_ERROR("[PISCSI] Unit %u: %u cache lines could not be written back and are lost.\n",
+                unit, c->ndirty);
+    }
+    for (uint32_t i = 0; i < c->nlines; i++) {
+      free(c->lines[i].data);
+    }
+    free(c->lines);
+    free(c->hash);
+    free(c->scratch);
+    c->lines = NULL;
+    c->hash = NULL;
+    c->scratch = NULL;
+    c->fd = -1;
+  }
+  pthread_mutex_unlock(&c->lock);
+}
+
+void piscsi_cache_flush(uint8_t unit) {
+  for (uint8_t i = 0; i < NUM_CACHE_UNITS; i++) {
+    if (unit == 0xFF || unit == i) {
+      struct unit_cache* c = get_unit(i);
+      pthread_mutex_lock(&c->lock);
+      flush_unit(c);
+      pthread_mutex_unlock(&c->lock);
+    }
+  }
+}
+
+int piscsi_cache_update(uint8_t unit) {
+  struct unit_cache* c = get_unit(unit);
+  if (!c) {
+    return 0;
+  }
+  pthread_mutex_lock(&c->lock);
+  if (c->policy == PISCSI_CACHE_UPDATE) {
+    flush_unit(c);
+  }
+  // Report write-backs that failed since the last write or update, here or
+  // on the flusher thread.
+  int ret = c->werr ? -1 : 0;
+  c->werr = 0;
+  pthread_mutex_unlock(&c->lock);
+  return ret;
+}
+
+void piscsi_cache_stop(void) {
+  pthread_mutex_lock(&flusher_lock);
+  uint8_t running = flusher_running;
+  flusher_quit = 1;
+  pthread_cond_signal(&flusher_wake);
+  pthread_mutex_unlock(&flusher_lock);
+  if (running) {
+    pthread_join(flusher, NULL);
+    flusher_running = 0;
+  }
+  for (uint8_t i = 0; i < NUM_CACHE_UNITS; i++) {
+    piscsi_cache_detach(i);
+  }
+  if (stats.hits + stats.misses) {
+    LOG_INFO("[PISCSI] Cache: %llu hits, %llu misses, %llu lines read ahead (%llu used), %llu "
+             "bytes written back in %llu flushes, %llu errors.\n",
+             (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+             (unsigned long long)stats.readahead, (unsigned long long)stats.readahead_hits,
+             (unsigned long long)stats.writeback_bytes, (unsigned long long)stats.flushes,
+             (unsigned long long)stats.errors);
+  }
+}
+
+ssize_t piscsi_cache_read(uint8_t unit, int fd, uint8_t* buf, uint32_t len, uint64_t offset) {
+  struct unit_cache* c = get_unit(unit);
+  if (!c || !len) {
+    return piscsi_mmap_read(unit, fd, buf, len, offset);
+  }
+  pthread_mutex_lock(&c->lock);
+  if (c->fd != fd) {
+    pthread_mutex_unlock(&c->lock);
+    return piscsi_mmap_read(unit, fd, buf, len, offset);
+  }
+  if (offset >= c->size) {
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+  }
+  uint64_t end = offset + len;
+  if (end > c->size) {
+    end = c->size;
+  }
+  int sequential = offset == c->seq_next;
+  c->seq_next = end;
+  uint64_t last = (end - 1) / PISCSI_CACHE_LINE;
+  uint64_t limit = last;
+  if (sequential) {
+    uint64_t eof = (c->size - 1) / PISCSI_CACHE_LINE;
+    limit = last + c->readahead < eof ? last + c->readahead : eof;
+  }
+
+  uint64_t pos = offset;
+  uint64_t fresh = 0; // lines before this were just read, not hits
+  while (pos < end) {
+    uint64_t index = pos / PISCSI_CACHE_LINE;
+    uint32_t lo = (uint32_t)(pos % PISCSI_CACHE_LINE);
+    uint32_t n = PISCSI_CACHE_LINE - lo;
+    if (n > end - pos) {
+      n = (uint32_t)(end - pos);
+    }
+    uint8_t need = sector_mask(lo, n);
+    struct line* l = lookup(c, index);
+    if (l && (l->valid & need) == need) {
+      touch(c, l);
+      if (index >= fresh) {
+        STAT_ADD(hits, 1);
+        METRICS_INC(piscsi_cache_hits);
+      }
+      if (l->ahead) {
+        l->ahead = 0;
+        STAT_ADD(readahead_hits, 1);
+      }
+    } else {
+      // Read this line and the following ones that are not fully cached,
+      // up to the end of the request plus the read-ahead.
+      uint32_t count = 1;
+      while (index + count <= limit && count < MAX_RUN) {
+        struct line* o = lookup(c, index + count);
+        if (o && o->valid == FULL) {
+          break;
+        }
+        count++;
+      }
+      uint64_t in_request = last - index + 1;
+      STAT_ADD(misses, count < in_request ? count : in_request);
+      METRICS_ADD(piscsi_cache_misses, count < in_request ? count : in_request);
+      if (fill_run(c, index, count, last) < 0) {
+        pthread_mutex_unlock(&c->lock);
+        return pos > offset ? (ssize_t)(pos - offset) : -1;
+      }
+      fresh = index + count;
+      l = lookup(c, index);
+    }
+    memcpy(buf + (pos - offset), l->data + lo, n);
+    pos += n;
+  }
+  pthread_mutex_unlock(&c->lock);
+  return (ssize_t)(end - offset);
+}
+
+ssize_t piscsi_cache_write(uint8_t unit, int fd, const uint8_t* buf, uint32_t len,
+                           uint64_t offset) {
+  struct unit_cache* c = get_unit(unit);
+  if (!c || !len) {
+    return piscsi_mmap_write(unit, fd, buf, len, offset);
+  }
+  pthread_mutex_lock(&c->lock);
+  if (c->fd != fd) {
+    pthread_mutex_unlock(&c->lock);
+    return piscsi_mmap_write(unit, fd, buf, len, offset);
+  }
+  uint64_t end = offset + len;
+  // Writes that grow the image go straight to the file.
+  int through = c->policy == PISCSI_CACHE_THROUGH || end > c->size;
+  ssize_t ret = len;
+  if (through) {
+    ret = image_write(c, buf, len, offset);
+    if (end > c->size && ret > 0) {
+      c->size = end;
+    }
+    if (ret != (ssize_t)len) {
+      // Cached copies are only changed by writes that made it to the image.
+      pthread_mutex_unlock(&c->lock);
+      return ret;
+    }
+  }
+
+  for (uint64_t pos = offset; pos < end;) {
+    uint64_t index = pos / PISCSI_CACHE_LINE;
+    uint32_t lo = (uint32_t)(pos % PISCSI_CACHE_LINE);
+    uint32_t n = PISCSI_CACHE_LINE - lo;
+    if (n > end - pos) {
+      n = (uint32_t)(end - pos);
+    }
+    const uint8_t* src = buf + (pos - offset);
+    pos += n;
+    uint8_t full = sector_mask_full(lo, n);
+    uint8_t part = sector_mask(lo, n) & (uint8_t)~full;
+    struct line* l;
+
+    if (through) {
+      // Keep cached copies current. Partly written sectors that were not
+      // valid stay invalid and are read back from the image when needed.
+      if (!(l = lookup(c, index))) {
+        continue;
+      }
+      memcpy(l->data + lo, src, n);
+      l->valid |= full;
+      continue;
+    }
+
+    if (!(l = get_line(c, index))) {
+      // No memory for the line: write this piece through.
+      if (image_write(c, src, n, pos - n) < 0) {
+        ret = -1;
+      }
+      continue;
+    }
+    uint8_t missing = part & (uint8_t)~l->valid;
+    for (unsigned int s = 0; s < LINE_SECTORS; s++) {
+      if (missing & (1u << s)) {
+        // Read-modify-write of a partly written sector.
+        uint64_t soff = index * PISCSI_CACHE_LINE + s * SECTOR;
+        ssize_t got = image_read(c, l->data + s * SECTOR, SECTOR, soff);
+        if (got < 0) {
+          STAT_ADD(errors, 1);
+          got = 0;
+        }
+        memset(l->data + s * SECTOR + got, 0, SECTOR - (size_t)got);
+      }
+    }
+    memcpy(l->data + lo, src, n);
+    if (!l->dirty) {
+      c->ndirty++;
+    }
+    l->valid |= full | part;
+    l->dirty |= full | part;
+    l->ahead = 0;
+  }
+  if (c->werr) {
+    // An earlier write-back failed; its sectors are still dirty and will be
+    // tried again, but the driver has to hear about it.
+    c->werr = 0;
+    ret = -1;
+  }
+  pthread_mutex_unlock(&c->lock);
+  return ret;
+}
+
+void piscsi_cache_get_stats(struct piscsi_cache_stats* out) {
+  out->hits = __atomic_load_n(&stats.hits, __ATOMIC_RELAXED);
+  out->misses = __atomic_load_n(&stats.misses, __ATOMIC_RELAXED);
+  out->readahead = __atomic_load_n(&stats.readahead, __ATOMIC_RELAXED);
+  out->readahead_hits = __atomic_load_n(&stats.readahead_hits, __ATOMIC_RELAXED);
+  out->writeback_bytes = __atomic_load_n(&stats.writeback_bytes, __ATOMIC_RELAXED);
+  out->flushes = __atomic_load_n(&stats.flushes, __ATOMIC_RELAXED);
+  out->evictions = __atomic_load_n(&stats.evictions, __ATOMIC_RELAXED);
+  out->errors = __atomic_load_n(&stats.errors, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_PISCSI_CACHE_H
+#define PISTORM_PISCSI_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Block cache for PiSCSI hard files, one per unit. The image is cached in
+ * 4KB lines with a valid and dirty bit per 512-byte sector, evicted least
+ * recently used first. A read that starts where the previous one on the
+ * unit ended also fetches the next piscsi-readahead KB in the same file
+ * read. Writes follow the policy:
+ *
+ *   through  written to the image at once, cached lines are updated
+ *   back     kept in the cache and written every piscsi-cache-flush seconds
+ *   update   kept in the cache until the driver sends PISCSI_CMD_UPDATE
+ *            (CMD_UPDATE, SCSI SYNCHRONIZE CACHE)
+ *
+ * Dirty lines are also written when they are evicted, on Amiga reset, when a
+ * unit is unmapped and on shutdown, in file offset order followed by an
+ * fdatasync(). Misses and write-backs of one unit are serialised; different
+ * units run in parallel.
+ *
+ *   setvar piscsi-cache [MB]           cache size per unit (16 without a value;
+ *                                      off when not set or 0)
+ *   setvar piscsi-cache-policy POLICY  through (default), back or update
+ *   setvar piscsi-cache-flush [s]      flush interval for "back" (default 5)
+ *   setvar piscsi-readahead [KB]       sequential read-ahead (default 128)
+ *   PISTORM_PISCSI_CACHE_MB, PISTORM_PISCSI_CACHE_POLICY,
+ *   PISTORM_PISCSI_CACHE_FLUSH, PISTORM_PISCSI_READAHEAD
+ *                                      the same, override the config file
+ *
+ * The settings apply to units mapped after them.
+ */
+
+#define PISCSI_CACHE_LINE 4096
+#define PISCSI_CACHE_DEFAULT_MB 16
+#define PISCSI_CACHE_DEFAULT_FLUSH 5
+#define PISCSI_CACHE_DEFAULT_READAHEAD 128
+
+enum piscsi_cache_policy {
+  PISCSI_CACHE_THROUGH,
+  PISCSI_CACHE_BACK,
+  PISCSI_CACHE_UPDATE,
+};
+
+struct piscsi_cache_stats {
+  uint64_t hits;            // 4KB lines found in the cache
+  uint64_t misses;          // lines read from the image
+  uint64_t readahead;       // lines read ahead of a sequential reader
+  uint64_t readahead_hits;  // read-ahead lines that were used
+  uint64_t writeback_bytes; // dirty data written to the image
+  uint64_t flushes;         // flushes that wrote anything
+  uint64_t evictions;
+  uint64_t errors;          // failed reads and write-backs
+};
+
+void piscsi_cache_set_size(unsigned int mb);
+// Returns -1 for an unknown policy name.
+int piscsi_cache_set_policy(const char* name);
+void piscsi_cache_set_flush(unsigned int seconds);
+void piscsi_cache_set_readahead(unsigned int kb);
+
+// Start caching `fd` (`size` bytes) as `unit` with the current settings.
+void piscsi_cache_attach(uint8_t unit, int fd, uint64_t size);
+// Write back and drop the unit's cache. Call before closing its file.
+void piscsi_cache_detach(uint8_t unit);
+// Write back dirty lines of `unit`, all units for 0xFF.
+void piscsi_cache_flush(uint8_t unit);
+// The driver asked for its writes to be made permanent (PISCSI_CMD_UPDATE).
+// Only the "update" policy flushes; "back" keeps to its interval. Returns -1
+// if a write-back of the unit failed since the last write or update; the
+// sectors stay dirty and are tried again on the next flush.
+int piscsi_cache_update(uint8_t unit);
+// Detach every unit and stop the flush thread.
+void piscsi_cache_stop(void);
+
+// pread()/pwrite() of the whole range through the unit's cache, or through
+// piscsi_mmap_read()/piscsi_mmap_write() when the unit is not cached. Return the bytes transferred (short
+// at the end of the image) or -1. A write also returns -1, after caching its
+// data, when an earlier write-back of the unit failed.
+ssize_t piscsi_cache_read(uint8_t unit, int fd, uint8_t* buf, uint32_t len, uint64_t offset);
+ssize_t piscsi_cache_write(uint8_t unit, int fd, const uint8_t* buf, uint32_t len,
+                           uint64_t offset);
+
+// Totals over all units since startup.
+void piscsi_cache_get_stats(struct piscsi_cache_stats* stats);
+
+#endif /* PISTORM_PISCSI_CACHE_H */
@@ -18,6 +18,7 @@ enum piscsi_stuff {
   PISCSI_BLOCK_SIZE = 512, // Deprecated, do not use
   PISCSI_MAX_BLOCK_SIZE = 65536,
   PISCSI_TRACK_SECTORS = 2048,
+  PISCSI_ASYNC_FLAG = 0x8000, // ORed into the unit number of an async READ/WRITE
 };
 
 enum piscsi_cmds {
@@ -51,6 +52,15 @@ enum piscsi_cmds {
   PISCSI_CMD_DRVNUMX = 0x80,
   PISCSI_CMD_LOADFS = 0x84,
   PISCSI_CMD_GET_FS_INFO = 0x88,
+  PISCSI_CMD_ASYNC = 0x8C,    // R: async queue depth, 0 if not available
+  PISCSI_CMD_TAG = 0x90,      // W: tag of the next async request; R: 1 if it was queued
+  PISCSI_CMD_DONE = 0x94,     // R: tag of the next completed request, 0 if none
+  PISCSI_CMD_DONE_ERR = 0x98, // R: io_Error of the last completed or synchronous request
+  PISCSI_CMD_UPDATE = 0x9C,   // W: unit number, flush its cache under the update policy
+                              // R: non-zero if the last update failed to reach the image
+  PISCSI_CMD_MEDIA = 0xA0,    // R: piscsi_media_state of the DRVNUM/DRVNUMX unit
+  PISCSI_CMD_CHANGES = 0xA4,  // R: units with a disk change since the last read, a bit each
+                              // W: non-zero if the driver handles those changes on PORTS
   PISCSI_DBG_MSG = 0x1000,
   PISCSI_DBG_VAL1 = 0x1010,
   PISCSI_DBG_VAL2 = 0x1014,
@@ -63,6 +73,13 @@ enum piscsi_cmds {
   PISCSI_CMD_ROM = 0x4000,
 };
 
+// PISCSI_CMD_MEDIA
+enum piscsi_media_state {
+  PISCSI_MEDIA_REMOVABLE = 1,
+  PISCSI_MEDIA_PRESENT = 2,
+  PISCSI_MEDIA_PROTECTED = 4,
+};
+
 enum piscsi_dbg_msgs {
   DBG_INIT,
   DBG_OPENDEV,
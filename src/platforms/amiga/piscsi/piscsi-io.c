@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: MIT
+// File helpers shared by the PiSCSI layers. See piscsi-io.h.
+
+#include "piscsi-io.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+ssize_t piscsi_full_pread(int fd, uint8_t* buf, size_t len, uint64_t offset) {
+  size_t pos = 0;
+  while (pos < len) {
+    ssize_t n = pread(fd, buf + pos, len - pos, (off_t)(offset + pos));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    pos += (size_t)n;
+  }
+  return (ssize_t)pos;
+}
+
+ssize_t piscsi_full_pwrite(int fd, const uint8_t* buf, size_t len, uint64_t offset) {
+  size_t pos = 0;
+  while (pos < len) {
+    ssize_t n = pwrite(fd, buf + pos, len - pos, (off_t)(offset + pos));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    pos += (size_t)n;
+  }
+  return (ssize_t)pos;
+}
+
+unsigned int piscsi_env_uint(const char* name, unsigned int def) {
+  const char* env = getenv(name);
+  return env && *env ? (unsigned int)strtoul(env, NULL, 0) : def;
+}
@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_PISCSI_IO_H
+#define PISTORM_PISCSI_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * File helpers shared by the PiSCSI layers (cache, mmap, overlay, zhdf and
+ * the background workers).
+ */
+
+// pread() of the whole range, retried after EINTR and short reads. Returns
+// the bytes read, fewer only at the end of the file, or -1.
+ssize_t piscsi_full_pread(int fd, uint8_t* buf, size_t len, uint64_t offset);
+// pwrite() of the whole range, retried after EINTR and short writes. Returns
+// `len` or -1.
+ssize_t piscsi_full_pwrite(int fd, const uint8_t* buf, size_t len, uint64_t offset);
+// The environment variable `name` as a number (decimal, 0x hex or 0 octal),
+// or `def` when it is unset or empty.
+unsigned int piscsi_env_uint(const char* name, unsigned int def);
+
+#endif /* PISTORM_PISCSI_IO_H */
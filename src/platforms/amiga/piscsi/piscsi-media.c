@@ -0,0 +1,359 @@
+// SPDX-License-Identifier: MIT
+// Removable PiSCSI units for floppy images. See piscsi-media.h.
+
+#define _GNU_SOURCE // memfd_create, pthread_setname_np
+
+#include "piscsi-media.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef PISTORM_ZLIB
+#include <zlib.h>
+#endif
+
+#include "log.h"
+#include "piscsi-zhdf.h"
+#include "piscsi.h"
+#include "platforms/amiga/amiga-interrupts.h"
+
+#define NUM_MEDIA_UNITS 8
+#define MAX_QUEUED 16
+#define CTL_MAX 4096
+#define WATCH_POLL_MS 250
+
+enum media_op { OP_NEXT, OP_PREV, OP_DISK, OP_INSERT, OP_EJECT };
+
+struct media_cmd {
+  uint8_t unit;
+  enum media_op op;
+  int n;
+  char path[256];
+};
+
+static struct {
+  char* disks[PISCSI_MEDIA_MAX_DISKS];
+  int count;
+  int cur; // in disks, -1 for none or an image from elsewhere
+} units[NUM_MEDIA_UNITS];
+
+static uint32_t changes;
+static int listening;
+
+static char ctl_path[256];
+static pthread_t watcher;
+static int watcher_running, watcher_quit;
+
+// Commands from the watcher, for the emulator loop.
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct media_cmd queue[MAX_QUEUED];
+static unsigned int queued;
+
+static int has_suffix(const char* s, const char* suffix) {
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && strcasecmp(s + n - m, suffix) == 0;
+}
+
+static int floppy_size(uint64_t size) {
+  return size == PISCSI_MEDIA_DD_SIZE || size == PISCSI_MEDIA_HD_SIZE;
+}
+
+#ifdef PISTORM_ZLIB
+// Unpack a gzipped image into a memory file.
+static int open_gzip(const char* path, uint64_t* size) {
+  gzFile gz = gzopen(path, "rb");
+  if (!gz) {
+    return -1;
+  }
+  int fd = memfd_create("pistorm-adz", MFD_CLOEXEC);
+  uint8_t* buf = fd >= 0 ? malloc(PISCSI_MEDIA_HD_SIZE + 1) : NULL;
+  int n = buf ? gzread(gz, buf, PISCSI_MEDIA_HD_SIZE + 1) : -1;
+  gzclose(gz);
+  if (n < 0 || !floppy_size((uint64_t)n) || pwrite(fd, buf, (size_t)n, 0) != n) {
+    free(buf);
+    if (fd >= 0) {
+      close(fd);
+    }
+    errno = n < 0 ? EIO : EINVAL;
+    return -1;
+  }
+  free(buf);
+  *size = (uint64_t)n;
+  return fd;
+}
+#endif
+
+int piscsi_media_open(const char* path, uint64_t* size, int* read_only) {
+  uint64_t want = *size;
+  int fd;
+  *read_only = 0;
+  if (has_suffix(path, ".adz") || has_suffix(path, ".gz")) {
+#ifdef PISTORM_ZLIB
+    fd = open_gzip(path, size);
+    *read_only = 1;
+#else
+    LOG_ERROR("[PISCSI] This build has no zlib (USE_ZLIB=0), %s cannot be unpacked.\n", path);
+    return -1;
+#endif
+  } else {
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0 && (errno == EACCES || errno == EROFS)) {
+      fd = open(path, O_RDONLY | O_CLOEXEC);
+      *read_only = 1;
+    }
+    if (fd >= 0) {
+      struct piscsi_zhdf_header h;
+      if (piscsi_zhdf_read_header(fd, &h) > 0) {
+        *size = h.size;
+      } else {
+        *size = (uint64_t)lseek(fd, 0, SEEK_END);
+      }
+    }
+  }
+  if (fd < 0) {
+    LOG_WARN("[PISCSI] Could not open the disk image %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if (!floppy_size(*size) || (want && *size != want)) {
+    LOG_WARN("[PISCSI] %s is not a %s floppy image.\n", path,
+             want ? (want == PISCSI_MEDIA_DD_SIZE ? "DD" : "HD") : "DD or HD");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void piscsi_media_add(uint8_t unit, const char* path) {
+  if (unit >= NUM_MEDIA_UNITS || units[unit].count == PISCSI_MEDIA_MAX_DISKS) {
+    LOG_WARN("[PISCSI] Cannot add %s to unit %d.\n", path, unit);
+    return;
+  }
+  units[unit].disks[units[unit].count++] = strdup(path);
+  if (units[unit].count == 1) {
+    // The first image decides between a DD and an HD drive.
+    uint64_t size = 0;
+    int read_only;
+    int fd = piscsi_media_open(path, &size, &read_only);
+    if (fd >= 0) {
+      close(fd);
+    }
+    piscsi_make_removable(unit, fd >= 0 ? size : PISCSI_MEDIA_DD_SIZE);
+    units[unit].cur = fd >= 0 && piscsi_insert_media(unit, path) == 0 ? 0 : -1;
+  }
+}
+
+void piscsi_media_set_ctl(const char* path) {
+  snprintf(ctl_path, sizeof(ctl_path), "%s", path ? path : "");
+}
+
+void piscsi_media_changed(uint8_t unit) {
+  changes |= 1u << unit;
+  if (listening) {
+    amiga_emulate_irq(PORTS);
+  }
+}
+
+void piscsi_media_listen(int on) {
+  listening = on;
+}
+
+uint32_t piscsi_media_take_changes(void) {
+  uint32_t c = changes;
+  changes = 0;
+  return c;
+}
+
+static void run_cmd(const struct media_cmd* c) {
+  if (c->unit >= NUM_MEDIA_UNITS || !piscsi_get_dev(c->unit)->removable) {
+    LOG_WARN("[PISCSI] Unit %d is not a removable unit.\n", c->unit);
+    return;
+  }
+  int count = units[c->unit].count, cur = units[c->unit].cur;
+  int disk = -1;
+  switch (c->op) {
+  case OP_EJECT:
+    piscsi_eject_media(c->unit);
+    units[c->unit].cur = -1;
+    return;
+  case OP_INSERT:
+    if (piscsi_insert_media(c->unit, c->path) == 0) {
+      units[c->unit].cur = -1;
+    }
+    return;
+  case OP_NEXT:
+    disk = count ? (cur + 1) % count : -1;
+    break;
+  case OP_PREV:
+    disk = count ? (cur <= 0 ? count - 1 : cur - 1) : -1;
+    break;
+  case OP_DISK:
+    disk = c->n >= 1 && c->n <= count ? c->n - 1 : -1;
+    break;
+  }
+  if (disk < 0) {
+    LOG_WARN("[PISCSI] Unit %d has no such disk in its list.\n", c->unit);
+  } else if (piscsi_insert_media(c->unit, units[c->unit].disks[disk]) == 0) {
+    units[c->unit].cur = disk;
+  }
+}
+
+void piscsi_media_poll(void) {
+  if (__atomic_load_n(&queued, __ATOMIC_ACQUIRE)) {
+    struct media_cmd cmds[MAX_QUEUED];
+    pthread_mutex_lock(&queue_lock);
+    unsigned int n = queued;
+    memcpy(cmds, queue, n * sizeof(cmds[0]));
+    __atomic_store_n(&queued, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&queue_lock);
+    for (unsigned int i = 0; i < n; i++) {
+      run_cmd(&cmds[i]);
+    }
+  }
+  // Raised again if the driver's server has not taken the changes yet.
+  if (listening && changes && !amiga_emulating_irq(PORTS)) {
+    amiga_emulate_irq(PORTS);
+  }
+}
+
+static int parse_line(char* line, struct media_cmd* c) {
+  char* end;
+  unsigned long unit = strtoul(line, &end, 10);
+  if (end == line) {
+    return -1;
+  }
+  char* word = end + strspn(end, " \t");
+  char* arg = word + strcspn(word, " \t");
+  if (*arg) {
+    *arg++ = '\0';
+    arg += strspn(arg, " \t");
+  }
+  memset(c, 0, sizeof(*c));
+  c->unit = unit < NUM_MEDIA_UNITS ? (uint8_t)unit : NUM_MEDIA_UNITS;
+  if (!strcmp(word, "next")) {
+    c->op = OP_NEXT;
+  } else if (!strcmp(word, "prev")) {
+    c->op = OP_PREV;
+  } else if (!strcmp(word, "eject")) {
+    c->op = OP_EJECT;
+  } else if (!strcmp(word, "insert") && *arg) {
+    c->op = OP_INSERT;
+    snprintf(c->path, sizeof(c->path), "%s", arg);
+  } else if (*word >= '0' && *word <= '9') {
+    c->op = OP_DISK;
+    c->n = atoi(word);
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static void read_ctl(void) {
+  char buf[CTL_MAX + 1];
+  int fd = open(ctl_path, O_RDONLY | O_CLOEXEC);
+  ssize_t n = fd >= 0 ? read(fd, buf, CTL_MAX) : -1;
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (n <= 0) {
+    return;
+  }
+  buf[n] = '\0';
+  char* save = NULL;
+  for (char* line = strtok_r(buf, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save)) {
+    struct media_cmd c;
+    if (parse_line(line, &c) < 0) {
+      LOG_WARN("[PISCSI] Unknown media command: %s\n", line);
+      continue;
+    }
+    pthread_mutex_lock(&queue_lock);
+    if (queued < MAX_QUEUED) {
+      queue[queued] = c;
+      __atomic_store_n(&queued, queued + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&queue_lock);
+  }
+}
+
+// Watches the directory, so the file may be created, replaced or renamed
+// over; a command is read when the writer closes it.
+static void* watcher_task(void* arg) {
+  int ifd = (int)(intptr_t)arg;
+  char dir_buf[sizeof(ctl_path)], name_buf[sizeof(ctl_path)];
+  snprintf(dir_buf, sizeof(dir_buf), "%s", ctl_path);
+  snprintf(name_buf, sizeof(name_buf), "%s", ctl_path);
+  const char* name = basename(name_buf);
+  if (inotify_add_watch(ifd, dirname(dir_buf), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    LOG_ERROR("[PISCSI] Cannot watch the media control file %s: %s\n", ctl_path, strerror(errno));
+    close(ifd);
+    return NULL;
+  }
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (!__atomic_load_n(&watcher_quit, __ATOMIC_ACQUIRE)) {
+    struct pollfd p = {ifd, POLLIN, 0};
+    if (poll(&p, 1, WATCH_POLL_MS) <= 0) {
+      continue;
+    }
+    ssize_t n = read(ifd, events, sizeof(events));
+    int hit = 0;
+    for (ssize_t pos = 0; pos < n;) {
+      const struct inotify_event* e = (const struct inotify_event*)(events + pos);
+      hit |= e->len && strcmp(e->name, name) == 0;
+      pos += (ssize_t)(sizeof(*e) + e->len);
+    }
+    if (hit) {
+      read_ctl();
+    }
+  }
+  close(ifd);
+  return NULL;
+}
+
+void piscsi_media_start(void) {
+  const char* env = getenv("PISTORM_PISCSI_MEDIA_CTL");
+  if (env && *env) {
+    piscsi_media_set_ctl(env);
+  }
+  if (watcher_running || !ctl_path[0]) {
+    return;
+  }
+  int ifd = inotify_init1(IN_CLOEXEC);
+  if (ifd < 0) {
+    LOG_ERROR("[PISCSI] Cannot watch the media control file: %s\n", strerror(errno));
+    return;
+  }
+  watcher_quit = 0;
+  if (pthread_create(&watcher, NULL, watcher_task, (void*)(intptr_t)ifd) != 0) {
+    LOG_ERROR("[PISCSI] Could not start the media control thread.\n");
+    close(ifd);
+    return;
+  }
+  pthread_setname_np(watcher, "pistorm64: disk");
+  watcher_running = 1;
+  LOG_INFO("[PISCSI] Disk changes from %s.\n", ctl_path);
+}
+
+void piscsi_media_stop(void) {
+  if (watcher_running) {
+    __atomic_store_n(&watcher_quit, 1, __ATOMIC_RELEASE);
+    pthread_join(watcher, NULL);
+    watcher_running = 0;
+  }
+  for (int i = 0; i < NUM_MEDIA_UNITS; i++) {
+    for (int j = 0; j < units[i].count; j++) {
+      free(units[i].disks[j]);
+    }
+    units[i].count = 0;
+    units[i].cur = -1;
+  }
+  queued = 0;
+  changes = 0;
+  listening = 0;
+}
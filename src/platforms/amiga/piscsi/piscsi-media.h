@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_PISCSI_MEDIA_H
+#define PISTORM_PISCSI_MEDIA_H
+
+#include <stdint.h>
+
+/*
+ * Removable PiSCSI units for floppy images. A unit given disk images with
+ * piscsi-media instead of piscsi0 to piscsi6 is a drive with the first of
+ * them inserted, mounted as PF<unit>: with the floppy geometry of the image
+ * (DD, 880KB, or HD, 1760KB). Each setvar adds a disk to the unit's list:
+ *
+ *   setvar piscsi-media4 Game-Disk1.adf
+ *   setvar piscsi-media4 Game-Disk2.adz
+ *   setvar piscsi-media4 Game-Disk3.zhdf
+ *
+ * Images are plain ADFs, gzipped ADFs (.adz, .adf.gz), which are unpacked
+ * into memory when inserted and are write protected, or .zhdf images
+ * (piscsi-zhdf.h). An ADF the emulator cannot write is write protected.
+ *
+ * The disk is changed from the Pi side, with PISCSI_CTRL_INSERT and
+ * PISCSI_CTRL_EJECT of the PiStorm device, or by writing commands, one per
+ * line, to the piscsi-media-ctl file:
+ *
+ *   <unit> next | prev       the next or previous disk of the list
+ *   <unit> <n>               disk n of the list, from 1
+ *   <unit> insert <image>    any image of the unit's size
+ *   <unit> eject
+ *
+ *   echo "4 next" > /run/pistorm-media
+ *
+ *   setvar piscsi-media-ctl [file]  the control file (default none)
+ *   PISTORM_PISCSI_MEDIA_CTL=file   the same, overrides the config file
+ *
+ * The file is watched with inotify and the commands run in the emulator
+ * loop. Every change counts in the unit's change number and raises PORTS,
+ * and the driver calls the TD_ADDCHANGEINT interrupts of the unit, so the
+ * file system sees a disk change at once.
+ */
+
+#define PISCSI_MEDIA_MAX_DISKS 16
+#define PISCSI_MEDIA_DD_SIZE (80 * 2 * 11 * 512)
+#define PISCSI_MEDIA_HD_SIZE (80 * 2 * 22 * 512)
+
+// Open `path` as a disk of `size` bytes, 0 for either floppy size. Returns
+// a file descriptor, gzipped images unpacked to a memory file, with
+// `*size` set and `*read_only` set when it cannot be written, or -1.
+int piscsi_media_open(const char* path, uint64_t* size, int* read_only);
+
+// Add a disk to the list of `unit`. The first makes it a removable unit.
+void piscsi_media_add(uint8_t unit, const char* path);
+void piscsi_media_set_ctl(const char* path);
+// Start watching the control file, if one is set.
+void piscsi_media_start(void);
+void piscsi_media_stop(void);
+
+// Record a disk change of `unit`, to be signalled to the driver.
+void piscsi_media_changed(uint8_t unit);
+// The driver handles change interrupts from now on, or, for 0, not anymore.
+void piscsi_media_listen(int on);
+// Units changed since the last call, one bit each.
+uint32_t piscsi_media_take_changes(void);
+// Run queued control commands and raise PORTS for unsignalled changes. Call
+// from the emulator loop.
+void piscsi_media_poll(void);
+
+#endif /* PISTORM_PISCSI_MEDIA_H */
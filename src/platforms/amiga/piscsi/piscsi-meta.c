@@ -0,0 +1,439 @@
+// SPDX-License-Identifier: MIT
+// Cache of the metadata PiSCSI reads from its images. See piscsi-meta.h.
+
+#include "piscsi-meta.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "piscsi-cache.h"
+
+#define META_UNITS 8
+#define META_MAGIC "PISCSIMD"
+#define META_MAX_FILE (PISCSI_META_MAX_IMAGES * (PISCSI_META_MAX_BYTES + 65536))
+
+// What tells an image and whether it has changed. No padding, so it can be
+// compared and stored as it is.
+struct meta_key {
+  uint64_t dev, ino, size;
+  uint64_t mtime_ns, ctime_ns;
+};
+
+// A read of `asked` bytes at `offset` that returned `len`, fewer at the end
+// of the image.
+struct meta_extent {
+  uint64_t offset;
+  uint32_t len, asked;
+  uint8_t* data;
+};
+
+struct meta_image {
+  struct meta_key key;
+  struct meta_extent* ext;
+  uint32_t num, cap;
+  uint64_t bytes;
+  // The range the extents lie in, to pass over most writes at once.
+  uint64_t lo, hi;
+};
+
+/*
+ * The file, in host byte order:
+ *
+ *   "PISCSIMD" <version u32> <images u32> <checksum u32>
+ *   per image:  <struct meta_key> <extents u32>
+ *   per extent: <offset u64> <len u32> <asked u32> <len bytes>
+ *
+ * The checksum is FNV-1a over everything after the header.
+ */
+struct meta_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t images;
+  uint32_t checksum;
+};
+
+static char meta_path[256] = PISCSI_META_DEFAULT_PATH;
+static int meta_env_read, meta_loaded, meta_dirty;
+
+// The units piscsi_meta_open() knows the image of.
+static struct meta_image units[META_UNITS];
+static uint8_t unit_open[META_UNITS];
+// Whether the Amiga wrote to the image since it was opened.
+static uint8_t unit_written[META_UNITS];
+// The images of the file no unit has, the ones used last at the end.
+static struct meta_image stored[PISCSI_META_MAX_IMAGES];
+static unsigned int num_stored;
+
+static struct piscsi_meta_stats stats;
+
+void piscsi_meta_set_path(const char* path) {
+  snprintf(meta_path, sizeof(meta_path), "%s", path ? path : "");
+}
+
+static int meta_enabled(void) {
+  if (!meta_env_read) {
+    const char* env = getenv("PISTORM_PISCSI_META_CACHE");
+    if (env && *env) {
+      piscsi_meta_set_path(env);
+    }
+    meta_env_read = 1;
+  }
+  return meta_path[0] && strcmp(meta_path, "off") != 0;
+}
+
+static int get_key(int fd, struct meta_key* key) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return -1;
+  }
+  key->dev = (uint64_t)st.st_dev;
+  key->ino = (uint64_t)st.st_ino;
+  key->size = (uint64_t)st.st_size;
+  key->mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec;
+  key->ctime_ns = (uint64_t)st.st_ctim.tv_sec * 1000000000u + (uint64_t)st.st_ctim.tv_nsec;
+  return 0;
+}
+
+static int same_file(const struct meta_key* a, const struct meta_key* b) {
+  return a->dev == b->dev && a->ino == b->ino;
+}
+
+static void drop_extents(struct meta_image* img) {
+  for (uint32_t i = 0; i < img->num; i++) {
+    free(img->ext[i].data);
+  }
+  free(img->ext);
+  img->ext = NULL;
+  img->num = img->cap = 0;
+  img->bytes = img->lo = img->hi = 0;
+}
+
+static void add_extent(struct meta_image* img, const uint8_t* data, uint32_t len,
+                       uint32_t asked, uint64_t offset) {
+  if (img->bytes + len > PISCSI_META_MAX_BYTES) {
+    return;
+  }
+  if (img->num == img->cap) {
+    uint32_t cap = img->cap ? img->cap * 2 : 64;
+    struct meta_extent* ext = realloc(img->ext, cap * sizeof(*ext));
+    if (!ext) {
+      return;
+    }
+    img->ext = ext;
+    img->cap = cap;
+  }
+  uint8_t* copy = NULL;
+  if (len) {
+    if (!(copy = malloc(len))) {
+      return;
+    }
+    memcpy(copy, data, len);
+    if (!img->hi || offset < img->lo) {
+      img->lo = offset;
+    }
+    if (offset + len > img->hi) {
+      img->hi = offset + len;
+    }
+  }
+  img->ext[img->num++] = (struct meta_extent){offset, len, asked, copy};
+  img->bytes += len;
+}
+
+static void remove_stored(unsigned int i) {
+  num_stored--;
+  memmove(&stored[i], &stored[i + 1], (num_stored - i) * sizeof(stored[0]));
+  memset(&stored[num_stored], 0, sizeof(stored[0]));
+}
+
+static uint32_t fnv1a(uint32_t h, const void* data, size_t len) {
+  const uint8_t* p = data;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h;
+}
+
+struct cursor {
+  const uint8_t* p;
+  const uint8_t* end;
+};
+
+static int take(struct cursor* c, void* dst, size_t len) {
+  if ((size_t)(c->end - c->p) < len) {
+    return -1;
+  }
+  memcpy(dst, c->p, len);
+  c->p += len;
+  return 0;
+}
+
+static const char* parse(const uint8_t* buf, size_t size) {
+  struct meta_header h;
+  struct cursor c = {buf, buf + size};
+  if (take(&c, &h, sizeof(h)) || memcmp(h.magic, META_MAGIC, sizeof(h.magic)) != 0) {
+    return "not a metadata cache";
+  }
+  if (h.version != PISCSI_META_VERSION) {
+    return "written by another version";
+  }
+  if (fnv1a(2166136261u, c.p, (size_t)(c.end - c.p)) != h.checksum) {
+    return "bad checksum";
+  }
+  for (uint32_t i = 0; i < h.images && num_stored < PISCSI_META_MAX_IMAGES; i++) {
+    struct meta_image* img = &stored[num_stored++];
+    uint32_t num;
+    if (take(&c, &img->key, sizeof(img->key)) || take(&c, &num, sizeof(num))) {
+      return "truncated";
+    }
+    for (uint32_t n = 0; n < num; n++) {
+      uint64_t offset;
+      uint32_t len, asked;
+      if (take(&c, &offset, sizeof(offset)) || take(&c, &len, sizeof(len)) ||
+          take(&c, &asked, sizeof(asked)) || (size_t)(c.end - c.p) < len) {
+        return "truncated";
+      }
+      add_extent(img, c.p, len, asked, offset);
+      c.p += len;
+    }
+  }
+  return NULL;
+}
+
+static void meta_load(void) {
+  meta_loaded = 1;
+  FILE* f = fopen(meta_path, "rb");
+  if (!f) {
+    if (errno != ENOENT) {
+      LOG_WARN("[PISCSI] Cannot read the metadata cache %s: %s\n", meta_path, strerror(errno));
+    }
+    return;
+  }
+  const char* why = NULL;
+  uint8_t* buf = NULL;
+  long size = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+  if (size < (long)sizeof(struct meta_header) || size > META_MAX_FILE) {
+    why = "bad size";
+  } else if (!(buf = malloc((size_t)size))) {
+    why = "out of memory";
+  } else if (fseek(f, 0, SEEK_SET) != 0 || fread(buf, (size_t)size, 1, f) != 1) {
+    why = "read error";
+  } else {
+    why = parse(buf, (size_t)size);
+  }
+  fclose(f);
+  free(buf);
+  if (why) {
+    LOG_WARN("[PISCSI] Ignoring the metadata cache %s: %s.\n", meta_path, why);
+    for (unsigned int i = 0; i < num_stored; i++) {
+      drop_extents(&stored[i]);
+    }
+    num_stored = 0;
+    return;
+  }
+  // The file has the ones used last first.
+  for (unsigned int i = 0; i < num_stored / 2; i++) {
+    struct meta_image img = stored[i];
+    stored[i] = stored[num_stored - 1 - i];
+    stored[num_stored - 1 - i] = img;
+  }
+  LOG_INFO("[PISCSI] Metadata of %u images in %s.\n", num_stored, meta_path);
+}
+
+int piscsi_meta_open(uint8_t unit, int fd) {
+  if (unit >= META_UNITS || !meta_enabled()) {
+    return 0;
+  }
+  if (!meta_loaded) {
+    meta_load();
+  }
+  struct meta_image* img = &units[unit];
+  struct meta_key key;
+  drop_extents(img);
+  unit_open[unit] = unit_written[unit] = 0;
+  if (get_key(fd, &key) != 0) {
+    return 0;
+  }
+  unit_open[unit] = 1;
+  for (unsigned int i = 0; i < num_stored; i++) {
+    if (!same_file(&stored[i].key, &key)) {
+      continue;
+    }
+    int hit = memcmp(&stored[i].key, &key, sizeof(key)) == 0;
+    if (hit) {
+      *img = stored[i];
+    } else {
+      drop_extents(&stored[i]);
+      meta_dirty = 1;
+    }
+    remove_stored(i);
+    if (hit) {
+      stats.hits++;
+      return 1;
+    }
+    break;
+  }
+  img->key = key;
+  stats.misses++;
+  return 0;
+}
+
+ssize_t piscsi_meta_read(uint8_t unit, int fd, uint8_t* buf, uint32_t len, uint64_t offset) {
+  if (unit >= META_UNITS || !unit_open[unit]) {
+    return piscsi_cache_read(unit, fd, buf, len, offset);
+  }
+  struct meta_image* img = &units[unit];
+  for (uint32_t i = 0; i < img->num; i++) {
+    struct meta_extent* e = &img->ext[i];
+    if (offset >= e->offset && offset + len <= e->offset + e->len) {
+      memcpy(buf, e->data + (offset - e->offset), len);
+      stats.served_bytes += len;
+      return len;
+    }
+    if (offset == e->offset && len == e->asked) {
+      if (e->len) {
+        memcpy(buf, e->data, e->len);
+      }
+      stats.served_bytes += e->len;
+      return e->len;
+    }
+  }
+  ssize_t n = piscsi_cache_read(unit, fd, buf, len, offset);
+  if (n >= 0) {
+    add_extent(img, buf, (uint32_t)n, len, offset);
+    stats.read_bytes += (uint64_t)n;
+    meta_dirty = 1;
+  }
+  return n;
+}
+
+void piscsi_meta_written(uint8_t unit, uint64_t offset, uint32_t len) {
+  if (unit >= META_UNITS) {
+    return;
+  }
+  struct meta_image* img = &units[unit];
+  unit_written[unit] = 1;
+  if (!img->num || offset >= img->hi || offset + len <= img->lo) {
+    return;
+  }
+  for (uint32_t i = 0; i < img->num; i++) {
+    if (offset < img->ext[i].offset + img->ext[i].len && offset + len > img->ext[i].offset) {
+      LOG_DEBUG("[PISCSI] Unit %d: metadata written, read again at the next reset.\n", unit);
+      drop_extents(img);
+      stats.invalidations++;
+      meta_dirty = 1;
+      return;
+    }
+  }
+}
+
+void piscsi_meta_close(uint8_t unit, int fd) {
+  if (unit >= META_UNITS || !unit_open[unit]) {
+    return;
+  }
+  struct meta_image* img = &units[unit];
+  struct meta_key key;
+  unit_open[unit] = 0;
+  if (!img->num || get_key(fd, &key) != 0 || !same_file(&key, &img->key)) {
+    drop_extents(img);
+    return;
+  }
+  if (memcmp(&key, &img->key, sizeof(key)) != 0) {
+    // The extents survive only writes that missed them, so if the Amiga's
+    // writes account for the new times the image still holds what they do.
+    // Without any, or with a new size, another program changed the image
+    // and the extents cannot be trusted.
+    if (!unit_written[unit] || key.size != img->key.size) {
+      LOG_DEBUG("[PISCSI] Unit %d: image changed outside the emulator, metadata dropped.\n",
+                unit);
+      drop_extents(img);
+      stats.invalidations++;
+      meta_dirty = 1;
+      return;
+    }
+    img->key = key;
+    meta_dirty = 1;
+  }
+  if (num_stored == PISCSI_META_MAX_IMAGES) {
+    drop_extents(&stored[0]);
+    remove_stored(0);
+  }
+  stored[num_stored++] = *img;
+  memset(img, 0, sizeof(*img));
+}
+
+static int write_image(FILE* f, const struct meta_image* img, uint32_t* checksum) {
+  int ok = fwrite(&img->key, sizeof(img->key), 1, f) == 1 &&
+           fwrite(&img->num, sizeof(img->num), 1, f) == 1;
+  *checksum = fnv1a(*checksum, &img->key, sizeof(img->key));
+  *checksum = fnv1a(*checksum, &img->num, sizeof(img->num));
+  for (uint32_t i = 0; ok && i < img->num; i++) {
+    const struct meta_extent* e = &img->ext[i];
+    ok = fwrite(&e->offset, sizeof(e->offset), 1, f) == 1 &&
+         fwrite(&e->len, sizeof(e->len), 1, f) == 1 &&
+         fwrite(&e->asked, sizeof(e->asked), 1, f) == 1 &&
+         (!e->len || fwrite(e->data, e->len, 1, f) == 1);
+    *checksum = fnv1a(*checksum, &e->offset, sizeof(e->offset));
+    *checksum = fnv1a(*checksum, &e->len, sizeof(e->len));
+    *checksum = fnv1a(*checksum, &e->asked, sizeof(e->asked));
+    *checksum = fnv1a(*checksum, e->data, e->len);
+  }
+  return ok;
+}
+
+void piscsi_meta_save(void) {
+  if (!meta_dirty || !meta_enabled()) {
+    return;
+  }
+  meta_dirty = 0;
+  char tmp[sizeof(meta_path) + 4];
+  snprintf(tmp, sizeof(tmp), "%s.new", meta_path);
+  FILE* f = fopen(tmp, "wb");
+  if (!f) {
+    LOG_WARN("[PISCSI] Cannot write the metadata cache %s: %s\n", tmp, strerror(errno));
+    return;
+  }
+  struct meta_header h = {.version = PISCSI_META_VERSION, .checksum = 2166136261u};
+  memcpy(h.magic, META_MAGIC, sizeof(h.magic));
+  int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  // The mapped images first, then the others from the one used last.
+  for (unsigned int i = 0; ok && i < META_UNITS + num_stored; i++) {
+    const struct meta_image* img = NULL;
+    if (i >= META_UNITS) {
+      img = &stored[num_stored - 1 - (i - META_UNITS)];
+    } else if (unit_open[i]) {
+      img = &units[i];
+    }
+    if (img && img->num && h.images < PISCSI_META_MAX_IMAGES) {
+      ok = write_image(f, img, &h.checksum);
+      h.images++;
+    }
+  }
+  ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1;
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp, meta_path) != 0) {
+    LOG_WARN("[PISCSI] Cannot write the metadata cache %s: %s\n", meta_path, strerror(errno));
+    unlink(tmp);
+  }
+}
+
+void piscsi_meta_stop(void) {
+  piscsi_meta_save();
+  for (int i = 0; i < META_UNITS; i++) {
+    drop_extents(&units[i]);
+    unit_open[i] = 0;
+  }
+  for (unsigned int i = 0; i < num_stored; i++) {
+    drop_extents(&stored[i]);
+  }
+  num_stored = 0;
+  meta_loaded = 0;
+}
+
+void piscsi_meta_get_stats(struct piscsi_meta_stats* s) {
+  *s = stats;
+}
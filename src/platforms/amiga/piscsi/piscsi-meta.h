@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_PISCSI_META_H
+#define PISTORM_PISCSI_META_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Cache of what PiSCSI reads from a hard file to set it up: the RDB, the
+ * partition and file system header blocks and the LSEG blocks of the file
+ * systems. piscsi_map_drive() reads them at startup and
+ * piscsi_refresh_drives() again at every Amiga reset, a few hundred small
+ * reads per image; with the cache both parse them from memory, and an
+ * image is only read when it is new or has changed.
+ *
+ * An image is known by its device, inode, size and modification and change
+ * times. The cache is kept in a file across runs, and an image whose size
+ * or times differ from the ones in the file is read again, as is one the
+ * Amiga has written blocks of the cache to (after repartitioning, or
+ * installing a file system), at the next reset. Writes elsewhere leave the
+ * cache valid, and the times are taken again when the image is closed. If
+ * they changed while the Amiga wrote nothing, the image is read again at
+ * the next start. An image found in the cache passed piscsi_validate_hdf()
+ * when it was read and is not checked again.
+ *
+ *   setvar piscsi-meta-cache [file]   the cache file (default
+ *                                     data/piscsi-meta.bin; off for none)
+ *   PISTORM_PISCSI_META_CACHE=file    the same, overrides the config file
+ *
+ * Set it before the piscsi0 to piscsi6 lines. With "off" nothing is kept,
+ * not even across resets. As with the block cache, an image changed by
+ * another program while the emulator has it open is not seen.
+ */
+
+#define PISCSI_META_DEFAULT_PATH "./data/piscsi-meta.bin"
+#define PISCSI_META_VERSION 1
+// Images kept in the file, mapped or not.
+#define PISCSI_META_MAX_IMAGES 32
+// Metadata kept per image; what does not fit is read from the image.
+#define PISCSI_META_MAX_BYTES (4 * 1024 * 1024)
+
+struct piscsi_meta_stats {
+  uint64_t hits;          // images mapped with their metadata in the cache
+  uint64_t misses;        // images read
+  uint64_t invalidations; // images whose metadata was written to, here or by another program
+  uint64_t served_bytes;  // reads answered from the cache
+  uint64_t read_bytes;    // reads from the images
+};
+
+void piscsi_meta_set_path(const char* path);
+
+// `fd` is mapped as `unit`. Returns 1 if its metadata is in the cache.
+int piscsi_meta_open(uint8_t unit, int fd);
+// A read of the unit's metadata: from the cache, or through
+// piscsi_cache_read() and kept. Returns what piscsi_cache_read() would.
+ssize_t piscsi_meta_read(uint8_t unit, int fd, uint8_t* buf, uint32_t len, uint64_t offset);
+// The Amiga writes `len` bytes at `offset` of the unit.
+void piscsi_meta_written(uint8_t unit, uint64_t offset, uint32_t len);
+// `fd` is about to be closed, its other layers detached.
+void piscsi_meta_close(uint8_t unit, int fd);
+// Write the cache file, if anything has changed.
+void piscsi_meta_save(void);
+// Save and drop everything.
+void piscsi_meta_stop(void);
+
+void piscsi_meta_get_stats(struct piscsi_meta_stats* stats);
+
+#endif /* PISTORM_PISCSI_META_H */
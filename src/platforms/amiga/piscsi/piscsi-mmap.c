@@ -0,0 +1,270 @@
+// SPDX-License-Identifier: MIT
+// Memory-mapped PiSCSI images. See piscsi-mmap.h.
+
+#include "piscsi-mmap.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "piscsi-io.h"
+#include "piscsi-overlay.h"
+
+#define NUM_MMAP_UNITS 8
+
+struct window {
+  uint64_t base;
+  uint8_t* p; // NULL while unused
+  size_t len;
+  uint64_t used; // LRU stamp
+};
+
+struct unit_map {
+  pthread_mutex_t lock; // the windows; a whole-image mapping needs no lock
+  int fd;               // -1 while the unit is not mapped
+  uint64_t size;
+  uint8_t* whole;
+  uint64_t window;
+  struct window win[PISCSI_MMAP_WINDOWS];
+  uint64_t tick;
+  uint64_t seq_next;     // where a sequential reader continues
+  uint64_t prefetch_end; // how far MADV_WILLNEED has been asked for
+};
+
+static struct unit_map units[NUM_MMAP_UNITS];
+static pthread_once_t units_once = PTHREAD_ONCE_INIT;
+
+static int cfg_enabled;
+static unsigned int cfg_window;
+static uint64_t page_size;
+
+static void init_units(void) {
+  for (int i = 0; i < NUM_MMAP_UNITS; i++) {
+    pthread_mutex_init(&units[i].lock, NULL);
+    units[i].fd = -1;
+  }
+  page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+static struct unit_map* get_unit(uint8_t unit) {
+  pthread_once(&units_once, init_units);
+  return unit < NUM_MMAP_UNITS ? &units[unit] : NULL;
+}
+
+// The mapping of the window holding `offset`, mapping it in place of the
+// least recently used one if needed. Called with the lock held.
+static struct window* get_window(struct unit_map* m, uint64_t offset) {
+  uint64_t base = offset / m->window * m->window;
+  struct window* lru = &m->win[0];
+  for (int i = 0; i < PISCSI_MMAP_WINDOWS; i++) {
+    struct window* w = &m->win[i];
+    if (w->p && w->base == base) {
+      w->used = ++m->tick;
+      return w;
+    }
+    if (!w->p || (lru->p && w->used < lru->used)) {
+      lru = w;
+    }
+  }
+  if (lru->p) {
+    munmap(lru->p, lru->len);
+    lru->p = NULL;
+  }
+  size_t len = (size_t)(m->size - base < m->window ? m->size - base : m->window);
+  void* p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, (off_t)base);
+  if (p == MAP_FAILED) {
+    LOG_WARN("[PISCSI] Could not map %zu bytes of the image at %llu: %s\n", len,
+             (unsigned long long)base, strerror(errno));
+    return NULL;
+  }
+  lru->base = base;
+  lru->p = p;
+  lru->len = len;
+  lru->used = ++m->tick;
+  return lru;
+}
+
+// Ask for the data after a sequential reader's request ahead of time.
+static void prefetch(struct unit_map* m, uint64_t offset, uint64_t end) {
+  if (offset != __atomic_load_n(&m->seq_next, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&m->seq_next, end, __ATOMIC_RELAXED);
+    return;
+  }
+  __atomic_store_n(&m->seq_next, end, __ATOMIC_RELAXED);
+  // One madvise() per half window rather than per request.
+  uint64_t from = __atomic_load_n(&m->prefetch_end, __ATOMIC_RELAXED);
+  if (from > end + PISCSI_MMAP_PREFETCH / 2 && from <= end + PISCSI_MMAP_PREFETCH) {
+    return;
+  }
+  if (from < end || from > end + PISCSI_MMAP_PREFETCH) {
+    from = end;
+  }
+  from &= ~(page_size - 1);
+  uint64_t to = end + PISCSI_MMAP_PREFETCH;
+  if (to > m->size) {
+    to = m->size;
+  }
+  __atomic_store_n(&m->prefetch_end, to, __ATOMIC_RELAXED);
+  if (to <= from) {
+    return;
+  }
+  if (m->whole) {
+    madvise(m->whole + from, (size_t)(to - from), MADV_WILLNEED);
+    return;
+  }
+  // Windowed: only the part in windows that are mapped right now.
+  pthread_mutex_lock(&m->lock);
+  for (int i = 0; i < PISCSI_MMAP_WINDOWS; i++) {
+    struct window* w = &m->win[i];
+    if (w->p && from < w->base + w->len && to > w->base) {
+      uint64_t a = from > w->base ? from : w->base;
+      uint64_t b = to < w->base + w->len ? to : w->base + w->len;
+      madvise(w->p + (a - w->base), (size_t)(b - a), MADV_WILLNEED);
+    }
+  }
+  pthread_mutex_unlock(&m->lock);
+}
+
+// Copy [offset, offset + len) of the image to or from `buf`. Returns the
+// bytes inside the mapping that were copied.
+static uint64_t copy(struct unit_map* m, uint8_t* buf, uint64_t len, uint64_t offset, int write) {
+  if (m->whole) {
+    if (write) {
+      memcpy(m->whole + offset, buf, (size_t)len);
+    } else {
+      memcpy(buf, m->whole + offset, (size_t)len);
+    }
+    return len;
+  }
+  uint64_t done = 0;
+  pthread_mutex_lock(&m->lock);
+  while (done < len) {
+    struct window* w = get_window(m, offset + done);
+    if (!w) {
+      break;
+    }
+    uint64_t in = offset + done - w->base;
+    uint64_t n = w->len - in < len - done ? w->len - in : len - done;
+    if (write) {
+      memcpy(w->p + in, buf + done, (size_t)n);
+    } else {
+      memcpy(buf + done, w->p + in, (size_t)n);
+    }
+    done += n;
+  }
+  pthread_mutex_unlock(&m->lock);
+  return done;
+}
+
+void piscsi_mmap_set_enabled(int enabled) {
+  cfg_enabled = enabled;
+}
+
+void piscsi_mmap_set_window(unsigned int mb) {
+  cfg_window = mb;
+}
+
+int piscsi_mmap_attach(uint8_t unit, int fd, uint64_t size) {
+  struct unit_map* m = get_unit(unit);
+  if (!m) {
+    return 0;
+  }
+  piscsi_mmap_detach(unit);
+  if (!piscsi_env_uint("PISTORM_PISCSI_MMAP", (unsigned int)cfg_enabled) || !size) {
+    return 0;
+  }
+  unsigned int window_mb = piscsi_env_uint("PISTORM_PISCSI_MMAP_WINDOW", cfg_window);
+
+  pthread_mutex_lock(&m->lock);
+  m->size = size;
+  m->fd = fd;
+  m->whole = NULL;
+  m->seq_next = m->prefetch_end = 0;
+  if (!window_mb && size <= SIZE_MAX) {
+    void* p = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p != MAP_FAILED) {
+      m->whole = p;
+    }
+  }
+  if (!m->whole) {
+    m->window = (uint64_t)(window_mb ? window_mb : PISCSI_MMAP_DEFAULT_WINDOW) * 1024 * 1024;
+    m->window = (m->window + page_size - 1) & ~(page_size - 1);
+    if (!get_window(m, 0)) {
+      m->fd = -1;
+      pthread_mutex_unlock(&m->lock);
+      LOG_WARN("[PISCSI] Unit %u is not memory-mapped.\n", unit);
+      return 0;
+    }
+  }
+  pthread_mutex_unlock(&m->lock);
+  if (m->whole) {
+    LOG_INFO("[PISCSI] Unit %u: image memory-mapped.\n", unit);
+  } else {
+    LOG_INFO("[PISCSI] Unit %u: image memory-mapped in %lluMB windows.\n", unit,
+             (unsigned long long)(m->window >> 20));
+  }
+  return 1;
+}
+
+void piscsi_mmap_detach(uint8_t unit) {
+  struct unit_map* m = get_unit(unit);
+  if (!m) {
+    return;
+  }
+  pthread_mutex_lock(&m->lock);
+  if (m->fd != -1) {
+    if (m->whole) {
+      munmap(m->whole, (size_t)m->size);
+      m->whole = NULL;
+    }
+    for (int i = 0; i < PISCSI_MMAP_WINDOWS; i++) {
+      if (m->win[i].p) {
+        munmap(m->win[i].p, m->win[i].len);
+        m->win[i].p = NULL;
+      }
+    }
+    m->fd = -1;
+  }
+  pthread_mutex_unlock(&m->lock);
+}
+
+ssize_t piscsi_mmap_read(uint8_t unit, int fd, uint8_t* buf, uint32_t len, uint64_t offset) {
+  struct unit_map* m = get_unit(unit);
+  if (!m || m->fd != fd || !len) {
+    return piscsi_overlay_read(unit, fd, buf, len, offset);
+  }
+  uint64_t n = offset >= m->size ? 0 : m->size - offset < len ? m->size - offset : len;
+  uint64_t done = 0;
+  if (n) {
+    prefetch(m, offset, offset + n);
+    done = copy(m, buf, n, offset, 0);
+  }
+  if (done < len) {
+    // Past the mapping, if the image has grown since it was mapped.
+    ssize_t r = piscsi_overlay_read(unit, fd, buf + done, (uint32_t)(len - done), offset + done);
+    if (r > 0) {
+      done += (uint64_t)r;
+    }
+  }
+  return done || n == 0 ? (ssize_t)done : -1;
+}
+
+ssize_t piscsi_mmap_write(uint8_t unit, int fd, const uint8_t* buf, uint32_t len,
+                          uint64_t offset) {
+  struct unit_map* m = get_unit(unit);
+  if (!m || m->fd != fd || !len) {
+    return piscsi_overlay_write(unit, fd, buf, len, offset);
+  }
+  // Whatever is past the mapping, because the image grows, is written.
+  uint64_t n = offset >= m->size ? 0 : m->size - offset < len ? m->size - offset : len;
+  uint64_t done = n ? copy(m, (uint8_t*)(uintptr_t)buf, n, offset, 1) : 0;
+  if (done < len &&
+      piscsi_overlay_write(unit, fd, buf + done, (uint32_t)(len - done), offset + done) < 0) {
+    return done ? (ssize_t)done : -1;
+  }
+  return len;
+}
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_PISCSI_MMAP_H
+#define PISTORM_PISCSI_MMAP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Memory-mapped PiSCSI images. With piscsi-mmap on, each image mapped after
+ * it is mmap()ed shared, and reads and writes become memcpy() between the
+ * mapping and the Amiga buffer, with no system call when the data is in the
+ * page cache. A reader that continues where the previous request on the
+ * unit stopped gets the following PISCSI_MMAP_PREFETCH bytes requested with
+ * MADV_WILLNEED.
+ *
+ * The whole image is mapped when the address space allows it. Otherwise,
+ * and always with piscsi-mmap-window set, it is mapped in windows of that
+ * many MB, up to PISCSI_MMAP_WINDOWS at a time, which works for images of
+ * any size on a 32-bit system.
+ *
+ * A memory-mapped unit does not use the block cache (piscsi-cache.h); the
+ * page cache already holds its data. Writes reach the image like write()
+ * would, through the page cache. If the image shrinks or its device fails
+ * while mapped, the emulator gets SIGBUS instead of an I/O error.
+ *
+ *   setvar piscsi-mmap              map images (default off)
+ *   setvar piscsi-mmap-window [MB]  map in windows of this size (default 64
+ *                                   when the whole image cannot be mapped)
+ *   PISTORM_PISCSI_MMAP=0|1, PISTORM_PISCSI_MMAP_WINDOW=MB
+ *                                   the same, override the config file
+ */
+
+#define PISCSI_MMAP_WINDOWS 8
+#define PISCSI_MMAP_DEFAULT_WINDOW 64
+#define PISCSI_MMAP_PREFETCH (512 * 1024)
+
+void piscsi_mmap_set_enabled(int enabled);
+void piscsi_mmap_set_window(unsigned int mb);
+
+// Map `fd` (`size` bytes) as `unit` if memory mapping is enabled. Returns 1
+// if the unit is now mapped.
+int piscsi_mmap_attach(uint8_t unit, int fd, uint64_t size);
+void piscsi_mmap_detach(uint8_t unit);
+
+// Copy between `buf` and the unit's mapping, or go through
+// piscsi_overlay_read()/piscsi_overlay_write() when the unit is not mapped.
+// Return the bytes transferred (short at the end of the image) or -1.
+ssize_t piscsi_mmap_read(uint8_t unit, int fd, uint8_t* buf, uint32_t len, uint64_t offset);
+ssize_t piscsi_mmap_write(uint8_t unit, int fd, const uint8_t* buf, uint32_t len,
+                          uint64_t offset);
+
+#endif /* PISTORM_PISCSI_MMAP_H */
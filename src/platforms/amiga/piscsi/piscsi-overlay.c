@@ -0,0 +1,742 @@
+// SPDX-License-Identifier: MIT
+// Copy-on-write overlays for PiSCSI images. See piscsi-overlay.h.
+
+#define _GNU_SOURCE // pthread_setname_np
+
+#include "piscsi-overlay.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "piscsi-io.h"
+#include "piscsi-zhdf.h"
+
+#define NUM_OVERLAY_UNITS 8
+#define MIN_CHUNK 512
+#define MAX_CHUNK (1024 * 1024)
+// Where the data starts, so that chunks sit on erase block boundaries.
+#define DATA_ALIGN (1024 * 1024)
+#define COMPACT_BLOCK (1024 * 1024)
+
+_Static_assert(sizeof(struct piscsi_overlay_header) == PISCSI_OVERLAY_HEADER_SIZE,
+               "the overlay header must be 4KB");
+
+struct layer {
+  int fd;
+  uint8_t* bitmap;
+  uint64_t bitmap_offset;
+  uint64_t data_offset;
+};
+
+struct unit_overlay {
+  pthread_mutex_t lock; // adding chunks and saving the bitmap
+  int fd;               // the overlay, -1 while the unit has none
+  uint64_t size;
+  uint32_t chunk;
+  unsigned int shift;
+  unsigned int depth; // layers; layer 0 is the overlay at fd, the rest are read-only
+  struct layer layer[PISCSI_OVERLAY_MAX_DEPTH];
+  int base_fd; // the flat image at the bottom of the chain
+  struct piscsi_zhdf* base_z; // base_fd opened as a compressed image, or NULL
+  uint8_t* scratch; // one chunk
+  uint64_t dirty_lo, dirty_hi; // bitmap bytes changed since the last save
+};
+
+static struct unit_overlay units[NUM_OVERLAY_UNITS];
+static pthread_once_t units_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t saver_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t saver_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t saver;
+static uint8_t saver_running, saver_quit;
+
+static struct piscsi_overlay_stats stats;
+#define STAT_ADD(field, n) __atomic_fetch_add(&stats.field, (uint64_t)(n), __ATOMIC_RELAXED)
+
+static void init_units(void) {
+  for (int i = 0; i < NUM_OVERLAY_UNITS; i++) {
+    pthread_mutex_init(&units[i].lock, NULL);
+    units[i].fd = -1;
+    units[i].base_fd = -1;
+  }
+}
+
+static struct unit_overlay* get_unit(uint8_t unit) {
+  pthread_once(&units_once, init_units);
+  return unit < NUM_OVERLAY_UNITS ? &units[unit] : NULL;
+}
+
+static uint64_t bitmap_bytes(uint64_t size, uint32_t chunk) {
+  return ((size + chunk - 1) / chunk + 7) / 8;
+}
+
+static int valid_chunk(uint32_t chunk) {
+  return chunk >= MIN_CHUNK && chunk <= MAX_CHUNK && !(chunk & (chunk - 1));
+}
+
+static int has_chunk(const struct layer* l, uint64_t c) {
+  return (__atomic_load_n(&l->bitmap[c >> 3], __ATOMIC_ACQUIRE) >> (c & 7)) & 1;
+}
+
+// The top-most layer from `first` down that holds chunk `c`; depth for the
+// base image.
+static unsigned int source(const struct unit_overlay* o, unsigned int first, uint64_t c) {
+  for (unsigned int i = first; i < o->depth; i++) {
+    if (has_chunk(&o->layer[i], c)) {
+      return i;
+    }
+  }
+  return o->depth;
+}
+
+// Read [offset, offset + len) of the image as seen from layer `first`, each
+// run of chunks from the same file with one pread(). The range is inside
+// the image.
+static int read_chain(struct unit_overlay* o, unsigned int first, uint8_t* buf, uint64_t len,
+                      uint64_t offset) {
+  uint64_t end = offset + len;
+  for (uint64_t pos = offset; pos < end;) {
+    uint64_t c = pos >> o->shift;
+    unsigned int src = source(o, first, c);
+    uint64_t run_end = (c + 1) << o->shift;
+    while (run_end < end && source(o, first, run_end >> o->shift) == src) {
+      run_end += o->chunk;
+    }
+    if (run_end > end) {
+      run_end = end;
+    }
+    size_t n = (size_t)(run_end - pos);
+    uint8_t* dst = buf + (pos - offset);
+    ssize_t got;
+    if (src < o->depth) {
+      got = piscsi_full_pread(o->layer[src].fd, dst, n, o->layer[src].data_offset + pos);
+    } else if (o->base_z) {
+      got = piscsi_zhdf_pread(o->base_z, dst, n, pos);
+    } else {
+      got = piscsi_full_pread(o->base_fd, dst, n, pos);
+    }
+    if (got < 0) {
+      return -1;
+    }
+    // A base image shorter than the overlay reads as zeroes past its end.
+    memset(dst + got, 0, n - (size_t)got);
+    pos = run_end;
+  }
+  return 0;
+}
+
+static void set_chunks(struct unit_overlay* o, uint64_t first, uint64_t last) {
+  uint8_t* bitmap = o->layer[0].bitmap;
+  for (uint64_t c = first; c <= last; c++) {
+    __atomic_fetch_or(&bitmap[c >> 3], (uint8_t)(1u << (c & 7)), __ATOMIC_RELEASE);
+  }
+  if (o->dirty_lo >= o->dirty_hi) {
+    o->dirty_lo = first >> 3;
+    o->dirty_hi = (last >> 3) + 1;
+  } else {
+    if ((first >> 3) < o->dirty_lo) {
+      o->dirty_lo = first >> 3;
+    }
+    if ((last >> 3) + 1 > o->dirty_hi) {
+      o->dirty_hi = (last >> 3) + 1;
+    }
+  }
+  STAT_ADD(copy_ups, last - first + 1);
+}
+
+// Add chunks to the overlay for the write of `src` at `pos`, up to `end`:
+// the chunk at `pos`, read from below and merged if the write only covers
+// part of it, or every whole chunk from `pos` on that is not in the overlay
+// yet. Called with the lock held. Returns where the write continues, or 0.
+static uint64_t copy_up(struct unit_overlay* o, const uint8_t* src, uint64_t pos, uint64_t end) {
+  struct layer* top = &o->layer[0];
+  uint64_t c = pos >> o->shift;
+  uint64_t cstart = c << o->shift;
+  uint64_t cend = cstart + o->chunk < o->size ? cstart + o->chunk : o->size;
+  if (pos == cstart && end >= cend) {
+    uint64_t run_end = cend;
+    while (run_end < end) {
+      uint64_t next_end = run_end + o->chunk < o->size ? run_end + o->chunk : o->size;
+      if (end < next_end || has_chunk(top, run_end >> o->shift)) {
+        break;
+      }
+      run_end = next_end;
+    }
+    if (piscsi_full_pwrite(o->fd, src, (size_t)(run_end - pos), top->data_offset + pos) < 0) {
+      return 0;
+    }
+    set_chunks(o, c, (run_end - 1) >> o->shift);
+    return run_end;
+  }
+  if (read_chain(o, 1, o->scratch, cend - cstart, cstart) < 0) {
+    return 0;
+  }
+  uint64_t n = (end < cend ? end : cend) - pos;
+  memcpy(o->scratch + (pos - cstart), src, (size_t)n);
+  if (piscsi_full_pwrite(o->fd, o->scratch, (size_t)(cend - cstart), top->data_offset + cstart) < 0) {
+    return 0;
+  }
+  set_chunks(o, c, c);
+  STAT_ADD(partial, 1);
+  return pos + n;
+}
+
+// Save the bitmap bytes changed since the last save, once the chunks they
+// stand for are on disk. Called with the lock held.
+static int save_bitmap(struct unit_overlay* o) {
+  if (o->fd == -1 || o->dirty_lo >= o->dirty_hi) {
+    return 0;
+  }
+  struct layer* top = &o->layer[0];
+  int ret = 0;
+  if ((fdatasync(o->fd) < 0 && errno != EINVAL) ||
+      piscsi_full_pwrite(o->fd, top->bitmap + o->dirty_lo, (size_t)(o->dirty_hi - o->dirty_lo),
+                  top->bitmap_offset + o->dirty_lo) < 0 ||
+      (fdatasync(o->fd) < 0 && errno != EINVAL)) {
+    LOG_ERROR("[PISCSI] Could not save the overlay bitmap: %s\n", strerror(errno));
+    STAT_ADD(errors, 1);
+    ret = -1;
+  } else {
+    STAT_ADD(bitmap_saves, 1);
+  }
+  // Not retried: the chunks stay in use and are saved with the next change.
+  o->dirty_lo = o->dirty_hi = 0;
+  return ret;
+}
+
+static void* saver_task(void* arg) {
+  (void)arg;
+  pthread_mutex_lock(&saver_lock);
+  while (!saver_quit) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += PISCSI_OVERLAY_SYNC_SECONDS;
+    pthread_cond_timedwait(&saver_wake, &saver_lock, &ts);
+    if (saver_quit) {
+      break;
+    }
+    pthread_mutex_unlock(&saver_lock);
+    for (int i = 0; i < NUM_OVERLAY_UNITS; i++) {
+      pthread_mutex_lock(&units[i].lock);
+      save_bitmap(&units[i]);
+      pthread_mutex_unlock(&units[i].lock);
+    }
+    pthread_mutex_lock(&saver_lock);
+  }
+  pthread_mutex_unlock(&saver_lock);
+  return NULL;
+}
+
+static void start_saver(void) {
+  pthread_mutex_lock(&saver_lock);
+  if (!saver_running) {
+    saver_quit = 0;
+    if (pthread_create(&saver, NULL, saver_task, NULL) != 0) {
+      LOG_ERROR("[PISCSI] Could not start the overlay thread, bitmaps are only saved on cache "
+                "flushes and unmap.\n");
+    } else {
+      pthread_setname_np(saver, "pistorm64: cow");
+      saver_running = 1;
+    }
+  }
+  pthread_mutex_unlock(&saver_lock);
+}
+
+// `backing` as the overlay at `path` should name it: the file name alone if
+// both are in the same directory, otherwise the full path.
+static int backing_name(const char* path, const char* backing, char* out, size_t n) {
+  char full[PATH_MAX], dir[PATH_MAX], tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s", path);
+  if (!realpath(backing, full) || !realpath(dirname(tmp), dir)) {
+    return -1;
+  }
+  size_t dl = strlen(dir);
+  const char* name = full;
+  if (strncmp(full, dir, dl) == 0 && full[dl] == '/' && !strchr(full + dl + 1, '/')) {
+    name = full + dl + 1;
+  }
+  size_t len = strlen(name);
+  if (len >= n) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memcpy(out, name, len + 1);
+  return 0;
+}
+
+void piscsi_overlay_backing_path(const char* path, const char* backing, char* out, size_t n) {
+  const char* slash = strrchr(path, '/');
+  if (backing[0] == '/' || !slash) {
+    snprintf(out, n, "%s", backing);
+  } else {
+    snprintf(out, n, "%.*s/%s", (int)(slash - path), path, backing);
+  }
+}
+
+int piscsi_overlay_read_header(int fd, struct piscsi_overlay_header* h) {
+  if (piscsi_full_pread(fd, (uint8_t*)h, sizeof(*h), 0) != (ssize_t)sizeof(*h) ||
+      memcmp(h->magic, PISCSI_OVERLAY_MAGIC, sizeof(h->magic)) != 0) {
+    return 0;
+  }
+  h->version = le32toh(h->version);
+  h->chunk_size = le32toh(h->chunk_size);
+  h->size = le64toh(h->size);
+  h->bitmap_offset = le64toh(h->bitmap_offset);
+  h->data_offset = le64toh(h->data_offset);
+  if (h->version != PISCSI_OVERLAY_VERSION || !valid_chunk(h->chunk_size) || !h->size ||
+      h->bitmap_offset < sizeof(*h) ||
+      h->data_offset < h->bitmap_offset + bitmap_bytes(h->size, h->chunk_size) ||
+      !h->backing[0] || !memchr(h->backing, 0, sizeof(h->backing))) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 1;
+}
+
+static int write_header(int fd, const struct piscsi_overlay_header* h) {
+  struct piscsi_overlay_header le = *h;
+  le.version = htole32(h->version);
+  le.chunk_size = htole32(h->chunk_size);
+  le.size = htole64(h->size);
+  le.bitmap_offset = htole64(h->bitmap_offset);
+  le.data_offset = htole64(h->data_offset);
+  return piscsi_full_pwrite(fd, (const uint8_t*)&le, sizeof(le), 0) < 0 ? -1 : 0;
+}
+
+int piscsi_overlay_create(const char* path, const char* backing, uint32_t chunk_size) {
+  struct piscsi_overlay_header h;
+  int bfd = open(backing, O_RDONLY);
+  if (bfd < 0) {
+    return -1;
+  }
+  int r = piscsi_overlay_read_header(bfd, &h);
+  struct piscsi_zhdf_header zh;
+  uint64_t size = r ? h.size : (uint64_t)lseek(bfd, 0, SEEK_END);
+  if (!r && piscsi_zhdf_read_header(bfd, &zh) > 0) {
+    size = zh.size;
+  }
+  if (r > 0 && !chunk_size) {
+    chunk_size = h.chunk_size;
+  }
+  close(bfd);
+  if (!chunk_size) {
+    chunk_size = PISCSI_OVERLAY_DEFAULT_CHUNK;
+  }
+  // Every layer of a chain uses the same chunks.
+  if (r < 0 || (r > 0 && chunk_size != h.chunk_size) || !valid_chunk(chunk_size) || !size ||
+      size == (uint64_t)-1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(&h, 0, sizeof(h));
+  if (backing_name(path, backing, h.backing, sizeof(h.backing)) < 0) {
+    return -1;
+  }
+  uint64_t data_offset = sizeof(h) + bitmap_bytes(size, chunk_size);
+  data_offset = (data_offset + DATA_ALIGN - 1) / DATA_ALIGN * DATA_ALIGN;
+  memcpy(h.magic, PISCSI_OVERLAY_MAGIC, sizeof(h.magic));
+  h.version = PISCSI_OVERLAY_VERSION;
+  h.chunk_size = chunk_size;
+  h.size = size;
+  h.bitmap_offset = sizeof(h);
+  h.data_offset = data_offset;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  // The bitmap and the data are a hole until chunks are written.
+  if (write_header(fd, &h) < 0 || ftruncate(fd, (off_t)(data_offset + size)) < 0 ||
+      fdatasync(fd) < 0) {
+    int err = errno;
+    close(fd);
+    unlink(path);
+    errno = err;
+    return -1;
+  }
+  return close(fd);
+}
+
+static void close_chain(struct unit_overlay* o) {
+  for (unsigned int i = 0; i < o->depth; i++) {
+    if (i) {
+      close(o->layer[i].fd);
+    }
+    free(o->layer[i].bitmap);
+    o->layer[i].bitmap = NULL;
+  }
+  piscsi_zhdf_close(o->base_z);
+  o->base_z = NULL;
+  if (o->base_fd != -1) {
+    close(o->base_fd);
+  }
+  free(o->scratch);
+  o->scratch = NULL;
+  o->depth = 0;
+  o->base_fd = -1;
+  o->fd = -1;
+}
+
+// Open the chain below the overlay `fd` (`path`, header `h`) into `o`, and
+// name its base image in `base`. Returns 0, or -1 with nothing left open
+// but `fd`.
+static int open_chain(struct unit_overlay* o, int fd, const char* path,
+                      struct piscsi_overlay_header* h, char* base, size_t n) {
+  o->size = h->size;
+  o->chunk = h->chunk_size;
+  o->shift = (unsigned int)__builtin_ctz(h->chunk_size);
+  o->depth = 0;
+  o->base_fd = -1;
+  o->base_z = NULL;
+  char cur[PATH_MAX];
+  snprintf(cur, sizeof(cur), "%s", path);
+  int cur_fd = fd;
+  for (;;) {
+    struct layer* l = &o->layer[o->depth++];
+    size_t bytes = (size_t)bitmap_bytes(o->size, o->chunk);
+    l->fd = cur_fd;
+    l->bitmap_offset = h->bitmap_offset;
+    l->data_offset = h->data_offset;
+    l->bitmap = calloc(1, bytes);
+    if (!l->bitmap || piscsi_full_pread(cur_fd, l->bitmap, bytes, h->bitmap_offset) < 0) {
+      LOG_ERROR("[PISCSI] Could not read the bitmap of %s.\n", cur);
+      goto fail;
+    }
+    piscsi_overlay_backing_path(cur, h->backing, base, n);
+    int nfd = open(base, O_RDONLY);
+    if (nfd < 0) {
+      LOG_ERROR("[PISCSI] Could not open %s, the backing image of %s: %s\n", base, cur,
+                strerror(errno));
+      goto fail;
+    }
+    int r = piscsi_overlay_read_header(nfd, h);
+    if (r == 0) {
+      // A compressed base image is read through its index, never written.
+      struct piscsi_zhdf_header zh;
+      o->base_fd = nfd;
+      if (piscsi_zhdf_read_header(nfd, &zh) != 0 && !(o->base_z = piscsi_zhdf_open(nfd, 0, 0))) {
+        LOG_ERROR("[PISCSI] Could not open %s, the compressed backing image of %s.\n", base, cur);
+        goto fail;
+      }
+      break;
+    }
+    if (r < 0 || h->size != o->size || h->chunk_size != o->chunk ||
+        o->depth == PISCSI_OVERLAY_MAX_DEPTH) {
+      LOG_ERROR("[PISCSI] %s does not fit under %s (a damaged overlay, another size or chunk "
+                "size, or more than %d overlays).\n",
+                base, cur, PISCSI_OVERLAY_MAX_DEPTH);
+      close(nfd);
+      goto fail;
+    }
+    cur_fd = nfd;
+    snprintf(cur, sizeof(cur), "%s", base);
+  }
+  o->scratch = malloc(o->chunk);
+  if (o->scratch) {
+    o->dirty_lo = o->dirty_hi = 0;
+    return 0;
+  }
+
+fail:
+  close_chain(o);
+  return -1;
+}
+
+int piscsi_overlay_attach(uint8_t unit, int fd, const char* path, uint64_t* size) {
+  struct unit_overlay* o = get_unit(unit);
+  if (!o) {
+    return 0;
+  }
+  piscsi_overlay_detach(unit);
+  struct piscsi_overlay_header h;
+  int r = piscsi_overlay_read_header(fd, &h);
+  if (r <= 0) {
+    if (r < 0) {
+      LOG_ERROR("[PISCSI] %s is a damaged or unsupported overlay.\n", path);
+    }
+    return r;
+  }
+
+  char base[PATH_MAX];
+  pthread_mutex_lock(&o->lock);
+  if (open_chain(o, fd, path, &h, base, sizeof(base)) < 0) {
+    pthread_mutex_unlock(&o->lock);
+    return -1;
+  }
+  o->fd = fd;
+  pthread_mutex_unlock(&o->lock);
+
+  start_saver();
+  *size = o->size;
+  LOG_INFO("[PISCSI] Unit %u: overlay of %s (%u deep), %uKB chunks.\n", unit, base, o->depth,
+           o->chunk / 1024);
+  return 1;
+}
+
+void piscsi_overlay_detach(uint8_t unit) {
+  struct unit_overlay* o = get_unit(unit);
+  if (!o) {
+    return;
+  }
+  pthread_mutex_lock(&o->lock);
+  if (o->fd != -1) {
+    save_bitmap(o);
+    close_chain(o);
+  }
+  pthread_mutex_unlock(&o->lock);
+}
+
+int piscsi_overlay_active(uint8_t unit) {
+  struct unit_overlay* o = get_unit(unit);
+  return o && o->fd != -1;
+}
+
+ssize_t piscsi_overlay_read(uint8_t unit, int fd, uint8_t* buf, uint32_t len, uint64_t offset) {
+  struct unit_overlay* o = get_unit(unit);
+  if (!o || o->fd != fd || !len) {
+    return piscsi_zhdf_read(unit, fd, buf, len, offset);
+  }
+  if (offset >= o->size) {
+    return 0;
+  }
+  uint64_t n = o->size - offset < len ? o->size - offset : len;
+  return read_chain(o, 0, buf, n, offset) < 0 ? -1 : (ssize_t)n;
+}
+
+ssize_t piscsi_overlay_write(uint8_t unit, int fd, const uint8_t* buf, uint32_t len,
+                             uint64_t offset) {
+  struct unit_overlay* o = get_unit(unit);
+  if (!o || o->fd != fd || !len) {
+    return piscsi_zhdf_write(unit, fd, buf, len, offset);
+  }
+  // An overlay does not grow.
+  if (offset >= o->size) {
+    errno = ENOSPC;
+    return -1;
+  }
+  struct layer* top = &o->layer[0];
+  uint64_t end = o->size - offset < len ? o->size : offset + len;
+  uint64_t pos = offset;
+  while (pos < end) {
+    const uint8_t* src = buf + (pos - offset);
+    uint64_t c = pos >> o->shift;
+    if (!has_chunk(top, c)) {
+      pthread_mutex_lock(&o->lock);
+      uint64_t next = has_chunk(top, c) ? pos : copy_up(o, src, pos, end);
+      pthread_mutex_unlock(&o->lock);
+      if (!next) {
+        LOG_ERROR("[PISCSI] Overlay write at %llu failed: %s\n", (unsigned long long)pos,
+                  strerror(errno));
+        STAT_ADD(errors, 1);
+        break;
+      }
+      if (next != pos) {
+        pos = next;
+        continue;
+      }
+    }
+    // Chunks already in the overlay are written in place.
+    uint64_t run_end = (c + 1) << o->shift;
+    while (run_end < end && has_chunk(top, run_end >> o->shift)) {
+      run_end += o->chunk;
+    }
+    if (run_end > end) {
+      run_end = end;
+    }
+    if (piscsi_full_pwrite(fd, src, (size_t)(run_end - pos), top->data_offset + pos) < 0) {
+      STAT_ADD(errors, 1);
+      break;
+    }
+    pos = run_end;
+  }
+  return pos > offset ? (ssize_t)(pos - offset) : -1;
+}
+
+int piscsi_overlay_sync(uint8_t unit, int fd) {
+  struct unit_overlay* o = get_unit(unit);
+  if (o && o->fd == fd) {
+    pthread_mutex_lock(&o->lock);
+    int ret = o->dirty_lo < o->dirty_hi ? save_bitmap(o) : fdatasync(fd);
+    pthread_mutex_unlock(&o->lock);
+    return ret;
+  }
+  return piscsi_zhdf_unit_sync(unit, fd);
+}
+
+// Read the header of the overlay at `path`. Returns 0, or -1 with errno set.
+static int load_header(const char* path, struct piscsi_overlay_header* h) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  int r = piscsi_overlay_read_header(fd, h);
+  close(fd);
+  if (r == 0) {
+    errno = EINVAL;
+  }
+  return r > 0 ? 0 : -1;
+}
+
+// Overlays in the chain of the one at `path`, itself included.
+static unsigned int chain_depth(const char* path) {
+  struct piscsi_overlay_header h;
+  char cur[PATH_MAX], next[PATH_MAX];
+  unsigned int depth = 0;
+  snprintf(cur, sizeof(cur), "%s", path);
+  while (depth <= PISCSI_OVERLAY_MAX_DEPTH && load_header(cur, &h) == 0) {
+    depth++;
+    piscsi_overlay_backing_path(cur, h.backing, next, sizeof(next));
+    memcpy(cur, next, sizeof(cur));
+  }
+  return depth;
+}
+
+int piscsi_overlay_snapshot(const char* path, const char* snapshot) {
+  struct piscsi_overlay_header h;
+  char backing[PATH_MAX];
+  if (load_header(path, &h) < 0) {
+    return -1;
+  }
+  if (chain_depth(path) >= PISCSI_OVERLAY_MAX_DEPTH) {
+    errno = EMLINK;
+    return -1;
+  }
+  if (access(snapshot, F_OK) == 0) {
+    errno = EEXIST;
+    return -1;
+  }
+  piscsi_overlay_backing_path(path, h.backing, backing, sizeof(backing));
+  if (rename(path, snapshot) < 0) {
+    return -1;
+  }
+  // The snapshot may be in another directory: name its backing image from there.
+  int fd = open(snapshot, O_RDWR);
+  memset(h.backing, 0, sizeof(h.backing));
+  if (fd < 0 || backing_name(snapshot, backing, h.backing, sizeof(h.backing)) < 0 ||
+      write_header(fd, &h) < 0 || fdatasync(fd) < 0 || close(fd) < 0 ||
+      piscsi_overlay_create(path, snapshot, 0) < 0) {
+    int err = errno;
+    if (fd >= 0) {
+      close(fd);
+    }
+    rename(snapshot, path);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+int piscsi_overlay_revert(const char* path, const char* backing) {
+  struct piscsi_overlay_header h;
+  char own[PATH_MAX], tmp[PATH_MAX];
+  if (load_header(path, &h) < 0) {
+    return -1;
+  }
+  if (!backing) {
+    piscsi_overlay_backing_path(path, h.backing, own, sizeof(own));
+    backing = own;
+  }
+  // Made beside the overlay and renamed over it, so a failure leaves it as it was.
+  snprintf(tmp, sizeof(tmp), "%s.new", path);
+  if (piscsi_overlay_create(tmp, backing, backing == own ? h.chunk_size : 0) < 0) {
+    return -1;
+  }
+  if (rename(tmp, path) < 0) {
+    int err = errno;
+    unlink(tmp);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+int piscsi_overlay_compact(const char* path, const char* out) {
+  struct unit_overlay o;
+  struct piscsi_overlay_header h;
+  char base[PATH_MAX];
+  memset(&o, 0, sizeof(o));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  if (piscsi_overlay_read_header(fd, &h) <= 0 ||
+      open_chain(&o, fd, path, &h, base, sizeof(base)) < 0) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  uint8_t* buf = malloc(COMPACT_BLOCK);
+  // Never over an existing file, which could be part of the chain.
+  int ofd = buf ? open(out, O_WRONLY | O_CREAT | O_EXCL, 0644) : -1;
+  int ret = ofd < 0 || ftruncate(ofd, (off_t)o.size) < 0 ? -1 : 0;
+  for (uint64_t pos = 0; !ret && pos < o.size; pos += COMPACT_BLOCK) {
+    uint64_t n = o.size - pos < COMPACT_BLOCK ? o.size - pos : COMPACT_BLOCK;
+    if (read_chain(&o, 0, buf, n, pos) < 0) {
+      ret = -1;
+      break;
+    }
+    // Zeroes stay a hole, as in the overlay.
+    uint64_t i = 0;
+    while (i < n && !buf[i]) {
+      i++;
+    }
+    if (i < n && piscsi_full_pwrite(ofd, buf, (size_t)n, pos) < 0) {
+      ret = -1;
+    }
+  }
+  int err = errno;
+  if (!ret && fdatasync(ofd) < 0) {
+    err = errno;
+    ret = -1;
+  }
+  if (ofd >= 0) {
+    close(ofd);
+    if (ret) {
+      unlink(out);
+    }
+  }
+  free(buf);
+  close_chain(&o);
+  close(fd);
+  errno = err;
+  return ret;
+}
+
+void piscsi_overlay_stop(void) {
+  pthread_mutex_lock(&saver_lock);
+  uint8_t running = saver_running;
+  saver_quit = 1;
+  pthread_cond_signal(&saver_wake);
+  pthread_mutex_unlock(&saver_lock);
+  if (running) {
+    pthread_join(saver, NULL);
+    saver_running = 0;
+  }
+  for (uint8_t i = 0; i < NUM_OVERLAY_UNITS; i++) {
+    piscsi_overlay_detach(i);
+  }
+  if (stats.copy_ups) {
+    LOG_INFO("[PISCSI] Overlays: %llu chunks added (%llu read from below), %llu bitmap saves, "
+             "%llu errors.\n",
+             (unsigned long long)stats.copy_ups, (unsigned long long)stats.partial,
+             (unsigned long long)stats.bitmap_saves, (unsigned long long)stats.errors);
+  }
+}
+
+void piscsi_overlay_get_stats(struct piscsi_overlay_stats* out) {
+  out->copy_ups = __atomic_load_n(&stats.copy_ups, __ATOMIC_RELAXED);
+  out->partial = __atomic_load_n(&stats.partial, __ATOMIC_RELAXED);
+  out->bitmap_saves = __atomic_load_n(&stats.bitmap_saves, __ATOMIC_RELAXED);
+  out->errors = __atomic_load_n(&stats.errors, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_PISCSI_OVERLAY_H
+#define PISTORM_PISCSI_OVERLAY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Copy-on-write overlays for PiSCSI images. An overlay file stands in for a
+ * hard file: it names a backing image, which is only ever opened read-only,
+ * and holds the chunks of it that have been written since the overlay was
+ * made. Map it like any image:
+ *
+ *   setvar piscsi0 work.cow
+ *
+ * The backing image can be a flat hard file, a compressed one
+ * (piscsi-zhdf.h) or another overlay, up to PISCSI_OVERLAY_MAX_DEPTH deep,
+ * so a chain is base <- snapshot <- ... <- overlay. Only the overlay that is
+ * mapped is written.
+ *
+ * File layout (little endian):
+ *
+ *   0              struct piscsi_overlay_header, 4KB
+ *   bitmap_offset  one bit per chunk, set when the chunk is in this file
+ *   data_offset    the image: chunk n at data_offset + n * chunk_size,
+ *                  a hole where the chunk is not in this file
+ *
+ * A new overlay is a header and a sparse file, so making one takes the same
+ * time whatever the size of the image. It needs a file system with sparse
+ * files (ext4, btrfs, xfs; not FAT).
+ *
+ * The first write to a chunk copies the rest of it from below. New bits of
+ * the bitmap are saved, after an fdatasync() of the data, every
+ * PISCSI_OVERLAY_SYNC_SECONDS, whenever the block cache flushes and when the
+ * unit is unmapped. After a power loss the chunks added since the last save
+ * read as they were before; writes to chunks already in the overlay behave
+ * as with a flat image. Memory-mapping (piscsi-mmap.h) is not used for
+ * overlays.
+ *
+ * Snapshots freeze the overlay as it is and continue in a new one on top of
+ * it; reverting replaces the overlay with an empty one. Both only write a
+ * header, like making an overlay. Compacting writes out the whole image the
+ * chain stands for as a new flat image. tools/piscsi_overlay.c does these
+ * from the command line.
+ */
+
+#define PISCSI_OVERLAY_MAGIC "PiSCOW\r\n"
+#define PISCSI_OVERLAY_VERSION 1
+#define PISCSI_OVERLAY_HEADER_SIZE 4096
+#define PISCSI_OVERLAY_DEFAULT_CHUNK 4096
+#define PISCSI_OVERLAY_MAX_DEPTH 8
+#define PISCSI_OVERLAY_SYNC_SECONDS 5
+
+struct piscsi_overlay_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t chunk_size; // power of two, 512 to 1MB
+  uint64_t size;       // of the image
+  uint64_t bitmap_offset;
+  uint64_t data_offset;
+  // Backing image, relative to the overlay's directory unless absolute.
+  char backing[PISCSI_OVERLAY_HEADER_SIZE - 40];
+};
+
+// Make an empty overlay of `backing` at `path`, replacing any file there.
+// `chunk_size` 0 picks the backing overlay's, or the default. Returns 0 or
+// -1 with errno set.
+int piscsi_overlay_create(const char* path, const char* backing, uint32_t chunk_size);
+// The backing image `backing` named in the overlay at `path`, as a path
+// that can be opened.
+void piscsi_overlay_backing_path(const char* path, const char* backing, char* out, size_t n);
+// Read and check the header of an open file. Returns 1 for an overlay, 0
+// for anything else, -1 for a damaged overlay.
+int piscsi_overlay_read_header(int fd, struct piscsi_overlay_header* h);
+
+// Offline operations, on overlays that are not mapped. They return 0 or -1
+// with errno set.
+//
+// Move the overlay to `snapshot`, which must not exist, and put an empty
+// overlay of it in its place.
+int piscsi_overlay_snapshot(const char* path, const char* snapshot);
+// Drop everything written to the overlay since it was made, or make it an
+// empty overlay of `backing` instead when that is not NULL.
+int piscsi_overlay_revert(const char* path, const char* backing);
+// Write the image the overlay stands for to `out`, a new flat image.
+int piscsi_overlay_compact(const char* path, const char* out);
+
+// Open the chain below the overlay `fd` (`path`) as `unit`. Returns 1 if it
+// is an overlay, with `*size` set to the image size, 0 if it is a plain
+// image and -1 if it is an overlay that could not be opened.
+int piscsi_overlay_attach(uint8_t unit, int fd, const char* path, uint64_t* size);
+// Save the bitmap and close the chain. The caller closes `fd`.
+void piscsi_overlay_detach(uint8_t unit);
+int piscsi_overlay_active(uint8_t unit);
+
+// pread()/pwrite() of the whole range through the unit's overlay, or of the
+// file itself when the unit has none. Return the bytes transferred (short
+// at the end of the image) or -1.
+ssize_t piscsi_overlay_read(uint8_t unit, int fd, uint8_t* buf, uint32_t len, uint64_t offset);
+ssize_t piscsi_overlay_write(uint8_t unit, int fd, const uint8_t* buf, uint32_t len,
+                             uint64_t offset);
+// fdatasync() the file, and for an overlay then save its bitmap.
+int piscsi_overlay_sync(uint8_t unit, int fd);
+
+// Detach every unit and stop the thread that saves bitmaps.
+void piscsi_overlay_stop(void);
+
+struct piscsi_overlay_stats {
+  uint64_t copy_ups;      // chunks added to an overlay
+  uint64_t partial;       // of those, chunks that needed a read from below
+  uint64_t bitmap_saves;
+  uint64_t errors;
+};
+
+// Totals over all units since startup.
+void piscsi_overlay_get_stats(struct piscsi_overlay_stats* stats);
+
+#endif /* PISTORM_PISCSI_OVERLAY_H */
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: MIT
+// Recording of PiSCSI register accesses. See piscsi-trace.h.
+
+#include "piscsi-trace.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config_file/config_file.h"
+#include "log.h"
+#include "piscsi-enums.h"
+#include "piscsi.h"
+
+#define TRACE_BUFFER (256 * 1024)
+
+extern struct emulator_config* cfg;
+
+FILE* piscsi_trace_out;
+
+static char trace_path[256];
+static uint64_t trace_t0;
+static int trace_failed;
+
+void piscsi_trace_set_path(const char* path) {
+  snprintf(trace_path, sizeof(trace_path), "%s", path ? path : "");
+}
+
+static void write_layout(void) {
+  for (int i = 0; cfg && i < MAX_NUM_MAPPED_ITEMS; i++) {
+    unsigned char type = cfg->map_type[i];
+    if (cfg->map_data[i] &&
+        (type == MAPTYPE_RAM || type == MAPTYPE_RAM_NOALLOC || type == MAPTYPE_ROM)) {
+      fprintf(piscsi_trace_out, "map %08lX %08lX\n", cfg->map_offset[i],
+              cfg->map_high[i] - cfg->map_offset[i]);
+    }
+  }
+  for (uint8_t i = 0; i < NUM_UNITS; i++) {
+    struct piscsi_dev* d = piscsi_get_dev(i);
+    if (d->fd != -1 || d->removable) {
+      fprintf(piscsi_trace_out, "unit %u %llu %u %u\n", i, (unsigned long long)d->fs,
+              d->block_size, d->removable);
+    }
+  }
+}
+
+void piscsi_trace_reset(void) {
+  if (!piscsi_trace_out && !trace_failed) {
+    const char* env = getenv("PISTORM_PISCSI_TRACE");
+    if (env && *env) {
+      piscsi_trace_set_path(env);
+    }
+    if (!trace_path[0]) {
+      return;
+    }
+    piscsi_trace_out = fopen(trace_path, "w");
+    if (!piscsi_trace_out) {
+      LOG_ERROR("[PISCSI] Cannot record to %s: %s\n", trace_path, strerror(errno));
+      trace_failed = 1;
+      return;
+    }
+    setvbuf(piscsi_trace_out, NULL, _IOFBF, TRACE_BUFFER);
+    fprintf(piscsi_trace_out, "# pistorm piscsi trace %d\n", PISCSI_TRACE_VERSION);
+    LOG_INFO("[PISCSI] Recording register accesses to %s.\n", trace_path);
+  }
+  if (!piscsi_trace_out) {
+    return;
+  }
+  write_layout();
+  fprintf(piscsi_trace_out, "reset\n");
+  fflush(piscsi_trace_out);
+}
+
+void piscsi_trace_stop(void) {
+  if (piscsi_trace_out) {
+    fclose(piscsi_trace_out);
+    piscsi_trace_out = NULL;
+  }
+}
+
+void piscsi_trace_access(char op, uint32_t reg, unsigned int bits, uint32_t value, uint64_t t0,
+                         uint64_t t1) {
+  if (!trace_t0) {
+    trace_t0 = t0;
+  }
+  fprintf(piscsi_trace_out, "%llu %c %X %u %X %llu\n", (unsigned long long)(t0 - trace_t0), op,
+          reg, bits, value, (unsigned long long)(t1 - t0));
+}
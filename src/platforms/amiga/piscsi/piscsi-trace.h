@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_PISCSI_TRACE_H
+#define PISTORM_PISCSI_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Recording of the PiSCSI register accesses of a running emulator, for
+ * tools/piscsi_replay.c to replay against the same piscsi.c on any Linux
+ * machine. Everything the boot ROM and pi-scsi.device do goes through
+ * these registers, from the unit probing and partition setup at boot to
+ * every transfer, so a trace holds the whole workload. Reads of the boot
+ * ROM itself are left out.
+ *
+ *   setvar piscsi-trace [file]    record to this file (default off)
+ *   PISTORM_PISCSI_TRACE=file     the same, overrides the config file
+ *
+ * The file is text, one line each:
+ *
+ *   map <base> <size>                    Amiga memory the Pi maps, hex
+ *   unit <n> <bytes> <block size> <removable>
+ *   reset                                piscsi_refresh_drives(), at every
+ *                                        Amiga reset, after the maps and units
+ *   <ns> W <reg> <bits> <value> <ns>     register write: time since the
+ *   <ns> R <reg> <bits> <value> <ns>     recording started, register offset
+ *                                        and value in hex, time it took
+ *
+ * Lines starting with # are comments. A synthetic trace only needs the
+ * unit lines, a reset and the register accesses; the times can be 0.
+ * The trace is written from the CPU thread and buffered; it is complete
+ * once the emulator has exited.
+ */
+
+#define PISCSI_TRACE_VERSION 1
+
+// Open while recording. Checked before every register access.
+extern FILE* piscsi_trace_out;
+
+void piscsi_trace_set_path(const char* path);
+// Start recording if a file is set and record a reset. Called from
+// piscsi_refresh_drives().
+void piscsi_trace_reset(void);
+void piscsi_trace_stop(void);
+
+// Record a register access of `bits` width that started at `t0` and ended
+// at `t1` (CLOCK_MONOTONIC ns).
+void piscsi_trace_access(char op, uint32_t reg, unsigned int bits, uint32_t value, uint64_t t0,
+                         uint64_t t1);
+
+#endif /* PISTORM_PISCSI_TRACE_H */
@@ -0,0 +1,839 @@
+// SPDX-License-Identifier: MIT
+// Compressed hard files for PiSCSI. See piscsi-zhdf.h.
+
+#define _GNU_SOURCE // pthread_setname_np
+
+#include "piscsi-zhdf.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef PISTORM_ZLIB
+#include <zlib.h>
+#endif
+
+#include "log.h"
+#include "piscsi-io.h"
+
+#define NUM_ZHDF_UNITS 8
+#define MIN_CHUNK 4096
+#define MAX_CHUNK (1024 * 1024)
+#define SECTOR 512
+#define DATA_ALIGN 4096
+#define MIN_CACHED_CHUNKS 4
+#define NO_CHUNK UINT64_MAX
+
+_Static_assert(sizeof(struct piscsi_zhdf_header) == PISCSI_ZHDF_HEADER_SIZE,
+               "the .zhdf header must be 4KB");
+_Static_assert(sizeof(struct piscsi_zhdf_entry) == 16, "index entries are 16 bytes");
+
+struct cached {
+  uint64_t n; // chunk number, NO_CHUNK while unused
+  uint8_t* data;
+  uint8_t dirty;
+  struct cached *prev, *next; // LRU list, most recently used first
+  struct cached* hnext;
+};
+
+struct slot {
+  uint64_t offset;
+  uint32_t size;
+};
+
+struct slot_list {
+  struct slot* s;
+  uint32_t count, cap;
+};
+
+struct piscsi_zhdf {
+  pthread_mutex_t lock;
+  int fd;
+  int writable;
+  uint64_t size;
+  uint32_t chunk;
+  unsigned int shift;
+  int level;
+  uint64_t chunks;
+  uint64_t index_offset;
+  uint64_t data_offset;
+  struct piscsi_zhdf_entry* index; // in host byte order
+  uint64_t dirty_lo, dirty_hi;     // index entries changed since the last save
+
+  struct cached* cache;
+  unsigned int ncache, ndirty;
+  struct cached** hash;
+  unsigned int hash_mask;
+  struct cached lru; // list head
+
+  // Free slots by size in sectors, 1 to chunk / SECTOR, and slots given up
+  // since the last index save, which that index may still point at.
+  struct slot_list* free;
+  unsigned int classes;
+  struct slot_list pending;
+  uint64_t end; // of the last slot in use
+
+  uint8_t* zbuf;
+  size_t zbuf_len;
+};
+
+struct unit_zhdf {
+  pthread_mutex_t lock; // z against the saver thread
+  int fd;
+  struct piscsi_zhdf* z;
+};
+
+static struct unit_zhdf units[NUM_ZHDF_UNITS];
+static pthread_once_t units_once = PTHREAD_ONCE_INIT;
+static unsigned int cache_mb = PISCSI_ZHDF_DEFAULT_CACHE;
+
+static pthread_mutex_t saver_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t saver_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t saver;
+static uint8_t saver_running, saver_quit;
+
+static struct piscsi_zhdf_stats stats;
+#define STAT_ADD(field, n) __atomic_fetch_add(&stats.field, (uint64_t)(n), __ATOMIC_RELAXED)
+
+static void init_units(void) {
+  for (int i = 0; i < NUM_ZHDF_UNITS; i++) {
+    pthread_mutex_init(&units[i].lock, NULL);
+    units[i].fd = -1;
+  }
+}
+
+static struct unit_zhdf* get_unit(uint8_t unit) {
+  pthread_once(&units_once, init_units);
+  return unit < NUM_ZHDF_UNITS ? &units[unit] : NULL;
+}
+
+static int valid_chunk(uint32_t chunk) {
+  return chunk >= MIN_CHUNK && chunk <= MAX_CHUNK && !(chunk & (chunk - 1));
+}
+
+static uint32_t sectors(uint32_t len) {
+  return (len + SECTOR - 1) / SECTOR;
+}
+
+static int all_zero(const uint8_t* p, size_t len) {
+  const uint64_t* w = (const uint64_t*)p;
+  for (size_t i = 0; i < len / 8; i++) {
+    if (w[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// zlib, when the emulator is built with it. Without it no image is opened,
+// so these are never reached.
+#ifdef PISTORM_ZLIB
+#define ZBUF_SIZE(chunk) compressBound(chunk)
+#else
+#define ZBUF_SIZE(chunk) (chunk)
+#endif
+
+static int deflate_chunk(struct piscsi_zhdf* z, const uint8_t* src, size_t* out_len) {
+#ifdef PISTORM_ZLIB
+  uLongf n = (uLongf)z->zbuf_len;
+  if (compress2(z->zbuf, &n, src, z->chunk, z->level) != Z_OK) {
+    return -1;
+  }
+  *out_len = n;
+  return 0;
+#else
+  (void)z;
+  (void)src;
+  (void)out_len;
+  return -1;
+#endif
+}
+
+static int inflate_chunk(struct piscsi_zhdf* z, uint8_t* dst, size_t len) {
+#ifdef PISTORM_ZLIB
+  uLongf n = z->chunk;
+  if (uncompress(dst, &n, z->zbuf, (uLong)len) != Z_OK || n != z->chunk) {
+    errno = EIO;
+    return -1;
+  }
+  return 0;
+#else
+  (void)z;
+  (void)dst;
+  (void)len;
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+static int push_slot(struct slot_list* l, uint64_t offset, uint32_t size) {
+  if (l->count == l->cap) {
+    uint32_t cap = l->cap ? l->cap * 2 : 16;
+    struct slot* s = realloc(l->s, cap * sizeof(*s));
+    if (!s) {
+      return -1;
+    }
+    l->s = s;
+    l->cap = cap;
+  }
+  l->s[l->count].offset = offset;
+  l->s[l->count++].size = size;
+  return 0;
+}
+
+// Free space in [offset, offset + len), in slots of at most one chunk.
+static void add_free(struct piscsi_zhdf* z, uint64_t offset, uint64_t len) {
+  while (len >= SECTOR) {
+    uint32_t n = len / SECTOR < z->classes - 1 ? (uint32_t)(len / SECTOR) : z->classes - 1;
+    // Lost until the next open if there is no memory for it.
+    push_slot(&z->free[n], offset, n * SECTOR);
+    offset += (uint64_t)n * SECTOR;
+    len -= (uint64_t)n * SECTOR;
+  }
+}
+
+// A slot of `n` sectors: the smallest free one that is large enough, split
+// if it is larger, or new space at the end of the file.
+static uint64_t alloc_slot(struct piscsi_zhdf* z, uint32_t n) {
+  for (uint32_t k = n; k < z->classes; k++) {
+    struct slot_list* l = &z->free[k];
+    if (l->count) {
+      uint64_t offset = l->s[--l->count].offset;
+      add_free(z, offset + (uint64_t)n * SECTOR, (uint64_t)(k - n) * SECTOR);
+      return offset;
+    }
+  }
+  uint64_t offset = z->end;
+  z->end += (uint64_t)n * SECTOR;
+  return offset;
+}
+
+static void mark_entry(struct piscsi_zhdf* z, uint64_t n) {
+  if (z->dirty_lo >= z->dirty_hi) {
+    z->dirty_lo = n;
+    z->dirty_hi = n + 1;
+  } else if (n < z->dirty_lo) {
+    z->dirty_lo = n;
+  } else if (n >= z->dirty_hi) {
+    z->dirty_hi = n + 1;
+  }
+}
+
+// Compress a changed chunk into a new slot and point the index at it. Its
+// old slot is reused once the index is saved.
+static int write_back(struct piscsi_zhdf* z, struct cached* c) {
+  struct piscsi_zhdf_entry* e = &z->index[c->n];
+  struct piscsi_zhdf_entry ne = {0, 0, 0};
+  if (!all_zero(c->data, z->chunk)) {
+    const uint8_t* out = z->zbuf;
+    size_t len;
+    if (deflate_chunk(z, c->data, &len) < 0 || sectors((uint32_t)len) >= z->chunk / SECTOR) {
+      out = c->data;
+      len = z->chunk;
+    }
+    ne.length = (uint32_t)len;
+    ne.slot = sectors(ne.length) * SECTOR;
+    ne.offset = alloc_slot(z, ne.slot / SECTOR);
+    if (piscsi_full_pwrite(z->fd, out, len, ne.offset) < 0) {
+      LOG_ERROR("[PISCSI] Could not write a compressed chunk: %s\n", strerror(errno));
+      STAT_ADD(errors, 1);
+      add_free(z, ne.offset, ne.slot);
+      return -1;
+    }
+    STAT_ADD(bytes_out, len);
+  }
+  if (e->length && push_slot(&z->pending, e->offset, e->slot) < 0) {
+    LOG_WARN("[PISCSI] Out of memory, a compressed image slot is not reused.\n");
+  }
+  *e = ne;
+  mark_entry(z, c->n);
+  c->dirty = 0;
+  z->ndirty--;
+  STAT_ADD(deflated, 1);
+  STAT_ADD(bytes_in, z->chunk);
+  return 0;
+}
+
+// Save the index entries changed since the last save, once the chunks they
+// point at are on disk, then let the slots they replaced be reused.
+static int save_index(struct piscsi_zhdf* z) {
+  if (z->dirty_lo >= z->dirty_hi) {
+    return 0;
+  }
+  size_t count = (size_t)(z->dirty_hi - z->dirty_lo);
+  struct piscsi_zhdf_entry* le = malloc(count * sizeof(*le));
+  if (!le) {
+    return -1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    const struct piscsi_zhdf_entry* e = &z->index[z->dirty_lo + i];
+    le[i].offset = htole64(e->offset);
+    le[i].length = htole32(e->length);
+    le[i].slot = htole32(e->slot);
+  }
+  int ret = 0;
+  if (fdatasync(z->fd) < 0 ||
+      piscsi_full_pwrite(z->fd, (const uint8_t*)le, count * sizeof(*le),
+                  z->index_offset + z->dirty_lo * sizeof(*le)) < 0 ||
+      fdatasync(z->fd) < 0) {
+    // Kept dirty and tried again with the next save; the old slots stay taken.
+    LOG_ERROR("[PISCSI] Could not save the index of a compressed image: %s\n", strerror(errno));
+    STAT_ADD(errors, 1);
+    ret = -1;
+  } else {
+    for (uint32_t i = 0; i < z->pending.count; i++) {
+      add_free(z, z->pending.s[i].offset, z->pending.s[i].size);
+    }
+    z->pending.count = 0;
+    z->dirty_lo = z->dirty_hi = 0;
+    STAT_ADD(index_saves, 1);
+  }
+  free(le);
+  return ret;
+}
+
+// Write back every changed chunk and save the index. Called with the lock held.
+static int flush(struct piscsi_zhdf* z) {
+  int ret = 0;
+  for (unsigned int i = 0; i < z->ncache && z->ndirty; i++) {
+    if (z->cache[i].dirty && write_back(z, &z->cache[i]) < 0) {
+      ret = -1;
+    }
+  }
+  return save_index(z) < 0 ? -1 : ret;
+}
+
+static void lru_unlink(struct cached* c) {
+  c->prev->next = c->next;
+  c->next->prev = c->prev;
+}
+
+static void lru_front(struct piscsi_zhdf* z, struct cached* c) {
+  c->next = z->lru.next;
+  c->prev = &z->lru;
+  z->lru.next->prev = c;
+  z->lru.next = c;
+}
+
+static struct cached* lookup(struct piscsi_zhdf* z, uint64_t n) {
+  struct cached* c = z->hash[n & z->hash_mask];
+  while (c && c->n != n) {
+    c = c->hnext;
+  }
+  return c;
+}
+
+static void hash_remove(struct piscsi_zhdf* z, struct cached* c) {
+  struct cached** p = &z->hash[c->n & z->hash_mask];
+  while (*p != c) {
+    p = &(*p)->hnext;
+  }
+  *p = c->hnext;
+  c->n = NO_CHUNK;
+}
+
+// Fill `dst` with chunk `n` from the file.
+static int load_chunk(struct piscsi_zhdf* z, uint64_t n, uint8_t* dst) {
+  const struct piscsi_zhdf_entry* e = &z->index[n];
+  if (!e->length) {
+    memset(dst, 0, z->chunk);
+    return 0;
+  }
+  if (e->length == z->chunk) {
+    return piscsi_full_pread(z->fd, dst, z->chunk, e->offset) == (ssize_t)z->chunk ? 0 : -1;
+  }
+  if (piscsi_full_pread(z->fd, z->zbuf, e->length, e->offset) != (ssize_t)e->length) {
+    return -1;
+  }
+  STAT_ADD(inflated, 1);
+  return inflate_chunk(z, dst, e->length);
+}
+
+// Chunk `n` in the cache, read in if `load` is set, making room by writing
+// back the least recently used chunk if needed. NULL if that fails.
+static struct cached* get_chunk(struct piscsi_zhdf* z, uint64_t n, int load) {
+  struct cached* c = lookup(z, n);
+  if (c) {
+    STAT_ADD(hits, 1);
+  } else {
+    c = z->lru.prev;
+    if (c->n != NO_CHUNK) {
+      if (c->dirty && write_back(z, c) < 0) {
+        return NULL;
+      }
+      hash_remove(z, c);
+    }
+    if (!c->data && !(c->data = malloc(z->chunk))) {
+      return NULL;
+    }
+    if (load && load_chunk(z, n, c->data) < 0) {
+      LOG_ERROR("[PISCSI] Could not read chunk %llu of a compressed image: %s\n",
+                (unsigned long long)n, strerror(errno));
+      STAT_ADD(errors, 1);
+      return NULL;
+    }
+    c->n = n;
+    c->hnext = z->hash[n & z->hash_mask];
+    z->hash[n & z->hash_mask] = c;
+  }
+  lru_unlink(c);
+  lru_front(z, c);
+  return c;
+}
+
+int piscsi_zhdf_read_header(int fd, struct piscsi_zhdf_header* h) {
+  if (piscsi_full_pread(fd, (uint8_t*)h, sizeof(*h), 0) != (ssize_t)sizeof(*h) ||
+      memcmp(h->magic, PISCSI_ZHDF_MAGIC, sizeof(h->magic)) != 0) {
+    return 0;
+  }
+  h->version = le32toh(h->version);
+  h->chunk_size = le32toh(h->chunk_size);
+  h->size = le64toh(h->size);
+  h->index_offset = le64toh(h->index_offset);
+  h->data_offset = le64toh(h->data_offset);
+  h->level = le32toh(h->level);
+  uint64_t chunks = h->chunk_size ? (h->size + h->chunk_size - 1) / h->chunk_size : 0;
+  if (h->version != PISCSI_ZHDF_VERSION || !valid_chunk(h->chunk_size) || !h->size ||
+      h->index_offset < sizeof(*h) ||
+      h->data_offset < h->index_offset + chunks * sizeof(struct piscsi_zhdf_entry) ||
+      h->data_offset % SECTOR || h->level > 9) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 1;
+}
+
+int piscsi_zhdf_create(const char* path, uint64_t size, uint32_t chunk_size, int level) {
+  struct piscsi_zhdf_header h;
+  if (!chunk_size) {
+    chunk_size = PISCSI_ZHDF_DEFAULT_CHUNK;
+  }
+  if (!level) {
+    level = PISCSI_ZHDF_DEFAULT_LEVEL;
+  }
+  if (!valid_chunk(chunk_size) || !size || level < 1 || level > 9) {
+    errno = EINVAL;
+    return -1;
+  }
+  uint64_t chunks = (size + chunk_size - 1) / chunk_size;
+  uint64_t data_offset = sizeof(h) + chunks * sizeof(struct piscsi_zhdf_entry);
+  data_offset = (data_offset + DATA_ALIGN - 1) / DATA_ALIGN * DATA_ALIGN;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, PISCSI_ZHDF_MAGIC, sizeof(h.magic));
+  h.version = htole32(PISCSI_ZHDF_VERSION);
+  h.chunk_size = htole32(chunk_size);
+  h.size = htole64(size);
+  h.index_offset = htole64(sizeof(h));
+  h.data_offset = htole64(data_offset);
+  h.level = htole32((uint32_t)level);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  // An index of zeroes says every chunk is zeroes.
+  if (piscsi_full_pwrite(fd, (const uint8_t*)&h, sizeof(h), 0) < 0 ||
+      ftruncate(fd, (off_t)data_offset) < 0 || fdatasync(fd) < 0) {
+    int err = errno;
+    close(fd);
+    unlink(path);
+    errno = err;
+    return -1;
+  }
+  return close(fd);
+}
+
+static int by_offset(const void* a, const void* b) {
+  const struct slot* x = a;
+  const struct slot* y = b;
+  return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+// Check the index, and make the space between its slots free.
+static int load_slots(struct piscsi_zhdf* z) {
+  struct slot_list used = {NULL, 0, 0};
+  int ret = 0;
+  for (uint64_t n = 0; n < z->chunks && !ret; n++) {
+    const struct piscsi_zhdf_entry* e = &z->index[n];
+    if (!e->length) {
+      continue;
+    }
+    if (e->length > z->chunk || e->slot > z->chunk || e->slot < e->length || e->slot % SECTOR ||
+        e->offset < z->data_offset || e->offset % SECTOR) {
+      ret = -1;
+    } else if (push_slot(&used, e->offset, e->slot) < 0) {
+      ret = -1;
+    }
+  }
+  if (!ret) {
+    qsort(used.s, used.count, sizeof(*used.s), by_offset);
+    uint64_t end = z->data_offset;
+    for (uint32_t i = 0; i < used.count; i++) {
+      if (used.s[i].offset < end) {
+        ret = -1;
+        break;
+      }
+      add_free(z, end, used.s[i].offset - end);
+      end = used.s[i].offset + used.s[i].size;
+    }
+    z->end = end;
+  }
+  free(used.s);
+  return ret;
+}
+
+static void free_zhdf(struct piscsi_zhdf* z) {
+  if (z->free) {
+    for (unsigned int i = 0; i < z->classes; i++) {
+      free(z->free[i].s);
+    }
+  }
+  if (z->cache) {
+    for (unsigned int i = 0; i < z->ncache; i++) {
+      free(z->cache[i].data);
+    }
+  }
+  free(z->free);
+  free(z->pending.s);
+  free(z->cache);
+  free(z->hash);
+  free(z->index);
+  free(z->zbuf);
+  pthread_mutex_destroy(&z->lock);
+  free(z);
+}
+
+struct piscsi_zhdf* piscsi_zhdf_open(int fd, int writable, unsigned int mb) {
+  struct piscsi_zhdf_header h;
+  if (piscsi_zhdf_read_header(fd, &h) <= 0) {
+    return NULL;
+  }
+#ifndef PISTORM_ZLIB
+  LOG_ERROR("[PISCSI] This build has no zlib (USE_ZLIB=0), compressed images cannot be used.\n");
+  return NULL;
+#endif
+  struct piscsi_zhdf* z = calloc(1, sizeof(*z));
+  if (!z) {
+    return NULL;
+  }
+  pthread_mutex_init(&z->lock, NULL);
+  z->fd = fd;
+  z->writable = writable;
+  z->size = h.size;
+  z->chunk = h.chunk_size;
+  z->shift = (unsigned int)__builtin_ctz(h.chunk_size);
+  z->level = h.level ? (int)h.level : PISCSI_ZHDF_DEFAULT_LEVEL;
+  z->chunks = (h.size + h.chunk_size - 1) / h.chunk_size;
+  z->index_offset = h.index_offset;
+  z->data_offset = h.data_offset;
+  z->classes = z->chunk / SECTOR + 1;
+
+  if (!mb) {
+    mb = piscsi_env_uint("PISTORM_PISCSI_ZHDF_CACHE", cache_mb);
+  }
+  z->ncache = (unsigned int)((uint64_t)mb * 1024 * 1024 / z->chunk);
+  if (z->ncache < MIN_CACHED_CHUNKS) {
+    z->ncache = MIN_CACHED_CHUNKS;
+  }
+  unsigned int buckets = 1;
+  while (buckets < z->ncache * 2) {
+    buckets <<= 1;
+  }
+  z->hash_mask = buckets - 1;
+  z->zbuf_len = ZBUF_SIZE(z->chunk);
+
+  size_t index_bytes = (size_t)z->chunks * sizeof(struct piscsi_zhdf_entry);
+  z->index = malloc(index_bytes);
+  z->free = calloc(z->classes, sizeof(*z->free));
+  z->cache = calloc(z->ncache, sizeof(*z->cache));
+  z->hash = calloc(buckets, sizeof(*z->hash));
+  z->zbuf = malloc(z->zbuf_len);
+  if (!z->index || !z->free || !z->cache || !z->hash || !z->zbuf) {
+    LOG_ERROR("[PISCSI] Out of memory for a compressed image.\n");
+    free_zhdf(z);
+    return NULL;
+  }
+  if (piscsi_full_pread(fd, (uint8_t*)z->index, index_bytes, z->index_offset) != (ssize_t)index_bytes) {
+    LOG_ERROR("[PISCSI] Could not read the index of a compressed image.\n");
+    free_zhdf(z);
+    return NULL;
+  }
+  for (uint64_t n = 0; n < z->chunks; n++) {
+    z->index[n].offset = le64toh(z->index[n].offset);
+    z->index[n].length = le32toh(z->index[n].length);
+    z->index[n].slot = le32toh(z->index[n].slot);
+  }
+  if (load_slots(z) < 0) {
+    LOG_ERROR("[PISCSI] The index of a compressed image is damaged.\n");
+    free_zhdf(z);
+    return NULL;
+  }
+
+  z->lru.next = z->lru.prev = &z->lru;
+  for (unsigned int i = 0; i < z->ncache; i++) {
+    z->cache[i].n = NO_CHUNK;
+    lru_front(z, &z->cache[i]);
+  }
+  return z;
+}
+
+int piscsi_zhdf_sync(struct piscsi_zhdf* z) {
+  pthread_mutex_lock(&z->lock);
+  int ret = z->ndirty || z->dirty_lo < z->dirty_hi ? flush(z) : fdatasync(z->fd);
+  pthread_mutex_unlock(&z->lock);
+  return ret;
+}
+
+void piscsi_zhdf_close(struct piscsi_zhdf* z) {
+  if (z) {
+    if (z->writable) {
+      pthread_mutex_lock(&z->lock);
+      flush(z);
+      pthread_mutex_unlock(&z->lock);
+    }
+    free_zhdf(z);
+  }
+}
+
+uint64_t piscsi_zhdf_size(const struct piscsi_zhdf* z) {
+  return z->size;
+}
+
+ssize_t piscsi_zhdf_pread(struct piscsi_zhdf* z, uint8_t* buf, size_t len, uint64_t offset) {
+  if (offset >= z->size) {
+    return 0;
+  }
+  uint64_t end = z->size - offset < len ? z->size : offset + len;
+  uint64_t pos = offset;
+  pthread_mutex_lock(&z->lock);
+  while (pos < end) {
+    uint64_t n = pos >> z->shift;
+    uint64_t cstart = n << z->shift;
+    size_t in = (size_t)(pos - cstart);
+    size_t cnt = (size_t)((end < cstart + z->chunk ? end : cstart + z->chunk) - pos);
+    uint8_t* dst = buf + (pos - offset);
+    const struct piscsi_zhdf_entry* e = &z->index[n];
+    // Zeroes and chunks stored as they are cost nothing to decompress, so
+    // they only take cache space once written.
+    if (!lookup(z, n) && e->length == 0) {
+      memset(dst, 0, cnt);
+    } else if (!lookup(z, n) && e->length == z->chunk) {
+      if (piscsi_full_pread(z->fd, dst, cnt, e->offset + in) != (ssize_t)cnt) {
+        STAT_ADD(errors, 1);
+        break;
+      }
+    } else {
+      struct cached* c = get_chunk(z, n, 1);
+      if (!c) {
+        break;
+      }
+      memcpy(dst, c->data + in, cnt);
+    }
+    pos += cnt;
+  }
+  pthread_mutex_unlock(&z->lock);
+  return pos == end ? (ssize_t)(end - offset) : -1;
+}
+
+ssize_t piscsi_zhdf_pwrite(struct piscsi_zhdf* z, const uint8_t* buf, size_t len,
+                           uint64_t offset) {
+  if (!z->writable) {
+    errno = EROFS;
+    return -1;
+  }
+  // A compressed image does not grow.
+  if (offset >= z->size) {
+    errno = ENOSPC;
+    return -1;
+  }
+  uint64_t end = z->size - offset < len ? z->size : offset + len;
+  uint64_t pos = offset;
+  pthread_mutex_lock(&z->lock);
+  while (pos < end) {
+    uint64_t n = pos >> z->shift;
+    uint64_t cstart = n << z->shift;
+    uint64_t cend = z->size - cstart < z->chunk ? z->size : cstart + z->chunk;
+    size_t in = (size_t)(pos - cstart);
+    size_t cnt = (size_t)((end < cend ? end : cend) - pos);
+    // A write of the whole chunk does not need the old one.
+    int whole = pos == cstart && pos + cnt == cend;
+    struct cached* c = get_chunk(z, n, !whole);
+    if (!c) {
+      break;
+    }
+    if (whole) {
+      memset(c->data + cnt, 0, z->chunk - cnt);
+    }
+    memcpy(c->data + in, buf + (pos - offset), cnt);
+    if (!c->dirty) {
+      c->dirty = 1;
+      z->ndirty++;
+    }
+    pos += cnt;
+  }
+  pthread_mutex_unlock(&z->lock);
+  return pos > offset ? (ssize_t)(pos - offset) : -1;
+}
+
+static void* saver_task(void* arg) {
+  (void)arg;
+  pthread_mutex_lock(&saver_lock);
+  while (!saver_quit) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += PISCSI_ZHDF_SYNC_SECONDS;
+    pthread_cond_timedwait(&saver_wake, &saver_lock, &ts);
+    if (saver_quit) {
+      break;
+    }
+    pthread_mutex_unlock(&saver_lock);
+    for (int i = 0; i < NUM_ZHDF_UNITS; i++) {
+      pthread_mutex_lock(&units[i].lock);
+      struct piscsi_zhdf* z = units[i].z;
+      if (z) {
+        pthread_mutex_lock(&z->lock);
+        if (z->ndirty || z->dirty_lo < z->dirty_hi) {
+          flush(z);
+        }
+        pthread_mutex_unlock(&z->lock);
+      }
+      pthread_mutex_unlock(&units[i].lock);
+    }
+    pthread_mutex_lock(&saver_lock);
+  }
+  pthread_mutex_unlock(&saver_lock);
+  return NULL;
+}
+
+static void start_saver(void) {
+  pthread_mutex_lock(&saver_lock);
+  if (!saver_running) {
+    saver_quit = 0;
+    if (pthread_create(&saver, NULL, saver_task, NULL) != 0) {
+      LOG_ERROR("[PISCSI] Could not start the compressed image thread, chunks are only written "
+                "back on cache flushes and unmap.\n");
+    } else {
+      pthread_setname_np(saver, "pistorm64: zhdf");
+      saver_running = 1;
+    }
+  }
+  pthread_mutex_unlock(&saver_lock);
+}
+
+void piscsi_zhdf_set_cache(unsigned int mb) {
+  cache_mb = mb;
+}
+
+int piscsi_zhdf_attach(uint8_t unit, int fd, uint64_t* size) {
+  struct unit_zhdf* u = get_unit(unit);
+  if (!u) {
+    return 0;
+  }
+  piscsi_zhdf_detach(unit);
+  struct piscsi_zhdf_header h;
+  int r = piscsi_zhdf_read_header(fd, &h);
+  if (r <= 0) {
+    if (r < 0) {
+      LOG_ERROR("[PISCSI] Unit %u is a damaged or unsupported compressed image.\n", unit);
+    }
+    return r;
+  }
+  int writable = (fcntl(fd, F_GETFL) & O_ACCMODE) != O_RDONLY;
+  struct piscsi_zhdf* z = piscsi_zhdf_open(fd, writable, 0);
+  if (!z) {
+    return -1;
+  }
+  pthread_mutex_lock(&u->lock);
+  u->z = z;
+  u->fd = fd;
+  pthread_mutex_unlock(&u->lock);
+
+  if (writable) {
+    start_saver();
+  }
+  *size = z->size;
+  LOG_INFO("[PISCSI] Unit %u: compressed image, %lluMB in %uKB chunks, %uKB cached.\n", unit,
+           (unsigned long long)(z->size >> 20), z->chunk / 1024, z->ncache * (z->chunk / 1024));
+  return 1;
+}
+
+void piscsi_zhdf_detach(uint8_t unit) {
+  struct unit_zhdf* u = get_unit(unit);
+  if (!u) {
+    return;
+  }
+  pthread_mutex_lock(&u->lock);
+  if (u->z) {
+    piscsi_zhdf_close(u->z);
+    u->z = NULL;
+    u->fd = -1;
+  }
+  pthread_mutex_unlock(&u->lock);
+}
+
+int piscsi_zhdf_active(uint8_t unit) {
+  struct unit_zhdf* u = get_unit(unit);
+  return u && u->z;
+}
+
+ssize_t piscsi_zhdf_read(uint8_t unit, int fd, uint8_t* buf, uint32_t len, uint64_t offset) {
+  struct unit_zhdf* u = get_unit(unit);
+  if (!u || !u->z || u->fd != fd) {
+    return piscsi_full_pread(fd, buf, len, offset);
+  }
+  return piscsi_zhdf_pread(u->z, buf, len, offset);
+}
+
+ssize_t piscsi_zhdf_write(uint8_t unit, int fd, const uint8_t* buf, uint32_t len,
+                          uint64_t offset) {
+  struct unit_zhdf* u = get_unit(unit);
+  if (!u || !u->z || u->fd != fd) {
+    return piscsi_full_pwrite(fd, buf, len, offset);
+  }
+  return piscsi_zhdf_pwrite(u->z, buf, len, offset);
+}
+
+int piscsi_zhdf_unit_sync(uint8_t unit, int fd) {
+  struct unit_zhdf* u = get_unit(unit);
+  if (!u || !u->z || u->fd != fd) {
+    return fdatasync(fd);
+  }
+  return piscsi_zhdf_sync(u->z);
+}
+
+void piscsi_zhdf_stop(void) {
+  pthread_mutex_lock(&saver_lock);
+  uint8_t running = saver_running;
+  saver_quit = 1;
+  pthread_cond_signal(&saver_wake);
+  pthread_mutex_unlock(&saver_lock);
+  if (running) {
+    pthread_join(saver, NULL);
+    saver_running = 0;
+  }
+  for (uint8_t i = 0; i < NUM_ZHDF_UNITS; i++) {
+    piscsi_zhdf_detach(i);
+  }
+  if (stats.inflated || stats.deflated) {
+    LOG_INFO("[PISCSI] Compressed images: %llu chunks decompressed, %llu cache hits, %llu "
+             "written (%lluKB to %lluKB), %llu errors.\n",
+             (unsigned long long)stats.inflated, (unsigned long long)stats.hits,
+             (unsigned long long)stats.deflated, (unsigned long long)(stats.bytes_in >> 10),
+             (unsigned long long)(stats.bytes_out >> 10), (unsigned long long)stats.errors);
+  }
+}
+
+void piscsi_zhdf_get_stats(struct piscsi_zhdf_stats* out) {
+  out->hits = __atomic_load_n(&stats.hits, __ATOMIC_RELAXED);
+  out->inflated = __atomic_load_n(&stats.inflated, __ATOMIC_RELAXED);
+  out->deflated = __atomic_load_n(&stats.deflated, __ATOMIC_RELAXED);
+  out->bytes_in = __atomic_load_n(&stats.bytes_in, __ATOMIC_RELAXED);
+  out->bytes_out = __atomic_load_n(&stats.bytes_out, __ATOMIC_RELAXED);
+  out->index_saves = __atomic_load_n(&stats.index_saves, __ATOMIC_RELAXED);
+  out->errors = __atomic_load_n(&stats.errors, __ATOMIC_RELAXED);
+}
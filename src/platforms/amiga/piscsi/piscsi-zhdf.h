@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_PISCSI_ZHDF_H
+#define PISTORM_PISCSI_ZHDF_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Compressed hard files for PiSCSI. A .zhdf file holds an image in chunks
+ * (64KB by default), each compressed with zlib on its own, stored as is
+ * when it does not compress, or not stored at all when it is all zeroes.
+ * An index gives the place of every chunk, so any block can be read by
+ * decompressing one chunk. Map it like any image:
+ *
+ *   setvar piscsi0 Games.zhdf
+ *
+ * File layout (little endian):
+ *
+ *   0             struct piscsi_zhdf_header, 4KB
+ *   index_offset  struct piscsi_zhdf_entry per chunk
+ *   data_offset   compressed chunks, each in a slot of whole 512-byte
+ *                 sectors, in any order
+ *
+ * Decompressed chunks are kept in a cache of piscsi-zhdf-cache MB per
+ * unit, so repeated reads do not decompress again. Writes change the cached
+ * chunk. A changed chunk is compressed again and written to a free slot,
+ * never over its old one, when it leaves the cache, on CMD_UPDATE, on a
+ * reset and every PISCSI_ZHDF_SYNC_SECONDS; the index is then saved after
+ * an fdatasync() of the chunks, and only after that are the old slots
+ * reused. A power loss therefore loses the writes since then, like the
+ * block cache's "back" policy, but leaves the image as it was at the last
+ * save.
+ *
+ *   setvar piscsi-zhdf-cache [MB]  decompressed chunks per unit (default 8)
+ *   PISTORM_PISCSI_ZHDF_CACHE=MB   the same, overrides the config file
+ *
+ * tools/piscsi_zhdf.c converts between raw hard files and .zhdf. Without
+ * zlib (make USE_ZLIB=0) .zhdf images are recognised but not mapped.
+ */
+
+#define PISCSI_ZHDF_MAGIC "PiSCZHD\n"
+#define PISCSI_ZHDF_VERSION 1
+#define PISCSI_ZHDF_HEADER_SIZE 4096
+#define PISCSI_ZHDF_DEFAULT_CHUNK (64 * 1024)
+#define PISCSI_ZHDF_DEFAULT_LEVEL 6
+#define PISCSI_ZHDF_DEFAULT_CACHE 8
+#define PISCSI_ZHDF_SYNC_SECONDS 5
+
+struct piscsi_zhdf_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t chunk_size; // power of two, 4KB to 1MB
+  uint64_t size;       // of the image
+  uint64_t index_offset;
+  uint64_t data_offset;
+  uint32_t level; // zlib level for chunks written later
+  uint8_t reserved[PISCSI_ZHDF_HEADER_SIZE - 44];
+};
+
+struct piscsi_zhdf_entry {
+  uint64_t offset;
+  uint32_t length; // 0: all zeroes, chunk_size: stored as is, else compressed
+  uint32_t slot;   // bytes reserved at offset
+};
+
+struct piscsi_zhdf_stats {
+  uint64_t hits;        // chunks found decompressed in the cache
+  uint64_t inflated;    // chunks decompressed
+  uint64_t deflated;    // chunks compressed and written
+  uint64_t bytes_in;    // of those, image bytes
+  uint64_t bytes_out;   // and bytes written to the file
+  uint64_t index_saves;
+  uint64_t errors;
+};
+
+struct piscsi_zhdf;
+
+// Read and check the header of an open file. Returns 1 for a .zhdf image,
+// 0 for anything else, -1 for a damaged one.
+int piscsi_zhdf_read_header(int fd, struct piscsi_zhdf_header* h);
+// Make an empty (all zero) .zhdf image of `size` bytes at `path`. `chunk_size`
+// and `level` 0 pick the defaults. Returns 0 or -1 with errno set.
+int piscsi_zhdf_create(const char* path, uint64_t size, uint32_t chunk_size, int level);
+
+// Open the .zhdf image `fd` with a cache of `cache_mb` MB, or of the
+// piscsi-zhdf-cache setting for 0. Returns NULL if it cannot be used; `fd`
+// stays open either way and is the caller's to close.
+struct piscsi_zhdf* piscsi_zhdf_open(int fd, int writable, unsigned int cache_mb);
+// Write back changed chunks and save the index, then fdatasync().
+int piscsi_zhdf_sync(struct piscsi_zhdf* z);
+// Sync and free `z`.
+void piscsi_zhdf_close(struct piscsi_zhdf* z);
+uint64_t piscsi_zhdf_size(const struct piscsi_zhdf* z);
+// The whole range, short only at the end of the image, or -1.
+ssize_t piscsi_zhdf_pread(struct piscsi_zhdf* z, uint8_t* buf, size_t len, uint64_t offset);
+ssize_t piscsi_zhdf_pwrite(struct piscsi_zhdf* z, const uint8_t* buf, size_t len,
+                           uint64_t offset);
+
+void piscsi_zhdf_set_cache(unsigned int mb);
+
+// Open `fd` as `unit` if it is a .zhdf image. Returns 1 if it is, with
+// `*size` set to the image size, 0 if it is not and -1 if it cannot be used.
+int piscsi_zhdf_attach(uint8_t unit, int fd, uint64_t* size);
+// Sync and close the unit's image. The caller closes `fd`.
+void piscsi_zhdf_detach(uint8_t unit);
+int piscsi_zhdf_active(uint8_t unit);
+
+// pread()/pwrite() of the whole range through the unit's .zhdf image, or of
+// the file itself when the unit has none. Return the bytes transferred
+// (short at the end of the image) or -1.
+ssize_t piscsi_zhdf_read(uint8_t unit, int fd, uint8_t* buf, uint32_t len, uint64_t offset);
+ssize_t piscsi_zhdf_write(uint8_t unit, int fd, const uint8_t* buf, uint32_t len,
+                          uint64_t offset);
+// piscsi_zhdf_sync() for a .zhdf unit, fdatasync() otherwise.
+int piscsi_zhdf_unit_sync(uint8_t unit, int fd);
+// Detach every unit and stop the thread that writes changed chunks back.
+void piscsi_zhdf_stop(void);
+
+// Totals over all images since startup.
+void piscsi_zhdf_get_stats(struct piscsi_zhdf_stats* stats);
+
+#endif /* PISTORM_PISCSI_ZHDF_H */
@@ -8,13 +8,25 @@
 #include <unistd.h>
 #include <endian.h>
 #include <errno.h>
+#include <time.h>
 
 #include "config_file/config_file.h"
 #include "gpio/ps_protocol.h"
 #include "log.h"
+#include "metrics/metrics.h"
+#include "pistorm_trace.h"
+#include "piscsi-async.h"
+#include "piscsi-cache.h"
 #include "piscsi-enums.h"
+#include "piscsi-media.h"
+#include "piscsi-meta.h"
+#include "piscsi-mmap.h"
+#include "piscsi-overlay.h"
+#include "piscsi-trace.h"
+#include "piscsi-zhdf.h"
 #include "piscsi.h"
 #include "platforms/amiga/hunk-reloc.h"
+#include "platforms/amiga/rtg/rtg.h"
 
 #define BE(val) be32toh(val)
 #define BE16(val) be16toh(val)
@@ -24,7 +36,7 @@
 
 #ifdef PISCSI_DEBUG
 #define DEBUG LOG_DEBUG
-#define DEBUG_TRIVIAL LOG_DEBUG
+#define DEBUG_TRIVIAL LOG_FAST_DEBUG
 
 //extern void stop_cpu_emulation(uint8_t disasm_cur);
 #define stop_cpu_emulation(...)
@@ -46,6 +58,7 @@ static const char *op_type_names[4] = {
 #endif
 
 extern struct emulator_config *cfg;
+extern int move_slow_to_chip;
 
 struct piscsi_dev devs[8];
 struct piscsi_fs filesystems[NUM_FILESYSTEMS];
@@ -54,6 +67,10 @@ uint8_t piscsi_num_fs = 0;
 
 uint8_t piscsi_cur_drive = 0;
 uint32_t piscsi_u32[4];
+// Asynchronous requests: the tag for the next one, whether the last one was
+// queued, and the io_Error of the last synchronous or popped request.
+static uint32_t piscsi_tag;
+static uint8_t piscsi_queued, piscsi_error, piscsi_update_error;
 uint32_t piscsi_dbg[8];
 uint32_t piscsi_rom_size = 0;
 uint8_t *piscsi_rom_ptr;
@@ -72,12 +89,101 @@ unsigned int num_partition_names = 0;
 struct hunk_info piscsi_hinfo;
 struct hunk_reloc piscsi_hreloc[256];
 
+static uint64_t piscsi_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Transfers to and from Amiga memory the Pi has no mapping for go through a
+// bounce buffer, one chunk of the image at a time.
+#define PISCSI_BOUNCE_SIZE (64 * 1024)
+static uint8_t piscsi_bounce[PISCSI_BOUNCE_SIZE];
+
+// Chip RAM and slow RAM that no Pi mapping covers are plain memory on the
+// Amiga side, so a whole chunk can go over the bus in batched longwords. The
+// trapdoor remap of move_slow_to_chip is left to the CPU memory handlers.
+static int piscsi_bus_ram(uint32_t addr, uint32_t len) {
+    uint32_t end = addr + len;
+    int chip = end <= 0x200000;
+    int slow = addr >= 0xC00000 && end <= 0xD80000;
+    if ((!chip && !slow) || end < addr) {
+        return 0;
+    }
+    if (move_slow_to_chip && ((addr < 0x100000 && end > 0x080000) || (slow && addr < 0xC80000))) {
+        return 0;
+    }
+    for (uint32_t a = addr; a < end; a += 0x10000) {
+        if (get_mapped_item_by_address(cfg, a) != -1) {
+            return 0;
+        }
+    }
+    return get_mapped_item_by_address(cfg, end - 1) == -1;
+}
+
+// Copy `len` bytes from `src` to Amiga memory at `addr`, with the widest
+// accesses the alignment allows.
+static void piscsi_amiga_write(uint32_t addr, const uint8_t *src, uint32_t len) {
+    if (len && (addr & 1)) {
+        m68k_write_memory_8(addr++, *src++);
+        len--;
+    }
+    if (piscsi_bus_ram(addr, len)) {
+        ps_write_block(addr, src, len & ~1u);
+    } else {
+        for (uint32_t i = 0; i + 4 <= len; i += 4) {
+            m68k_write_memory_32(addr + i, (uint32_t)src[i] << 24 | (uint32_t)src[i + 1] << 16 |
+                                 (uint32_t)src[i + 2] << 8 | src[i + 3]);
+        }
+        if (len & 2) {
+            uint32_t i = len & ~3u;
+            m68k_write_memory_16(addr + i, (uint32_t)src[i] << 8 | src[i + 1]);
+        }
+    }
+    if (len & 1) {
+        m68k_write_memory_8(addr + len - 1, src[len - 1]);
+    }
+}
+
+// Copy `len` bytes of Amiga memory at `addr` to `dst`.
+static void piscsi_amiga_read(uint32_t addr, uint8_t *dst, uint32_t len) {
+    if (len && (addr & 1)) {
+        *dst++ = (uint8_t)m68k_read_memory_8(addr++);
+        len--;
+    }
+    if (piscsi_bus_ram(addr, len)) {
+        ps_read_block(addr, dst, len & ~1u);
+    } else {
+        for (uint32_t i = 0; i + 4 <= len; i += 4) {
+            uint32_t v = m68k_read_memory_32(addr + i);
+            dst[i] = (uint8_t)(v >> 24);
+            dst[i + 1] = (uint8_t)(v >> 16);
+            dst[i + 2] = (uint8_t)(v >> 8);
+            dst[i + 3] = (uint8_t)v;
+        }
+        if (len & 2) {
+            uint32_t i = len & ~3u;
+            uint32_t v = m68k_read_memory_16(addr + i);
+            dst[i] = (uint8_t)(v >> 8);
+            dst[i + 1] = (uint8_t)v;
+        }
+    }
+    if (len & 1) {
+        dst[len - 1] = (uint8_t)m68k_read_memory_8(addr + len - 1);
+    }
+}
+
 void piscsi_init(void) {
     for (int i = 0; i < 8; i++) {
         devs[i].fd = -1;
         devs[i].lba = 0;
         devs[i].c = devs[i].h = devs[i].s = 0;
+        devs[i].removable = devs[i].read_only = 0;
     }
+    // Off until `setvar piscsi-async` or PISTORM_PISCSI_ASYNC asks for it, since
+    // the boot ROM's driver predates the protocol (see piscsi-async.h). Started
+    // before the boot ROM, so a driver loaded from DEVS: gets it as well.
+    piscsi_async_start(0);
 
     if (piscsi_rom_ptr == NULL) {
         FILE *in = fopen("./src/platforms/amiga/piscsi/piscsi.rom", "rb");
@@ -110,13 +216,22 @@ void piscsi_init(void) {
 
 void piscsi_shutdown(void) {
     printf("[PISCSI] Shutting down PiSCSI.\n");
+    piscsi_async_stop();
+    piscsi_cache_stop();
+    piscsi_overlay_stop();
+    piscsi_zhdf_stop();
+    piscsi_media_stop();
+    piscsi_trace_stop();
     for (int i = 0; i < 8; i++) {
         if (devs[i].fd != -1) {
+            piscsi_mmap_detach((uint8_t)i);
+            piscsi_meta_close((uint8_t)i, devs[i].fd);
             close(devs[i].fd);
             devs[i].fd = -1;
             devs[i].block_size = 0;
         }
     }
+    piscsi_meta_stop();
 
     for (int i = 0; i < NUM_FILESYSTEMS; i++) {
         if (filesystems[i].binary_data) {
@@ -134,8 +249,24 @@ void piscsi_shutdown(void) {
     }
 }
 
+// Reads of the image on the Pi side go through the same cache, mapping and
+// overlay as the Amiga's, so they see what it has written.
+static ssize_t piscsi_dev_read(struct piscsi_dev *d, void *buf, uint32_t len, uint64_t offset) {
+    return piscsi_cache_read((uint8_t)(d - devs), d->fd, buf, len, offset);
+}
+
+// Reads of the RDB, partitions and file systems, kept by piscsi-meta.c for
+// the next reset and the next start.
+static ssize_t piscsi_scan_read(struct piscsi_dev *d, void *buf, uint32_t len, uint64_t offset) {
+    return piscsi_meta_read((uint8_t)(d - devs), d->fd, buf, len, offset);
+}
+
+static ssize_t piscsi_lseg_read(void *ctx, uint8_t *buf, uint32_t len, uint64_t offset) {
+    return piscsi_scan_read(ctx, buf, len, offset);
+}
+
 static void piscsi_find_partitions(struct piscsi_dev *d) {
-    int fd = d->fd;
+    uint64_t pos;
     int cur_partition = 0;
     uint8_t tmp;
 
@@ -153,9 +284,10 @@ static void piscsi_find_partitions(struct piscsi_dev *d) {
 
     char *block = malloc(d->block_size);
 
-    lseek(fd, BE(d->rdb->rdb_PartitionList) * d->block_size, SEEK_SET);
+    pos = (uint64_t)BE(d->rdb->rdb_PartitionList) * d->block_size;
 next_partition:;
-    read(fd, block, d->block_size);
+    piscsi_scan_read(d, block, d->block_size, pos);
+    pos += d->block_size;
 
     uint32_t first_temp;
     memcpy(&first_temp, &block[0], sizeof(first_temp));
@@ -200,26 +332,25 @@ partition_renamed:
     if (d->pb[cur_partition]->pb_Next != 0xFFFFFFFF) {
         uint64_t next = be32toh(pb->pb_Next);
         block = malloc(d->block_size);
-        lseek64(fd, (off64_t)(next * d->block_size), SEEK_SET);
+        pos = next * d->block_size;
         cur_partition++;
         DEBUG("[PISCSI] Next partition at block %d.\n", be32toh(pb->pb_Next));
         goto next_partition;
     }
     DEBUG("[PISCSI] No more partitions on disk.\n");
     d->num_partitions = (uint8_t)(cur_partition + 1);
-    d->fshd_offs = (uint32_t)lseek64(fd, 0, SEEK_CUR);
+    d->fshd_offs = (uint32_t)pos;
 
     return;
 }
 
 static int piscsi_parse_rdb(struct piscsi_dev *d) {
-    int fd = d->fd;
     int i = 0;
-    uint8_t *block = malloc(PISCSI_MAX_BLOCK_SIZE);
+    // Only the RigidDiskBlock at the start of each place is looked at.
+    uint8_t *block = malloc(RDB_PROBE_SIZE);
 
-    lseek(fd, 0, SEEK_SET);
     for (i = 0; i < RDB_BLOCK_LIMIT; i++) {
-        read(fd, block, PISCSI_MAX_BLOCK_SIZE);
+        piscsi_scan_read(d, block, RDB_PROBE_SIZE, (uint64_t)i * PISCSI_MAX_BLOCK_SIZE);
         uint32_t first_temp;
         memcpy(&first_temp, &block[0], sizeof(first_temp));
         uint32_t first = be32toh(first_temp);
@@ -260,7 +391,20 @@ no_rdb_found:;
 }
 
 void piscsi_refresh_drives(void) {
+    piscsi_trace_reset();
+    piscsi_async_reset();
+    // A reset is a good point to get written data to the images.
+    piscsi_cache_flush(0xFF);
+    for (uint8_t i = 0; i < NUM_UNITS; i++) {
+        if (devs[i].fd != -1 && piscsi_zhdf_active(i)) {
+            piscsi_zhdf_unit_sync(i, devs[i].fd);
+        }
+    }
+    piscsi_queued = piscsi_error = piscsi_update_error = 0;
     piscsi_num_fs = 0;
+    // Until the new driver asks for disk changes.
+    piscsi_media_listen(0);
+    piscsi_media_start();
 
     for (int i = 0; i < NUM_FILESYSTEMS; i++) {
         if (filesystems[i].binary_data) {
@@ -286,12 +430,14 @@ void piscsi_refresh_drives(void) {
     num_partition_names = 0;
 
     for (int i = 0; i < NUM_UNITS; i++) {
-        if (devs[i].fd != -1) {
+        // Removable units keep the partition made for them.
+        if (devs[i].fd != -1 && !devs[i].removable) {
             piscsi_parse_rdb(&devs[i]);
             piscsi_find_partitions(&devs[i]);
             piscsi_find_filesystems(&devs[i]);
         }
     }
+    piscsi_meta_save();
 }
 
 void piscsi_find_filesystems(struct piscsi_dev *d) {
@@ -301,8 +447,7 @@ void piscsi_find_filesystems(struct piscsi_dev *d) {
     uint8_t fs_found = 0;
 
     uint8_t *fhb_block = malloc(d->block_size);
-
-    lseek64(d->fd, d->fshd_offs, SEEK_SET);
+    uint64_t pos = d->fshd_offs;
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-align"
@@ -314,7 +459,8 @@ void piscsi_find_filesystems(struct piscsi_dev *d) {
      */
     struct FileSysHeaderBlock *fhb = (struct FileSysHeaderBlock *)((char *)fhb_block);
 #pragma GCC diagnostic pop
-    read(d->fd, fhb_block, d->block_size);
+    piscsi_scan_read(d, fhb_block, d->block_size, pos);
+    pos += d->block_size;
 
     while (BE(fhb->fhb_ID) == FS_IDENTIFIER) {
         char *dosID = (char *)&fhb->fhb_DosType;
@@ -343,7 +489,7 @@ void piscsi_find_filesystems(struct piscsi_dev *d) {
             }
         }
 
-        if (load_lseg(d->fd, &filesystems[piscsi_num_fs].binary_data, &filesystems[piscsi_num_fs].h_info, filesystems[piscsi_num_fs].relocs, d->block_size) != -1) {
+        if (load_lseg(piscsi_lseg_read, d, pos, &filesystems[piscsi_num_fs].binary_data, &filesystems[piscsi_num_fs].h_info, filesystems[piscsi_num_fs].relocs, d->block_size) != -1) {
             filesystems[piscsi_num_fs].FS_ID = fhb->fhb_DosType;
             filesystems[piscsi_num_fs].fhb = fhb;
             printf("[FSHD] Loaded and set up file system %d: %c%c%c/%d\n", piscsi_num_fs + 1, dosID[0], dosID[1], dosID[2], dosID[3]);
@@ -370,7 +516,7 @@ void piscsi_find_filesystems(struct piscsi_dev *d) {
 
 skip_fs_load_lseg:;
         fs_found++;
-        lseek64(d->fd, BE(fhb->fhb_Next) * d->block_size, SEEK_SET);
+        pos = (uint64_t)BE(fhb->fhb_Next) * d->block_size;
         fhb_block = malloc(d->block_size);
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-align"
@@ -382,7 +528,8 @@ skip_fs_load_lseg:;
          */
         fhb = (struct FileSysHeaderBlock *)((char *)fhb_block);
 #pragma GCC diagnostic pop
-        read(d->fd, fhb_block, d->block_size);
+        piscsi_scan_read(d, fhb_block, d->block_size, pos);
+        pos += d->block_size;
     }
 
     if (!fs_found) {
@@ -398,6 +545,37 @@ struct piscsi_dev *piscsi_get_dev(uint8_t index) {
     return &devs[index];
 }
 
+// An overlay stands for its backing images, a compressed image for what it
+// holds; *size becomes the size of that image. Returns 1 for either, 0 for a
+// plain image and -1 if the image cannot be used.
+static int piscsi_attach_layers(uint8_t index, int fd, const char *filename, uint64_t *size) {
+    int overlay = piscsi_overlay_attach(index, fd, filename, size);
+    int zhdf = overlay ? 0 : piscsi_zhdf_attach(index, fd, size);
+    if (overlay < 0 || zhdf < 0) {
+        return -1;
+    }
+    return overlay || zhdf;
+}
+
+// A mapped image is cached by the kernel already. Overlays and compressed
+// images are not mapped.
+static void piscsi_attach_cache(uint8_t index, int fd, uint64_t size, int layered) {
+    if (layered || !piscsi_mmap_attach(index, fd, size)) {
+        piscsi_cache_attach(index, fd, size);
+    }
+}
+
+static void piscsi_close_image(uint8_t index) {
+    piscsi_async_drain(index);
+    piscsi_cache_detach(index);
+    piscsi_mmap_detach(index);
+    piscsi_overlay_detach(index);
+    piscsi_zhdf_detach(index);
+    piscsi_meta_close(index, devs[index].fd);
+    close(devs[index].fd);
+    devs[index].fd = -1;
+}
+
 void piscsi_map_drive(const char *filename, uint8_t index) {
     if (index > 7) {
         printf("[PISCSI] Drive index %d out of range.\nUnable to map file %s to drive.\n", index, filename);
@@ -410,9 +588,23 @@ void piscsi_map_drive(const char *filename, uint8_t index) {
         return;
     }
 
+    struct piscsi_dev *d = &devs[index];
+
+    uint64_t file_size = (uint64_t)lseek(tmp_fd, 0, SEEK_END);
+    int layered = piscsi_attach_layers(index, tmp_fd, filename, &file_size);
+    if (layered < 0) {
+        printf("[PISCSI] Failed to open the image %s, could not map drive %d.\n", filename, index);
+        close(tmp_fd);
+        return;
+    }
+    d->removable = d->read_only = 0;
+    d->fs = file_size;
+    d->fd = tmp_fd;
+    int known = piscsi_meta_open(index, tmp_fd);
+
     char hdfID[512];
     memset(hdfID, 0x00, 512);
-    read(tmp_fd, hdfID, 512);
+    piscsi_scan_read(d, hdfID, 512, 0);
     hdfID[4] = '\0';
     if (strcmp(hdfID, "DOS") == 0 || strcmp(hdfID, "PFS") == 0 || strcmp(hdfID, "PDS") == 0 || strcmp(hdfID, "SFS") == 0) {
         printf("[!!!PISCSI] The disk image %s is a UAE Single Partition Hardfile!\n", filename);
@@ -421,12 +613,6 @@ void piscsi_map_drive(const char *filename, uint8_t index) {
         printf("[!!!PISCSI] If this is merely an empty or placeholder file you've created to partition and format on the Amiga, please disregard this warning message.\n");
     }
 
-    struct piscsi_dev *d = &devs[index];
-
-    uint64_t file_size = (uint64_t)lseek(tmp_fd, 0, SEEK_END);
-    d->fs = file_size;
-    d->fd = tmp_fd;
-    lseek(tmp_fd, 0, SEEK_SET);
     printf("[PISCSI] Map %d: [%s] - %lu bytes.\n", index, filename, (unsigned long)file_size);
 
     if (piscsi_parse_rdb(d) == -1) {
@@ -437,6 +623,7 @@ void piscsi_map_drive(const char *filename, uint8_t index) {
         d->block_size = 512;
     }
     printf("[PISCSI] CHS: %d %d %d\n", d->c, d->h, d->s);
+    piscsi_attach_cache(index, d->fd, file_size, layered);
 
     printf ("Finding partitions.\n");
     piscsi_find_partitions(d);
@@ -445,6 +632,10 @@ void piscsi_map_drive(const char *filename, uint8_t index) {
     printf ("Done.\n");
 
     // Perform self-test to validate HDF integrity
+    if (known) {
+        printf("[PISCSI-SELFTEST] Drive %d (%s) is unchanged since it was validated.\n", index, filename);
+        return;
+    }
     printf("[PISCSI-SELFTEST] Running HDF integrity validation for drive %d...\n", index);
     if (!piscsi_validate_hdf(d, filename)) {
         printf("[PISCSI-SELFTEST-ERROR] HDF validation failed for drive %d (%s)\n", index, filename);
@@ -462,12 +653,7 @@ int piscsi_validate_hdf(struct piscsi_dev *d, const char *filename) {
 
     // Test 1: Read RDB block 0 (first 512 bytes)
     uint8_t rdb_block[512];
-    if (lseek(d->fd, 0, SEEK_SET) == (off_t)-1) {
-        printf("[PISCSI-SELFTEST] ERROR: Cannot seek to RDB block 0 in %s\n", filename);
-        return 0;
-    }
-
-    ssize_t bytes_read = read(d->fd, rdb_block, 512);
+    ssize_t bytes_read = piscsi_dev_read(d, rdb_block, 512, 0);
     if (bytes_read < 512) {
         printf("[PISCSI-SELFTEST] ERROR: Cannot read full RDB block 0 from %s (got %zd bytes)\n", filename, bytes_read);
         return 0;
@@ -487,12 +673,7 @@ int piscsi_validate_hdf(struct piscsi_dev *d, const char *filename) {
 
         // Look for first partition block (usually at offset 1024 for standard Amiga HDFs)
         uint8_t boot_block[512];
-        if (lseek(d->fd, 1024, SEEK_SET) == (off_t)-1) {
-            printf("[PISCSI-SELFTEST] ERROR: Cannot seek to DH0 boot block in %s\n", filename);
-            return 0;
-        }
-
-        bytes_read = read(d->fd, boot_block, 512);
+        bytes_read = piscsi_dev_read(d, boot_block, 512, 1024);
         if (bytes_read < 512) {
             printf("[PISCSI-SELFTEST] ERROR: Cannot read DH0 boot block from %s (got %zd bytes)\n", filename, bytes_read);
             return 0;
@@ -507,16 +688,19 @@ int piscsi_validate_hdf(struct piscsi_dev *d, const char *filename) {
         }
     }
 
-    // Test 3: Verify we can seek to end of file
-    off64_t file_end = lseek64(d->fd, 0, SEEK_END);
-    if (file_end == (off64_t)-1) {
-        printf("[PISCSI-SELFTEST] ERROR: Cannot seek to end of file %s\n", filename);
-        return 0;
-    }
+    // Test 3: Verify we can seek to end of file (not the image size for an overlay or a
+    // compressed image)
+    if (!piscsi_overlay_active((uint8_t)(d - devs)) && !piscsi_zhdf_active((uint8_t)(d - devs))) {
+        off64_t file_end = lseek64(d->fd, 0, SEEK_END);
+        if (file_end == (off64_t)-1) {
+            printf("[PISCSI-SELFTEST] ERROR: Cannot seek to end of file %s\n", filename);
+            return 0;
+        }
 
-    if ((uint64_t)file_end != d->fs) {
-        printf("[PISCSI-SELFTEST] WARNING: File size mismatch: reported=%llu, actual=%lld\n",
-               (unsigned long long)d->fs, (long long)file_end);
+        if ((uint64_t)file_end != d->fs) {
+            printf("[PISCSI-SELFTEST] WARNING: File size mismatch: reported=%llu, actual=%lld\n",
+                   (unsigned long long)d->fs, (long long)file_end);
+        }
     }
 
     // Test 4: Try reading a few random blocks to verify integrity
@@ -527,13 +711,7 @@ int piscsi_validate_hdf(struct piscsi_dev *d, const char *filename) {
         }
 
         uint8_t test_block[512];
-        if (lseek64(d->fd, test_offset, SEEK_SET) == (off64_t)-1) {
-            printf("[PISCSI-SELFTEST] ERROR: Cannot seek to test block at offset %lld in %s\n",
-                   (long long)test_offset, filename);
-            return 0;
-        }
-
-        bytes_read = read(d->fd, test_block, 512);
+        bytes_read = piscsi_dev_read(d, test_block, 512, (uint64_t)test_offset);
         if (bytes_read < 512) {
             printf("[PISCSI-SELFTEST] ERROR: Cannot read test block at offset %lld from %s (got %zd bytes)\n",
                    (long long)test_offset, filename, bytes_read);
@@ -547,9 +725,101 @@ int piscsi_validate_hdf(struct piscsi_dev *d, const char *filename) {
 void piscsi_unmap_drive(uint8_t index) {
     if (devs[index].fd != -1) {
         DEBUG("[PISCSI] Unmapped drive %d.\n", index);
-        close (devs[index].fd);
-        devs[index].fd = -1;
+        piscsi_close_image(index);
+    }
+    devs[index].removable = devs[index].read_only = 0;
+}
+
+// A floppy drive's partition, PF<unit>:, for the ROM file system, which
+// takes OFS and FFS disks alike. It is mounted, not booted from.
+static void piscsi_floppy_partition(struct piscsi_dev *d) {
+    for (int i = 0; i < 16; i++) {
+        free(d->pb[i]);
+        d->pb[i] = NULL;
+    }
+    struct PartitionBlock *pb = calloc(1, sizeof(struct PartitionBlock));
+    uint32_t env[17] = {
+        16,             // de_TableSize
+        128,            // de_SizeBlock
+        0,              // de_SecOrg
+        d->h,           // de_Surfaces
+        1,              // de_SectorPerBlock
+        d->s,           // de_BlocksPerTrack
+        2,              // de_Reserved
+        0,              // de_PreAlloc
+        0,              // de_Interleave
+        0,              // de_LowCyl
+        d->c - 1,       // de_HighCyl
+        5,              // de_NumBuffers
+        1,              // de_BufMemType, MEMF_PUBLIC
+        0x1FE00,        // de_MaxTransfer
+        0x7FFFFFFE,     // de_Mask
+        (uint32_t)-128, // de_BootPri
+        0x444F5300,     // de_DosType, DOS\0
+    };
+    for (int i = 0; i < 17; i++) {
+        pb->pb_Environment[i] = htobe32(env[i]);
+    }
+    pb->pb_ID = htobe32(PART_IDENTIFIER);
+    pb->pb_Next = 0xFFFFFFFF;
+    pb->pb_DriveName[0] = (uint8_t)sprintf((char *)pb->pb_DriveName + 1, "PF%d", (int)(d - devs));
+    d->pb[0] = pb;
+    d->num_partitions = 1;
+}
+
+void piscsi_make_removable(uint8_t index, uint64_t size) {
+    if (index >= NUM_UNITS) {
+        return;
+    }
+    struct piscsi_dev *d = &devs[index];
+    piscsi_unmap_drive(index);
+    d->removable = 1;
+    d->fs = size;
+    d->block_size = 512;
+    d->c = 80;
+    d->h = 2;
+    d->s = (uint16_t)(size / (80 * 2 * 512));
+    piscsi_floppy_partition(d);
+    printf("[PISCSI] Unit %d: removable %s floppy drive PF%d:.\n", index, d->s == 11 ? "DD" : "HD", index);
+}
+
+int piscsi_insert_media(uint8_t index, const char *filename) {
+    if (index >= NUM_UNITS || !devs[index].removable) {
+        return -1;
+    }
+    struct piscsi_dev *d = &devs[index];
+    uint64_t size = d->fs;
+    int read_only;
+    int fd = piscsi_media_open(filename, &size, &read_only);
+    if (fd < 0) {
+        return -1;
+    }
+    if (d->fd != -1) {
+        piscsi_close_image(index);
+    }
+    int layered = piscsi_attach_layers(index, fd, filename, &size);
+    if (layered < 0) {
+        printf("[PISCSI] Failed to open the image %s, unit %d has no disk in.\n", filename, index);
+        close(fd);
+    } else {
+        d->fd = fd;
+        d->read_only = (uint8_t)read_only;
+        piscsi_attach_cache(index, fd, size, layered);
+        printf("[PISCSI] Unit %d: inserted %s%s.\n", index, filename, read_only ? ", write protected" : "");
     }
+    piscsi_media_changed(index);
+    return layered < 0 ? -1 : 0;
+}
+
+int piscsi_eject_media(uint8_t index) {
+    if (index >= NUM_UNITS || !devs[index].removable || devs[index].fd == -1) {
+        return -1;
+    }
+    piscsi_close_image(index);
+    devs[index].read_only = 0;
+    printf("[PISCSI] Unit %d: disk ejected.\n", index);
+    piscsi_media_changed(index);
+    return 0;
 }
 
 static const char *io_cmd_name(int index) {
@@ -605,6 +875,7 @@ static const char *scsi_cmd_name(int index) {
         GETSCSINAME(SCSICMD_READ_CAPACITY_10);
         GETSCSINAME(SCSICMD_MODE_SENSE_6);
         GETSCSINAME(SCSICMD_READ_DEFECT_DATA_10);
+        GETSCSINAME(SCSICMD_SYNCHRONIZE_CACHE_10);
         default:
             return "[!!!PISCSI] Unhandled SCSI command";
     }
@@ -752,9 +1023,10 @@ static void piscsi_debugme(uint32_t index) {
     }
 }
 
-void handle_piscsi_write(uint32_t addr, uint32_t val, uint8_t type) {
+static void piscsi_write_reg(uint32_t addr, uint32_t val, uint8_t type) {
     int32_t r;
     uint8_t *map;
+    int rtg;
 #ifndef PISCSI_DEBUG
     if (type) {}
 #endif
@@ -766,133 +1038,240 @@ void handle_piscsi_write(uint32_t addr, uint32_t val, uint8_t type) {
     switch (cmd) {
         case PISCSI_CMD_READ64:
         case PISCSI_CMD_READ:
-        case PISCSI_CMD_READBYTES:
-            d = &devs[val];
-            if (d->fd == -1) {
+        case PISCSI_CMD_READBYTES: {
+            uint8_t async = (val & PISCSI_ASYNC_FLAG) != 0;
+            uint64_t file_offset;
+            val &= ~(uint32_t)PISCSI_ASYNC_FLAG;
+            piscsi_queued = 0;
+            piscsi_error = PISCSI_ASYNC_IOERR;
+            if (val >= NUM_UNITS || devs[val].fd == -1) {
+                if (val < NUM_UNITS && devs[val].removable) {
+                    piscsi_error = TDERR_DiskChanged;
+                    break;
+                }
                 DEBUG("[!!!PISCSI] BUG: Attempted read from unmapped drive %d.\n", val);
                 break;
             }
+            d = &devs[val];
+            METRICS_INC(piscsi_reads);
+            METRICS_ADD(piscsi_read_bytes, piscsi_u32[1]);
 
             if (cmd == PISCSI_CMD_READBYTES) {
                 uint32_t src = piscsi_u32[0];
                 uint32_t block = src / d->block_size;
                 d->lba = block;
-                DEBUG("[PISCSI-IO] Unit:%d CMD:READBYTES io_Offset:0x%X io_Length:%d LBA:0x%X file_offset:0x%X to_addr:0x%.8X\n", val, src, piscsi_u32[1], block, src, piscsi_u32[2]);
-                lseek64(d->fd, (off64_t)src, SEEK_SET);
+                DEBUG_TRIVIAL("[PISCSI-IO] Unit:%d CMD:READBYTES io_Offset:0x%X io_Length:%d LBA:0x%X file_offset:0x%X to_addr:0x%.8X\n", val, src, piscsi_u32[1], block, src, piscsi_u32[2]);
+                file_offset = src;
             }
             else if (cmd == PISCSI_CMD_READ) {
                 uint32_t block = piscsi_u32[0];
-                uint64_t file_offset = (uint64_t)block * d->block_size;
+                file_offset = (uint64_t)block * d->block_size;
                 d->lba = block;
-                DEBUG("[PISCSI-IO] Unit:%d CMD:READ io_Offset:0x%X io_Length:%d LBA:0x%X file_offset:0x%llX to_addr:0x%.8X\n", val, block, piscsi_u32[1], block, (unsigned long long)file_offset, piscsi_u32[2]);
-                lseek64(d->fd, (off64_t)file_offset, SEEK_SET);
+                DEBUG_TRIVIAL("[PISCSI-IO] Unit:%d CMD:READ io_Offset:0x%X io_Length:%d LBA:0x%X file_offset:0x%llX to_addr:0x%.8X\n", val, block, piscsi_u32[1], block, (unsigned long long)file_offset, piscsi_u32[2]);
             }
             else {
                 uint64_t src = ((uint64_t)piscsi_u32[3] << 32) | piscsi_u32[0];
                 uint32_t block = (uint32_t)(src / d->block_size);
                 d->lba = block;
-                DEBUG("[PISCSI-IO] Unit:%d CMD:READ64 io_Offset:0x%llX io_Length:%d LBA:0x%X file_offset:0x%llX to_addr:0x%.8X\n", val, (unsigned long long)src, piscsi_u32[1], block, (unsigned long long)src, piscsi_u32[2]);
-                lseek64(d->fd, (off64_t)src, SEEK_SET);
+                DEBUG_TRIVIAL("[PISCSI-IO] Unit:%d CMD:READ64 io_Offset:0x%llX io_Length:%d LBA:0x%X file_offset:0x%llX to_addr:0x%.8X\n", val, (unsigned long long)src, piscsi_u32[1], block, (unsigned long long)src, piscsi_u32[2]);
+                file_offset = src;
             }
 
+            // Queued requests end on a worker thread; the tag pairs the probes.
+            PS_TRACE5(piscsi_start, cmd, val, d->lba, piscsi_u32[1], async ? piscsi_tag : 0);
             r = get_mapped_item_by_address(cfg, piscsi_u32[2]);
             map = get_mapped_data_pointer_by_address(cfg, piscsi_u32[2]);
+            rtg = map && rtg_vram_range(piscsi_u32[2], piscsi_u32[1]);
+            if (rtg) {
+                // Queued PiGFX operations may still be drawing where this lands.
+                rtg_async_drain();
+            }
+            if (async && map) {
+                struct piscsi_async_req req = {piscsi_tag, cmd, (uint8_t)val, 0, d->fd, file_offset, piscsi_u32[1], map, piscsi_u32[2]};
+                if (piscsi_async_submit(&req)) {
+                    piscsi_queued = 1;
+                    break;
+                }
+            }
+            uint64_t t0 = piscsi_now_ns();
+            // Synchronous commands see everything queued before them.
+            piscsi_async_drain((uint8_t)val);
             if (map) {
                 DEBUG_TRIVIAL("[PISCSI-%d] \"DMA\" Read goes to mapped range %d.\n", val, r);
-                ssize_t bytes_read = read(d->fd, map, piscsi_u32[1]);
+                ssize_t bytes_read = piscsi_cache_read((uint8_t)val, d->fd, map, piscsi_u32[1], file_offset);
+                PS_TRACE4(piscsi_end, cmd, val, bytes_read, async ? piscsi_tag : 0);
+                if (rtg && bytes_read > 0) {
+                    rtg_mark_dirty_addr(piscsi_u32[2], (uint32_t)bytes_read);
+                }
+                if (bytes_read == (ssize_t)piscsi_u32[1]) {
+                    piscsi_error = 0;
+                }
                 if (bytes_read < 0) {
-                    DEBUG("[PISCSI-IO-ERROR] Unit:%d READ failed: bytes_requested=%d, bytes_read=%zd, errno=%d\n", val, piscsi_u32[1], bytes_read, errno);
+                    DEBUG_TRIVIAL("[PISCSI-IO-ERROR] Unit:%d READ failed: bytes_requested=%d, bytes_read=%zd, errno=%d\n", val, piscsi_u32[1], bytes_read, errno);
                 } else if (bytes_read != (ssize_t)piscsi_u32[1]) {
-                    DEBUG("[PISCSI-IO-WARN] Unit:%d PARTIAL READ: requested=%d, actual=%zd\n", val, piscsi_u32[1], bytes_read);
+                    DEBUG_TRIVIAL("[PISCSI-IO-WARN] Unit:%d PARTIAL READ: requested=%d, actual=%zd\n", val, piscsi_u32[1], bytes_read);
                 } else {
-                    DEBUG("[PISCSI-IO-SUCCESS] Unit:%d READ: %zd bytes OK\n", val, bytes_read);
+                    DEBUG_TRIVIAL("[PISCSI-IO-SUCCESS] Unit:%d READ: %zd bytes OK\n", val, bytes_read);
                 }
             }
             else {
                 DEBUG_TRIVIAL("[PISCSI-%d] No mapped range found for read.\n", val);
-                uint8_t c = 0;
                 int success = 1;
-                for (uint32_t i = 0; i < piscsi_u32[1]; i++) {
-                    ssize_t result = read(d->fd, &c, 1);
+                for (uint32_t i = 0; i < piscsi_u32[1];) {
+                    uint32_t chunk = piscsi_u32[1] - i;
+                    if (chunk > PISCSI_BOUNCE_SIZE) {
+                        chunk = PISCSI_BOUNCE_SIZE;
+                    }
+                    ssize_t result = piscsi_cache_read((uint8_t)val, d->fd, piscsi_bounce, chunk, file_offset + i);
                     if (result <= 0) {
-                        DEBUG("[PISCSI-IO-ERROR] Unit:%d BYTE READ failed at offset %d: result=%zd\n", val, i, result);
+                        DEBUG_TRIVIAL("[PISCSI-IO-ERROR] Unit:%d BOUNCE READ failed at offset %d: result=%zd\n", val, i, result);
                         success = 0;
                         break;
                     }
-                    m68k_write_memory_8(piscsi_u32[2] + i, (uint32_t)c);
+                    piscsi_amiga_write(piscsi_u32[2] + i, piscsi_bounce, (uint32_t)result);
+                    i += (uint32_t)result;
                 }
+                PS_TRACE4(piscsi_end, cmd, val, success ? (int64_t)piscsi_u32[1] : -1, async ? piscsi_tag : 0);
                 if (success) {
-                    DEBUG("[PISCSI-IO-SUCCESS] Unit:%d BYTE READ: %d bytes OK\n", val, piscsi_u32[1]);
+                    piscsi_error = 0;
+                    DEBUG_TRIVIAL("[PISCSI-IO-SUCCESS] Unit:%d BOUNCE READ: %d bytes OK\n", val, piscsi_u32[1]);
                 }
             }
+            METRICS_ADD(piscsi_stall_ns, piscsi_now_ns() - t0);
             break;
+        }
         case PISCSI_CMD_WRITE64:
         case PISCSI_CMD_WRITE:
-        case PISCSI_CMD_WRITEBYTES:
-            d = &devs[val];
-            if (d->fd == -1) {
+        case PISCSI_CMD_WRITEBYTES: {
+            uint8_t async = (val & PISCSI_ASYNC_FLAG) != 0;
+            uint64_t file_offset;
+            val &= ~(uint32_t)PISCSI_ASYNC_FLAG;
+            piscsi_queued = 0;
+            piscsi_error = PISCSI_ASYNC_IOERR;
+            if (val >= NUM_UNITS || devs[val].fd == -1) {
+                if (val < NUM_UNITS && devs[val].removable) {
+                    piscsi_error = TDERR_DiskChanged;
+                    break;
+                }
                 DEBUG ("[PISCSI] BUG: Attempted write to unmapped drive %d.\n", val);
                 break;
             }
+            if (devs[val].read_only) {
+                piscsi_error = TDERR_WriteProt;
+                break;
+            }
+            d = &devs[val];
+            METRICS_INC(piscsi_writes);
+            METRICS_ADD(piscsi_write_bytes, piscsi_u32[1]);
 
             if (cmd == PISCSI_CMD_WRITEBYTES) {
                 uint32_t src = piscsi_u32[0];
                 uint32_t block = src / d->block_size;
                 d->lba = block;
-                DEBUG("[PISCSI-IO] Unit:%d CMD:WRITEBYTES io_Offset:0x%X io_Length:%d LBA:0x%X file_offset:0x%X from_addr:0x%.8X\n", val, src, piscsi_u32[1], block, src, piscsi_u32[2]);
-                lseek64(d->fd, (off64_t)src, SEEK_SET);
+                DEBUG_TRIVIAL("[PISCSI-IO] Unit:%d CMD:WRITEBYTES io_Offset:0x%X io_Length:%d LBA:0x%X file_offset:0x%X from_addr:0x%.8X\n", val, src, piscsi_u32[1], block, src, piscsi_u32[2]);
+                file_offset = src;
             }
             else if (cmd == PISCSI_CMD_WRITE) {
                 uint32_t block = piscsi_u32[0];
-                uint64_t file_offset = (uint64_t)block * d->block_size;
+                file_offset = (uint64_t)block * d->block_size;
                 d->lba = block;
-                DEBUG("[PISCSI-IO] Unit:%d CMD:WRITE io_Offset:0x%X io_Length:%d LBA:0x%X file_offset:0x%llX from_addr:0x%.8X\n", val, block, piscsi_u32[1], block, (unsigned long long)file_offset, piscsi_u32[2]);
-                lseek64(d->fd, (off64_t)file_offset, SEEK_SET);
+                DEBUG_TRIVIAL("[PISCSI-IO] Unit:%d CMD:WRITE io_Offset:0x%X io_Length:%d LBA:0x%X file_offset:0x%llX from_addr:0x%.8X\n", val, block, piscsi_u32[1], block, (unsigned long long)file_offset, piscsi_u32[2]);
             }
             else {
                 uint64_t src = ((uint64_t)piscsi_u32[3] << 32) | piscsi_u32[0];
                 uint32_t block = (uint32_t)(src / d->block_size);
                 d->lba = block;
-                DEBUG("[PISCSI-IO] Unit:%d CMD:WRITE64 io_Offset:0x%llX io_Length:%d LBA:0x%X file_offset:0x%llX from_addr:0x%.8X\n", val, (unsigned long long)src, piscsi_u32[1], block, (unsigned long long)src, piscsi_u32[2]);
-                lseek64(d->fd, (off64_t)src, SEEK_SET);
+                DEBUG_TRIVIAL("[PISCSI-IO] Unit:%d CMD:WRITE64 io_Offset:0x%llX io_Length:%d LBA:0x%X file_offset:0x%llX from_addr:0x%.8X\n", val, (unsigned long long)src, piscsi_u32[1], block, (unsigned long long)src, piscsi_u32[2]);
+                file_offset = src;
             }
 
+            piscsi_meta_written((uint8_t)val, file_offset, piscsi_u32[1]);
+            // Queued requests end on a worker thread; the tag pairs the probes.
+            PS_TRACE5(piscsi_start, cmd, val, d->lba, piscsi_u32[1], async ? piscsi_tag : 0);
             r = get_mapped_item_by_address(cfg, piscsi_u32[2]);
             map = get_mapped_data_pointer_by_address(cfg, piscsi_u32[2]);
+            if (map && rtg_vram_range(piscsi_u32[2], piscsi_u32[1])) {
+                // Write what the queued PiGFX operations draw, not what was there before.
+                rtg_async_drain();
+            }
+            if (async && map) {
+                struct piscsi_async_req req = {piscsi_tag, cmd, (uint8_t)val, 1, d->fd, file_offset, piscsi_u32[1], map, piscsi_u32[2]};
+                if (piscsi_async_submit(&req)) {
+                    piscsi_queued = 1;
+                    break;
+                }
+            }
+            uint64_t t0 = piscsi_now_ns();
+            piscsi_async_drain((uint8_t)val);
             if (map) {
                 DEBUG_TRIVIAL("[PISCSI-%d] \"DMA\" Write comes from mapped range %d.\n", val, r);
-                ssize_t bytes_written = write(d->fd, map, piscsi_u32[1]);
+                ssize_t bytes_written = piscsi_cache_write((uint8_t)val, d->fd, map, piscsi_u32[1], file_offset);
+                PS_TRACE4(piscsi_end, cmd, val, bytes_written, async ? piscsi_tag : 0);
+                if (bytes_written == (ssize_t)piscsi_u32[1]) {
+                    piscsi_error = 0;
+                }
                 if (bytes_written < 0) {
-                    DEBUG("[PISCSI-IO-ERROR] Unit:%d WRITE failed: bytes_requested=%d, bytes_written=%zd, errno=%d\n", val, piscsi_u32[1], bytes_written, errno);
+                    DEBUG_TRIVIAL("[PISCSI-IO-ERROR] Unit:%d WRITE failed: bytes_requested=%d, bytes_written=%zd, errno=%d\n", val, piscsi_u32[1], bytes_written, errno);
                 } else if (bytes_written != (ssize_t)piscsi_u32[1]) {
-                    DEBUG("[PISCSI-IO-WARN] Unit:%d PARTIAL WRITE: requested=%d, actual=%zd\n", val, piscsi_u32[1], bytes_written);
+                    DEBUG_TRIVIAL("[PISCSI-IO-WARN] Unit:%d PARTIAL WRITE: requested=%d, actual=%zd\n", val, piscsi_u32[1], bytes_written);
                 } else {
-                    DEBUG("[PISCSI-IO-SUCCESS] Unit:%d WRITE: %zd bytes OK\n", val, bytes_written);
+                    DEBUG_TRIVIAL("[PISCSI-IO-SUCCESS] Unit:%d WRITE: %zd bytes OK\n", val, bytes_written);
                 }
             }
             else {
                 DEBUG_TRIVIAL("[PISCSI-%d] No mapped range found for write.\n", val);
-                uint8_t c = 0;
                 int success = 1;
-                for (uint32_t i = 0; i < piscsi_u32[1]; i++) {
-                    c = (uint8_t)m68k_read_memory_8(piscsi_u32[2] + i);
-                    ssize_t result = write(d->fd, &c, 1);
-                    if (result <= 0) {
-                        DEBUG("[PISCSI-IO-ERROR] Unit:%d BYTE WRITE failed at offset %d: result=%zd\n", val, (int)i, result);
+                for (uint32_t i = 0; i < piscsi_u32[1] && success;) {
+                    uint32_t chunk = piscsi_u32[1] - i;
+                    if (chunk > PISCSI_BOUNCE_SIZE) {
+                        chunk = PISCSI_BOUNCE_SIZE;
+                    }
+                    piscsi_amiga_read(piscsi_u32[2] + i, piscsi_bounce, chunk);
+                    ssize_t result = piscsi_cache_write((uint8_t)val, d->fd, piscsi_bounce, chunk, file_offset + i);
+                    if (result != (ssize_t)chunk) {
+                        DEBUG_TRIVIAL("[PISCSI-IO-ERROR] Unit:%d BOUNCE WRITE failed at offset %d: result=%zd\n", val, i, result);
                         success = 0;
-                        break;
                     }
+                    i += chunk;
                 }
+                PS_TRACE4(piscsi_end, cmd, val, success ? (int64_t)piscsi_u32[1] : -1, async ? piscsi_tag : 0);
                 if (success) {
-                    DEBUG("[PISCSI-IO-SUCCESS] Unit:%d BYTE WRITE: %d bytes OK\n", val, piscsi_u32[1]);
+                    piscsi_error = 0;
+                    DEBUG_TRIVIAL("[PISCSI-IO-SUCCESS] Unit:%d BOUNCE WRITE: %d bytes OK\n", val, piscsi_u32[1]);
                 }
             }
+            METRICS_ADD(piscsi_stall_ns, piscsi_now_ns() - t0);
             break;
+        }
         case PISCSI_CMD_ADDR1: case PISCSI_CMD_ADDR2: case PISCSI_CMD_ADDR3: case PISCSI_CMD_ADDR4: {
             int addr_idx = ((addr & 0xFFFF) - PISCSI_CMD_ADDR1) / 4;
             piscsi_u32[addr_idx] = val;
             break;
         }
+        case PISCSI_CMD_TAG:
+            piscsi_tag = val;
+            break;
+        case PISCSI_CMD_UPDATE:
+            // The result has its own register, since completions popped by the
+            // interrupt server rewrite DONE_ERR. It is mirrored there for drivers
+            // that still read DONE_ERR after an update.
+            piscsi_update_error = 0;
+            if (val < NUM_UNITS && devs[val].fd != -1) {
+                piscsi_async_drain((uint8_t)val);
+                if (piscsi_cache_update((uint8_t)val) < 0) {
+                    piscsi_update_error = PISCSI_ASYNC_IOERR;
+                }
+                // Compressed images hold written chunks until asked.
+                if (piscsi_zhdf_active((uint8_t)val) &&
+                    piscsi_zhdf_unit_sync((uint8_t)val, devs[val].fd) < 0) {
+                    piscsi_update_error = PISCSI_ASYNC_IOERR;
+                }
+            }
+            piscsi_error = piscsi_update_error;
+            break;
+        case PISCSI_CMD_CHANGES:
+            piscsi_media_listen(val != 0);
+            break;
         case PISCSI_CMD_DRVNUM:
             if (val > 6) {
                 piscsi_cur_drive = 255;
@@ -938,7 +1317,7 @@ void handle_piscsi_write(uint32_t addr, uint32_t val, uint8_t type) {
                 sprintf((char *)dst_data + data_addr, "pi-scsi.device");
                 uint32_t addr2 = addr + 0x4000;
                 for (int i = 0; i < NUM_UNITS; i++) {
-                    if (devs[i].fd == -1)
+                    if (devs[i].fd == -1 && !devs[i].removable)
                         goto skip_disk;
 
                     if (devs[i].num_partitions) {
@@ -1112,7 +1491,7 @@ fs_found:;
 
 #define PIB 0x00
 
-uint32_t handle_piscsi_read(uint32_t addr, uint8_t type) {
+static uint32_t piscsi_read_reg(uint32_t addr, uint8_t type) {
     if (type) {}
 
     if ((addr & 0xFFFF) >= PISCSI_CMD_ROM) {
@@ -1151,8 +1530,34 @@ uint32_t handle_piscsi_read(uint32_t addr, uint8_t type) {
             return piscsi_u32[i];
             break;
         }
+        case PISCSI_CMD_ASYNC:
+            return piscsi_async_depth();
+        case PISCSI_CMD_TAG:
+            return piscsi_queued;
+        case PISCSI_CMD_DONE: {
+            uint8_t err = 0;
+            uint32_t tag = piscsi_async_pop(&err);
+            if (tag) {
+                piscsi_error = err;
+            }
+            return tag;
+        }
+        case PISCSI_CMD_DONE_ERR:
+            return piscsi_error;
+        case PISCSI_CMD_UPDATE:
+            return piscsi_update_error;
+        case PISCSI_CMD_MEDIA: {
+            if (piscsi_cur_drive >= NUM_UNITS) {
+                return 0;
+            }
+            struct piscsi_dev *d = &devs[piscsi_cur_drive];
+            return (d->removable ? PISCSI_MEDIA_REMOVABLE : 0) | (d->fd != -1 ? PISCSI_MEDIA_PRESENT : 0) |
+                   (d->read_only ? PISCSI_MEDIA_PROTECTED : 0);
+        }
+        case PISCSI_CMD_CHANGES:
+            return piscsi_media_take_changes();
         case PISCSI_CMD_DRVTYPE:
-            if (devs[piscsi_cur_drive].fd == -1) {
+            if (devs[piscsi_cur_drive].fd == -1 && !devs[piscsi_cur_drive].removable) {
                 DEBUG("[PISCSI] %s Read from DRVTYPE %d, drive not attached.\n", op_type_names[type], piscsi_cur_drive);
                 return 0;
             }
@@ -1238,3 +1643,25 @@ uint32_t handle_piscsi_read(uint32_t addr, uint8_t type) {
 
     return 0;
 }
+
+// With a trace being recorded (piscsi-trace.h), every register access but
+// the boot ROM reads goes to it as well.
+void handle_piscsi_write(uint32_t addr, uint32_t val, uint8_t type) {
+    if (!piscsi_trace_out) {
+        piscsi_write_reg(addr, val, type);
+        return;
+    }
+    uint64_t t0 = piscsi_now_ns();
+    piscsi_write_reg(addr, val, type);
+    piscsi_trace_access('W', addr & 0xFFFF, 8u << type, val, t0, piscsi_now_ns());
+}
+
+uint32_t handle_piscsi_read(uint32_t addr, uint8_t type) {
+    if (!piscsi_trace_out || (addr & 0xFFFF) >= PISCSI_CMD_ROM) {
+        return piscsi_read_reg(addr, type);
+    }
+    uint64_t t0 = piscsi_now_ns();
+    uint32_t val = piscsi_read_reg(addr, type);
+    piscsi_trace_access('R', addr & 0xFFFF, 8u << type, val, t0, piscsi_now_ns());
+    return val;
+}
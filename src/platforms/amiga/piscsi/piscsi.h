@@ -46,6 +46,9 @@
 
 #define HD_SCSICMD 28
 
+#define TDERR_WriteProt 28
+#define TDERR_DiskChanged 29
+
 #define NSCMD_DEVICEQUERY 0x4000
 #define NSCMD_TD_READ64   0xC000
 #define NSCMD_TD_WRITE64  0xC001
@@ -53,6 +56,8 @@
 #define NSCMD_TD_FORMAT64 0xC003
 
 #define RDB_BLOCK_LIMIT 16
+// Bytes read at each place an RDB may be.
+#define RDB_PROBE_SIZE 512
 
 // RDSK
 #define RDB_IDENTIFIER 0x5244534B
@@ -75,6 +80,10 @@ struct piscsi_dev {
     uint32_t block_size;
     struct PartitionBlock *pb[16];
     struct RigidDiskBlock *rdb;
+    // Removable units (piscsi-media.h) keep their geometry and partition
+    // with no disk in, fd -1.
+    uint8_t removable;
+    uint8_t read_only;
 };
 
 struct piscsi_fs {
@@ -260,6 +269,11 @@ void piscsi_map_drive(const char *filename, uint8_t index);
 void piscsi_unmap_drive(uint8_t index);
 int piscsi_validate_hdf(struct piscsi_dev *d, const char *filename);
 struct piscsi_dev *piscsi_get_dev(uint8_t index);
+// Make `index` an empty removable unit for disks of `size` bytes.
+void piscsi_make_removable(uint8_t index, uint64_t size);
+// Change the disk of a removable unit. Return 0 or -1.
+int piscsi_insert_media(uint8_t index, const char *filename);
+int piscsi_eject_media(uint8_t index);
 
 void handle_piscsi_write(uint32_t addr, uint32_t val, uint8_t type);
 uint32_t handle_piscsi_read(uint32_t addr, uint8_t type);
@@ -135,8 +135,8 @@ enum pistorm_piscsi_commands {
   PISCSI_CTRL_NONE,
   PISCSI_CTRL_MAP,     // For hard drives
   PISCSI_CTRL_UNMAP,   //
-  PISCSI_CTRL_EJECT,   // For optical media, not yet implemented
-  PISCSI_CTRL_INSERT,  //
+  PISCSI_CTRL_EJECT,   // For removable units (piscsi-media), PI_WORD1 the unit
+  PISCSI_CTRL_INSERT,  // PI_STR1 the disk image
   PISCSI_CTRL_ENABLE,  // Enable PiSCSI
   PISCSI_CTRL_DISABLE, // Disable PiSCSI
   PISCSI_CTRL_NUM,
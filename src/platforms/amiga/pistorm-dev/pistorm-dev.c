@@ -76,6 +76,13 @@ static void write_be16(uint8_t* ptr, uint16_t val) {
   ptr[1] = (uint8_t)(val & 0xFF);
 }
 
+// Host-side copies bypass the CPU write path, so tell the RTG output about
+// anything that lands in VRAM.
+static void mark_rect_dirty(uint32_t addr, uint16_t pitch, uint16_t x, uint16_t y, uint16_t w,
+                            uint16_t h) {
+  rtg_mark_dirty_addr(addr + x + ((uint32_t)y * pitch), ((uint32_t)pitch * (h - 1u)) + w);
+}
+
 static uint16_t janus_ring_used(uint16_t write_idx, uint16_t read_idx, uint16_t ring_size) {
   if (write_idx >= read_idx) {
     return (uint16_t)(write_idx - read_idx);
@@ -354,6 +361,11 @@ void handle_pistorm_dev_write(uint32_t addr_, uint32_t val, uint8_t type) {
   uint32_t addr = (addr_ & 0xFFFF);
   pi_cmd_result = (uint8_t)PI_RES_OK;
 
+  // The host-side copies, fills and blits below write VRAM directly.
+  if (addr >= PI_CMD_FILESIZE && addr < PI_DBG_MSG) {
+    rtg_async_drain();
+  }
+
   switch ((addr)) {
   case PI_DBG_MSG:
     // TODO: Output debug message based on value written and data in val/str registers.
@@ -487,6 +499,7 @@ void handle_pistorm_dev_write(uint32_t addr_, uint32_t val, uint8_t type) {
         uint8_t* src_ptr = &cfg->map_data[src][(pi_ptr[0] - cfg->map_offset[src])];
         uint8_t* dst_ptr = &cfg->map_data[dst][(pi_ptr[1] - cfg->map_offset[dst])];
         memcpy(dst_ptr, src_ptr, val);
+        rtg_mark_dirty_addr(pi_ptr[1], val);
       } else {
         // DEBUG("slow memcpy\n");
         uint8_t tmp = 0;
@@ -533,6 +546,7 @@ void handle_pistorm_dev_write(uint32_t addr_, uint32_t val, uint8_t type) {
       if (dst != -1) {
         uint8_t* dst_ptr = &cfg->map_data[dst][(pi_ptr[0] - cfg->map_offset[dst])];
         memset(dst_ptr, pi_byte[0], val);
+        rtg_mark_dirty_addr(pi_ptr[0], val);
       } else {
         for (uint32_t i = 0; i < val; i++) {
           m68k_write_memory_8(pi_ptr[0] + i, pi_byte[0]);
@@ -578,6 +592,7 @@ void handle_pistorm_dev_write(uint32_t addr_, uint32_t val, uint8_t type) {
           src_ptr += pi_word[0];
           dst_ptr += pi_word[1];
         }
+        mark_rect_dirty(pi_ptr[1], pi_word[1], pi_word[6], pi_word[7], pi_word[2], pi_word[3]);
       } else {
         uint32_t src_offset = 0, dst_offset = 0;
         uint8_t tmp = 0;
@@ -639,6 +654,7 @@ void handle_pistorm_dev_write(uint32_t addr_, uint32_t val, uint8_t type) {
           src_ptr += pi_word[0];
           dst_ptr += pi_word[1];
         }
+        mark_rect_dirty(pi_ptr[1], pi_word[1], pi_word[6], pi_word[7], pi_word[2], pi_word[3]);
       } else {
         uint32_t src_offset = 0, dst_offset = 0;
         uint8_t tmp = 0;
@@ -692,6 +708,7 @@ void handle_pistorm_dev_write(uint32_t addr_, uint32_t val, uint8_t type) {
           memset(dst_ptr, tmp, pi_word[2]);
           dst_ptr += pi_word[1];
         }
+        mark_rect_dirty(pi_ptr[1], pi_word[1], pi_word[6], pi_word[7], pi_word[2], pi_word[3]);
       } else {
         uint32_t dst_offset = 0;
         dst_offset += pi_word[6] + (pi_word[7] * pi_word[1]);
@@ -748,6 +765,7 @@ void handle_pistorm_dev_write(uint32_t addr_, uint32_t val, uint8_t type) {
           }
           dst_ptr += pi_word[1];
         }
+        rtg_mark_dirty_addr(pi_ptr[1], (uint32_t)pi_word[3] * ((uint32_t)pi_word[2] + pi_word[1]));
       } else {
         // NYI
       }
@@ -896,12 +914,31 @@ void handle_pistorm_dev_write(uint32_t addr_, uint32_t val, uint8_t type) {
       }
       break;
     case PISCSI_CTRL_EJECT:
-      DEBUG("EJECT (NYI)\n");
-      pi_cmd_result = (uint8_t)PI_RES_NOCHANGE;
+      DEBUG("EJECT\n");
+      if ((uint8_t)pi_word[0] > 6 || !piscsi_get_dev((uint8_t)pi_word[0])->removable) {
+        LOG_WARN("[PISTORM-DEV] Drive %d is not a removable PISCSI drive.\n", (int)pi_word[0]);
+        pi_cmd_result = (uint8_t)PI_RES_INVALIDVALUE;
+      } else if (piscsi_eject_media((uint8_t)pi_word[0]) == 0) {
+        pi_cmd_result = (uint8_t)PI_RES_OK;
+      } else {
+        pi_cmd_result = (uint8_t)PI_RES_NOCHANGE;
+      }
       break;
     case PISCSI_CTRL_INSERT:
-      DEBUG("INSERT (NYI)\n");
-      pi_cmd_result = (uint8_t)PI_RES_NOCHANGE;
+      DEBUG("INSERT\n");
+      if ((uint8_t)pi_word[0] > 6 || !piscsi_get_dev((uint8_t)pi_word[0])->removable) {
+        LOG_WARN("[PISTORM-DEV] Drive %d is not a removable PISCSI drive.\n", (int)pi_word[0]);
+        pi_cmd_result = (uint8_t)PI_RES_INVALIDVALUE;
+      } else if (pi_string[0] == 0 ||
+                 grab_amiga_string(pi_string[0], (uint8_t*)tmp_string, 255) == -1) {
+        LOG_WARN("[PISTORM-DEV] Failed to grab string for PISCSI disk image. Aborting.\n");
+        pi_cmd_result = (uint8_t)PI_RES_FAILED;
+      } else if (piscsi_insert_media((uint8_t)pi_word[0], tmp_string) == 0) {
+        pi_cmd_result = (uint8_t)PI_RES_OK;
+      } else {
+        pi_cmd_result = (uint8_t)PI_RES_FILENOTFOUND;
+      }
+      pi_string[0] = 0;
       break;
     default:
       DEBUG("UNKNOWN/UNHANDLED. Aborting.\n");
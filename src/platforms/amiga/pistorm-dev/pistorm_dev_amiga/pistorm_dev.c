@@ -253,7 +253,7 @@ unsigned short pi_piscsi_unmap_drive(unsigned char index) {
   RETURN_CMDRES;
 }
 
-// For virtual removable media. Not yet implemented.
+// For removable PiSCSI units, set up with piscsi-media on the Pi side.
 unsigned short pi_piscsi_insert_media(char* filename, unsigned char index) {
   WRITESHORT(PI_WORD1, index);
   WRITELONG(PI_STR1, (unsigned int)filename);
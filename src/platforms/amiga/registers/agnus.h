@@ -50,6 +50,10 @@
 #define BPL5PTL  (AGNUS_BASE + 0x0F2)  // Bitplane 5 pointer low
 #define BPL6PTH  (AGNUS_BASE + 0x0F4)  // Bitplane 6 pointer high
 #define BPL6PTL  (AGNUS_BASE + 0x0F6)  // Bitplane 6 pointer low
+#define BPL7PTH  (AGNUS_BASE + 0x0F8)  // Bitplane 7 pointer high (AGA)
+#define BPL7PTL  (AGNUS_BASE + 0x0FA)  // Bitplane 7 pointer low (AGA)
+#define BPL8PTH  (AGNUS_BASE + 0x0FC)  // Bitplane 8 pointer high (AGA)
+#define BPL8PTL  (AGNUS_BASE + 0x0FE)  // Bitplane 8 pointer low (AGA)
 
 // Bitplane Modulo Registers
 #define BPL1MOD  (AGNUS_BASE + 0x108)  // Bitplane 1 modulo
@@ -60,6 +64,24 @@
 #define BPLCON1  (AGNUS_BASE + 0x102)  // Bitplane control 1
 #define BPLCON2  (AGNUS_BASE + 0x104)  // Bitplane control 2
 #define BPLCON3  (AGNUS_BASE + 0x106)  // Bitplane control 3
+#define BPLCON4  (AGNUS_BASE + 0x10C)  // Bitplane control 4 (AGA)
+#define FMODE    (AGNUS_BASE + 0x1FC)  // Fetch mode (AGA)
+
+// BPLCON0 Bits
+#define BPLCON0_HIRES 0x8000  // High resolution (640 pixels)
+#define BPLCON0_BPU   0x7000  // Number of bitplanes, 0-7
+#define BPLCON0_HAM   0x0800  // Hold-and-modify
+#define BPLCON0_DPF   0x0400  // Dual playfield
+#define BPLCON0_SHRES 0x0040  // Super high resolution (ECS)
+#define BPLCON0_BPU3  0x0010  // Eighth bitplane (AGA)
+#define BPLCON0_LACE  0x0004  // Interlace
+
+// BPLCON2/BPLCON3 Bits
+#define BPLCON2_KILLEHB 0x0200  // Disable extra half-brite (ECS/AGA)
+#define BPLCON2_PF2PRI  0x0040  // Playfield 2 in front of playfield 1
+#define BPLCON3_BANK    0xE000  // Colour bank for COLORxx writes (AGA)
+#define BPLCON3_PF2OF   0x1C00  // Playfield 2 colour offset (AGA)
+#define BPLCON3_LOCT    0x0200  // COLORxx writes set the low nibbles (AGA)
 
 // Bitplane Data Registers
 #define BPL1DAT  (AGNUS_BASE + 0x110)  // Bitplane 1 data
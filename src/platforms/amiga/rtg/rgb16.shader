@@ -0,0 +1,39 @@
+#version 100
+
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+
+// Raw 16-bit RTG pixels, uploaded as two 8-bit channels per texel:
+// r = first byte in VRAM, a = second byte.
+
+varying vec2 fragTexCoord;
+varying vec4 fragColor;
+
+uniform sampler2D texture0;
+
+uniform vec4 colDiffuse;
+
+uniform float bigEndian; // 1.0: the first byte holds bits 15-8
+uniform float rgb555;    // 1.0: x1r5g5b5 instead of r5g6b5
+uniform float bgr;       // 1.0: blue in the top field, red in the bottom one
+
+void main()
+{
+    vec4 texelColor = texture2D(texture0, fragTexCoord);
+    float b0 = floor(texelColor.r * 255.0 + 0.5);
+    float b1 = floor(texelColor.a * 255.0 + 0.5);
+    float hi = mix(b1, b0, bigEndian);
+    float lo = mix(b0, b1, bigEndian);
+
+    // 565: hi = TTTTTMMM lo = MMMLLLLL
+    // 555: hi = xTTTTTMM lo = MMMLLLLL
+    float top = mix(floor(hi / 8.0), floor(mod(hi, 128.0) / 4.0), rgb555);
+    float mid = mix(mod(hi, 8.0), mod(hi, 4.0), rgb555) * 8.0 + floor(lo / 32.0);
+    float low = mod(lo, 32.0);
+
+    vec3 color = vec3(top / 31.0, mid / mix(63.0, 31.0, rgb555), low / 31.0);
+    gl_FragColor = vec4(mix(color, color.bgr, bgr), 1.0);
+}
@@ -0,0 +1,483 @@
+// SPDX-License-Identifier: MIT
+
+#include <endian.h>
+#include <string.h>
+
+#include "rtg-convert.h"
+#include "rtg.h"
+
+// The NEON paths load 16-bit pixels straight into lanes, so they assume a
+// little-endian host like every Pi OS build.
+#if defined(__ARM_NEON) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define RTG_CONVERT_NEON 1
+#include <arm_neon.h>
+#endif
+
+static inline uint16_t load_u16_be(const uint8_t* p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof v);
+  return be16toh(v);
+}
+
+static inline uint16_t load_u16_le(const uint8_t* p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof v);
+  return le16toh(v);
+}
+
+static inline uint32_t load_u32_be(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof v);
+  return be32toh(v);
+}
+
+static inline uint16_t rgb565_passthrough(uint16_t v) {
+  return v;
+}
+
+static inline uint16_t rgb555_to_rgb565(uint16_t v) {
+  uint16_t r = (v >> 10) & 0x1F;
+  uint16_t g = (v >> 5) & 0x1F;
+  uint16_t b = v & 0x1F;
+  uint16_t g6 = (uint16_t)((g << 1) | (g >> 4));
+  return (uint16_t)((r << 11) | (g6 << 5) | b);
+}
+
+static inline uint16_t bgr565_to_rgb565(uint16_t v) {
+  uint16_t b = (v >> 11) & 0x1F;
+  uint16_t g = (v >> 5) & 0x3F;
+  uint16_t r = v & 0x1F;
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static inline uint16_t bgr555_to_rgb565(uint16_t v) {
+  uint16_t b = (v >> 10) & 0x1F;
+  uint16_t g = (v >> 5) & 0x1F;
+  uint16_t r = v & 0x1F;
+  uint16_t g6 = (uint16_t)((g << 1) | (g >> 4));
+  return (uint16_t)((r << 11) | (g6 << 5) | b);
+}
+
+static inline uint8_t clamp_u8(int v) {
+  if (v < 0) {
+    return 0;
+  }
+  if (v > 255) {
+    return 255;
+  }
+  return (uint8_t)v;
+}
+
+static inline uint32_t pack_rgba(uint8_t r, uint8_t g, uint8_t b) {
+  return 0xFF000000u | ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
+}
+
+// BT.601 studio swing, 8.8 fixed point.
+static inline uint32_t yuv601_to_rgba(uint8_t y, uint8_t u, uint8_t v) {
+  int c = (int)y - 16;
+  int d = (int)u - 128;
+  int e = (int)v - 128;
+  int r = (298 * c + 409 * e + 128) >> 8;
+  int g = (298 * c - 100 * d - 208 * e + 128) >> 8;
+  int b = (298 * c + 516 * d + 128) >> 8;
+  return pack_rgba(clamp_u8(r), clamp_u8(g), clamp_u8(b));
+}
+
+/*
+ * Scalar converters. These are the reference the NEON versions are checked
+ * against (tools/rtg_convert_bench.c) and handle the row tails for them.
+ */
+
+#define CONV16_SCALAR(name, load, xform)                                              \
+  static void name##_scalar(void* dst_, const uint8_t* src, size_t pixels,            \
+                            const uint32_t* palette) {                                \
+    uint16_t* dst = dst_;                                                             \
+    (void)palette;                                                                    \
+    for (size_t x = 0; x < pixels; x++) {                                             \
+      dst[x] = xform(load(src + (x * 2)));                                            \
+    }                                                                                 \
+  }
+
+CONV16_SCALAR(conv_rgb565_be, load_u16_be, rgb565_passthrough)
+CONV16_SCALAR(conv_rgb555_be, load_u16_be, rgb555_to_rgb565)
+CONV16_SCALAR(conv_rgb555_le, load_u16_le, rgb555_to_rgb565)
+CONV16_SCALAR(conv_bgr565_le, load_u16_le, bgr565_to_rgb565)
+CONV16_SCALAR(conv_bgr555_le, load_u16_le, bgr555_to_rgb565)
+
+// Byte positions of Y0, Y1, U and V inside one 4-byte YUV422 pixel pair.
+struct yuv422_order {
+  uint8_t y0;
+  uint8_t y1;
+  uint8_t u;
+  uint8_t v;
+};
+
+static const struct yuv422_order yuv422_cgx = {0, 2, 3, 1};  // Y0 V0 Y1 U0
+static const struct yuv422_order yuv422_std = {2, 0, 1, 3};  // Y1 U0 Y0 V0
+static const struct yuv422_order yuv422_pc = {1, 3, 2, 0};   // V0 Y0 U0 Y1
+static const struct yuv422_order yuv422_pa = {0, 1, 3, 2};   // Y0 Y1 V0 U0
+static const struct yuv422_order yuv422_papc = {3, 2, 0, 1}; // U0 V0 Y1 Y0
+
+static inline void yuv422_to_rgba(uint32_t* dst, const uint8_t* src, size_t pixels,
+                                  struct yuv422_order o) {
+  size_t x = 0;
+  for (; x + 1 < pixels; x += 2) {
+    dst[x] = yuv601_to_rgba(src[o.y0], src[o.u], src[o.v]);
+    dst[x + 1] = yuv601_to_rgba(src[o.y1], src[o.u], src[o.v]);
+    src += 4;
+  }
+  if (x < pixels) {
+    dst[x] = yuv601_to_rgba(src[0], 128, 128);
+  }
+}
+
+static inline uint8_t expand5(uint8_t v) {
+  return (uint8_t)((v << 3) | (v >> 2));
+}
+
+static inline uint8_t expand6(uint8_t v) {
+  return (uint8_t)((v << 2) | (v >> 4));
+}
+
+// Four pixels per 32-bit word: U6 Ya5 Yb5 V6 Yc5 Yd5, big-endian unless PC.
+static inline void yuv411_to_rgba(uint32_t* dst, const uint8_t* src, size_t pixels, int pc) {
+  size_t x = 0;
+  for (; x + 3 < pixels; x += 4) {
+    uint32_t pack = load_u32_be(src);
+    if (pc) {
+      pack = __builtin_bswap32(pack);
+    }
+    uint8_t u0 = expand6((uint8_t)((pack >> 26) & 0x3F));
+    uint8_t v0 = expand6((uint8_t)((pack >> 10) & 0x3F));
+    dst[x] = yuv601_to_rgba(expand5((uint8_t)((pack >> 21) & 0x1F)), u0, v0);
+    dst[x + 1] = yuv601_to_rgba(expand5((uint8_t)((pack >> 16) & 0x1F)), u0, v0);
+    dst[x + 2] = yuv601_to_rgba(expand5((uint8_t)((pack >> 5) & 0x1F)), u0, v0);
+    dst[x + 3] = yuv601_to_rgba(expand5((uint8_t)(pack & 0x1F)), u0, v0);
+    src += 4;
+  }
+  for (; x < pixels; x++) {
+    dst[x] = yuv601_to_rgba(src[0], 128, 128);
+    src++;
+  }
+}
+
+#define CONV_YUV_SCALAR(name, body)                                                   \
+  static void name##_scalar(void* dst, const uint8_t* src, size_t pixels,             \
+                            const uint32_t* palette) {                                \
+    (void)palette;                                                                    \
+    body;                                                                             \
+  }
+
+CONV_YUV_SCALAR(conv_yuv422_cgx, yuv422_to_rgba(dst, src, pixels, yuv422_cgx))
+CONV_YUV_SCALAR(conv_yuv422_std, yuv422_to_rgba(dst, src, pixels, yuv422_std))
+CONV_YUV_SCALAR(conv_yuv422_pc, yuv422_to_rgba(dst, src, pixels, yuv422_pc))
+CONV_YUV_SCALAR(conv_yuv422_pa, yuv422_to_rgba(dst, src, pixels, yuv422_pa))
+CONV_YUV_SCALAR(conv_yuv422_papc, yuv422_to_rgba(dst, src, pixels, yuv422_papc))
+CONV_YUV_SCALAR(conv_yuv411, yuv411_to_rgba(dst, src, pixels, 0))
+CONV_YUV_SCALAR(conv_yuv411_pc, yuv411_to_rgba(dst, src, pixels, 1))
+
+// A 256-entry gather has no useful NEON form; unrolling is what helps here,
+// so both implementations share this one.
+static void conv_clut(void* dst_, const uint8_t* src, size_t pixels, const uint32_t* palette) {
+  uint32_t* dst = dst_;
+  size_t x = 0;
+  for (; x + 4 <= pixels; x += 4) {
+    dst[x] = palette[src[x]];
+    dst[x + 1] = palette[src[x + 1]];
+    dst[x + 2] = palette[src[x + 2]];
+    dst[x + 3] = palette[src[x + 3]];
+  }
+  for (; x < pixels; x++) {
+    dst[x] = palette[src[x]];
+  }
+}
+
+#ifdef RTG_CONVERT_NEON
+
+static inline uint16x8_t neon_load_be16(const uint8_t* src) {
+  return vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(src)));
+}
+
+static inline uint16x8_t neon_load_le16(const uint8_t* src) {
+  return vreinterpretq_u16_u8(vld1q_u8(src));
+}
+
+static inline uint16x8_t neon_rgb565_passthrough(uint16x8_t v) {
+  return v;
+}
+
+static inline uint16x8_t neon_rgb555_to_rgb565(uint16x8_t v) {
+  uint16x8_t m5 = vdupq_n_u16(0x1F);
+  uint16x8_t r = vandq_u16(vshrq_n_u16(v, 10), m5);
+  uint16x8_t g = vandq_u16(vshrq_n_u16(v, 5), m5);
+  uint16x8_t b = vandq_u16(v, m5);
+  uint16x8_t g6 = vorrq_u16(vshlq_n_u16(g, 1), vshrq_n_u16(g, 4));
+  return vorrq_u16(vorrq_u16(vshlq_n_u16(r, 11), vshlq_n_u16(g6, 5)), b);
+}
+
+static inline uint16x8_t neon_bgr565_to_rgb565(uint16x8_t v) {
+  uint16x8_t b = vshrq_n_u16(v, 11);
+  uint16x8_t g = vandq_u16(vshrq_n_u16(v, 5), vdupq_n_u16(0x3F));
+  uint16x8_t r = vandq_u16(v, vdupq_n_u16(0x1F));
+  return vorrq_u16(vorrq_u16(vshlq_n_u16(r, 11), vshlq_n_u16(g, 5)), b);
+}
+
+static inline uint16x8_t neon_bgr555_to_rgb565(uint16x8_t v) {
+  uint16x8_t m5 = vdupq_n_u16(0x1F);
+  uint16x8_t b = vandq_u16(vshrq_n_u16(v, 10), m5);
+  uint16x8_t g = vandq_u16(vshrq_n_u16(v, 5), m5);
+  uint16x8_t r = vandq_u16(v, m5);
+  uint16x8_t g6 = vorrq_u16(vshlq_n_u16(g, 1), vshrq_n_u16(g, 4));
+  return vorrq_u16(vorrq_u16(vshlq_n_u16(r, 11), vshlq_n_u16(g6, 5)), b);
+}
+
+#define CONV16_NEON(name, load, xform)                                                \
+  static void name##_neon(void* dst_, const uint8_t* src, size_t pixels,              \
+                          const uint32_t* palette) {                                  \
+    uint16_t* dst = dst_;                                                             \
+    size_t x = 0;                                                                     \
+    for (; x + 8 <= pixels; x += 8) {                                                 \
+      vst1q_u16(dst + x, xform(load(src + (x * 2))));                                 \
+    }                                                                                 \
+    name##_scalar(dst + x, src + (x * 2), pixels - x, palette);                       \
+  }
+
+CONV16_NEON(conv_rgb565_be, neon_load_be16, neon_rgb565_passthrough)
+CONV16_NEON(conv_rgb555_be, neon_load_be16, neon_rgb555_to_rgb565)
+CONV16_NEON(conv_rgb555_le, neon_load_le16, neon_rgb555_to_rgb565)
+CONV16_NEON(conv_bgr565_le, neon_load_le16, neon_bgr565_to_rgb565)
+CONV16_NEON(conv_bgr555_le, neon_load_le16, neon_bgr555_to_rgb565)
+
+// (yc + chroma) >> 8, saturated to 0..255 - the same result as clamp_u8().
+static inline uint8x8_t neon_yuv_channel(int32x4_t yc_lo, int32x4_t yc_hi, int32x4_t uv_lo,
+                                         int32x4_t uv_hi) {
+  int32x4_t lo = vshrq_n_s32(vaddq_s32(yc_lo, uv_lo), 8);
+  int32x4_t hi = vshrq_n_s32(vaddq_s32(yc_hi, uv_hi), 8);
+  return vqmovn_u16(vcombine_u16(vqmovun_s32(lo), vqmovun_s32(hi)));
+}
+
+// 16 pixels (8 pairs) per iteration; the scalar code finishes the row.
+static inline void yuv422_to_rgba_neon(uint32_t* dst, const uint8_t* src, size_t pixels,
+                                       struct yuv422_order o) {
+  size_t x = 0;
+  for (; x + 16 <= pixels; x += 16) {
+    uint8x8x4_t in = vld4_u8(src);
+    int16x8_t c0 = vreinterpretq_s16_u16(vsubl_u8(in.val[o.y0], vdup_n_u8(16)));
+    int16x8_t c1 = vreinterpretq_s16_u16(vsubl_u8(in.val[o.y1], vdup_n_u8(16)));
+    int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(in.val[o.u], vdup_n_u8(128)));
+    int16x8_t e = vreinterpretq_s16_u16(vsubl_u8(in.val[o.v], vdup_n_u8(128)));
+    int32x4_t round = vdupq_n_s32(128);
+
+    int32x4_t r_lo = vmlal_n_s16(round, vget_low_s16(e), 409);
+    int32x4_t r_hi = vmlal_n_s16(round, vget_high_s16(e), 409);
+    int32x4_t g_lo = vmlsl_n_s16(vmlsl_n_s16(round, vget_low_s16(d), 100), vget_low_s16(e), 208);
+    int32x4_t g_hi =
+        vmlsl_n_s16(vmlsl_n_s16(round, vget_high_s16(d), 100), vget_high_s16(e), 208);
+    int32x4_t b_lo = vmlal_n_s16(round, vget_low_s16(d), 516);
+    int32x4_t b_hi = vmlal_n_s16(round, vget_high_s16(d), 516);
+
+    int32x4_t y0_lo = vmull_n_s16(vget_low_s16(c0), 298);
+    int32x4_t y0_hi = vmull_n_s16(vget_high_s16(c0), 298);
+    int32x4_t y1_lo = vmull_n_s16(vget_low_s16(c1), 298);
+    int32x4_t y1_hi = vmull_n_s16(vget_high_s16(c1), 298);
+
+    uint8x8x2_t r = vzip_u8(neon_yuv_channel(y0_lo, y0_hi, r_lo, r_hi),
+                            neon_yuv_channel(y1_lo, y1_hi, r_lo, r_hi));
+    uint8x8x2_t g = vzip_u8(neon_yuv_channel(y0_lo, y0_hi, g_lo, g_hi),
+                            neon_yuv_channel(y1_lo, y1_hi, g_lo, g_hi));
+    uint8x8x2_t b = vzip_u8(neon_yuv_channel(y0_lo, y0_hi, b_lo, b_hi),
+                            neon_yuv_channel(y1_lo, y1_hi, b_lo, b_hi));
+
+    // Little-endian 0xAARRGGBB is B, G, R, A in memory.
+    uint8x16x4_t out;
+    out.val[0] = vcombine_u8(b.val[0], b.val[1]);
+    out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+    out.val[2] = vcombine_u8(r.val[0], r.val[1]);
+    out.val[3] = vdupq_n_u8(0xFF);
+    vst4q_u8((uint8_t*)(dst + x), out);
+    src += 32;
+  }
+  yuv422_to_rgba(dst + x, src, pixels - x, o);
+}
+
+static inline uint32x4_t neon_expand6(uint32x4_t pack, int shift) {
+  uint32x4_t v = vandq_u32(vshlq_u32(pack, vdupq_n_s32(-shift)), vdupq_n_u32(0x3F));
+  return vorrq_u32(vshlq_n_u32(v, 2), vshrq_n_u32(v, 4));
+}
+
+static inline uint32x4_t neon_expand5(uint32x4_t pack, int shift) {
+  uint32x4_t v = vandq_u32(vshlq_u32(pack, vdupq_n_s32(-shift)), vdupq_n_u32(0x1F));
+  return vorrq_u32(vshlq_n_u32(v, 3), vshrq_n_u32(v, 2));
+}
+
+static inline uint32x4_t neon_yuv_pixel(uint32x4_t y, int32x4_t r_uv, int32x4_t g_uv,
+                                        int32x4_t b_uv) {
+  int32x4_t zero = vdupq_n_s32(0);
+  int32x4_t max = vdupq_n_s32(255);
+  int32x4_t yc = vmulq_n_s32(vsubq_s32(vreinterpretq_s32_u32(y), vdupq_n_s32(16)), 298);
+  int32x4_t r = vminq_s32(vmaxq_s32(vshrq_n_s32(vaddq_s32(yc, r_uv), 8), zero), max);
+  int32x4_t g = vminq_s32(vmaxq_s32(vshrq_n_s32(vaddq_s32(yc, g_uv), 8), zero), max);
+  int32x4_t b = vminq_s32(vmaxq_s32(vshrq_n_s32(vaddq_s32(yc, b_uv), 8), zero), max);
+  uint32x4_t px = vorrq_u32(vshlq_n_u32(vreinterpretq_u32_s32(r), 16),
+                            vshlq_n_u32(vreinterpretq_u32_s32(g), 8));
+  return vorrq_u32(vorrq_u32(px, vreinterpretq_u32_s32(b)), vdupq_n_u32(0xFF000000u));
+}
+
+// 16 pixels (4 words) per iteration.
+static inline void yuv411_to_rgba_neon(uint32_t* dst, const uint8_t* src, size_t pixels,
+                                       int pc) {
+  size_t x = 0;
+  for (; x + 16 <= pixels; x += 16) {
+    uint8x16_t raw = vld1q_u8(src);
+    uint32x4_t pack = vreinterpretq_u32_u8(pc ? raw : vrev32q_u8(raw));
+    int32x4_t d = vsubq_s32(vreinterpretq_s32_u32(neon_expand6(pack, 26)), vdupq_n_s32(128));
+    int32x4_t e = vsubq_s32(vreinterpretq_s32_u32(neon_expand6(pack, 10)), vdupq_n_s32(128));
+    int32x4_t round = vdupq_n_s32(128);
+    int32x4_t r_uv = vmlaq_n_s32(round, e, 409);
+    int32x4_t g_uv = vmlsq_n_s32(vmlsq_n_s32(round, d, 100), e, 208);
+    int32x4_t b_uv = vmlaq_n_s32(round, d, 516);
+
+    // vst4 interleaves the four Y positions back into pixel order.
+    uint32x4x4_t out;
+    out.val[0] = neon_yuv_pixel(neon_expand5(pack, 21), r_uv, g_uv, b_uv);
+    out.val[1] = neon_yuv_pixel(neon_expand5(pack, 16), r_uv, g_uv, b_uv);
+    out.val[2] = neon_yuv_pixel(neon_expand5(pack, 5), r_uv, g_uv, b_uv);
+    out.val[3] = neon_yuv_pixel(neon_expand5(pack, 0), r_uv, g_uv, b_uv);
+    vst4q_u32(dst + x, out);
+    src += 16;
+  }
+  yuv411_to_rgba(dst + x, src, pixels - x, pc);
+}
+
+#define CONV_YUV_NEON(name, body)                                                     \
+  static void name##_neon(void* dst, const uint8_t* src, size_t pixels,               \
+                          const uint32_t* palette) {                                  \
+    (void)palette;                                                                    \
+    body;                                                                             \
+  }
+
+CONV_YUV_NEON(conv_yuv422_cgx, yuv422_to_rgba_neon(dst, src, pixels, yuv422_cgx))
+CONV_YUV_NEON(conv_yuv422_std, yuv422_to_rgba_neon(dst, src, pixels, yuv422_std))
+CONV_YUV_NEON(conv_yuv422_pc, yuv422_to_rgba_neon(dst, src, pixels, yuv422_pc))
+CONV_YUV_NEON(conv_yuv422_pa, yuv422_to_rgba_neon(dst, src, pixels, yuv422_pa))
+CONV_YUV_NEON(conv_yuv422_papc, yuv422_to_rgba_neon(dst, src, pixels, yuv422_papc))
+CONV_YUV_NEON(conv_yuv411, yuv411_to_rgba_neon(dst, src, pixels, 0))
+CONV_YUV_NEON(conv_yuv411_pc, yuv411_to_rgba_neon(dst, src, pixels, 1))
+
+#define CONV_ENTRY(fmt, name, bpp) {fmt, name##_scalar, name##_neon, bpp}
+
+#else
+
+#define CONV_ENTRY(fmt, name, bpp) {fmt, name##_scalar, name##_scalar, bpp}
+
+#endif /* RTG_CONVERT_NEON */
+
+static const struct {
+  uint16_t format;
+  rtg_convert_fn scalar;
+  rtg_convert_fn best;
+  uint8_t dst_bpp;
+} converters[] = {
+    CONV_ENTRY(RTGFMT_RGB565_BE, conv_rgb565_be, 2),
+    CONV_ENTRY(RTGFMT_RGB555_BE, conv_rgb555_be, 2),
+    CONV_ENTRY(RTGFMT_RGB555_LE, conv_rgb555_le, 2),
+    CONV_ENTRY(RTGFMT_BGR565_LE, conv_bgr565_le, 2),
+    CONV_ENTRY(RTGFMT_BGR555_LE, conv_bgr555_le, 2),
+    CONV_ENTRY(RTGFMT_YUV422_CGX, conv_yuv422_cgx, 4),
+    CONV_ENTRY(RTGFMT_YUV422, conv_yuv422_std, 4),
+    CONV_ENTRY(RTGFMT_YUV422_PC, conv_yuv422_pc, 4),
+    CONV_ENTRY(RTGFMT_YUV422_PA, conv_yuv422_pa, 4),
+    CONV_ENTRY(RTGFMT_YUV422_PAPC, conv_yuv422_papc, 4),
+    CONV_ENTRY(RTGFMT_YUV411, conv_yuv411, 4),
+    CONV_ENTRY(RTGFMT_YUV411_PC, conv_yuv411_pc, 4),
+    {RTGFMT_8BIT_CLUT, conv_clut, conv_clut, 4},
+};
+
+rtg_convert_fn rtg_convert_lookup(uint16_t format, enum rtg_convert_impl impl) {
+  for (size_t i = 0; i < sizeof(converters) / sizeof(converters[0]); i++) {
+    if (converters[i].format == format) {
+      return impl == RTG_CONVERT_SCALAR ? converters[i].scalar : converters[i].best;
+    }
+  }
+  return NULL;
+}
+
+size_t rtg_convert_dst_bpp(uint16_t format) {
+  for (size_t i = 0; i < sizeof(converters) / sizeof(converters[0]); i++) {
+    if (converters[i].format == format) {
+      return converters[i].dst_bpp;
+    }
+  }
+  return 0;
+}
+
+int rtg_convert_yuv422_order(uint16_t format, uint8_t order[4]) {
+  const struct yuv422_order* o;
+  switch (format) {
+  case RTGFMT_YUV422_CGX:
+    o = &yuv422_cgx;
+    break;
+  case RTGFMT_YUV422:
+    o = &yuv422_std;
+    break;
+  case RTGFMT_YUV422_PC:
+    o = &yuv422_pc;
+    break;
+  case RTGFMT_YUV422_PA:
+    o = &yuv422_pa;
+    break;
+  case RTGFMT_YUV422_PAPC:
+    o = &yuv422_papc;
+    break;
+  default:
+    return 0;
+  }
+  order[0] = o->y0;
+  order[1] = o->y1;
+  order[2] = o->u;
+  order[3] = o->v;
+  return 1;
+}
+
+const char* rtg_convert_impl_name(void) {
+#ifdef RTG_CONVERT_NEON
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+unsigned int rtg_collect_dirty_rows(uint8_t* dirty, uint8_t reader, size_t addr, size_t pitch,
+                                    uint16_t height, struct rtg_row_band* bands) {
+  size_t end = addr + (pitch * height);
+  unsigned int n = 0;
+
+  for (size_t p = addr >> RTG_DIRTY_SHIFT; p <= (end - 1) >> RTG_DIRTY_SHIFT; p++) {
+    if (!(__atomic_load_n(&dirty[p], __ATOMIC_RELAXED) & reader) ||
+        !(__atomic_fetch_and(&dirty[p], (uint8_t)~reader, __ATOMIC_ACQUIRE) & reader)) {
+      continue;
+    }
+    size_t lo = p << RTG_DIRTY_SHIFT;
+    size_t hi = lo + ((size_t)1 << RTG_DIRTY_SHIFT);
+    if (lo < addr) {
+      lo = addr;
+    }
+    if (hi > end) {
+      hi = end;
+    }
+    uint16_t y0 = (uint16_t)((lo - addr) / pitch);
+    uint16_t y1 = (uint16_t)(((hi - 1 - addr) / pitch) + 1);
+    if (n && y0 <= bands[n - 1].y1 + RTG_BAND_MERGE_ROWS) {
+      if (y1 > bands[n - 1].y1) {
+        bands[n - 1].y1 = y1;
+      }
+    } else if (n < RTG_MAX_BANDS) {
+      bands[n].y0 = y0;
+      bands[n].y1 = y1;
+      n++;
+    } else {
+      bands[n - 1].y1 = y1;
+    }
+  }
+  return n;
+}
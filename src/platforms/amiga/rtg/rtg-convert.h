@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_RTG_CONVERT_H
+#define PISTORM_RTG_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Row converters for the RTG formats the display thread has to expand on the
+ * CPU before texture upload:
+ *
+ *   RGB565_BE, RGB555_BE/LE, BGR565_LE, BGR555_LE -> RGB565 (uint16_t)
+ *   YUV422 (all orders), YUV411, YUV411_PC        -> 0xAARRGGBB (uint32_t)
+ *   8BIT_CLUT (CPU CLUT mode)                      -> palette[] (uint32_t)
+ *
+ * Look the converter up once per frame (or band) so the format switch stays
+ * out of the per-pixel path. RTG_CONVERT_BEST picks the NEON version when the
+ * build has it, RTG_CONVERT_SCALAR always returns the portable one; both
+ * produce bit-identical output.
+ */
+
+enum rtg_convert_impl {
+  RTG_CONVERT_BEST,
+  RTG_CONVERT_SCALAR,
+};
+
+// Convert one row of `pixels` pixels from `src` (RTG VRAM, any alignment)
+// into `dst`. palette is only used by the CLUT converter.
+typedef void (*rtg_convert_fn)(void* dst, const uint8_t* src, size_t pixels,
+                               const uint32_t* palette);
+
+// Returns NULL for formats that are uploaded as-is or handled by a shader.
+rtg_convert_fn rtg_convert_lookup(uint16_t format, enum rtg_convert_impl impl);
+
+// Bytes per destination pixel for a format that has a converter, else 0.
+size_t rtg_convert_dst_bpp(uint16_t format);
+
+// Byte positions of Y0, Y1, U and V inside one 4-byte pixel pair of a
+// YUV422 format, for code that unpacks the raw pairs itself (the conversion
+// shaders). Returns 0 for other formats.
+int rtg_convert_yuv422_order(uint16_t format, uint8_t order[4]);
+
+// "neon" or "scalar".
+const char* rtg_convert_impl_name(void);
+
+// Rows [y0, y1) of the visible framebuffer that need converting and uploading.
+struct rtg_row_band {
+  uint16_t y0;
+  uint16_t y1;
+};
+
+#define RTG_MAX_BANDS 32
+// Bands closer than this are merged; one taller upload beats many small ones.
+#define RTG_BAND_MERGE_ROWS 8
+
+// Clear the `reader` bit (RTG_DIRTY_DISPLAY, RTG_DIRTY_VNC) of the RTG dirty
+// map pages (see rtg.h) covering the visible framebuffer and turn the pages
+// that had it set into at most RTG_MAX_BANDS row bands. The caller has
+// validated addr/pitch/height against VRAM.
+unsigned int rtg_collect_dirty_rows(uint8_t* dirty, uint8_t reader, size_t addr, size_t pitch,
+                                    uint16_t height, struct rtg_row_band* bands);
+
+#endif /* PISTORM_RTG_CONVERT_H */
@@ -5,6 +5,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "config_file/config_file.h"
 #ifndef FAKESTORM
 #include "gpio/ps_protocol.h"
@@ -49,12 +50,12 @@ static inline size_t rtg_index_offset(int index, size_t element_size) {
     return (size_t)index * element_size;
 }
 
-extern uint32_t rtg_address[8];
-extern uint32_t rtg_address_adj[8];
+extern __thread uint32_t rtg_address[8];
+extern __thread uint32_t rtg_address_adj[8];
 extern uint8_t* rtg_mem; // FIXME
-extern uint16_t rtg_user[8];
-extern uint16_t rtg_x[8], rtg_y[8];
-extern uint16_t rtg_format;
+extern __thread uint16_t rtg_user[8];
+extern __thread uint16_t rtg_x[8], rtg_y[8];
+extern __thread uint16_t rtg_format;
 extern uint16_t rtg_display_format;
 
 extern uint32_t framebuffer_addr;
@@ -62,7 +63,6 @@ extern uint32_t framebuffer_addr_adj;
 
 extern uint8_t realtime_graphics_debug;
 
-static const size_t rtg_mem_size = 40u * SIZE_MEGA;
 static uint32_t rtg_oob_log_count = 0;
 
 static int rtg_calc_span(size_t x_bytes, uint16_t w, uint16_t h, uint16_t pitch, size_t bpp,
@@ -123,43 +123,758 @@ static int rtg_get_ptr_checked(uint32_t base_adj, uint16_t x, uint16_t y, uint16
   return 1;
 }
 
-void rtg_fillrect_solid(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint32_t color,
-                        uint16_t pitch, uint16_t format) {
-  uint8_t* dptr = NULL;
-  if (!rtg_get_ptr_checked(rtg_address_adj[0], x, y, w, h, pitch, format, "fillrect_solid",
-                           &dptr)) {
-    return;
+// Destination lookups also queue the written span for the output dirty map.
+static int rtg_get_dst_ptr_checked(uint32_t base_adj, uint16_t x, uint16_t y, uint16_t w,
+                                   uint16_t h, uint16_t pitch, uint16_t format, const char* tag,
+                                   uint8_t** out_ptr) {
+  if (!rtg_get_ptr_checked(base_adj, x, y, w, h, pitch, format, tag, out_ptr)) {
+    return 0;
   }
-  switch (format) {
-  case RTGFMT_8BIT_CLUT: {
-    for (int xs = 0; xs < w; xs++) {
-      dptr[xs] = color & 0xFF;
-    }
-    break;
+  size_t bpp = rtg_pixel_size[format];
+  size_t span = 0;
+  if (rtg_calc_span((size_t)x * bpp, w, h, pitch, bpp, &span)) {
+    rtg_gfx_defer_dirty(*out_ptr, span);
+  }
+  return 1;
+}
+
+/*
+ * Span kernels for the 8/16/32-bit formats. They work on 64-bit words (8, 4
+ * or 2 pixels) with colors pre-expanded to the exact bytes rtg_store_pixel()
+ * would write, so the output is byte-identical to the per-pixel loops that
+ * follow each of them. Those loops stay as the path for the other formats
+ * (whose pixel helpers only touch one byte per pixel) and as the reference;
+ * rtg_gfx_scalar forces them for comparison, see tools/rtg_gfx_bench.c.
+ */
+uint8_t rtg_gfx_scalar = 0;
+
+static inline uint64_t rtg_ld64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+static inline void rtg_st64(uint8_t* p, uint64_t v) {
+  memcpy(p, &v, sizeof v);
+}
+
+// Partial words for the span tails; only the first n bytes are touched.
+static inline uint64_t rtg_ld_tail(const uint8_t* p, size_t n) {
+  uint64_t v = 0;
+  memcpy(&v, p, n);
+  return v;
+}
+
+static inline void rtg_st_tail(uint8_t* p, uint64_t v, size_t n) {
+  memcpy(p, &v, n);
+}
+
+static inline uint64_t rtg_rep8(uint8_t b) {
+  return 0x0101010101010101ull * b;
+}
+
+// Bytes per pixel the span kernels handle for a format, or 0 when the
+// per-pixel path has to run.
+static inline size_t rtg_span_bpp(uint16_t format) {
+  if (rtg_gfx_scalar) {
+    return 0;
   }
+  switch (format) {
+  case RTGFMT_8BIT_CLUT:
+    return 1;
   case RTGFMT_RGB565_LE:
   case RTGFMT_RGB565_BE:
   case RTGFMT_BGR565_LE:
   case RTGFMT_RGB555_LE:
   case RTGFMT_RGB555_BE:
-  case RTGFMT_BGR555_LE: {
-    uint16_t color16 = (color & 0xFFFF);
-    for (int xs = 0; xs < w; xs++) {
-      size_t offset = (size_t)xs * sizeof(uint16_t);
-      store_u16_be(&dptr[offset], color16);
-    }
-    break;
-  }
+  case RTGFMT_BGR555_LE:
+    return 2;
   case RTGFMT_RGB32_ABGR:
   case RTGFMT_RGB32_ARGB:
   case RTGFMT_RGB32_BGRA:
-  case RTGFMT_RGB32_RGBA: {
-    for (int xs = 0; xs < w; xs++) {
-      size_t offset = (size_t)xs * sizeof(uint32_t);
-      store_u32_be(&dptr[offset], color);
+  case RTGFMT_RGB32_RGBA:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+// A word of pixels holding value, laid out as rtg_store_pixel() stores it.
+static inline uint64_t rtg_span_pattern(uint32_t value, uint16_t format, size_t bpp) {
+  uint8_t bytes[8];
+  for (size_t i = 0; i < sizeof(bytes); i += bpp) {
+    rtg_store_pixel(&bytes[i], format, value);
+  }
+  return rtg_ld64(bytes);
+}
+
+static void rtg_span_fill(uint8_t* d, uint64_t pat, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    rtg_st64(d + i, pat);
+  }
+  if (i < n) {
+    rtg_st_tail(d + i, pat, n - i);
+  }
+}
+
+static void rtg_span_xor(uint8_t* d, uint64_t x, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    rtg_st64(d + i, rtg_ld64(d + i) ^ x);
+  }
+  if (i < n) {
+    rtg_st_tail(d + i, rtg_ld_tail(d + i, n - i) ^ x, n - i);
+  }
+}
+
+// rtg_store_pixel_mask() for CLUT: d = value ^ (d & ~mask).
+static void rtg_span_fill_masked(uint8_t* d, uint64_t pat, uint64_t keep, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    rtg_st64(d + i, pat ^ (rtg_ld64(d + i) & keep));
+  }
+  if (i < n) {
+    rtg_st_tail(d + i, pat ^ (rtg_ld_tail(d + i, n - i) & keep), n - i);
+  }
+}
+
+// Swap the bytes of each 16/32-bit pixel in a word (load_*_be + native store).
+static inline uint64_t rtg_swap_pixels(uint64_t v, size_t bpp) {
+  if (bpp == 2) {
+    return ((v >> 8) & 0x00FF00FF00FF00FFull) | ((v & 0x00FF00FF00FF00FFull) << 8);
+  }
+  if (bpp == 4) {
+    v = __builtin_bswap64(v);
+    return (v >> 32) | (v << 32);
+  }
+  return v;
+}
+
+// The masked BlitRect pixel op on a word: CLUT stores s ^ (d & ~mask), the
+// direct-colour formats store the source with its pixel bytes swapped.
+static inline uint64_t rtg_blit_word(uint64_t s, uint64_t d, uint64_t keep, size_t bpp) {
+  return bpp == 1 ? s ^ (d & keep) : rtg_swap_pixels(s, bpp);
+}
+
+// Row copy in either direction, so overlapping rows see the same values the
+// per-pixel loop would. n is a multiple of bpp, so end-aligned words still
+// cover whole pixels.
+static void rtg_span_blit(uint8_t* d, const uint8_t* s, size_t n, uint64_t keep, size_t bpp,
+                          int forward) {
+  if (forward) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      rtg_st64(d + i, rtg_blit_word(rtg_ld64(s + i), rtg_ld64(d + i), keep, bpp));
+    }
+    if (i < n) {
+      uint64_t v = rtg_blit_word(rtg_ld_tail(s + i, n - i), rtg_ld_tail(d + i, n - i), keep, bpp);
+      rtg_st_tail(d + i, v, n - i);
+    }
+  } else {
+    size_t i = n;
+    for (; i >= 8; i -= 8) {
+      rtg_st64(d + i - 8, rtg_blit_word(rtg_ld64(s + i - 8), rtg_ld64(d + i - 8), keep, bpp));
+    }
+    if (i) {
+      rtg_st_tail(d, rtg_blit_word(rtg_ld_tail(s, i), rtg_ld_tail(d, i), keep, bpp), i);
+    }
+  }
+}
+
+// HANDLE_MINTERM_PIXEL for eight CLUT pixels. *s is updated for the minterms
+// that modify their source operand; m is the replicated write mask.
+static inline uint64_t rtg_minterm_word(uint8_t minterm, uint64_t* s, uint64_t d, uint64_t m) {
+  uint64_t keep = ~m;
+  switch (minterm) {
+  case MINTERM_NOR:
+  case MINTERM_ONLYSRC:
+    *s &= ~d;
+    return *s ^ (d & keep);
+  case MINTERM_ONLYDST:
+    return d & ~*s;
+  case MINTERM_NOTSRC:
+  case MINTERM_SRC:
+    return *s ^ (d & keep);
+  case MINTERM_INVERT:
+    return ~d;
+  case MINTERM_EOR:
+    return d ^ *s;
+  case MINTERM_NAND:
+    *s = ~(d & ~*s) & m;
+    return *s ^ (d & keep);
+  case MINTERM_AND:
+    *s &= d;
+    return *s ^ (d & keep);
+  case MINTERM_NEOR:
+    return d ^ (*s & m);
+  case MINTERM_NOTONLYSRC:
+  case MINTERM_OR:
+    return d | (*s & m);
+  case MINTERM_NOTONLYDST:
+    *s = ~(d & *s) & m;
+    return *s ^ (d & keep);
+  default:
+    return d;
+  }
+}
+
+static inline int rtg_minterm_writes_src(uint8_t minterm) {
+  return minterm == MINTERM_NOR || minterm == MINTERM_ONLYSRC || minterm == MINTERM_NAND ||
+         minterm == MINTERM_AND || minterm == MINTERM_NOTONLYDST;
+}
+
+static void rtg_span_minterm(uint8_t* d, uint8_t* s, size_t n, uint8_t minterm, uint64_t m,
+                             int write_src) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t sv = rtg_ld64(s + i);
+    uint64_t dv = rtg_minterm_word(minterm, &sv, rtg_ld64(d + i), m);
+    if (write_src) {
+      rtg_st64(s + i, sv);
     }
+    rtg_st64(d + i, dv);
+  }
+  if (i < n) {
+    uint64_t sv = rtg_ld_tail(s + i, n - i);
+    uint64_t dv = rtg_minterm_word(minterm, &sv, rtg_ld_tail(d + i, n - i), m);
+    if (write_src) {
+      rtg_st_tail(s + i, sv, n - i);
+    }
+    rtg_st_tail(d + i, dv, n - i);
+  }
+}
+
+// Whether the byte ranges of a w x h CLUT source and destination rectangle
+// intersect. sptr/dptr point at the first row processed; a negative step
+// means the rows run bottom-up.
+static int rtg_blit_overlaps(const uint8_t* sptr, const uint8_t* dptr, uint16_t w, uint16_t h,
+                             uint16_t srcpitch, uint16_t dstpitch, int32_t src_pitchstep) {
+  if (!w || !h) {
+    return 0;
+  }
+  const uint8_t* s_lo = sptr;
+  const uint8_t* d_lo = dptr;
+  if (src_pitchstep < 0) {
+    s_lo -= (size_t)(h - 1) * srcpitch;
+    d_lo -= (size_t)(h - 1) * dstpitch;
+  }
+  const uint8_t* s_hi = s_lo + ((size_t)(h - 1) * srcpitch) + w;
+  const uint8_t* d_hi = d_lo + ((size_t)(h - 1) * dstpitch) + w;
+  return s_lo < d_hi && d_lo < s_hi;
+}
+
+/*
+ * 1bpp expansion (BlitTemplate, BlitPattern, patterned lines). rtg_bit_mask
+ * turns one template byte into byte masks for its 8 pixels, MSB first:
+ * [0] for 8-bit (one word), [1] for 16-bit (two), [2] for 32-bit (four).
+ */
+static uint64_t rtg_bit_mask[3][256][4];
+static pthread_once_t rtg_bit_mask_once = PTHREAD_ONCE_INIT;
+
+static void rtg_bit_mask_init(void) {
+  for (unsigned int k = 0; k < 3; k++) {
+    size_t bpp = (size_t)1 << k;
+    for (unsigned int bits = 0; bits < 256; bits++) {
+      uint8_t bytes[32] = {0};
+      for (size_t i = 0; i < 8; i++) {
+        if (bits & (0x80u >> i)) {
+          memset(&bytes[i * bpp], 0xFF, bpp);
+        }
+      }
+      memcpy(rtg_bit_mask[k][bits], bytes, sizeof(bytes));
+    }
+  }
+}
+
+static inline const uint64_t* rtg_bits_to_mask(uint8_t bits, size_t bpp) {
+  return rtg_bit_mask[bpp == 1 ? 0 : (bpp == 2 ? 1 : 2)][bits];
+}
+
+struct rtg_expand {
+  uint16_t format;
+  size_t bpp;
+  uint8_t draw_mode; // JAM1, JAM2 or COMPLEMENT
+  uint8_t masked;    // CLUT with a partial mask: stores go through the mask
+  uint8_t fast_fg;   // JAM2 full bytes store fg unmasked, like SET_RTG_PIXELS2_COND_MASK
+  uint8_t mask;
+  uint32_t fg;
+  uint32_t bg;
+  uint64_t fg_pat;
+  uint64_t bg_pat;
+  uint64_t keep;
+  uint64_t inv;
+};
+
+static void rtg_expand_setup(struct rtg_expand* e, uint16_t format, size_t bpp, uint8_t draw_mode,
+                             uint32_t fg, uint32_t bg, uint8_t mask, uint8_t fast_fg) {
+  pthread_once(&rtg_bit_mask_once, rtg_bit_mask_init);
+  e->format = format;
+  e->bpp = bpp;
+  e->draw_mode = draw_mode;
+  e->masked = (mask != 0xFF && format == RTGFMT_8BIT_CLUT);
+  e->fast_fg = fast_fg;
+  e->mask = mask;
+  e->fg = fg;
+  e->bg = bg;
+  e->fg_pat = rtg_span_pattern(fg, format, bpp);
+  e->bg_pat = rtg_span_pattern(bg, format, bpp);
+  e->keep = ~rtg_rep8(mask);
+  e->inv = (format == RTGFMT_8BIT_CLUT) ? rtg_rep8(mask) : ~0ull;
+}
+
+// Single pixel, as the per-bit loops draw it.
+static inline void rtg_expand_pixel(const struct rtg_expand* e, uint8_t* p, int set) {
+  switch (e->draw_mode) {
+  case DRAWMODE_JAM1:
+    if (!set) {
+      break;
+    }
+    if (e->masked) {
+      rtg_store_pixel_mask(p, e->format, e->fg, e->mask);
+    } else {
+      rtg_store_pixel(p, e->format, e->fg);
+    }
+    break;
+  case DRAWMODE_JAM2:
+    if (e->masked) {
+      rtg_store_pixel_mask(p, e->format, set ? e->fg : e->bg, e->mask);
+    } else {
+      rtg_store_pixel(p, e->format, set ? e->fg : e->bg);
+    }
+    break;
+  case DRAWMODE_COMPLEMENT:
+    if (set) {
+      rtg_invert_pixel(p, e->format, e->mask);
+    }
+    break;
+  }
+}
+
+// Eight pixels from one template byte. fast is set for the bytes the
+// per-pixel code draws with its 8-at-a-time macros.
+static inline void rtg_expand_byte(const struct rtg_expand* e, uint8_t* p, uint8_t bits, int fast) {
+  const uint64_t* bm = rtg_bits_to_mask(bits, e->bpp);
+  for (size_t i = 0; i < e->bpp; i++) {
+    uint64_t b = bm[i];
+    uint8_t* wp = p + (i * 8);
+    switch (e->draw_mode) {
+    case DRAWMODE_JAM1: {
+      uint64_t d = rtg_ld64(wp);
+      uint64_t v = e->masked ? e->fg_pat ^ (d & e->keep) : e->fg_pat;
+      rtg_st64(wp, (d & ~b) | (v & b));
+      break;
+    }
+    case DRAWMODE_JAM2:
+      if (!e->masked) {
+        rtg_st64(wp, (e->fg_pat & b) | (e->bg_pat & ~b));
+      } else {
+        uint64_t d = rtg_ld64(wp);
+        uint64_t fg = (fast && e->fast_fg) ? e->fg_pat : e->fg_pat ^ (d & e->keep);
+        uint64_t bg = e->bg_pat ^ (d & e->keep);
+        rtg_st64(wp, (fg & b) | (bg & ~b));
+      }
+      break;
+    case DRAWMODE_COMPLEMENT:
+      rtg_st64(wp, rtg_ld64(wp) ^ (b & e->inv));
+      break;
+    }
+  }
+}
+
+// One row: pixel xs takes bit (first_bit + xs) of bits[], MSB first.
+static void rtg_expand_row(const struct rtg_expand* e, uint8_t* dptr, size_t w,
+                           unsigned int first_bit, const uint8_t* bits) {
+  size_t xs = 0;
+  size_t k = 0;
+  if (first_bit) {
+    for (uint8_t bit = (uint8_t)(0x80 >> first_bit); bit && xs < w; bit >>= 1, xs++) {
+      rtg_expand_pixel(e, dptr + (xs * e->bpp), bits[0] & bit);
+    }
+    k = 1;
+  }
+  for (; xs + 8 <= w; xs += 8, k++) {
+    rtg_expand_byte(e, dptr + (xs * e->bpp), bits[k], xs + 8 < w);
+  }
+  for (uint8_t bit = 0x80; xs < w; bit >>= 1, xs++) {
+    rtg_expand_pixel(e, dptr + (xs * e->bpp), bits[k] & bit);
+  }
+}
+
+// Bytes of template data one row of w pixels starting at first_bit covers.
+#define RTG_ROW_BITS_MAX (((UINT16_MAX + 7) / 8) + 2)
+
+/*
+ * Planar to chunky for P2C/P2D: decodes one row of w pixels into out[] (one
+ * plane-bit index per byte). The source byte walk, including its 8-bit wrap,
+ * matches the per-pixel loop. out must have 8 bytes of slack on both sides.
+ */
+static void rtg_planar_row(uint8_t* out, size_t w, unsigned int first_bit, uint8_t base_byte,
+                           uint16_t src_line_pitch, const uint8_t* bmp_data, uint32_t plane_size,
+                           uint8_t planes, uint8_t layer_mask, int inverted) {
+  pthread_once(&rtg_bit_mask_once, rtg_bit_mask_init);
+  uint8_t nplanes = planes <= 8 ? planes : 0;
+  uint8_t cur_byte = base_byte;
+  uint8_t* o = out - first_bit;
+  for (size_t px = 0; px < first_bit + w; px += 8) {
+    uint64_t v = 0;
+    for (uint8_t p = 0; p < nplanes; p++) {
+      if (layer_mask & (1u << p)) {
+        uint8_t b = bmp_data[(plane_size * p) + cur_byte];
+        if (inverted) {
+          b ^= 0xFF;
+        }
+        v |= rtg_bit_mask[0][b][0] & rtg_rep8((uint8_t)(1u << p));
+      }
+    }
+    rtg_st64(o + px, v);
+    cur_byte++;
+    cur_byte = (uint8_t)(cur_byte % src_line_pitch);
+  }
+}
+
+/*
+ * Worker pool for large operations (rtg-threads / PISTORM_RTG_THREADS).
+ *
+ * Once an operation has passed its bounds checks and touches at least
+ * RTG_PAR_MIN_BYTES, it is cut into row bands or column strips that the
+ * calling thread and up to rtg-threads - 1 helpers run through the same public
+ * entry point, one piece per call. Smaller operations, and everything when the
+ * pool is off, never leave the calling thread.
+ *
+ * Blits keep their copy direction: non-overlapping or same-row blits split
+ * into row bands, vertical scrolls (same columns) into column strips, and any
+ * other overlapping blit runs on one thread. P2C/P2D decode their planes with
+ * a plane size of src_pitch * h, so they split into column strips only.
+ */
+#define RTG_PAR_MAX_THREADS 8
+#define RTG_PAR_MIN_BYTES (256u * 1024u)
+#define RTG_PAR_MIN_PIECE (64u * 1024u)
+
+enum rtg_par_op {
+  RTG_PAR_FILLRECT_SOLID,
+  RTG_PAR_FILLRECT,
+  RTG_PAR_INVERTRECT,
+  RTG_PAR_BLITRECT,
+  RTG_PAR_BLITRECT_SOLID,
+  RTG_PAR_P2C,
+  RTG_PAR_P2D,
+};
+
+struct rtg_par_job {
+  enum rtg_par_op op;
+  int16_t x, y, dx, dy, w, h;
+  uint32_t color;
+  uint16_t pitch, format, src_pitch;
+  uint8_t mask, draw_mode, planes, layer_mask;
+  uint8_t* src;
+  // Registers the primitives read besides their arguments.
+  uint32_t adj[2];
+  uint16_t reg_pitch, reg_format;
+  // Split along columns (else rows), in pieces of a multiple of align.
+  uint8_t columns;
+  uint16_t align;
+  unsigned int parts;
+  unsigned int next, done;
+};
+
+static unsigned int rtg_par_config = 1;
+static unsigned int rtg_par_threads;  // 0 until the pool has been set up
+static unsigned int rtg_par_helpers;
+static pthread_t rtg_par_tid[RTG_PAR_MAX_THREADS];
+static pthread_mutex_t rtg_par_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rtg_par_go = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t rtg_par_idle = PTHREAD_COND_INITIALIZER;
+static struct rtg_par_job rtg_par_current;
+static struct rtg_par_job* rtg_par_posted;
+static uint64_t rtg_par_gen;
+static unsigned int rtg_par_busy;
+static uint8_t rtg_par_quit;
+// Set while a thread runs one piece, so the nested call does not split again.
+static __thread uint8_t rtg_par_in_piece;
+// Bytes a P2C/P2D strip moves its row pointer back, see rtg_par_run_piece().
+static __thread size_t rtg_par_dst_skew;
+
+static void rtg_par_run_piece(const struct rtg_par_job* job, unsigned int piece) {
+  unsigned int len = (unsigned int)(job->columns ? job->w : job->h);
+  unsigned int lo = (unsigned int)(((uint64_t)len * piece / job->parts) / job->align * job->align);
+  unsigned int hi = (piece + 1 == job->parts)
+                        ? len
+                        : (unsigned int)(((uint64_t)len * (piece + 1) / job->parts) / job->align *
+                                         job->align);
+  if (lo >= hi) {
+    return;
+  }
+  int16_t cx = job->columns ? (int16_t)lo : 0, cy = job->columns ? 0 : (int16_t)lo;
+  int16_t w = job->columns ? (int16_t)(hi - lo) : job->w;
+  int16_t h = job->columns ? job->h : (int16_t)(hi - lo);
+
+  uint32_t adj0 = rtg_address_adj[0], adj1 = rtg_address_adj[1];
+  uint16_t reg_pitch = rtg_x[3], reg_format = rtg_format;
+  rtg_address_adj[0] = job->adj[0];
+  rtg_address_adj[1] = job->adj[1];
+  rtg_x[3] = job->reg_pitch;
+  rtg_format = job->reg_format;
+  rtg_par_in_piece = 1;
+
+  switch (job->op) {
+  case RTG_PAR_FILLRECT_SOLID:
+    rtg_fillrect_solid((uint16_t)(job->x + cx), (uint16_t)(job->y + cy), (uint16_t)w, (uint16_t)h,
+                       job->color, job->pitch, job->format);
+    break;
+  case RTG_PAR_FILLRECT:
+    rtg_fillrect((uint16_t)(job->x + cx), (uint16_t)(job->y + cy), (uint16_t)w, (uint16_t)h,
+                 job->color, job->pitch, job->format, job->mask);
+    break;
+  case RTG_PAR_INVERTRECT:
+    rtg_invertrect((uint16_t)(job->x + cx), (uint16_t)(job->y + cy), (uint16_t)w, (uint16_t)h,
+                   job->pitch, job->format, job->mask);
+    break;
+  case RTG_PAR_BLITRECT:
+    rtg_blitrect((uint16_t)(job->x + cx), (uint16_t)(job->y + cy), (uint16_t)(job->dx + cx),
+                 (uint16_t)(job->dy + cy), (uint16_t)w, (uint16_t)h, job->pitch, job->format,
+                 job->mask);
+    break;
+  case RTG_PAR_BLITRECT_SOLID:
+    rtg_blitrect_solid((uint16_t)(job->x + cx), (uint16_t)(job->y + cy), (uint16_t)(job->dx + cx),
+                       (uint16_t)(job->dy + cy), (uint16_t)w, (uint16_t)h, job->pitch,
+                       job->format);
+    break;
+  case RTG_PAR_P2C:
+  case RTG_PAR_P2D:
+    // The destination is indexed with the absolute x on top of the dx-adjusted row pointer,
+    // so the strip moves that pointer back by its offset to land on the same pixels.
+    rtg_par_dst_skew = (size_t)cx * rtg_pixel_size[job->reg_format];
+    if (job->op == RTG_PAR_P2C) {
+      rtg_p2c((int16_t)(job->x + cx), job->y, (int16_t)(job->dx + cx), job->dy, w, job->h,
+              job->draw_mode, job->planes, job->mask, job->layer_mask, job->src_pitch, job->src);
+    } else {
+      rtg_p2d((int16_t)(job->x + cx), job->y, (int16_t)(job->dx + cx), job->dy, w, job->h,
+              job->draw_mode, job->planes, job->mask, job->layer_mask, job->src_pitch, job->src);
+    }
+    rtg_par_dst_skew = 0;
     break;
   }
+
+  rtg_par_in_piece = 0;
+  rtg_address_adj[0] = adj0;
+  rtg_address_adj[1] = adj1;
+  rtg_x[3] = reg_pitch;
+  rtg_format = reg_format;
+}
+
+static void rtg_par_work(struct rtg_par_job* job) {
+  unsigned int piece;
+  while ((piece = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->parts) {
+    rtg_par_run_piece(job, piece);
+    __atomic_fetch_add(&job->done, 1, __ATOMIC_RELEASE);
+  }
+}
+
+static void* rtg_par_task(void* arg) {
+  (void)arg;
+  uint64_t seen = 0;
+  pthread_mutex_lock(&rtg_par_lock);
+  for (;;) {
+    while (rtg_par_gen == seen && !rtg_par_quit) {
+      pthread_cond_wait(&rtg_par_go, &rtg_par_lock);
+    }
+    if (rtg_par_quit) {
+      break;
+    }
+    seen = rtg_par_gen;
+    struct rtg_par_job* job = rtg_par_posted;
+    if (!job) {
+      continue;
+    }
+    rtg_par_busy++;
+    pthread_mutex_unlock(&rtg_par_lock);
+
+    rtg_par_work(job);
+    // Helpers publish their own share of the dirty span.
+    rtg_gfx_flush_dirty();
+
+    pthread_mutex_lock(&rtg_par_lock);
+    if (--rtg_par_busy == 0) {
+      pthread_cond_signal(&rtg_par_idle);
+    }
+  }
+  pthread_mutex_unlock(&rtg_par_lock);
+  return NULL;
+}
+
+static void rtg_par_setup(void) {
+  unsigned int threads = rtg_par_config;
+  const char* env = getenv("PISTORM_RTG_THREADS");
+  if (env && *env) {
+    threads = (unsigned int)atoi(env);
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+  if (threads > RTG_PAR_MAX_THREADS) {
+    threads = RTG_PAR_MAX_THREADS;
+  }
+
+  rtg_par_quit = 0;
+  rtg_par_helpers = 0;
+  for (unsigned int i = 0; i + 1 < threads; i++) {
+    if (pthread_create(&rtg_par_tid[i], NULL, &rtg_par_task, NULL) != 0) {
+      LOG_WARN("[RTG] Could only start %u of %u drawing helper threads.\n", i, threads - 1);
+      break;
+    }
+    rtg_par_helpers++;
+  }
+  rtg_par_threads = rtg_par_helpers + 1;
+  if (rtg_par_threads > 1) {
+    LOG_INFO("[RTG] Splitting large drawing operations across %u threads.\n", rtg_par_threads);
+  }
+}
+
+void rtg_gfx_stop_threads(void) {
+  if (rtg_par_helpers) {
+    pthread_mutex_lock(&rtg_par_lock);
+    rtg_par_quit = 1;
+    pthread_cond_broadcast(&rtg_par_go);
+    pthread_mutex_unlock(&rtg_par_lock);
+    for (unsigned int i = 0; i < rtg_par_helpers; i++) {
+      pthread_join(rtg_par_tid[i], NULL);
+    }
+  }
+  rtg_par_helpers = 0;
+  rtg_par_threads = 0;
+}
+
+void rtg_gfx_set_threads(unsigned int threads) {
+  rtg_gfx_stop_threads();
+  rtg_par_config = threads;
+}
+
+// Runs job across the pool and returns 1, or returns 0 when the caller should
+// just do the whole operation itself. bytes is what the operation touches.
+static int rtg_par_split(struct rtg_par_job* job, size_t bytes) {
+  if (rtg_par_in_piece || bytes < RTG_PAR_MIN_BYTES) {
+    return 0;
+  }
+  if (!rtg_par_threads) {
+    rtg_par_setup();
+  }
+  if (rtg_par_threads < 2) {
+    return 0;
+  }
+  unsigned int len = (unsigned int)(job->columns ? job->w : job->h);
+  unsigned int parts = rtg_par_threads;
+  if (bytes / parts < RTG_PAR_MIN_PIECE) {
+    parts = (unsigned int)(bytes / RTG_PAR_MIN_PIECE);
+  }
+  if (parts > len / job->align) {
+    parts = len / job->align;
+  }
+  if (parts < 2) {
+    return 0;
+  }
+
+  job->adj[0] = rtg_address_adj[0];
+  job->adj[1] = rtg_address_adj[1];
+  job->reg_pitch = rtg_x[3];
+  job->reg_format = rtg_format;
+  job->parts = parts;
+  job->next = 0;
+  job->done = 0;
+
+  pthread_mutex_lock(&rtg_par_lock);
+  rtg_par_current = *job;
+  rtg_par_posted = &rtg_par_current;
+  rtg_par_gen++;
+  pthread_cond_broadcast(&rtg_par_go);
+  pthread_mutex_unlock(&rtg_par_lock);
+
+  rtg_par_work(&rtg_par_current);
+
+  // Wait for the other pieces and for every helper to let go of the job.
+  pthread_mutex_lock(&rtg_par_lock);
+  rtg_par_posted = NULL;
+  while (rtg_par_busy ||
+         __atomic_load_n(&rtg_par_current.done, __ATOMIC_ACQUIRE) < rtg_par_current.parts) {
+    pthread_cond_wait(&rtg_par_idle, &rtg_par_lock);
+  }
+  pthread_mutex_unlock(&rtg_par_lock);
+  return 1;
+}
+
+// Row band or column strip split for a blit; 0 if it has to stay on one thread.
+static int rtg_par_blit(enum rtg_par_op op, uint16_t x, uint16_t y, uint16_t dx, uint16_t dy,
+                        uint16_t w, uint16_t h, uint16_t pitch, uint16_t format, uint8_t mask) {
+  struct rtg_par_job job = {.op = op, .x = (int16_t)x, .y = (int16_t)y, .dx = (int16_t)dx,
+                            .dy = (int16_t)dy, .w = (int16_t)w, .h = (int16_t)h, .pitch = pitch,
+                            .format = format, .mask = mask, .align = 1};
+  int rows_overlap = y < dy + h && dy < y + h;
+  int cols_overlap = x < dx + w && dx < x + w;
+  if (rows_overlap && cols_overlap && y != dy) {
+    if (x != dx) {
+      return 0;
+    }
+    job.columns = 1;
+    job.align = 16;
+  }
+  return rtg_par_split(&job, (size_t)w * h * rtg_pixel_size[format]);
+}
+
+void rtg_fillrect_solid(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint32_t color,
+                        uint16_t pitch, uint16_t format) {
+  uint8_t* dptr = NULL;
+  if (!rtg_get_dst_ptr_checked(rtg_address_adj[0], x, y, w, h, pitch, format, "fillrect_solid",
+                               &dptr)) {
+    return;
+  }
+  struct rtg_par_job job = {.op = RTG_PAR_FILLRECT_SOLID, .x = (int16_t)x, .y = (int16_t)y,
+                            .w = (int16_t)w, .h = (int16_t)h, .color = color, .pitch = pitch,
+                            .format = format, .align = 1};
+  if (rtg_par_split(&job, (size_t)w * h * rtg_pixel_size[format])) {
+    return;
+  }
+  size_t span_bpp = rtg_span_bpp(format);
+  if (span_bpp) {
+    // First row from the big-endian colour the per-pixel stores below use.
+    uint32_t value = color;
+    if (span_bpp == 2) {
+      value = htobe16((uint16_t)color);
+    } else if (span_bpp == 4) {
+      value = htobe32(color);
+    }
+    rtg_span_fill(dptr, rtg_span_pattern(value, format, span_bpp), (size_t)w * span_bpp);
+  } else {
+    switch (format) {
+    case RTGFMT_8BIT_CLUT: {
+      for (int xs = 0; xs < w; xs++) {
+        dptr[xs] = color & 0xFF;
+      }
+      break;
+    }
+    case RTGFMT_RGB565_LE:
+    case RTGFMT_RGB565_BE:
+    case RTGFMT_BGR565_LE:
+    case RTGFMT_RGB555_LE:
+    case RTGFMT_RGB555_BE:
+    case RTGFMT_BGR555_LE: {
+      uint16_t color16 = (color & 0xFFFF);
+      for (int xs = 0; xs < w; xs++) {
+        size_t offset = (size_t)xs * sizeof(uint16_t);
+        store_u16_be(&dptr[offset], color16);
+      }
+      break;
+    }
+    case RTGFMT_RGB32_ABGR:
+    case RTGFMT_RGB32_ARGB:
+    case RTGFMT_RGB32_BGRA:
+    case RTGFMT_RGB32_RGBA: {
+      for (int xs = 0; xs < w; xs++) {
+        size_t offset = (size_t)xs * sizeof(uint32_t);
+        store_u32_be(&dptr[offset], color);
+      }
+      break;
+    }
+    }
   }
   for (int ys = 1; ys < h; ys++) {
     dptr += pitch;
@@ -171,7 +886,28 @@ void rtg_fillrect_solid(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint32_t
 void rtg_fillrect(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint32_t color, uint16_t pitch,
                   uint16_t format, uint8_t mask) {
   uint8_t* dptr = NULL;
-  if (!rtg_get_ptr_checked(rtg_address_adj[0], x, y, w, h, pitch, format, "fillrect", &dptr)) {
+  if (!rtg_get_dst_ptr_checked(rtg_address_adj[0], x, y, w, h, pitch, format, "fillrect", &dptr)) {
+    return;
+  }
+  struct rtg_par_job job = {.op = RTG_PAR_FILLRECT, .x = (int16_t)x, .y = (int16_t)y,
+                            .w = (int16_t)w, .h = (int16_t)h, .color = color, .pitch = pitch,
+                            .format = format, .mask = mask, .align = 1};
+  if (rtg_par_split(&job, (size_t)w * h * rtg_pixel_size[format])) {
+    return;
+  }
+
+  size_t span_bpp = rtg_span_bpp(format);
+  if (span_bpp) {
+    // Only CLUT honours the mask; the other formats store color & 0xFF as a whole pixel.
+    uint64_t pat = rtg_span_pattern(color & 0xFF, format, span_bpp);
+    for (int ys = 0; ys < h; ys++) {
+      if (format == RTGFMT_8BIT_CLUT) {
+        rtg_span_fill_masked(dptr, pat, ~rtg_rep8(mask), w);
+      } else {
+        rtg_span_fill(dptr, pat, (size_t)w * span_bpp);
+      }
+      dptr += pitch;
+    }
     return;
   }
 
@@ -189,7 +925,23 @@ void rtg_invertrect(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t pit
   if (mask) {
   }
   uint8_t* dptr = NULL;
-  if (!rtg_get_ptr_checked(rtg_address_adj[0], x, y, w, h, pitch, format, "invertrect", &dptr)) {
+  if (!rtg_get_dst_ptr_checked(rtg_address_adj[0], x, y, w, h, pitch, format, "invertrect",
+                               &dptr)) {
+    return;
+  }
+  struct rtg_par_job job = {.op = RTG_PAR_INVERTRECT, .x = (int16_t)x, .y = (int16_t)y,
+                            .w = (int16_t)w, .h = (int16_t)h, .pitch = pitch, .format = format,
+                            .mask = mask, .align = 1};
+  if (rtg_par_split(&job, (size_t)w * h * rtg_pixel_size[format])) {
+    return;
+  }
+  size_t span_bpp = rtg_span_bpp(format);
+  if (span_bpp) {
+    uint64_t inv = (format == RTGFMT_8BIT_CLUT) ? rtg_rep8(mask) : ~0ull;
+    for (int ys = 0; ys < h; ys++) {
+      rtg_span_xor(dptr, inv, (size_t)w * span_bpp);
+      dptr += pitch;
+    }
     return;
   }
   for (int ys = 0; ys < h; ys++) {
@@ -240,8 +992,11 @@ void rtg_blitrect(uint16_t x, uint16_t y, uint16_t dx, uint16_t dy, uint16_t w,
   if (!rtg_get_ptr_checked(rtg_address_adj[0], x, y, w, h, pitch, format, "blitrect_src", &sptr)) {
     return;
   }
-  if (!rtg_get_ptr_checked(rtg_address_adj[0], dx, dy, w, h, pitch, format, "blitrect_dst",
-                           &dptr)) {
+  if (!rtg_get_dst_ptr_checked(rtg_address_adj[0], dx, dy, w, h, pitch, format, "blitrect_dst",
+                               &dptr)) {
+    return;
+  }
+  if (rtg_par_blit(RTG_PAR_BLITRECT, x, y, dx, dy, w, h, pitch, format, mask)) {
     return;
   }
 
@@ -257,6 +1012,16 @@ void rtg_blitrect(uint16_t x, uint16_t y, uint16_t dx, uint16_t dy, uint16_t w,
     xdir = 0;
   }
 
+  size_t span_bpp = rtg_span_bpp(format);
+  if (span_bpp) {
+    for (int ys = 0; ys < h; ys++) {
+      rtg_span_blit(dptr, sptr, (size_t)w * span_bpp, ~rtg_rep8(mask), span_bpp, xdir);
+      sptr += pitchstep;
+      dptr += pitchstep;
+    }
+    return;
+  }
+
   for (int ys = 0; ys < h; ys++) {
     if (format == RTGFMT_8BIT_CLUT) {
       if (xdir) {
@@ -343,8 +1108,11 @@ void rtg_blitrect_solid(uint16_t x, uint16_t y, uint16_t dx, uint16_t dy, uint16
                            &sptr)) {
     return;
   }
-  if (!rtg_get_ptr_checked(rtg_address_adj[0], dx, dy, w, h, pitch, format, "blitrect_solid_dst",
-                           &dptr)) {
+  if (!rtg_get_dst_ptr_checked(rtg_address_adj[0], dx, dy, w, h, pitch, format,
+                               "blitrect_solid_dst", &dptr)) {
+    return;
+  }
+  if (rtg_par_blit(RTG_PAR_BLITRECT_SOLID, x, y, dx, dy, w, h, pitch, format, 0xFF)) {
     return;
   }
 
@@ -384,8 +1152,8 @@ void rtg_blitrect_nomask_complete(uint16_t sx, uint16_t sy, uint16_t dx, uint16_
                            &sptr)) {
     return;
   }
-  if (!rtg_get_ptr_checked(dst_base, dx, dy, w, h, dstpitch, format, "blitrect_nomask_dst",
-                           &dptr)) {
+  if (!rtg_get_dst_ptr_checked(dst_base, dx, dy, w, h, dstpitch, format, "blitrect_nomask_dst",
+                               &dptr)) {
     return;
   }
 
@@ -437,6 +1205,19 @@ void rtg_blitrect_nomask_complete(uint16_t sx, uint16_t sy, uint16_t dx, uint16_
         dptr += dst_pitchstep;
       }
     }
+  } else if (format == RTGFMT_8BIT_CLUT && rtg_span_bpp(format) &&
+             !rtg_blit_overlaps(sptr, dptr, w, h, srcpitch, dstpitch, src_pitchstep)) {
+    // Non-overlapping CLUT blits only: the per-pixel loop writes some minterm results back
+    // into the source, which a word at a time cannot reproduce when the rows overlap.
+    if (minterm == MINTERM_DST) {
+      return;
+    }
+    int write_src = rtg_minterm_writes_src(minterm);
+    for (int ys = 0; ys < h; ys++) {
+      rtg_span_minterm(dptr, sptr, w, minterm, ~0ull, write_src);
+      sptr += src_pitchstep;
+      dptr += dst_pitchstep;
+    }
   } else {
     for (int ys = 0; ys < h; ys++) {
       if (xdir) {
@@ -521,8 +1302,8 @@ void rtg_blittemplate(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint32_t s
                       uint16_t format, uint16_t offset_x, uint8_t mask, uint8_t draw_mode) {
   // P96 uses template blits for window decorations (gadgets/scrollbars/titlebar text/masks).
   uint8_t* dptr = NULL;
-  if (!rtg_get_ptr_checked(rtg_address_adj[1], x, y, w, h, pitch, format, "blittemplate",
-                           &dptr)) {
+  if (!rtg_get_dst_ptr_checked(rtg_address_adj[1], x, y, w, h, pitch, format, "blittemplate",
+                               &dptr)) {
     return;
   }
   uint8_t* sptr = NULL;
@@ -591,6 +1372,28 @@ void rtg_blittemplate(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint32_t s
     }
   }
 
+  size_t span_bpp = rtg_span_bpp(format);
+  if (span_bpp) {
+    if (draw_mode > DRAWMODE_COMPLEMENT) {
+      return;
+    }
+    // Fetch each row's template bytes in the order the per-pixel loop reads them, then
+    // expand eight pixels per byte.
+    struct rtg_expand e;
+    uint8_t bits[RTG_ROW_BITS_MAX];
+    size_t row_bytes = w ? ((offset_x % 8) + (size_t)w + 7) / 8 : 0;
+    rtg_expand_setup(&e, format, span_bpp, draw_mode, fg_color, bg_color, mask, 1);
+    for (uint16_t ys = 0; ys < h; ys++) {
+      for (size_t i = 0; i < row_bytes; i++) {
+        TEMPLATE_LOOPX;
+        bits[i] = cur_byte;
+      }
+      rtg_expand_row(&e, dptr, w, offset_x % 8, bits);
+      TEMPLATE_LOOPY;
+    }
+    return;
+  }
+
   switch (draw_mode) {
   case DRAWMODE_JAM1:
     for (uint16_t ys = 0; ys < h; ys++) {
@@ -694,8 +1497,8 @@ void rtg_blitpattern(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint32_t sr
 
   // P96 uses pattern blits for window decoration fills and requesters.
   uint8_t* dptr = NULL;
-  if (!rtg_get_ptr_checked(rtg_address_adj[1], x, y, w, h, pitch, format, "blitpattern",
-                           &dptr)) {
+  if (!rtg_get_dst_ptr_checked(rtg_address_adj[1], x, y, w, h, pitch, format, "blitpattern",
+                               &dptr)) {
     return;
   }
   if (loop_rows == 0) {
@@ -766,6 +1569,28 @@ void rtg_blitpattern(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint32_t sr
     sptr += (offset_y % loop_rows) * 2;
   }
 
+  size_t span_bpp = rtg_span_bpp(format);
+  if (span_bpp) {
+    if (draw_mode > DRAWMODE_COMPLEMENT) {
+      return;
+    }
+    // Fetch each row's template bytes in the order the per-pixel loop reads them, then
+    // expand eight pixels per byte.
+    struct rtg_expand e;
+    uint8_t bits[RTG_ROW_BITS_MAX];
+    size_t row_bytes = w ? ((offset_x % 8) + (size_t)w + 7) / 8 : 0;
+    rtg_expand_setup(&e, format, span_bpp, draw_mode, fg_color, bg_color, mask, 1);
+    for (uint16_t ys = 0; ys < h; ys++) {
+      for (size_t i = 0; i < row_bytes; i++) {
+        PATTERN_LOOPX;
+        bits[i] = cur_byte;
+      }
+      rtg_expand_row(&e, dptr, w, offset_x % 8, bits);
+      PATTERN_LOOPY;
+    }
+    return;
+  }
+
   switch (draw_mode) {
   case DRAWMODE_JAM1:
     for (uint16_t ys = 0; ys < h; ys++) {
@@ -872,8 +1697,8 @@ void rtg_drawline_solid(int16_t x1_, int16_t y1_, int16_t x2_, int16_t y2_, uint
   uint8_t* base_ptr = NULL;
   uint16_t span_w = (uint16_t)(max_x - min_x + 1);
   uint16_t span_h = (uint16_t)(max_y - min_y + 1);
-  if (!rtg_get_ptr_checked(rtg_address_adj[0], (uint16_t)min_x, (uint16_t)min_y, span_w, span_h,
-                           pitch, format, "drawline_solid", &base_ptr)) {
+  if (!rtg_get_dst_ptr_checked(rtg_address_adj[0], (uint16_t)min_x, (uint16_t)min_y, span_w, span_h,
+                               pitch, format, "drawline_solid", &base_ptr)) {
     return;
   }
   (void)base_ptr;
@@ -917,6 +1742,18 @@ void rtg_drawline_solid(int16_t x1_, int16_t y1_, int16_t x2_, int16_t y2_, uint
   ix = dy_abs >> 1;
   iy = dx_abs >> 1;
 
+  // Horizontal lines are a single span, as long as x does not wrap.
+  size_t span_bpp = rtg_span_bpp(format);
+  if (span_bpp && dy == 0 && dx_abs > 0) {
+    int32_t n = (len ? len : dx_abs) + 1;
+    int32_t first = (x_step > 0) ? x : x - (n - 1);
+    if (first >= INT16_MIN && first + n - 1 <= INT16_MAX) {
+      rtg_span_fill(rtg_line_pixel_ptr(dptr, first, format),
+                    rtg_span_pattern(fg_color, format, span_bpp), (size_t)n * span_bpp);
+      return;
+    }
+  }
+
   SET_RTG_PIXEL(rtg_line_pixel_ptr(dptr, x, format), fg_color, format);
 
   if (dx_abs >= dy_abs) {
@@ -998,8 +1835,8 @@ void rtg_drawline(int16_t x1_, int16_t y1_, int16_t x2_, int16_t y2_, uint16_t l
   uint8_t* base_ptr = NULL;
   uint16_t span_w = (uint16_t)(max_x - min_x + 1);
   uint16_t span_h = (uint16_t)(max_y - min_y + 1);
-  if (!rtg_get_ptr_checked(rtg_address_adj[0], (uint16_t)min_x, (uint16_t)min_y, span_w, span_h,
-                           pitch, format, "drawline", &base_ptr)) {
+  if (!rtg_get_dst_ptr_checked(rtg_address_adj[0], (uint16_t)min_x, (uint16_t)min_y, span_w, span_h,
+                               pitch, format, "drawline", &base_ptr)) {
     return;
   }
   (void)base_ptr;
@@ -1056,6 +1893,26 @@ void rtg_drawline(int16_t x1_, int16_t y1_, int16_t x2_, int16_t y2_, uint16_t l
   }
   draw_mode &= 0x01;
 
+  // Left-to-right horizontal lines take pattern bits MSB first from the start, so they
+  // expand like a template row of the pattern repeated.
+  size_t span_bpp = rtg_span_bpp(format);
+  if (span_bpp && dy == 0 && dx > 0) {
+    int32_t n = (len ? len : dx_abs) + 1;
+    if (x + n - 1 <= INT16_MAX) {
+      struct rtg_expand e;
+      uint8_t bits[RTG_ROW_BITS_MAX];
+      uint8_t mode = invert ? DRAWMODE_COMPLEMENT : draw_mode;
+      for (size_t i = 0; i < ((size_t)n + 7) / 8; i++) {
+        // COMPLEMENT with JAM2 inverts the clear bits as well.
+        bits[i] = (invert && draw_mode == DRAWMODE_JAM2) ? 0xFF
+                                                         : (uint8_t)(pattern >> ((i & 1) ? 0 : 8));
+      }
+      rtg_expand_setup(&e, format, span_bpp, mode, fg_color, bg_color, mask, 0);
+      rtg_expand_row(&e, rtg_line_pixel_ptr(dptr, x, format), (size_t)n, 0, bits);
+      return;
+    }
+  }
+
   DRAW_LINE_PIXEL;
 
   if (dx_abs >= dy_abs) {
@@ -1101,8 +1958,8 @@ void rtg_p2c_ex(int16_t sx, int16_t sy, int16_t dx, int16_t dy, int16_t w, int16
     }
     return;
   }
-  if (!rtg_get_ptr_checked(rtg_address_adj[0], (uint16_t)dx, (uint16_t)dy, (uint16_t)w, (uint16_t)h,
-                           pitch, rtg_format, "p2c_ex_dst", &dptr)) {
+  if (!rtg_get_dst_ptr_checked(rtg_address_adj[0], (uint16_t)dx, (uint16_t)dy, (uint16_t)w,
+                               (uint16_t)h, pitch, rtg_format, "p2c_ex_dst", &dptr)) {
     return;
   }
   uint8_t draw_mode = minterm;
@@ -1205,10 +2062,22 @@ void rtg_p2c(int16_t sx, int16_t sy, int16_t dx, int16_t dy, int16_t w, int16_t
     }
     return;
   }
-  if (!rtg_get_ptr_checked(rtg_address_adj[0], (uint16_t)dx, (uint16_t)dy, (uint16_t)w, (uint16_t)h,
-                           pitch, rtg_format, "p2c_dst", &dptr)) {
+  if (!rtg_get_dst_ptr_checked(rtg_address_adj[0], (uint16_t)dx, (uint16_t)dy, (uint16_t)w,
+                               (uint16_t)h, pitch, rtg_format, "p2c_dst", &dptr)) {
     return;
   }
+  // Strips start on a byte of the planar source; the uint8_t byte index below only
+  // wraps the same way from any start when a source row fits in 256 bytes.
+  if (sx >= 0 && w > 0 && h > 0 && src_line_pitch <= 256) {
+    struct rtg_par_job job = {.op = RTG_PAR_P2C, .x = sx, .y = sy, .dx = dx, .dy = dy,
+                              .w = w, .h = h, .src_pitch = src_line_pitch, .draw_mode = draw_mode,
+                              .planes = planes, .mask = mask, .layer_mask = layer_mask,
+                              .src = bmp_data_src, .columns = 1, .align = 8};
+    if (rtg_par_split(&job, (size_t)w * (size_t)h * rtg_pixel_size[rtg_format])) {
+      return;
+    }
+  }
+  dptr -= rtg_par_dst_skew;
 
   uint8_t cur_bit, base_bit, base_byte, cur_byte = 0;
   uint8_t u8_fg = 0;
@@ -1242,6 +2111,27 @@ void rtg_p2c(int16_t sx, int16_t sy, int16_t dx, int16_t dy, int16_t w, int16_t
     }
   }
 
+  if (rtg_format == RTGFMT_8BIT_CLUT && rtg_span_bpp(rtg_format) && sx >= 0 && w > 0 &&
+      dx + w <= INT16_MAX) {
+    if (draw_mode == MINTERM_DST) {
+      return;
+    }
+    // Decode a row of chunky pixels, then apply the minterm eight at a time. Like the
+    // per-pixel loop, the destination is indexed with the absolute x.
+    uint8_t row[8 + INT16_MAX + 8];
+    for (int16_t line_y = 0; line_y < h; line_y++) {
+      rtg_planar_row(row + 8, (size_t)w, (unsigned int)(sx % 8), base_byte, src_line_pitch,
+                     bmp_data, plane_size, planes, layer_mask, draw_mode & 0x01);
+      rtg_span_minterm(dptr + dx, row + 8, (size_t)w, draw_mode, rtg_rep8(mask), 0);
+      dptr += pitch;
+      if ((((int16_t)(line_y + sy + 1)) % (int16_t)h) != 0)
+        bmp_data += src_line_pitch;
+      else
+        bmp_data = bmp_data_src;
+    }
+    return;
+  }
+
   for (int16_t line_y = 0; line_y < h; line_y++) {
     for (int16_t x = dx; x < dx + w; x++) {
       u8_fg = 0;
@@ -1287,10 +2177,22 @@ void rtg_p2d(int16_t sx, int16_t sy, int16_t dx, int16_t dy, int16_t w, int16_t
     }
     return;
   }
-  if (!rtg_get_ptr_checked(rtg_address_adj[0], (uint16_t)dx, (uint16_t)dy, (uint16_t)w, (uint16_t)h,
-                           pitch, rtg_format, "p2d_dst", &dptr)) {
+  if (!rtg_get_dst_ptr_checked(rtg_address_adj[0], (uint16_t)dx, (uint16_t)dy, (uint16_t)w,
+                               (uint16_t)h, pitch, rtg_format, "p2d_dst", &dptr)) {
     return;
   }
+  // Strips start on a byte of the planar source; the uint8_t byte index below only
+  // wraps the same way from any start when a source row fits in 256 bytes.
+  if (sx >= 0 && w > 0 && h > 0 && src_line_pitch <= 256) {
+    struct rtg_par_job job = {.op = RTG_PAR_P2D, .x = sx, .y = sy, .dx = dx, .dy = dy,
+                              .w = w, .h = h, .src_pitch = src_line_pitch, .draw_mode = draw_mode,
+                              .planes = planes, .mask = mask, .layer_mask = layer_mask,
+                              .src = bmp_data_src, .columns = 1, .align = 8};
+    if (rtg_par_split(&job, (size_t)w * (size_t)h * rtg_pixel_size[rtg_format])) {
+      return;
+    }
+  }
+  dptr -= rtg_par_dst_skew;
 
   uint8_t cur_bit, base_bit, base_byte, cur_byte = 0;
   uint8_t u8_fg = 0;
@@ -1334,6 +2236,43 @@ void rtg_p2d(int16_t sx, int16_t sy, int16_t dx, int16_t dy, int16_t w, int16_t
   bmp_data += (256 * 4);
   bmp_data_src += (256 * 4);
 
+  size_t span_bpp = rtg_span_bpp(rtg_format);
+  if (span_bpp > 1 && sx >= 0 && w > 0 && dx + w <= INT16_MAX) {
+    // Only SRC/NOTSRC with a full mask draw anything.
+    if (mask != 0xFF || (draw_mode != MINTERM_SRC && draw_mode != MINTERM_NOTSRC)) {
+      return;
+    }
+    uint8_t lut[256][4];
+    for (int i = 0; i < 256; i++) {
+      if (span_bpp == 2) {
+        store_u16_be(lut[i], (uint16_t)(clut[i] >> 16));
+      } else {
+        store_u32_be(lut[i], clut[i]);
+      }
+    }
+    uint8_t row[8 + INT16_MAX + 8];
+    for (int16_t line_y = 0; line_y < h; line_y++) {
+      rtg_planar_row(row + 8, (size_t)w, (unsigned int)(sx % 8), base_byte, src_line_pitch,
+                     bmp_data, plane_size, planes, layer_mask, draw_mode & 0x01);
+      uint8_t* p = dptr + ((size_t)dx * span_bpp);
+      if (span_bpp == 2) {
+        for (int16_t i = 0; i < w; i++) {
+          memcpy(p + ((size_t)i * 2), lut[row[8 + i]], 2);
+        }
+      } else {
+        for (int16_t i = 0; i < w; i++) {
+          memcpy(p + ((size_t)i * 4), lut[row[8 + i]], 4);
+        }
+      }
+      dptr += pitch;
+      if ((((int16_t)(line_y + sy + 1)) % (int16_t)h) != 0)
+        bmp_data += src_line_pitch;
+      else
+        bmp_data = bmp_data_src;
+    }
+    return;
+  }
+
   for (int16_t line_y = 0; line_y < h; line_y++) {
     for (int16_t x = dx; x < dx + w; x++) {
       u8_fg = 0;
@@ -0,0 +1,711 @@
+// SPDX-License-Identifier: MIT
+// Native chipset display capture. See rtg-native.h for the settings.
+//
+// The custom chip registers are write-only, so the display state is pieced
+// together from two sources: a shadow of everything the CPU writes to
+// $DFF000-$DFF1FF, and the copper list, which is read from chip RAM at the
+// start of each frame and applied on top up to the first WAIT below the top
+// of the display window. The bitplanes are then read in chunks of up to 1KB
+// per CPU loop iteration and, once the last one is in, converted a batch of
+// rows at a time.
+
+#include "config_file/config_file.h"
+#include "gpio/ps_protocol.h"
+#include "log.h"
+#include "platforms/amiga/registers/agnus.h"
+#include "platforms/amiga/registers/denise.h"
+#include "rtg.h"
+#include "rtg-native.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern uint8_t* rtg_mem;
+extern uint8_t display_enabled;
+
+#define CHIP_MASK 0x1FFFFE
+#define REG(r) CUSTOM_REG_OFFSET(r)
+// Copper list bytes read per frame at most, and per bus read.
+#define COPPER_MAX 16384
+#define COPPER_CHUNK 256
+// Bitplane bytes per bus read; one kmod batch.
+#define PLANE_CHUNK 1024
+#define MAX_WIDTH 2048
+#define MAX_HEIGHT 1280
+
+struct chip_state {
+  uint16_t bplcon0, bplcon2, bplcon3, bplcon4, fmode;
+  uint16_t diwstrt, diwstop, ddfstrt, ddfstop;
+  int16_t bplmod[2];
+  uint32_t bplpt[8];
+  uint32_t cop1lc, cop2lc;
+  uint32_t palette[256]; // 0x00RRGGBB
+};
+
+enum { MODE_NORMAL, MODE_EHB, MODE_HAM6, MODE_HAM8, MODE_DPF };
+
+struct native_plan {
+  unsigned int planes, mode, res;
+  unsigned int fetch;  // bytes per plane and row
+  unsigned int skip;   // fetched pixels left of the display window
+  unsigned int width, height;
+  uint32_t pt[8];
+  int32_t stride[8];   // bytes from one displayed row to the next
+  // Where the rows end up in the read buffer. Planes that lie close together
+  // (interleaved bitmaps, planes allocated back to back) are read as one
+  // span; otherwise each plane's rows are packed one after the other.
+  uint32_t span_lo, span_len;
+  size_t buf_off[8];
+  int32_t buf_stride[8];
+};
+
+uint8_t rtg_native_enabled = 0;
+
+static struct chip_state regs;  // CPU writes
+static struct chip_state frame; // plus the copper list, for the frame being read
+static struct native_plan plan;
+static uint8_t* planar;
+static size_t planar_size;
+static unsigned int cur_plane, cur_row;
+static uint32_t cur_off;
+static uint8_t reading, converting;
+static unsigned int conv_row;
+static uint8_t* conv_index;
+static size_t conv_index_size;
+static int conv_resized;
+
+static uint64_t frame_interval_ns, next_frame_ns;
+static unsigned int budget_pct = RTG_NATIVE_DEFAULT_BUDGET;
+static int64_t budget_ns;
+static uint64_t budget_last_ns;
+static unsigned int idle_polls;
+
+static uint64_t frame_bus_ns, frame_bus_bytes, frame_copper_ns, frame_cpu_ns;
+static uint16_t shown_width, shown_height;
+static unsigned int shown_planes, shown_mode, shown_res;
+static uint64_t spread[256];
+static struct rtg_native_stats stats;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t cpu_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void bus_read(uint32_t addr, uint8_t* dst, uint32_t len) {
+  uint64_t t0 = now_ns();
+  ps_read_block(addr & CHIP_MASK, dst, len);
+  uint64_t t = now_ns() - t0;
+  frame_bus_ns += t;
+  frame_bus_bytes += len;
+}
+
+static void set_color(struct chip_state* s, unsigned int index, uint16_t value) {
+  index += ((s->bplcon3 & BPLCON3_BANK) >> 13) * 32u;
+  uint32_t r = (value >> 8) & 0xF, g = (value >> 4) & 0xF, b = value & 0xF;
+  if (s->bplcon3 & BPLCON3_LOCT) {
+    s->palette[index] = (s->palette[index] & 0xF0F0F0) | r << 16 | g << 8 | b;
+  } else {
+    // On AGA a plain write sets both nibbles, like the 12-bit chipsets.
+    s->palette[index] = (r * 0x11) << 16 | (g * 0x11) << 8 | (b * 0x11);
+  }
+}
+
+static void apply(struct chip_state* s, uint16_t reg, uint16_t value) {
+  if (reg >= REG(BPL1PTH) && reg <= REG(BPL8PTL)) {
+    uint32_t* pt = &s->bplpt[(reg - REG(BPL1PTH)) >> 2];
+    if (reg & 2) {
+      *pt = (*pt & 0xFFFF0000) | (value & 0xFFFE);
+    } else {
+      *pt = (*pt & 0xFFFF) | (uint32_t)value << 16;
+    }
+    return;
+  }
+  if (reg >= REG(COLOR00) && reg <= REG(COLOR31)) {
+    set_color(s, (unsigned int)(reg - REG(COLOR00)) >> 1, value);
+    return;
+  }
+  switch (reg) {
+  case REG(COP1LCH):
+    s->cop1lc = (s->cop1lc & 0xFFFF) | (uint32_t)value << 16;
+    break;
+  case REG(COP1LCL):
+    s->cop1lc = (s->cop1lc & 0xFFFF0000) | (value & 0xFFFE);
+    break;
+  case REG(COP2LCH):
+    s->cop2lc = (s->cop2lc & 0xFFFF) | (uint32_t)value << 16;
+    break;
+  case REG(COP2LCL):
+    s->cop2lc = (s->cop2lc & 0xFFFF0000) | (value & 0xFFFE);
+    break;
+  case REG(DIWSTRT):
+    s->diwstrt = value;
+    break;
+  case REG(DIWSTOP):
+    s->diwstop = value;
+    break;
+  case REG(DDFSTRT):
+    s->ddfstrt = value;
+    break;
+  case REG(DDFSTOP):
+    s->ddfstop = value;
+    break;
+  case REG(BPLCON0):
+    s->bplcon0 = value;
+    break;
+  case REG(BPLCON2):
+    s->bplcon2 = value;
+    break;
+  case REG(BPLCON3):
+    s->bplcon3 = value;
+    break;
+  case REG(BPLCON4):
+    s->bplcon4 = value;
+    break;
+  case REG(BPL1MOD):
+    s->bplmod[0] = (int16_t)value;
+    break;
+  case REG(BPL2MOD):
+    s->bplmod[1] = (int16_t)value;
+    break;
+  case REG(FMODE):
+    s->fmode = value;
+    break;
+  default:
+    break;
+  }
+}
+
+void rtg_native_custom_write(uint32_t addr, uint32_t value, uint8_t type) {
+  uint16_t reg = (uint16_t)(addr & 0x1FE);
+  if (type == OP_TYPE_LONGWORD) {
+    apply(&regs, reg, (uint16_t)(value >> 16));
+    apply(&regs, (uint16_t)((reg + 2) & 0x1FE), (uint16_t)value);
+  } else if (type == OP_TYPE_WORD) {
+    apply(&regs, reg, (uint16_t)value);
+  }
+}
+
+// Apply the copper list to `s` up to the top of the display window, following
+// jumps through COPJMP1/2 (the system list jumps from copinit to the LOF list).
+static void copper_walk(struct chip_state* s) {
+  uint8_t buf[COPPER_CHUNK];
+  uint32_t pc = s->cop1lc, base = 0;
+  unsigned int have = 0, total = 0, jumps = 0;
+  uint64_t t0 = frame_bus_ns;
+
+  if (!pc) {
+    return;
+  }
+  while (total < COPPER_MAX) {
+    if (pc < base || pc + 4 > base + have) {
+      base = pc;
+      have = COPPER_CHUNK;
+      bus_read(base, buf, have);
+      total += have;
+    }
+    const uint8_t* ins = &buf[pc - base];
+    uint16_t ir1 = (uint16_t)(ins[0] << 8 | ins[1]);
+    uint16_t ir2 = (uint16_t)(ins[2] << 8 | ins[3]);
+    pc += 4;
+    if (!(ir1 & 1)) {
+      uint16_t reg = ir1 & 0x1FE;
+      if (reg == REG(COPJMP1) || reg == REG(COPJMP2)) {
+        if (++jumps > 4) {
+          break;
+        }
+        pc = reg == REG(COPJMP1) ? s->cop1lc : s->cop2lc;
+        continue;
+      }
+      apply(s, reg, ir2);
+      continue;
+    }
+    if (ir1 == 0xFFFF && ir2 == 0xFFFE) {
+      break;
+    }
+    if (ir2 & 1) {
+      continue; // SKIP
+    }
+    // Stop at a WAIT below the first displayed line. Until the list has set
+    // DIWSTRT, assume the usual $2C.
+    unsigned int top = s->diwstrt >> 8 ? (unsigned int)(s->diwstrt >> 8) : 0x2Cu;
+    if ((unsigned int)(ir1 >> 8) > top) {
+      break;
+    }
+  }
+  frame_copper_ns += frame_bus_ns - t0;
+}
+
+static int make_plan(const struct chip_state* s, struct native_plan* p) {
+  static const unsigned int fetch_mult[4] = {1, 2, 2, 4};
+  uint16_t con0 = s->bplcon0;
+
+  memset(p, 0, sizeof(*p));
+  p->planes = ((con0 & BPLCON0_BPU) >> 12) | ((con0 & BPLCON0_BPU3) ? 8u : 0u);
+  if (p->planes > 8) {
+    p->planes = 8;
+  }
+  if (!p->planes) {
+    return 0;
+  }
+  p->res = (con0 & BPLCON0_SHRES) ? 2 : (con0 & BPLCON0_HIRES) ? 1 : 0;
+  if (con0 & BPLCON0_HAM) {
+    p->mode = p->planes > 6 ? MODE_HAM8 : MODE_HAM6;
+  } else if (con0 & BPLCON0_DPF) {
+    p->mode = MODE_DPF;
+  } else if (p->planes == 6 && !(s->bplcon2 & BPLCON2_KILLEHB)) {
+    p->mode = MODE_EHB;
+  } else {
+    p->mode = MODE_NORMAL;
+  }
+
+  // One fetch block is 8 colour clocks per fetch width and yields 16, 32 or
+  // 64 pixels per width; the standard 320-pixel lores window (DDFSTRT $38,
+  // DDFSTOP $D0) is 20 blocks of 2 bytes.
+  unsigned int mult = fetch_mult[s->fmode & 3];
+  unsigned int ddfstrt = s->ddfstrt & 0xFC, ddfstop = s->ddfstop & 0xFC;
+  if (ddfstop < ddfstrt) {
+    return 0;
+  }
+  unsigned int block = 8 * mult;
+  p->fetch = ((ddfstop - ddfstrt + block - 1) / block + 1) * (2u << p->res) * mult;
+
+  // Horizontal window in lores pixels; fetched data appears 17 (lores) or 9
+  // lores pixels after twice DDFSTRT.
+  unsigned int hstart = s->diwstrt & 0xFF, hstop = (s->diwstop & 0xFF) | 0x100;
+  unsigned int first = ddfstrt * 2 + (p->res ? 9 : 17);
+  if (hstop <= hstart) {
+    return 0;
+  }
+  p->skip = (hstart > first ? hstart - first : 0) << p->res;
+  p->width = (hstop - hstart) << p->res;
+  if (p->skip >= p->fetch * 8) {
+    return 0;
+  }
+  if (p->width > p->fetch * 8 - p->skip) {
+    p->width = p->fetch * 8 - p->skip;
+  }
+
+  unsigned int vstart = s->diwstrt >> 8;
+  unsigned int vstop = (s->diwstop >> 8) | ((s->diwstop & 0x8000) ? 0u : 0x100u);
+  if (vstop <= vstart) {
+    return 0;
+  }
+  p->height = vstop - vstart;
+
+  // Interlaced screens skip every other line in each field; read both.
+  int lace = (con0 & BPLCON0_LACE) && s->bplmod[0] >= (int)p->fetch &&
+             s->bplmod[1] >= (int)p->fetch;
+  if (lace) {
+    p->height *= 2;
+  }
+  if (p->width > MAX_WIDTH) {
+    p->width = MAX_WIDTH;
+  }
+  if (p->height > MAX_HEIGHT) {
+    p->height = MAX_HEIGHT;
+  }
+  while ((size_t)p->width * p->height * 4 > PIGFX_NATIVE_SIZE) {
+    p->height--;
+  }
+  int64_t lo = INT64_MAX, hi = 0;
+  size_t needed = (size_t)p->planes * p->height * p->fetch;
+  for (unsigned int i = 0; i < p->planes; i++) {
+    int32_t stride = (int32_t)p->fetch + s->bplmod[i & 1];
+    p->pt[i] = s->bplpt[i] & CHIP_MASK;
+    p->stride[i] = lace ? stride / 2 : stride;
+    int64_t top = p->pt[i], bottom = top + (int64_t)(p->height - 1) * p->stride[i];
+    if (bottom < top) {
+      int64_t t = top;
+      top = bottom;
+      bottom = t;
+    }
+    lo = top < lo ? top : lo;
+    hi = bottom + p->fetch > hi ? bottom + p->fetch : hi;
+  }
+  if ((uint64_t)(hi - lo) <= needed + needed / 4 && hi <= CHIP_MASK + 2) {
+    p->span_lo = (uint32_t)lo;
+    p->span_len = (uint32_t)((hi - lo + 3) & ~3);
+    for (unsigned int i = 0; i < p->planes; i++) {
+      p->buf_off[i] = p->pt[i] - p->span_lo;
+      p->buf_stride[i] = p->stride[i];
+    }
+  } else {
+    for (unsigned int i = 0; i < p->planes; i++) {
+      p->buf_off[i] = (size_t)i * p->height * p->fetch;
+      p->buf_stride[i] = (int32_t)p->fetch;
+    }
+  }
+  return 1;
+}
+
+static size_t plan_buffer_size(const struct native_plan* p) {
+  return p->span_len ? p->span_len : (size_t)p->planes * p->height * p->fetch;
+}
+
+// Read the next chunk of the span or the current plane. Returns 0 once the
+// whole frame is in.
+static int read_chunk(void) {
+  if (plan.span_len) {
+    uint32_t len = plan.span_len - cur_off;
+    if (len > PLANE_CHUNK) {
+      len = PLANE_CHUNK;
+    }
+    bus_read(plan.span_lo + cur_off, planar + cur_off, len);
+    cur_off += len;
+    return cur_off < plan.span_len;
+  }
+  if (cur_plane >= plan.planes) {
+    return 0;
+  }
+  unsigned int rows = 1;
+  if (plan.stride[cur_plane] == (int32_t)plan.fetch) {
+    rows = PLANE_CHUNK / plan.fetch;
+    if (!rows) {
+      rows = 1;
+    }
+    if (rows > plan.height - cur_row) {
+      rows = plan.height - cur_row;
+    }
+  }
+  uint8_t* dst = planar + plan.buf_off[cur_plane] + (size_t)cur_row * plan.fetch;
+  bus_read((uint32_t)((int64_t)plan.pt[cur_plane] + (int64_t)cur_row * plan.stride[cur_plane]),
+           dst, rows * plan.fetch);
+  cur_row += rows;
+  if (cur_row >= plan.height) {
+    cur_row = 0;
+    cur_plane++;
+  }
+  return cur_plane < plan.planes;
+}
+
+static inline void put_pixel(uint8_t* out, uint32_t rgb) {
+  out[0] = 0xFF;
+  out[1] = (uint8_t)(rgb >> 16);
+  out[2] = (uint8_t)(rgb >> 8);
+  out[3] = (uint8_t)rgb;
+}
+
+static void convert_row(unsigned int row, uint8_t* index, uint8_t* out) {
+  const uint32_t* pal = frame.palette;
+  const uint8_t* src[8];
+  for (unsigned int p = 0; p < plan.planes; p++) {
+    src[p] = planar + (int64_t)plan.buf_off[p] + (int64_t)row * plan.buf_stride[p];
+  }
+
+  // Eight pixels at a time: spread[] turns a plane byte into one bit per
+  // output byte, and the planes are added in at their bit positions.
+  for (unsigned int x = 0; x < plan.fetch; x++) {
+    uint64_t px = 0;
+    for (unsigned int p = 0; p < plan.planes; p++) {
+      px |= spread[src[p][x]] << p;
+    }
+    for (unsigned int i = 0; i < 8; i++) {
+      index[x * 8 + i] = (uint8_t)(px >> (i * 8));
+    }
+  }
+  index += plan.skip;
+
+  switch (plan.mode) {
+  case MODE_NORMAL: {
+    uint8_t xor = (uint8_t)(frame.bplcon4 >> 8);
+    for (unsigned int x = 0; x < plan.width; x++) {
+      put_pixel(out + x * 4, pal[index[x] ^ xor]);
+    }
+    break;
+  }
+  case MODE_EHB:
+    for (unsigned int x = 0; x < plan.width; x++) {
+      uint8_t i = index[x];
+      put_pixel(out + x * 4, i & 32 ? (pal[i & 31] >> 1) & 0x7F7F7F : pal[i]);
+    }
+    break;
+  case MODE_DPF: {
+    static const unsigned int pf2_offsets[8] = {0, 2, 4, 8, 16, 32, 64, 128};
+    unsigned int pf2_offset = pf2_offsets[(frame.bplcon3 & BPLCON3_PF2OF) >> 10];
+    int pf2_front = (frame.bplcon2 & BPLCON2_PF2PRI) != 0;
+    for (unsigned int x = 0; x < plan.width; x++) {
+      uint8_t i = index[x];
+      unsigned int pf1 = (i & 1) | ((i >> 1) & 2) | ((i >> 2) & 4) | ((i >> 3) & 8);
+      unsigned int pf2 = ((i >> 1) & 1) | ((i >> 2) & 2) | ((i >> 3) & 4) | ((i >> 4) & 8);
+      unsigned int c = 0;
+      if (pf2 && (pf2_front || !pf1)) {
+        c = (pf2 + pf2_offset) & 0xFF;
+      } else if (pf1) {
+        c = pf1;
+      }
+      put_pixel(out + x * 4, pal[c]);
+    }
+    break;
+  }
+  case MODE_HAM6:
+  case MODE_HAM8: {
+    // Hold-and-modify starts every line from COLOR00; the hidden pixels left
+    // of the window still modify it.
+    int ham8 = plan.mode == MODE_HAM8;
+    unsigned int shift = ham8 ? 6 : 4, mask = ham8 ? 0x3F : 0x0F;
+    uint32_t c = pal[0];
+    index -= plan.skip;
+    for (unsigned int x = 0; x < plan.skip + plan.width; x++) {
+      uint8_t i = index[x];
+      uint32_t v = i & mask;
+      uint32_t v8 = ham8 ? v << 2 : v * 0x11;
+      uint32_t keep = ham8 ? 3 : 0;
+      switch ((i >> shift) & 3) {
+      case 0:
+        c = pal[v];
+        break;
+      case 1:
+        c = (c & (0xFFFF00 | keep)) | v8;
+        break;
+      case 2:
+        c = (c & (0x00FFFF | keep << 16)) | v8 << 16;
+        break;
+      default:
+        c = (c & (0xFF00FF | keep << 8)) | v8 << 8;
+        break;
+      }
+      if (x >= plan.skip) {
+        put_pixel(out + (x - plan.skip) * 4, c);
+      }
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// Set up the conversion once the last chunk is in. Returns 0 if there is
+// no memory for it.
+static int begin_convert(void) {
+  size_t need = (size_t)plan.fetch * 8 + (size_t)plan.width * 4;
+  if (need > conv_index_size) {
+    free(conv_index);
+    conv_index = malloc(need);
+    conv_index_size = conv_index ? need : 0;
+    if (!conv_index) {
+      return 0;
+    }
+  }
+  conv_resized = plan.width != shown_width || plan.height != shown_height;
+  if (conv_resized || plan.planes != shown_planes || plan.mode != shown_mode ||
+      plan.res != shown_res) {
+    LOG_INFO("[RTG/NATIVE] %ux%u, %u planes, %s%s.\n", plan.width, plan.height, plan.planes,
+             plan.res == 2 ? "superhires" : plan.res ? "hires" : "lores",
+             plan.mode == MODE_HAM6   ? " HAM6"
+             : plan.mode == MODE_HAM8 ? " HAM8"
+             : plan.mode == MODE_EHB  ? " EHB"
+             : plan.mode == MODE_DPF  ? " dual playfield"
+                                      : "");
+    shown_planes = plan.planes;
+    shown_mode = plan.mode;
+    shown_res = plan.res;
+  }
+  if (conv_resized) {
+    // Switch to the new size first, so rows written in the new pitch are not
+    // shown with the old one.
+    shown_width = (uint16_t)plan.width;
+    shown_height = (uint16_t)plan.height;
+    rtg_show_native_frame((uint32_t)PIGFX_WINDOW_SIZE, shown_width, shown_height);
+  }
+  conv_row = 0;
+  converting = 1;
+  return 1;
+}
+
+// Convert rows until the frame is done or `deadline` has passed. Only rows
+// that changed are written and marked dirty, so a still screen costs the
+// display and VNC readers nothing.
+static void convert_rows(uint64_t deadline) {
+  const uint32_t base = (uint32_t)PIGFX_WINDOW_SIZE;
+  const size_t pitch = (size_t)plan.width * 4;
+  uint8_t* row = conv_index + (size_t)plan.fetch * 8;
+  uint64_t c0 = cpu_now_ns();
+
+  while (conv_row < plan.height) {
+    uint8_t* dst = rtg_mem + base + conv_row * pitch;
+    convert_row(conv_row, conv_index, row);
+    if (conv_resized || memcmp(dst, row, pitch) != 0) {
+      memcpy(dst, row, pitch);
+      rtg_mark_dirty(base + conv_row * pitch, pitch);
+    }
+    conv_row++;
+    if (!(conv_row & 15) && now_ns() >= deadline) {
+      break;
+    }
+  }
+  frame_cpu_ns += cpu_now_ns() - c0;
+  if (conv_row < plan.height) {
+    return;
+  }
+
+  converting = 0;
+  rtg_show_native_frame(base, shown_width, shown_height);
+  stats.cpu_ns += frame_cpu_ns;
+  stats.frames++;
+  stats.bus_ns += frame_bus_ns;
+  stats.bus_bytes += frame_bus_bytes;
+  stats.copper_ns += frame_copper_ns;
+  stats.width = shown_width;
+  stats.height = shown_height;
+  stats.planes = (uint16_t)plan.planes;
+}
+
+static void start_frame(void) {
+  frame_bus_ns = frame_bus_bytes = frame_copper_ns = frame_cpu_ns = 0;
+  frame = regs;
+  copper_walk(&frame);
+  if (!make_plan(&frame, &plan)) {
+    stats.skipped++;
+    stats.bus_ns += frame_bus_ns;
+    stats.bus_bytes += frame_bus_bytes;
+    stats.copper_ns += frame_copper_ns;
+    return;
+  }
+  size_t need = plan_buffer_size(&plan);
+  if (need > planar_size) {
+    free(planar);
+    planar = malloc(need);
+    planar_size = planar ? need : 0;
+    if (!planar) {
+      return;
+    }
+  }
+  cur_plane = cur_row = 0;
+  cur_off = 0;
+  reading = 1;
+}
+
+void rtg_native_step(void) {
+  if (!reading && !converting && (++idle_polls & 63)) {
+    return;
+  }
+  uint64_t now = now_ns();
+  budget_ns += (int64_t)((now - budget_last_ns) * budget_pct / 100);
+  budget_last_ns = now;
+  if (budget_ns > RTG_NATIVE_STEP_NS) {
+    budget_ns = RTG_NATIVE_STEP_NS;
+  }
+  if (budget_ns <= 0) {
+    return;
+  }
+  if (display_enabled == 1) {
+    // Picasso96 owns the display; drop the frame in progress.
+    reading = converting = 0;
+  }
+
+  uint64_t start = now;
+  if (converting) {
+    convert_rows(start + (uint64_t)budget_ns);
+  } else {
+    if (!reading) {
+      if (now < next_frame_ns) {
+        return;
+      }
+      next_frame_ns += frame_interval_ns;
+      if (next_frame_ns < now) {
+        next_frame_ns = now + frame_interval_ns;
+      }
+      if (display_enabled == 1 || !rtg_mem) {
+        return;
+      }
+      start_frame();
+    }
+    while (reading && now - start < RTG_NATIVE_STEP_NS && (int64_t)(now - start) < budget_ns) {
+      if (!read_chunk()) {
+        reading = 0;
+        begin_convert();
+      }
+      now = now_ns();
+    }
+  }
+  // Bus reads and conversion both hold up the CPU.
+  budget_ns -= (int64_t)(now_ns() - start);
+}
+
+int rtg_native_start(unsigned int fps) {
+  const char* env = getenv("PISTORM_RTG_NATIVE_FPS");
+  if (env && *env) {
+    fps = (unsigned int)strtoul(env, NULL, 0);
+  }
+  env = getenv("PISTORM_RTG_NATIVE_BUDGET");
+  if (env && *env) {
+    budget_pct = (unsigned int)strtoul(env, NULL, 0);
+  }
+  if (budget_pct < 1) {
+    budget_pct = 1;
+  }
+  if (budget_pct > 100) {
+    budget_pct = 100;
+  }
+  if (!fps) {
+    rtg_native_stop();
+    return 0;
+  }
+  if (!rtg_mem) {
+    LOG_WARN("[RTG/NATIVE] Native display capture needs RTG (setvar rtg).\n");
+    return 0;
+  }
+  if (fps > 60) {
+    fps = 60;
+  }
+  for (unsigned int b = 0; b < 256; b++) {
+    uint64_t v = 0;
+    for (unsigned int i = 0; i < 8; i++) {
+      v |= (uint64_t)((b >> (7 - i)) & 1) << (i * 8);
+    }
+    spread[b] = v;
+  }
+  if (!rtg_native_enabled) {
+    // Until the copper or the CPU sets it, assume the reset BPLCON3.
+    regs.bplcon3 = 0x0C00;
+  }
+  frame_interval_ns = 1000000000ull / fps;
+  next_frame_ns = budget_last_ns = now_ns();
+  budget_ns = 0;
+  reading = converting = 0;
+  rtg_native_enabled = 1;
+  LOG_INFO("[RTG/NATIVE] Capturing the native display at %u fps, up to %u%% bus time.\n", fps,
+           budget_pct);
+  return 1;
+}
+
+void rtg_native_stop(void) {
+  if (!rtg_native_enabled) {
+    return;
+  }
+  rtg_native_enabled = 0;
+  reading = converting = 0;
+  rtg_hide_native_frame();
+  if (stats.frames) {
+    LOG_INFO("[RTG/NATIVE] %llu frames: %.2f ms bus (%.1f KB), %.2f ms CPU per frame.\n",
+             (unsigned long long)stats.frames, (double)stats.bus_ns / 1e6 / (double)stats.frames,
+             (double)stats.bus_bytes / 1024.0 / (double)stats.frames,
+             (double)stats.cpu_ns / 1e6 / (double)stats.frames);
+  }
+  free(planar);
+  planar = NULL;
+  planar_size = 0;
+  free(conv_index);
+  conv_index = NULL;
+  conv_index_size = 0;
+  shown_width = shown_height = 0;
+}
+
+void rtg_native_get_stats(struct rtg_native_stats* out) {
+  *out = stats;
+}
+
+void rtg_native_reset_stats(void) {
+  memset(&stats, 0, sizeof(stats));
+}
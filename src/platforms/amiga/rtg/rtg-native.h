@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_RTG_NATIVE_H
+#define PISTORM_RTG_NATIVE_H
+
+#include <stdint.h>
+
+/*
+ * Native chipset display capture. While the Picasso96 display is switched
+ * off, the Pi reconstructs what the custom chips are showing: register writes
+ * from the CPU are shadowed, the copper list is walked up to the top of the
+ * display window, and the bitplanes are read over the bus in batches. The
+ * planes are converted to 32-bit pixels on the Pi and shown through the RTG
+ * output, so native OCS/ECS/AGA screens appear without a scandoubler.
+ *
+ * Lores, hires, superhires, interlace, 1-8 planes, EHB, HAM6/HAM8, dual
+ * playfield and the AGA 24-bit palette are handled. Sprites, BPLCON1 scroll,
+ * copper splits below the first line (e.g. dragged screens) and modes
+ * changed by CPU writes in the middle of the frame are not.
+ *
+ * Everything runs on the CPU thread, between CPU slices, because the bus is
+ * not shared. A frame is read and converted in pieces so a single stall stays
+ * short, and a budget caps the share of wall time the CPU is held up.
+ *
+ *   setvar rtg-native [fps]       enable, default 10 frames per second
+ *   PISTORM_RTG_NATIVE_FPS        same, overrides the config file; 0 disables
+ *   PISTORM_RTG_NATIVE_BUDGET     time budget in percent (default 20)
+ */
+
+#define RTG_NATIVE_DEFAULT_FPS 10
+#define RTG_NATIVE_DEFAULT_BUDGET 20
+// Longest stall of the CPU loop for capture work, give or take one read.
+#define RTG_NATIVE_STEP_NS 250000
+
+struct rtg_native_stats {
+  uint64_t frames;      // frames converted and shown
+  uint64_t skipped;     // frames not captured: no bitplanes or a bad mode
+  uint64_t bus_bytes;   // bytes read over the bus (copper lists and planes)
+  uint64_t bus_ns;      // wall time spent in those reads
+  uint64_t cpu_ns;      // CPU time spent converting planes to pixels
+  uint64_t copper_ns;   // part of bus_ns spent reading copper lists
+  uint16_t width, height, planes; // last frame
+};
+
+extern uint8_t rtg_native_enabled;
+
+// Enable capture at `fps` frames per second (0 disables). The environment
+// overrides fps and the budget. Needs RTG memory; returns 1 if enabled.
+int rtg_native_start(unsigned int fps);
+void rtg_native_stop(void);
+
+// Shadow a CPU write to the custom chip registers ($DFF000-$DFF1FF).
+void rtg_native_custom_write(uint32_t addr, uint32_t value, uint8_t type);
+// Do a bounded amount of capture work; called from the CPU thread.
+void rtg_native_step(void);
+
+void rtg_native_get_stats(struct rtg_native_stats* stats);
+void rtg_native_reset_stats(void);
+
+#endif /* PISTORM_RTG_NATIVE_H */
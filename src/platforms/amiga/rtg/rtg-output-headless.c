@@ -0,0 +1,607 @@
+// SPDX-License-Identifier: MIT
+// Headless RTG backend: converts the visible framebuffer like the raylib
+// output does, but into memory, with optional frame capture. See
+// rtg-output-headless.h for the environment variables.
+
+#define _GNU_SOURCE
+
+#include "config_file/config_file.h"
+#include "rtg.h"
+#include "rtg-convert.h"
+#include "rtg-output-headless.h"
+#include "log.h"
+#include "metrics/metrics.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint8_t busy = 0;
+uint8_t rtg_on = 0;
+uint8_t rtg_initialized = 0;
+uint8_t emulator_exiting = 0;
+uint8_t rtg_output_in_vblank = 0;
+uint8_t rtg_dpms = 0;
+uint8_t shutdown = 0;
+uint32_t cur_rtg_frame = 0;
+
+extern uint8_t* rtg_mem;
+extern uint8_t display_enabled;
+
+extern uint32_t framebuffer_addr_adj;
+
+extern uint16_t rtg_display_width;
+extern uint16_t rtg_display_height;
+extern uint16_t rtg_display_format;
+extern uint16_t rtg_pitch;
+
+static pthread_t thread_id;
+static uint8_t thread_running;
+static pthread_mutex_t frame_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t palette[256];
+static uint8_t palette_updated;
+
+// The converted frame, laid out like the texture the raylib backend uploads.
+static uint8_t* frame_buf;
+static size_t frame_buf_size;
+static size_t frame_bpp;
+static uint16_t frame_width, frame_height, frame_format, frame_pitch;
+static uint32_t frame_addr;
+static uint8_t frame_valid;
+static uint8_t bad_mode_logged;
+
+static struct rtg_headless_stats stats;
+// Frames since the display was brought up; what capture selection counts.
+static uint32_t frame_seq;
+
+static uint8_t config_loaded;
+static unsigned int output_fps = 60;
+static const char* capture_path;
+static uint8_t capture_per_frame;
+// Per-frame names: capture_path up to the %, the frame number, then capture_suffix.
+static int capture_prefix_len;
+static int capture_digits;
+static const char* capture_suffix;
+static FILE* capture_stream;
+static uint32_t capture_first, capture_last = UINT32_MAX, capture_step = 1;
+static FILE* frame_log;
+static uint8_t* rgb_buf;
+static size_t rgb_buf_size;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void rtg_headless_load_config(void) {
+  if (config_loaded) {
+    return;
+  }
+  config_loaded = 1;
+  output_fps = 60;
+  capture_first = 0;
+  capture_last = UINT32_MAX;
+  capture_step = 1;
+
+  const char* env = getenv("PISTORM_RTG_HEADLESS_FPS");
+  if (env && *env) {
+    output_fps = (unsigned int)strtoul(env, NULL, 0);
+  }
+
+  env = getenv("PISTORM_RTG_CAPTURE_FRAMES");
+  if (env && *env) {
+    char* end = NULL;
+    capture_first = (uint32_t)strtoul(env, &end, 0);
+    capture_last = capture_first;
+    if (*end == '-') {
+      end++;
+      capture_last = (*end && *end != '/') ? (uint32_t)strtoul(end, &end, 0) : UINT32_MAX;
+    }
+    if (*end == '/') {
+      capture_step = (uint32_t)strtoul(end + 1, NULL, 0);
+    }
+    if (!capture_step) {
+      capture_step = 1;
+    }
+  }
+
+  capture_path = getenv("PISTORM_RTG_CAPTURE");
+  if (capture_path && *capture_path) {
+    const char* pct = strchr(capture_path, '%');
+    capture_per_frame = pct != NULL;
+    if (pct) {
+      // Only a frame number conversion is accepted: %u, %d or %0Nu.
+      char* end = NULL;
+      capture_prefix_len = (int)(pct - capture_path);
+      capture_digits = (int)strtol(pct + 1, &end, 10);
+      capture_suffix = (*end == 'u' || *end == 'd') ? end + 1 : NULL;
+      if (!capture_suffix || capture_digits < 0 || strchr(capture_suffix, '%')) {
+        LOG_ERROR("[RTG/HEADLESS] Capture name %s needs a single %%u or %%0Nu.\n", capture_path);
+        capture_path = NULL;
+      }
+    } else {
+      capture_stream = fopen(capture_path, "wb");
+      if (!capture_stream) {
+        LOG_ERROR("[RTG/HEADLESS] Can't open capture stream %s.\n", capture_path);
+        capture_path = NULL;
+      }
+    }
+    if (capture_path) {
+      LOG_INFO("[RTG/HEADLESS] Capturing frames %u-%u/%u to %s (%s).\n", capture_first,
+               capture_last, capture_step, capture_path,
+               capture_per_frame ? "PPM per frame" : "raw RGB24 stream");
+    }
+  } else {
+    capture_path = NULL;
+  }
+
+  env = getenv("PISTORM_RTG_FRAME_LOG");
+  if (env && *env) {
+    frame_log = fopen(env, "w");
+    if (!frame_log) {
+      LOG_ERROR("[RTG/HEADLESS] Can't open frame log %s.\n", env);
+    } else {
+      fprintf(frame_log, "frame,rows,convert_us,capture_us\n");
+    }
+  }
+}
+
+static inline uint8_t expand5(unsigned int v) {
+  return (uint8_t)((v << 3) | (v >> 2));
+}
+
+static inline uint8_t expand6(unsigned int v) {
+  return (uint8_t)((v << 2) | (v >> 4));
+}
+
+// One row of the converted frame to packed RGB. Formats without a CPU
+// converter are still in their VRAM byte order here.
+static void rtg_headless_row_rgb(uint8_t* out, const uint8_t* in, uint16_t format,
+                                 uint16_t width) {
+  for (uint16_t x = 0; x < width; x++, out += 3) {
+    switch (format) {
+    case RTGFMT_RGB565_BE:
+    case RTGFMT_RGB555_BE:
+    case RTGFMT_RGB555_LE:
+    case RTGFMT_BGR565_LE:
+    case RTGFMT_BGR555_LE:
+    case RTGFMT_RGB565_LE: {
+      uint16_t v;
+      if (format == RTGFMT_RGB565_LE) {
+        v = (uint16_t)(in[x * 2] | (in[x * 2 + 1] << 8));
+      } else {
+        memcpy(&v, &in[x * 2], sizeof(v));
+      }
+      out[0] = expand5((v >> 11) & 0x1F);
+      out[1] = expand6((v >> 5) & 0x3F);
+      out[2] = expand5(v & 0x1F);
+      break;
+    }
+    case RTGFMT_YUV422_CGX:
+    case RTGFMT_YUV411:
+    case RTGFMT_YUV411_PC:
+    case RTGFMT_YUV422:
+    case RTGFMT_YUV422_PC:
+    case RTGFMT_YUV422_PA:
+    case RTGFMT_YUV422_PAPC: {
+      uint32_t v;
+      memcpy(&v, &in[x * 4], sizeof(v));
+      out[0] = (uint8_t)(v >> 16);
+      out[1] = (uint8_t)(v >> 8);
+      out[2] = (uint8_t)v;
+      break;
+    }
+    case RTGFMT_8BIT_CLUT:
+    case RTGFMT_RGB32_RGBA:
+      memcpy(out, &in[x * 4], 3);
+      break;
+    case RTGFMT_RGB24:
+      memcpy(out, &in[x * 3], 3);
+      break;
+    case RTGFMT_BGR24:
+      out[0] = in[x * 3 + 2];
+      out[1] = in[x * 3 + 1];
+      out[2] = in[x * 3];
+      break;
+    case RTGFMT_RGB32_ARGB:
+      memcpy(out, &in[x * 4 + 1], 3);
+      break;
+    case RTGFMT_RGB32_ABGR:
+      out[0] = in[x * 4 + 3];
+      out[1] = in[x * 4 + 2];
+      out[2] = in[x * 4 + 1];
+      break;
+    case RTGFMT_RGB32_BGRA:
+      out[0] = in[x * 4 + 2];
+      out[1] = in[x * 4 + 1];
+      out[2] = in[x * 4];
+      break;
+    default:
+      out[0] = out[1] = out[2] = in[x];
+      break;
+    }
+  }
+}
+
+// Called with frame_lock held and a valid frame.
+static int rtg_headless_to_rgb(uint8_t* dst, size_t size) {
+  size_t row = (size_t)frame_width * 3;
+  if (size < row * frame_height) {
+    return 0;
+  }
+  size_t stride = (size_t)frame_width * frame_bpp;
+  for (uint16_t y = 0; y < frame_height; y++) {
+    rtg_headless_row_rgb(dst + (row * y), frame_buf + (stride * y), frame_format, frame_width);
+  }
+  return 1;
+}
+
+static void rtg_headless_capture(uint32_t frame_no) {
+  size_t rgb_size = (size_t)frame_width * frame_height * 3;
+  if (rgb_buf_size < rgb_size) {
+    void* resized = realloc(rgb_buf, rgb_size);
+    if (!resized) {
+      LOG_ERROR("[RTG/HEADLESS] Failed to allocate capture buffer (%zu bytes)\n", rgb_size);
+      return;
+    }
+    rgb_buf = resized;
+    rgb_buf_size = rgb_size;
+  }
+  rtg_headless_to_rgb(rgb_buf, rgb_buf_size);
+
+  if (capture_per_frame) {
+    char name[512];
+    snprintf(name, sizeof(name), "%.*s%0*u%s", capture_prefix_len, capture_path, capture_digits,
+             frame_no, capture_suffix);
+    FILE* out = fopen(name, "wb");
+    if (!out) {
+      LOG_ERROR("[RTG/HEADLESS] Can't write capture %s.\n", name);
+      return;
+    }
+    fprintf(out, "P6\n%u %u\n255\n", frame_width, frame_height);
+    fwrite(rgb_buf, 1, rgb_size, out);
+    fclose(out);
+  } else {
+    fwrite(rgb_buf, 1, rgb_size, capture_stream);
+  }
+  stats.captured++;
+}
+
+// Set the frame buffer up for a new mode. Called with frame_lock held.
+static int rtg_headless_set_mode(uint16_t width, uint16_t height, uint16_t format,
+                                 uint16_t pitch) {
+  size_t bpp = rtg_convert_dst_bpp(format);
+  if (!bpp) {
+    bpp = rtg_pixel_size[format];
+  }
+  size_t bytes = (size_t)width * height * bpp;
+  if (frame_buf_size < bytes) {
+    void* resized = realloc(frame_buf, bytes);
+    if (!resized) {
+      LOG_ERROR("[RTG/HEADLESS] Failed to allocate frame buffer (%zu bytes)\n", bytes);
+      return 0;
+    }
+    frame_buf = resized;
+    frame_buf_size = bytes;
+  }
+  if (frame_width) {
+    LOG_INFO("[RTG/HEADLESS] Mode change: %ux%u fmt=%u pitch=%u -> %ux%u fmt=%u pitch=%u\n",
+             frame_width, frame_height, frame_format, frame_pitch, width, height, format, pitch);
+  }
+  frame_bpp = bpp;
+  frame_width = width;
+  frame_height = height;
+  frame_format = format;
+  frame_pitch = pitch;
+  return 1;
+}
+
+int rtg_headless_render_frame(void) {
+  struct rtg_row_band bands[RTG_MAX_BANDS];
+  unsigned int num_bands = 0;
+  unsigned int rows = 0;
+  uint64_t convert_ns = 0, capture_ns = 0;
+
+  pthread_mutex_lock(&frame_lock);
+  uint32_t frame_no = frame_seq++;
+  cur_rtg_frame++;
+  stats.frames++;
+
+  uint16_t width = rtg_display_width;
+  uint16_t height = rtg_display_height;
+  uint16_t format = rtg_display_format;
+  uint16_t pitch = rtg_pitch;
+  size_t addr = framebuffer_addr_adj;
+  int valid = rtg_on && rtg_mem && format < RTGFMT_NUM && width && height &&
+              pitch >= (size_t)width * rtg_pixel_size[format] && addr < rtg_mem_size &&
+              (size_t)pitch * height <= rtg_mem_size - addr;
+
+  if (!valid) {
+    if (!bad_mode_logged && rtg_on && rtg_mem) {
+      LOG_WARN("[RTG/HEADLESS] Skipping frames: %ux%u fmt=%u pitch=%u addr=0x%08zX\n", width,
+               height, format, pitch, addr);
+      bad_mode_logged = 1;
+    }
+    frame_valid = 0;
+  } else {
+    int force_full = !frame_valid || addr != frame_addr;
+    if (!frame_valid || width != frame_width || height != frame_height ||
+        format != frame_format || pitch != frame_pitch) {
+      frame_valid = (uint8_t)rtg_headless_set_mode(width, height, format, pitch);
+    }
+    frame_addr = (uint32_t)addr;
+    bad_mode_logged = 0;
+    if (format == RTGFMT_8BIT_CLUT && palette_updated) {
+      palette_updated = 0;
+      force_full = 1;
+    }
+
+    // Same row selection as the raylib output: only rows on dirty pages,
+    // everything after a mode, address or palette change.
+    if (frame_valid && rtg_dirty) {
+      num_bands = rtg_collect_dirty_rows(rtg_dirty, RTG_DIRTY_DISPLAY, addr, pitch, height,
+                                         bands);
+    }
+    if (frame_valid && (force_full || !rtg_dirty)) {
+      bands[0].y0 = 0;
+      bands[0].y1 = height;
+      num_bands = 1;
+    }
+
+    if (num_bands) {
+      rtg_convert_fn conv = rtg_convert_lookup(format, RTG_CONVERT_BEST);
+      size_t stride = (size_t)width * frame_bpp;
+      const uint8_t* src = rtg_mem + addr;
+      uint64_t t0 = now_ns();
+      for (unsigned int b = 0; b < num_bands; b++) {
+        for (uint16_t y = bands[b].y0; y < bands[b].y1; y++) {
+          if (conv) {
+            conv(frame_buf + (stride * y), src + ((size_t)pitch * y), width, palette);
+          } else {
+            memcpy(frame_buf + (stride * y), src + ((size_t)pitch * y), stride);
+          }
+        }
+        rows += bands[b].y1 - bands[b].y0;
+      }
+      convert_ns = now_ns() - t0;
+    }
+  }
+
+  if (num_bands) {
+    stats.rendered++;
+    stats.rows += rows;
+    stats.convert_ns += convert_ns;
+    if (!stats.convert_ns_min || convert_ns < stats.convert_ns_min) {
+      stats.convert_ns_min = convert_ns;
+    }
+    if (convert_ns > stats.convert_ns_max) {
+      stats.convert_ns_max = convert_ns;
+    }
+    METRICS_INC(rtg_frames_rendered);
+    METRICS_ADD(rtg_rows_uploaded, rows);
+  } else {
+    stats.skipped++;
+    METRICS_INC(rtg_frames_skipped);
+  }
+
+  if (capture_path && frame_valid && frame_no >= capture_first && frame_no <= capture_last &&
+      (frame_no - capture_first) % capture_step == 0) {
+    uint64_t t0 = now_ns();
+    rtg_headless_capture(frame_no);
+    capture_ns = now_ns() - t0;
+    stats.capture_ns += capture_ns;
+  }
+  if (frame_log) {
+    fprintf(frame_log, "%u,%u,%.1f,%.1f\n", frame_no, rows, (double)convert_ns / 1000.0,
+            (double)capture_ns / 1000.0);
+  }
+  pthread_mutex_unlock(&frame_lock);
+
+  rtg_output_in_vblank = 1;
+  return num_bands != 0;
+}
+
+void rtg_headless_get_stats(struct rtg_headless_stats* out) {
+  pthread_mutex_lock(&frame_lock);
+  *out = stats;
+  pthread_mutex_unlock(&frame_lock);
+}
+
+void rtg_headless_reset_stats(void) {
+  pthread_mutex_lock(&frame_lock);
+  memset(&stats, 0, sizeof(stats));
+  pthread_mutex_unlock(&frame_lock);
+}
+
+int rtg_headless_read_rgb(uint8_t* dst, size_t size, uint16_t* width, uint16_t* height) {
+  int ok = 0;
+  pthread_mutex_lock(&frame_lock);
+  if (frame_valid && frame_buf) {
+    ok = rtg_headless_to_rgb(dst, size);
+    if (width) {
+      *width = frame_width;
+    }
+    if (height) {
+      *height = frame_height;
+    }
+  }
+  pthread_mutex_unlock(&frame_lock);
+  return ok;
+}
+
+static void* rtg_headless_thread(void* arg) {
+  (void)arg;
+  const uint64_t period = 1000000000ull / output_fps;
+  uint64_t next = now_ns() + period;
+
+  LOG_INFO("[RTG/HEADLESS] Frame thread running at %u fps.\n", output_fps);
+  while (!shutdown) {
+    if (rtg_on) {
+      rtg_output_in_vblank = 0;
+      rtg_headless_render_frame();
+    }
+
+    uint64_t now = now_ns();
+    if (!rtg_on) {
+      next = now + period;
+    } else if (now >= next) {
+      // Ran past one or more frame periods.
+      uint64_t lost = ((now - next) / period) + 1;
+      pthread_mutex_lock(&frame_lock);
+      stats.dropped += lost;
+      pthread_mutex_unlock(&frame_lock);
+      next += lost * period;
+    }
+    uint64_t wait = next - now_ns();
+    if (wait < period) {
+      struct timespec ts = {(time_t)(wait / 1000000000ull), (long)(wait % 1000000000ull)};
+      nanosleep(&ts, NULL);
+    }
+    next += period;
+  }
+  return arg;
+}
+
+static void rtg_headless_log_stats(void) {
+  struct rtg_headless_stats s;
+  rtg_headless_get_stats(&s);
+  LOG_INFO("[RTG/HEADLESS] %llu frames: %llu rendered, %llu skipped, %llu dropped, %llu captured, "
+           "%llu rows; conversion avg %.1f us (min %.1f, max %.1f)\n",
+           (unsigned long long)s.frames, (unsigned long long)s.rendered,
+           (unsigned long long)s.skipped, (unsigned long long)s.dropped,
+           (unsigned long long)s.captured, (unsigned long long)s.rows,
+           s.rendered ? (double)s.convert_ns / (double)s.rendered / 1000.0 : 0.0,
+           (double)s.convert_ns_min / 1000.0, (double)s.convert_ns_max / 1000.0);
+}
+
+void rtg_init_display(void) {
+  rtg_on = 1;
+  rtg_headless_load_config();
+
+  if (!rtg_initialized) {
+    rtg_initialized = 1;
+    shutdown = 0;
+    frame_seq = 0;
+    if (output_fps) {
+      int err = pthread_create(&thread_id, NULL, &rtg_headless_thread, NULL);
+      if (err != 0) {
+        LOG_ERROR("[RTG/HEADLESS] Can't create frame thread: %s\n", strerror(err));
+      } else {
+        thread_running = 1;
+        pthread_setname_np(thread_id, "pistorm: rtg");
+      }
+    }
+  }
+  LOG_INFO("RTG display enabled.\n");
+}
+
+void rtg_shutdown_display(void) {
+  LOG_INFO("RTG display disabled.\n");
+
+  rtg_on = 0;
+
+  if (!emulator_exiting) {
+    display_enabled = 0xFF;
+    return;
+  }
+
+  shutdown = 1;
+  if (thread_running) {
+    pthread_join(thread_id, NULL);
+    thread_running = 0;
+  }
+  rtg_headless_log_stats();
+  if (capture_stream) {
+    fclose(capture_stream);
+    capture_stream = NULL;
+    capture_path = NULL;
+  }
+  if (frame_log) {
+    fclose(frame_log);
+    frame_log = NULL;
+  }
+  // The next rtg_init_display() reads the environment again.
+  config_loaded = 0;
+  frame_valid = 0;
+  rtg_initialized = 0;
+  display_enabled = 0xFF;
+}
+
+void rtg_set_clut_entry(uint8_t index, uint32_t xrgb) {
+  // Same byte order as the raylib palette: R, G, B, A in memory.
+  unsigned char* src = (unsigned char*)&xrgb;
+  unsigned char* dst = (unsigned char*)&palette[index];
+  dst[0] = src[2];
+  dst[1] = src[1];
+  dst[2] = src[0];
+  dst[3] = 0xFF;
+  palette_updated = 1;
+}
+
+void rtg_enable_mouse_cursor(uint8_t enable) {
+  (void)enable;
+}
+void rtg_set_mouse_cursor_pos(int16_t x, int16_t y) {
+  (void)x;
+  (void)y;
+}
+void rtg_set_cursor_clut_entry(uint8_t r, uint8_t g, uint8_t b, uint8_t idx) {
+  (void)r;
+  (void)g;
+  (void)b;
+  (void)idx;
+}
+void rtg_set_mouse_cursor_image(uint8_t* src, uint8_t w, uint8_t h) {
+  (void)src;
+  (void)w;
+  (void)h;
+}
+void rtg_show_fps(uint8_t enable) {
+  (void)enable;
+}
+void rtg_set_scale_mode(uint16_t scale_mode) {
+  (void)scale_mode;
+}
+uint16_t rtg_get_scale_mode(void) {
+  return 0;
+}
+void rtg_set_scale_rect(uint16_t scale_mode, int16_t x1, int16_t y1, int16_t x2, int16_t y2) {
+  (void)scale_mode;
+  (void)x1;
+  (void)y1;
+  (void)x2;
+  (void)y2;
+}
+void rtg_set_scale_filter(uint16_t _filter_mode) {
+  (void)_filter_mode;
+}
+void rtg_set_screen_width(uint32_t width) {
+  (void)width;
+}
+void rtg_set_screen_height(uint32_t height) {
+  (void)height;
+}
+void rtg_show_clut_cursor(uint8_t show) {
+  (void)show;
+}
+void rtg_set_clut_cursor(uint8_t* bmp, uint32_t* pal, int16_t offs_x, int16_t offs_y, uint16_t w,
+                         uint16_t h, uint8_t mask_color) {
+  (void)bmp;
+  (void)pal;
+  (void)offs_x;
+  (void)offs_y;
+  (void)w;
+  (void)h;
+  (void)mask_color;
+}
+uint16_t rtg_get_scale_filter(void) {
+  return 0;
+}
+void rtg_palette_debug(uint8_t enable) {
+  (void)enable;
+}
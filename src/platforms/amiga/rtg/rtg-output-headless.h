@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_RTG_OUTPUT_HEADLESS_H
+#define PISTORM_RTG_OUTPUT_HEADLESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Headless RTG output (make USE_RAYLIB=0 RTG_HEADLESS=1). Runs the same dirty
+ * row tracking and CPU conversion as the raylib backend into a memory frame,
+ * without a display, so RTG can be exercised and timed on a build machine.
+ *
+ *   PISTORM_RTG_HEADLESS_FPS     output rate of the frame thread (default 60);
+ *                                0 runs no thread, frames only come from
+ *                                rtg_headless_render_frame()
+ *   PISTORM_RTG_CAPTURE          capture file; a name containing a printf
+ *                                conversion (frame-%05u.ppm) gets one PPM per
+ *                                frame, anything else a raw RGB24 stream
+ *   PISTORM_RTG_CAPTURE_FRAMES   frames to capture: first[-[last]][/step],
+ *                                e.g. 100-200/10 (default: all)
+ *   PISTORM_RTG_FRAME_LOG        CSV with one line per frame: number, rows
+ *                                converted, conversion and capture time in us
+ */
+
+struct rtg_headless_stats {
+  uint64_t frames;    // frames produced, rendered or skipped
+  uint64_t rendered;  // frames that converted at least one row
+  uint64_t skipped;   // nothing on screen changed, or no valid mode
+  uint64_t dropped;   // frame periods lost because the thread ran late
+  uint64_t captured;  // frames written to the capture file(s)
+  uint64_t rows;      // rows converted
+  uint64_t convert_ns;      // total conversion time of rendered frames
+  uint64_t convert_ns_min;
+  uint64_t convert_ns_max;
+  uint64_t capture_ns;      // total time spent writing captures
+};
+
+// Produce one frame on the calling thread. Returns 1 if rows were converted,
+// 0 if the frame was skipped.
+int rtg_headless_render_frame(void);
+
+void rtg_headless_get_stats(struct rtg_headless_stats* stats);
+void rtg_headless_reset_stats(void);
+
+// Copy the current frame as packed 8-bit RGB (width * height * 3 bytes).
+// Returns 0 if no frame has been converted yet or size is too small.
+int rtg_headless_read_rgb(uint8_t* dst, size_t size, uint16_t* width, uint16_t* height);
+
+#endif /* PISTORM_RTG_OUTPUT_HEADLESS_H */
@@ -4,9 +4,12 @@
 #include "platforms/amiga/pistorm-dev/pistorm-dev-enums.h"
 #include "emulator.h"
 #include "rtg.h"
+#include "rtg-convert.h"
 #include "log.h"
+#include "metrics/metrics.h"
 
 #include "raylib.h"
+#include "rlgl.h"
 
 #include <dirent.h>
 #include <endian.h>
@@ -17,73 +20,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-// Helper functions for safe unaligned memory access
-static inline uint16_t load_u16_be(const uint8_t *p) {
-    uint16_t v;
-    memcpy(&v, p, sizeof v);
-    return be16toh(v);
-}
-static inline uint16_t load_u16_le(const uint8_t *p) {
-    uint16_t v;
-    memcpy(&v, p, sizeof v);
-    return le16toh(v);
-}
-
-static inline uint32_t load_u32_be(const uint8_t *p) {
-    uint32_t v;
-    memcpy(&v, p, sizeof v);
-    return be32toh(v);
-}
-
-static inline uint16_t rtg_rgb555_to_rgb565(uint16_t v) {
-    uint16_t r = (v >> 10) & 0x1F;
-    uint16_t g = (v >> 5) & 0x1F;
-    uint16_t b = v & 0x1F;
-    uint16_t g6 = (uint16_t)((g << 1) | (g >> 4));
-    return (uint16_t)((r << 11) | (g6 << 5) | b);
-}
-
-static inline uint16_t rtg_bgr565_to_rgb565(uint16_t v) {
-    uint16_t b = (v >> 11) & 0x1F;
-    uint16_t g = (v >> 5) & 0x3F;
-    uint16_t r = v & 0x1F;
-    return (uint16_t)((r << 11) | (g << 5) | b);
-}
-
-static inline uint16_t rtg_bgr555_to_rgb565(uint16_t v) {
-    uint16_t b = (v >> 10) & 0x1F;
-    uint16_t g = (v >> 5) & 0x1F;
-    uint16_t r = v & 0x1F;
-    uint16_t g6 = (uint16_t)((g << 1) | (g >> 4));
-    return (uint16_t)((r << 11) | (g6 << 5) | b);
-}
-
-static inline uint8_t clamp_u8(int v) {
-    if (v < 0) {
-        return 0;
-    }
-    if (v > 255) {
-        return 255;
-    }
-    return (uint8_t)v;
-}
-
-static inline uint32_t rtg_pack_rgba(uint8_t r, uint8_t g, uint8_t b) {
-    return 0xFF000000u | ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
-}
-
-static inline uint32_t rtg_yuv601_to_rgba(uint8_t y, uint8_t u, uint8_t v) {
-    int c = (int)y - 16;
-    int d = (int)u - 128;
-    int e = (int)v - 128;
-    int r = (298 * c + 409 * e + 128) >> 8;
-    int g = (298 * c - 100 * d - 208 * e + 128) >> 8;
-    int b = (298 * c + 516 * d + 128) >> 8;
-    return rtg_pack_rgba(clamp_u8(r), clamp_u8(g), clamp_u8(b));
-}
-
 static const char* rtg_resolve_shader_path(const char* filename, char* buf, size_t buf_len) {
     const char* root = getenv("PISTORM_ROOT");
     if (root && *root) {
@@ -157,6 +96,7 @@ static uint8_t debug_palette        = 0;
 static uint8_t show_fps             = 0;
 static uint8_t palette_updated      = 0;
 static int clut_cpu_mode            = -1;
+static int convert_cpu_mode         = -1;
 static uint8_t yuv_log_once         = 0;
 
 static uint16_t mouse_cursor_w      = 16;
@@ -172,8 +112,6 @@ static int32_t pi_screen_height     = 720;
 static uint8_t pi_screen_width_set  = 0;
 static uint8_t pi_screen_height_set = 0;
 
-static const size_t rtg_mem_size = 40u * SIZE_MEGA;
-
 struct rtg_shared_data {
   uint16_t *width;
   uint16_t *height;
@@ -406,13 +344,160 @@ static inline int rtg_format_is_yuv(uint16_t format) {
   }
 }
 
+/*
+ * Conversion shaders for the 16-bit and YUV formats. VRAM rows are uploaded
+ * as they are (two bytes per texel, one for YUV411) and the fragment shader
+ * unpacks them; the rtg-convert.c converters are only used when a shader did
+ * not load or PISTORM_RTG_CONVERT_CPU is set.
+ */
+static struct {
+  Shader rgb16;
+  Shader yuv422;
+  Shader yuv411;
+  int rgb16_ok;
+  int yuv422_ok;
+  int yuv411_ok;
+  int rgb16_big_endian;
+  int rgb16_555;
+  int rgb16_bgr;
+  int yuv422_width;
+  int yuv422_sel[4];
+  int yuv411_width;
+  int yuv411_pc;
+} conv_shaders;
+
+static int rtg_shader_loaded(Shader shader, const char* name) {
+  // A missing file comes back as the default shader, a broken one with id 0.
+  if(!IsShaderValid(shader) || shader.id == rlGetShaderIdDefault()) {
+    LOG_WARN("[RTG/RAYLIB] %s not usable, converting on the CPU instead.\n", name);
+    return 0;
+  }
+  return 1;
+}
+
+static void rtg_load_convert_shaders(void) {
+  static const char* sel_names[4] = {"selY0", "selY1", "selU", "selV"};
+  char shader_path[PATH_MAX];
+
+  conv_shaders.rgb16 = LoadShader(NULL, rtg_resolve_shader_path("rgb16.shader", shader_path,
+                                                                sizeof(shader_path)));
+  conv_shaders.rgb16_ok = rtg_shader_loaded(conv_shaders.rgb16, "rgb16.shader");
+  conv_shaders.rgb16_big_endian = GetShaderLocation(conv_shaders.rgb16, "bigEndian");
+  conv_shaders.rgb16_555 = GetShaderLocation(conv_shaders.rgb16, "rgb555");
+  conv_shaders.rgb16_bgr = GetShaderLocation(conv_shaders.rgb16, "bgr");
+
+  conv_shaders.yuv422 = LoadShader(NULL, rtg_resolve_shader_path("yuv422.shader", shader_path,
+                                                                 sizeof(shader_path)));
+  conv_shaders.yuv422_ok = rtg_shader_loaded(conv_shaders.yuv422, "yuv422.shader");
+  conv_shaders.yuv422_width = GetShaderLocation(conv_shaders.yuv422, "texWidth");
+  for (int i = 0; i < 4; i++) {
+    conv_shaders.yuv422_sel[i] = GetShaderLocation(conv_shaders.yuv422, sel_names[i]);
+  }
+
+  conv_shaders.yuv411 = LoadShader(NULL, rtg_resolve_shader_path("yuv411.shader", shader_path,
+                                                                 sizeof(shader_path)));
+  conv_shaders.yuv411_ok = rtg_shader_loaded(conv_shaders.yuv411, "yuv411.shader");
+  conv_shaders.yuv411_width = GetShaderLocation(conv_shaders.yuv411, "texWidth");
+  conv_shaders.yuv411_pc = GetShaderLocation(conv_shaders.yuv411, "pc");
+}
+
+static void rtg_unload_convert_shaders(void) {
+  UnloadShader(conv_shaders.rgb16);
+  UnloadShader(conv_shaders.yuv422);
+  UnloadShader(conv_shaders.yuv411);
+  memset(&conv_shaders, 0, sizeof(conv_shaders));
+}
+
+// The shader that converts this format from its raw upload, or NULL when the
+// CPU converter has to run.
+static Shader* rtg_convert_shader(uint16_t format) {
+  if(convert_cpu_mode) {
+    return NULL;
+  }
+  switch (format) {
+  case RTGFMT_RGB565_BE:
+  case RTGFMT_RGB555_BE:
+  case RTGFMT_RGB555_LE:
+  case RTGFMT_BGR565_LE:
+  case RTGFMT_BGR555_LE:
+    return conv_shaders.rgb16_ok ? &conv_shaders.rgb16 : NULL;
+  case RTGFMT_YUV422_CGX:
+  case RTGFMT_YUV422:
+  case RTGFMT_YUV422_PC:
+  case RTGFMT_YUV422_PA:
+  case RTGFMT_YUV422_PAPC:
+    return conv_shaders.yuv422_ok ? &conv_shaders.yuv422 : NULL;
+  case RTGFMT_YUV411:
+  case RTGFMT_YUV411_PC:
+    return conv_shaders.yuv411_ok ? &conv_shaders.yuv411 : NULL;
+  default:
+    return NULL;
+  }
+}
+
+static void rtg_begin_convert_shader(Shader* shader, uint16_t format, uint16_t width) {
+  float tex_width = (float)width;
+
+  BeginShaderMode(*shader);
+  if(shader == &conv_shaders.rgb16) {
+    float big_endian = (format == RTGFMT_RGB565_BE || format == RTGFMT_RGB555_BE) ? 1.0f : 0.0f;
+    float rgb555 = (format == RTGFMT_RGB555_BE || format == RTGFMT_RGB555_LE ||
+                    format == RTGFMT_BGR555_LE) ? 1.0f : 0.0f;
+    float bgr = (format == RTGFMT_BGR565_LE || format == RTGFMT_BGR555_LE) ? 1.0f : 0.0f;
+    SetShaderValue(*shader, conv_shaders.rgb16_big_endian, &big_endian, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(*shader, conv_shaders.rgb16_555, &rgb555, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(*shader, conv_shaders.rgb16_bgr, &bgr, SHADER_UNIFORM_FLOAT);
+  } else if(shader == &conv_shaders.yuv422) {
+    uint8_t order[4];
+    rtg_convert_yuv422_order(format, order);
+    SetShaderValue(*shader, conv_shaders.yuv422_width, &tex_width, SHADER_UNIFORM_FLOAT);
+    for (int i = 0; i < 4; i++) {
+      Vector4 sel = {order[i] == 0, order[i] == 1, order[i] == 2, order[i] == 3};
+      SetShaderValue(*shader, conv_shaders.yuv422_sel[i], &sel, SHADER_UNIFORM_VEC4);
+    }
+  } else {
+    float pc = (format == RTGFMT_YUV411_PC) ? 1.0f : 0.0f;
+    SetShaderValue(*shader, conv_shaders.yuv411_width, &tex_width, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(*shader, conv_shaders.yuv411_pc, &pc, SHADER_UNIFORM_FLOAT);
+  }
+}
+
 static void rtg_copy_tight_rows(uint8_t* dst, const uint8_t* src, size_t row_bytes, size_t pitch,
-                                size_t height) {
-  for (size_t y = 0; y < height; y++) {
+                                size_t y0, size_t y1) {
+  for (size_t y = y0; y < y1; y++) {
     memcpy(dst + (y * row_bytes), src + (y * pitch), row_bytes);
   }
 }
 
+// Redraw at least this often while idle so the window keeps handling events.
+#define RTG_IDLE_REDRAW_FRAMES 30
+#define RTG_FRAME_US (1000000 / 60)
+
+// Run a CPU-side converter over the given row bands of the frame and upload
+// each band from the tightly packed buffer.
+static void rtg_convert_and_upload(Texture tex, rtg_convert_fn conv, uint8_t* buf,
+                                   size_t dst_bpp, const uint8_t* src, size_t pitch,
+                                   uint16_t width, const struct rtg_row_band* bands,
+                                   unsigned int num_bands, const uint32_t* pal) {
+  size_t dst_stride = (size_t)width * dst_bpp;
+  for (unsigned int b = 0; b < num_bands; b++) {
+    uint16_t y0 = bands[b].y0;
+    uint16_t y1 = bands[b].y1;
+    for (uint16_t y = y0; y < y1; y++) {
+      conv(buf + (dst_stride * y), src + (pitch * y), width, pal);
+    }
+    Rectangle rows = {0, (float)y0, (float)width, (float)(y1 - y0)};
+    UpdateTextureRec(tex, rows, buf + (dst_stride * y0));
+    METRICS_ADD(rtg_rows_uploaded, y1 - y0);
+  }
+}
+
+static uint64_t rtg_thread_cpu_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
 void rtg_scale_output(uint16_t width, uint16_t height) {
   static uint8_t center = 1;
   float screen_w = (float)pi_screen_width;
@@ -532,6 +617,16 @@ void* rtgThread(void* args) {
   size_t tight_buf_size = 0;
   uint32_t last_frame_addr = 0;
   uint32_t frame_no = 0;
+  struct rtg_row_band bands[RTG_MAX_BANDS];
+  unsigned int num_bands = 0;
+  int force_full = 1;
+  int texture_pending = 1;
+  unsigned int clean_frames = 0;
+  int16_t drawn_cursor_x = 0;
+  int16_t drawn_cursor_y = 0;
+  uint8_t drawn_cursor_on = 0;
+  Rectangle drawn_dst = {0};
+  uint64_t cpu_start_ns = rtg_thread_cpu_ns();
 
   rtg_share_data.format = &rtg_display_format;
   rtg_share_data.width = &rtg_display_width;
@@ -583,6 +678,14 @@ void* rtgThread(void* args) {
     }
   }
 
+  if (convert_cpu_mode < 0) {
+    const char* env = getenv("PISTORM_RTG_CONVERT_CPU");
+    convert_cpu_mode = (env && *env && atoi(env) != 0) ? 1 : 0;
+    if (convert_cpu_mode) {
+      LOG_INFO("[RTG/RAYLIB] CPU 16-bit/YUV conversion enabled via PISTORM_RTG_CONVERT_CPU.\n");
+    }
+  }
+
   Color bef = {0, 64, 128, 255};
   Color black = {0, 0, 0, 255};
 
@@ -599,6 +702,7 @@ void* rtgThread(void* args) {
                                                                         shader_path,
                                                                         sizeof(shader_path)));
   int clut_loc = GetShaderLocation(clut_shader, "texture1");
+  rtg_load_convert_shaders();
 
   raylib_clut.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
   raylib_clut.width = 256;
@@ -635,6 +739,8 @@ reinit_raylib:;
     }
     UnloadTexture(raylib_texture);
     old_filter_mode = -1;
+    force_full = 1;
+    texture_pending = 1;
     reinit = 0;
   }
 
@@ -675,7 +781,12 @@ reinit_raylib:;
   int pitch_ok = (pitch >= row_bytes);
   int addr_ok = pitch_ok && (addr < rtg_mem_size) && (addr + needed <= rtg_mem_size);
 
-  if ((format == RTGFMT_8BIT_CLUT && clut_cpu_mode) || rtg_format_is_yuv(format)) {
+  Shader* convert_shader = rtg_convert_shader(format);
+  if (convert_shader) {
+    // Raw VRAM bytes, the shader does the unpacking.
+    raylib_fb.format = (bpp == 1) ? PIXELFORMAT_UNCOMPRESSED_GRAYSCALE
+                                  : PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA;
+  } else if ((format == RTGFMT_8BIT_CLUT && clut_cpu_mode) || rtg_format_is_yuv(format)) {
     raylib_fb.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
   } else {
     raylib_fb.format = (int)rtg_to_raylib[format];
@@ -701,7 +812,7 @@ reinit_raylib:;
     }
     memset(tight_buf, 0, tight_size);
     raylib_fb.data = tight_buf;
-  } else if(rtg_format_is_yuv(format)) {
+  } else if(rtg_format_is_yuv(format) && !convert_shader) {
     size_t yuv_bytes = (size_t)width * height * sizeof(uint32_t);
     if(yuv_buf_size < yuv_bytes) {
       void* resized = realloc(yuv_buf, yuv_bytes);
@@ -715,9 +826,10 @@ reinit_raylib:;
     }
     memset(yuv_buf, 0, yuv_bytes);
     raylib_fb.data = yuv_buf;
-  } else if(format == RTGFMT_RGB565_BE || format == RTGFMT_RGB555_BE ||
-            format == RTGFMT_RGB555_LE || format == RTGFMT_BGR565_LE ||
-            format == RTGFMT_BGR555_LE) {
+  } else if(!convert_shader &&
+            (format == RTGFMT_RGB565_BE || format == RTGFMT_RGB555_BE ||
+             format == RTGFMT_RGB555_LE || format == RTGFMT_BGR565_LE ||
+             format == RTGFMT_BGR555_LE)) {
     if((pitch % 2) != 0) {
       LOG_WARN("[RTG/RAYLIB] 16-bit pitch not aligned: pitch=%u\n", pitch);
       reinit = 1;
@@ -733,41 +845,10 @@ reinit_raylib:;
       indexed_buf = resized;
       indexed_buf_size = tight_size;
     }
-    size_t src_stride = pitch / 2;
+    rtg_convert_fn conv = rtg_convert_lookup(format, RTG_CONVERT_BEST);
     for (uint16_t y = 0; y < height; y++) {
-      for (uint16_t x = 0; x < width; x++) {
-        size_t src_idx = (x + (y * src_stride)) * sizeof(uint16_t);
-        const uint8_t* src_ptr = data->memory + addr + src_idx;
-        uint16_t raw = 0;
-        uint16_t rgb565 = 0;
-        switch (format) {
-        case RTGFMT_RGB565_BE:
-          raw = load_u16_be(src_ptr);
-          rgb565 = raw;
-          break;
-        case RTGFMT_RGB555_BE:
-          raw = load_u16_be(src_ptr);
-          rgb565 = rtg_rgb555_to_rgb565(raw);
-          break;
-        case RTGFMT_RGB555_LE:
-          raw = load_u16_le(src_ptr);
-          rgb565 = rtg_rgb555_to_rgb565(raw);
-          break;
-        case RTGFMT_BGR565_LE:
-          raw = load_u16_le(src_ptr);
-          rgb565 = rtg_bgr565_to_rgb565(raw);
-          break;
-        case RTGFMT_BGR555_LE:
-          raw = load_u16_le(src_ptr);
-          rgb565 = rtg_bgr555_to_rgb565(raw);
-          break;
-        default:
-          raw = load_u16_le(src_ptr);
-          rgb565 = raw;
-          break;
-        }
-        indexed_buf[x + (y * width)] = rgb565;
-      }
+      conv(indexed_buf + ((size_t)width * y), data->memory + addr + ((size_t)pitch * y), width,
+           NULL);
     }
     raylib_fb.data = indexed_buf;
   } else if(format == RTGFMT_8BIT_CLUT && clut_cpu_mode) {
@@ -795,7 +876,7 @@ reinit_raylib:;
       tight_buf = resized;
       tight_buf_size = tight_size;
     }
-    rtg_copy_tight_rows(tight_buf, data->memory + addr, row_bytes, pitch, height);
+    rtg_copy_tight_rows(tight_buf, data->memory + addr, row_bytes, pitch, 0, height);
     raylib_fb.data = tight_buf;
   } else {
     raylib_fb.data = &data->memory[frame_addr];
@@ -844,6 +925,8 @@ reinit_raylib:;
       if(current_addr != last_frame_addr) {
         LOG_DEBUG("[RTG/RAYLIB] FB addr update: 0x%08X\n", current_addr);
         last_frame_addr = current_addr;
+        // Page flip: the dirty map only describes the old buffer.
+        force_full = 1;
       }
 
       if(frame_no < 3) {
@@ -858,28 +941,80 @@ reinit_raylib:;
                   raylib_texture.id);
       }
 
+      int view_changed = 0;
       if(old_filter_mode != filter_mode) {
         old_filter_mode = filter_mode;
+        view_changed = 1;
         SetTextureFilter(raylib_texture, filter_mode);
         SetTextureFilter(raylib_cursor_texture, filter_mode);
       }
       /* If we are not in 16bit mode then don't use any filtering - otherwise force_filter_mode to
-       * no smoothing */
+       * no smoothing. The conversion shaders need the raw texels unfiltered as well. */
       if(force_filter_mode == 0) {
-        if(bpp != 2 && filter_mode != 0) {
-          LOG_DEBUG("[RTG/RAYLIB] Disabling smoothing (non-16bpp mode)\n");
+        if((bpp != 2 || convert_shader) && filter_mode != 0) {
+          LOG_DEBUG("[RTG/RAYLIB] Disabling smoothing (non-16bpp mode or conversion shader)\n");
           force_filter_mode = 1;
           old_filter_mode = filter_mode;
+          view_changed = 1;
           SetTextureFilter(raylib_texture, 0);
           SetTextureFilter(raylib_cursor_texture, 0);
         }
       } else {
-        if(bpp == 2) {
+        if(bpp == 2 && !convert_shader) {
           LOG_DEBUG("[RTG/RAYLIB] Restoring smoothing (16bpp mode)\n");
           force_filter_mode = 0;
           old_filter_mode = -1;
         }
       }
+
+      size_t frame_addr_offset = (size_t)current_addr;
+      size_t addr_offset = frame_addr_offset;
+      size_t frame_needed = (size_t)current_pitch * height;
+      int frame_ok = frame_addr_offset < rtg_mem_size &&
+                     frame_needed <= rtg_mem_size - frame_addr_offset;
+      rtg_convert_fn frame_conv = rtg_convert_lookup(current_format, RTG_CONVERT_BEST);
+
+      // Only rows whose VRAM pages were written since the last upload are
+      // converted and sent to the texture. Without a dirty map (or when the
+      // CPU-side CLUT expansion has a new palette) everything is redone.
+      num_bands = 0;
+      if(frame_ok && rtg_dirty && current_pitch >= row_bytes) {
+        num_bands = rtg_collect_dirty_rows(rtg_dirty, RTG_DIRTY_DISPLAY, addr_offset,
+                                           current_pitch, height, bands);
+      }
+      if(force_full || !rtg_dirty || (palette_updated && clut_cpu_mode)) {
+        bands[0].y0 = 0;
+        bands[0].y1 = height;
+        num_bands = 1;
+        force_full = 0;
+      }
+
+      uint8_t cursor_on = mouse_cursor_enabled || clut_cursor_enabled;
+      if(cursor_on != drawn_cursor_on ||
+          (cursor_on && (mouse_cursor_x != drawn_cursor_x || mouse_cursor_y != drawn_cursor_y))) {
+        view_changed = 1;
+      }
+      if(dstscale.x != drawn_dst.x || dstscale.y != drawn_dst.y ||
+          dstscale.width != drawn_dst.width || dstscale.height != drawn_dst.height) {
+        view_changed = 1;
+      }
+
+      // Nothing on screen would change: keep the last presented frame. An
+      // occasional redraw still goes through so window events get serviced.
+      if(!num_bands && !texture_pending && !view_changed && !cursor_image_updated &&
+          !palette_updated && !show_fps && clean_frames < RTG_IDLE_REDRAW_FRAMES) {
+        clean_frames++;
+        cur_rtg_frame++;
+        METRICS_INC(rtg_frames_skipped);
+        usleep(RTG_FRAME_US);
+        goto frame_done;
+      }
+      clean_frames = 0;
+      drawn_cursor_on = cursor_on;
+      drawn_cursor_x = mouse_cursor_x;
+      drawn_cursor_y = mouse_cursor_y;
+      drawn_dst = dstscale;
+
       BeginDrawing();
       ClearBackground(black);
       rtg_output_in_vblank = 0;
@@ -902,6 +1037,14 @@ reinit_raylib:;
       case RTGFMT_RGB32_ABGR:
         BeginShaderMode(abgr_swizzle_shader);
         break;
+      default:
+        if(convert_shader) {
+          rtg_begin_convert_shader(convert_shader, format, width);
+        } else if(rtg_format_is_yuv(format)) {
+          // The CPU YUV converters write 0xAARRGGBB words, i.e. B G R A bytes.
+          BeginShaderMode(bgra_swizzle_shader);
+        }
+        break;
       }
 
       DrawTexturePro(raylib_texture, srcrect, dstscale, origin, 0.0f, RAYWHITE);
@@ -918,6 +1061,11 @@ reinit_raylib:;
       case RTGFMT_RGB32_ABGR:
         EndShaderMode();
         break;
+      default:
+        if(convert_shader || rtg_format_is_yuv(format)) {
+          EndShaderMode();
+        }
+        break;
       }
 
       if(mouse_cursor_enabled || clut_cursor_enabled) {
@@ -955,17 +1103,21 @@ reinit_raylib:;
 
       rtg_output_in_vblank = 1;
       cur_rtg_frame++;
-      size_t frame_addr_offset = (size_t)current_addr;
-      size_t addr_offset = frame_addr_offset;
-      size_t frame_needed = (size_t)current_pitch * height;
+      texture_pending = (num_bands || cursor_image_updated || palette_updated);
 
-      if(current_pitch < row_bytes) {
+      // Counted as rendered once its damage has been uploaded as well.
+      uint8_t skipped = 0;
+      if(!num_bands) {
+        // Only the cursor, palette or view changed.
+      } else if(current_pitch < row_bytes) {
         LOG_WARN("[RTG/RAYLIB] Frame pitch too small: pitch=%u row_bytes=%zu\n", current_pitch,
                  row_bytes);
-      } else if(frame_addr_offset >= rtg_mem_size || frame_needed > rtg_mem_size - frame_addr_offset) {
+        skipped = 1;
+      } else if(!frame_ok) {
         LOG_WARN("[RTG/RAYLIB] Framebuffer OOB: addr=0x%08X needed=%zu limit=%zu\n", current_addr,
                  frame_needed, rtg_mem_size);
-      } else if(rtg_format_is_yuv(current_format)) {
+        skipped = 1;
+      } else if(rtg_format_is_yuv(current_format) && !convert_shader) {
         size_t yuv_bytes = (size_t)width * height * sizeof(uint32_t);
         if(yuv_buf_size < yuv_bytes) {
           void* resized = realloc(yuv_buf, yuv_bytes);
@@ -976,96 +1128,12 @@ reinit_raylib:;
             yuv_buf_size = yuv_bytes;
           }
         }
-        if(yuv_buf) {
-          switch (current_format) {
-          case RTGFMT_YUV422_CGX:
-          case RTGFMT_YUV422:
-          case RTGFMT_YUV422_PC:
-          case RTGFMT_YUV422_PA:
-          case RTGFMT_YUV422_PAPC:
-            for (uint16_t y = 0; y < height; y++) {
-              const uint8_t* src = data->memory + addr_offset + (size_t)current_pitch * y;
-              uint32_t* dst = yuv_buf + (size_t)width * y;
-              uint16_t x = 0;
-              for (; x + 1 < width; x += 2) {
-                uint8_t b0 = src[0];
-                uint8_t b1 = src[1];
-                uint8_t b2 = src[2];
-                uint8_t b3 = src[3];
-                uint8_t y0 = 0;
-                uint8_t y1 = 0;
-                uint8_t u0 = 128;
-                uint8_t v0 = 128;
-                switch (current_format) {
-                case RTGFMT_YUV422_CGX: // Y0 V0 Y1 U0
-                  y0 = b0; v0 = b1; y1 = b2; u0 = b3;
-                  break;
-                case RTGFMT_YUV422: // Y1 U0 Y0 V0
-                  y1 = b0; u0 = b1; y0 = b2; v0 = b3;
-                  break;
-                case RTGFMT_YUV422_PC: // V0 Y0 U0 Y1
-                  v0 = b0; y0 = b1; u0 = b2; y1 = b3;
-                  break;
-                case RTGFMT_YUV422_PA: // Y0 Y1 V0 U0
-                  y0 = b0; y1 = b1; v0 = b2; u0 = b3;
-                  break;
-                case RTGFMT_YUV422_PAPC: // U0 V0 Y1 Y0
-                  u0 = b0; v0 = b1; y1 = b2; y0 = b3;
-                  break;
-                default:
-                  y0 = b0; v0 = b1; y1 = b2; u0 = b3;
-                  break;
-                }
-                dst[x] = rtg_yuv601_to_rgba(y0, u0, v0);
-                dst[x + 1] = rtg_yuv601_to_rgba(y1, u0, v0);
-                src += 4;
-              }
-              if(x < width) {
-                uint8_t y0 = src[0];
-                dst[x] = rtg_yuv601_to_rgba(y0, 128, 128);
-              }
-            }
-            break;
-          case RTGFMT_YUV411:
-          case RTGFMT_YUV411_PC:
-            for (uint16_t y = 0; y < height; y++) {
-              const uint8_t* src = data->memory + addr_offset + (size_t)current_pitch * y;
-              uint32_t* dst = yuv_buf + (size_t)width * y;
-              uint16_t x = 0;
-              for (; x + 3 < width; x += 4) {
-                uint32_t pack = load_u32_be(src);
-                if(current_format == RTGFMT_YUV411_PC) {
-                  pack = __builtin_bswap32(pack);
-                }
-                uint8_t u6 = (uint8_t)((pack >> 26) & 0x3F);
-                uint8_t y0 = (uint8_t)((pack >> 21) & 0x1F);
-                uint8_t y1 = (uint8_t)((pack >> 16) & 0x1F);
-                uint8_t v6 = (uint8_t)((pack >> 10) & 0x3F);
-                uint8_t y2 = (uint8_t)((pack >> 5) & 0x1F);
-                uint8_t y3 = (uint8_t)(pack & 0x1F);
-                uint8_t u0 = (uint8_t)((u6 << 2) | (u6 >> 4));
-                uint8_t v0 = (uint8_t)((v6 << 2) | (v6 >> 4));
-                uint8_t yy0 = (uint8_t)((y0 << 3) | (y0 >> 2));
-                uint8_t yy1 = (uint8_t)((y1 << 3) | (y1 >> 2));
-                uint8_t yy2 = (uint8_t)((y2 << 3) | (y2 >> 2));
-                uint8_t yy3 = (uint8_t)((y3 << 3) | (y3 >> 2));
-                dst[x] = rtg_yuv601_to_rgba(yy0, u0, v0);
-                dst[x + 1] = rtg_yuv601_to_rgba(yy1, u0, v0);
-                dst[x + 2] = rtg_yuv601_to_rgba(yy2, u0, v0);
-                dst[x + 3] = rtg_yuv601_to_rgba(yy3, u0, v0);
-                src += 4;
-              }
-              for (; x < width; x++) {
-                uint8_t y0 = src[0];
-                dst[x] = rtg_yuv601_to_rgba(y0, 128, 128);
-                src++;
-              }
-            }
-            break;
-          default:
-            break;
-          }
-          UpdateTexture(raylib_texture, yuv_buf);
+        if(yuv_buf_size < yuv_bytes || !frame_conv) {
+          skipped = 1;
+        } else {
+          rtg_convert_and_upload(raylib_texture, frame_conv, (uint8_t*)yuv_buf, sizeof(uint32_t),
+                                 data->memory + addr_offset, current_pitch, width, bands,
+                                 num_bands, NULL);
           if (!yuv_log_once) {
             yuv_log_once = 1;
             size_t sample_len = current_pitch;
@@ -1083,11 +1151,13 @@ reinit_raylib:;
                      current_format, width, height, current_pitch, sample_buf);
           }
         }
-      } else if(current_format == RTGFMT_RGB565_BE || current_format == RTGFMT_RGB555_BE ||
-                current_format == RTGFMT_RGB555_LE || current_format == RTGFMT_BGR565_LE ||
-                current_format == RTGFMT_BGR555_LE) {
+      } else if(!convert_shader &&
+                (current_format == RTGFMT_RGB565_BE || current_format == RTGFMT_RGB555_BE ||
+                 current_format == RTGFMT_RGB555_LE || current_format == RTGFMT_BGR565_LE ||
+                 current_format == RTGFMT_BGR555_LE)) {
         if((current_pitch % 2) != 0) {
           LOG_WARN("[RTG/RAYLIB] 16-bit pitch not aligned: pitch=%u\n", current_pitch);
+          skipped = 1;
         } else {
           if(indexed_buf_size < tight_size) {
             void* resized = realloc(indexed_buf, tight_size);
@@ -1098,44 +1168,12 @@ reinit_raylib:;
               indexed_buf_size = tight_size;
             }
           }
-          if(indexed_buf) {
-            size_t src_stride = current_pitch / 2;
-            for (uint16_t y = 0; y < height; y++) {
-              for (uint16_t x = 0; x < width; x++) {
-                size_t src_idx = (x + (y * src_stride)) * sizeof(uint16_t);
-                const uint8_t* src_ptr = data->memory + addr_offset + src_idx;
-                uint16_t raw = 0;
-                uint16_t rgb565 = 0;
-                switch (current_format) {
-                case RTGFMT_RGB565_BE:
-                  raw = load_u16_be(src_ptr);
-                  rgb565 = raw;
-                  break;
-                case RTGFMT_RGB555_BE:
-                  raw = load_u16_be(src_ptr);
-                  rgb565 = rtg_rgb555_to_rgb565(raw);
-                  break;
-                case RTGFMT_RGB555_LE:
-                  raw = load_u16_le(src_ptr);
-                  rgb565 = rtg_rgb555_to_rgb565(raw);
-                  break;
-                case RTGFMT_BGR565_LE:
-                  raw = load_u16_le(src_ptr);
-                  rgb565 = rtg_bgr565_to_rgb565(raw);
-                  break;
-                case RTGFMT_BGR555_LE:
-                  raw = load_u16_le(src_ptr);
-                  rgb565 = rtg_bgr555_to_rgb565(raw);
-                  break;
-                default:
-                  raw = load_u16_le(src_ptr);
-                  rgb565 = raw;
-                  break;
-                }
-                indexed_buf[x + (y * width)] = rgb565;
-              }
-            }
-            UpdateTexture(raylib_texture, indexed_buf);
+          if(indexed_buf_size < tight_size || !frame_conv) {
+            skipped = 1;
+          } else {
+            rtg_convert_and_upload(raylib_texture, frame_conv, (uint8_t*)indexed_buf,
+                                   sizeof(uint16_t), data->memory + addr_offset, current_pitch,
+                                   width, bands, num_bands, NULL);
           }
         }
       } else if(current_format == RTGFMT_8BIT_CLUT && clut_cpu_mode) {
@@ -1149,15 +1187,12 @@ reinit_raylib:;
             clut_buf_size = tight_size * sizeof(uint32_t);
           }
         }
-        if(clut_buf) {
-          for (uint16_t y = 0; y < height; y++) {
-            const uint8_t* src = data->memory + addr_offset + (size_t)current_pitch * y;
-            uint32_t* dst = clut_buf + (size_t)width * y;
-            for (uint16_t x = 0; x < width; x++) {
-              dst[x] = palette[src[x]];
-            }
-          }
-          UpdateTexture(raylib_texture, clut_buf);
+        if(clut_buf_size < tight_size * sizeof(uint32_t) || !frame_conv) {
+          skipped = 1;
+        } else {
+          rtg_convert_and_upload(raylib_texture, frame_conv, (uint8_t*)clut_buf, sizeof(uint32_t),
+                                 data->memory + addr_offset, current_pitch, width, bands,
+                                 num_bands, palette);
         }
       } else if(current_pitch != row_bytes) {
         if(tight_buf_size < tight_size) {
@@ -1169,12 +1204,27 @@ reinit_raylib:;
             tight_buf_size = tight_size;
           }
         }
-        if(tight_buf) {
-          rtg_copy_tight_rows(tight_buf, data->memory + addr_offset, row_bytes, current_pitch, height);
-          UpdateTexture(raylib_texture, tight_buf);
+        if(tight_buf_size < tight_size) {
+          skipped = 1;
+        } else {
+          for (unsigned int b = 0; b < num_bands; b++) {
+            uint16_t y0 = bands[b].y0;
+            uint16_t y1 = bands[b].y1;
+            rtg_copy_tight_rows(tight_buf, data->memory + addr_offset, row_bytes, current_pitch, y0,
+                                y1);
+            Rectangle rows = {0, (float)y0, (float)width, (float)(y1 - y0)};
+            UpdateTextureRec(raylib_texture, rows, tight_buf + row_bytes * y0);
+            METRICS_ADD(rtg_rows_uploaded, y1 - y0);
+          }
         }
       } else {
-        UpdateTexture(raylib_texture, data->memory + addr_offset);
+        for (unsigned int b = 0; b < num_bands; b++) {
+          uint16_t y0 = bands[b].y0;
+          uint16_t y1 = bands[b].y1;
+          Rectangle rows = {0, (float)y0, (float)width, (float)(y1 - y0)};
+          UpdateTextureRec(raylib_texture, rows, data->memory + addr_offset + row_bytes * y0);
+          METRICS_ADD(rtg_rows_uploaded, y1 - y0);
+        }
       }
       if(cursor_image_updated) {
         if(clut_cursor_enabled) {
@@ -1188,17 +1238,24 @@ reinit_raylib:;
         UpdateTexture(raylib_clut_texture, palette);
         palette_updated = 0;
       }
+      if(skipped) {
+        METRICS_INC(rtg_frames_skipped);
+      } else {
+        METRICS_INC(rtg_frames_rendered);
+      }
       if(frame_no < 3) {
         LOG_DEBUG("[RTG/RAYLIB] Frame %u end\n", frame_no);
       }
       frame_no++;
       updating_screen = 0;
+      pistorm_metrics.rtg_thread_cpu_ns = rtg_thread_cpu_ns() - cpu_start_ns;
     } else {
       BeginDrawing();
       ClearBackground(bef);
       // DrawText("RTG is currently sleeping.", 16, 16, 12, RAYWHITE);
       EndDrawing();
     }
+frame_done:;
     if(pitch != *data->pitch || height != *data->height || width != *data->width ||
         format != *data->format) {
       LOG_INFO("[RTG/RAYLIB] Mode change detected after frame; reinitializing.\n");
@@ -1236,11 +1293,15 @@ shutdown_raylib:;
     free(tight_buf);
   }
 
+  LOG_INFO("[RTG/RAYLIB] Output thread CPU time: %.3f s\n",
+           (double)(rtg_thread_cpu_ns() - cpu_start_ns) / 1e9);
+
   UnloadTexture(raylib_texture);
   UnloadShader(clut_shader);
   UnloadShader(bgra_swizzle_shader);
   UnloadShader(argb_swizzle_shader);
   UnloadShader(abgr_swizzle_shader);
+  rtg_unload_convert_shaders();
 
   CloseWindow();
 
@@ -0,0 +1,1190 @@
+// SPDX-License-Identifier: MIT
+// RFB (VNC) server for the RTG screen. See rtg-vnc.h for the settings.
+//
+// One thread serves all clients. Each tick (PISTORM_RTG_VNC_FPS) it takes
+// the VNC bit of the VRAM dirty map for the visible framebuffer, converts the
+// dirty rows to 0x00RRGGBB and compares them with a shadow copy of the screen
+// tile by tile. Changed tiles are queued for every client and sent when the
+// client has asked for an update, in the pixel format it asked for.
+
+#define _GNU_SOURCE
+
+#include "emulator.h"
+#include "log.h"
+#include "rtg.h"
+#include "rtg-convert.h"
+#include "rtg-vnc.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/input-event-codes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+extern uint8_t* rtg_mem;
+extern uint8_t display_enabled;
+extern uint32_t framebuffer_addr_adj;
+extern uint16_t rtg_display_width;
+extern uint16_t rtg_display_height;
+extern uint16_t rtg_display_format;
+extern uint16_t rtg_pitch;
+
+#define VNC_ENC_RAW 0
+#define VNC_ENC_RRE 2
+#define VNC_ENC_DESKTOP_SIZE -223
+
+// Largest pointer step fed to the Amiga per tick, and how long to wait for the
+// driver to report where the last step put the sprite.
+#define VNC_POINTER_STEP 64
+#define VNC_POINTER_WAIT_NS 100000000ull
+
+enum vnc_state {
+  VNC_STATE_VERSION,
+  VNC_STATE_SECURITY,
+  VNC_STATE_INIT,
+  VNC_STATE_NORMAL,
+};
+
+struct vnc_pixel_format {
+  uint8_t bpp;
+  uint8_t depth;
+  uint8_t big_endian;
+  uint8_t true_colour;
+  uint16_t max[3]; // red, green, blue
+  uint8_t shift[3];
+};
+
+struct vnc_client {
+  int fd;
+  enum vnc_state state;
+  int minor;
+  char peer[INET_ADDRSTRLEN + 8];
+  uint8_t in[4096];
+  size_t in_len;
+  uint32_t skip; // ClientCutText bytes still to discard
+  struct vnc_pixel_format pf;
+  uint8_t native_pf; // pf is the shadow layout, rows go out as they are
+  uint8_t rre;
+  uint8_t desktop_size;
+  uint8_t want_update;
+  uint8_t size_changed;
+  uint16_t w, h; // framebuffer size the client knows about
+  uint8_t* pending; // one byte per tile
+  uint8_t buttons;  // last RFB button mask
+};
+
+static pthread_t thread_id;
+static uint8_t thread_running;
+static uint8_t thread_stop;
+static int listen_fd = -1;
+static int listen_port;
+static unsigned int update_fps = 30;
+static struct vnc_client clients[RTG_VNC_MAX_CLIENTS];
+
+// The visible screen as last converted, 0x00RRGGBB.
+static uint32_t* shadow;
+static uint16_t shadow_w, shadow_h;
+static uint16_t tiles_x, tiles_y;
+static uint8_t* tile_changed;
+static uint32_t* row_buf;
+static uint16_t* conv_buf;
+static uint16_t fb_format, fb_pitch;
+static uint32_t fb_addr;
+static uint8_t fb_valid;
+static uint32_t fb_clut_seq;
+
+static uint8_t* out_buf;
+static size_t out_size, out_len;
+
+// Pointer: where the clients want it, and how it is being moved there.
+static uint8_t ptr_active;
+static int ptr_x, ptr_y;
+static int ptr_sent_x, ptr_sent_y;
+static uint8_t ptr_buttons;
+static uint32_t ptr_seq;
+static uint64_t ptr_time;
+static int ptr_step_x, ptr_step_y;
+static int ptr_from_x, ptr_from_y;
+static float ptr_gain = 1.0f;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rtg_vnc_stats stats;
+static uint64_t cpu_base;
+
+static const struct vnc_pixel_format default_pf = {32, 24, 0, 1, {255, 255, 255}, {16, 8, 0}};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t thread_cpu_ns(void) {
+  clockid_t cid;
+  struct timespec ts;
+  if (!thread_running || pthread_getcpuclockid(thread_id, &cid) != 0 ||
+      clock_gettime(cid, &ts) != 0) {
+    return 0;
+  }
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint16_t get16(const uint8_t* p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint8_t* out_reserve(size_t n) {
+  if (out_len + n > out_size) {
+    size_t size = out_size ? out_size : 65536;
+    while (size < out_len + n) {
+      size *= 2;
+    }
+    uint8_t* buf = realloc(out_buf, size);
+    if (!buf) {
+      return NULL;
+    }
+    out_buf = buf;
+    out_size = size;
+  }
+  uint8_t* p = out_buf + out_len;
+  out_len += n;
+  return p;
+}
+
+static void put_rect(uint16_t x, uint16_t y, uint16_t w, uint16_t h, int32_t encoding) {
+  uint8_t* p = out_reserve(12);
+  if (!p) {
+    return;
+  }
+  p[0] = (uint8_t)(x >> 8), p[1] = (uint8_t)x;
+  p[2] = (uint8_t)(y >> 8), p[3] = (uint8_t)y;
+  p[4] = (uint8_t)(w >> 8), p[5] = (uint8_t)w;
+  p[6] = (uint8_t)(h >> 8), p[7] = (uint8_t)h;
+  uint32_t e = (uint32_t)encoding;
+  p[8] = (uint8_t)(e >> 24), p[9] = (uint8_t)(e >> 16), p[10] = (uint8_t)(e >> 8);
+  p[11] = (uint8_t)e;
+}
+
+static int send_all(struct vnc_client* c, const uint8_t* data, size_t len) {
+  size_t sent = 0;
+  while (sent < len) {
+    ssize_t n = send(c->fd, data + sent, len - sent, MSG_NOSIGNAL);
+    if (n > 0) {
+      sent += (size_t)n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // A client that cannot take an update within two seconds is dropped
+      // rather than holding up the others.
+      struct pollfd pfd = {c->fd, POLLOUT, 0};
+      if (poll(&pfd, 1, 2000) > 0) {
+        continue;
+      }
+    }
+    return -1;
+  }
+  pthread_mutex_lock(&stats_lock);
+  stats.bytes_sent += len;
+  pthread_mutex_unlock(&stats_lock);
+  return 0;
+}
+
+static void client_close(struct vnc_client* c, const char* why) {
+  if (c->fd < 0) {
+    return;
+  }
+  LOG_INFO("[RTG/VNC] Client %s disconnected%s%s.\n", c->peer, why ? ": " : "", why ? why : "");
+  close(c->fd);
+  c->fd = -1;
+  free(c->pending);
+  c->pending = NULL;
+}
+
+static size_t num_tiles(void) {
+  return (size_t)tiles_x * tiles_y;
+}
+
+static int shadow_resize(uint16_t w, uint16_t h) {
+  uint16_t tx = (uint16_t)((w + RTG_VNC_TILE - 1) / RTG_VNC_TILE);
+  uint16_t ty = (uint16_t)((h + RTG_VNC_TILE - 1) / RTG_VNC_TILE);
+  uint32_t* s = calloc((size_t)w * h, sizeof(uint32_t));
+  uint8_t* t = calloc((size_t)tx * ty, 1);
+  uint32_t* r = malloc((size_t)w * sizeof(uint32_t));
+  uint16_t* cb = malloc((size_t)w * sizeof(uint16_t));
+  if (!s || !t || !r || !cb) {
+    free(s), free(t), free(r), free(cb);
+    return 0;
+  }
+  free(shadow), free(tile_changed), free(row_buf), free(conv_buf);
+  shadow = s, tile_changed = t, row_buf = r, conv_buf = cb;
+  shadow_w = w, shadow_h = h;
+  tiles_x = tx, tiles_y = ty;
+
+  for (int i = 0; i < RTG_VNC_MAX_CLIENTS; i++) {
+    struct vnc_client* c = &clients[i];
+    if (c->fd < 0) {
+      continue;
+    }
+    free(c->pending);
+    c->pending = malloc(num_tiles());
+    if (!c->pending) {
+      client_close(c, "out of memory");
+      continue;
+    }
+    memset(c->pending, 1, num_tiles());
+    c->size_changed = 1;
+  }
+  return 1;
+}
+
+static inline uint32_t rgb565_to_xrgb(uint16_t v) {
+  uint32_t r = (v >> 11) & 0x1F, g = (v >> 5) & 0x3F, b = v & 0x1F;
+  return ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+}
+
+// One VRAM row of any displayable RTG format to 0x00RRGGBB.
+static void row_to_xrgb(uint32_t* dst, const uint8_t* src, uint16_t width, uint16_t format,
+                        rtg_convert_fn conv) {
+  switch (format) {
+  case RTGFMT_8BIT_CLUT:
+    for (uint16_t x = 0; x < width; x++) {
+      dst[x] = rtg_clut[src[x]] & 0xFFFFFF;
+    }
+    return;
+  case RTGFMT_RGB565_LE:
+    for (uint16_t x = 0; x < width; x++) {
+      uint16_t v;
+      memcpy(&v, src + x * 2, sizeof(v));
+      dst[x] = rgb565_to_xrgb(v);
+    }
+    return;
+  case RTGFMT_RGB24:
+    for (uint16_t x = 0; x < width; x++, src += 3) {
+      dst[x] = ((uint32_t)src[0] << 16) | ((uint32_t)src[1] << 8) | src[2];
+    }
+    return;
+  case RTGFMT_BGR24:
+    for (uint16_t x = 0; x < width; x++, src += 3) {
+      dst[x] = ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+    }
+    return;
+  case RTGFMT_RGB32_ARGB:
+    for (uint16_t x = 0; x < width; x++, src += 4) {
+      dst[x] = ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+    }
+    return;
+  case RTGFMT_RGB32_ABGR:
+    for (uint16_t x = 0; x < width; x++, src += 4) {
+      dst[x] = ((uint32_t)src[3] << 16) | ((uint32_t)src[2] << 8) | src[1];
+    }
+    return;
+  case RTGFMT_RGB32_RGBA:
+    for (uint16_t x = 0; x < width; x++, src += 4) {
+      dst[x] = ((uint32_t)src[0] << 16) | ((uint32_t)src[1] << 8) | src[2];
+    }
+    return;
+  case RTGFMT_RGB32_BGRA:
+    for (uint16_t x = 0; x < width; x++, src += 4) {
+      dst[x] = ((uint32_t)src[2] << 16) | ((uint32_t)src[1] << 8) | src[0];
+    }
+    return;
+  default:
+    break;
+  }
+
+  // The remaining 16-bit and YUV formats go through the display converters.
+  if (!conv) {
+    memset(dst, 0, (size_t)width * sizeof(uint32_t));
+  } else if (rtg_convert_dst_bpp(format) == 2) {
+    conv(conv_buf, src, width, NULL);
+    for (uint16_t x = 0; x < width; x++) {
+      dst[x] = rgb565_to_xrgb(conv_buf[x]);
+    }
+  } else {
+    conv(dst, src, width, NULL);
+    for (uint16_t x = 0; x < width; x++) {
+      dst[x] &= 0xFFFFFF;
+    }
+  }
+}
+
+// Bring the shadow frame up to date with VRAM and queue the tiles that
+// changed for every connected client.
+static void refresh_frame(void) {
+  uint16_t width = rtg_display_width;
+  uint16_t height = rtg_display_height;
+  uint16_t format = rtg_display_format;
+  uint16_t pitch = rtg_pitch;
+  uint32_t addr = framebuffer_addr_adj;
+
+  int valid = display_enabled == 1 && rtg_mem && width && height && format < RTGFMT_NONE &&
+              format != RTGFMT_4BIT_PLANAR && pitch >= width * rtg_pixel_size[format] &&
+              addr < rtg_mem_size && (size_t)pitch * height <= rtg_mem_size - addr;
+  if (!valid) {
+    fb_valid = 0;
+    return;
+  }
+
+  int full = !fb_valid || addr != fb_addr || format != fb_format || pitch != fb_pitch;
+  if (width != shadow_w || height != shadow_h) {
+    if (!shadow_resize(width, height)) {
+      LOG_WARN("[RTG/VNC] Out of memory for a %ux%u screen.\n", width, height);
+      fb_valid = 0;
+      return;
+    }
+    full = 1;
+  }
+  if (format == RTGFMT_8BIT_CLUT) {
+    uint32_t seq = __atomic_load_n(&rtg_clut_seq, __ATOMIC_ACQUIRE);
+    if (seq != fb_clut_seq) {
+      fb_clut_seq = seq;
+      full = 1;
+    }
+  }
+  fb_addr = addr, fb_format = format, fb_pitch = pitch;
+  fb_valid = 1;
+
+  struct rtg_row_band bands[RTG_MAX_BANDS];
+  unsigned int num_bands = 0;
+  if (rtg_dirty) {
+    num_bands = rtg_collect_dirty_rows(rtg_dirty, RTG_DIRTY_VNC, addr, pitch, height, bands);
+  }
+  if (full || !rtg_dirty) {
+    bands[0].y0 = 0;
+    bands[0].y1 = height;
+    num_bands = 1;
+  }
+  if (!num_bands) {
+    return;
+  }
+
+  // Rows are compared with what was sent before, so a page that was written
+  // with the same pixels, or a wide row where only one tile changed, costs a
+  // conversion but no bandwidth.
+  rtg_convert_fn conv = rtg_convert_lookup(format, RTG_CONVERT_BEST);
+  memset(tile_changed, 0, num_tiles());
+  uint64_t rows = 0, changed = 0;
+  for (unsigned int b = 0; b < num_bands; b++) {
+    for (uint16_t y = bands[b].y0; y < bands[b].y1; y++) {
+      row_to_xrgb(row_buf, rtg_mem + addr + (size_t)y * pitch, width, format, conv);
+      uint32_t* dst = shadow + (size_t)y * width;
+      uint8_t* tiles = tile_changed + (size_t)(y / RTG_VNC_TILE) * tiles_x;
+      for (uint16_t tx = 0; tx < tiles_x; tx++) {
+        size_t x0 = (size_t)tx * RTG_VNC_TILE;
+        size_t n = width - x0 < RTG_VNC_TILE ? width - x0 : RTG_VNC_TILE;
+        if (memcmp(dst + x0, row_buf + x0, n * sizeof(uint32_t)) != 0) {
+          memcpy(dst + x0, row_buf + x0, n * sizeof(uint32_t));
+          tiles[tx] = 1;
+        }
+      }
+      rows++;
+    }
+  }
+
+  for (size_t t = 0; t < num_tiles(); t++) {
+    if (!tile_changed[t]) {
+      continue;
+    }
+    changed++;
+    for (int i = 0; i < RTG_VNC_MAX_CLIENTS; i++) {
+      if (clients[i].fd >= 0 && clients[i].pending) {
+        clients[i].pending[t] = 1;
+      }
+    }
+  }
+
+  pthread_mutex_lock(&stats_lock);
+  stats.rows_converted += rows;
+  stats.tiles_changed += changed;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+static int pf_is_native(const struct vnc_pixel_format* pf) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return pf->bpp == 32 && pf->true_colour && !pf->big_endian && pf->max[0] == 255 &&
+         pf->max[1] == 255 && pf->max[2] == 255 && pf->shift[0] == 16 && pf->shift[1] == 8 &&
+         pf->shift[2] == 0;
+#else
+  (void)pf;
+  return 0;
+#endif
+}
+
+static void pack_pixels(uint8_t* out, const uint32_t* src, size_t n, const struct vnc_client* c) {
+  if (c->native_pf) {
+    memcpy(out, src, n * sizeof(uint32_t));
+    return;
+  }
+  const struct vnc_pixel_format* pf = &c->pf;
+  size_t bytes = pf->bpp / 8;
+  for (size_t i = 0; i < n; i++) {
+    uint32_t p = src[i];
+    uint32_t v = ((((p >> 16) & 0xFF) * pf->max[0] + 127) / 255) << pf->shift[0] |
+                 ((((p >> 8) & 0xFF) * pf->max[1] + 127) / 255) << pf->shift[1] |
+                 (((p & 0xFF) * pf->max[2] + 127) / 255) << pf->shift[2];
+    for (size_t b = 0; b < bytes; b++) {
+      out[b] = (uint8_t)(v >> (8 * (pf->big_endian ? bytes - 1 - b : b)));
+    }
+    out += bytes;
+  }
+}
+
+static int tile_is_solid(uint16_t x0, uint16_t y0, uint16_t w, uint16_t h) {
+  const uint32_t first = shadow[(size_t)y0 * shadow_w + x0];
+  for (uint16_t y = y0; y < y0 + h; y++) {
+    const uint32_t* row = shadow + (size_t)y * shadow_w + x0;
+    for (uint16_t x = 0; x < w; x++) {
+      if (row[x] != first) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+static int send_update(struct vnc_client* c) {
+  out_len = 0;
+  uint8_t* head = out_reserve(4);
+  if (!head) {
+    return -1;
+  }
+  head[0] = 0; // FramebufferUpdate
+  head[1] = 0;
+  unsigned int count = 0, solid = 0;
+
+  if (c->size_changed) {
+    if (c->desktop_size) {
+      put_rect(0, 0, shadow_w, shadow_h, VNC_ENC_DESKTOP_SIZE);
+      c->w = shadow_w;
+      c->h = shadow_h;
+      count++;
+    }
+    c->size_changed = 0;
+  }
+
+  // Clients without DesktopSize keep the size they connected with and see
+  // the part of a larger screen that fits.
+  uint16_t cw = c->w < shadow_w ? c->w : shadow_w;
+  uint16_t ch = c->h < shadow_h ? c->h : shadow_h;
+  size_t bytes = c->pf.bpp / 8;
+  for (uint16_t ty = 0; ty < tiles_y && count < 0xFFFF; ty++) {
+    for (uint16_t tx = 0; tx < tiles_x && count < 0xFFFF; tx++) {
+      uint8_t* pending = &c->pending[(size_t)ty * tiles_x + tx];
+      if (!*pending) {
+        continue;
+      }
+      *pending = 0;
+      uint16_t x0 = (uint16_t)(tx * RTG_VNC_TILE), y0 = (uint16_t)(ty * RTG_VNC_TILE);
+      if (x0 >= cw || y0 >= ch) {
+        continue;
+      }
+      uint16_t w = (uint16_t)(cw - x0 < RTG_VNC_TILE ? cw - x0 : RTG_VNC_TILE);
+      uint16_t h = (uint16_t)(ch - y0 < RTG_VNC_TILE ? ch - y0 : RTG_VNC_TILE);
+      if (c->rre && tile_is_solid(x0, y0, w, h)) {
+        put_rect(x0, y0, w, h, VNC_ENC_RRE);
+        uint8_t* p = out_reserve(4 + bytes);
+        if (!p) {
+          return -1;
+        }
+        memset(p, 0, 4); // no subrectangles
+        pack_pixels(p + 4, &shadow[(size_t)y0 * shadow_w + x0], 1, c);
+        solid++;
+      } else {
+        put_rect(x0, y0, w, h, VNC_ENC_RAW);
+        for (uint16_t y = y0; y < y0 + h; y++) {
+          uint8_t* p = out_reserve(w * bytes);
+          if (!p) {
+            return -1;
+          }
+          pack_pixels(p, &shadow[(size_t)y * shadow_w + x0], w, c);
+        }
+      }
+      count++;
+    }
+  }
+  if (!count) {
+    return 0;
+  }
+
+  out_buf[2] = (uint8_t)(count >> 8);
+  out_buf[3] = (uint8_t)count;
+  c->want_update = 0;
+  if (send_all(c, out_buf, out_len) < 0) {
+    return -1;
+  }
+  pthread_mutex_lock(&stats_lock);
+  stats.updates++;
+  stats.rects += count;
+  stats.solid_rects += solid;
+  pthread_mutex_unlock(&stats_lock);
+  return 0;
+}
+
+static int send_server_init(struct vnc_client* c) {
+  static const char name[] = "PiStorm RTG";
+  uint8_t msg[24 + sizeof(name) - 1];
+  c->w = shadow_w;
+  c->h = shadow_h;
+  msg[0] = (uint8_t)(c->w >> 8), msg[1] = (uint8_t)c->w;
+  msg[2] = (uint8_t)(c->h >> 8), msg[3] = (uint8_t)c->h;
+  msg[4] = default_pf.bpp;
+  msg[5] = default_pf.depth;
+  msg[6] = default_pf.big_endian;
+  msg[7] = default_pf.true_colour;
+  for (int i = 0; i < 3; i++) {
+    msg[8 + i * 2] = (uint8_t)(default_pf.max[i] >> 8);
+    msg[9 + i * 2] = (uint8_t)default_pf.max[i];
+    msg[14 + i] = default_pf.shift[i];
+  }
+  msg[17] = msg[18] = msg[19] = 0;
+  msg[20] = msg[21] = msg[22] = 0;
+  msg[23] = (uint8_t)(sizeof(name) - 1);
+  memcpy(msg + 24, name, sizeof(name) - 1);
+
+  c->pending = malloc(num_tiles());
+  if (!c->pending) {
+    return -1;
+  }
+  memset(c->pending, 1, num_tiles());
+  return send_all(c, msg, sizeof(msg));
+}
+
+// X11 keysym to Linux key code, US layout; shifted symbols map to their key
+// and rely on the client sending Shift as well. 0 for keys that have no
+// Amiga counterpart. Caps Lock is left out: queue_keypress() tracks its state
+// from the local keyboard.
+static const struct {
+  uint32_t keysym;
+  uint16_t key;
+} keysyms[] = {
+    {'0', KEY_0},
+    {')', KEY_0},
+    {'!', KEY_1},
+    {'@', KEY_2},
+    {'#', KEY_3},
+    {'$', KEY_4},
+    {'%', KEY_5},
+    {'^', KEY_6},
+    {'&', KEY_7},
+    {'*', KEY_8},
+    {'(', KEY_9},
+    {' ', KEY_SPACE},
+    {'\'', KEY_APOSTROPHE},
+    {'"', KEY_APOSTROPHE},
+    {',', KEY_COMMA},
+    {'<', KEY_COMMA},
+    {'-', KEY_MINUS},
+    {'_', KEY_MINUS},
+    {'.', KEY_DOT},
+    {'>', KEY_DOT},
+    {'/', KEY_SLASH},
+    {'?', KEY_SLASH},
+    {'=', KEY_EQUAL},
+    {'+', KEY_EQUAL},
+    {'[', KEY_LEFTBRACE},
+    {'{', KEY_LEFTBRACE},
+    {']', KEY_RIGHTBRACE},
+    {'}', KEY_RIGHTBRACE},
+    {'\\', KEY_BACKSLASH},
+    {'|', KEY_BACKSLASH},
+    {'`', KEY_GRAVE},
+    {'~', KEY_GRAVE},
+    {0xFF08, KEY_BACKSPACE},
+    {0xFF09, KEY_TAB},
+    {0xFF0D, KEY_ENTER},
+    {0xFF1B, KEY_ESC},
+    {0xFFFF, KEY_DELETE},
+    {0xFF50, KEY_HOME},      // Help
+    {0xFF51, KEY_LEFT},
+    {0xFF52, KEY_UP},
+    {0xFF53, KEY_RIGHT},
+    {0xFF54, KEY_DOWN},
+    {0xFF8D, KEY_KPENTER},
+    {0xFFAA, KEY_KPASTERISK},
+    {0xFFAB, KEY_KPPLUS},
+    {0xFFAD, KEY_KPMINUS},
+    {0xFFAE, KEY_KPDOT},
+    {0xFFAF, KEY_KPSLASH},
+    {0xFFE1, KEY_LEFTSHIFT},
+    {0xFFE2, KEY_RIGHTSHIFT},
+    {0xFFE3, KEY_LEFTCTRL},  // the Amiga has one Ctrl
+    {0xFFE4, KEY_LEFTCTRL},
+    {0xFFE7, KEY_LEFTMETA},  // left Amiga
+    {0xFFEB, KEY_LEFTMETA},
+    {0xFFE8, KEY_RIGHTMETA}, // right Amiga
+    {0xFFEC, KEY_RIGHTMETA},
+    {0xFFE9, KEY_LEFTALT},
+    {0xFFEA, KEY_RIGHTALT},
+    {0xFE03, KEY_RIGHTALT},
+};
+
+static uint16_t keysym_to_key(uint32_t ks) {
+  static const uint8_t letters[26] = {
+      KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J, KEY_K, KEY_L, KEY_M,
+      KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z,
+  };
+  static const uint8_t keypad[10] = {
+      KEY_KP0, KEY_KP1, KEY_KP2, KEY_KP3, KEY_KP4, KEY_KP5, KEY_KP6, KEY_KP7, KEY_KP8, KEY_KP9,
+  };
+
+  if (ks >= 'a' && ks <= 'z') {
+    return letters[ks - 'a'];
+  }
+  if (ks >= 'A' && ks <= 'Z') {
+    return letters[ks - 'A'];
+  }
+  if (ks >= '1' && ks <= '9') {
+    return (uint16_t)(KEY_1 + (ks - '1'));
+  }
+  if (ks >= 0xFFB0 && ks <= 0xFFB9) {
+    return keypad[ks - 0xFFB0];
+  }
+  if (ks >= 0xFFBE && ks <= 0xFFC7) {
+    return (uint16_t)(KEY_F1 + (ks - 0xFFBE)); // F1-F10
+  }
+  for (size_t i = 0; i < sizeof(keysyms) / sizeof(keysyms[0]); i++) {
+    if (keysyms[i].keysym == ks) {
+      return keysyms[i].key;
+    }
+  }
+  return 0;
+}
+
+static void handle_pointer(struct vnc_client* c, uint8_t mask, uint16_t x, uint16_t y) {
+  // RFB: 1 left, 2 middle, 4 right, 8/16 wheel up/down. PS/2: 1 left, 2 right, 4 middle.
+  uint8_t buttons = (uint8_t)(((mask & 1) ? 0x01 : 0) | ((mask & 4) ? 0x02 : 0) |
+                              ((mask & 2) ? 0x04 : 0));
+  int8_t wheel = 0;
+  if ((mask & 8) && !(c->buttons & 8)) {
+    wheel = -1;
+  } else if ((mask & 16) && !(c->buttons & 16)) {
+    wheel = 1;
+  }
+  c->buttons = mask;
+  if (buttons != ptr_buttons || wheel) {
+    ptr_buttons = buttons;
+    emulator_remote_mouse(0, 0, buttons, wheel);
+  }
+  if (!ptr_active) {
+    ptr_active = 1;
+    ptr_sent_x = x;
+    ptr_sent_y = y;
+  }
+  ptr_x = x;
+  ptr_y = y;
+}
+
+static int clamp_step(int v) {
+  return v > VNC_POINTER_STEP ? VNC_POINTER_STEP : v < -VNC_POINTER_STEP ? -VNC_POINTER_STEP : v;
+}
+
+// The Amiga mouse is relative and the clients' pointer absolute. When the
+// driver reports the sprite position the pointer is steered towards the
+// client's, learning how far Intuition moves the sprite per mouse count
+// (mouse speed and acceleration) so it does not overshoot; without a hardware
+// sprite the client's own motion is replayed.
+static void move_pointer(void) {
+  if (!ptr_active) {
+    return;
+  }
+  int dx, dy;
+  uint32_t seq = __atomic_load_n(&rtg_sprite_seq, __ATOMIC_ACQUIRE);
+  if (seq) {
+    uint64_t now = now_ns();
+    if (ptr_step_x || ptr_step_y) {
+      if (seq == ptr_seq && now - ptr_time < VNC_POINTER_WAIT_NS) {
+        return;
+      }
+      int moved = abs(rtg_sprite_x - ptr_from_x) + abs(rtg_sprite_y - ptr_from_y);
+      int step = abs(ptr_step_x) + abs(ptr_step_y);
+      if (step >= 4 && moved) {
+        float gain = (float)moved / (float)step;
+        gain = gain < 0.25f ? 0.25f : gain > 8.0f ? 8.0f : gain;
+        ptr_gain = (ptr_gain + gain) * 0.5f;
+      }
+    }
+    dx = clamp_step((int)((float)(ptr_x - rtg_sprite_x) / ptr_gain));
+    dy = clamp_step((int)((float)(ptr_y - rtg_sprite_y) / ptr_gain));
+    ptr_step_x = dx, ptr_step_y = dy;
+    ptr_from_x = rtg_sprite_x, ptr_from_y = rtg_sprite_y;
+    ptr_seq = seq;
+    ptr_time = now;
+  } else {
+    dx = clamp_step(ptr_x - ptr_sent_x);
+    dy = clamp_step(ptr_y - ptr_sent_y);
+    ptr_sent_x += dx;
+    ptr_sent_y += dy;
+  }
+  if (dx || dy) {
+    emulator_remote_mouse((int16_t)dx, (int16_t)dy, ptr_buttons, 0);
+  }
+}
+
+static int set_pixel_format(struct vnc_client* c, const uint8_t* m) {
+  struct vnc_pixel_format pf;
+  pf.bpp = m[4];
+  pf.depth = m[5];
+  pf.big_endian = m[6] != 0;
+  pf.true_colour = m[7] != 0;
+  for (int i = 0; i < 3; i++) {
+    pf.max[i] = get16(m + 8 + i * 2);
+    pf.shift[i] = m[14 + i];
+  }
+  if ((pf.bpp != 8 && pf.bpp != 16 && pf.bpp != 32) || !pf.true_colour) {
+    LOG_WARN("[RTG/VNC] Client %s asked for an unsupported %u-bit %s pixel format.\n", c->peer,
+             pf.bpp, pf.true_colour ? "true colour" : "colour map");
+    return -1;
+  }
+  // Every channel has to fit in the pixel; the shifts come off the network.
+  for (int i = 0; i < 3; i++) {
+    if (!pf.max[i] || pf.shift[i] >= pf.bpp || ((uint64_t)pf.max[i] << pf.shift[i]) >> pf.bpp) {
+      LOG_WARN("[RTG/VNC] Client %s asked for a pixel format with channel %d (max %u, shift %u) "
+               "outside its %u bits.\n",
+               c->peer, i, pf.max[i], pf.shift[i], pf.bpp);
+      return -1;
+    }
+  }
+  c->pf = pf;
+  c->native_pf = (uint8_t)pf_is_native(&pf);
+  return 0;
+}
+
+// Parse one message at the start of `m`. Returns its length, 0 if it is not
+// complete yet, or -1 to drop the client.
+static ssize_t handle_message(struct vnc_client* c, const uint8_t* m, size_t len) {
+  switch (c->state) {
+  case VNC_STATE_VERSION: {
+    if (len < 12) {
+      return 0;
+    }
+    int major = 0, minor = 0;
+    if (memcmp(m, "RFB ", 4) != 0 || sscanf((const char*)m + 4, "%3d.%3d", &major, &minor) != 2 ||
+        major != 3) {
+      return -1;
+    }
+    c->minor = minor >= 8 ? 8 : minor == 7 ? 7 : 3;
+    if (c->minor == 3) {
+      static const uint8_t none[4] = {0, 0, 0, 1};
+      c->state = VNC_STATE_INIT;
+      return send_all(c, none, sizeof(none)) < 0 ? -1 : 12;
+    }
+    static const uint8_t types[2] = {1, 1}; // one type: None
+    c->state = VNC_STATE_SECURITY;
+    return send_all(c, types, sizeof(types)) < 0 ? -1 : 12;
+  }
+  case VNC_STATE_SECURITY: {
+    if (len < 1) {
+      return 0;
+    }
+    if (m[0] != 1) {
+      return -1;
+    }
+    c->state = VNC_STATE_INIT;
+    if (c->minor == 8) {
+      static const uint8_t ok[4] = {0, 0, 0, 0};
+      return send_all(c, ok, sizeof(ok)) < 0 ? -1 : 1;
+    }
+    return 1;
+  }
+  case VNC_STATE_INIT:
+    if (len < 1) {
+      return 0;
+    }
+    // The shared flag is ignored; clients always share the screen.
+    c->state = VNC_STATE_NORMAL;
+    return send_server_init(c) < 0 ? -1 : 1;
+  case VNC_STATE_NORMAL:
+    break;
+  }
+
+  if (len < 1) {
+    return 0;
+  }
+  switch (m[0]) {
+  case 0: // SetPixelFormat
+    if (len < 20) {
+      return 0;
+    }
+    return set_pixel_format(c, m) < 0 ? -1 : 20;
+  case 2: { // SetEncodings
+    if (len < 4) {
+      return 0;
+    }
+    size_t n = get16(m + 2);
+    if (4 + n * 4 > sizeof(c->in)) {
+      return -1;
+    }
+    if (len < 4 + n * 4) {
+      return 0;
+    }
+    c->rre = c->desktop_size = 0;
+    for (size_t i = 0; i < n; i++) {
+      int32_t enc = (int32_t)get32(m + 4 + i * 4);
+      if (enc == VNC_ENC_RRE) {
+        c->rre = 1;
+      } else if (enc == VNC_ENC_DESKTOP_SIZE) {
+        c->desktop_size = 1;
+      }
+    }
+    return (ssize_t)(4 + n * 4);
+  }
+  case 3: // FramebufferUpdateRequest
+    if (len < 10) {
+      return 0;
+    }
+    if (!m[1] && c->pending) {
+      // Non-incremental: the client wants the whole screen again.
+      memset(c->pending, 1, num_tiles());
+    }
+    c->want_update = 1;
+    return 10;
+  case 4: { // KeyEvent
+    if (len < 8) {
+      return 0;
+    }
+    uint16_t key = keysym_to_key(get32(m + 4));
+    if (key) {
+      emulator_remote_key(key, m[1]);
+    }
+    pthread_mutex_lock(&stats_lock);
+    stats.key_events++;
+    pthread_mutex_unlock(&stats_lock);
+    return 8;
+  }
+  case 5: // PointerEvent
+    if (len < 6) {
+      return 0;
+    }
+    handle_pointer(c, m[1], get16(m + 2), get16(m + 4));
+    pthread_mutex_lock(&stats_lock);
+    stats.pointer_events++;
+    pthread_mutex_unlock(&stats_lock);
+    return 6;
+  case 6: // ClientCutText, not used
+    if (len < 8) {
+      return 0;
+    }
+    c->skip = get32(m + 4);
+    return 8;
+  default:
+    LOG_WARN("[RTG/VNC] Client %s sent unknown message type %u.\n", c->peer, m[0]);
+    return -1;
+  }
+}
+
+static int read_client(struct vnc_client* c) {
+  for (;;) {
+    ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+    if (n == 0) {
+      return -1;
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+      return -1;
+    }
+    pthread_mutex_lock(&stats_lock);
+    stats.bytes_received += (uint64_t)n;
+    pthread_mutex_unlock(&stats_lock);
+    c->in_len += (size_t)n;
+
+    size_t pos = 0;
+    while (pos < c->in_len) {
+      if (c->skip) {
+        size_t s = c->in_len - pos < c->skip ? c->in_len - pos : c->skip;
+        c->skip -= (uint32_t)s;
+        pos += s;
+        continue;
+      }
+      ssize_t used = handle_message(c, c->in + pos, c->in_len - pos);
+      if (used < 0) {
+        return -1;
+      }
+      if (used == 0) {
+        break;
+      }
+      pos += (size_t)used;
+    }
+    memmove(c->in, c->in + pos, c->in_len - pos);
+    c->in_len -= pos;
+  }
+}
+
+static void accept_client(void) {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  int fd = accept4(listen_fd, (struct sockaddr*)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  char peer[INET_ADDRSTRLEN] = "?";
+  inet_ntop(AF_INET, &addr.sin_addr, peer, sizeof(peer));
+
+  struct vnc_client* c = NULL;
+  for (int i = 0; i < RTG_VNC_MAX_CLIENTS; i++) {
+    if (clients[i].fd < 0) {
+      c = &clients[i];
+      break;
+    }
+  }
+  if (!c) {
+    LOG_WARN("[RTG/VNC] Refusing %s:%u, already %d clients.\n", peer, ntohs(addr.sin_port),
+             RTG_VNC_MAX_CLIENTS);
+    close(fd);
+    return;
+  }
+
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  memset(c, 0, sizeof(*c));
+  c->fd = fd;
+  c->state = VNC_STATE_VERSION;
+  c->pf = default_pf;
+  c->native_pf = (uint8_t)pf_is_native(&default_pf);
+  snprintf(c->peer, sizeof(c->peer), "%s:%u", peer, ntohs(addr.sin_port));
+  LOG_INFO("[RTG/VNC] Client %s connected.\n", c->peer);
+  pthread_mutex_lock(&stats_lock);
+  stats.clients++;
+  pthread_mutex_unlock(&stats_lock);
+
+  static const char version[] = "RFB 003.008\n";
+  if (send_all(c, (const uint8_t*)version, sizeof(version) - 1) < 0) {
+    client_close(c, "handshake failed");
+  }
+}
+
+static void* vnc_thread(void* arg) {
+  (void)arg;
+  const uint64_t period = 1000000000ull / update_fps;
+  uint64_t next = now_ns() + period;
+
+  while (!__atomic_load_n(&thread_stop, __ATOMIC_ACQUIRE)) {
+    struct pollfd pfd[1 + RTG_VNC_MAX_CLIENTS];
+    struct vnc_client* owner[1 + RTG_VNC_MAX_CLIENTS];
+    int n = 0;
+    pfd[n].fd = listen_fd;
+    pfd[n].events = POLLIN;
+    owner[n++] = NULL;
+    for (int i = 0; i < RTG_VNC_MAX_CLIENTS; i++) {
+      if (clients[i].fd >= 0) {
+        pfd[n].fd = clients[i].fd;
+        pfd[n].events = POLLIN;
+        owner[n++] = &clients[i];
+      }
+    }
+
+    uint64_t now = now_ns();
+    int timeout = next > now ? (int)((next - now + 999999) / 1000000) : 0;
+    if (poll(pfd, (nfds_t)n, timeout) > 0) {
+      for (int i = 1; i < n; i++) {
+        if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+          if (read_client(owner[i]) < 0) {
+            client_close(owner[i], NULL);
+          }
+        }
+      }
+      if (pfd[0].revents & POLLIN) {
+        accept_client();
+      }
+    }
+
+    now = now_ns();
+    if (now < next) {
+      continue;
+    }
+    next = next + period > now ? next + period : now + period;
+
+    int active = 0;
+    for (int i = 0; i < RTG_VNC_MAX_CLIENTS; i++) {
+      active |= clients[i].fd >= 0 && clients[i].state == VNC_STATE_NORMAL;
+    }
+    if (!active) {
+      // Nobody watching: leave VRAM alone and start from scratch next time.
+      fb_valid = 0;
+      continue;
+    }
+    refresh_frame();
+    move_pointer();
+    for (int i = 0; i < RTG_VNC_MAX_CLIENTS; i++) {
+      struct vnc_client* c = &clients[i];
+      if (c->fd >= 0 && c->state == VNC_STATE_NORMAL && c->want_update && send_update(c) < 0) {
+        client_close(c, "send failed");
+      }
+    }
+  }
+
+  for (int i = 0; i < RTG_VNC_MAX_CLIENTS; i++) {
+    client_close(&clients[i], "server stopping");
+  }
+  return NULL;
+}
+
+static int parse_listen(const char* spec, struct sockaddr_in* addr) {
+  char host[64] = "127.0.0.1";
+  long port = RTG_VNC_DEFAULT_PORT;
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+
+  if (spec && *spec) {
+    const char* colon = strrchr(spec, ':');
+    const char* port_str = NULL;
+    if (colon) {
+      size_t n = (size_t)(colon - spec);
+      if (n >= sizeof(host)) {
+        return 0;
+      }
+      if (n) {
+        memcpy(host, spec, n);
+        host[n] = 0;
+      }
+      port_str = colon + 1;
+    } else if (strspn(spec, "0123456789") == strlen(spec)) {
+      port_str = spec;
+    } else {
+      snprintf(host, sizeof(host), "%s", spec);
+    }
+    if (port_str) {
+      char* end;
+      port = strtol(port_str, &end, 10);
+      if (*end || port < 0 || port > 65535) {
+        return 0;
+      }
+    }
+  }
+  if (!strcmp(host, "*") || !strcmp(host, "any")) {
+    addr->sin_addr.s_addr = htonl(INADDR_ANY);
+  } else if (inet_pton(AF_INET, host, &addr->sin_addr) != 1) {
+    return 0;
+  }
+  addr->sin_port = htons((uint16_t)port);
+  return 1;
+}
+
+int rtg_vnc_start(const char* listen_spec) {
+  const char* env = getenv("PISTORM_RTG_VNC");
+  if (env && *env) {
+    listen_spec = env;
+  } else if (!listen_spec) {
+    return 0;
+  }
+  if (thread_running) {
+    return 1;
+  }
+
+  env = getenv("PISTORM_RTG_VNC_FPS");
+  if (env && *env) {
+    unsigned long fps = strtoul(env, NULL, 0);
+    update_fps = fps < 1 ? 1 : fps > 240 ? 240 : (unsigned int)fps;
+  }
+
+  struct sockaddr_in addr;
+  if (!parse_listen(listen_spec, &addr)) {
+    LOG_WARN("[RTG/VNC] Invalid listen address \"%s\"; expected [address][:port].\n",
+             listen_spec);
+    return 0;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOG_WARN("[RTG/VNC] socket: %s\n", strerror(errno));
+    return 0;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+    LOG_WARN("[RTG/VNC] Cannot listen on %s: %s\n", listen_spec, strerror(errno));
+    close(fd);
+    return 0;
+  }
+  socklen_t len = sizeof(addr);
+  getsockname(fd, (struct sockaddr*)&addr, &len);
+  listen_fd = fd;
+  listen_port = ntohs(addr.sin_port);
+
+  for (int i = 0; i < RTG_VNC_MAX_CLIENTS; i++) {
+    clients[i].fd = -1;
+  }
+  if (!shadow && !shadow_resize(640, 480)) {
+    close(listen_fd);
+    listen_fd = -1;
+    return 0;
+  }
+  fb_valid = 0;
+  thread_stop = 0;
+  if (pthread_create(&thread_id, NULL, vnc_thread, NULL) != 0) {
+    LOG_WARN("[RTG/VNC] Failed to start the server thread.\n");
+    close(listen_fd);
+    listen_fd = -1;
+    return 0;
+  }
+  pthread_setname_np(thread_id, "pistorm64: vnc");
+  thread_running = 1;
+  rtg_vnc_reset_stats();
+
+  char host[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &addr.sin_addr, host, sizeof(host));
+  LOG_INFO("[RTG/VNC] Serving the RTG screen on %s:%d, up to %u updates/s.\n", host, listen_port,
+           update_fps);
+  return 1;
+}
+
+void rtg_vnc_stop(void) {
+  if (!thread_running) {
+    return;
+  }
+  __atomic_store_n(&thread_stop, 1, __ATOMIC_RELEASE);
+  pthread_join(thread_id, NULL);
+  thread_running = 0;
+  close(listen_fd);
+  listen_fd = -1;
+  listen_port = 0;
+
+  struct rtg_vnc_stats s;
+  rtg_vnc_get_stats(&s);
+  LOG_INFO("[RTG/VNC] Stopped: %llu clients, %llu updates, %llu rects, %.1f MB sent.\n",
+           (unsigned long long)s.clients, (unsigned long long)s.updates,
+           (unsigned long long)s.rects, (double)s.bytes_sent / (1024.0 * 1024.0));
+
+  free(shadow), free(tile_changed), free(row_buf), free(conv_buf), free(out_buf);
+  shadow = NULL, tile_changed = NULL, row_buf = NULL, conv_buf = NULL, out_buf = NULL;
+  shadow_w = shadow_h = tiles_x = tiles_y = 0;
+  out_size = out_len = 0;
+  ptr_active = 0;
+}
+
+int rtg_vnc_port(void) {
+  return thread_running ? listen_port : 0;
+}
+
+void rtg_vnc_get_stats(struct rtg_vnc_stats* s) {
+  pthread_mutex_lock(&stats_lock);
+  *s = stats;
+  uint64_t cpu = thread_cpu_ns();
+  s->cpu_ns = cpu > cpu_base ? cpu - cpu_base : 0;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+void rtg_vnc_reset_stats(void) {
+  pthread_mutex_lock(&stats_lock);
+  memset(&stats, 0, sizeof(stats));
+  cpu_base = thread_cpu_ns();
+  pthread_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef PISTORM_RTG_VNC_H
+#define PISTORM_RTG_VNC_H
+
+#include <stdint.h>
+
+/*
+ * Built-in RFB (VNC) server for the RTG screen, independent of the output
+ * backend. It reads the visible framebuffer straight from VRAM in any RTG
+ * format, converts only the rows the VRAM dirty map (reader RTG_DIRTY_VNC)
+ * reports, and sends only the 64x64 tiles whose pixels actually changed:
+ * single-colour tiles as RRE, the rest as Raw. Keyboard and pointer events
+ * from clients are fed to the Amiga like the local input devices.
+ *
+ *   setvar rtg-vnc [address][:port]   start the server (default 127.0.0.1:5900)
+ *   PISTORM_RTG_VNC                   same, overrides the config file
+ *   PISTORM_RTG_VNC_FPS               update rate limit (default 30)
+ *
+ * There is no authentication; anything that can reach the port can see the
+ * screen and type, so only bind other addresses than localhost on trusted
+ * networks (or tunnel over SSH).
+ */
+
+#define RTG_VNC_DEFAULT_PORT 5900
+#define RTG_VNC_MAX_CLIENTS 4
+#define RTG_VNC_TILE 64
+
+struct rtg_vnc_stats {
+  uint64_t clients;        // connections accepted
+  uint64_t updates;        // FramebufferUpdate messages sent
+  uint64_t rects;          // rectangles sent
+  uint64_t solid_rects;    // of those, single-colour tiles sent as RRE
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+  uint64_t rows_converted; // VRAM rows converted and compared
+  uint64_t tiles_changed;  // tiles whose pixels differed from the last frame
+  uint64_t key_events;
+  uint64_t pointer_events;
+  uint64_t cpu_ns;         // CPU time of the server thread
+};
+
+// Start the server on `listen` ("port", "address", "address:port", NULL or
+// "" for the default). PISTORM_RTG_VNC, when set, replaces `listen`; with
+// listen == NULL the server only starts if it is set. Returns 1 if the server
+// is running afterwards.
+int rtg_vnc_start(const char* listen);
+void rtg_vnc_stop(void);
+// The TCP port the server listens on (useful with port 0), 0 if stopped.
+int rtg_vnc_port(void);
+
+void rtg_vnc_get_stats(struct rtg_vnc_stats* stats);
+void rtg_vnc_reset_stats(void);
+
+#endif /* PISTORM_RTG_VNC_H */
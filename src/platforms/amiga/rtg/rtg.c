@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: MIT
 
+#define _GNU_SOURCE // pthread_setname_np
 #include <stdint.h>
 #include <inttypes.h>
 #include <endian.h>
@@ -8,8 +9,12 @@
 #include <string.h>
 #include <time.h>
 #include <stddef.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include "config_file/config_file.h"
 #include "log.h"
+#include "metrics/metrics.h"
+#include "pistorm_trace.h"
 #include "gpio/ps_protocol.h"
 #include "platforms/amiga/rtg/irtg_structs.h"
 #include "rtg.h"
@@ -42,14 +47,16 @@ void rtg_p2c_ex(int16_t sx, int16_t sy, int16_t dx, int16_t dy, int16_t w, int16
                 uint8_t minterm, struct BitMap* bm, uint8_t mask, uint16_t dst_pitch,
                 uint16_t src_pitch);
 
-uint8_t rtg_u8[4];
-uint16_t rtg_x[8];
-uint16_t rtg_y[8];
-uint16_t rtg_user[8];
-uint16_t rtg_format;
-uint32_t rtg_address[8];
-uint32_t rtg_address_adj[8];
-uint32_t rtg_rgb[8];
+// The PiGFX register file is per thread: the CPU thread owns the live copy the
+// 68k writes, the async command worker loads a snapshot per queued command.
+__thread uint8_t rtg_u8[4];
+__thread uint16_t rtg_x[8];
+__thread uint16_t rtg_y[8];
+__thread uint16_t rtg_user[8];
+__thread uint16_t rtg_format;
+__thread uint32_t rtg_address[8];
+__thread uint32_t rtg_address_adj[8];
+__thread uint32_t rtg_rgb[8];
 
 uint8_t display_enabled = 0xFF;
 
@@ -62,12 +69,20 @@ uint16_t rtg_offset_x;
 uint16_t rtg_offset_y;
 
 uint8_t* rtg_mem; // FIXME
+uint8_t* rtg_dirty;
+uint32_t rtg_clut[256];
+uint32_t rtg_clut_seq;
+int16_t rtg_sprite_x, rtg_sprite_y;
+uint32_t rtg_sprite_seq;
 
 uint32_t framebuffer_addr = 0;
 uint32_t framebuffer_addr_adj = 0;
 
 static void handle_rtg_command(uint32_t cmd);
 static void handle_irtg_command(uint32_t cmd);
+static int rtg_async_submit(uint16_t cmd);
+static void rtg_async_fence(size_t offset, size_t len);
+static void rtg_async_stop(void);
 
 uint8_t realtime_graphics_debug = 0;
 extern int cpu_emulation_running;
@@ -86,7 +101,7 @@ extern uint8_t rtg_output_in_vblank;
     "MEM",
 };*/
 
-#define DEBUG LOG_DEBUG
+#define DEBUG LOG_FAST_DEBUG
 #else
 #define DEBUG(...)
 #endif
@@ -101,31 +116,470 @@ static const char* rtg_format_names[RTGFMT_NUM] = {
     "NONE/UNKNOWN",
 };
 
-static const unsigned int rtg_mem_size = 40u * SIZE_MEGA;
+uint32_t rtg_vram_size = PIGFX_RTG_SIZE;
+size_t rtg_mem_size = PIGFX_RTG_SIZE + PIGFX_SCRATCH_SIZE + PIGFX_NATIVE_SIZE;
+
+uint32_t rtg_set_vram_size(uint32_t megabytes) {
+  if (rtg_mem) {
+    LOG_WARN("[RTG] VRAM already allocated, size stays at %uMB (set rtg-vram before rtg).\n",
+             rtg_vram_size / SIZE_MEGA);
+    return rtg_vram_size;
+  }
+  if (megabytes < 1) {
+    megabytes = 1;
+  }
+  if (megabytes > PIGFX_RTG_SIZE_MAX / SIZE_MEGA) {
+    LOG_WARN("[RTG] %uMB of VRAM does not fit the PiGFX window, using %uMB.\n", megabytes,
+             PIGFX_RTG_SIZE_MAX / SIZE_MEGA);
+    megabytes = PIGFX_RTG_SIZE_MAX / SIZE_MEGA;
+  }
+  if (megabytes < PIGFX_RTG_SIZE / SIZE_MEGA) {
+    // Older PiGFX cards do not read RTG_VRAM_SIZE and assume 32MB.
+    LOG_WARN("[RTG] %uMB of VRAM needs a PiGFX card driver that reads the VRAM size.\n",
+             megabytes);
+  }
+  rtg_vram_size = megabytes * SIZE_MEGA;
+  rtg_mem_size = PIGFX_WINDOW_SIZE + PIGFX_NATIVE_SIZE;
+  return rtg_vram_size;
+}
 
 int init_rtg_data(struct emulator_config* cfg_) {
-  rtg_mem = calloc(1, rtg_mem_size);
-  if (!rtg_mem) {
-    LOG_ERROR("Failed to allocate RTG video memory.\n");
+  const char* env = getenv("PISTORM_RTG_VRAM_MB");
+  if (env && *env) {
+    rtg_set_vram_size((uint32_t)strtoul(env, NULL, 0));
+  }
+
+  // Anonymous pages are only backed once written, so VRAM that Picasso96
+  // never draws into costs address space but no RAM. MAP_NORESERVE keeps a
+  // large setting from failing under strict overcommit accounting.
+  void* mem = mmap(NULL, rtg_mem_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mem == MAP_FAILED) {
+    LOG_ERROR("Failed to allocate RTG video memory (%zu bytes).\n", rtg_mem_size);
     return 0;
   }
+  rtg_mem = mem;
+  LOG_INFO("[RTG] %uMB of VRAM at $%.8X, scratch area at $%.8X.\n", rtg_vram_size / SIZE_MEGA,
+           PIGFX_RTG_BASE + PIGFX_REG_SIZE, PIGFX_SCRATCH_AREA);
 
   m68k_add_ram_range(PIGFX_RTG_BASE + PIGFX_REG_SIZE, PIGFX_UPPER, rtg_mem);
-  add_mapping(cfg_, MAPTYPE_RAM_NOALLOC, PIGFX_RTG_BASE + PIGFX_REG_SIZE, rtg_mem_size,
-              (unsigned int)-1, (char*)rtg_mem, "rtg_mem", 0);
+  // Without a dirty map the output backends fall back to full-frame updates.
+  rtg_dirty = calloc(1, rtg_mem_size >> RTG_DIRTY_SHIFT);
+  if (!rtg_dirty) {
+    LOG_WARN("[RTG] Failed to allocate VRAM dirty map; updating full frames.\n");
+  }
+  m68k_set_ram_range_dirty_map(rtg_mem, rtg_dirty);
+  add_mapping(cfg_, MAPTYPE_RAM_NOALLOC, PIGFX_RTG_BASE + PIGFX_REG_SIZE,
+              (unsigned int)PIGFX_WINDOW_SIZE, (unsigned int)-1, (char*)rtg_mem, "rtg_mem", 0);
   return 1;
 }
 
 void shutdown_rtg(void) {
   LOG_INFO("[RTG] Shutting down RTG.\n");
+  rtg_async_stop();
+  rtg_gfx_stop_threads();
   if (rtg_on) {
     display_enabled = 0xFF;
     rtg_on = 0;
   }
   if (rtg_mem) {
-    free(rtg_mem);
+    m68k_set_ram_range_dirty_map(rtg_mem, NULL);
+    munmap(rtg_mem, rtg_mem_size);
     rtg_mem = NULL;
   }
+  if (rtg_dirty) {
+    free(rtg_dirty);
+    rtg_dirty = NULL;
+  }
+}
+
+_Static_assert(RTG_DIRTY_SHIFT == M68K_DIRTY_PAGE_SHIFT, "RTG and Musashi dirty pages must match");
+
+int rtg_vram_range(uint32_t address, uint32_t len) {
+  const uint32_t base = PIGFX_RTG_BASE + PIGFX_REG_SIZE;
+  if (!rtg_mem || !len || address + (uint64_t)len <= base) {
+    return 0;
+  }
+  return address < base || address - base < rtg_mem_size;
+}
+
+void rtg_mark_dirty_addr(uint32_t address, uint32_t len) {
+  const uint32_t base = PIGFX_RTG_BASE + PIGFX_REG_SIZE;
+  if (address < base || address - base >= rtg_mem_size) {
+    return;
+  }
+  uint32_t offset = address - base;
+  if (len > rtg_mem_size - offset) {
+    len = (uint32_t)(rtg_mem_size - offset);
+  }
+  rtg_mark_dirty(offset, len);
+}
+
+static __thread size_t gfx_dirty_lo = SIZE_MAX, gfx_dirty_hi = 0;
+
+void rtg_gfx_defer_dirty(const uint8_t* dst, size_t len) {
+  size_t lo = (size_t)(dst - rtg_mem);
+  if (lo < gfx_dirty_lo) {
+    gfx_dirty_lo = lo;
+  }
+  if (lo + len > gfx_dirty_hi) {
+    gfx_dirty_hi = lo + len;
+  }
+}
+
+void rtg_gfx_flush_dirty(void) {
+  if (gfx_dirty_lo < gfx_dirty_hi) {
+    rtg_mark_dirty(gfx_dirty_lo, gfx_dirty_hi - gfx_dirty_lo);
+  }
+  gfx_dirty_lo = SIZE_MAX;
+  gfx_dirty_hi = 0;
+}
+
+/*
+ * Asynchronous PiGFX command execution (rtg-async / PISTORM_RTG_ASYNC).
+ *
+ * RTG_COMMAND writes for operations that only read and write VRAM are queued
+ * together with a snapshot of the register file and run on a worker thread, so
+ * the 68k continues as soon as the command register write returns. Every other
+ * command (mode, panning, CLUT, sprites, templates and patterns that read Amiga
+ * memory, all iRTG commands) first waits for the queue to drain and then runs
+ * on the CPU thread exactly as before.
+ *
+ * While anything is queued the Musashi VRAM range is suspended, so 68k VRAM
+ * accesses come through rtg_read()/rtg_write() and only wait for queued
+ * operations whose source or destination overlaps the access. Reading any
+ * PiGFX register (status, vblank polls) drains the queue.
+ */
+#define RTG_ASYNC_DEPTH 64
+
+struct rtg_regs {
+  uint8_t u8[4];
+  uint16_t x[8], y[8], user[8], format;
+  uint32_t address[8], address_adj[8], rgb[8];
+};
+
+struct rtg_async_op {
+  uint16_t cmd;
+  struct rtg_regs regs;
+  // VRAM byte ranges [lo, hi) the operation may touch, source and destination.
+  size_t lo[2], hi[2];
+};
+
+enum {
+  RTG_ASYNC_UNSET,
+  RTG_ASYNC_OFF,
+  RTG_ASYNC_ON,
+};
+
+static uint8_t rtg_async_config;
+static uint8_t rtg_async_state = RTG_ASYNC_UNSET;
+static uint8_t rtg_async_quit;
+static uint8_t vram_suspended;
+static pthread_t rtg_async_tid;
+static pthread_mutex_t rtg_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rtg_async_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t rtg_async_done = PTHREAD_COND_INITIALIZER;
+static struct rtg_async_op rtg_async_ring[RTG_ASYNC_DEPTH];
+// submitted is only written by the CPU thread, completed only by the worker.
+static uint64_t rtg_async_submitted, rtg_async_completed;
+
+void rtg_set_async(uint8_t enable) {
+  rtg_async_config = enable;
+}
+
+static void rtg_regs_save(struct rtg_regs* regs) {
+  memcpy(regs->u8, rtg_u8, sizeof(rtg_u8));
+  memcpy(regs->x, rtg_x, sizeof(rtg_x));
+  memcpy(regs->y, rtg_y, sizeof(rtg_y));
+  memcpy(regs->user, rtg_user, sizeof(rtg_user));
+  regs->format = rtg_format;
+  memcpy(regs->address, rtg_address, sizeof(rtg_address));
+  memcpy(regs->address_adj, rtg_address_adj, sizeof(rtg_address_adj));
+  memcpy(regs->rgb, rtg_rgb, sizeof(rtg_rgb));
+}
+
+static void rtg_regs_load(const struct rtg_regs* regs) {
+  memcpy(rtg_u8, regs->u8, sizeof(rtg_u8));
+  memcpy(rtg_x, regs->x, sizeof(rtg_x));
+  memcpy(rtg_y, regs->y, sizeof(rtg_y));
+  memcpy(rtg_user, regs->user, sizeof(rtg_user));
+  rtg_format = regs->format;
+  memcpy(rtg_address, regs->address, sizeof(rtg_address));
+  memcpy(rtg_address_adj, regs->address_adj, sizeof(rtg_address_adj));
+  memcpy(rtg_rgb, regs->rgb, sizeof(rtg_rgb));
+}
+
+// Conservative byte range of a rectangle: whole rows from y to y + h, plus the
+// right edge at the widest pixel size in the last row.
+static void rtg_async_span(struct rtg_async_op* op, int i, uint32_t base, int32_t x, int32_t y,
+                           int32_t w, int32_t h, uint32_t pitch) {
+  int64_t lo = (int64_t)base + (int64_t)(y < 0 ? 0 : y) * pitch;
+  int64_t hi = (int64_t)base + (int64_t)(y + h) * pitch + (int64_t)(x + w) * 4;
+  if (lo < 0)
+    lo = 0;
+  if (hi > (int64_t)rtg_mem_size)
+    hi = (int64_t)rtg_mem_size;
+  op->lo[i] = (size_t)lo;
+  op->hi[i] = hi > lo ? (size_t)hi : (size_t)lo;
+}
+
+// Fills in the touched ranges for commands that can be queued, returns 0 for
+// everything that has to run on the CPU thread.
+static int rtg_async_prepare(struct rtg_async_op* op, uint16_t cmd) {
+  const uint32_t vram = PIGFX_RTG_BASE + PIGFX_REG_SIZE;
+  const int32_t sy = (int16_t)rtg_y[0];
+  op->lo[0] = op->hi[0] = op->lo[1] = op->hi[1] = 0;
+
+  switch (cmd) {
+  case RTGCMD_FILLRECT:
+  case RTGCMD_INVERTRECT:
+    rtg_async_span(op, 0, rtg_address_adj[0], rtg_x[0], rtg_y[0], rtg_x[1], rtg_y[1], rtg_x[2]);
+    break;
+  case RTGCMD_BLITRECT:
+    rtg_async_span(op, 0, rtg_address_adj[0], rtg_x[0], rtg_y[0], rtg_x[2], rtg_y[2], rtg_x[3]);
+    rtg_async_span(op, 1, rtg_address_adj[0], rtg_x[1], rtg_y[1], rtg_x[2], rtg_y[2], rtg_x[3]);
+    break;
+  case RTGCMD_BLITRECT_NOMASK_COMPLETE:
+    rtg_async_span(op, 0, rtg_address[0] - vram, rtg_x[0], rtg_y[0], rtg_x[2], rtg_y[2], rtg_x[3]);
+    rtg_async_span(op, 1, rtg_address[1] - vram, rtg_x[1], rtg_y[1], rtg_x[2], rtg_y[2], rtg_x[4]);
+    break;
+  case RTGCMD_DRAWLINE: {
+    // Cover every row the line could reach in either direction.
+    int32_t reach = rtg_x[2] + abs((int16_t)rtg_y[1]) + 1;
+    rtg_async_span(op, 0, rtg_address_adj[0], 0, sy - reach, (int16_t)rtg_x[0] + reach,
+                   2 * reach, rtg_x[3]);
+    break;
+  }
+  case RTGCMD_P2C:
+  case RTGCMD_P2D: {
+    // Planar source: up to eight planes of src_pitch * (sy + h) bytes each.
+    uint32_t planes = rtg_u8[2] > 8 ? 8 : rtg_u8[2];
+    rtg_async_span(op, 0, rtg_address_adj[1], 0, 0, 0,
+                   (int32_t)planes * (abs(sy) + (int16_t)rtg_y[2] + 1), rtg_x[4]);
+    rtg_async_span(op, 1, rtg_address_adj[0], (int16_t)rtg_x[1], (int16_t)rtg_y[1],
+                   (int16_t)rtg_x[2], (int16_t)rtg_y[2], rtg_x[3]);
+    break;
+  }
+  default:
+    return 0;
+  }
+  return 1;
+}
+
+static void* rtg_async_task(void* arg) {
+  (void)arg;
+  pthread_mutex_lock(&rtg_async_lock);
+  for (;;) {
+    while (rtg_async_completed == rtg_async_submitted && !rtg_async_quit)
+      pthread_cond_wait(&rtg_async_work, &rtg_async_lock);
+    if (rtg_async_completed == rtg_async_submitted)
+      break;
+    struct rtg_async_op* op = &rtg_async_ring[rtg_async_completed % RTG_ASYNC_DEPTH];
+    pthread_mutex_unlock(&rtg_async_lock);
+
+    rtg_regs_load(&op->regs);
+    handle_rtg_command(op->cmd);
+    rtg_gfx_flush_dirty();
+    PS_TRACE1(rtg_cmd_done, op->cmd);
+
+    pthread_mutex_lock(&rtg_async_lock);
+    __atomic_store_n(&rtg_async_completed, rtg_async_completed + 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&rtg_async_done);
+  }
+  pthread_mutex_unlock(&rtg_async_lock);
+  return NULL;
+}
+
+static void rtg_async_start(void) {
+  const char* env = getenv("PISTORM_RTG_ASYNC");
+  uint8_t enable = rtg_async_config;
+  if (env && *env)
+    enable = atoi(env) != 0;
+
+  rtg_async_state = RTG_ASYNC_OFF;
+  if (!enable)
+    return;
+  rtg_async_quit = 0;
+  int err = pthread_create(&rtg_async_tid, NULL, &rtg_async_task, NULL);
+  if (err != 0) {
+    LOG_WARN("[RTG] Failed to start command worker (%d), running commands synchronously.\n", err);
+    return;
+  }
+  pthread_setname_np(rtg_async_tid, "pistorm64: blit");
+  rtg_async_state = RTG_ASYNC_ON;
+  LOG_INFO("[RTG] Asynchronous command execution enabled (queue depth %d).\n", RTG_ASYNC_DEPTH);
+}
+
+static inline int rtg_async_idle(void) {
+  return __atomic_load_n(&rtg_async_completed, __ATOMIC_ACQUIRE) == rtg_async_submitted;
+}
+
+// Waits until every command up to and including seq has run.
+static void rtg_async_wait(uint64_t seq) {
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  pthread_mutex_lock(&rtg_async_lock);
+  while (rtg_async_completed < seq)
+    pthread_cond_wait(&rtg_async_done, &rtg_async_lock);
+  pthread_mutex_unlock(&rtg_async_lock);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  METRICS_INC(rtg_async_fences);
+  METRICS_ADD(rtg_async_stall_ns, (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000u +
+                                      (uint64_t)t1.tv_nsec - (uint64_t)t0.tv_nsec);
+}
+
+// CPU thread only: hand VRAM back to the Musashi fast path once nothing is queued.
+static inline void rtg_async_resume_vram(void) {
+  if (vram_suspended && rtg_async_idle()) {
+    m68k_suspend_ram_range(rtg_mem, 0);
+    vram_suspended = 0;
+  }
+}
+
+void rtg_async_drain(void) {
+  if (rtg_async_state != RTG_ASYNC_ON)
+    return;
+  if (!rtg_async_idle())
+    rtg_async_wait(rtg_async_submitted);
+  rtg_async_resume_vram();
+}
+
+static void rtg_async_fence(size_t offset, size_t len) {
+  if (!vram_suspended)
+    return;
+  uint64_t done = __atomic_load_n(&rtg_async_completed, __ATOMIC_ACQUIRE);
+  uint64_t wait_for = 0;
+  for (uint64_t seq = done; seq < rtg_async_submitted; seq++) {
+    const struct rtg_async_op* op = &rtg_async_ring[seq % RTG_ASYNC_DEPTH];
+    for (int i = 0; i < 2; i++) {
+      if (offset < op->hi[i] && offset + len > op->lo[i])
+        wait_for = seq + 1;
+    }
+  }
+  if (wait_for)
+    rtg_async_wait(wait_for);
+  rtg_async_resume_vram();
+}
+
+// Returns 1 if the command was queued, 0 if the caller has to run it now.
+static int rtg_async_submit(uint16_t cmd) {
+  if (rtg_async_state == RTG_ASYNC_UNSET)
+    rtg_async_start();
+  if (rtg_async_state != RTG_ASYNC_ON)
+    return 0;
+
+  struct rtg_async_op op;
+  if (realtime_graphics_debug || !rtg_async_prepare(&op, cmd)) {
+    rtg_async_drain();
+    return 0;
+  }
+  op.cmd = cmd;
+  rtg_regs_save(&op.regs);
+
+  if (!vram_suspended) {
+    m68k_suspend_ram_range(rtg_mem, 1);
+    vram_suspended = 1;
+  }
+  if (rtg_async_submitted - __atomic_load_n(&rtg_async_completed, __ATOMIC_ACQUIRE) >=
+      RTG_ASYNC_DEPTH) {
+    rtg_async_wait(rtg_async_submitted - RTG_ASYNC_DEPTH + 1);
+  }
+  pthread_mutex_lock(&rtg_async_lock);
+  rtg_async_ring[rtg_async_submitted % RTG_ASYNC_DEPTH] = op;
+  rtg_async_submitted++;
+  pthread_cond_signal(&rtg_async_work);
+  pthread_mutex_unlock(&rtg_async_lock);
+  METRICS_INC(rtg_async_ops);
+  return 1;
+}
+
+static void rtg_async_stop(void) {
+  if (rtg_async_state != RTG_ASYNC_ON) {
+    rtg_async_state = RTG_ASYNC_UNSET;
+    return;
+  }
+  rtg_async_drain();
+  pthread_mutex_lock(&rtg_async_lock);
+  rtg_async_quit = 1;
+  pthread_cond_signal(&rtg_async_work);
+  pthread_mutex_unlock(&rtg_async_lock);
+  pthread_join(rtg_async_tid, NULL);
+  rtg_async_state = RTG_ASYNC_UNSET;
+}
+
+// The Picasso96 mode while native frames are shown, and the native mode last
+// set, to notice SetGC/SetPan arriving in between.
+struct rtg_display_mode {
+  uint32_t addr, addr_adj;
+  uint16_t width, height, format, pitch;
+};
+static struct rtg_display_mode p96_mode, native_mode;
+static uint8_t native_shown;
+
+static void rtg_mode_get(struct rtg_display_mode* mode) {
+  mode->addr = framebuffer_addr;
+  mode->addr_adj = framebuffer_addr_adj;
+  mode->width = rtg_display_width;
+  mode->height = rtg_display_height;
+  mode->format = rtg_display_format;
+  mode->pitch = rtg_pitch;
+}
+
+static void rtg_mode_set(const struct rtg_display_mode* mode) {
+  framebuffer_addr = mode->addr;
+  framebuffer_addr_adj = mode->addr_adj;
+  rtg_display_width = mode->width;
+  rtg_display_height = mode->height;
+  rtg_display_format = mode->format;
+  rtg_pitch = mode->pitch;
+}
+
+// Picasso96 may SetGC/SetPan while a native frame is shown. Whatever it set
+// since then is its mode; the rest is what it had before.
+static void rtg_mode_update_p96(void) {
+  struct rtg_display_mode cur;
+  rtg_mode_get(&cur);
+  if (!native_shown) {
+    p96_mode = cur;
+    return;
+  }
+#define P96_FIELD(f)                                                                               \
+  if (cur.f != native_mode.f) {                                                                    \
+    p96_mode.f = cur.f;                                                                            \
+  }
+  P96_FIELD(addr)
+  P96_FIELD(addr_adj)
+  P96_FIELD(width)
+  P96_FIELD(height)
+  P96_FIELD(format)
+  P96_FIELD(pitch)
+#undef P96_FIELD
+}
+
+void rtg_show_native_frame(uint32_t offset, uint16_t width, uint16_t height) {
+  if (display_enabled == 1 || !rtg_mem) {
+    return;
+  }
+  rtg_mode_update_p96();
+  native_mode = (struct rtg_display_mode){offset, offset, width, height, RTGFMT_RGB32_ARGB,
+                                          (uint16_t)(width * 4u)};
+  rtg_mode_set(&native_mode);
+  native_shown = 1;
+  if (!rtg_on) {
+    rtg_init_display();
+  }
+}
+
+void rtg_hide_native_frame(void) {
+  if (!native_shown) {
+    return;
+  }
+  rtg_mode_update_p96();
+  rtg_mode_set(&p96_mode);
+  native_shown = 0;
+  if (display_enabled != 1 && rtg_on) {
+    rtg_shutdown_display();
+  }
 }
 
 unsigned int rtg_get_fb(void) {
@@ -140,7 +594,8 @@ unsigned int rtg_read(uint32_t address, uint8_t mode) {
   // printf("%s read from RTG: %.8X\n", op_type_names[mode], address);
   if (address >= PIGFX_REG_SIZE) {
     const unsigned int offset = address - PIGFX_REG_SIZE;
-    if (rtg_mem && offset < rtg_mem_size) {
+    if (rtg_mem && offset < PIGFX_WINDOW_SIZE) {
+      rtg_async_fence(offset, mode == OP_TYPE_BYTE ? 1 : mode == OP_TYPE_WORD ? 2 : 4);
       switch (mode) {
       case OP_TYPE_BYTE:
         return rtg_mem[offset];
@@ -156,9 +611,13 @@ unsigned int rtg_read(uint32_t address, uint8_t mode) {
       }
     }
   }
+  // Register reads are how the driver polls for status, so let queued work land.
+  rtg_async_drain();
   switch (address) {
   case RTG_COMMAND:
     return rtg_enabled ? 0xFFCF : 0x0000;
+  case RTG_VRAM_SIZE:
+    return rtg_vram_size;
   case RTG_WAITVSYNC:
     if (rtg_on) {
       if (!wait_vblank && cur_rtg_frame != wait_rtg_frame) {
@@ -215,7 +674,8 @@ void rtg_write(uint32_t address, uint32_t value, uint8_t mode) {
     PIGFX_REG_SIZE), framebuffer_addr);
     }*/
     const unsigned int offset = address - PIGFX_REG_SIZE;
-    if (rtg_mem && offset < rtg_mem_size) {
+    if (rtg_mem && offset < PIGFX_WINDOW_SIZE) {
+      rtg_async_fence(offset, mode == OP_TYPE_BYTE ? 1 : mode == OP_TYPE_WORD ? 2 : 4);
       switch (mode) {
       case OP_TYPE_BYTE:
         rtg_mem[offset] = (uint8_t)value;
@@ -229,6 +689,7 @@ void rtg_write(uint32_t address, uint32_t value, uint8_t mode) {
       default:
         return;
       }
+      rtg_mark_dirty(offset, mode == OP_TYPE_BYTE ? 1 : mode == OP_TYPE_WORD ? 2 : 4);
     }
   } else if (address == RTG_DEBUGME) {
     uint8_t tag = (uint8_t)((value >> 24) & 0xFF);
@@ -266,7 +727,7 @@ void rtg_write(uint32_t address, uint32_t value, uint8_t mode) {
       LOG_INFO("[RTG/DBG] P2D RGBFormat=%u\n", (unsigned int)payload);
       break;
     default:
-      LOG_DEBUG("RTG DEBUGME WRITE: %u\n", (unsigned int)value);
+      LOG_FAST_DEBUG("RTG DEBUGME WRITE: %u\n", (unsigned int)value);
       break;
     }
   } else {
@@ -329,10 +790,19 @@ void rtg_write(uint32_t address, uint32_t value, uint8_t mode) {
           rtg_format = (uint16_t)value;
           break;
       case RTG_COMMAND:
-        handle_rtg_command(value);
+        PS_TRACE5(rtg_cmd, value, rtg_x[0], rtg_y[0], rtg_x[1], rtg_y[1]);
+        if (!rtg_async_submit((uint16_t)value)) {
+          handle_rtg_command(value);
+          rtg_gfx_flush_dirty();
+          PS_TRACE1(rtg_cmd_done, value);
+        }
         break;
       case IRTG_COMMAND:
+        PS_TRACE1(irtg_cmd, value);
+        rtg_async_drain();
         handle_irtg_command(value);
+        rtg_gfx_flush_dirty();
+        PS_TRACE1(irtg_cmd_done, value);
         break;
       }
       break;
@@ -443,12 +913,12 @@ static void handle_irtg_command(uint32_t cmd) {
     // y_offset, D7: RGBFTYPE format
 #ifdef DEBUG_RTG
     if (realtime_graphics_debug) {
-      LOG_DEBUG("iSetPanning begin\n");
-      LOG_DEBUG("IRTGCmd SetPanning\n");
-      LOG_DEBUG("IRTGCmd x: %d y: %d w: %d (%d)\n", M68KR(M68K_REG_D1), M68KR(M68K_REG_D2),
+      LOG_FAST_DEBUG("iSetPanning begin\n");
+      LOG_FAST_DEBUG("IRTGCmd SetPanning\n");
+      LOG_FAST_DEBUG("IRTGCmd x: %d y: %d w: %d (%d)\n", M68KR(M68K_REG_D1), M68KR(M68K_REG_D2),
                 M68KR(M68K_REG_D0) << RGBF_D7, M68KR(M68K_REG_D0));
-      LOG_DEBUG("BoardInfo: %.8X Addr: %.8X\n", M68KR(M68K_REG_A0), M68KR(M68K_REG_A1));
-      LOG_DEBUG("BoardInfo Xoffs: %d Yoffs: %d\n", be16toh(b->XOffset), be16toh(b->YOffset));
+      LOG_FAST_DEBUG("BoardInfo: %.8X Addr: %.8X\n", M68KR(M68K_REG_A0), M68KR(M68K_REG_A1));
+      LOG_FAST_DEBUG("BoardInfo Xoffs: %d Yoffs: %d\n", be16toh(b->XOffset), be16toh(b->YOffset));
     }
 #endif
     if (!b)
@@ -466,11 +936,11 @@ static void handle_irtg_command(uint32_t cmd) {
 
 #ifdef DEBUG_RTG
     if (realtime_graphics_debug) {
-      LOG_DEBUG("RTG OffsetX/Y: %d/%d\n", rtg_offset_x, rtg_offset_y);
-      LOG_DEBUG("RTG Pitch: %d\n", rtg_pitch);
-      LOG_DEBUG("RTG FBAddr/Adj: %.8X (%.8X)/%.8X\n", framebuffer_addr, M68KR(M68K_REG_A1),
+      LOG_FAST_DEBUG("RTG OffsetX/Y: %d/%d\n", rtg_offset_x, rtg_offset_y);
+      LOG_FAST_DEBUG("RTG Pitch: %d\n", rtg_pitch);
+      LOG_FAST_DEBUG("RTG FBAddr/Adj: %.8X (%.8X)/%.8X\n", framebuffer_addr, M68KR(M68K_REG_A1),
                 framebuffer_addr_adj);
-      LOG_DEBUG("iSetPanning End\n");
+      LOG_FAST_DEBUG("iSetPanning End\n");
     }
 #endif
 
@@ -698,11 +1168,11 @@ static void handle_irtg_command(uint32_t cmd) {
     }
 
     if (realtime_graphics_debug) {
-      LOG_DEBUG("bm: 0x%" PRIxPTR " r: 0x%" PRIxPTR "\n", (uintptr_t)bm, (uintptr_t)r);
+      LOG_FAST_DEBUG("bm: 0x%" PRIxPTR " r: 0x%" PRIxPTR "\n", (uintptr_t)bm, (uintptr_t)r);
       if (bm)
-        LOG_DEBUG("bm pitch: %d\n", be16toh(bm->BytesPerRow));
+        LOG_FAST_DEBUG("bm pitch: %d\n", be16toh(bm->BytesPerRow));
       if (r)
-        LOG_DEBUG("r pitch: %d\n", be16toh(r->BytesPerRow));
+        LOG_FAST_DEBUG("r pitch: %d\n", be16toh(r->BytesPerRow));
     }
 
     uint16_t bmp_pitch = be16toh(bm->BytesPerRow);
@@ -751,8 +1221,8 @@ static void handle_rtg_command(uint32_t cmd) {
       rtg_total_rows = rtg_y[1];
     }
     if (realtime_graphics_debug) {
-      LOG_DEBUG("Set RTG mode:\n");
-      LOG_DEBUG("%dx%d pixels\n", rtg_display_width, rtg_display_height);
+      LOG_FAST_DEBUG("Set RTG mode:\n");
+      LOG_FAST_DEBUG("%dx%d pixels\n", rtg_display_width, rtg_display_height);
     }
     break;
   case RTGCMD_SETPAN:
@@ -772,23 +1242,31 @@ static void handle_rtg_command(uint32_t cmd) {
     // printf("Command: SetCLUT.\n");
     // printf("Set palette entry %d to %d, %d, %d\n", rtg_u8[0], rtg_u8[1], rtg_u8[2], rtg_u8[3]);
     // printf("Set palette entry %d to 32-bit palette color: %.8X\n", rtg_u8[0], rtg_rgb[0]);
+    rtg_clut[rtg_u8[0]] = rtg_rgb[0];
+    __atomic_add_fetch(&rtg_clut_seq, 1, __ATOMIC_RELEASE);
     rtg_set_clut_entry(rtg_u8[0], rtg_rgb[0]);
     break;
   }
   case RTGCMD_SETDISPLAY:
     gdebug("SetDisplay\n");
     if (realtime_graphics_debug) {
-      LOG_DEBUG("RTG SetDisplay %s\n", (rtg_u8[1]) ? "enabled" : "disabled");
+      LOG_FAST_DEBUG("RTG SetDisplay %s\n", (rtg_u8[1]) ? "enabled" : "disabled");
     }
     break;
   case RTGCMD_ENABLE:
   case RTGCMD_SETSWITCH:
     gdebug("SetSwitch\n");
     if (realtime_graphics_debug) {
-      LOG_DEBUG("RTG SetSwitch %s\n", ((rtg_x[0]) & 0x01) ? "enabled" : "disabled");
-      LOG_DEBUG("LAL: %.4X\n", rtg_x[0]);
+      LOG_FAST_DEBUG("RTG SetSwitch %s\n", ((rtg_x[0]) & 0x01) ? "enabled" : "disabled");
+      LOG_FAST_DEBUG("LAL: %.4X\n", rtg_x[0]);
     }
     display_enabled = ((rtg_x[0]) & 0x01);
+    if (display_enabled && native_shown) {
+      // Picasso96 takes the display back from the native capture.
+      rtg_mode_update_p96();
+      rtg_mode_set(&p96_mode);
+      native_shown = 0;
+    }
     if (display_enabled != rtg_on) {
       rtg_on = display_enabled;
       if (rtg_on)
@@ -873,6 +1351,9 @@ static void handle_rtg_command(uint32_t cmd) {
     gdebug("SetSpriteColor\n");
     break;
   case RTGCMD_SETSPRITEPOS:
+    rtg_sprite_x = (int16_t)rtg_x[0];
+    rtg_sprite_y = (int16_t)rtg_y[0];
+    __atomic_add_fetch(&rtg_sprite_seq, 1, __ATOMIC_RELEASE);
     rtg_set_mouse_cursor_pos((int16_t)rtg_x[0], (int16_t)rtg_y[0]);
     gdebug("SetSpritePos\n");
     break;
@@ -881,7 +1362,7 @@ static void handle_rtg_command(uint32_t cmd) {
     gdebug("SetSpriteImage\n");
     break;
   case RTGCMD_DEBUGME:
-    LOG_DEBUG("[RTG] DebugMe!\n");
+    LOG_FAST_DEBUG("[RTG] DebugMe!\n");
     break;
   default:
     LOG_WARN("[!!!RTG] Unknown/unhandled RTG command %d ($%.4X)\n", cmd, cmd);
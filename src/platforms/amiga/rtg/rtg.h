@@ -2,10 +2,19 @@
 
 #define PIGFX_RTG_BASE 0x70000000
 #define PIGFX_REG_SIZE 0x00010000
+// Default VRAM size; "setvar rtg-vram <MB>" changes it (see rtg_set_vram_size).
 #define PIGFX_RTG_SIZE 0x02000000
 #define PIGFX_SCRATCH_SIZE 0x00800000
-#define PIGFX_SCRATCH_AREA 0x72010000
-#define PIGFX_UPPER 0x72810000
+// VRAM plus the driver's scratch area has to end below PiSCSI at 0x80000000.
+#define PIGFX_RTG_SIZE_MAX 0x0F700000
+// The scratch area follows the VRAM; drivers learn its size from RTG_VRAM_SIZE.
+#define PIGFX_SCRATCH_AREA (PIGFX_RTG_BASE + PIGFX_REG_SIZE + rtg_vram_size)
+#define PIGFX_UPPER (PIGFX_SCRATCH_AREA + PIGFX_SCRATCH_SIZE)
+// The part of rtg_mem the Amiga can reach through the PiGFX window.
+#define PIGFX_WINDOW_SIZE ((size_t)rtg_vram_size + PIGFX_SCRATCH_SIZE)
+// Native display capture frames (rtg-native.c) follow the scratch area in
+// rtg_mem, outside the PiGFX window.
+#define PIGFX_NATIVE_SIZE 0x00800000
 
 #define CARD_OFFSET 0
 
@@ -17,6 +26,17 @@
 
 struct emulator_config;
 
+extern uint32_t rtg_vram_size; // VRAM reported to the driver
+extern size_t rtg_mem_size;    // VRAM, scratch and native capture area, the size of rtg_mem
+
+// Copies of what the driver last sent through SetCLUT (0x00RRGGBB) and
+// SetSpritePos, for readers other than the output backend. The sequence
+// numbers count updates.
+extern uint32_t rtg_clut[256];
+extern uint32_t rtg_clut_seq;
+extern int16_t rtg_sprite_x, rtg_sprite_y;
+extern uint32_t rtg_sprite_seq;
+
 static inline uint8_t* rtg_pixel_at(uint8_t *base, size_t index, uint16_t format) {
   return base + ((size_t)index * rtg_pixel_size[format]);
 }
@@ -114,6 +134,10 @@ unsigned int rtg_read(uint32_t address, uint8_t mode);
 void rtg_set_clut_entry(uint8_t index, uint32_t xrgb);
 void rtg_init_display(void);
 void rtg_shutdown_display(void);
+// Show a 32-bit ARGB frame at `offset` in rtg_mem while the Picasso96 display
+// is switched off, keeping the Picasso96 mode for when it switches back on.
+void rtg_show_native_frame(uint32_t offset, uint16_t width, uint16_t height);
+void rtg_hide_native_frame(void);
 void rtg_enable_mouse_cursor(uint8_t enable);
 
 unsigned int rtg_get_fb(void);
@@ -134,8 +158,15 @@ void rtg_set_clut_cursor(uint8_t* bmp, uint32_t* pal, int16_t offs_x, int16_t of
 uint16_t rtg_get_scale_filter(void);
 void rtg_palette_debug(uint8_t enable);
 
+// Set the VRAM size in megabytes before init_rtg_data(); clamped to what fits
+// the PiGFX window. Returns the size in bytes that will be used.
+uint32_t rtg_set_vram_size(uint32_t megabytes);
 int init_rtg_data(struct emulator_config* cfg);
 void shutdown_rtg(void);
+// Queue VRAM-only PiGFX commands to a worker thread (PISTORM_RTG_ASYNC overrides).
+void rtg_set_async(uint8_t enable);
+// Wait for queued PiGFX commands; call before touching VRAM behind rtg_read/rtg_write.
+void rtg_async_drain(void);
 
 void rtg_fillrect(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint32_t color, uint16_t pitch,
                   uint16_t format, uint8_t mask);
@@ -175,6 +206,48 @@ void rtg_p2c_ex(int16_t sx, int16_t sy, int16_t dx, int16_t dy, int16_t w, int16
                 uint8_t minterm, struct BitMap* bm, uint8_t mask, uint16_t dst_pitch,
                 uint16_t src_pitch);
 
+/*
+ * Dirty page map over RTG VRAM, one byte per (1 << RTG_DIRTY_SHIFT) bytes.
+ * Writers set entries to RTG_DIRTY_ALL after storing pixels: the 68k through
+ * its Musashi RAM range, rtg_write(), PiGFX operations and PiStorm device
+ * copies. Each reader owns one bit and clears only that bit before converting
+ * the matching rows, so a write that races with the conversion marks the page
+ * again for next frame, and readers never steal each other's damage.
+ */
+#define RTG_DIRTY_SHIFT 10
+#define RTG_DIRTY_ALL 0xFF
+#define RTG_DIRTY_DISPLAY 0x01 // the output backend
+#define RTG_DIRTY_VNC 0x02     // rtg-vnc.c
+extern uint8_t* rtg_dirty;
+
+static inline void rtg_mark_dirty(size_t offset, size_t len) {
+  if (!rtg_dirty || !len) {
+    return;
+  }
+  for (size_t p = offset >> RTG_DIRTY_SHIFT; p <= (offset + len - 1) >> RTG_DIRTY_SHIFT; p++) {
+    __atomic_store_n(&rtg_dirty[p], RTG_DIRTY_ALL, __ATOMIC_RELEASE);
+  }
+}
+
+// Same, for a 68k address range; ignored unless it falls inside VRAM.
+void rtg_mark_dirty_addr(uint32_t address, uint32_t len);
+// Non-zero if any of the 68k address range falls inside VRAM. Host-side
+// copies there call rtg_async_drain() first and rtg_mark_dirty_addr() after.
+int rtg_vram_range(uint32_t address, uint32_t len);
+// PiGFX operations record their destination span while drawing and publish
+// it once the operation has finished.
+void rtg_gfx_defer_dirty(const uint8_t* dst, size_t len);
+void rtg_gfx_flush_dirty(void);
+
+// Non-zero runs the per-pixel reference loops in rtg-gfx.c instead of the span kernels.
+extern uint8_t rtg_gfx_scalar;
+
+// Split large PiGFX operations across this many threads (the caller plus
+// threads - 1 helpers, at most 8). 1 keeps everything on the calling thread;
+// PISTORM_RTG_THREADS overrides the value when the pool next starts.
+void rtg_gfx_set_threads(unsigned int threads);
+void rtg_gfx_stop_threads(void);
+
 #define PATTERN_LOOPX                                                                              \
   if (sptr) {                                                                                      \
     cur_byte = (uint8_t)sptr[tmpl_x];                                                              \
@@ -30,8 +30,9 @@
 #define CARD_OFFSET   0x70000000
 #define IRTGCMD_OFFSET   0x70000060
 #define CARD_REGSIZE  0x00010000
-#define CARD_MEMSIZE  0x02000000 // 32MB "VRAM"
-#define CARD_SCRATCH  0x72010000
+#define CARD_MEMSIZE  0x02000000 // 32MB "VRAM", if the emulator does not report a size
+// The scratch area follows the VRAM, its address is kept in CardData[0].
+#define CARD_SCRATCH(b) ((b)->CardData[0])
 
 #define WRITESHORT(cmd, val) *(unsigned short *)((unsigned long)(CARD_OFFSET+cmd)) = val;
 #define WRITELONG(cmd, val) *(unsigned long *)((unsigned long)(CARD_OFFSET+cmd)) = val;
@@ -234,9 +235,17 @@ int __attribute__((used)) FindCard(__REGA0(struct BoardInfo* b)) {
     LOADLIB(DOSBase, "dos.library");
     LOADLIB(IntuitionBase, "intuition.library");
 
-    b->MemorySize = CARD_MEMSIZE;
+    ULONG memsize;
+    READLONG(RTG_VRAM_SIZE, memsize);
+    if (memsize == 0) {
+        // Emulator from before RTG_VRAM_SIZE.
+        memsize = CARD_MEMSIZE;
+    }
+
+    b->MemorySize = memsize;
     b->RegisterBase = (void *)CARD_OFFSET;
     b->MemoryBase = (void *)(CARD_OFFSET + CARD_REGSIZE);
+    CARD_SCRATCH(b) = CARD_OFFSET + CARD_REGSIZE + memsize;
 
     return 1;
 }
@@ -595,7 +604,7 @@ void BlitTemplate (__REGA0(struct BoardInfo *b), __REGA1(struct RenderInfo *r),
         WRITELONG(RTG_ADDR1, (unsigned long)t->Memory);
     }
     else {
-        unsigned long dest = CARD_SCRATCH;
+        unsigned long dest = CARD_SCRATCH(b);
         memcpy((unsigned char *)dest, t->Memory, (t->BytesPerRow * h));
         WRITELONG(RTG_ADDR1, (unsigned long)dest);
         WRITELONG(RTG_ADDR3, (unsigned long)t->Memory);
@@ -634,7 +643,7 @@ void BlitPattern (__REGA0(struct BoardInfo *b), __REGA1(struct RenderInfo *r), _
         WRITELONG(RTG_ADDR1, (unsigned long)p->Memory);
     }
     else {
-        unsigned long dest = CARD_SCRATCH;
+        unsigned long dest = CARD_SCRATCH(b);
         memcpy((unsigned char *)dest, p->Memory, (2 * (1 << p->Size)));
         WRITELONG(RTG_ADDR1, (unsigned long)dest);
     }
@@ -693,7 +702,7 @@ void BlitPlanar2Chunky (__REGA0(struct BoardInfo *b), __REGA1(struct BitMap *bm)
 
     //uint32_t plane_size = bm->BytesPerRow * bm->Rows;
 
-    uint32_t template_addr = CARD_SCRATCH;
+    uint32_t template_addr = CARD_SCRATCH(b);
 
     uint16_t plane_mask = mask;
     uint8_t ff_mask = 0x00;
@@ -756,7 +765,7 @@ void BlitPlanar2Direct (__REGA0(struct BoardInfo *b), __REGA1(struct BitMap *bm)
 
     //uint32_t plane_size = bm->BytesPerRow * bm->Rows;
 
-    uint32_t template_addr = CARD_SCRATCH;
+    uint32_t template_addr = CARD_SCRATCH(b);
 
     uint16_t plane_mask = mask;
     uint8_t ff_mask = 0x00;
@@ -831,7 +840,7 @@ void SetSpriteImage (__REGA0(struct BoardInfo *b), __REGD7(RGBFTYPE format)) {
     WRITEBYTE(RTG_U81, b->MouseWidth);
     WRITEBYTE(RTG_U82, b->MouseHeight);
 
-    uint8_t* dest = (uint8_t*)((uint32_t)CARD_SCRATCH);
+    uint8_t* dest = (uint8_t*)((uint32_t)CARD_SCRATCH(b));
     uint8_t* src = (uint8_t *)b->MouseImage;
     uint16_t data_size = ((b->MouseWidth >> 3) * 2) * (b->MouseHeight);
 
@@ -840,7 +849,7 @@ void SetSpriteImage (__REGA0(struct BoardInfo *b), __REGD7(RGBFTYPE format)) {
 
     memcpy(dest, src, data_size);
 
-    WRITELONG(RTG_ADDR2, CARD_SCRATCH);
+    WRITELONG(RTG_ADDR2, CARD_SCRATCH(b));
 
     WRITESHORT(RTG_COMMAND, RTGCMD_SETSPRITEIMAGE);
 }
@@ -26,6 +26,7 @@ enum pi_regs {
   RTG_U2 = 0x2E,
   RTG_ADDR3 = 0x30,
   RTG_ADDR4 = 0x34,
+  RTG_VRAM_SIZE = 0x38, // read-only, bytes of VRAM the driver may use
   RTG_DEBUGME = 0x50,
   RTG_WAITVSYNC = 0x60,
   RTG_INVBLANK = 0x62,
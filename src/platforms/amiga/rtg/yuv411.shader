@@ -0,0 +1,62 @@
+#version 100
+
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+
+// Raw YUV411 RTG pixels, uploaded as one 8-bit channel per texel. Four pixels
+// share a 32-bit word U6 Ya5 Yb5 V6 Yc5 Yd5, big-endian unless pc is set.
+
+varying vec2 fragTexCoord;
+varying vec4 fragColor;
+
+uniform sampler2D texture0;
+
+uniform vec4 colDiffuse;
+
+uniform float texWidth;
+uniform float pc; // 1.0: YUV411_PC, bytes of each word reversed
+
+// BT.601 studio swing, same rounding as the CPU converter.
+vec3 yuv601(float y, float u, float v)
+{
+    float c = 298.0 * (y - 16.0);
+    float d = u - 128.0;
+    float e = v - 128.0;
+    vec3 rgb = vec3(c + 409.0 * e, c - 100.0 * d - 208.0 * e, c + 516.0 * d);
+    return clamp(floor((rgb + 128.0) / 256.0), 0.0, 255.0) / 255.0;
+}
+
+float byteAt(float x)
+{
+    return floor(texture2D(texture0, vec2((x + 0.5) / texWidth, fragTexCoord.y)).r * 255.0 + 0.5);
+}
+
+void main()
+{
+    float x = floor(fragTexCoord.x * texWidth);
+    float group = floor(x / 4.0) * 4.0;
+
+    if (group + 3.0 >= texWidth) {
+        // Row tail shorter than a word: grey from the pixel's own byte.
+        gl_FragColor = vec4(yuv601(byteAt(x), 128.0, 128.0), 1.0);
+        return;
+    }
+
+    vec4 b = vec4(byteAt(group), byteAt(group + 1.0), byteAt(group + 2.0), byteAt(group + 3.0));
+    b = mix(b, b.wzyx, pc);
+
+    vec4 y5 = vec4(mod(b.x, 4.0) * 8.0 + floor(b.y / 32.0), mod(b.y, 32.0),
+                   mod(b.z, 4.0) * 8.0 + floor(b.w / 32.0), mod(b.w, 32.0));
+    float y = dot(y5, vec4(equal(vec4(x - group), vec4(0.0, 1.0, 2.0, 3.0))));
+    float u = floor(b.x / 4.0);
+    float v = floor(b.z / 4.0);
+
+    // Widen the 5/6-bit fields the way the CPU converter does.
+    y = y * 8.0 + floor(y / 4.0);
+    u = u * 4.0 + floor(u / 16.0);
+    v = v * 4.0 + floor(v / 16.0);
+    gl_FragColor = vec4(yuv601(y, u, v), 1.0);
+}
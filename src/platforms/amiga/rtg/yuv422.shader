@@ -0,0 +1,54 @@
+#version 100
+
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+
+// Raw YUV422 RTG pixels, uploaded as two 8-bit channels per texel
+// (r = first byte, a = second), one texel per pixel. Each 4-byte pixel pair
+// spans two texels; the sel* uniforms pick Y0, Y1, U and V out of it.
+
+varying vec2 fragTexCoord;
+varying vec4 fragColor;
+
+uniform sampler2D texture0;
+
+uniform vec4 colDiffuse;
+
+uniform float texWidth;
+uniform vec4 selY0;
+uniform vec4 selY1;
+uniform vec4 selU;
+uniform vec4 selV;
+
+// BT.601 studio swing, same rounding as the CPU converter.
+vec3 yuv601(float y, float u, float v)
+{
+    float c = 298.0 * (y - 16.0);
+    float d = u - 128.0;
+    float e = v - 128.0;
+    vec3 rgb = vec3(c + 409.0 * e, c - 100.0 * d - 208.0 * e, c + 516.0 * d);
+    return clamp(floor((rgb + 128.0) / 256.0), 0.0, 255.0) / 255.0;
+}
+
+void main()
+{
+    float x = floor(fragTexCoord.x * texWidth);
+    float pair = floor(x / 2.0) * 2.0;
+    vec4 t0 = texture2D(texture0, vec2((pair + 0.5) / texWidth, fragTexCoord.y));
+    vec4 t1 = texture2D(texture0, vec2((pair + 1.5) / texWidth, fragTexCoord.y));
+    vec4 bytes = floor(vec4(t0.r, t0.a, t1.r, t1.a) * 255.0 + 0.5);
+
+    float y = dot(bytes, mix(selY0, selY1, x - pair));
+    float u = dot(bytes, selU);
+    float v = dot(bytes, selV);
+    if (pair + 1.0 >= texWidth) {
+        // Odd width: the last pixel has no partner, show its first byte as grey.
+        y = bytes.x;
+        u = 128.0;
+        v = 128.0;
+    }
+    gl_FragColor = vec4(yuv601(y, u, v), 1.0);
+}
@@ -0,0 +1,500 @@
+// SPDX-License-Identifier: MIT
+// tools/ide_bench.c
+//
+// Sequential throughput of the Gayle IDE emulation (src/ide/ide.c), driven
+// through its registers as the Amiga's driver does: the task file, the
+// command, a wait on the status register for DRQ before every block and 256
+// data register accesses per sector. It reads and writes SIZE MB with COUNT
+// sectors per command, with READ/WRITE SECTORS and, when the drive offers
+// it, READ/WRITE MULTIPLE, and a write pass ends with FLUSH CACHE so that
+// deferred writes are counted. Then, without the storage model, a few
+// hundred reads and writes of random places and lengths and a read past the
+// end of the drive. Every sector read must hold what was last written to
+// it, and any failure makes the exit code 1.
+//
+//   -m op-us,MB/s  every read and write of the image costs a fixed time plus
+//                  a transfer rate, to stand in for an SD card or USB stick
+//   -w ns          time the Amiga spends per data word, copying it, which
+//                  the I/O thread can overlap with reading the next block
+//   -c count       sectors per command, 1 to 256 (default 128)
+//
+// Each pass starts with the image's page cache dropped. Run it with
+// PISTORM_IDE_ASYNC=0 for the I/O on the caller's thread, and build it with
+// IDE_SRC=path/to/ide.c ./build_idebench.sh to measure another ide.c; a
+// drive without READ MULTIPLE is run with READ/WRITE SECTORS only. The
+// image, ACME ACCELLERATTI (128MB), is made in dir (default /tmp) and
+// removed at the end.
+//
+// Usage: ide_bench [-m op-us,MB/s] [-w ns] [-c count] [size-MB] [dir]
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ide/ide.h"
+
+#define ST_ERR 0x01
+#define ST_DRQ 0x08
+#define ST_BSY 0x80
+
+#define CMD_READ 0x20
+#define CMD_WRITE 0x30
+#define CMD_READ_MULTIPLE 0xC4
+#define CMD_WRITE_MULTIPLE 0xC5
+#define CMD_SET_MULTIPLE 0xC6
+#define CMD_FLUSH_CACHE 0xE7
+#define CMD_IDENTIFY 0xEC
+
+#define HEADER_SECTORS 2
+#define MIXED_OPS 400
+
+/* Reads and writes of the image, with the optional storage model. */
+
+static uint64_t model_op_ns, model_ns_per_kb;
+static int model_on;
+static uint64_t n_reads, n_writes, read_bytes, write_bytes;
+
+static void storage(size_t len) {
+  uint64_t ns = model_op_ns + len * model_ns_per_kb / 1024;
+  if (__atomic_load_n(&model_on, __ATOMIC_RELAXED) && ns) {
+    struct timespec ts = {(time_t)(ns / 1000000000u), (long)(ns % 1000000000u)};
+    nanosleep(&ts, NULL);
+  }
+}
+
+static void count_read(size_t len) {
+  __atomic_add_fetch(&n_reads, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&read_bytes, len, __ATOMIC_RELAXED);
+  storage(len);
+}
+
+static void count_write(size_t len) {
+  __atomic_add_fetch(&n_writes, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&write_bytes, len, __ATOMIC_RELAXED);
+  storage(len);
+}
+
+// With _FILE_OFFSET_BITS=64 glibc may resolve pread and pwrite to their
+// 64-bit names, so both are wrapped.
+ssize_t __real_read(int fd, void* buf, size_t len);
+ssize_t __real_write(int fd, const void* buf, size_t len);
+ssize_t __real_pread(int fd, void* buf, size_t len, off_t offset);
+ssize_t __real_pread64(int fd, void* buf, size_t len, off_t offset);
+ssize_t __real_pwrite(int fd, const void* buf, size_t len, off_t offset);
+ssize_t __real_pwrite64(int fd, const void* buf, size_t len, off_t offset);
+ssize_t __wrap_read(int fd, void* buf, size_t len);
+ssize_t __wrap_write(int fd, const void* buf, size_t len);
+ssize_t __wrap_pread(int fd, void* buf, size_t len, off_t offset);
+ssize_t __wrap_pread64(int fd, void* buf, size_t len, off_t offset);
+ssize_t __wrap_pwrite(int fd, const void* buf, size_t len, off_t offset);
+ssize_t __wrap_pwrite64(int fd, const void* buf, size_t len, off_t offset);
+
+ssize_t __wrap_read(int fd, void* buf, size_t len) {
+  count_read(len);
+  return __real_read(fd, buf, len);
+}
+
+ssize_t __wrap_write(int fd, const void* buf, size_t len) {
+  count_write(len);
+  return __real_write(fd, buf, len);
+}
+
+ssize_t __wrap_pread(int fd, void* buf, size_t len, off_t offset) {
+  count_read(len);
+  return __real_pread(fd, buf, len, offset);
+}
+
+ssize_t __wrap_pread64(int fd, void* buf, size_t len, off_t offset) {
+  count_read(len);
+  return __real_pread64(fd, buf, len, offset);
+}
+
+ssize_t __wrap_pwrite(int fd, const void* buf, size_t len, off_t offset) {
+  count_write(len);
+  return __real_pwrite(fd, buf, len, offset);
+}
+
+ssize_t __wrap_pwrite64(int fd, const void* buf, size_t len, off_t offset) {
+  count_write(len);
+  return __real_pwrite64(fd, buf, len, offset);
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+/* The Amiga side. */
+
+static struct ide_controller* ctl;
+static uint64_t word_ns;
+static int failures;
+
+static void amiga_work(unsigned int words) {
+  struct timespec t0, t;
+  uint64_t ns = word_ns * words, spent;
+  if (!ns) {
+    return;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  do {
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    spent = (uint64_t)(t.tv_sec - t0.tv_sec) * 1000000000u + (uint64_t)t.tv_nsec -
+            (uint64_t)t0.tv_nsec;
+  } while (spent < ns);
+}
+
+static uint8_t wait_not_busy(void) {
+  uint8_t st;
+  while ((st = ide_read8(ctl, ide_status_r)) & ST_BSY) {
+  }
+  return st;
+}
+
+static void command(uint32_t lba, unsigned int count, uint8_t cmd) {
+  wait_not_busy();
+  ide_write8(ctl, ide_lba_top, (uint8_t)(0x40 | ((lba >> 24) & 15)));
+  ide_write8(ctl, ide_sec_count, (uint8_t)count);
+  ide_write8(ctl, ide_lba_low, (uint8_t)lba);
+  ide_write8(ctl, ide_lba_mid, (uint8_t)(lba >> 8));
+  ide_write8(ctl, ide_lba_hi, (uint8_t)(lba >> 16));
+  ide_write8(ctl, ide_command_w, cmd);
+}
+
+// Moves count sectors, block of them per DRQ, in or out of buf. Returns -1
+// if the drive reports an error.
+static int transfer(uint32_t lba, unsigned int count, unsigned int block, uint8_t* buf,
+                    int write) {
+  uint8_t cmd;
+  if (write) {
+    cmd = block > 1 ? CMD_WRITE_MULTIPLE : CMD_WRITE;
+  } else {
+    cmd = block > 1 ? CMD_READ_MULTIPLE : CMD_READ;
+  }
+  command(lba, count & 0xFF, cmd);
+  for (unsigned int s = 0; s < count; s += block) {
+    uint8_t st = wait_not_busy();
+    if ((st & ST_ERR) || !(st & ST_DRQ)) {
+      return -1;
+    }
+    unsigned int n = count - s < block ? count - s : block;
+    for (unsigned int i = 0; i < n; i++) {
+      uint8_t* p = buf + 512 * (s + i);
+      for (int w = 0; w < 512; w += 2) {
+        if (write) {
+          ide_write16(ctl, ide_data, (uint16_t)(p[w] << 8 | p[w + 1]));
+        } else {
+          uint16_t v = ide_read16(ctl, ide_data);
+          p[w] = (uint8_t)(v >> 8);
+          p[w + 1] = (uint8_t)v;
+        }
+      }
+      amiga_work(256);
+    }
+  }
+  return wait_not_busy() & ST_ERR ? -1 : 0;
+}
+
+// The most sectors per block READ/WRITE MULTIPLE may be set to, 0 if the
+// drive has no multiple mode.
+static unsigned int identify_multiple(void) {
+  uint16_t ident[256];
+  command(0, 0, CMD_IDENTIFY);
+  if ((wait_not_busy() & (ST_ERR | ST_DRQ)) != ST_DRQ) {
+    return 0;
+  }
+  for (int w = 0; w < 256; w++) {
+    // Byte swapped, as the Amiga sees the little-endian words.
+    uint16_t v = ide_read16(ctl, ide_data);
+    ident[w] = (uint16_t)(v << 8 | v >> 8);
+  }
+  wait_not_busy();
+  return ident[47] & 0x8000 ? ident[47] & 0xFF : 0;
+}
+
+static int simple_command(uint8_t cmd, unsigned int count) {
+  command(0, count, cmd);
+  return wait_not_busy() & ST_ERR ? -1 : 0;
+}
+
+/* What the drive should hold. */
+
+static uint8_t* gen;
+
+static void pattern(uint32_t lba, uint8_t* p) {
+  uint32_t x = lba * 2654435761u ^ gen[lba] * 0x9E3779B9u;
+  for (int i = 0; i < 512; i += 4) {
+    x = x * 1664525u + 1013904223u;
+    memcpy(p + i, &x, 4);
+  }
+}
+
+static int check(uint32_t lba, unsigned int count, const uint8_t* buf, const char* what) {
+  uint8_t want[512];
+  for (unsigned int i = 0; i < count; i++) {
+    pattern(lba + i, want);
+    if (memcmp(buf + 512 * i, want, 512)) {
+      printf("FAIL: %s: sector %u is not what was written to it\n", what, lba + i);
+      failures++;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void fill(uint32_t lba, unsigned int count, uint8_t* buf) {
+  for (unsigned int i = 0; i < count; i++) {
+    pattern(lba + i, buf + 512 * i);
+  }
+}
+
+/* Passes. */
+
+static int img_fd;
+
+static void drop_cache(void) {
+  fdatasync(img_fd);
+  posix_fadvise(img_fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+struct pass {
+  double ms;
+  uint64_t reads, writes, bytes;
+};
+
+static uint64_t load(const uint64_t* v) {
+  return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+static void pass_begin(struct pass* p) {
+  drop_cache();
+  __atomic_store_n(&model_on, 1, __ATOMIC_RELAXED);
+  p->reads = load(&n_reads);
+  p->writes = load(&n_writes);
+  p->bytes = load(&read_bytes) + load(&write_bytes);
+  p->ms = now_ms();
+}
+
+// A read-ahead still going at the end is counted in the next pass.
+static void pass_end(struct pass* p) {
+  p->ms = now_ms() - p->ms;
+  __atomic_store_n(&model_on, 0, __ATOMIC_RELAXED);
+  p->reads = load(&n_reads) - p->reads;
+  p->writes = load(&n_writes) - p->writes;
+  p->bytes = load(&read_bytes) + load(&write_bytes) - p->bytes;
+}
+
+static void sequential(uint32_t sectors, unsigned int count, unsigned int block, int write,
+                       uint8_t* buf, struct pass* p) {
+  const char* what = write ? "sequential write" : "sequential read";
+  pass_begin(p);
+  for (uint32_t lba = 0; lba < sectors; lba += count) {
+    unsigned int n = sectors - lba < count ? sectors - lba : count;
+    if (write) {
+      for (unsigned int i = 0; i < n; i++) {
+        gen[lba + i]++;
+      }
+      fill(lba, n, buf);
+    }
+    if (transfer(lba, n, block, buf, write) < 0) {
+      printf("FAIL: %s at sector %u reported an error\n", what, lba);
+      failures++;
+      break;
+    }
+    if (!write && check(lba, n, buf, what) < 0) {
+      break;
+    }
+  }
+  if (write && simple_command(CMD_FLUSH_CACHE, 0) < 0 && ide_read8(ctl, ide_error_r) != 4) {
+    printf("FAIL: FLUSH CACHE reported an error\n");
+    failures++;
+  }
+  pass_end(p);
+}
+
+static void mixed(uint32_t sectors, unsigned int block, uint8_t* buf) {
+  srand(1);
+  for (int op = 0; op < MIXED_OPS; op++) {
+    unsigned int n = 1 + (unsigned int)rand() % 256;
+    uint32_t lba = (uint32_t)rand() % (sectors - n);
+    int write = rand() % 3 == 0;
+    if (rand() % 4 == 0 && op > 0) {
+      // Sequential runs, for the read-ahead.
+      lba = (lba / 64) * 64;
+    }
+    if (write) {
+      for (unsigned int i = 0; i < n; i++) {
+        gen[lba + i]++;
+      }
+      fill(lba, n, buf);
+    }
+    if (transfer(lba, n, write ? block : 1, buf, write) < 0) {
+      printf("FAIL: mixed %s of %u at %u reported an error\n", write ? "write" : "read", n, lba);
+      failures++;
+      return;
+    }
+    if (!write && check(lba, n, buf, "mixed read") < 0) {
+      return;
+    }
+    if (!write && lba + 2 * n < sectors && rand() % 2) {
+      // And the next ones, read as they were read ahead.
+      if (transfer(lba + n, n, block, buf, 0) < 0 || check(lba + n, n, buf, "mixed read") < 0) {
+        printf("FAIL: mixed read on from %u\n", lba + n);
+        failures++;
+        return;
+      }
+    }
+  }
+}
+
+static void report(const char* mode, const char* what, uint32_t sectors, const struct pass* p) {
+  double mb = (double)sectors * 512 / (1024 * 1024);
+  printf("%-8s %-6s %9.1f %9.2f %8llu %8llu %10.1f\n", mode, what, p->ms, mb / (p->ms / 1e3),
+         (unsigned long long)p->reads, (unsigned long long)p->writes,
+         p->reads + p->writes ? (double)p->bytes / (double)(p->reads + p->writes) / 1024 : 0.0);
+}
+
+static void usage(const char* name) {
+  fprintf(stderr, "Usage: %s [-m op-us,MB/s] [-w ns] [-c count] [size-MB] [dir]\n", name);
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  unsigned int count = 128;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:w:c:")) != -1) {
+    switch (opt) {
+    case 'm': {
+      double op_us, mbps;
+      if (sscanf(optarg, "%lf,%lf", &op_us, &mbps) != 2 || op_us < 0 || mbps <= 0) {
+        usage(argv[0]);
+      }
+      model_op_ns = (uint64_t)(op_us * 1000);
+      model_ns_per_kb = (uint64_t)(1024 * 1e3 / mbps);
+      break;
+    }
+    case 'w':
+      word_ns = strtoull(optarg, NULL, 0);
+      break;
+    case 'c':
+      count = (unsigned int)atoi(optarg);
+      if (count < 1 || count > 256) {
+        usage(argv[0]);
+      }
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  uint32_t size_mb = optind < argc ? (uint32_t)atoi(argv[optind]) : 16;
+  const char* dir = optind + 1 < argc ? argv[optind + 1] : "/tmp";
+
+  char path[512];
+  snprintf(path, sizeof(path), "%s/ide_bench.%d.img", dir, (int)getpid());
+  int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd == -1) {
+    perror(path);
+    return 1;
+  }
+  if (ide_make_drive(ACME_ACCELLERATTI, fd) < 0) {
+    perror(path);
+    unlink(path);
+    return 1;
+  }
+  uint32_t total = 1024 * 16 * 16;
+  uint32_t sectors = size_mb * 2048;
+  if (sectors == 0 || sectors > total) {
+    sectors = total;
+  }
+  gen = calloc(total, 1);
+  uint8_t* buf = malloc(512 * 256);
+  for (uint32_t lba = 0; lba < total; lba += 256) {
+    fill(lba, 256, buf);
+    if (__real_pwrite64(fd, buf, 512 * 256, (off_t)(lba + HEADER_SECTORS) * 512) != 512 * 256) {
+      perror(path);
+      unlink(path);
+      return 1;
+    }
+  }
+  lseek(fd, 0, SEEK_SET);
+  img_fd = fd;
+
+  ctl = ide_allocate("bench");
+  if (ide_attach(ctl, 0, fd) < 0) {
+    fprintf(stderr, "%s: cannot attach\n", path);
+    unlink(path);
+    return 1;
+  }
+  ide_reset_begin(ctl);
+
+  unsigned int max_multiple = identify_multiple(), multiple = 0;
+
+  const char* env = getenv("PISTORM_IDE_ASYNC");
+  printf("ide_bench: %u MB, %u sectors per command, I/O %s", size_mb, count,
+         env && !strcmp(env, "0") ? "on the caller's thread" : "as ide.c does it");
+  if (model_op_ns || model_ns_per_kb) {
+    printf(", storage model %.0fus per op + %.1fMB/s", (double)model_op_ns / 1000,
+           1024 * 1e3 / (double)model_ns_per_kb);
+  }
+  if (word_ns) {
+    printf(", %lluns per data word", (unsigned long long)word_ns);
+  }
+  printf("\nREAD MULTIPLE: %s\n\n", max_multiple ? "yes" : "no");
+  printf("%-8s %-6s %9s %9s %8s %8s %10s\n", "mode", "pass", "ms", "MB/s", "reads", "writes",
+         "KB per op");
+
+  struct pass p;
+  int modes = max_multiple ? 2 : 1;
+  for (int m = 0; m < modes; m++) {
+    unsigned int block = 1;
+    const char* mode = "sectors";
+    if (m == 1) {
+      // A power of two, as big as the drive and the commands allow.
+      while (block * 2 <= max_multiple && block * 2 <= count) {
+        block *= 2;
+      }
+      if (simple_command(CMD_SET_MULTIPLE, block) < 0) {
+        printf("FAIL: SET MULTIPLE %u reported an error\n", block);
+        failures++;
+        break;
+      }
+      multiple = block;
+      mode = "multiple";
+    }
+    sequential(sectors, count, block, 0, buf, &p);
+    report(mode, "read", sectors, &p);
+    sequential(sectors, count, block, 1, buf, &p);
+    report(mode, "write", sectors, &p);
+    sequential(sectors, count, block, 0, buf, &p);
+    report(mode, "reread", sectors, &p);
+  }
+
+  mixed(total, multiple ? multiple : 1, buf);
+
+  // A read that runs past the end of the drive fails, and the next works.
+  if (transfer(total - 4, 8, 1, buf, 0) == 0) {
+    printf("FAIL: a read past the end of the drive did not report an error\n");
+    failures++;
+  }
+  if (transfer(total - 4, 4, 1, buf, 0) < 0 || check(total - 4, 4, buf, "last sectors") < 0) {
+    printf("FAIL: the last sectors cannot be read after a failed read\n");
+    failures++;
+  }
+
+  ide_free(ctl);
+  unlink(path);
+  free(buf);
+  free(gen);
+  if (failures) {
+    return 1;
+  }
+  printf("\nEvery sector read held what was last written to it.\n");
+  return 0;
+}
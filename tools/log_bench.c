@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: MIT
+// tools/log_bench.c
+//
+// Measures the caller-side cost of one log call: the synchronous
+// log_message() path versus the deferred LOG_EVENT() path.
+//
+// Output goes to /dev/null (or --log <file> as well), so the numbers are a
+// lower bound for the synchronous path; a real console is far slower.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/log.h"
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char* argv[]) {
+  unsigned int iters = 200000;
+  unsigned int burst = 256; // events per burst, then let the writer catch up
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--iters") == 0 && i + 1 < argc) {
+      iters = (unsigned int)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--burst") == 0 && i + 1 < argc) {
+      burst = (unsigned int)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+      if (log_set_file(argv[++i]) != 0) {
+        fprintf(stderr, "Failed to open log file %s.\n", argv[i]);
+        return 1;
+      }
+    } else {
+      fprintf(stderr, "Usage: %s [--iters N] [--burst N] [--log file]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (!burst) {
+    burst = 1;
+  }
+
+  if (!freopen("/dev/null", "w", stdout)) {
+    fprintf(stderr, "Cannot redirect stdout.\n");
+    return 1;
+  }
+  log_set_level(LOG_LEVEL_DEBUG);
+
+  uint32_t addr = 0x00bfe001;
+  uint64_t t0 = now_ns();
+  for (unsigned int i = 0; i < iters; i++) {
+    LOG_INFO("[FC] fc=%u addr=%08x\n", i & 7, addr + i);
+  }
+  uint64_t sync_ns = now_ns() - t0;
+
+  log_async_start();
+  uint64_t async_ns = 0;
+  for (unsigned int done = 0; done < iters;) {
+    unsigned int n = iters - done < burst ? iters - done : burst;
+    t0 = now_ns();
+    for (unsigned int i = 0; i < n; i++) {
+      LOG_FAST_INFO("[FC] fc=%u addr=%08x\n", (done + i) & 7, addr + done + i);
+    }
+    async_ns += now_ns() - t0;
+    done += n;
+    usleep(2000);
+  }
+  log_async_stop();
+
+  fprintf(stderr, "log_message():    %8.1f ns/call (%u calls)\n", (double)sync_ns / iters, iters);
+  fprintf(stderr, "LOG_EVENT():      %8.1f ns/call (%u calls, bursts of %u)\n",
+          (double)async_ns / iters, iters, burst);
+  fprintf(stderr, "dropped events:   %llu\n", (unsigned long long)log_async_dropped());
+  return 0;
+}
@@ -0,0 +1,391 @@
+// SPDX-License-Identifier: MIT
+// tools/piscsi_async_bench.c
+//
+// Drives piscsi.c through handle_piscsi_write()/handle_piscsi_read() the way
+// pi-scsi.device does and compares synchronous PiSCSI I/O with the background
+// workers of piscsi-async.c on file-backed hard-file images. Each workload runs
+// for a fixed time with every unit count and queue depth, starting with a cold
+// page cache, and reports requests per second, throughput and the time the 68k
+// spends inside the PiSCSI registers (the stall the emulated CPU sees).
+//
+//   seq-read     64KB reads walking through the image
+//   rand-read    4KB reads at random 512-byte aligned offsets
+//   rand-write   4KB writes at random offsets
+//   mixed        4KB, 30% writes, all inside the first 1MB so requests overlap
+//
+// Every read is checked against what the image held when it was issued and
+// every image is compared with the expected contents after each run, so
+// reordered overlapping requests show up as errors. A read into chip RAM is
+// checked to fall back to synchronous I/O. Any mismatch makes the exit code 1.
+//
+// On a single-core host the workers compete with the issuing thread; the
+// numbers only mean something on the Pi, with the images on its own storage.
+//
+// Usage: piscsi_async_bench [seconds] [image-MB] [dir]
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_file/config_file.h"
+#include "piscsi_stubs.h"
+#include "platforms/amiga/amiga-interrupts.h"
+#include "platforms/amiga/piscsi/piscsi-async.h"
+#include "platforms/amiga/piscsi/piscsi-cache.h"
+#include "platforms/amiga/piscsi/piscsi-enums.h"
+#include "platforms/amiga/piscsi/piscsi.h"
+
+#define MAX_UNITS 4
+#define MAX_QD PISCSI_ASYNC_SLOTS
+#define MAX_LEN (64u * 1024u)
+#define FAST_BASE 0x40000000u
+#define FAST_SIZE (MAX_QD * MAX_LEN)
+#define CHIP_BASE 0x00010000u
+
+// Fast RAM is Pi memory the workers can reach; chip RAM is on the bus.
+static uint8_t* fast_ram;
+static uint8_t* const chip_ram = &piscsi_stub_bus[CHIP_BASE];
+
+// PORTS as the CPU loop sees it: raised by the workers, cleared by the
+// interrupt server below.
+static pthread_mutex_t irq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t irq_cond = PTHREAD_COND_INITIALIZER;
+static int irq_pending;
+
+void amiga_emulate_irq(AMIGA_IRQ irq) {
+  (void)irq;
+  pthread_mutex_lock(&irq_lock);
+  irq_pending = 1;
+  pthread_cond_signal(&irq_cond);
+  pthread_mutex_unlock(&irq_lock);
+}
+
+int amiga_emulating_irq(AMIGA_IRQ irq) {
+  (void)irq;
+  return __atomic_load_n(&irq_pending, __ATOMIC_ACQUIRE);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t rng = 1;
+static uint32_t rnd(uint32_t n) {
+  rng = rng * 1664525u + 1013904223u;
+  return (rng >> 8) % n;
+}
+
+static unsigned int image_size;
+static char image_path[MAX_UNITS][256];
+static uint8_t* shadow[MAX_UNITS]; // what each image should hold
+static unsigned int failures;
+
+// One IORequest of the simulated driver.
+struct request {
+  uint8_t busy;
+  uint8_t write;
+  uint8_t unit;
+  uint32_t offset;
+  uint32_t len;
+  uint8_t expect[MAX_LEN];
+};
+static struct request reqs[MAX_QD];
+static unsigned int outstanding;
+static uint64_t stall_ns, done_ops, done_bytes;
+
+static uint32_t reg_read(uint32_t cmd) {
+  return handle_piscsi_read(PISCSI_OFFSET + cmd, OP_TYPE_LONGWORD);
+}
+
+static void reg_write(uint32_t cmd, uint32_t value, uint8_t type) {
+  handle_piscsi_write(PISCSI_OFFSET + cmd, value, type);
+}
+
+static void complete(unsigned int i, uint32_t error) {
+  struct request* r = &reqs[i];
+  if (error) {
+    fprintf(stderr, "Unit %u: %s at %u failed with %u.\n", r->unit, r->write ? "write" : "read",
+            r->offset, error);
+    failures++;
+  } else if (!r->write && memcmp(&fast_ram[i * MAX_LEN], r->expect, r->len) != 0) {
+    fprintf(stderr, "Unit %u: read at %u returned the wrong data.\n", r->unit, r->offset);
+    failures++;
+  }
+  r->busy = 0;
+  outstanding--;
+  done_ops++;
+  done_bytes += r->len;
+}
+
+// begin_io() for CMD_READ/CMD_WRITE, as in piscsi-amiga-2.c.
+static void issue(unsigned int i, uint8_t unit, uint8_t write, uint32_t offset, uint32_t len,
+                  int async) {
+  struct request* r = &reqs[i];
+  uint8_t* buf = &fast_ram[i * MAX_LEN];
+  r->busy = 1;
+  r->write = write;
+  r->unit = unit;
+  r->offset = offset;
+  r->len = len;
+  if (write) {
+    for (uint32_t j = 0; j < len; j += 4) {
+      uint32_t v = rng = rng * 1664525u + 1013904223u;
+      memcpy(&buf[j], &v, 4);
+    }
+    memcpy(&shadow[unit][offset], buf, len);
+  } else {
+    memcpy(r->expect, &shadow[unit][offset], len);
+    memset(buf, 0xA5, len);
+  }
+  outstanding++;
+
+  uint64_t t0 = now_ns();
+  reg_write(PISCSI_CMD_ADDR1, offset, OP_TYPE_LONGWORD);
+  reg_write(PISCSI_CMD_ADDR2, len, OP_TYPE_LONGWORD);
+  reg_write(PISCSI_CMD_ADDR3, FAST_BASE + i * MAX_LEN, OP_TYPE_LONGWORD);
+  uint32_t queued = 0, error;
+  if (async) {
+    reg_write(PISCSI_CMD_TAG, i + 1, OP_TYPE_LONGWORD);
+  }
+  reg_write(write ? PISCSI_CMD_WRITEBYTES : PISCSI_CMD_READBYTES,
+            unit | (async ? PISCSI_ASYNC_FLAG : 0), OP_TYPE_WORD);
+  if (async) {
+    queued = reg_read(PISCSI_CMD_TAG);
+  }
+  error = queued ? 0 : reg_read(PISCSI_CMD_DONE_ERR);
+  stall_ns += now_ns() - t0;
+
+  if (!queued) {
+    complete(i, error);
+  }
+}
+
+// The driver's PORTS interrupt server plus the CPU loop's piscsi_async_poll().
+static void serve_irq(void) {
+  pthread_mutex_lock(&irq_lock);
+  while (!irq_pending) {
+    pthread_cond_wait(&irq_cond, &irq_lock);
+  }
+  irq_pending = 0;
+  pthread_mutex_unlock(&irq_lock);
+
+  uint32_t tags[MAX_QD], errors[MAX_QD], tag;
+  unsigned int n = 0;
+  uint64_t t0 = now_ns();
+  while (n < MAX_QD && (tag = reg_read(PISCSI_CMD_DONE)) != 0) {
+    errors[n] = reg_read(PISCSI_CMD_DONE_ERR);
+    tags[n++] = tag;
+  }
+  piscsi_async_poll();
+  stall_ns += now_ns() - t0;
+
+  // Checking the data is the bench's business, not the driver's.
+  for (unsigned int i = 0; i < n; i++) {
+    if (tags[i] > MAX_QD || !reqs[tags[i] - 1].busy) {
+      fprintf(stderr, "Unexpected completion tag %u.\n", tags[i]);
+      failures++;
+      continue;
+    }
+    complete(tags[i] - 1, errors[i]);
+  }
+}
+
+static void drop_cache(unsigned int units) {
+  for (unsigned int u = 0; u < units; u++) {
+    int fd = open(image_path[u], O_RDONLY);
+    if (fd != -1) {
+      fdatasync(fd);
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+    }
+  }
+}
+
+static void check_images(unsigned int units) {
+  // With PISTORM_PISCSI_CACHE_MB set, write-back data is still in the cache.
+  piscsi_cache_flush(0xFF);
+  uint8_t* buf = malloc(image_size);
+  for (unsigned int u = 0; u < units; u++) {
+    int fd = open(image_path[u], O_RDONLY);
+    if (fd == -1 || pread(fd, buf, image_size, 0) != (ssize_t)image_size ||
+        memcmp(buf, shadow[u], image_size) != 0) {
+      fprintf(stderr, "Unit %u: image contents differ from what was written.\n", u);
+      failures++;
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+  free(buf);
+}
+
+enum { WL_SEQ_READ, WL_RAND_READ, WL_RAND_WRITE, WL_MIXED, WL_NUM };
+static const char* wl_names[WL_NUM] = {"seq-read", "rand-read", "rand-write", "mixed"};
+
+static void run(int workload, unsigned int units, unsigned int qd, double seconds) {
+  int async = qd > 0;
+  piscsi_async_start(async ? PISCSI_ASYNC_DEFAULT_THREADS : 0);
+  if (async && !piscsi_async_depth()) {
+    fprintf(stderr, "Could not start the I/O workers.\n");
+    exit(1);
+  }
+  if (!qd) {
+    qd = 1;
+  }
+  struct piscsi_async_stats before;
+  piscsi_async_get_stats(&before);
+  drop_cache(units);
+
+  uint32_t len = workload == WL_SEQ_READ ? MAX_LEN : 4096;
+  uint32_t region = workload == WL_MIXED ? 1024 * 1024 : image_size;
+  uint32_t seq_pos[MAX_UNITS] = {0};
+  unsigned int next_unit = 0;
+  stall_ns = done_ops = done_bytes = 0;
+  rng = 12345 + (uint32_t)workload;
+
+  uint64_t start = now_ns(), end = start + (uint64_t)(seconds * 1e9);
+  while (now_ns() < end) {
+    for (unsigned int i = 0; i < qd && outstanding < qd; i++) {
+      if (reqs[i].busy) {
+        continue;
+      }
+      uint8_t unit = (uint8_t)next_unit;
+      next_unit = (next_unit + 1) % units;
+      uint32_t offset;
+      if (workload == WL_SEQ_READ) {
+        offset = seq_pos[unit];
+        seq_pos[unit] = (offset + len) % image_size;
+      } else {
+        offset = rnd((region - len) / 512 + 1) * 512;
+      }
+      uint8_t write = workload == WL_RAND_WRITE || (workload == WL_MIXED && rnd(10) < 3);
+      issue(i, unit, write, offset, len, async);
+    }
+    if (outstanding) {
+      serve_irq();
+    }
+  }
+  while (outstanding) {
+    serve_irq();
+  }
+  double elapsed = (double)(now_ns() - start) / 1e9;
+
+  struct piscsi_async_stats after;
+  piscsi_async_get_stats(&after);
+  piscsi_async_start(0);
+  check_images(units);
+
+  char mode[16];
+  snprintf(mode, sizeof(mode), async ? "async %2u" : "sync", qd);
+  printf("%-10s %5u  %-8s %9.0f %9.1f %9.1f %7.1f%% %8llu\n", wl_names[workload], units, mode,
+         (double)done_ops / elapsed, (double)done_bytes / elapsed / 1e6,
+         done_ops ? (double)stall_ns / 1e3 / (double)done_ops : 0.0,
+         100.0 * (double)stall_ns / 1e9 / elapsed,
+         (unsigned long long)(after.ordered - before.ordered));
+  fflush(stdout);
+}
+
+// A chip RAM buffer cannot be reached by the workers: the request has to be
+// done on the spot and report that through PISCSI_CMD_TAG.
+static void check_chip_fallback(void) {
+  piscsi_async_start(PISCSI_ASYNC_DEFAULT_THREADS);
+  reg_write(PISCSI_CMD_ADDR1, 4096, OP_TYPE_LONGWORD);
+  reg_write(PISCSI_CMD_ADDR2, 4096, OP_TYPE_LONGWORD);
+  reg_write(PISCSI_CMD_ADDR3, CHIP_BASE, OP_TYPE_LONGWORD);
+  reg_write(PISCSI_CMD_TAG, 1, OP_TYPE_LONGWORD);
+  reg_write(PISCSI_CMD_READBYTES, 0 | PISCSI_ASYNC_FLAG, OP_TYPE_WORD);
+  uint32_t queued = reg_read(PISCSI_CMD_TAG), error = reg_read(PISCSI_CMD_DONE_ERR);
+  if (queued || error || memcmp(chip_ram, &shadow[0][4096], 4096) != 0 ||
+      reg_read(PISCSI_CMD_DONE) != 0) {
+    fprintf(stderr, "Chip RAM read was not done synchronously (queued %u, error %u).\n", queued,
+            error);
+    failures++;
+  }
+  piscsi_async_start(0);
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+  unsigned int mb = argc > 2 ? (unsigned int)atoi(argv[2]) : 64;
+  const char* dir = argc > 3 ? argv[3] : "/tmp";
+  if (seconds <= 0 || mb < 2 || mb > 2048) {
+    fprintf(stderr, "Usage: %s [seconds] [image-MB] [dir]\n", argv[0]);
+    return 1;
+  }
+  image_size = mb * 1024u * 1024u;
+  unsetenv("PISTORM_PISCSI_ASYNC");
+  // The scratch images are new every run.
+  setenv("PISTORM_PISCSI_META_CACHE", "off", 1);
+  fast_ram = piscsi_stub_map(FAST_BASE, FAST_SIZE);
+
+  // piscsi_init() and piscsi_map_drive() are chatty; keep the table readable.
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  int devnull = open("/dev/null", O_WRONLY);
+  dup2(devnull, STDOUT_FILENO);
+  piscsi_init();
+  for (unsigned int u = 0; u < MAX_UNITS; u++) {
+    snprintf(image_path[u], sizeof(image_path[u]), "%s/piscsi-bench-%u.hdf", dir, u);
+    shadow[u] = malloc(image_size);
+    if (!shadow[u]) {
+      fprintf(stderr, "Out of memory.\n");
+      return 1;
+    }
+    rng = 777 + u;
+    for (uint32_t j = 0; j < image_size; j += 4) {
+      uint32_t v = rng = rng * 1664525u + 1013904223u;
+      memcpy(&shadow[u][j], &v, 4);
+    }
+    int fd = open(image_path[u], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || write(fd, shadow[u], image_size) != (ssize_t)image_size) {
+      fprintf(stderr, "Could not create %s.\n", image_path[u]);
+      return 1;
+    }
+    close(fd);
+    piscsi_map_drive(image_path[u], (uint8_t)u);
+  }
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(devnull);
+  close(saved_stdout);
+
+  check_chip_fallback();
+
+  printf("%u MB images in %s, %.1f s per run, %u workers\n\n", mb, dir, seconds,
+         PISCSI_ASYNC_DEFAULT_THREADS);
+  printf("%-10s %5s  %-8s %9s %9s %9s %8s %8s\n", "workload", "units", "mode", "IOPS", "MB/s",
+         "stall-us", "stall", "ordered");
+  static const unsigned int depths[] = {0, 1, 4, 16, 32};
+  static const unsigned int unit_counts[] = {1, MAX_UNITS};
+  for (int w = 0; w < WL_NUM; w++) {
+    for (unsigned int u = 0; u < sizeof(unit_counts) / sizeof(unit_counts[0]); u++) {
+      for (unsigned int d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+        run(w, unit_counts[u], depths[d], seconds);
+      }
+    }
+  }
+
+  fflush(stdout);
+  dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+  piscsi_shutdown();
+  for (unsigned int u = 0; u < MAX_UNITS; u++) {
+    unlink(image_path[u]);
+    free(shadow[u]);
+  }
+
+  if (failures) {
+    fprintf(stderr, "%u errors.\n", failures);
+    return 1;
+  }
+  fprintf(stderr, "All requests completed with the expected data.\n");
+  return 0;
+}
@@ -0,0 +1,245 @@
+// SPDX-License-Identifier: MIT
+// tools/piscsi_cache_bench.c
+//
+// Runs AmigaOS-like request patterns through piscsi-cache.c with the cache
+// off and with each write policy, on a hard-file image whose file operations
+// are slowed down to a simple storage model (a fixed cost per pread, pwrite
+// or pwritev plus a transfer rate, and ten times the fixed cost for
+// fdatasync), so the numbers reflect an SD card rather than the host's page
+// cache. For each run it reports requests per second, the cache hit rate,
+// how many file operations reached the image and how much data was written.
+//
+//   seq-read     8KB reads walking through the image
+//   hot-read     4KB reads, 90% inside the first 2MB (directories, bitmaps)
+//   small-write  512-byte writes, 90% to the first 64 sectors, CMD_UPDATE every 16
+//   mixed        70% hot 4KB reads, 30% writes of 512 bytes to 4KB,
+//                CMD_UPDATE every 32
+//
+// Every read is checked against a copy of what was written. At the end of a
+// run the image is compared with that copy twice: before the unit is
+// detached, which is what a power cut at that moment would leave ("at risk",
+// in KB), and after, which has to match (clean shutdown). Any mismatch makes
+// the exit code 1.
+//
+// Usage: piscsi_cache_bench [ops] [op-us] [MB/s] [dir]
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "piscsi_stubs.h"
+#include "platforms/amiga/piscsi/piscsi-cache.h"
+
+#define IMAGE_SIZE (32u * 1024u * 1024u)
+#define CACHE_MB 8
+#define MAX_LEN (64u * 1024u)
+
+/* The storage model: piscsi_stubs.c wraps the calls piscsi-cache.c makes. */
+
+// The image is set up and checked behind the model's back.
+ssize_t __real_pread(int fd, void* buf, size_t len, off_t offset);
+ssize_t __real_pwrite(int fd, const void* buf, size_t len, off_t offset);
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Workloads. */
+
+enum { SEQ_READ, HOT_READ, SMALL_WRITE, MIXED, NUM_WORKLOADS };
+static const char* workload_names[] = {"seq-read", "hot-read", "small-write", "mixed"};
+
+struct config {
+  const char* name;
+  unsigned int mb;
+  const char* policy;
+};
+
+static const struct config configs[] = {
+    {"off", 0, "through"},
+    {"through", CACHE_MB, "through"},
+    {"back", CACHE_MB, "back"},
+    {"update", CACHE_MB, "update"},
+};
+
+static uint8_t* ref;
+static uint8_t buf[MAX_LEN];
+static unsigned int failures;
+
+static uint32_t rng = 0x2468ACE1;
+static uint32_t rnd(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static uint32_t pick(uint32_t hot, uint32_t len) {
+  uint32_t range = rnd() % 10 ? hot : IMAGE_SIZE;
+  return (rnd() % ((range - len) / 512)) * 512;
+}
+
+static void do_read(int fd, uint32_t offset, uint32_t len) {
+  if (piscsi_cache_read(0, fd, buf, len, offset) != (ssize_t)len ||
+      memcmp(buf, ref + offset, len) != 0) {
+    if (failures++ < 10) {
+      fprintf(stderr, "Read of %u bytes at %u returned the wrong data.\n", len, offset);
+    }
+  }
+}
+
+static void do_write(int fd, uint32_t offset, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    ref[offset + i] = (uint8_t)rnd();
+  }
+  if (piscsi_cache_write(0, fd, ref + offset, len, offset) != (ssize_t)len) {
+    if (failures++ < 10) {
+      fprintf(stderr, "Write of %u bytes at %u failed.\n", len, offset);
+    }
+  }
+}
+
+// Bytes of the image that differ from what the Amiga wrote, by sector.
+static uint64_t image_differs(int fd) {
+  static uint8_t chunk[1024 * 1024];
+  uint64_t differ = 0;
+  for (uint32_t off = 0; off < IMAGE_SIZE; off += sizeof(chunk)) {
+    if (__real_pread(fd, chunk, sizeof(chunk), off) != (ssize_t)sizeof(chunk)) {
+      return IMAGE_SIZE;
+    }
+    for (uint32_t s = 0; s < sizeof(chunk); s += 512) {
+      differ += memcmp(chunk + s, ref + off + s, 512) ? 512 : 0;
+    }
+  }
+  return differ;
+}
+
+static void run(const char* path, int workload, const struct config* cfg, unsigned int ops) {
+  int fd = open(path, O_RDWR);
+  if (fd < 0 || __real_pread(fd, ref, IMAGE_SIZE, 0) != (ssize_t)IMAGE_SIZE) {
+    perror(path);
+    exit(1);
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  piscsi_cache_set_size(cfg->mb);
+  piscsi_cache_set_policy(cfg->policy);
+  piscsi_cache_attach(0, fd, IMAGE_SIZE);
+
+  struct piscsi_cache_stats s0, s1;
+  piscsi_cache_get_stats(&s0);
+  struct piscsi_stub_io io0 = piscsi_stub_io;
+  uint32_t seq = 0;
+  uint64_t t0 = now_ns();
+  for (unsigned int i = 0; i < ops; i++) {
+    switch (workload) {
+    case SEQ_READ:
+      do_read(fd, seq, 8192);
+      seq = (seq + 8192) % IMAGE_SIZE;
+      break;
+    case HOT_READ:
+      do_read(fd, pick(2u << 20, 4096), 4096);
+      break;
+    case SMALL_WRITE:
+      do_write(fd, pick(32u << 10, 512), 512);
+      if (i % 16 == 15) {
+        piscsi_cache_update(0);
+      }
+      break;
+    case MIXED: {
+      uint32_t len = rnd() % 3 ? 4096 : 512u << (rnd() % 4);
+      uint32_t off = pick(2u << 20, len);
+      if (rnd() % 10 < 3) {
+        do_write(fd, off, len);
+      } else {
+        do_read(fd, off, len);
+      }
+      if (i % 32 == 31) {
+        piscsi_cache_update(0);
+      }
+      break;
+    }
+    }
+  }
+  double secs = (double)(now_ns() - t0) / 1e9;
+  piscsi_cache_get_stats(&s1);
+  struct piscsi_stub_io* io = &piscsi_stub_io;
+  uint64_t ops_run = io->pread - io0.pread + io->pwrite - io0.pwrite + io->pwritev - io0.pwritev;
+  uint64_t syncs = io->sync - io0.sync, written = io->written - io0.written;
+
+  uint64_t at_risk = image_differs(fd);
+  piscsi_cache_detach(0);
+  uint64_t lost = image_differs(fd);
+  if (lost) {
+    fprintf(stderr, "%s/%s: %llu bytes of the image are wrong after a clean detach.\n",
+            workload_names[workload], cfg->name, (unsigned long long)lost);
+    failures++;
+  }
+  close(fd);
+
+  uint64_t hits = s1.hits - s0.hits, misses = s1.misses - s0.misses;
+  printf("%-12s %-8s %9.0f %7.1f%% %8llu %6llu %9.1f %8.1f\n", workload_names[workload],
+         cfg->name, ops / secs, hits + misses ? 100.0 * (double)hits / (double)(hits + misses) : 0.0,
+         (unsigned long long)ops_run, (unsigned long long)syncs, (double)written / 1024.0,
+         (double)at_risk / 1024.0);
+}
+
+int main(int argc, char** argv) {
+  unsigned int ops = argc > 1 ? (unsigned int)strtoul(argv[1], NULL, 0) : 4000;
+  uint64_t op_ns = 300000, ns_per_kb = 50000;
+  if (argc > 2) {
+    op_ns = strtoull(argv[2], NULL, 0) * 1000;
+  }
+  if (argc > 3) {
+    double mbps = strtod(argv[3], NULL);
+    ns_per_kb = mbps > 0 ? (uint64_t)(1e9 / (mbps * 1024.0)) : 0;
+  }
+  const char* dir = argc > 4 ? argv[4] : "/tmp";
+
+  char path[512];
+  snprintf(path, sizeof(path), "%s/piscsi_cache_bench.hdf", dir);
+  ref = malloc(IMAGE_SIZE);
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (!ref || fd < 0) {
+    perror(path);
+    return 1;
+  }
+  for (uint32_t i = 0; i < IMAGE_SIZE; i++) {
+    ref[i] = (uint8_t)rnd();
+  }
+  if (__real_pwrite(fd, ref, IMAGE_SIZE, 0) != (ssize_t)IMAGE_SIZE) {
+    perror(path);
+    return 1;
+  }
+  close(fd);
+
+  piscsi_stub_op_ns = op_ns;
+  piscsi_stub_ns_per_kb = ns_per_kb;
+  piscsi_cache_set_flush(1);
+  printf("%u requests per run, %lluus per file operation, %.1f MB/s, %uMB cache, 32MB image\n\n",
+         ops, (unsigned long long)(op_ns / 1000), ns_per_kb ? 1e9 / 1024.0 / (double)ns_per_kb : 0.0,
+         CACHE_MB);
+  printf("%-12s %-8s %9s %8s %8s %6s %9s %8s\n", "workload", "cache", "req/s", "hits", "file-ops",
+         "syncs", "writtenKB", "riskKB");
+  for (int w = 0; w < NUM_WORKLOADS; w++) {
+    for (unsigned int c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+      run(path, w, &configs[c], ops);
+    }
+  }
+  piscsi_cache_stop();
+  unlink(path);
+
+  if (failures) {
+    printf("\n%u failures\n", failures);
+    return 1;
+  }
+  printf("\nAll reads returned the written data and every image was intact after detach.\n");
+  return 0;
+}
@@ -0,0 +1,294 @@
+// SPDX-License-Identifier: MIT
+// tools/piscsi_chip_bench.c
+//
+// Times PiSCSI reads and writes whose buffer is in chip RAM, or anywhere else
+// the Pi has no mapping for, against a simulated Amiga bus. Each bus access
+// costs a fixed time per 16-bit word (default 564 ns, one 68000 bus cycle at
+// 7.09 MHz) plus a fixed time per request to the kernel module (default
+// 1000 ns); a batch of up to 256 longwords counts as one request. The bus
+// times are a model, not measurements; the file I/O is real.
+//
+//   old    the byte loop piscsi.c used before: one read()/write() of one byte
+//          and one byte-wide bus access per byte, reproduced here
+//   chip   the current code with the buffer in chip RAM (batched block moves)
+//   other  the current code with the buffer in unmapped memory outside chip
+//          and slow RAM, which goes through the CPU memory handlers a
+//          longword at a time
+//
+// Every transfer is checked against the image or the simulated memory,
+// including odd addresses and odd lengths. Exit code 0 means all matched.
+//
+// Usage: piscsi_chip_bench [ns-per-word] [ns-per-request] [KB-per-transfer]
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_file/config_file.h"
+#include "piscsi_stubs.h"
+#include "platforms/amiga/piscsi/piscsi-enums.h"
+#include "platforms/amiga/piscsi/piscsi.h"
+
+#define MEM_SIZE PISCSI_STUB_BUS_SIZE
+#define CHIP_ADDR 0x00010000u
+#define OTHER_ADDR 0x00200000u // Zorro II space, reached through the handlers
+#define IMAGE_SIZE (4u * 1024u * 1024u)
+
+/* The simulated bus, in place of the one in piscsi_stubs.c. */
+
+static uint8_t* const mem = piscsi_stub_bus;
+static uint64_t word_ns = 564, request_ns = 1000;
+static uint64_t bus_requests, bus_words;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void bus(uint32_t requests, uint32_t words) {
+  uint64_t end = now_ns() + requests * request_ns + words * word_ns;
+  bus_requests += requests;
+  bus_words += words;
+  while (now_ns() < end) {
+  }
+}
+
+unsigned int m68k_read_memory_8(unsigned int address) {
+  bus(1, 1);
+  return mem[address % MEM_SIZE];
+}
+
+unsigned int m68k_read_memory_16(unsigned int address) {
+  bus(1, 1);
+  return (unsigned int)mem[address % MEM_SIZE] << 8 | mem[(address + 1) % MEM_SIZE];
+}
+
+unsigned int m68k_read_memory_32(unsigned int address) {
+  bus(1, 2);
+  unsigned int v = 0;
+  for (unsigned int i = 0; i < 4; i++) {
+    v = v << 8 | mem[(address + i) % MEM_SIZE];
+  }
+  return v;
+}
+
+void m68k_write_memory_8(unsigned int address, unsigned int value) {
+  bus(1, 1);
+  mem[address % MEM_SIZE] = (uint8_t)value;
+}
+
+void m68k_write_memory_16(unsigned int address, unsigned int value) {
+  bus(1, 1);
+  mem[address % MEM_SIZE] = (uint8_t)(value >> 8);
+  mem[(address + 1) % MEM_SIZE] = (uint8_t)value;
+}
+
+void m68k_write_memory_32(unsigned int address, unsigned int value) {
+  bus(1, 2);
+  for (int i = 0; i < 4; i++) {
+    mem[(address + (unsigned int)i) % MEM_SIZE] = (uint8_t)(value >> (24 - 8 * i));
+  }
+}
+
+void ps_read_block(uint32_t address, uint8_t* dst, uint32_t len) {
+  bus((len / 4 + 255) / 256 + (len & 2 ? 1 : 0), len / 2);
+  memcpy(dst, &mem[address], len);
+}
+
+void ps_write_block(uint32_t address, const uint8_t* src, uint32_t len) {
+  bus((len / 4 + 255) / 256 + (len & 2 ? 1 : 0), len / 2);
+  memcpy(&mem[address], src, len);
+}
+
+/* PiSCSI as the driver sees it. */
+
+static char image_path[256];
+static uint8_t* image;
+static int image_fd;
+static unsigned int failures;
+
+static void reg_write(uint32_t cmd, uint32_t value, uint8_t type) {
+  handle_piscsi_write(PISCSI_OFFSET + cmd, value, type);
+}
+
+static void piscsi_io(int write, uint32_t offset, uint32_t len, uint32_t addr) {
+  reg_write(PISCSI_CMD_ADDR1, offset, OP_TYPE_LONGWORD);
+  reg_write(PISCSI_CMD_ADDR2, len, OP_TYPE_LONGWORD);
+  reg_write(PISCSI_CMD_ADDR3, addr, OP_TYPE_LONGWORD);
+  reg_write(write ? PISCSI_CMD_WRITEBYTES : PISCSI_CMD_READBYTES, 0, OP_TYPE_WORD);
+  if (handle_piscsi_read(PISCSI_OFFSET + PISCSI_CMD_DONE_ERR, OP_TYPE_LONGWORD) != 0) {
+    fprintf(stderr, "%s of %u bytes at %u into $%X reported an error.\n", write ? "Write" : "Read",
+            len, offset, addr);
+    failures++;
+  }
+}
+
+// The loop piscsi.c had before bulk transfers, for comparison.
+static void old_io(int is_write, uint32_t offset, uint32_t len, uint32_t addr) {
+  lseek(image_fd, (off_t)offset, SEEK_SET);
+  for (uint32_t i = 0; i < len; i++) {
+    uint8_t c = 0;
+    if (is_write) {
+      c = (uint8_t)m68k_read_memory_8(addr + i);
+      if (write(image_fd, &c, 1) != 1) {
+        failures++;
+        return;
+      }
+    } else {
+      if (read(image_fd, &c, 1) != 1) {
+        failures++;
+        return;
+      }
+      m68k_write_memory_8(addr + i, c);
+    }
+  }
+}
+
+static void check_read(const char* what, uint32_t offset, uint32_t len, uint32_t addr) {
+  if (memcmp(&mem[addr], &image[offset], len) != 0) {
+    fprintf(stderr, "%s: read of %u bytes at %u into $%X returned the wrong data.\n", what, len,
+            offset, addr);
+    failures++;
+  }
+}
+
+static void check_write(const char* what, uint32_t offset, uint32_t len) {
+  uint8_t* buf = malloc(len);
+  if (pread(image_fd, buf, len, (off_t)offset) != (ssize_t)len ||
+      memcmp(buf, &image[offset], len) != 0) {
+    fprintf(stderr, "%s: write of %u bytes at %u did not reach the image.\n", what, len, offset);
+    failures++;
+  }
+  free(buf);
+}
+
+static uint32_t rng = 0x13579BDF;
+static uint32_t rnd(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+// Alignment and length corner cases, each checked for both directions.
+static void check_edges(void) {
+  static const uint32_t lens[] = {1, 2, 3, 5, 511, 512, 513, 4096 + 6, 65536 + 3, 200000};
+  static const uint32_t addrs[] = {CHIP_ADDR, CHIP_ADDR + 1, CHIP_ADDR + 2, CHIP_ADDR + 3,
+                                   OTHER_ADDR, OTHER_ADDR + 1, OTHER_ADDR + 3};
+  for (unsigned int l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+    for (unsigned int a = 0; a < sizeof(addrs) / sizeof(addrs[0]); a++) {
+      uint32_t offset = rnd() % (IMAGE_SIZE - lens[l]);
+      memset(&mem[addrs[a] - 4], 0xEE, lens[l] + 8);
+      piscsi_io(0, offset, lens[l], addrs[a]);
+      check_read("edges", offset, lens[l], addrs[a]);
+      if (mem[addrs[a] - 1] != 0xEE || mem[addrs[a] + lens[l]] != 0xEE) {
+        fprintf(stderr, "edges: read of %u bytes into $%X touched its neighbours.\n", lens[l],
+                addrs[a]);
+        failures++;
+      }
+
+      for (uint32_t i = 0; i < lens[l]; i++) {
+        mem[addrs[a] + i] = (uint8_t)rnd();
+      }
+      offset = rnd() % (IMAGE_SIZE - lens[l]);
+      memcpy(&image[offset], &mem[addrs[a]], lens[l]);
+      piscsi_io(1, offset, lens[l], addrs[a]);
+      check_write("edges", offset, lens[l]);
+    }
+  }
+}
+
+static void bench(const char* what, int write, uint32_t len, uint32_t addr, int old) {
+  unsigned int count = 0;
+  uint64_t requests0 = bus_requests, words0 = bus_words;
+  uint64_t start = now_ns();
+  do {
+    uint32_t offset = (rnd() % (IMAGE_SIZE - len)) & ~511u;
+    if (write) {
+      memcpy(&image[offset], &mem[addr], len);
+    }
+    if (old) {
+      old_io(write, offset, len, addr);
+    } else {
+      piscsi_io(write, offset, len, addr);
+    }
+    if (write) {
+      check_write(what, offset, len);
+    } else {
+      check_read(what, offset, len, addr);
+    }
+    count++;
+  } while (now_ns() - start < 500000000ull);
+  double s = (double)(now_ns() - start) / 1e9;
+  printf("%-6s %-5s %10.0f %12.1f %12.1f\n", what, write ? "write" : "read",
+         (double)count * len / 1024.0 / s, (double)(bus_requests - requests0) / count,
+         (double)(bus_words - words0) / count);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    word_ns = strtoull(argv[1], NULL, 0);
+  }
+  if (argc > 2) {
+    request_ns = strtoull(argv[2], NULL, 0);
+  }
+  uint32_t len = (argc > 3 ? (uint32_t)atoi(argv[3]) : 32) * 1024u;
+  if (!len || len > 1024 * 1024) {
+    fprintf(stderr, "Usage: %s [ns-per-word] [ns-per-request] [KB-per-transfer]\n", argv[0]);
+    return 1;
+  }
+
+  image = malloc(IMAGE_SIZE);
+  for (uint32_t i = 0; i < IMAGE_SIZE; i++) {
+    image[i] = (uint8_t)rnd();
+  }
+  snprintf(image_path, sizeof(image_path), "/tmp/piscsi-chip-bench-%d.hdf", (int)getpid());
+  image_fd = open(image_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (image_fd == -1 || write(image_fd, image, IMAGE_SIZE) != IMAGE_SIZE) {
+    fprintf(stderr, "Could not create %s.\n", image_path);
+    return 1;
+  }
+
+  // The scratch image is new every run.
+  setenv("PISTORM_PISCSI_META_CACHE", "off", 1);
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  int devnull = open("/dev/null", O_WRONLY);
+  dup2(devnull, STDOUT_FILENO);
+  piscsi_init();
+  piscsi_map_drive(image_path, 0);
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+
+  check_edges();
+
+  printf("%u KB transfers, %llu ns per bus word, %llu ns per bus request\n\n", len / 1024,
+         (unsigned long long)word_ns, (unsigned long long)request_ns);
+  printf("%-6s %-5s %10s %12s %12s\n", "path", "dir", "KB/s", "requests", "bus words");
+  for (int write = 0; write < 2; write++) {
+    bench("old", write, len, CHIP_ADDR, 1);
+    bench("chip", write, len, CHIP_ADDR, 0);
+    bench("other", write, len, OTHER_ADDR, 0);
+  }
+
+  fflush(stdout);
+  dup2(devnull, STDOUT_FILENO);
+  piscsi_shutdown();
+  close(image_fd);
+  unlink(image_path);
+  free(image);
+
+  if (failures) {
+    fprintf(stderr, "%u errors.\n", failures);
+    return 1;
+  }
+  fprintf(stderr, "All transfers matched.\n");
+  return 0;
+}
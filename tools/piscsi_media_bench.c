@@ -0,0 +1,322 @@
+// SPDX-License-Identifier: MIT
+// tools/piscsi_media_bench.c
+//
+// Loads a three-disk program from removable PiSCSI units (piscsi-media.c),
+// the disks as plain ADFs, gzipped ADFs and .zhdf images, and compares the
+// time with a real floppy drive. For every disk it reports:
+//
+//  - swap: from writing "<unit> <disk>" to the control file until the disk
+//    is in, through the inotify watcher, piscsi_media_poll() and the insert
+//    (opening, unpacking or attaching the image);
+//  - load: reading LOAD_KB of the disk in 512-byte blocks, as OFS does,
+//    through the block cache layers, checked against what was written.
+//
+// Only the Pi side is measured: the Amiga's file system and the bus add to
+// both sides alike. The floppy figures are a model, not a measurement: one
+// revolution (200ms at 300rpm) per track of 5.5KB read, 3ms step and 15ms
+// settle per track change, and a disk change seen on trackdisk's 2s poll,
+// on average after 1s.
+//
+// Every swap is also checked to be signalled: the unit's change bit set and
+// PORTS raised. Any failure makes the exit code 1.
+//
+// Usage: piscsi_media_bench [dir]
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "platforms/amiga/amiga-interrupts.h"
+#include "platforms/amiga/piscsi/piscsi-cache.h"
+#include "platforms/amiga/piscsi/piscsi-media.h"
+#include "platforms/amiga/piscsi/piscsi-zhdf.h"
+#include "platforms/amiga/piscsi/piscsi.h"
+
+#define DISKS 3
+#define FORMATS 3
+#define DISK_SIZE PISCSI_MEDIA_DD_SIZE
+#define LOAD_KB 700
+#define TRACK (11 * 512)
+
+#define FLOPPY_REV_S 0.2
+#define FLOPPY_STEP_S 0.018
+#define FLOPPY_CHANGE_S 1.0
+
+static unsigned int irqs, failures;
+
+void amiga_emulate_irq(AMIGA_IRQ irq) {
+  irqs += irq == PORTS;
+}
+
+int amiga_emulating_irq(AMIGA_IRQ irq) {
+  (void)irq;
+  return 0;
+}
+
+/* What piscsi.c does for a removable unit, without the Amiga side. */
+
+static struct piscsi_dev devs[8];
+static unsigned int inserts;
+
+struct piscsi_dev* piscsi_get_dev(uint8_t index) {
+  return &devs[index];
+}
+
+void piscsi_make_removable(uint8_t index, uint64_t size) {
+  devs[index].removable = 1;
+  devs[index].fs = size;
+  devs[index].fd = -1;
+}
+
+static void close_image(uint8_t index) {
+  piscsi_cache_detach(index);
+  piscsi_zhdf_detach(index);
+  close(devs[index].fd);
+  devs[index].fd = -1;
+}
+
+int piscsi_insert_media(uint8_t index, const char* filename) {
+  uint64_t size = devs[index].fs;
+  int read_only;
+  int fd = piscsi_media_open(filename, &size, &read_only);
+  if (fd < 0) {
+    return -1;
+  }
+  if (devs[index].fd != -1) {
+    close_image(index);
+  }
+  if (piscsi_zhdf_attach(index, fd, &size) < 0) {
+    close(fd);
+    return -1;
+  }
+  piscsi_cache_attach(index, fd, size);
+  devs[index].fd = fd;
+  devs[index].read_only = (uint8_t)read_only;
+  piscsi_media_changed(index);
+  inserts++;
+  return 0;
+}
+
+int piscsi_eject_media(uint8_t index) {
+  if (devs[index].fd == -1) {
+    return -1;
+  }
+  close_image(index);
+  piscsi_media_changed(index);
+  inserts++;
+  return 0;
+}
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint32_t rng = 0x1234567;
+static uint32_t rnd(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static void fail(const char* what) {
+  if (failures++ < 10) {
+    fprintf(stderr, "%s\n", what);
+  }
+}
+
+// A disk as games and applications tend to fill them: packed data that
+// does not compress, code and text that does, and unused blocks.
+static void make_disk(uint8_t* d) {
+  for (uint32_t t = 0; t < DISK_SIZE / TRACK; t++) {
+    uint8_t* p = d + t * TRACK;
+    uint32_t kind = rnd() % 10;
+    for (uint32_t i = 0; i < TRACK; i++) {
+      p[i] = kind < 4 ? (uint8_t)rnd() : kind < 8 ? (uint8_t)("move.l d0,(a0)+\n"[rnd() % 16]) : 0;
+    }
+  }
+}
+
+static void write_file(const char* path, const uint8_t* d) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || write(fd, d, DISK_SIZE) != DISK_SIZE) {
+    perror(path);
+    exit(1);
+  }
+  close(fd);
+}
+
+static void write_adz(const char* path, const uint8_t* d) {
+  gzFile gz = gzopen(path, "wb9");
+  if (!gz || gzwrite(gz, d, DISK_SIZE) != DISK_SIZE) {
+    perror(path);
+    exit(1);
+  }
+  gzclose(gz);
+}
+
+static void write_zhdf(const char* path, const uint8_t* d) {
+    if (piscsi_zhdf_create(path, DISK_SIZE, 16384, 9) < 0) {
+    perror(path);
+    exit(1);
+  }
+  int fd = open(path, O_RDWR);
+  struct piscsi_zhdf* z = piscsi_zhdf_open(fd, 1, 1);
+  if (!z || piscsi_zhdf_pwrite(z, d, DISK_SIZE, 0) != DISK_SIZE) {
+    perror(path);
+    exit(1);
+  }
+  piscsi_zhdf_close(z);
+  close(fd);
+}
+
+static long file_size(const char* path) {
+  int fd = open(path, O_RDONLY);
+  long n = fd >= 0 ? (long)lseek(fd, 0, SEEK_END) : 0;
+  if (fd >= 0) {
+    close(fd);
+  }
+  return n;
+}
+
+static char ctl[512];
+
+static double swap(uint8_t unit, const char* cmd) {
+  unsigned int before = inserts, irqs_before = irqs;
+  double t0 = now_s();
+  int fd = open(ctl, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || write(fd, cmd, strlen(cmd)) != (ssize_t)strlen(cmd)) {
+    perror(ctl);
+    exit(1);
+  }
+  close(fd);
+  while (inserts == before) {
+    if (now_s() - t0 > 5) {
+      fail("A control command was not seen within 5s.");
+      return 0;
+    }
+    piscsi_media_poll();
+  }
+  double t = now_s() - t0;
+  if (!(piscsi_media_take_changes() & (1u << unit)) || irqs == irqs_before) {
+    fail("A disk change was not signalled.");
+  }
+  return t;
+}
+
+static double load(uint8_t unit, const uint8_t* want) {
+  static uint8_t block[512];
+  double t0 = now_s();
+  for (uint32_t pos = 0; pos < LOAD_KB * 1024; pos += 512) {
+    if (piscsi_cache_read(unit, devs[unit].fd, block, 512, pos) != 512 ||
+        memcmp(block, want + pos, 512) != 0) {
+      fail("A read returned the wrong data.");
+      break;
+    }
+  }
+  return now_s() - t0;
+}
+
+int main(int argc, char** argv) {
+  const char* dir = argc > 1 ? argv[1] : "/tmp";
+  static const char* formats[FORMATS] = {"adf", "adz", "zhdf"};
+  static uint8_t data[DISKS][DISK_SIZE];
+  char path[FORMATS][DISKS][512];
+  long stored[FORMATS] = {0};
+
+  for (int i = 0; i < 8; i++) {
+    devs[i].fd = -1;
+  }
+  for (int n = 0; n < DISKS; n++) {
+    make_disk(data[n]);
+    for (int f = 0; f < FORMATS; f++) {
+      snprintf(path[f][n], sizeof(path[f][n]), "%s/piscsi_media_bench_%d.%s", dir, n + 1,
+               formats[f]);
+    }
+    write_file(path[0][n], data[n]);
+    write_adz(path[1][n], data[n]);
+    write_zhdf(path[2][n], data[n]);
+    for (int f = 0; f < FORMATS; f++) {
+      stored[f] += file_size(path[f][n]);
+    }
+  }
+  snprintf(ctl, sizeof(ctl), "%s/piscsi_media_bench.ctl", dir);
+  unlink(ctl);
+
+  // Unit f holds the disks in format f.
+  for (uint8_t f = 0; f < FORMATS; f++) {
+    for (int n = 0; n < DISKS; n++) {
+      piscsi_media_add(f, path[f][n]);
+    }
+  }
+  piscsi_media_set_ctl(ctl);
+  piscsi_media_start();
+  piscsi_media_listen(1);
+  piscsi_media_take_changes();
+  if (!devs[1].read_only || devs[0].read_only || devs[2].read_only) {
+    fail("Only the gzipped disk should be write protected.");
+  }
+  usleep(100000); // the watcher is up
+
+  printf("%d-disk program, %dKB loaded per disk in 512-byte reads\n\n", DISKS, LOAD_KB);
+  printf("%-8s %8s %10s %10s %10s %10s\n", "format", "KB", "swap ms", "load ms", "total ms",
+         "MB/s");
+  double total[FORMATS] = {0};
+  for (uint8_t f = 0; f < FORMATS; f++) {
+    double t_swap = 0, t_load = 0;
+    for (int n = 0; n < DISKS; n++) {
+      char cmd[32];
+      snprintf(cmd, sizeof(cmd), "%u %d\n", f, n + 1);
+      t_swap += swap(f, cmd);
+      t_load += load(f, data[n]);
+    }
+    total[f] = t_swap + t_load;
+    printf("%-8s %8ld %10.2f %10.2f %10.2f %10.1f\n", formats[f], stored[f] / 1024,
+           t_swap * 1000, t_load * 1000, total[f] * 1000,
+           (double)DISKS * LOAD_KB / 1024 / t_load);
+  }
+
+  // next, prev and eject through the same path.
+  double t_next = swap(0, "0 next\n");
+  load(0, data[0]);
+  swap(0, "0 prev\n");
+  load(0, data[DISKS - 1]);
+  swap(0, "0 eject\n");
+  if (devs[0].fd != -1) {
+    fail("The disk was not ejected.");
+  }
+
+  double tracks = (double)LOAD_KB * 1024 / TRACK;
+  double floppy = DISKS * (FLOPPY_CHANGE_S + tracks * (FLOPPY_REV_S + FLOPPY_STEP_S));
+  printf("\nfloppy (model) %.1fs: %.1fs to see each change, %.0f tracks at %.0fms each\n", floppy,
+         FLOPPY_CHANGE_S, tracks, (FLOPPY_REV_S + FLOPPY_STEP_S) * 1000);
+  for (int f = 0; f < FORMATS; f++) {
+    printf("%-8s %.0fx faster\n", formats[f], floppy / total[f]);
+  }
+  printf("next: %.2fms\n", t_next * 1000);
+
+  piscsi_media_stop();
+  piscsi_cache_stop();
+  piscsi_zhdf_stop();
+  for (int f = 0; f < FORMATS; f++) {
+    for (int n = 0; n < DISKS; n++) {
+      unlink(path[f][n]);
+    }
+  }
+  unlink(ctl);
+  if (failures) {
+    printf("%u failures\n", failures);
+    return 1;
+  }
+  printf("Every swap was seen and signalled, and every read returned the expected data.\n");
+  return 0;
+}
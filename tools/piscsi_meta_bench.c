@@ -0,0 +1,467 @@
+// SPDX-License-Identifier: MIT
+// tools/piscsi_meta_bench.c
+//
+// Time to ready of seven PiSCSI units with and without the metadata cache
+// (piscsi-meta.c): piscsi_init(), piscsi_map_drive() for each unit and the
+// first piscsi_refresh_drives(), as the emulator starts, and an Amiga reset
+// after that. Each image has an RDB, two partitions and a file system of its
+// own in LSEG blocks, a made-up hunk file of FS_KB, as HDToolBox leaves a
+// hard file. Each start begins with the images' page cache dropped:
+//
+//   off      PISTORM_PISCSI_META_CACHE=off, everything read at every start
+//   cold     the cache file does not exist yet
+//   warm     the next start, with the file the cold one wrote
+//   changed  a start after one image was modified, and after one was
+//            modified by another program while the emulator had it open
+//
+// It checks that every start finds the same geometry, partitions and file
+// systems, that a warm start reads nothing but the header every image is
+// probed for an overlay or compressed image by, and that a write through
+// the PiSCSI registers to a data block keeps the cache while one to the
+// RDB has the image read again at the next reset. Any failure makes the
+// exit code 1.
+//
+// The units are read with pread, PISTORM_PISCSI_MMAP=0 unless set, so that
+// -m can slow every read down to a fixed cost plus a transfer rate, to stand
+// in for slow storage (an SD card, a USB stick or disk). The boot ROM is
+// not loaded, and the file systems are saved to data/fs of the scratch
+// directory, which is removed at the end.
+//
+// Usage: piscsi_meta_bench [-m op-us,MB/s] [image-MB] [dir]
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_file/config_file.h"
+#include "piscsi_stubs.h"
+#include "platforms/amiga/piscsi/piscsi-enums.h"
+#include "platforms/amiga/piscsi/piscsi-meta.h"
+#include "platforms/amiga/piscsi/piscsi.h"
+
+#define UNITS 7
+#define HEADS 16
+#define SECS 63
+#define FS_KB 56
+#define RELOCS 400
+#define FAST_BASE 0x00200000u
+#define FAST_SIZE 0x10000u
+
+extern struct piscsi_fs filesystems[NUM_FILESYSTEMS];
+extern uint8_t piscsi_num_fs;
+
+static uint8_t* fast_ram;
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static unsigned int failures;
+
+static void fail(const char* what) {
+  if (failures++ < 10) {
+    fprintf(stderr, "%s\n", what);
+  }
+}
+
+/* The images. */
+
+static char images[UNITS][512];
+static uint64_t image_size;
+
+static void put_be32(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+static void write_block(int fd, const uint8_t* block, uint32_t n) {
+  if (pwrite(fd, block, 512, (off_t)n * 512) != 512) {
+    perror("pwrite");
+    exit(1);
+  }
+}
+
+static void write_partition(int fd, uint32_t n, uint32_t next, const char* name, uint32_t low,
+                            uint32_t high) {
+  static const uint32_t env[] = {16, 128, 0, HEADS, 1, SECS, 2, 0, 0, 0, 0, 30, 0,
+                                 0x1FE00, 0x7FFFFFFE, 0, 0x50465303};
+  uint8_t b[512] = {0};
+  put_be32(b, PART_IDENTIFIER);
+  put_be32(b + 4, 64);
+  put_be32(b + 16, next);
+  b[36] = (uint8_t)strlen(name);
+  memcpy(b + 37, name, strlen(name));
+  for (unsigned int i = 0; i < sizeof(env) / sizeof(env[0]); i++) {
+    put_be32(b + 128 + i * 4, i == 9 ? low : i == 10 ? high : env[i]);
+  }
+  write_block(fd, b, n);
+}
+
+// A hunk file of a code hunk with RELOCS relocations into a data hunk, the
+// way a file system handler is built, in LSEG blocks from block `first`.
+static void write_lseg(int fd, uint32_t first, uint8_t unit) {
+  static uint8_t hunks[FS_KB * 1024 + 4096];
+  uint32_t code = FS_KB * 1024 / 4 * 7 / 8, data = FS_KB * 1024 / 4 - code, n = 0;
+  uint32_t words[] = {HUNKTYPE_HEADER, 0, 2, 0, 1, code, data, HUNKTYPE_CODE, code};
+  for (unsigned int i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+    put_be32(hunks + 4 * n++, words[i]);
+  }
+  for (uint32_t i = 0; i < code; i++) {
+    put_be32(hunks + 4 * n++, 0x4E714E71 ^ (i * 2654435761u) ^ unit);
+  }
+  put_be32(hunks + 4 * n++, HUNKTYPE_HUNK_RELOC32);
+  put_be32(hunks + 4 * n++, RELOCS);
+  put_be32(hunks + 4 * n++, 1);
+  for (uint32_t i = 0; i < RELOCS; i++) {
+    put_be32(hunks + 4 * n++, i * (code / RELOCS) * 4);
+  }
+  put_be32(hunks + 4 * n++, 0);
+  put_be32(hunks + 4 * n++, HUNKTYPE_END);
+  put_be32(hunks + 4 * n++, HUNKTYPE_DATA);
+  put_be32(hunks + 4 * n++, data);
+  for (uint32_t i = 0; i < data; i++) {
+    put_be32(hunks + 4 * n++, i + unit);
+  }
+  put_be32(hunks + 4 * n++, HUNKTYPE_END);
+
+  uint32_t bytes = n * 4, per_block = 512 - 20, blocks = (bytes + per_block - 1) / per_block;
+  for (uint32_t i = 0; i < blocks; i++) {
+    uint8_t b[512] = {0};
+    put_be32(b, 0x4C534547); // LSEG
+    put_be32(b + 4, 128);
+    put_be32(b + 16, i + 1 == blocks ? 0xFFFFFFFF : first + i + 1);
+    uint32_t len = bytes - i * per_block < per_block ? bytes - i * per_block : per_block;
+    memcpy(b + 20, hunks + i * per_block, len);
+    write_block(fd, b, first + i);
+  }
+}
+
+static void make_image(uint8_t unit) {
+  int fd = open(images[unit], O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, (off_t)image_size) != 0) {
+    perror(images[unit]);
+    exit(1);
+  }
+  uint32_t cyls = (uint32_t)(image_size / (HEADS * SECS * 512));
+  uint8_t b[512] = {0};
+  put_be32(b, RDB_IDENTIFIER);
+  put_be32(b + 4, 64);
+  put_be32(b + 16, 512);        // rdb_BlockBytes
+  put_be32(b + 28, 1);          // rdb_PartitionList
+  put_be32(b + 32, 3);          // rdb_FileSysHeaderList
+  put_be32(b + 64, cyls);       // rdb_Cylinders
+  put_be32(b + 68, SECS);       // rdb_Sectors
+  put_be32(b + 72, HEADS);      // rdb_Heads
+  put_be32(b + 128, 0);         // rdb_RDBBlocksLo
+  put_be32(b + 132, 2 * HEADS * SECS - 1);
+  write_block(fd, b, 0);
+
+  char name[16];
+  snprintf(name, sizeof(name), "DH%u", unit);
+  write_partition(fd, 1, 2, name, 2, cyls / 2 - 1);
+  snprintf(name, sizeof(name), "WORK%u", unit);
+  write_partition(fd, 2, 0xFFFFFFFF, name, cyls / 2, cyls - 1);
+
+  // A file system header per unit, each its own DOS type.
+  memset(b, 0, sizeof(b));
+  put_be32(b, FS_IDENTIFIER);
+  put_be32(b + 4, 64);
+  put_be32(b + 16, 0xFFFFFFFF);
+  put_be32(b + 32, 0x50465300 | (uint32_t)(unit + 1)); // PFS\<unit + 1>
+  put_be32(b + 36, 0x00130002);
+  put_be32(b + 72, 4);          // fhb_SegListBlocks
+  write_block(fd, b, 3);
+  write_lseg(fd, 4, unit);
+  close(fd);
+}
+
+static void drop_cache(void) {
+  for (int u = 0; u < UNITS; u++) {
+    int fd = open(images[u], O_RDONLY);
+    if (fd >= 0) {
+      fdatasync(fd);
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+    }
+  }
+}
+
+/* What the units were found to hold, to compare the starts. */
+
+static uint32_t fnv(uint32_t h, const void* p, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ ((const uint8_t*)p)[i]) * 16777619u;
+  }
+  return h;
+}
+
+static uint32_t found(void) {
+  uint32_t h = 2166136261u;
+  for (uint8_t u = 0; u < UNITS; u++) {
+    struct piscsi_dev* d = piscsi_get_dev(u);
+    h = fnv(h, &d->c, sizeof(d->c));
+    h = fnv(h, &d->h, sizeof(d->h));
+    h = fnv(h, &d->s, sizeof(d->s));
+    h = fnv(h, &d->block_size, sizeof(d->block_size));
+    h = fnv(h, &d->num_partitions, sizeof(d->num_partitions));
+    for (uint32_t p = 0; p < d->num_partitions; p++) {
+      h = fnv(h, d->pb[p], sizeof(*d->pb[p]));
+    }
+  }
+  h = fnv(h, &piscsi_num_fs, sizeof(piscsi_num_fs));
+  for (int i = 0; i < piscsi_num_fs; i++) {
+    struct piscsi_fs* fs = &filesystems[i];
+    h = fnv(h, &fs->FS_ID, sizeof(fs->FS_ID));
+    h = fnv(h, fs->binary_data, fs->h_info.byte_size);
+    h = fnv(h, fs->relocs, fs->h_info.reloc_hunks * sizeof(fs->relocs[0]));
+    h = fnv(h, fs->fhb, sizeof(*fs->fhb));
+  }
+  return h;
+}
+
+/* Starts and resets. */
+
+struct result {
+  double ms;
+  uint64_t reads, kb;
+  struct piscsi_meta_stats stats;
+};
+
+static void count(struct result* r, double t0, uint64_t reads0, uint64_t bytes0,
+                  const struct piscsi_meta_stats* s0) {
+  r->ms = now_ms() - t0;
+  r->reads = piscsi_stub_io.pread - reads0;
+  r->kb = (piscsi_stub_io.read - bytes0) / 1024;
+  piscsi_meta_get_stats(&r->stats);
+  r->stats.hits -= s0->hits;
+  r->stats.misses -= s0->misses;
+  r->stats.read_bytes -= s0->read_bytes;
+}
+
+static uint32_t expected;
+
+static struct result start(void) {
+  struct result r;
+  struct piscsi_meta_stats s0;
+  drop_cache();
+  piscsi_meta_get_stats(&s0);
+  uint64_t reads0 = piscsi_stub_io.pread, bytes0 = piscsi_stub_io.read;
+  double t0 = now_ms();
+  piscsi_init();
+  for (uint8_t u = 0; u < UNITS; u++) {
+    piscsi_map_drive(images[u], u);
+  }
+  piscsi_refresh_drives();
+  count(&r, t0, reads0, bytes0, &s0);
+  if (!expected) {
+    expected = found();
+  } else if (found() != expected) {
+    fail("A start found different partitions or file systems.");
+  }
+  return r;
+}
+
+static struct result reset(void) {
+  struct result r;
+  struct piscsi_meta_stats s0;
+  piscsi_meta_get_stats(&s0);
+  uint64_t reads0 = piscsi_stub_io.pread, bytes0 = piscsi_stub_io.read;
+  double t0 = now_ms();
+  piscsi_refresh_drives();
+  count(&r, t0, reads0, bytes0, &s0);
+  if (found() != expected) {
+    fail("A reset found different partitions or file systems.");
+  }
+  return r;
+}
+
+static void reg_write(uint32_t cmd, uint32_t value) {
+  handle_piscsi_write(PISCSI_OFFSET + cmd, value, OP_TYPE_LONGWORD);
+}
+
+// Write `block` of unit 0 back as it is, through the registers.
+static void amiga_write(uint32_t block) {
+  int fd = open(images[0], O_RDONLY);
+  if (fd < 0 || pread(fd, fast_ram, 512, (off_t)block * 512) != 512) {
+    perror(images[0]);
+    exit(1);
+  }
+  close(fd);
+  reg_write(PISCSI_CMD_ADDR1, block);
+  reg_write(PISCSI_CMD_ADDR2, 512);
+  reg_write(PISCSI_CMD_ADDR3, FAST_BASE);
+  reg_write(PISCSI_CMD_WRITE, 0);
+}
+
+static FILE* out;
+
+static void print_row(const char* name, const struct result* r) {
+  fprintf(out, "%-22s %9.1f %7llu %8llu %6llu %6llu\n", name, r->ms,
+          (unsigned long long)r->reads, (unsigned long long)r->kb,
+          (unsigned long long)r->stats.hits, (unsigned long long)r->stats.misses);
+}
+
+static char work[256];
+
+static void remove_tree(const char* path) {
+  DIR* dir = opendir(path);
+  struct dirent* e;
+  while (dir && (e = readdir(dir))) {
+    if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0) {
+      char sub[1024];
+      snprintf(sub, sizeof(sub), "%s/%s", path, e->d_name);
+      if (e->d_type == DT_DIR) {
+        remove_tree(sub);
+      } else {
+        unlink(sub);
+      }
+    }
+  }
+  if (dir) {
+    closedir(dir);
+  }
+  rmdir(path);
+}
+
+int main(int argc, char** argv) {
+  int arg = 1;
+  fast_ram = piscsi_stub_map(FAST_BASE, FAST_SIZE);
+  if (arg + 1 < argc && strcmp(argv[arg], "-m") == 0) {
+    double op_us = 0, mbps = 0;
+    if (sscanf(argv[arg + 1], "%lf,%lf", &op_us, &mbps) != 2 || mbps <= 0) {
+      fprintf(stderr, "Usage: %s [-m op-us,MB/s] [image-MB] [dir]\n", argv[0]);
+      return 1;
+    }
+    piscsi_stub_op_ns = (uint64_t)(op_us * 1000);
+    piscsi_stub_ns_per_kb = (uint64_t)(1024 * 1e3 / mbps);
+    arg += 2;
+  }
+  image_size = (uint64_t)(arg < argc ? atoi(argv[arg++]) : 512) * 1024 * 1024;
+  const char* dir = arg < argc ? argv[arg] : "/tmp";
+
+  unsetenv("PISTORM_PISCSI_META_CACHE");
+  setenv("PISTORM_PISCSI_MMAP", "0", 0);
+  snprintf(work, sizeof(work), "%s/piscsi_meta_bench.%d", dir, (int)getpid());
+  char fs_dir[600];
+  snprintf(fs_dir, sizeof(fs_dir), "%s/data", work);
+  if (mkdir(work, 0755) != 0 || mkdir(fs_dir, 0755) != 0 ||
+      mkdir(strcat(fs_dir, "/fs"), 0755) != 0 || chdir(work) != 0) {
+    perror(work);
+    return 1;
+  }
+  for (uint8_t u = 0; u < UNITS; u++) {
+    snprintf(images[u], sizeof(images[u]), "%s/unit%u.hdf", work, u);
+    make_image(u);
+  }
+
+  // piscsi.c reports every unit on stdout; keep the table readable.
+  fflush(stdout);
+  out = fdopen(dup(STDOUT_FILENO), "w");
+  int devnull = open("/dev/null", O_WRONLY);
+  dup2(devnull, STDOUT_FILENO);
+
+  fprintf(out, "%d units of %lluMB: RDB, 2 partitions and a %dKB file system each\n", UNITS,
+          (unsigned long long)(image_size >> 20), FS_KB);
+  if (piscsi_stub_op_ns || piscsi_stub_ns_per_kb) {
+    fprintf(out, "storage model: %.0fus per read + %.1fMB/s\n", (double)piscsi_stub_op_ns / 1000,
+            1024 * 1e3 / (double)piscsi_stub_ns_per_kb);
+  }
+  fprintf(out, "\n%-22s %9s %7s %8s %6s %6s\n", "", "ms", "reads", "KB read", "hits", "misses");
+
+  piscsi_meta_set_path("off");
+  struct result r = start();
+  print_row("start, cache off", &r);
+  r = reset();
+  print_row("reset, cache off", &r);
+  piscsi_shutdown();
+
+  piscsi_meta_set_path(PISCSI_META_DEFAULT_PATH);
+  r = start();
+  print_row("start, cold", &r);
+  if (r.stats.misses != UNITS) {
+    fail("The cold start did not read every image.");
+  }
+  r = reset();
+  print_row("reset", &r);
+  if (r.stats.read_bytes) {
+    fail("A reset read metadata from the images.");
+  }
+  piscsi_shutdown();
+
+  r = start();
+  print_row("start, warm", &r);
+  if (r.stats.read_bytes || r.stats.hits != UNITS) {
+    fail("The warm start read from the images.");
+  }
+  amiga_write((uint32_t)(image_size / 1024)); // a data block, mid-image
+  r = reset();
+  print_row("reset after data write", &r);
+  if (r.stats.read_bytes) {
+    fail("A data write made a reset read the metadata.");
+  }
+  amiga_write(0);
+  r = reset();
+  print_row("reset after RDB write", &r);
+  if (!r.stats.read_bytes) {
+    fail("A write to the RDB did not make the reset read it again.");
+  }
+  piscsi_shutdown();
+
+  // The times of unit 0 changed with the writes: the cache was updated when
+  // it was closed. Another program changing unit 3 is seen at the next start.
+  struct timespec times[2] = {{0, UTIME_OMIT}, {0, UTIME_NOW}};
+  if (utimensat(AT_FDCWD, images[3], times, 0) != 0) {
+    perror(images[3]);
+  }
+  r = start();
+  print_row("start, 1 image changed", &r);
+  if (r.stats.misses != 1 || r.stats.hits != UNITS - 1) {
+    fail("The changed image was not read again, or others were.");
+  }
+  // Unit 5 changes while it is open and the Amiga writes nothing to it: its
+  // new times must not be taken for the cache's own when it is closed.
+  if (utimensat(AT_FDCWD, images[5], times, 0) != 0) {
+    perror(images[5]);
+  }
+  piscsi_shutdown();
+  r = start();
+  print_row("start, changed in use", &r);
+  if (r.stats.misses != 1 || r.stats.hits != UNITS - 1) {
+    fail("The image changed while in use was not read again, or others were.");
+  }
+  piscsi_shutdown();
+
+  struct stat st;
+  if (stat(PISCSI_META_DEFAULT_PATH, &st) == 0) {
+    fprintf(out, "\ncache file: %lldKB for %d images", (long long)st.st_size / 1024, UNITS);
+    if (piscsi_stub_op_ns || piscsi_stub_ns_per_kb) {
+      // Read with stdio, once per start, and not slowed down above.
+      uint64_t ns = piscsi_stub_op_ns + (uint64_t)st.st_size * piscsi_stub_ns_per_kb / 1024;
+      fprintf(out, ", %.1fms to read in the model", (double)ns / 1e6);
+    }
+    fprintf(out, "\n");
+  }
+  if (chdir("/") != 0) {
+    perror("/");
+  }
+  remove_tree(work);
+  if (failures) {
+    fprintf(out, "%u failures\n", failures);
+    return 1;
+  }
+  fprintf(out, "Every start found the same units, and the cache was used and dropped as "
+               "expected.\n");
+  return 0;
+}
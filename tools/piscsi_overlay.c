@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: MIT
+// tools/piscsi_overlay.c
+//
+// Makes and manages PiSCSI copy-on-write overlays (piscsi-overlay.h). Stop
+// the emulator, or unmap the unit, before changing an overlay it uses.
+//
+//   piscsi_overlay create <overlay> <image> [chunk-KB]
+//       an empty overlay of <image>, a hard file, a compressed one or
+//       another overlay
+//   piscsi_overlay snapshot <overlay> <snapshot>
+//       freeze the overlay as <snapshot> and continue in an empty one
+//   piscsi_overlay revert <overlay> [snapshot]
+//       drop what was written since the overlay was made, or start over
+//       from an older snapshot
+//   piscsi_overlay compact <overlay> <new-image>
+//       write the image the chain stands for as a new flat hard file
+//   piscsi_overlay info <overlay>
+//       the chain and how much of the image each overlay holds
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "platforms/amiga/piscsi/piscsi-overlay.h"
+#include "platforms/amiga/piscsi/piscsi-zhdf.h"
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int usage(void) {
+  fprintf(stderr, "Usage: piscsi_overlay create <overlay> <image> [chunk-KB]\n"
+                  "       piscsi_overlay snapshot <overlay> <snapshot>\n"
+                  "       piscsi_overlay revert <overlay> [snapshot]\n"
+                  "       piscsi_overlay compact <overlay> <new-image>\n"
+                  "       piscsi_overlay info <overlay>\n");
+  return 2;
+}
+
+static int info(const char* path) {
+  char cur[PATH_MAX], next[PATH_MAX];
+  snprintf(cur, sizeof(cur), "%s", path);
+  for (unsigned int depth = 0; depth <= PISCSI_OVERLAY_MAX_DEPTH; depth++) {
+    struct piscsi_overlay_header h;
+    struct stat st;
+    int fd = open(cur, O_RDONLY);
+    if (fd < 0) {
+      perror(cur);
+      return 1;
+    }
+    int r = piscsi_overlay_read_header(fd, &h);
+    if (r <= 0) {
+      struct piscsi_zhdf_header zh;
+      if (r == 0 && piscsi_zhdf_read_header(fd, &zh) > 0) {
+        printf("%-40s compressed image, %lluMB\n", cur, (unsigned long long)(zh.size >> 20));
+      } else if (r == 0 && fstat(fd, &st) == 0) {
+        printf("%-40s image, %lluMB\n", cur, (unsigned long long)(st.st_size >> 20));
+      } else {
+        printf("%-40s damaged overlay\n", cur);
+      }
+      close(fd);
+      return r < 0;
+    }
+    uint64_t chunks = (h.size + h.chunk_size - 1) / h.chunk_size;
+    uint64_t bytes = (chunks + 7) / 8, used = 0;
+    uint8_t* bitmap = calloc(1, bytes);
+    if (!bitmap || pread(fd, bitmap, bytes, (off_t)h.bitmap_offset) < 0) {
+      perror(cur);
+      return 1;
+    }
+    for (uint64_t i = 0; i < bytes; i++) {
+      used += (uint64_t)__builtin_popcount(bitmap[i]);
+    }
+    free(bitmap);
+    fstat(fd, &st);
+    close(fd);
+    printf("%-40s overlay, %lluMB image, %uKB chunks, %llu chunks written (%.1f%%), %lluMB on "
+           "disk\n",
+           cur, (unsigned long long)(h.size >> 20), h.chunk_size / 1024,
+           (unsigned long long)used, 100.0 * (double)used / (double)chunks,
+           (unsigned long long)((uint64_t)st.st_blocks * 512 >> 20));
+    piscsi_overlay_backing_path(cur, h.backing, next, sizeof(next));
+    memcpy(cur, next, sizeof(cur));
+  }
+  fprintf(stderr, "More than %d overlays in the chain.\n", PISCSI_OVERLAY_MAX_DEPTH);
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    return usage();
+  }
+  const char* cmd = argv[1];
+  double t0 = now_s();
+  int r;
+  if (!strcmp(cmd, "create") && argc <= 5 && argc >= 4) {
+    r = piscsi_overlay_create(argv[2], argv[3],
+                              argc > 4 ? (uint32_t)strtoul(argv[4], NULL, 0) * 1024 : 0);
+  } else if (!strcmp(cmd, "snapshot") && argc == 4) {
+    r = piscsi_overlay_snapshot(argv[2], argv[3]);
+  } else if (!strcmp(cmd, "revert") && argc <= 4) {
+    r = piscsi_overlay_revert(argv[2], argc > 3 ? argv[3] : NULL);
+  } else if (!strcmp(cmd, "compact") && argc == 4) {
+    r = piscsi_overlay_compact(argv[2], argv[3]);
+  } else if (!strcmp(cmd, "info") && argc == 3) {
+    return info(argv[2]);
+  } else {
+    return usage();
+  }
+  if (r < 0) {
+    perror(cmd);
+    return 1;
+  }
+  printf("%s: done in %.3fs\n", cmd, now_s() - t0);
+  return 0;
+}
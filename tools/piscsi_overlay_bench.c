@@ -0,0 +1,278 @@
+// SPDX-License-Identifier: MIT
+// tools/piscsi_overlay_bench.c
+//
+// Compares a PiSCSI unit on a flat hard file with one on a copy-on-write
+// overlay of the same image (piscsi-overlay.c), with 4KB and 64KB chunks.
+// It reports:
+//
+//  - provisioning: copying the image against making an overlay of it;
+//  - throughput per access pattern, for the flat image, for an overlay
+//    while every write adds chunks ("fresh") and once they are all in it;
+//  - snapshot, revert and compaction times, checking what each leaves.
+//
+// Every read is checked against what the image should hold. Any mismatch
+// makes the exit code 1. The page cache is dropped between runs, which only
+// matters when [dir] is on a real disk, not tmpfs.
+//
+// Usage: piscsi_overlay_bench [image-MB] [dir]
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "platforms/amiga/piscsi/piscsi-overlay.h"
+
+#define MAX_LEN (64u * 1024u)
+#define RANDOM_OPS 8000
+
+static uint64_t image_size;
+static char base_path[512], flat_path[512], cow_path[512], snap_path[512], out_path[512];
+static uint8_t* ref;  // the image as the unit should read it
+static uint8_t* snap; // ... as it was at the snapshot
+static uint8_t buf[MAX_LEN];
+static unsigned int failures;
+
+static uint32_t rng = 0x1234567;
+static uint32_t rnd(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void fail(const char* what) {
+  if (failures++ < 10) {
+    fprintf(stderr, "%s\n", what);
+  }
+}
+
+static void drop_cache(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+static int open_unit(const char* path) {
+  drop_cache(base_path);
+  drop_cache(path);
+  int fd = open(path, O_RDWR);
+  uint64_t size = 0;
+  if (fd < 0 || piscsi_overlay_attach(0, fd, path, &size) < 0) {
+    perror(path);
+    exit(1);
+  }
+  return fd;
+}
+
+static void close_unit(int fd) {
+  piscsi_overlay_detach(0);
+  close(fd);
+}
+
+static double copy_file(const char* from, const char* to) {
+  double t0 = now_s();
+  int in = open(from, O_RDONLY), out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  static uint8_t block[1024 * 1024];
+  ssize_t n;
+  while ((n = read(in, block, sizeof(block))) > 0) {
+    if (write(out, block, (size_t)n) != n) {
+      perror(to);
+      exit(1);
+    }
+  }
+  fdatasync(out);
+  close(in);
+  close(out);
+  return now_s() - t0;
+}
+
+// One pass of `len`-byte commands over the unit. Returns MB/s.
+static double run(int fd, int write, int sequential, uint32_t len) {
+  uint64_t blocks = image_size / len;
+  unsigned int ops = sequential ? (unsigned int)blocks : RANDOM_OPS;
+  double t0 = now_s();
+  for (unsigned int i = 0; i < ops; i++) {
+    uint64_t offset = (sequential ? i : rnd() % blocks) * len;
+    ssize_t n;
+    if (write) {
+      for (uint32_t j = 0; j < len; j += 64) {
+        buf[j] = (uint8_t)rnd();
+      }
+      n = piscsi_overlay_write(0, fd, buf, len, offset);
+      memcpy(ref + offset, buf, len);
+    } else {
+      n = piscsi_overlay_read(0, fd, buf, len, offset);
+    }
+    if (n != (ssize_t)len || (!write && memcmp(buf, ref + offset, len) != 0)) {
+      fail(write ? "A write failed." : "A read returned the wrong data.");
+    }
+  }
+  if (write) {
+    piscsi_overlay_sync(0, fd);
+  }
+  return (double)len * ops / (now_s() - t0) / (1024.0 * 1024.0);
+}
+
+static void check_unit(const char* path, const uint8_t* want, const char* what) {
+  int fd = open_unit(path);
+  for (uint64_t pos = 0; pos < image_size; pos += MAX_LEN) {
+    if (piscsi_overlay_read(0, fd, buf, MAX_LEN, pos) != MAX_LEN ||
+        memcmp(buf, want + pos, MAX_LEN) != 0) {
+      fail(what);
+      break;
+    }
+  }
+  close_unit(fd);
+}
+
+struct pattern {
+  const char* name;
+  int write, sequential;
+  uint32_t len;
+};
+
+static const struct pattern patterns[] = {
+    {"read seq 64K", 0, 1, MAX_LEN},  {"read rand 4K", 0, 0, 4096},
+    {"write seq 64K", 1, 1, MAX_LEN}, {"write rand 4K", 1, 0, 4096},
+    {"write rand 512", 1, 0, 512},    {"read rand 4K", 0, 0, 4096},
+};
+#define NUM_PATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+
+// The patterns on a fresh unit from `path`, then the writes again once the
+// chunks are in it.
+static void run_unit(const char* path, double* fresh, double* again) {
+  memcpy(ref, snap, image_size);
+  int fd = open_unit(path);
+  for (unsigned int p = 0; p < NUM_PATTERNS; p++) {
+    fresh[p] = run(fd, patterns[p].write, patterns[p].sequential, patterns[p].len);
+    again[p] = patterns[p].write ? run(fd, 1, patterns[p].sequential, patterns[p].len) : 0;
+  }
+  close_unit(fd);
+  check_unit(path, ref, "The image differs after the writes.");
+}
+
+int main(int argc, char** argv) {
+  image_size = (argc > 1 ? strtoull(argv[1], NULL, 0) : 128) * 1024 * 1024;
+  const char* dir = argc > 2 ? argv[2] : "/tmp";
+  snprintf(base_path, sizeof(base_path), "%s/piscsi_overlay_bench.hdf", dir);
+  snprintf(flat_path, sizeof(flat_path), "%s/piscsi_overlay_bench_flat.hdf", dir);
+  snprintf(cow_path, sizeof(cow_path), "%s/piscsi_overlay_bench.cow", dir);
+  snprintf(snap_path, sizeof(snap_path), "%s/piscsi_overlay_bench_snap.cow", dir);
+  snprintf(out_path, sizeof(out_path), "%s/piscsi_overlay_bench_out.hdf", dir);
+
+  ref = malloc(image_size);
+  snap = malloc(image_size);
+  int fd = open(base_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (!ref || !snap || fd < 0) {
+    perror(base_path);
+    return 1;
+  }
+  for (uint64_t i = 0; i < image_size; i++) {
+    snap[i] = (uint8_t)rnd();
+  }
+  if (pwrite(fd, snap, image_size, 0) != (ssize_t)image_size) {
+    perror(base_path);
+    return 1;
+  }
+  fdatasync(fd);
+  close(fd);
+  printf("%lluMB image in %s\n\n", (unsigned long long)(image_size >> 20), dir);
+
+  drop_cache(base_path);
+  double t_copy = copy_file(base_path, flat_path);
+  double t0 = now_s();
+  if (piscsi_overlay_create(cow_path, base_path, 0) < 0) {
+    perror(cow_path);
+    return 1;
+  }
+  double t_create = now_s() - t0;
+  printf("provisioning: full copy %.3fs, overlay %.6fs\n\n", t_copy, t_create);
+
+  static const uint32_t chunks[] = {4096, 64 * 1024};
+  double flat[NUM_PATTERNS], flat2[NUM_PATTERNS], cow[2][NUM_PATTERNS], cow2[2][NUM_PATTERNS];
+  run_unit(flat_path, flat, flat2);
+  for (int c = 0; c < 2; c++) {
+    if (piscsi_overlay_create(cow_path, base_path, chunks[c]) < 0) {
+      perror(cow_path);
+      return 1;
+    }
+    run_unit(cow_path, cow[c], cow2[c]);
+  }
+  printf("%-16s %9s %9s %9s %9s %9s\n", "MB/s", "flat", "cow-4K", "cow-4K", "cow-64K",
+         "cow-64K");
+  printf("%-16s %9s %9s %9s %9s %9s\n", "", "", "fresh", "again", "fresh", "again");
+  for (unsigned int p = 0; p < NUM_PATTERNS; p++) {
+    printf("%-16s %9.1f %9.1f", patterns[p].name, flat[p], cow[0][p]);
+    if (patterns[p].write) {
+      printf(" %9.1f %9.1f %9.1f\n", cow2[0][p], cow[1][p], cow2[1][p]);
+    } else {
+      printf(" %9s %9.1f %9s\n", "", cow[1][p], "");
+    }
+  }
+
+  // The overlay now holds everything ref does: snapshot it, write more,
+  // revert, and compact each state.
+  memcpy(snap, ref, image_size);
+  t0 = now_s();
+  if (piscsi_overlay_snapshot(cow_path, snap_path) < 0) {
+    perror(snap_path);
+    return 1;
+  }
+  double t_snap = now_s() - t0;
+  check_unit(cow_path, snap, "The snapshot's overlay differs from the image at the snapshot.");
+  fd = open_unit(cow_path);
+  run(fd, 1, 0, 4096);
+  close_unit(fd);
+  check_unit(cow_path, ref, "The overlay on the snapshot differs after the writes.");
+  t0 = now_s();
+  double t_compact = 0;
+  if (piscsi_overlay_compact(cow_path, out_path) < 0) {
+    perror(out_path);
+    failures++;
+  } else {
+    t_compact = now_s() - t0;
+    check_unit(out_path, ref, "The compacted image differs.");
+  }
+  unlink(out_path);
+  t0 = now_s();
+  if (piscsi_overlay_revert(cow_path, NULL) < 0) {
+    perror(cow_path);
+    return 1;
+  }
+  double t_revert = now_s() - t0;
+  check_unit(cow_path, snap, "The reverted overlay differs from the snapshot.");
+  printf("\nsnapshot %.6fs, revert %.6fs, compact %.3fs\n", t_snap, t_revert, t_compact);
+
+  struct piscsi_overlay_stats st;
+  piscsi_overlay_stop();
+  piscsi_overlay_get_stats(&st);
+  printf("%llu chunks added, %llu read from below first, %llu bitmap saves, %llu errors\n",
+         (unsigned long long)st.copy_ups, (unsigned long long)st.partial,
+         (unsigned long long)st.bitmap_saves, (unsigned long long)st.errors);
+
+  unlink(base_path);
+  unlink(flat_path);
+  unlink(cow_path);
+  unlink(snap_path);
+  if (failures || st.errors) {
+    printf("%u failures\n", failures);
+    return 1;
+  }
+  printf("All reads returned the expected data, and every snapshot, revert and compaction left "
+         "the expected image.\n");
+  return 0;
+}
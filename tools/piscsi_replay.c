@@ -0,0 +1,667 @@
+// SPDX-License-Identifier: MIT
+// tools/piscsi_replay.c
+//
+// Replays a PiSCSI register trace (piscsi-trace.h) against piscsi.c through
+// handle_piscsi_write()/handle_piscsi_read(), with no Amiga or PiStorm, so
+// a change to PiSCSI can be measured on the workload of a real machine.
+// Traces are recorded from a running emulator with setvar piscsi-trace, or
+// made up with -g.
+//
+// The Amiga memory the Pi mapped when the trace was recorded is plain memory
+// here, at the same addresses; the rest of the 24-bit space, which piscsi.c
+// reaches over the bus (chip RAM), is an array. Each unit gets a scratch
+// image in dir: a copy of the image given with -i, or one of the recorded
+// size with a one-partition RDB and random data, so the given images are
+// never written. Their page cache is dropped before the replay.
+//
+// For reads and writes it reports requests per second, throughput and
+// latency percentiles, from the write of the command register to the
+// completion (the end of that write, or the PISCSI_CMD_DONE read returning
+// the request's tag), next to the same figures from the recording. It also
+// reports the time spent in the registers (what the 68k waits for), the
+// system calls on the images, page faults and context switches, the bytes
+// moved over the emulated bus, and any probing register (geometry,
+// partitions) that read differently from the recording.
+//
+// Requests follow each other without the pauses of the recording, so the
+// replay shows how fast PiSCSI serves the workload, not how busy the Amiga
+// was. The PiSCSI settings come from the environment, as in the emulator:
+// PISTORM_PISCSI_ASYNC, PISTORM_PISCSI_CACHE_MB, PISTORM_PISCSI_MMAP and so
+// on, but PISTORM_PISCSI_META_CACHE is off unless set. Requests the driver
+// issued asynchronously run synchronously with PISTORM_PISCSI_ASYNC=0. -m
+// slows every pread, pwrite and pwritev down to a fixed cost plus a
+// transfer rate, and fdatasync to ten times that cost, to stand in for the
+// Pi's SD card.
+//
+// -g writes a synthetic trace: the driver's unit probing and the boot ROM's
+// partition setup for one unit, then `requests` transfers as an AmigaOS
+// file system makes them (25% file loads in 64KB steps, 45% 512-byte to
+// 4KB reads, 90% of them in the first 2MB, 10% 4KB reads into chip RAM,
+// 20% 512-byte to 4KB writes with an update every 32), one at a time, the
+// way pi-scsi.device issues them with asynchronous I/O on.
+//
+// Run it from the top of the tree: the boot ROM the driver is copied from
+// is loaded from src/platforms/amiga/piscsi/piscsi.rom.
+//
+// Usage: piscsi_replay [-i unit=image]... [-d dir] [-m op-us,MB/s] trace
+//        piscsi_replay -g trace [requests] [image-MB]
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_file/config_file.h"
+#include "piscsi_stubs.h"
+#include "platforms/amiga/piscsi/piscsi-async.h"
+#include "platforms/amiga/piscsi/piscsi-enums.h"
+#include "platforms/amiga/piscsi/piscsi-media.h"
+#include "platforms/amiga/piscsi/piscsi-trace.h"
+#include "platforms/amiga/piscsi/piscsi.h"
+
+#define MAX_PENDING 64
+#define MAX_DIVERGED_SHOWN 5
+
+// Synthetic traces: Zorro II fast RAM at its usual place, the driver's
+// requests and buffers in it.
+#define SYN_FAST_BASE 0x00200000u
+#define SYN_FAST_SIZE 0x00800000u
+#define SYN_IOREQ 0x00300000u
+#define SYN_BUFFER 0x00400000u
+#define SYN_CHIP_BUFFER 0x00010000u
+#define SYN_HEADS 16
+#define SYN_SECS 64
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t rng = 0x13579BDF;
+static uint32_t rnd(uint32_t n) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng % n;
+}
+
+/* Request tracking, for the recording and the replay alike. */
+
+struct latencies {
+  uint64_t* ns;
+  size_t n, cap;
+  uint64_t bytes;
+};
+
+struct side {
+  struct latencies lat[2]; // read, write
+  uint64_t reg_ns, io_reg_ns, first, last;
+  // The command being issued, until PISCSI_CMD_TAG says what became of it.
+  uint32_t tag, len;
+  int cmd_write, cmd_async;
+  uint64_t cmd_t0, cmd_t1;
+  struct {
+    uint32_t tag, len;
+    int write;
+    uint64_t t0;
+  } pending[MAX_PENDING];
+  unsigned int npending;
+};
+
+static struct side recorded, replayed;
+
+static void add_latency(struct side* s, int write, uint32_t len, uint64_t ns) {
+  struct latencies* l = &s->lat[write];
+  if (l->n == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 4096;
+    l->ns = realloc(l->ns, l->cap * sizeof(*l->ns));
+    if (!l->ns) {
+      fprintf(stderr, "Out of memory.\n");
+      exit(1);
+    }
+  }
+  l->ns[l->n++] = ns;
+  l->bytes += len;
+}
+
+// 1 for a read command register, 2 for a write, else 0.
+static int transfer_reg(uint32_t reg) {
+  switch (reg) {
+  case PISCSI_CMD_READ:
+  case PISCSI_CMD_READ64:
+  case PISCSI_CMD_READBYTES:
+    return 1;
+  case PISCSI_CMD_WRITE:
+  case PISCSI_CMD_WRITE64:
+  case PISCSI_CMD_WRITEBYTES:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+static void track(struct side* s, char op, uint32_t reg, uint32_t value, uint64_t t0,
+                  uint64_t t1) {
+  int rw = op == 'W' ? transfer_reg(reg) : 0;
+  if (!s->first) {
+    s->first = t0 ? t0 : 1;
+  }
+  s->last = t1;
+  s->reg_ns += t1 - t0;
+  if (rw) {
+    s->io_reg_ns += t1 - t0;
+    s->cmd_write = rw == 2;
+    s->cmd_async = (value & PISCSI_ASYNC_FLAG) != 0;
+    s->cmd_t0 = t0;
+    s->cmd_t1 = t1;
+    if (!s->cmd_async) {
+      add_latency(s, s->cmd_write, s->len, t1 - t0);
+    }
+  } else if (op == 'W' && reg == PISCSI_CMD_TAG) {
+    s->tag = value;
+  } else if (op == 'W' && reg == PISCSI_CMD_ADDR2) {
+    s->len = value;
+  } else if (op == 'R' && reg == PISCSI_CMD_TAG && s->cmd_async) {
+    s->cmd_async = 0;
+    if (!value || s->npending == MAX_PENDING) {
+      add_latency(s, s->cmd_write, s->len, s->cmd_t1 - s->cmd_t0);
+    } else {
+      s->pending[s->npending].tag = s->tag;
+      s->pending[s->npending].len = s->len;
+      s->pending[s->npending].write = s->cmd_write;
+      s->pending[s->npending++].t0 = s->cmd_t0;
+    }
+  } else if (op == 'R' && reg == PISCSI_CMD_DONE && value) {
+    for (unsigned int i = 0; i < s->npending; i++) {
+      if (s->pending[i].tag == value) {
+        add_latency(s, s->pending[i].write, s->pending[i].len, t1 - s->pending[i].t0);
+        s->pending[i] = s->pending[--s->npending];
+        break;
+      }
+    }
+  }
+}
+
+/* The replay. */
+
+static const char* scratch_dir = "/tmp";
+static const char* images[NUM_UNITS];
+static char scratch[NUM_UNITS][512];
+static struct {
+  int present, removable;
+  uint64_t size;
+  uint32_t block_size;
+} units[NUM_UNITS];
+static int started, resets;
+static uint64_t mount_ns;
+static unsigned int diverged;
+
+static void put_be32(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+// An RDB with one partition, RP<unit>:, over all cylinders but the first.
+static void write_rdb(uint8_t* block, uint8_t unit, uint64_t size) {
+  uint32_t cyls = (uint32_t)(size / (SYN_HEADS * SYN_SECS * 512));
+  memset(block, 0, 1024);
+  put_be32(block, RDB_IDENTIFIER);
+  put_be32(block + 4, 64);            // rdb_SummedLongs
+  put_be32(block + 16, 512);          // rdb_BlockBytes
+  put_be32(block + 28, 1);            // rdb_PartitionList
+  put_be32(block + 32, 0xFFFFFFFF);   // rdb_FileSysHeaderList
+  put_be32(block + 64, cyls);         // rdb_Cylinders
+  put_be32(block + 68, SYN_SECS);     // rdb_Sectors
+  put_be32(block + 72, SYN_HEADS);    // rdb_Heads
+
+  uint8_t* pb = block + 512;
+  static const uint32_t env[] = {16, 128, 0, SYN_HEADS, 1, SYN_SECS, 2, 0, 0, 1, 0, 30, 0,
+                                 0x1FE00, 0x7FFFFFFE, 0, 0x444F5303};
+  put_be32(pb, PART_IDENTIFIER);
+  put_be32(pb + 4, 64);
+  put_be32(pb + 16, 0xFFFFFFFF); // pb_Next
+  pb[36] = 3;
+  snprintf((char*)pb + 37, 8, "RP%u", unit);
+  for (unsigned int i = 0; i < sizeof(env) / sizeof(env[0]); i++) {
+    put_be32(pb + 128 + i * 4, i == 10 ? cyls - 1 : env[i]);
+  }
+}
+
+static void make_scratch(uint8_t unit) {
+  static uint8_t buf[1024 * 1024];
+  snprintf(scratch[unit], sizeof(scratch[unit]), "%s/piscsi_replay_%u.%d", scratch_dir, unit,
+           (int)getpid());
+  int out = open(scratch[unit], O_RDWR | O_CREAT | O_TRUNC, 0644);
+  int in = images[unit] ? open(images[unit], O_RDONLY) : -1;
+  if (out < 0 || (images[unit] && in < 0)) {
+    perror(out < 0 ? scratch[unit] : images[unit]);
+    exit(1);
+  }
+  uint64_t size = units[unit].size;
+  for (uint64_t pos = 0; in >= 0 || pos < size;) {
+    ssize_t n;
+    if (in >= 0) {
+      n = read(in, buf, sizeof(buf));
+      if (n <= 0) {
+        break;
+      }
+    } else {
+      n = (ssize_t)(size - pos < sizeof(buf) ? size - pos : sizeof(buf));
+      for (ssize_t i = 0; i < n; i += 4) {
+        uint32_t v = rnd(0xFFFFFFFF);
+        memcpy(&buf[i], &v, 4);
+      }
+      if (pos == 0 && !units[unit].removable) {
+        write_rdb(buf, unit, size);
+      }
+    }
+    if (write(out, buf, (size_t)n) != n) {
+      perror(scratch[unit]);
+      exit(1);
+    }
+    pos += (uint64_t)n;
+  }
+  if (in >= 0) {
+    close(in);
+  }
+  fdatasync(out);
+  posix_fadvise(out, 0, 0, POSIX_FADV_DONTNEED);
+  close(out);
+}
+
+static void start(void) {
+  started = 1;
+  for (uint8_t u = 0; u < NUM_UNITS; u++) {
+    if (!units[u].present) {
+      continue;
+    }
+    make_scratch(u);
+    uint64_t t0 = now_ns();
+    if (units[u].removable) {
+      piscsi_make_removable(u, units[u].size);
+      piscsi_insert_media(u, scratch[u]);
+    } else {
+      piscsi_map_drive(scratch[u], u);
+    }
+    mount_ns += now_ns() - t0;
+  }
+}
+
+static int probing_reg(uint32_t reg) {
+  switch (reg) {
+  case PISCSI_CMD_DRVTYPE:
+  case PISCSI_CMD_BLOCKS:
+  case PISCSI_CMD_CYLS:
+  case PISCSI_CMD_HEADS:
+  case PISCSI_CMD_SECS:
+  case PISCSI_CMD_BLOCKSIZE:
+  case PISCSI_CMD_MEDIA:
+  case PISCSI_CMD_GETPART:
+  case PISCSI_CMD_GETPRIO:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static void replay(char op, uint32_t reg, unsigned int bits, uint32_t value) {
+  uint8_t type = bits == 8 ? OP_TYPE_BYTE : bits == 16 ? OP_TYPE_WORD : OP_TYPE_LONGWORD;
+  uint32_t addr = PISCSI_OFFSET + reg;
+  if (op == 'W') {
+    uint64_t t0 = now_ns();
+    handle_piscsi_write(addr, value, type);
+    track(&replayed, op, reg, value, t0, now_ns());
+    return;
+  }
+  if (reg == PISCSI_CMD_DONE && value) {
+    // The driver was told a request had finished. If this replay has
+    // already collected it, there is nothing left to wait for.
+    if (!replayed.npending) {
+      return;
+    }
+    uint32_t tag;
+    uint64_t t0;
+    for (;;) {
+      t0 = now_ns();
+      if ((tag = handle_piscsi_read(addr, type)) != 0) {
+        break;
+      }
+      // Leave the CPU to the workers, as the 68k would be off running code.
+      sched_yield();
+    }
+    track(&replayed, op, reg, tag, t0, now_ns());
+    return;
+  }
+  uint64_t t0 = now_ns();
+  uint32_t got = handle_piscsi_read(addr, type);
+  track(&replayed, op, reg, got, t0, now_ns());
+  if (probing_reg(reg) && got != value && diverged++ < MAX_DIVERGED_SHOWN) {
+    fprintf(stderr, "Register %.2X read %.8X, the recording %.8X.\n", reg, got, value);
+  }
+}
+
+static void drain(void) {
+  while (replayed.npending) {
+    replay('R', PISCSI_CMD_DONE, 32, 1);
+  }
+}
+
+static int cmp_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static void print_row(FILE* out, const char* name, const char* what, struct side* s, int write) {
+  struct latencies* l = &s->lat[write];
+  double span = (double)(s->last - s->first) / 1e9;
+  fprintf(out, "%-6s %-9s %8zu", name, what, l->n);
+  if (!l->n || span <= 0) {
+    fprintf(out, "\n");
+    return;
+  }
+  qsort(l->ns, l->n, sizeof(*l->ns), cmp_u64);
+  static const double pcts[] = {50, 90, 99, 99.9};
+  fprintf(out, " %9.0f %8.1f", (double)l->n / span, (double)l->bytes / span / 1e6);
+  for (unsigned int i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+    fprintf(out, " %9.1f", (double)l->ns[(size_t)((double)(l->n - 1) * pcts[i] / 100)] / 1e3);
+  }
+  fprintf(out, " %9.1f\n", (double)l->ns[l->n - 1] / 1e3);
+}
+
+static int run(const char* path, FILE* out) {
+  FILE* in = fopen(path, "r");
+  if (!in) {
+    perror(path);
+    return 1;
+  }
+  if (access("src/platforms/amiga/piscsi/piscsi.rom", R_OK) != 0) {
+    fprintf(stderr, "Run from the top of the tree, where the PiSCSI boot ROM is.\n");
+    return 1;
+  }
+  piscsi_init();
+  // Traces come from a driver that uses background I/O, which the emulator
+  // only starts when the config asks for it.
+  piscsi_async_start(PISCSI_ASYNC_DEFAULT_THREADS);
+
+  char line[512];
+  uint64_t accesses = 0, lineno = 0, t_rec = 0;
+  int bad = 0;
+  struct rusage ru0, ru1;
+  getrusage(RUSAGE_SELF, &ru0);
+  struct piscsi_stub_io io0 = {0};
+  uint64_t bus0 = 0;
+  while (fgets(line, sizeof(line), in)) {
+    lineno++;
+    unsigned long long t, dur, a, b, c;
+    unsigned int reg, bits, value, removable;
+    char op;
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+    if (sscanf(line, "map %llx %llx", &a, &b) == 2) {
+      if (!started) {
+        piscsi_stub_map((uint32_t)a, (uint32_t)b);
+      }
+    } else if (sscanf(line, "unit %llu %llu %llu %u", &a, &b, &c, &removable) == 4) {
+      if (!started && a < NUM_UNITS) {
+        units[a].present = 1;
+        units[a].size = b ? b : PISCSI_MEDIA_DD_SIZE;
+        units[a].block_size = (uint32_t)c;
+        units[a].removable = removable != 0;
+      }
+    } else if (strncmp(line, "reset", 5) == 0) {
+      if (!started) {
+        start();
+      }
+      drain();
+      uint64_t t0 = now_ns();
+      piscsi_refresh_drives();
+      mount_ns += now_ns() - t0;
+      resets++;
+      if (resets == 1) {
+        // Mounting is reported on its own.
+        io0 = piscsi_stub_io;
+        bus0 = piscsi_stub_bus_bytes;
+        getrusage(RUSAGE_SELF, &ru0);
+      }
+    } else if (sscanf(line, "%llu %c %x %u %x %llu", &t, &op, &reg, &bits, &value, &dur) == 6 &&
+               (op == 'R' || op == 'W')) {
+      if (!started) {
+        start();
+      }
+      accesses++;
+      if (t || dur) {
+        t_rec = 1;
+      }
+      track(&recorded, op, reg, value, t, t + dur);
+      replay(op, reg, bits, value);
+    } else if (bad++ < MAX_DIVERGED_SHOWN) {
+      fprintf(stderr, "%s:%llu: not a trace line.\n", path, (unsigned long long)lineno);
+    }
+  }
+  fclose(in);
+  drain();
+  getrusage(RUSAGE_SELF, &ru1);
+
+  int nunits = 0;
+  for (int u = 0; u < NUM_UNITS; u++) {
+    nunits += units[u].present;
+  }
+  uint64_t transfers = replayed.lat[0].n + replayed.lat[1].n;
+  fprintf(out, "%llu register accesses, %llu transfers, %d unit%s", (unsigned long long)accesses,
+          (unsigned long long)transfers, nunits, nunits == 1 ? "" : "s");
+  if (t_rec) {
+    fprintf(out, ", recorded over %.1fs", (double)(recorded.last - recorded.first) / 1e9);
+  }
+  fprintf(out, "\nmount: %.1fms for the images and %d reset%s, async queue depth %u\n\n",
+          (double)mount_ns / 1e6, resets, resets == 1 ? "" : "s", piscsi_async_depth());
+  fprintf(out, "%-6s %-9s %8s %9s %8s %9s %9s %9s %9s %9s\n", "", "", "ops", "IOPS", "MB/s",
+          "p50-us", "p90-us", "p99-us", "p99.9-us", "max-us");
+  for (int w = 0; w < 2; w++) {
+    print_row(out, w ? "write" : "read", "replay", &replayed, w);
+    if (t_rec) {
+      print_row(out, "", "recorded", &recorded, w);
+    }
+  }
+  fprintf(out, "\nregister time: %.1fms replayed, %.1fms in transfers", replayed.reg_ns / 1e6,
+          replayed.io_reg_ns / 1e6);
+  if (t_rec) {
+    fprintf(out, "; %.1fms recorded, %.1fms in transfers", recorded.reg_ns / 1e6,
+            recorded.io_reg_ns / 1e6);
+  }
+  struct piscsi_stub_io io = piscsi_stub_io;
+  io.pread -= io0.pread, io.pwrite -= io0.pwrite, io.pwritev -= io0.pwritev, io.sync -= io0.sync;
+  uint64_t calls = io.pread + io.pwrite + io.pwritev + io.sync;
+  fprintf(out,
+          "\nsystem calls: %llu pread, %llu pwrite, %llu pwritev, %llu fdatasync, %.2f per "
+          "transfer\n",
+          (unsigned long long)io.pread, (unsigned long long)io.pwrite,
+          (unsigned long long)io.pwritev, (unsigned long long)io.sync,
+          transfers ? (double)calls / (double)transfers : 0.0);
+  fprintf(out,
+          "page faults: %ld major, %ld minor; context switches: %ld voluntary, %ld "
+          "involuntary\n",
+          ru1.ru_majflt - ru0.ru_majflt, ru1.ru_minflt - ru0.ru_minflt, ru1.ru_nvcsw - ru0.ru_nvcsw,
+          ru1.ru_nivcsw - ru0.ru_nivcsw);
+  fprintf(out, "bus: %llu KB to and from chip RAM\n",
+          (unsigned long long)((piscsi_stub_bus_bytes - bus0) / 1024));
+  fprintf(out, "probing reads that differ from the recording: %u\n", diverged);
+  fflush(out);
+
+  piscsi_shutdown();
+  for (int u = 0; u < NUM_UNITS; u++) {
+    if (scratch[u][0]) {
+      unlink(scratch[u]);
+    }
+  }
+  return bad ? 1 : 0;
+}
+
+/* Synthetic traces. */
+
+static FILE* syn;
+
+static void syn_access(char op, uint32_t reg, unsigned int bits, uint32_t value) {
+  fprintf(syn, "0 %c %X %u %X 0\n", op, reg, bits, value);
+}
+
+static void syn_transfer(uint8_t write, uint32_t offset, uint32_t len, uint32_t data,
+                         uint32_t tag) {
+  int queued = data >= SYN_FAST_BASE;
+  syn_access('W', PISCSI_CMD_DRVNUMX, 16, 0);
+  syn_access('R', PISCSI_CMD_BLOCKSIZE, 32, 512);
+  syn_access('W', PISCSI_CMD_TAG, 32, tag);
+  syn_access('W', PISCSI_CMD_ADDR1, 32, offset);
+  syn_access('W', PISCSI_CMD_ADDR2, 32, len);
+  syn_access('W', PISCSI_CMD_ADDR3, 32, data);
+  syn_access('W', write ? PISCSI_CMD_WRITEBYTES : PISCSI_CMD_READBYTES, 16, PISCSI_ASYNC_FLAG);
+  syn_access('R', PISCSI_CMD_TAG, 32, (uint32_t)queued);
+  if (!queued) {
+    syn_access('R', PISCSI_CMD_DONE_ERR, 32, 0);
+    return;
+  }
+  // The PORTS server of the driver.
+  syn_access('R', PISCSI_CMD_DONE, 32, tag);
+  syn_access('R', PISCSI_CMD_DONE_ERR, 32, 0);
+  syn_access('R', PISCSI_CMD_DONE, 32, 0);
+}
+
+static int generate(const char* path, unsigned int requests, unsigned int mb) {
+  syn = fopen(path, "w");
+  if (!syn) {
+    perror(path);
+    return 1;
+  }
+  uint64_t size = (uint64_t)mb * 1024 * 1024;
+  uint32_t blocks = (uint32_t)(size / 512);
+  uint32_t cyls = (uint32_t)(size / (SYN_HEADS * SYN_SECS * 512));
+  fprintf(syn, "# pistorm piscsi trace %d\n# synthetic: %u requests on a %uMB unit\n",
+          PISCSI_TRACE_VERSION, requests, mb);
+  fprintf(syn, "map %08X %08X\nunit 0 %llu 512 0\nreset\n", SYN_FAST_BASE, SYN_FAST_SIZE,
+          (unsigned long long)size);
+
+  // The boot ROM copies the driver and sets up the partitions, then the
+  // driver probes every unit.
+  syn_access('W', PISCSI_CMD_DRIVER, 32, SYN_FAST_BASE);
+  syn_access('R', PISCSI_CMD_GETPART, 32, SYN_FAST_BASE + 0x4020);
+  syn_access('R', PISCSI_CMD_GETPRIO, 32, (uint32_t)-128);
+  syn_access('W', PISCSI_CMD_NEXTPART, 32, 1);
+  syn_access('R', PISCSI_CMD_GETPART, 32, 0);
+  for (uint32_t u = 0; u < NUM_UNITS; u++) {
+    syn_access('W', PISCSI_CMD_DRVNUM, 16, u);
+    syn_access('R', PISCSI_CMD_DRVTYPE, 16, u == 0 ? 1 : 0);
+    if (u == 0) {
+      syn_access('R', PISCSI_CMD_CYLS, 32, cyls);
+      syn_access('R', PISCSI_CMD_HEADS, 16, SYN_HEADS);
+      syn_access('R', PISCSI_CMD_SECS, 16, SYN_SECS);
+      syn_access('R', PISCSI_CMD_MEDIA, 16, PISCSI_MEDIA_PRESENT);
+      syn_access('R', PISCSI_CMD_BLOCKS, 32, blocks);
+    }
+  }
+  syn_access('R', PISCSI_CMD_ASYNC, 32, PISCSI_ASYNC_DEFAULT_THREADS);
+
+  uint32_t seq = 0, seq_left = 0, writes = 0;
+  for (unsigned int i = 0; i < requests; i++) {
+    uint32_t tag = SYN_IOREQ + (i % 16) * 0x40;
+    uint32_t kind = rnd(100), len = (1 + rnd(8)) * 512, offset;
+    if (kind < 25) {
+      // A file load: up to 1MB in 64KB steps from a random place.
+      if (!seq_left || seq + 65536 > size) {
+        seq = rnd(blocks - 128) * 512;
+        seq_left = 1 + rnd(16);
+      }
+      syn_transfer(0, seq, 65536, SYN_BUFFER, tag);
+      seq += 65536;
+      seq_left--;
+      continue;
+    }
+    uint32_t region = rnd(10) < 9 ? 2 * 1024 * 1024 : (uint32_t)size;
+    offset = rnd((region - 4096) / 512) * 512;
+    if (kind < 70) {
+      syn_transfer(0, offset, len, SYN_BUFFER, tag);
+    } else if (kind < 80) {
+      syn_transfer(0, offset, 4096, SYN_CHIP_BUFFER, tag);
+    } else {
+      syn_transfer(1, offset, len, SYN_BUFFER, tag);
+      if (++writes % 32 == 0) {
+        syn_access('W', PISCSI_CMD_UPDATE, 16, 0);
+      }
+    }
+  }
+  if (fclose(syn) != 0) {
+    perror(path);
+    return 1;
+  }
+  printf("Wrote %u requests to %s.\n", requests, path);
+  return 0;
+}
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "Usage: %s [-i unit=image]... [-d dir] [-m op-us,MB/s] trace\n"
+          "       %s -g trace [requests] [image-MB]\n",
+          name, name);
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "g:i:d:m:")) != -1) {
+    switch (opt) {
+    case 'g': {
+      unsigned int requests = optind < argc ? (unsigned int)atoi(argv[optind]) : 20000;
+      unsigned int mb = optind + 1 < argc ? (unsigned int)atoi(argv[optind + 1]) : 64;
+      if (!requests || mb < 4) {
+        usage(argv[0]);
+      }
+      return generate(optarg, requests, mb);
+    }
+    case 'i': {
+      char* eq = strchr(optarg, '=');
+      int unit = atoi(optarg);
+      if (!eq || unit < 0 || unit >= NUM_UNITS) {
+        usage(argv[0]);
+      }
+      images[unit] = eq + 1;
+      break;
+    }
+    case 'd':
+      scratch_dir = optarg;
+      break;
+    case 'm': {
+      double op_us = 0, mbps = 0;
+      if (sscanf(optarg, "%lf,%lf", &op_us, &mbps) != 2 || op_us < 0 || mbps <= 0) {
+        usage(argv[0]);
+      }
+      piscsi_stub_op_ns = (uint64_t)(op_us * 1000);
+      piscsi_stub_ns_per_kb = (uint64_t)(1024 * 1e3 / mbps);
+      break;
+    }
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+  }
+  // The scratch images are new every run, so their metadata is not kept.
+  setenv("PISTORM_PISCSI_META_CACHE", "off", 0);
+
+  // piscsi.c prints as it goes; keep the report readable.
+  fflush(stdout);
+  FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+  int devnull = open("/dev/null", O_WRONLY);
+  dup2(devnull, STDOUT_FILENO);
+  close(devnull);
+  return run(argv[optind], out);
+}
@@ -0,0 +1,236 @@
+// SPDX-License-Identifier: MIT
+// tools/piscsi_stubs.c
+//
+// The emulator around PiSCSI, for the tools. See piscsi_stubs.h.
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_file/config_file.h"
+#include "log.h"
+#include "metrics/metrics.h"
+#include "platforms/amiga/amiga-interrupts.h"
+#include "piscsi_stubs.h"
+
+struct emulator_config* cfg;
+struct pistorm_metrics pistorm_metrics;
+unsigned char ac_piscsi_rom[32];
+int move_slow_to_chip;
+
+void log_message(int level, const char* fmt, ...) {
+  if (level > LOG_LEVEL_WARN) {
+    return;
+  }
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+int rtg_vram_range(uint32_t address, uint32_t len) {
+  (void)address;
+  (void)len;
+  return 0;
+}
+
+void rtg_async_drain(void) {
+}
+
+void rtg_mark_dirty_addr(uint32_t address, uint32_t len) {
+  (void)address;
+  (void)len;
+}
+
+__attribute__((weak)) void amiga_emulate_irq(AMIGA_IRQ irq) {
+  (void)irq;
+}
+
+__attribute__((weak)) int amiga_emulating_irq(AMIGA_IRQ irq) {
+  (void)irq;
+  return 0;
+}
+
+/* Pi memory. */
+
+uint8_t* piscsi_stub_map(uint32_t base, uint32_t size) {
+  if (!cfg && !(cfg = calloc(1, sizeof(*cfg)))) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(1);
+  }
+  for (int i = 0; i < MAX_NUM_MAPPED_ITEMS; i++) {
+    if (cfg->map_data[i] && cfg->map_offset[i] == base) {
+      return cfg->map_data[i];
+    }
+    if (!cfg->map_data[i]) {
+      cfg->map_data[i] = calloc(1, size);
+      if (!cfg->map_data[i]) {
+        fprintf(stderr, "Out of memory for the %u byte map at %.8X.\n", size, base);
+        exit(1);
+      }
+      cfg->map_type[i] = MAPTYPE_RAM;
+      cfg->map_offset[i] = base;
+      cfg->map_high[i] = (unsigned long)base + size;
+      cfg->map_size[i] = size;
+      return cfg->map_data[i];
+    }
+  }
+  fprintf(stderr, "No room for the map at %.8X.\n", base);
+  exit(1);
+}
+
+__attribute__((weak)) int get_mapped_item_by_address(struct emulator_config* c, uint32_t address) {
+  for (int i = 0; c && i < MAX_NUM_MAPPED_ITEMS; i++) {
+    if (c->map_data[i] && address >= c->map_offset[i] && address < c->map_high[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+__attribute__((weak)) uint8_t* get_mapped_data_pointer_by_address(struct emulator_config* c,
+                                                                   uint32_t address) {
+  int i = get_mapped_item_by_address(c, address);
+  return i == -1 ? NULL : c->map_data[i] + (address - c->map_offset[i]);
+}
+
+/* The bus: everything below 16MB no map covers. */
+
+uint8_t piscsi_stub_bus[PISCSI_STUB_BUS_SIZE];
+uint64_t piscsi_stub_bus_bytes;
+
+__attribute__((weak)) unsigned int m68k_read_memory_8(unsigned int address) {
+  piscsi_stub_bus_bytes++;
+  return address < PISCSI_STUB_BUS_SIZE ? piscsi_stub_bus[address] : 0;
+}
+
+__attribute__((weak)) void m68k_write_memory_8(unsigned int address, unsigned int value) {
+  piscsi_stub_bus_bytes++;
+  if (address < PISCSI_STUB_BUS_SIZE) {
+    piscsi_stub_bus[address] = (uint8_t)value;
+  }
+}
+
+__attribute__((weak)) unsigned int m68k_read_memory_16(unsigned int address) {
+  return m68k_read_memory_8(address) << 8 | m68k_read_memory_8(address + 1);
+}
+
+__attribute__((weak)) unsigned int m68k_read_memory_32(unsigned int address) {
+  return m68k_read_memory_16(address) << 16 | m68k_read_memory_16(address + 2);
+}
+
+__attribute__((weak)) void m68k_write_memory_16(unsigned int address, unsigned int value) {
+  m68k_write_memory_8(address, value >> 8);
+  m68k_write_memory_8(address + 1, value & 0xFF);
+}
+
+__attribute__((weak)) void m68k_write_memory_32(unsigned int address, unsigned int value) {
+  m68k_write_memory_16(address, value >> 16);
+  m68k_write_memory_16(address + 2, value & 0xFFFF);
+}
+
+__attribute__((weak)) void ps_read_block(uint32_t address, uint8_t* dst, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    dst[i] = (uint8_t)m68k_read_memory_8(address + i);
+  }
+}
+
+__attribute__((weak)) void ps_write_block(uint32_t address, const uint8_t* src, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) {
+    m68k_write_memory_8(address + i, src[i]);
+  }
+}
+
+/* System calls on the images, with the storage model. */
+
+struct piscsi_stub_io piscsi_stub_io;
+uint64_t piscsi_stub_op_ns, piscsi_stub_ns_per_kb;
+
+static void storage(uint64_t ops, size_t len) {
+  uint64_t ns = ops * piscsi_stub_op_ns + len * piscsi_stub_ns_per_kb / 1024;
+  if (ns) {
+    struct timespec ts = {(time_t)(ns / 1000000000u), (long)(ns % 1000000000u)};
+    nanosleep(&ts, NULL);
+  }
+}
+
+// --wrap turns these into the libc calls. They are weak so that a tool
+// built without it still links; the wrappers are then never called. With
+// _FILE_OFFSET_BITS=64 glibc may resolve the calls to the *64 names, so both
+// are wrapped.
+__attribute__((weak)) ssize_t __real_pread(int fd, void* buf, size_t len, off_t offset);
+__attribute__((weak)) ssize_t __real_pread64(int fd, void* buf, size_t len, off_t offset);
+__attribute__((weak)) ssize_t __real_pwrite(int fd, const void* buf, size_t len, off_t offset);
+__attribute__((weak)) ssize_t __real_pwrite64(int fd, const void* buf, size_t len, off_t offset);
+__attribute__((weak)) ssize_t __real_pwritev(int fd, const struct iovec* iov, int n, off_t offset);
+__attribute__((weak)) ssize_t __real_pwritev64(int fd, const struct iovec* iov, int n,
+                                               off_t offset);
+__attribute__((weak)) int __real_fdatasync(int fd);
+
+ssize_t __wrap_pread(int fd, void* buf, size_t len, off_t offset);
+ssize_t __wrap_pread64(int fd, void* buf, size_t len, off_t offset);
+ssize_t __wrap_pwrite(int fd, const void* buf, size_t len, off_t offset);
+ssize_t __wrap_pwrite64(int fd, const void* buf, size_t len, off_t offset);
+ssize_t __wrap_pwritev(int fd, const struct iovec* iov, int n, off_t offset);
+ssize_t __wrap_pwritev64(int fd, const struct iovec* iov, int n, off_t offset);
+int __wrap_fdatasync(int fd);
+
+static void count_read(size_t len) {
+  __atomic_fetch_add(&piscsi_stub_io.pread, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&piscsi_stub_io.read, len, __ATOMIC_RELAXED);
+  storage(1, len);
+}
+
+static void count_write(uint64_t* calls, size_t len) {
+  __atomic_fetch_add(calls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&piscsi_stub_io.written, len, __ATOMIC_RELAXED);
+  storage(1, len);
+}
+
+static size_t iov_len(const struct iovec* iov, int n) {
+  size_t len = 0;
+  for (int i = 0; i < n; i++) {
+    len += iov[i].iov_len;
+  }
+  return len;
+}
+
+ssize_t __wrap_pread(int fd, void* buf, size_t len, off_t offset) {
+  count_read(len);
+  return __real_pread(fd, buf, len, offset);
+}
+
+ssize_t __wrap_pread64(int fd, void* buf, size_t len, off_t offset) {
+  count_read(len);
+  return __real_pread64(fd, buf, len, offset);
+}
+
+ssize_t __wrap_pwrite(int fd, const void* buf, size_t len, off_t offset) {
+  count_write(&piscsi_stub_io.pwrite, len);
+  return __real_pwrite(fd, buf, len, offset);
+}
+
+ssize_t __wrap_pwrite64(int fd, const void* buf, size_t len, off_t offset) {
+  count_write(&piscsi_stub_io.pwrite, len);
+  return __real_pwrite64(fd, buf, len, offset);
+}
+
+ssize_t __wrap_pwritev(int fd, const struct iovec* iov, int n, off_t offset) {
+  count_write(&piscsi_stub_io.pwritev, iov_len(iov, n));
+  return __real_pwritev(fd, iov, n, offset);
+}
+
+ssize_t __wrap_pwritev64(int fd, const struct iovec* iov, int n, off_t offset) {
+  count_write(&piscsi_stub_io.pwritev, iov_len(iov, n));
+  return __real_pwritev64(fd, iov, n, offset);
+}
+
+int __wrap_fdatasync(int fd) {
+  __atomic_fetch_add(&piscsi_stub_io.sync, 1, __ATOMIC_RELAXED);
+  storage(10, 0);
+  return __real_fdatasync(fd);
+}
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: MIT
+// tools/piscsi_stubs.h
+//
+// What the PiSCSI code links against in the emulator, for the tools that run
+// it on its own (tools/piscsi_*.c, linked with tools/piscsi_stubs.c by every
+// build_piscsi*.sh). log_message() prints warnings and errors to stderr and
+// RTG is absent, so reads never land in VRAM.
+//
+// The Amiga side is plain memory: the ranges given to piscsi_stub_map() are
+// Pi memory piscsi.c transfers to directly, as the emulator's RAM maps, and
+// everything else below 16MB is piscsi_stub_bus, reached a byte at a time
+// through m68k_*_memory_* and ps_*_block (chip RAM). PORTS goes nowhere.
+// These are weak, so a tool defines its own where it needs something else.
+//
+// Linked with -Wl,--wrap= for pread, pread64, pwrite, pwrite64, pwritev,
+// pwritev64 and fdatasync, those calls are counted in piscsi_stub_io and
+// take the time of the storage model: piscsi_stub_op_ns per call (ten times
+// that for fdatasync) plus piscsi_stub_ns_per_kb per KB moved. Both are 0,
+// no delay, until a tool sets them. Without the flags nothing is wrapped.
+
+#ifndef PISTORM_TOOLS_PISCSI_STUBS_H
+#define PISTORM_TOOLS_PISCSI_STUBS_H
+
+#include <stdint.h>
+
+#define PISCSI_STUB_BUS_SIZE (16u * 1024u * 1024u)
+
+extern uint8_t piscsi_stub_bus[PISCSI_STUB_BUS_SIZE];
+extern uint64_t piscsi_stub_bus_bytes; // bytes moved over the bus
+
+// Pi memory for the 68k range [base, base + size), zeroed the first time
+// and the same memory when the range is asked for again.
+uint8_t* piscsi_stub_map(uint32_t base, uint32_t size);
+
+struct piscsi_stub_io {
+  uint64_t pread, pwrite, pwritev, sync; // calls
+  uint64_t read, written;                // bytes
+};
+
+extern struct piscsi_stub_io piscsi_stub_io;
+extern uint64_t piscsi_stub_op_ns, piscsi_stub_ns_per_kb;
+
+#endif /* PISTORM_TOOLS_PISCSI_STUBS_H */
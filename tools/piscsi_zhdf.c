@@ -0,0 +1,251 @@
+// SPDX-License-Identifier: MIT
+// tools/piscsi_zhdf.c
+//
+// Converts PiSCSI hard files to and from the compressed .zhdf format
+// (piscsi-zhdf.h). Stop the emulator, or unmap the unit, before converting
+// an image it uses.
+//
+//   piscsi_zhdf pack <image> <new.zhdf> [chunk-KB] [level]
+//       compress a hard file, or repack a .zhdf with other settings or to
+//       give back the space rewritten chunks left behind
+//   piscsi_zhdf unpack <image.zhdf> <new-image>
+//       write the image out as a flat hard file, zeroes as holes
+//   piscsi_zhdf info <image.zhdf>
+//       the settings, how the chunks are stored and the compression ratio
+
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "platforms/amiga/piscsi/piscsi-zhdf.h"
+
+#define BLOCK (1024 * 1024)
+#define CACHE_MB 4
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int usage(void) {
+  fprintf(stderr, "Usage: piscsi_zhdf pack <image> <new.zhdf> [chunk-KB] [level]\n"
+                  "       piscsi_zhdf unpack <image.zhdf> <new-image>\n"
+                  "       piscsi_zhdf info <image.zhdf>\n");
+  return 2;
+}
+
+static int is_zero(const uint8_t* p, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (p[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// An image to read: a flat hard file, or a .zhdf through its index.
+struct source {
+  int fd;
+  struct piscsi_zhdf* z;
+  uint64_t size;
+};
+
+static int open_source(const char* path, struct source* s) {
+  struct piscsi_zhdf_header h;
+  s->z = NULL;
+  s->fd = open(path, O_RDONLY);
+  if (s->fd < 0) {
+    perror(path);
+    return -1;
+  }
+  int r = piscsi_zhdf_read_header(s->fd, &h);
+  if (r > 0 && !(s->z = piscsi_zhdf_open(s->fd, 0, CACHE_MB))) {
+    r = -1;
+  }
+  if (r < 0) {
+    fprintf(stderr, "%s: not a usable .zhdf image\n", path);
+    close(s->fd);
+    return -1;
+  }
+  s->size = s->z ? piscsi_zhdf_size(s->z) : (uint64_t)lseek(s->fd, 0, SEEK_END);
+  return 0;
+}
+
+static ssize_t read_source(struct source* s, uint8_t* buf, size_t len, uint64_t offset) {
+  if (s->z) {
+    return piscsi_zhdf_pread(s->z, buf, len, offset);
+  }
+  size_t pos = 0;
+  while (pos < len) {
+    ssize_t n = pread(s->fd, buf + pos, len - pos, (off_t)(offset + pos));
+    if (n <= 0) {
+      return n < 0 ? -1 : (ssize_t)pos;
+    }
+    pos += (size_t)n;
+  }
+  return (ssize_t)pos;
+}
+
+static void close_source(struct source* s) {
+  piscsi_zhdf_close(s->z);
+  close(s->fd);
+}
+
+static int pack(const char* in, const char* out, uint32_t chunk, int level) {
+  struct source s;
+  if (open_source(in, &s) < 0) {
+    return -1;
+  }
+  uint8_t* buf = malloc(BLOCK);
+  struct piscsi_zhdf* z = NULL;
+  int fd = -1, ret = -1;
+  // Never over an existing file, which could be the input.
+  if (!buf || access(out, F_OK) == 0) {
+    fprintf(stderr, "%s exists\n", out);
+    goto done;
+  }
+  if (piscsi_zhdf_create(out, s.size, chunk, level) < 0 || (fd = open(out, O_RDWR)) < 0 ||
+      !(z = piscsi_zhdf_open(fd, 1, CACHE_MB))) {
+    perror(out);
+    goto done;
+  }
+  ret = 0;
+  for (uint64_t pos = 0; !ret && pos < s.size; pos += BLOCK) {
+    size_t n = s.size - pos < BLOCK ? (size_t)(s.size - pos) : BLOCK;
+    if (read_source(&s, buf, n, pos) != (ssize_t)n) {
+      perror(in);
+      ret = -1;
+    } else if (!is_zero(buf, n) && piscsi_zhdf_pwrite(z, buf, n, pos) != (ssize_t)n) {
+      // A new image is all zeroes already.
+      perror(out);
+      ret = -1;
+    }
+  }
+  if (!ret && piscsi_zhdf_sync(z) < 0) {
+    perror(out);
+    ret = -1;
+  }
+
+done:
+  piscsi_zhdf_close(z);
+  if (fd >= 0) {
+    close(fd);
+    if (ret) {
+      unlink(out);
+    }
+  }
+  free(buf);
+  close_source(&s);
+  return ret;
+}
+
+static int unpack(const char* in, const char* out) {
+  struct source s;
+  if (open_source(in, &s) < 0) {
+    return -1;
+  }
+  uint8_t* buf = malloc(BLOCK);
+  int fd = buf ? open(out, O_WRONLY | O_CREAT | O_EXCL, 0644) : -1;
+  int ret = fd < 0 || ftruncate(fd, (off_t)s.size) < 0 ? -1 : 0;
+  if (ret) {
+    perror(out);
+  }
+  for (uint64_t pos = 0; !ret && pos < s.size; pos += BLOCK) {
+    size_t n = s.size - pos < BLOCK ? (size_t)(s.size - pos) : BLOCK;
+    if (read_source(&s, buf, n, pos) != (ssize_t)n) {
+      perror(in);
+      ret = -1;
+    } else if (!is_zero(buf, n) && pwrite(fd, buf, n, (off_t)pos) != (ssize_t)n) {
+      perror(out);
+      ret = -1;
+    }
+  }
+  if (!ret && fdatasync(fd) < 0) {
+    perror(out);
+    ret = -1;
+  }
+  if (fd >= 0) {
+    close(fd);
+    if (ret) {
+      unlink(out);
+    }
+  }
+  free(buf);
+  close_source(&s);
+  return ret;
+}
+
+static int info(const char* path) {
+  struct piscsi_zhdf_header h;
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return 1;
+  }
+  if (piscsi_zhdf_read_header(fd, &h) <= 0) {
+    fprintf(stderr, "%s: not a usable .zhdf image\n", path);
+    close(fd);
+    return 1;
+  }
+  uint64_t chunks = (h.size + h.chunk_size - 1) / h.chunk_size;
+  uint64_t zero = 0, raw = 0, packed = 0, stored = 0;
+  struct piscsi_zhdf_entry* index = malloc(chunks * sizeof(*index));
+  if (!index || pread(fd, index, chunks * sizeof(*index), (off_t)h.index_offset) !=
+                    (ssize_t)(chunks * sizeof(*index))) {
+    perror(path);
+    return 1;
+  }
+  for (uint64_t i = 0; i < chunks; i++) {
+    uint32_t len = le32toh(index[i].length);
+    zero += !len;
+    raw += len == h.chunk_size;
+    packed += len && len != h.chunk_size;
+    stored += len;
+  }
+  free(index);
+  fstat(fd, &st);
+  close(fd);
+  printf("%s: %lluMB image, %uKB chunks, level %u\n", path, (unsigned long long)(h.size >> 20),
+         h.chunk_size / 1024, h.level);
+  printf("chunks: %llu compressed, %llu stored as they are, %llu zeroes\n",
+         (unsigned long long)packed, (unsigned long long)raw, (unsigned long long)zero);
+  printf("data %lluMB, file %lluMB: %.2f:1 (%.2f:1 without the zeroes)\n",
+         (unsigned long long)(stored >> 20), (unsigned long long)(st.st_size >> 20),
+         (double)h.size / (double)st.st_size,
+         stored ? (double)((chunks - zero) * h.chunk_size) / (double)stored : 0.0);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    return usage();
+  }
+  const char* cmd = argv[1];
+  double t0 = now_s();
+  int r;
+  if (!strcmp(cmd, "pack") && argc >= 4 && argc <= 6) {
+    r = pack(argv[2], argv[3], argc > 4 ? (uint32_t)strtoul(argv[4], NULL, 0) * 1024 : 0,
+             argc > 5 ? atoi(argv[5]) : 0);
+  } else if (!strcmp(cmd, "unpack") && argc == 4) {
+    r = unpack(argv[2], argv[3]);
+  } else if (!strcmp(cmd, "info") && argc == 3) {
+    return info(argv[2]);
+  } else {
+    return usage();
+  }
+  if (r < 0) {
+    return 1;
+  }
+  printf("%s: done in %.3fs\n", cmd, now_s() - t0);
+  return 0;
+}
@@ -0,0 +1,352 @@
+// SPDX-License-Identifier: MIT
+// tools/piscsi_zhdf_bench.c
+//
+// Compares a PiSCSI unit on a flat hard file with one on the same image
+// compressed (piscsi-zhdf.c), with 16KB and 64KB chunks and with the cache
+// of decompressed chunks cut to a few chunks. The image is a mix of zeroes,
+// text-like data and random data, a quarter, half and a quarter of it. It
+// reports:
+//
+//  - the time to pack the image and the compression ratio;
+//  - throughput per access pattern, sequential and random, including random
+//    reads over a range that fits in the cache ("hot");
+//  - the time to unpack the image again.
+//
+// Every read is checked against what the image should hold, and after the
+// writes the image is checked again from a fresh open and after unpacking
+// it. Any mismatch makes the exit code 1. The page cache is dropped between
+// runs, which only matters when [dir] is on a real disk, not tmpfs.
+//
+// Usage: piscsi_zhdf_bench [image-MB] [dir]
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "platforms/amiga/piscsi/piscsi-zhdf.h"
+
+#define MAX_LEN (64u * 1024u)
+#define RANDOM_OPS 8000
+#define HOT_RANGE (4u * 1024u * 1024u)
+#define CHECK_BLOCK (1024u * 1024u)
+
+static uint64_t image_size;
+static char raw_path[512], zhdf_path[512], out_path[512];
+static uint8_t* ref;  // the image as the unit should read it
+static uint8_t* orig; // ... as it was made
+static uint8_t buf[CHECK_BLOCK];
+static unsigned int failures;
+
+static uint32_t rng = 0x1234567;
+static uint32_t rnd(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void fail(const char* what) {
+  if (failures++ < 10) {
+    fprintf(stderr, "%s\n", what);
+  }
+}
+
+static void drop_cache(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+// Text-like data: words from a small vocabulary, as in the files and
+// executables on a typical Workbench partition.
+static void fill_text(uint8_t* p, size_t len) {
+  static const char* words[] = {"the ", "Workbench ", "LIBS:", "dos.library ", "Assign ",
+                                "\n", "0x0000 ", "FastFileSystem ", "c/", "Startup-Sequence ",
+                                "; ", "Resident ", "IF EXISTS ", "ENDIF\n", "\0\0\0\0"};
+  size_t pos = 0;
+  while (pos < len) {
+    const char* w = words[rnd() % (sizeof(words) / sizeof(words[0]))];
+    size_t n = strlen(w) ? strlen(w) : 4;
+    for (size_t i = 0; i < n && pos < len; i++) {
+      p[pos++] = (uint8_t)w[i];
+    }
+  }
+}
+
+static void make_image(uint8_t* p) {
+  for (uint64_t pos = 0; pos < image_size; pos += MAX_LEN) {
+    uint32_t kind = rnd() % 4;
+    if (kind == 0) {
+      memset(p + pos, 0, MAX_LEN);
+    } else if (kind == 3) {
+      for (uint32_t i = 0; i < MAX_LEN; i++) {
+        p[pos + i] = (uint8_t)rnd();
+      }
+    } else {
+      fill_text(p + pos, MAX_LEN);
+    }
+  }
+}
+
+static int open_unit(const char* path) {
+  drop_cache(path);
+  int fd = open(path, O_RDWR);
+  uint64_t size = 0;
+  if (fd < 0 || piscsi_zhdf_attach(0, fd, &size) < 0) {
+    perror(path);
+    exit(1);
+  }
+  return fd;
+}
+
+static void close_unit(int fd) {
+  piscsi_zhdf_detach(0);
+  close(fd);
+}
+
+// One pass of `len`-byte commands over the first `range` bytes of the unit.
+// Returns MB/s.
+static double run(int fd, int write, int sequential, uint32_t len, uint64_t range) {
+  uint64_t blocks = range / len;
+  unsigned int ops = sequential ? (unsigned int)blocks : RANDOM_OPS;
+  double t0 = now_s();
+  for (unsigned int i = 0; i < ops; i++) {
+    uint64_t offset = (sequential ? i : rnd() % blocks) * len;
+    ssize_t n;
+    if (write) {
+      // Text, so that written chunks compress like the image.
+      fill_text(buf, len);
+      n = piscsi_zhdf_write(0, fd, buf, len, offset);
+      memcpy(ref + offset, buf, len);
+    } else {
+      n = piscsi_zhdf_read(0, fd, buf, len, offset);
+    }
+    if (n != (ssize_t)len || (!write && memcmp(buf, ref + offset, len) != 0)) {
+      fail(write ? "A write failed." : "A read returned the wrong data.");
+    }
+  }
+  if (write) {
+    piscsi_zhdf_unit_sync(0, fd);
+  }
+  return (double)len * ops / (now_s() - t0) / (1024.0 * 1024.0);
+}
+
+static void check_unit(const char* path, const char* what) {
+  int fd = open_unit(path);
+  for (uint64_t pos = 0; pos < image_size; pos += CHECK_BLOCK) {
+    if (piscsi_zhdf_read(0, fd, buf, CHECK_BLOCK, pos) != CHECK_BLOCK ||
+        memcmp(buf, ref + pos, CHECK_BLOCK) != 0) {
+      fail(what);
+      break;
+    }
+  }
+  close_unit(fd);
+}
+
+struct pattern {
+  const char* name;
+  int write, sequential;
+  uint32_t len;
+  int hot;
+};
+
+static const struct pattern patterns[] = {
+    {"read seq 64K", 0, 1, MAX_LEN, 0}, {"read rand 4K", 0, 0, 4096, 0},
+    {"read hot 4K", 0, 0, 4096, 1},     {"write seq 64K", 1, 1, MAX_LEN, 0},
+    {"write rand 4K", 1, 0, 4096, 0},   {"read rand 4K", 0, 0, 4096, 0},
+};
+#define NUM_PATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+
+struct config {
+  const char* name;
+  uint32_t chunk;
+  unsigned int cache_mb; // 0: the smallest cache
+};
+
+static const struct config configs[] = {
+    {"zhdf-16K", 16 * 1024, PISCSI_ZHDF_DEFAULT_CACHE},
+    {"zhdf-64K", 64 * 1024, PISCSI_ZHDF_DEFAULT_CACHE},
+    {"64K-nocache", 64 * 1024, 0},
+};
+#define NUM_CONFIGS (sizeof(configs) / sizeof(configs[0]))
+
+// Write `data` as a flat image at `path`.
+static void write_raw(const char* path, const uint8_t* data) {
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || pwrite(fd, data, image_size, 0) != (ssize_t)image_size) {
+    perror(path);
+    exit(1);
+  }
+  fdatasync(fd);
+  close(fd);
+}
+
+// Pack the flat image at `raw_path` into `zhdf_path`, as tools/piscsi_zhdf
+// does. Returns the seconds it took.
+static double pack(uint32_t chunk) {
+  drop_cache(raw_path);
+  double t0 = now_s();
+  int in = open(raw_path, O_RDONLY);
+  int fd = -1;
+  struct piscsi_zhdf* z = NULL;
+  if (in < 0 || piscsi_zhdf_create(zhdf_path, image_size, chunk, 0) < 0 ||
+      (fd = open(zhdf_path, O_RDWR)) < 0 || !(z = piscsi_zhdf_open(fd, 1, 4))) {
+    perror(zhdf_path);
+    exit(1);
+  }
+  for (uint64_t pos = 0; pos < image_size; pos += CHECK_BLOCK) {
+    if (pread(in, buf, CHECK_BLOCK, (off_t)pos) != CHECK_BLOCK ||
+        piscsi_zhdf_pwrite(z, buf, CHECK_BLOCK, pos) != CHECK_BLOCK) {
+      fail("Packing the image failed.");
+      break;
+    }
+  }
+  piscsi_zhdf_close(z);
+  close(fd);
+  close(in);
+  return now_s() - t0;
+}
+
+// Unpack `zhdf_path` to `out_path` and compare it with ref. Returns the
+// seconds the unpacking took.
+static double unpack(void) {
+  drop_cache(zhdf_path);
+  double t0 = now_s();
+  int in = open(zhdf_path, O_RDONLY);
+  int out = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  struct piscsi_zhdf* z = in < 0 ? NULL : piscsi_zhdf_open(in, 0, 4);
+  if (!z || out < 0 || ftruncate(out, (off_t)image_size) < 0) {
+    perror(out_path);
+    exit(1);
+  }
+  for (uint64_t pos = 0; pos < image_size; pos += CHECK_BLOCK) {
+    if (piscsi_zhdf_pread(z, buf, CHECK_BLOCK, pos) != CHECK_BLOCK ||
+        pwrite(out, buf, CHECK_BLOCK, (off_t)pos) != CHECK_BLOCK) {
+      fail("Unpacking the image failed.");
+      break;
+    }
+  }
+  fdatasync(out);
+  double t = now_s() - t0;
+  piscsi_zhdf_close(z);
+  close(in);
+  for (uint64_t pos = 0; pos < image_size; pos += CHECK_BLOCK) {
+    if (pread(out, buf, CHECK_BLOCK, (off_t)pos) != CHECK_BLOCK ||
+        memcmp(buf, ref + pos, CHECK_BLOCK) != 0) {
+      fail("The unpacked image differs.");
+      break;
+    }
+  }
+  close(out);
+  unlink(out_path);
+  return t;
+}
+
+static double file_mb(const char* path) {
+  struct stat st;
+  return stat(path, &st) == 0 ? (double)st.st_size / (1024.0 * 1024.0) : 0;
+}
+
+// The patterns on a unit from `path`. `ref` must hold the image.
+static void run_unit(const char* path, double* mbs) {
+  int fd = open_unit(path);
+  for (unsigned int p = 0; p < NUM_PATTERNS; p++) {
+    uint64_t range = patterns[p].hot ? HOT_RANGE : image_size;
+    if (patterns[p].hot) {
+      run(fd, 0, 1, MAX_LEN, range); // warm the cache
+    }
+    mbs[p] = run(fd, patterns[p].write, patterns[p].sequential, patterns[p].len, range);
+  }
+  close_unit(fd);
+  check_unit(path, "The image differs after the writes.");
+}
+
+int main(int argc, char** argv) {
+  image_size = (argc > 1 ? strtoull(argv[1], NULL, 0) : 128) * 1024 * 1024;
+  const char* dir = argc > 2 ? argv[2] : "/tmp";
+  snprintf(raw_path, sizeof(raw_path), "%s/piscsi_zhdf_bench.hdf", dir);
+  snprintf(zhdf_path, sizeof(zhdf_path), "%s/piscsi_zhdf_bench.zhdf", dir);
+  snprintf(out_path, sizeof(out_path), "%s/piscsi_zhdf_bench_out.hdf", dir);
+  if (image_size < HOT_RANGE) {
+    fprintf(stderr, "The image must be at least %uMB.\n", HOT_RANGE >> 20);
+    return 2;
+  }
+
+  ref = malloc(image_size);
+  orig = malloc(image_size);
+  if (!ref || !orig) {
+    perror("malloc");
+    return 1;
+  }
+  make_image(orig);
+  printf("%lluMB image in %s: 1/4 zeroes, 1/2 text, 1/4 random\n\n",
+         (unsigned long long)(image_size >> 20), dir);
+
+  double raw[NUM_PATTERNS], z[NUM_CONFIGS][NUM_PATTERNS];
+  memcpy(ref, orig, image_size);
+  write_raw(raw_path, orig);
+  run_unit(raw_path, raw);
+  for (unsigned int c = 0; c < NUM_CONFIGS; c++) {
+    memcpy(ref, orig, image_size);
+    write_raw(raw_path, orig);
+    double t_pack = pack(configs[c].chunk);
+    double mb = file_mb(zhdf_path);
+    double t_unpack = unpack();
+    printf("%-12s pack %.3fs, unpack %.3fs, %.1fMB, ratio %.2f:1\n", configs[c].name, t_pack,
+           t_unpack, mb, (double)image_size / (1024.0 * 1024.0) / mb);
+    piscsi_zhdf_set_cache(configs[c].cache_mb);
+    run_unit(zhdf_path, z[c]);
+    if (c == NUM_CONFIGS - 1) {
+      unpack();
+      printf("%-12s %.1fMB after the writes\n", "", file_mb(zhdf_path));
+    }
+  }
+
+  printf("\n%-16s %11s", "MB/s", "raw");
+  for (unsigned int c = 0; c < NUM_CONFIGS; c++) {
+    printf(" %11s", configs[c].name);
+  }
+  printf("\n");
+  for (unsigned int p = 0; p < NUM_PATTERNS; p++) {
+    printf("%-16s %11.1f", patterns[p].name, raw[p]);
+    for (unsigned int c = 0; c < NUM_CONFIGS; c++) {
+      printf(" %11.1f", z[c][p]);
+    }
+    printf("\n");
+  }
+
+  struct piscsi_zhdf_stats st;
+  piscsi_zhdf_stop();
+  piscsi_zhdf_get_stats(&st);
+  printf("\n%llu chunks decompressed, %llu cache hits, %llu compressed (%lluMB to %lluMB), "
+         "%llu index saves, %llu errors\n",
+         (unsigned long long)st.inflated, (unsigned long long)st.hits,
+         (unsigned long long)st.deflated, (unsigned long long)(st.bytes_in >> 20),
+         (unsigned long long)(st.bytes_out >> 20), (unsigned long long)st.index_saves,
+         (unsigned long long)st.errors);
+
+  unlink(raw_path);
+  unlink(zhdf_path);
+  if (failures || st.errors) {
+    printf("%u failures\n", failures);
+    return 1;
+  }
+  printf("All reads returned the expected data, and every image read back as written and "
+         "unpacked to the expected hard file.\n");
+  return 0;
+}
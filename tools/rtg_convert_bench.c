@@ -0,0 +1,316 @@
+// SPDX-License-Identifier: MIT
+// tools/rtg_convert_bench.c
+//
+// Throughput of the RTG display-thread pixel converters, per format, in
+// megapixels per second: the old per-pixel switch loop from
+// rtg-output-raylib.c, the scalar row converters and the best (NEON when
+// built for it) row converters. Every converter's output is compared with
+// the old loop first; any mismatch is reported and makes the exit code 1.
+
+#include <endian.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "src/platforms/amiga/rtg/rtg-convert.h"
+#include "src/platforms/amiga/rtg/rtg_enums.h"
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Reference: the converters as they were written inline in the display
+ * thread, format switch inside the pixel loop.
+ */
+
+static inline uint16_t ref_load_u16_be(const uint8_t* p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof v);
+  return be16toh(v);
+}
+
+static inline uint16_t ref_load_u16_le(const uint8_t* p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof v);
+  return le16toh(v);
+}
+
+static inline uint32_t ref_load_u32_be(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof v);
+  return be32toh(v);
+}
+
+static inline uint16_t ref_rgb555_to_rgb565(uint16_t v) {
+  uint16_t r = (v >> 10) & 0x1F;
+  uint16_t g = (v >> 5) & 0x1F;
+  uint16_t b = v & 0x1F;
+  uint16_t g6 = (uint16_t)((g << 1) | (g >> 4));
+  return (uint16_t)((r << 11) | (g6 << 5) | b);
+}
+
+static inline uint16_t ref_bgr565_to_rgb565(uint16_t v) {
+  uint16_t b = (v >> 11) & 0x1F;
+  uint16_t g = (v >> 5) & 0x3F;
+  uint16_t r = v & 0x1F;
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static inline uint16_t ref_bgr555_to_rgb565(uint16_t v) {
+  uint16_t b = (v >> 10) & 0x1F;
+  uint16_t g = (v >> 5) & 0x1F;
+  uint16_t r = v & 0x1F;
+  uint16_t g6 = (uint16_t)((g << 1) | (g >> 4));
+  return (uint16_t)((r << 11) | (g6 << 5) | b);
+}
+
+static inline uint8_t ref_clamp_u8(int v) {
+  return v < 0 ? 0 : (v > 255 ? 255 : (uint8_t)v);
+}
+
+static inline uint32_t ref_yuv601_to_rgba(uint8_t y, uint8_t u, uint8_t v) {
+  int c = (int)y - 16;
+  int d = (int)u - 128;
+  int e = (int)v - 128;
+  int r = (298 * c + 409 * e + 128) >> 8;
+  int g = (298 * c - 100 * d - 208 * e + 128) >> 8;
+  int b = (298 * c + 516 * d + 128) >> 8;
+  return 0xFF000000u | ((uint32_t)ref_clamp_u8(r) << 16) | ((uint32_t)ref_clamp_u8(g) << 8) |
+         (uint32_t)ref_clamp_u8(b);
+}
+
+static void ref_convert_16(uint16_t format, uint16_t* dst, const uint8_t* mem, unsigned int width,
+                           unsigned int height, size_t pitch) {
+  size_t src_stride = pitch / 2;
+  for (unsigned int y = 0; y < height; y++) {
+    for (unsigned int x = 0; x < width; x++) {
+      const uint8_t* src_ptr = mem + (x + (y * src_stride)) * sizeof(uint16_t);
+      uint16_t rgb565 = 0;
+      switch (format) {
+      case RTGFMT_RGB565_BE:
+        rgb565 = ref_load_u16_be(src_ptr);
+        break;
+      case RTGFMT_RGB555_BE:
+        rgb565 = ref_rgb555_to_rgb565(ref_load_u16_be(src_ptr));
+        break;
+      case RTGFMT_RGB555_LE:
+        rgb565 = ref_rgb555_to_rgb565(ref_load_u16_le(src_ptr));
+        break;
+      case RTGFMT_BGR565_LE:
+        rgb565 = ref_bgr565_to_rgb565(ref_load_u16_le(src_ptr));
+        break;
+      case RTGFMT_BGR555_LE:
+        rgb565 = ref_bgr555_to_rgb565(ref_load_u16_le(src_ptr));
+        break;
+      default:
+        rgb565 = ref_load_u16_le(src_ptr);
+        break;
+      }
+      dst[x + (y * width)] = rgb565;
+    }
+  }
+}
+
+static void ref_convert_yuv(uint16_t format, uint32_t* out, const uint8_t* mem, unsigned int width,
+                            unsigned int height, size_t pitch) {
+  for (unsigned int y = 0; y < height; y++) {
+    const uint8_t* src = mem + pitch * y;
+    uint32_t* dst = out + (size_t)width * y;
+    unsigned int x = 0;
+    if (format == RTGFMT_YUV411 || format == RTGFMT_YUV411_PC) {
+      for (; x + 3 < width; x += 4) {
+        uint32_t pack = ref_load_u32_be(src);
+        if (format == RTGFMT_YUV411_PC) {
+          pack = __builtin_bswap32(pack);
+        }
+        uint8_t u6 = (uint8_t)((pack >> 26) & 0x3F);
+        uint8_t ya = (uint8_t)((pack >> 21) & 0x1F);
+        uint8_t yb = (uint8_t)((pack >> 16) & 0x1F);
+        uint8_t v6 = (uint8_t)((pack >> 10) & 0x3F);
+        uint8_t yc = (uint8_t)((pack >> 5) & 0x1F);
+        uint8_t yd = (uint8_t)(pack & 0x1F);
+        uint8_t u0 = (uint8_t)((u6 << 2) | (u6 >> 4));
+        uint8_t v0 = (uint8_t)((v6 << 2) | (v6 >> 4));
+        dst[x] = ref_yuv601_to_rgba((uint8_t)((ya << 3) | (ya >> 2)), u0, v0);
+        dst[x + 1] = ref_yuv601_to_rgba((uint8_t)((yb << 3) | (yb >> 2)), u0, v0);
+        dst[x + 2] = ref_yuv601_to_rgba((uint8_t)((yc << 3) | (yc >> 2)), u0, v0);
+        dst[x + 3] = ref_yuv601_to_rgba((uint8_t)((yd << 3) | (yd >> 2)), u0, v0);
+        src += 4;
+      }
+      for (; x < width; x++) {
+        dst[x] = ref_yuv601_to_rgba(src[0], 128, 128);
+        src++;
+      }
+      continue;
+    }
+    for (; x + 1 < width; x += 2) {
+      uint8_t b0 = src[0], b1 = src[1], b2 = src[2], b3 = src[3];
+      uint8_t y0 = 0, y1 = 0, u0 = 128, v0 = 128;
+      switch (format) {
+      case RTGFMT_YUV422_CGX:
+        y0 = b0; v0 = b1; y1 = b2; u0 = b3;
+        break;
+      case RTGFMT_YUV422:
+        y1 = b0; u0 = b1; y0 = b2; v0 = b3;
+        break;
+      case RTGFMT_YUV422_PC:
+        v0 = b0; y0 = b1; u0 = b2; y1 = b3;
+        break;
+      case RTGFMT_YUV422_PA:
+        y0 = b0; y1 = b1; v0 = b2; u0 = b3;
+        break;
+      case RTGFMT_YUV422_PAPC:
+        u0 = b0; v0 = b1; y1 = b2; y0 = b3;
+        break;
+      default:
+        y0 = b0; v0 = b1; y1 = b2; u0 = b3;
+        break;
+      }
+      dst[x] = ref_yuv601_to_rgba(y0, u0, v0);
+      dst[x + 1] = ref_yuv601_to_rgba(y1, u0, v0);
+      src += 4;
+    }
+    if (x < width) {
+      dst[x] = ref_yuv601_to_rgba(src[0], 128, 128);
+    }
+  }
+}
+
+static void ref_convert_clut(uint32_t* out, const uint8_t* mem, const uint32_t* palette,
+                             unsigned int width, unsigned int height, size_t pitch) {
+  for (unsigned int y = 0; y < height; y++) {
+    const uint8_t* src = mem + pitch * y;
+    uint32_t* dst = out + (size_t)width * y;
+    for (unsigned int x = 0; x < width; x++) {
+      dst[x] = palette[src[x]];
+    }
+  }
+}
+
+static void ref_convert(uint16_t format, void* dst, const uint8_t* mem, const uint32_t* palette,
+                        unsigned int width, unsigned int height, size_t pitch) {
+  if (format == RTGFMT_8BIT_CLUT) {
+    ref_convert_clut(dst, mem, palette, width, height, pitch);
+  } else if (rtg_convert_dst_bpp(format) == 2) {
+    ref_convert_16(format, dst, mem, width, height, pitch);
+  } else {
+    ref_convert_yuv(format, dst, mem, width, height, pitch);
+  }
+}
+
+static void row_convert(rtg_convert_fn fn, size_t dst_bpp, void* dst, const uint8_t* mem,
+                        const uint32_t* palette, unsigned int width, unsigned int height,
+                        size_t pitch) {
+  for (unsigned int y = 0; y < height; y++) {
+    fn((uint8_t*)dst + (size_t)y * width * dst_bpp, mem + pitch * y, width, palette);
+  }
+}
+
+static const struct {
+  uint16_t format;
+  const char* name;
+  unsigned int src_bits; // bits per source pixel
+} formats[] = {
+    {RTGFMT_RGB565_BE, "RGB565_BE", 16},   {RTGFMT_RGB555_BE, "RGB555_BE", 16},
+    {RTGFMT_RGB555_LE, "RGB555_LE", 16},   {RTGFMT_BGR565_LE, "BGR565_LE", 16},
+    {RTGFMT_BGR555_LE, "BGR555_LE", 16},   {RTGFMT_YUV422_CGX, "YUV422_CGX", 16},
+    {RTGFMT_YUV422, "YUV422", 16},         {RTGFMT_YUV422_PC, "YUV422_PC", 16},
+    {RTGFMT_YUV422_PA, "YUV422_PA", 16},   {RTGFMT_YUV422_PAPC, "YUV422_PAPC", 16},
+    {RTGFMT_YUV411, "YUV411", 8},          {RTGFMT_YUV411_PC, "YUV411_PC", 8},
+    {RTGFMT_8BIT_CLUT, "8BIT_CLUT", 8},
+};
+
+int main(int argc, char* argv[]) {
+  unsigned int width = 1920;
+  unsigned int height = 1080;
+  unsigned int iters = 20;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) {
+      width = (unsigned int)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--height") == 0 && i + 1 < argc) {
+      height = (unsigned int)strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--iters") == 0 && i + 1 < argc) {
+      iters = (unsigned int)strtoul(argv[++i], NULL, 0);
+    } else {
+      fprintf(stderr, "usage: %s [--width N] [--height N] [--iters N]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (!width || !height || !iters) {
+    fprintf(stderr, "width, height and iters must be non-zero\n");
+    return 2;
+  }
+
+  // Pad each row like a real RTG pitch so row starts are not all aligned.
+  size_t pitch = ((size_t)width * 2) + 6;
+  size_t src_size = pitch * height + 16;
+  size_t dst_size = (size_t)width * height * sizeof(uint32_t);
+  uint8_t* src = malloc(src_size);
+  uint8_t* ref = malloc(dst_size);
+  uint8_t* out = malloc(dst_size);
+  uint32_t palette[256];
+  if (!src || !ref || !out) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  srand(1);
+  for (size_t i = 0; i < src_size; i++) {
+    src[i] = (uint8_t)rand();
+  }
+  for (unsigned int i = 0; i < 256; i++) {
+    palette[i] = 0xFF000000u | ((uint32_t)rand() & 0xFFFFFF);
+  }
+  // Start one byte in so the converters see unaligned rows too.
+  const uint8_t* mem = src + 1;
+
+  printf("%ux%u, %u iterations, best implementation: %s\n", width, height, iters,
+         rtg_convert_impl_name());
+  printf("%-12s %10s %10s %10s %8s\n", "format", "old Mpx/s", "scalar", "best", "speedup");
+
+  int failed = 0;
+  double mpix = (double)width * height * iters / 1e6;
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    uint16_t format = formats[f].format;
+    size_t dst_bpp = rtg_convert_dst_bpp(format);
+    size_t fmt_pitch = pitch * formats[f].src_bits / 16;
+    rtg_convert_fn impl[2] = {rtg_convert_lookup(format, RTG_CONVERT_SCALAR),
+                              rtg_convert_lookup(format, RTG_CONVERT_BEST)};
+    double rate[3];
+
+    ref_convert(format, ref, mem, palette, width, height, fmt_pitch);
+    for (int k = 0; k < 2; k++) {
+      memset(out, 0xA5, dst_size);
+      row_convert(impl[k], dst_bpp, out, mem, palette, width, height, fmt_pitch);
+      if (memcmp(ref, out, (size_t)width * height * dst_bpp) != 0) {
+        printf("%-12s MISMATCH (%s)\n", formats[f].name, k ? "best" : "scalar");
+        failed = 1;
+      }
+    }
+
+    uint64_t t0 = now_ns();
+    for (unsigned int i = 0; i < iters; i++) {
+      ref_convert(format, ref, mem, palette, width, height, fmt_pitch);
+    }
+    rate[0] = mpix / ((double)(now_ns() - t0) / 1e9);
+    for (int k = 0; k < 2; k++) {
+      t0 = now_ns();
+      for (unsigned int i = 0; i < iters; i++) {
+        row_convert(impl[k], dst_bpp, out, mem, palette, width, height, fmt_pitch);
+      }
+      rate[k + 1] = mpix / ((double)(now_ns() - t0) / 1e9);
+    }
+    printf("%-12s %10.1f %10.1f %10.1f %7.2fx\n", formats[f].name, rate[0], rate[1], rate[2],
+           rate[2] / rate[0]);
+  }
+
+  free(src);
+  free(ref);
+  free(out);
+  return failed;
+}
@@ -0,0 +1,547 @@
+// SPDX-License-Identifier: MIT
+// tools/rtg_gfx_bench.c
+//
+// Checks and times the RTG 2D primitives in rtg-gfx.c on a plain Linux box.
+// Every operation is run twice from the same random VRAM contents, once with
+// rtg_gfx_scalar set (the per-pixel reference loops) and once with the span
+// kernels, over random sizes, offsets, formats, masks and draw modes; any byte
+// that differs is reported and makes the exit code 1. Afterwards each op is
+// timed on a full 1920x1080 screen in 8, 16 and 32-bit formats. Finally the
+// operations that rtg-threads splits are timed with 1 to N threads (default:
+// the online CPUs, at least 4) and their VRAM compared with the single-thread
+// result. The build script uses the emulator's default -Os unless OPT_LEVEL
+// says otherwise.
+//
+// Usage: rtg_gfx_bench [cases-per-op] [seed] [max-threads]
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_file/config_file.h"
+#include "platforms/amiga/rtg/rtg.h"
+
+#define VRAM_SIZE (40u * 1024u * 1024u)
+#define CHECK_SIZE (2u * 1024u * 1024u)
+#define BENCH_SIZE (12u * 1024u * 1024u)
+#define TMPL_BASE 0x00200000u
+#define TMPL_SIZE (256u * 1024u)
+#define BMP_SIZE (1024u + (320u * 256u * 8u))
+
+// What rtg-gfx.c links against in the emulator.
+__thread uint32_t rtg_address[8];
+__thread uint32_t rtg_address_adj[8];
+uint8_t* rtg_mem;
+size_t rtg_mem_size = VRAM_SIZE;
+__thread uint16_t rtg_user[8];
+__thread uint16_t rtg_x[8], rtg_y[8];
+__thread uint16_t rtg_format;
+uint16_t rtg_display_format;
+uint32_t framebuffer_addr;
+uint32_t framebuffer_addr_adj;
+uint8_t realtime_graphics_debug;
+struct emulator_config* cfg;
+
+static uint8_t tmpl[TMPL_SIZE];
+static int tmpl_mapped = 1;
+static uint64_t tmpl_reads;
+
+uint8_t* get_mapped_data_pointer_by_address(struct emulator_config* c, uint32_t address) {
+  (void)c;
+  if (!tmpl_mapped || address < TMPL_BASE || address >= TMPL_BASE + TMPL_SIZE) {
+    return NULL;
+  }
+  return &tmpl[address - TMPL_BASE];
+}
+
+unsigned int m68k_read_memory_8(unsigned int address) {
+  tmpl_reads++;
+  if (address < TMPL_BASE || address >= TMPL_BASE + TMPL_SIZE) {
+    return 0;
+  }
+  return tmpl[address - TMPL_BASE];
+}
+
+uint8_t ps_read_8(uint32_t address) {
+  (void)address;
+  return 0;
+}
+
+void rtg_gfx_defer_dirty(const uint8_t* dst, size_t len) {
+  (void)dst;
+  (void)len;
+}
+
+void rtg_gfx_flush_dirty(void) {
+}
+
+void log_message(int level, const char* fmt, ...) {
+  (void)level;
+  (void)fmt;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint32_t rnd(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (uint32_t)(rng_state >> 16);
+}
+
+static uint32_t rnd_range(uint32_t lo, uint32_t hi) {
+  return lo + (rnd() % (hi - lo + 1));
+}
+
+static void fill_random(uint8_t* p, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    p[i] = (uint8_t)rnd();
+  }
+}
+
+enum op {
+  OP_FILLRECT_SOLID,
+  OP_FILLRECT,
+  OP_INVERTRECT,
+  OP_BLITRECT,
+  OP_BLITRECT_NOMASK,
+  OP_BLITTEMPLATE,
+  OP_BLITPATTERN,
+  OP_DRAWLINE_SOLID,
+  OP_DRAWLINE,
+  OP_P2C,
+  OP_P2D,
+  OP_NUM,
+};
+
+static const char* op_names[OP_NUM] = {
+    "fillrect_solid", "fillrect",    "invertrect",      "blitrect",
+    "blitrect_nomask", "blittemplate", "blitpattern",   "drawline_solid",
+    "drawline",        "p2c",          "p2d",
+};
+
+static const uint16_t formats[] = {
+    RTGFMT_8BIT_CLUT,  RTGFMT_RGB565_BE,  RTGFMT_RGB555_LE, RTGFMT_BGR565_LE,
+    RTGFMT_RGB32_ARGB, RTGFMT_RGB32_BGRA, RTGFMT_RGB24,
+};
+#define NUM_FORMATS (sizeof(formats) / sizeof(formats[0]))
+
+struct params {
+  uint16_t format, pitch;
+  uint16_t x, y, dx, dy, w, h;
+  uint32_t fg, bg;
+  uint8_t mask, mode, loop_rows, planes, layer_mask, mapped;
+  uint16_t offset_x, offset_y, t_pitch, len, pattern, src_pitch;
+  int16_t lx, ly;
+};
+
+static uint8_t bmp[BMP_SIZE];
+
+static void run_op(enum op op, const struct params* p) {
+  rtg_format = p->format;
+  rtg_x[3] = p->pitch;
+  tmpl_mapped = p->mapped;
+  switch (op) {
+  case OP_FILLRECT_SOLID:
+    rtg_fillrect_solid(p->x, p->y, p->w, p->h, p->fg, p->pitch, p->format);
+    break;
+  case OP_FILLRECT:
+    rtg_fillrect(p->x, p->y, p->w, p->h, p->fg, p->pitch, p->format, p->mask);
+    break;
+  case OP_INVERTRECT:
+    rtg_invertrect(p->x, p->y, p->w, p->h, p->pitch, p->format, p->mask);
+    break;
+  case OP_BLITRECT:
+    rtg_blitrect(p->x, p->y, p->dx, p->dy, p->w, p->h, p->pitch, p->format, p->mask);
+    break;
+  case OP_BLITRECT_NOMASK: {
+    uint32_t base = PIGFX_RTG_BASE + PIGFX_REG_SIZE;
+    // Same surface when the mode is odd, so both overlap directions get covered.
+    uint32_t src = base + ((p->mode & 1) ? 0 : (uint32_t)p->pitch * 300u);
+    rtg_blitrect_nomask_complete(p->x, p->y, p->dx, p->dy, p->w, p->h, p->pitch, p->pitch, src,
+                                 base, p->format, p->mode >> 1);
+    break;
+  }
+  case OP_BLITTEMPLATE:
+    rtg_blittemplate(p->x, p->y, p->w, p->h, TMPL_BASE + 16, p->fg, p->bg, p->pitch, p->t_pitch,
+                     p->format, p->offset_x, p->mask, p->mode);
+    break;
+  case OP_BLITPATTERN:
+    rtg_blitpattern(p->x, p->y, p->w, p->h, TMPL_BASE + 64, p->fg, p->bg, p->pitch, p->format,
+                    p->offset_x, p->offset_y, p->mask, p->mode, p->loop_rows);
+    break;
+  case OP_DRAWLINE_SOLID:
+    rtg_drawline_solid(p->lx, p->ly, (int16_t)p->dx, (int16_t)p->dy, p->len, p->fg, p->pitch,
+                       p->format);
+    break;
+  case OP_DRAWLINE:
+    rtg_drawline(p->lx, p->ly, (int16_t)p->dx, (int16_t)p->dy, p->len, p->pattern, 0, p->fg,
+                 p->bg, p->pitch, p->format, p->mask, p->mode);
+    break;
+  case OP_P2C:
+    rtg_p2c((int16_t)p->x, (int16_t)p->y, (int16_t)p->dx, (int16_t)p->dy, (int16_t)p->w,
+            (int16_t)p->h, p->mode, p->planes, p->mask, p->layer_mask, p->src_pitch, bmp);
+    break;
+  case OP_P2D:
+    rtg_p2d((int16_t)p->x, (int16_t)p->y, (int16_t)p->dx, (int16_t)p->dy, (int16_t)p->w,
+            (int16_t)p->h, p->mode, p->planes, p->mask, p->layer_mask, p->src_pitch, bmp);
+    break;
+  default:
+    break;
+  }
+}
+
+static void random_params(enum op op, struct params* p) {
+  memset(p, 0, sizeof(*p));
+  p->format = formats[rnd() % NUM_FORMATS];
+  size_t bpp = rtg_pixel_size[p->format];
+  p->pitch = (uint16_t)(rnd_range(320, 1024) * bpp + rnd_range(0, 7));
+  uint16_t max_w = (uint16_t)(p->pitch / bpp / 3);
+  p->w = (uint16_t)((rnd() % 4) ? rnd_range(1, 40) : rnd_range(1, max_w));
+  p->h = (uint16_t)rnd_range(1, 60);
+  p->x = (uint16_t)rnd_range(0, max_w);
+  p->y = (uint16_t)rnd_range(0, 200);
+  p->dx = (uint16_t)rnd_range(0, max_w);
+  p->dy = (uint16_t)rnd_range(0, 200);
+  if (rnd() % 3 == 0) {
+    // Overlapping blits.
+    p->dx = (uint16_t)(p->x + rnd_range(0, 9));
+    p->dy = (uint16_t)(p->y + rnd_range(0, 2));
+    if (rnd() & 1) {
+      uint16_t t = p->x;
+      p->x = p->dx;
+      p->dx = t;
+      t = p->y;
+      p->y = p->dy;
+      p->dy = t;
+    }
+  }
+  p->fg = rnd();
+  p->bg = rnd();
+  p->mask = (rnd() & 1) ? 0xFF : (uint8_t)rnd();
+  p->mapped = (rnd() % 4) != 0;
+  p->offset_x = (uint16_t)rnd_range(0, 63);
+  p->offset_y = (uint16_t)rnd_range(0, 63);
+  p->t_pitch = (uint16_t)rnd_range((uint32_t)(p->offset_x / 8 + (p->w + 7) / 8 + 1), 400);
+  p->loop_rows = (uint8_t)rnd_range(1, 16);
+  p->pattern = (uint16_t)rnd();
+  p->planes = (uint8_t)rnd_range(0, 9);
+  p->layer_mask = (rnd() & 1) ? 0xFF : (uint8_t)rnd();
+  p->src_pitch = (uint16_t)((rnd() & 1) ? rnd_range(1, 64) : rnd_range(200, 320));
+
+  switch (op) {
+  case OP_BLITTEMPLATE:
+  case OP_BLITPATTERN:
+  case OP_DRAWLINE:
+    p->mode = (uint8_t)rnd_range(0, 7);
+    break;
+  case OP_BLITRECT_NOMASK:
+    p->mode = (uint8_t)rnd_range(0, 31);
+    break;
+  case OP_P2C:
+  case OP_P2D:
+    p->mode = (uint8_t)rnd_range(0, 15);
+    p->x = (uint16_t)rnd_range(0, 2000);
+    p->dx = (uint16_t)rnd_range(0, 100);
+    p->y = (uint16_t)rnd_range(0, 100);
+    if (rnd() & 1) {
+      p->mask = 0xFF;
+      p->mode = (rnd() & 1) ? MINTERM_SRC : MINTERM_NOTSRC;
+    }
+    if ((uint32_t)p->src_pitch * p->h * 8u + 1024u > BMP_SIZE) {
+      p->h = (uint16_t)((BMP_SIZE - 1024u) / (p->src_pitch * 8u));
+    }
+    break;
+  case OP_DRAWLINE_SOLID:
+    p->mode = 0;
+    break;
+  default:
+    break;
+  }
+
+  // Lines: mostly horizontal ones, which is what the span path covers.
+  p->lx = (int16_t)rnd_range(0, max_w);
+  p->ly = (int16_t)rnd_range(0, 200);
+  int32_t ldx = (int32_t)rnd_range(0, 200) - 100;
+  if (p->lx + ldx < 0) {
+    ldx = -p->lx;
+  }
+  p->dx = (op == OP_DRAWLINE || op == OP_DRAWLINE_SOLID) ? (uint16_t)(int16_t)ldx : p->dx;
+  p->dy = (op == OP_DRAWLINE || op == OP_DRAWLINE_SOLID)
+              ? (uint16_t)(int16_t)((rnd() % 4) ? 0 : (int32_t)rnd_range(0, 20) - 10)
+              : p->dy;
+  if ((op == OP_DRAWLINE || op == OP_DRAWLINE_SOLID) && p->ly + (int16_t)p->dy < 0) {
+    p->dy = 0;
+  }
+  // An explicit len longer than the line walks off the span that was bounds checked; only
+  // horizontal lines stay inside their row.
+  p->len = (uint16_t)((p->dy == 0 && rnd() % 3 == 0) ? rnd_range(1, 150) : 0);
+}
+
+static uint8_t* vram_init;
+static uint8_t* vram_ref;
+
+// Runs one case both ways; returns 0 when the results are byte-identical.
+static int check_case(enum op op, const struct params* p, unsigned int n) {
+  memcpy(rtg_mem, vram_init, CHECK_SIZE);
+  tmpl_reads = 0;
+  rtg_gfx_scalar = 1;
+  run_op(op, p);
+  uint64_t ref_reads = tmpl_reads;
+  memcpy(vram_ref, rtg_mem, CHECK_SIZE);
+
+  memcpy(rtg_mem, vram_init, CHECK_SIZE);
+  tmpl_reads = 0;
+  rtg_gfx_scalar = 0;
+  run_op(op, p);
+
+  if (!memcmp(vram_ref, rtg_mem, CHECK_SIZE) && ref_reads == tmpl_reads) {
+    return 0;
+  }
+  size_t first = 0;
+  while (first < CHECK_SIZE && vram_ref[first] == rtg_mem[first]) {
+    first++;
+  }
+  printf("MISMATCH %s case %u: fmt=%u pitch=%u x=%u y=%u dx=%u dy=%u w=%u h=%u mask=%.2X "
+         "mode=%u offset=%u,%u len=%u lx=%d ly=%d planes=%u src_pitch=%u mapped=%u",
+         op_names[op], n, p->format, p->pitch, p->x, p->y, p->dx, p->dy, p->w, p->h, p->mask,
+         p->mode, p->offset_x, p->offset_y, p->len, p->lx, p->ly, p->planes, p->src_pitch,
+         p->mapped);
+  if (first < CHECK_SIZE) {
+    printf(" first diff @%zu ref=%.2X got=%.2X", first, vram_ref[first], rtg_mem[first]);
+  }
+  if (ref_reads != tmpl_reads) {
+    printf(" reads ref=%llu got=%llu", (unsigned long long)ref_reads,
+           (unsigned long long)tmpl_reads);
+  }
+  printf("\n");
+  return 1;
+}
+
+static double time_op(enum op op, const struct params* p, int scalar, unsigned int iters) {
+  rtg_gfx_scalar = (uint8_t)scalar;
+  run_op(op, p);
+  uint64_t t0 = now_ns();
+  for (unsigned int i = 0; i < iters; i++) {
+    run_op(op, p);
+  }
+  return (double)(now_ns() - t0) / iters / 1000.0;
+}
+
+static void bench(void) {
+  static const uint16_t bench_formats[] = {RTGFMT_8BIT_CLUT, RTGFMT_RGB565_BE, RTGFMT_RGB32_ARGB};
+  printf("\n%-16s %-6s %12s %12s %8s\n", "op (1920x1080)", "bpp", "scalar us", "span us",
+         "speedup");
+  fill_random(rtg_mem, BENCH_SIZE);
+  for (unsigned int f = 0; f < sizeof(bench_formats) / sizeof(bench_formats[0]); f++) {
+    struct params p;
+    memset(&p, 0, sizeof(p));
+    p.format = bench_formats[f];
+    p.pitch = (uint16_t)(1920 * rtg_pixel_size[p.format]);
+    p.w = 1920;
+    p.h = 1080;
+    p.fg = 0x12345678;
+    p.bg = 0x9ABCDEF0;
+    p.mask = 0xFF;
+    p.mapped = 1;
+    p.loop_rows = 16;
+    p.t_pitch = 240;
+    p.pattern = 0xF0C3;
+    p.planes = 8;
+    p.layer_mask = 0xFF;
+    p.src_pitch = 40;
+    for (unsigned int o = 0; o < OP_NUM; o++) {
+      enum op op = (enum op)o;
+      struct params q = p;
+      unsigned int iters = 10;
+      switch (op) {
+      case OP_BLITRECT:
+        q.w = 1900;
+        q.h = 1000;
+        q.dx = 8;
+        q.dy = 4;
+        break;
+      case OP_BLITRECT_NOMASK:
+        q.w = 1920;
+        q.h = 500;
+        q.dy = 0;
+        q.mode = MINTERM_EOR << 1;
+        break;
+      case OP_BLITTEMPLATE:
+      case OP_BLITPATTERN:
+        q.mode = DRAWMODE_JAM2;
+        break;
+      case OP_DRAWLINE_SOLID:
+      case OP_DRAWLINE:
+        q.lx = 0;
+        q.ly = 10;
+        q.dx = 1919;
+        q.dy = 0;
+        iters = 2000;
+        break;
+      case OP_P2C:
+      case OP_P2D:
+        q.w = 320;
+        q.h = 256;
+        q.mode = MINTERM_SRC;
+        if (op == OP_P2D && p.format == RTGFMT_8BIT_CLUT) {
+          continue;
+        }
+        if (op == OP_P2C && p.format != RTGFMT_8BIT_CLUT) {
+          continue;
+        }
+        iters = 200;
+        break;
+      default:
+        break;
+      }
+      double ts = time_op(op, &q, 1, iters);
+      double tv = time_op(op, &q, 0, iters);
+      printf("%-16s %-6u %12.1f %12.1f %7.1fx\n", op_names[op], (unsigned)rtg_pixel_size[p.format],
+             ts, tv, tv > 0 ? ts / tv : 0.0);
+    }
+  }
+}
+
+struct scale_case {
+  const char* name;
+  enum op op;
+  struct params p;
+  unsigned int iters;
+};
+
+#define FULL(fmt) .format = (fmt), .pitch = (uint16_t)(1920 * rtg_pixel_size[(fmt)])
+
+static void bench_threads(unsigned int max_threads) {
+  const struct scale_case cases[] = {
+      {"fill 32bpp", OP_FILLRECT_SOLID,
+       {FULL(RTGFMT_RGB32_ARGB), .w = 1920, .h = 1080, .fg = 0x12345678, .mask = 0xFF}, 20},
+      {"fill mask 8bpp", OP_FILLRECT,
+       {FULL(RTGFMT_8BIT_CLUT), .w = 1920, .h = 1080, .fg = 0x5A, .mask = 0x3C}, 20},
+      {"invert 32bpp", OP_INVERTRECT,
+       {FULL(RTGFMT_RGB32_ARGB), .w = 1920, .h = 1080, .mask = 0xFF}, 20},
+      {"blit 16bpp", OP_BLITRECT,
+       {FULL(RTGFMT_RGB565_BE), .x = 0, .dx = 960, .w = 960, .h = 1080, .mask = 0xFF}, 20},
+      {"vscroll 32bpp", OP_BLITRECT,
+       {FULL(RTGFMT_RGB32_ARGB), .y = 8, .w = 1920, .h = 1072, .mask = 0xFF}, 20},
+      {"vscroll dn 32bpp", OP_BLITRECT,
+       {FULL(RTGFMT_RGB32_ARGB), .dy = 8, .w = 1920, .h = 1072, .mask = 0xFF}, 20},
+      {"hscroll 32bpp", OP_BLITRECT,
+       {FULL(RTGFMT_RGB32_ARGB), .x = 8, .w = 1912, .h = 1080, .mask = 0xFF}, 20},
+      {"p2c 8bpp", OP_P2C,
+       {FULL(RTGFMT_8BIT_CLUT), .x = 5, .dx = 16, .w = 1888, .h = 256, .mask = 0xFF,
+        .mode = MINTERM_SRC, .planes = 8, .layer_mask = 0xFF, .src_pitch = 240},
+       20},
+      {"p2d 32bpp", OP_P2D,
+       {FULL(RTGFMT_RGB32_ARGB), .x = 5, .dx = 16, .w = 1888, .h = 256, .mask = 0xFF,
+        .mode = MINTERM_SRC, .planes = 8, .layer_mask = 0xFF, .src_pitch = 240},
+       20},
+      {"small fill 8bpp", OP_FILLRECT_SOLID,
+       {FULL(RTGFMT_8BIT_CLUT), .w = 64, .h = 64, .fg = 0x33, .mask = 0xFF}, 20000},
+  };
+  const unsigned int num_cases = sizeof(cases) / sizeof(cases[0]);
+  uint8_t* init = malloc(BENCH_SIZE);
+  uint8_t* ref = malloc(BENCH_SIZE);
+  if (!init || !ref) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  fill_random(init, BENCH_SIZE);
+  rtg_gfx_scalar = 0;
+
+  printf("\n%-16s", "threads");
+  for (unsigned int t = 1; t <= max_threads; t++) {
+    printf(" %9u us", t);
+  }
+  printf("\n");
+  unsigned int failures = 0;
+  for (unsigned int c = 0; c < num_cases; c++) {
+    const struct scale_case* sc = &cases[c];
+    printf("%-16s", sc->name);
+    for (unsigned int t = 1; t <= max_threads; t++) {
+      rtg_gfx_set_threads(t);
+      memcpy(rtg_mem, init, BENCH_SIZE);
+      run_op(sc->op, &sc->p);
+      if (t == 1) {
+        memcpy(ref, rtg_mem, BENCH_SIZE);
+      } else if (memcmp(ref, rtg_mem, BENCH_SIZE)) {
+        printf("\n  MISMATCH with %u threads", t);
+        failures++;
+      }
+      uint64_t t0 = now_ns();
+      for (unsigned int i = 0; i < sc->iters; i++) {
+        run_op(sc->op, &sc->p);
+      }
+      printf(" %12.1f", (double)(now_ns() - t0) / sc->iters / 1000.0);
+    }
+    printf("\n");
+  }
+  rtg_gfx_stop_threads();
+  rtg_gfx_set_threads(1);
+  free(ref);
+  free(init);
+  if (failures) {
+    printf("%u thread count mismatches\n", failures);
+    exit(1);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  unsigned int cases = (argc > 1) ? (unsigned int)strtoul(argv[1], NULL, 0) : 500;
+  if (argc > 2) {
+    rng_state ^= strtoull(argv[2], NULL, 0) * 0x2545F4914F6CDD1Dull;
+  }
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int max_threads = (argc > 3) ? (unsigned int)strtoul(argv[3], NULL, 0)
+                                        : (unsigned int)(cpus < 4 ? 4 : cpus);
+  if (max_threads < 1 || max_threads > 8) {
+    max_threads = 8;
+  }
+  unsetenv("PISTORM_RTG_THREADS");
+
+  rtg_mem = calloc(1, VRAM_SIZE);
+  vram_init = malloc(CHECK_SIZE);
+  vram_ref = malloc(CHECK_SIZE);
+  if (!rtg_mem || !vram_init || !vram_ref) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  fill_random(tmpl, sizeof(tmpl));
+  fill_random(bmp, sizeof(bmp));
+
+  unsigned int failures = 0;
+  for (unsigned int o = 0; o < OP_NUM; o++) {
+    unsigned int bad = 0;
+    fill_random(vram_init, CHECK_SIZE);
+    for (unsigned int n = 0; n < cases; n++) {
+      struct params p;
+      random_params((enum op)o, &p);
+      bad += (unsigned int)check_case((enum op)o, &p, n);
+    }
+    printf("%-16s %u cases, %u mismatches\n", op_names[o], cases, bad);
+    failures += bad;
+  }
+
+  bench();
+  bench_threads(max_threads);
+
+  free(vram_ref);
+  free(vram_init);
+  free(rtg_mem);
+  if (failures) {
+    printf("\n%u mismatches\n", failures);
+    return 1;
+  }
+  return 0;
+}
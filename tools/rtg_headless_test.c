@@ -0,0 +1,413 @@
+// SPDX-License-Identifier: MIT
+// tools/rtg_headless_test.c
+//
+// Drives rtg.c through rtg_write() the way the PiGFX driver does, with the
+// headless output backend in place of a display, and checks what comes out
+// of the conversion pipeline:
+//
+//   1. 16-bit screen: the first frame converts every row, an idle frame is
+//      skipped, a fill only converts the rows it touched and lands in the
+//      captured image with the expected colour, a blit copies it.
+//   2. CLUT screen: palette entries set through SetCLUT show up in the frame
+//      and a palette change alone redraws the whole frame; the backend's own
+//      PPM capture writes exactly the selected frames.
+//   3. 32-bit screen written through VRAM longwords, then a page flip.
+//   4. Full-screen 1920x1080 conversion timing for the 16-bit, CLUT and
+//      YUV422 paths. With a budget in us, an average above it fails the test.
+//   5. The frame thread at 200 fps with a raw capture stream, reporting its
+//      rendered, skipped and dropped frames; the stream must hold exactly the
+//      captured frames.
+//
+// Steps 1-3 write the frames they check as PPM files, and steps 2 and 5 their
+// captures, to the output directory, by default a new rtg-headless-* directory
+// under $TMPDIR (or /tmp). Exit code 0 means every check passed.
+//
+// Usage: rtg_headless_test [budget-us] [output-dir]
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_file/config_file.h"
+#include "log.h"
+#include "metrics/metrics.h"
+#include "platforms/amiga/rtg/rtg.h"
+#include "platforms/amiga/rtg/rtg-output-headless.h"
+
+// What rtg.c links against in the emulator.
+struct emulator_config* cfg;
+struct pistorm_metrics pistorm_metrics;
+int cpu_emulation_running = 1;
+uint8_t rtg_enabled = 1;
+extern uint8_t emulator_exiting;
+
+void log_message(int level, const char* fmt, ...) {
+  if (level > LOG_LEVEL_WARN) {
+    return;
+  }
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+void log_event(int level, const char* fmt, const uint64_t* args, unsigned int nargs) {
+  (void)level;
+  (void)fmt;
+  (void)args;
+  (void)nargs;
+}
+
+void add_mapping(struct emulator_config* c, unsigned int type, unsigned int addr, unsigned int size,
+                 unsigned int mirr_addr, char* filename, const char* map_id, unsigned int autodump) {
+  (void)c, (void)type, (void)addr, (void)size, (void)mirr_addr, (void)filename, (void)map_id;
+  (void)autodump;
+}
+
+uint8_t* get_mapped_data_pointer_by_address(struct emulator_config* c, uint32_t address) {
+  (void)c;
+  (void)address;
+  return NULL;
+}
+
+unsigned int m68k_read_memory_8(unsigned int address) {
+  (void)address;
+  return 0;
+}
+uint8_t ps_read_8(uint32_t address) {
+  (void)address;
+  return 0;
+}
+uint16_t ps_read_16(uint32_t address) {
+  (void)address;
+  return 0;
+}
+uint32_t ps_read_32(uint32_t address) {
+  (void)address;
+  return 0;
+}
+unsigned int m68k_get_reg(void* context, m68k_register_t reg) {
+  (void)context;
+  (void)reg;
+  return 0;
+}
+void m68k_end_timeslice(void) {
+}
+void m68k_add_ram_range(uint32_t addr, uint32_t upper, unsigned char* ptr) {
+  (void)addr, (void)upper, (void)ptr;
+}
+void m68k_set_ram_range_dirty_map(unsigned char* ptr, unsigned char* map) {
+  (void)ptr, (void)map;
+}
+void m68k_suspend_ram_range(unsigned char* ptr, int suspend) {
+  (void)ptr, (void)suspend;
+}
+
+#define VRAM_BASE (PIGFX_RTG_BASE + PIGFX_REG_SIZE)
+
+static const char* out_dir;
+static unsigned int failures;
+
+#define CHECK(cond, ...)                                                                           \
+  do {                                                                                             \
+    if (!(cond)) {                                                                                 \
+      printf("  FAIL %s:%d: ", __FILE__, __LINE__);                                                \
+      printf(__VA_ARGS__);                                                                         \
+      printf("\n");                                                                                \
+      failures++;                                                                                  \
+    }                                                                                              \
+  } while (0)
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void reg(uint32_t address, uint32_t value, uint8_t type) {
+  rtg_write(address, value, type);
+}
+
+// SetGC + SetPan + SetSwitch, as P96 does on a mode switch.
+static void set_mode(uint16_t format, uint16_t w, uint16_t h, uint32_t fb_offset) {
+  reg(RTG_FORMAT, format, OP_TYPE_WORD);
+  reg(RTG_X1, w, OP_TYPE_WORD);
+  reg(RTG_Y1, h, OP_TYPE_WORD);
+  reg(RTG_Y2, h, OP_TYPE_WORD);
+  reg(RTG_U81, 0, OP_TYPE_BYTE);
+  reg(RTG_COMMAND, RTGCMD_SETGC, OP_TYPE_WORD);
+  reg(RTG_ADDR1, VRAM_BASE + fb_offset, OP_TYPE_LONGWORD);
+  reg(RTG_X1, w, OP_TYPE_WORD);
+  reg(RTG_X2, 0, OP_TYPE_WORD);
+  reg(RTG_Y2, 0, OP_TYPE_WORD);
+  reg(RTG_COMMAND, RTGCMD_SETPAN, OP_TYPE_WORD);
+  reg(RTG_X1, 1, OP_TYPE_WORD);
+  reg(RTG_COMMAND, RTGCMD_SETSWITCH, OP_TYPE_WORD);
+}
+
+static void fill(uint16_t format, uint16_t pitch_px, uint16_t x, uint16_t y, uint16_t w,
+                 uint16_t h, uint32_t color) {
+  reg(RTG_ADDR1, VRAM_BASE, OP_TYPE_LONGWORD);
+  reg(RTG_FORMAT, format, OP_TYPE_WORD);
+  reg(RTG_U81, 0xFF, OP_TYPE_BYTE);
+  reg(RTG_X1, x, OP_TYPE_WORD);
+  reg(RTG_Y1, y, OP_TYPE_WORD);
+  reg(RTG_X2, w, OP_TYPE_WORD);
+  reg(RTG_Y2, h, OP_TYPE_WORD);
+  reg(RTG_X3, (uint32_t)(pitch_px * rtg_pixel_size[format]), OP_TYPE_WORD);
+  reg(RTG_RGB1, color, OP_TYPE_LONGWORD);
+  reg(RTG_COMMAND, RTGCMD_FILLRECT, OP_TYPE_WORD);
+}
+
+static void set_clut(uint8_t index, uint32_t xrgb) {
+  reg(RTG_U81, index, OP_TYPE_BYTE);
+  reg(RTG_RGB1, xrgb, OP_TYPE_LONGWORD);
+  reg(RTG_COMMAND, RTGCMD_SETCLUT, OP_TYPE_WORD);
+}
+
+static uint8_t* rgb;
+static uint16_t rgb_w, rgb_h;
+
+static void grab(const char* name) {
+  CHECK(rtg_headless_read_rgb(rgb, 1920u * 1080u * 3u, &rgb_w, &rgb_h), "no frame for %s", name);
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s.ppm", out_dir, name);
+  FILE* f = fopen(path, "wb");
+  if (f) {
+    fprintf(f, "P6\n%u %u\n255\n", rgb_w, rgb_h);
+    fwrite(rgb, 1, (size_t)rgb_w * rgb_h * 3, f);
+    fclose(f);
+  }
+}
+
+static uint32_t pixel(uint16_t x, uint16_t y) {
+  const uint8_t* p = &rgb[((size_t)y * rgb_w + x) * 3];
+  return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static uint64_t rendered_rows(void) {
+  struct rtg_headless_stats s;
+  rtg_headless_get_stats(&s);
+  return s.rows;
+}
+
+static void start(void) {
+  if (!init_rtg_data(NULL)) {
+    fprintf(stderr, "Failed to allocate VRAM.\n");
+    exit(1);
+  }
+  emulator_exiting = 0;
+  rtg_headless_reset_stats();
+}
+
+static void stop(void) {
+  emulator_exiting = 1;
+  rtg_shutdown_display();
+  shutdown_rtg();
+}
+
+static void test_16bit(void) {
+  printf("16-bit screen\n");
+  start();
+  set_mode(RTGFMT_RGB565_BE, 640, 480, 0);
+  CHECK(rtg_headless_render_frame() == 1, "first frame not rendered");
+  CHECK(rendered_rows() == 480, "first frame converted %llu rows",
+        (unsigned long long)rendered_rows());
+  CHECK(rtg_headless_render_frame() == 0, "idle frame not skipped");
+
+  // Pure red in RGB565.
+  fill(RTGFMT_RGB565_BE, 640, 10, 20, 100, 50, 0xF800);
+  uint64_t before = rendered_rows();
+  CHECK(rtg_headless_render_frame() == 1, "fill not rendered");
+  uint64_t rows = rendered_rows() - before;
+  CHECK(rows >= 50 && rows < 100, "fill converted %llu rows", (unsigned long long)rows);
+  grab("headless-16bit-fill");
+  CHECK(pixel(10, 20) == 0xFF0000, "fill pixel %06X", pixel(10, 20));
+  CHECK(pixel(109, 69) == 0xFF0000, "fill corner %06X", pixel(109, 69));
+  CHECK(pixel(9, 20) == 0 && pixel(110, 20) == 0 && pixel(10, 70) == 0, "fill spilled");
+
+  reg(RTG_ADDR1, VRAM_BASE, OP_TYPE_LONGWORD);
+  reg(RTG_X1, 10, OP_TYPE_WORD);
+  reg(RTG_Y1, 20, OP_TYPE_WORD);
+  reg(RTG_X2, 400, OP_TYPE_WORD);
+  reg(RTG_Y2, 300, OP_TYPE_WORD);
+  reg(RTG_X3, 100, OP_TYPE_WORD);
+  reg(RTG_Y3, 50, OP_TYPE_WORD);
+  reg(RTG_X4, 640 * 2, OP_TYPE_WORD);
+  reg(RTG_U81, 0xFF, OP_TYPE_BYTE);
+  reg(RTG_COMMAND, RTGCMD_BLITRECT, OP_TYPE_WORD);
+  CHECK(rtg_headless_render_frame() == 1, "blit not rendered");
+  grab("headless-16bit-blit");
+  CHECK(pixel(400, 300) == 0xFF0000 && pixel(499, 349) == 0xFF0000, "blit missing");
+  CHECK(pixel(399, 300) == 0 && pixel(500, 350) == 0, "blit spilled");
+  stop();
+}
+
+static void test_clut(void) {
+  char capture[512], name[512];
+  struct stat st;
+  printf("CLUT screen, PPM capture of frames 0-1\n");
+  snprintf(capture, sizeof(capture), "%s/headless-clut-frame%%02u.ppm", out_dir);
+  setenv("PISTORM_RTG_CAPTURE", capture, 1);
+  setenv("PISTORM_RTG_CAPTURE_FRAMES", "0-1", 1);
+  start();
+  set_clut(1, 0x00336699);
+  set_mode(RTGFMT_8BIT_CLUT, 320, 200, 0);
+  fill(RTGFMT_8BIT_CLUT, 320, 0, 0, 320, 100, 1);
+  CHECK(rtg_headless_render_frame() == 1, "CLUT frame not rendered");
+  grab("headless-clut");
+  CHECK(pixel(5, 5) == 0x336699, "CLUT pixel %06X", pixel(5, 5));
+  CHECK(rtg_headless_render_frame() == 0, "idle CLUT frame not skipped");
+
+  uint64_t before = rendered_rows();
+  set_clut(0, 0x00FFFFFF);
+  CHECK(rtg_headless_render_frame() == 1, "palette change not rendered");
+  CHECK(rendered_rows() - before == 200, "palette change converted %llu rows",
+        (unsigned long long)(rendered_rows() - before));
+  grab("headless-clut-palette");
+  CHECK(pixel(5, 150) == 0xFFFFFF, "new palette entry %06X", pixel(5, 150));
+  stop();
+  for (unsigned int i = 0; i < 3; i++) {
+    snprintf(name, sizeof(name), "%s/headless-clut-frame%02u.ppm", out_dir, i);
+    CHECK((stat(name, &st) == 0) == (i < 2), "capture of frame %u", i);
+  }
+  unsetenv("PISTORM_RTG_CAPTURE");
+  unsetenv("PISTORM_RTG_CAPTURE_FRAMES");
+}
+
+static void test_32bit(void) {
+  printf("32-bit screen\n");
+  start();
+  set_mode(RTGFMT_RGB32_ARGB, 800, 600, 0);
+  rtg_headless_render_frame();
+  for (uint32_t x = 0; x < 800; x++) {
+    rtg_write(PIGFX_REG_SIZE + (599u * 800u + x) * 4u, 0x00112233, OP_TYPE_LONGWORD);
+  }
+  uint64_t before = rendered_rows();
+  CHECK(rtg_headless_render_frame() == 1, "VRAM write not rendered");
+  CHECK(rendered_rows() - before <= 2, "VRAM write converted %llu rows",
+        (unsigned long long)(rendered_rows() - before));
+  grab("headless-32bit");
+  CHECK(pixel(0, 599) == 0x112233 && pixel(799, 599) == 0x112233, "VRAM write missing");
+
+  // Flip to a second buffer: the whole frame is redone from the new address.
+  set_mode(RTGFMT_RGB32_ARGB, 800, 600, 800u * 600u * 4u);
+  before = rendered_rows();
+  CHECK(rtg_headless_render_frame() == 1, "page flip not rendered");
+  CHECK(rendered_rows() - before == 600, "page flip converted %llu rows",
+        (unsigned long long)(rendered_rows() - before));
+  grab("headless-32bit-flip");
+  CHECK(pixel(0, 599) == 0, "page flip shows the old buffer");
+  stop();
+}
+
+static void test_timing(double budget_us) {
+  static const uint16_t formats[] = {RTGFMT_RGB565_BE, RTGFMT_8BIT_CLUT, RTGFMT_YUV422,
+                                     RTGFMT_RGB32_ARGB};
+  static const char* names[] = {"RGB565_BE", "8BIT_CLUT", "YUV422", "RGB32_ARGB"};
+  printf("Full-screen conversion, 1920x1080\n");
+  start();
+  for (unsigned int f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    uint16_t format = formats[f];
+    set_mode(format, 1920, 1080, 0);
+    rtg_headless_render_frame();
+    rtg_headless_reset_stats();
+    const unsigned int frames = 20;
+    for (unsigned int i = 0; i < frames; i++) {
+      fill(format, 1920, 0, 0, 1920, 1080, 0x10101010u * (i & 7));
+      rtg_headless_render_frame();
+    }
+    struct rtg_headless_stats s;
+    rtg_headless_get_stats(&s);
+    double avg = s.rendered ? (double)s.convert_ns / (double)s.rendered / 1000.0 : 0.0;
+    printf("  %-12s %8.1f us/frame (min %.1f, max %.1f)\n", names[f], avg,
+           (double)s.convert_ns_min / 1000.0, (double)s.convert_ns_max / 1000.0);
+    CHECK(s.rendered == frames && s.rows == 1080u * frames, "%s: %llu frames, %llu rows",
+          names[f], (unsigned long long)s.rendered, (unsigned long long)s.rows);
+    if (budget_us > 0) {
+      CHECK(avg <= budget_us, "%s: %.1f us over the %.1f us budget", names[f],
+            avg, budget_us);
+    }
+  }
+  stop();
+}
+
+static void test_thread(void) {
+  char stream[512];
+  snprintf(stream, sizeof(stream), "%s/headless-stream.rgb", out_dir);
+  printf("Frame thread, 200 fps, raw capture of every 10th frame\n");
+  setenv("PISTORM_RTG_HEADLESS_FPS", "200", 1);
+  setenv("PISTORM_RTG_CAPTURE", stream, 1);
+  setenv("PISTORM_RTG_CAPTURE_FRAMES", "0-/10", 1);
+  start();
+  set_mode(RTGFMT_RGB565_BE, 640, 480, 0);
+
+  uint64_t t0 = now_ns();
+  unsigned int i = 0;
+  while (now_ns() - t0 < 500000000ull) {
+    // Draw for a while, then leave the screen alone.
+    if (now_ns() - t0 < 250000000ull) {
+      fill(RTGFMT_RGB565_BE, 640, (uint16_t)(i % 600), (uint16_t)(i % 460), 40, 20,
+           (i * 0x1234u) & 0xFFFF);
+      i++;
+    }
+    usleep(1000);
+  }
+  struct rtg_headless_stats s;
+  stop();
+  rtg_headless_get_stats(&s);
+  printf("  %llu frames: %llu rendered, %llu skipped, %llu dropped, %llu captured\n",
+         (unsigned long long)s.frames, (unsigned long long)s.rendered,
+         (unsigned long long)s.skipped, (unsigned long long)s.dropped,
+         (unsigned long long)s.captured);
+  CHECK(s.frames >= 20, "frame thread produced %llu frames", (unsigned long long)s.frames);
+  CHECK(s.rendered > 0 && s.skipped > 0, "expected both rendered and skipped frames");
+  CHECK(s.captured == (s.frames + 9) / 10, "%llu captures for %llu frames",
+        (unsigned long long)s.captured, (unsigned long long)s.frames);
+  struct stat st;
+  CHECK(stat(stream, &st) == 0 && (uint64_t)st.st_size == s.captured * 640u * 480u * 3u,
+        "capture stream holds %lld bytes", (long long)st.st_size);
+
+  unsetenv("PISTORM_RTG_HEADLESS_FPS");
+  unsetenv("PISTORM_RTG_CAPTURE");
+  unsetenv("PISTORM_RTG_CAPTURE_FRAMES");
+}
+
+int main(int argc, char** argv) {
+  double budget_us = argc > 1 ? strtod(argv[1], NULL) : 0.0;
+  char tmp_dir[256];
+  if (argc > 2) {
+    out_dir = argv[2];
+  } else {
+    const char* tmp = getenv("TMPDIR");
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s/rtg-headless-XXXXXX", tmp && *tmp ? tmp : "/tmp");
+    if (!(out_dir = mkdtemp(tmp_dir))) {
+      perror("mkdtemp");
+      return 1;
+    }
+  }
+  printf("Writing frames to %s\n", out_dir);
+  rgb = malloc(1920u * 1080u * 3u);
+  if (!rgb) {
+    return 1;
+  }
+
+  setenv("PISTORM_RTG_HEADLESS_FPS", "0", 1);
+  unsetenv("PISTORM_RTG_CAPTURE");
+  unsetenv("PISTORM_RTG_ASYNC");
+  unsetenv("PISTORM_RTG_THREADS");
+  test_16bit();
+  test_clut();
+  test_32bit();
+  test_timing(budget_us);
+  test_thread();
+
+  free(rgb);
+  printf(failures ? "%u checks failed\n" : "OK\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,539 @@
+// SPDX-License-Identifier: MIT
+// tools/rtg_native_check.c
+//
+// Checks and times the native display capture (rtg-native.c) against a
+// simulated chip RAM. The bus is modelled as a fixed cost per 16-bit read
+// (default 564 ns, one 68000 bus cycle at 7.09 MHz), so the bus times below
+// are what the reads would take on a stock Amiga without DMA contention, not
+// measurements.
+//
+//   1. Modes: for lores, hires (interleaved), interlace, EHB, HAM6, dual
+//      playfield, AGA 8 planes with a 24-bit palette and 4x fetch, and HAM8,
+//      a system-style copper list (copinit jumping to a second list) sets up
+//      the screen. The frame shown through the headless RTG output must match
+//      a pixel-by-pixel reference decode.
+//   2. Hand-over: switching the Picasso96 display on restores its mode and
+//      stops native frames; switching it off brings them back.
+//   3. Budget: a CPU loop of 20 us slices with capture at 10 fps, for budgets
+//      of 5, 20 and 100 percent. Reports captured frames per second, the share
+//      of time spent on the bus, how long single stalls get and how much less
+//      work the CPU loop got done than it would without capture.
+//
+// Exit code 0 means every check passed.
+//
+// Usage: rtg_native_check [ns-per-bus-word] [seconds-per-budget]
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config_file/config_file.h"
+#include "log.h"
+#include "metrics/metrics.h"
+#include "platforms/amiga/registers/agnus.h"
+#include "platforms/amiga/registers/denise.h"
+#include "platforms/amiga/rtg/rtg.h"
+#include "platforms/amiga/rtg/rtg-native.h"
+#include "platforms/amiga/rtg/rtg-output-headless.h"
+
+// What rtg.c and rtg-native.c link against in the emulator.
+struct emulator_config* cfg;
+struct pistorm_metrics pistorm_metrics;
+int cpu_emulation_running = 1;
+uint8_t rtg_enabled = 1;
+extern uint8_t emulator_exiting;
+extern uint8_t display_enabled;
+extern uint16_t rtg_display_width, rtg_display_height, rtg_display_format;
+
+void log_message(int level, const char* fmt, ...) {
+  if (level > LOG_LEVEL_WARN) {
+    return;
+  }
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+void log_event(int level, const char* fmt, const uint64_t* args, unsigned int nargs) {
+  (void)level;
+  (void)fmt;
+  (void)args;
+  (void)nargs;
+}
+
+void add_mapping(struct emulator_config* c, unsigned int type, unsigned int addr, unsigned int size,
+                 unsigned int mirr_addr, char* filename, const char* map_id, unsigned int autodump) {
+  (void)c, (void)type, (void)addr, (void)size, (void)mirr_addr, (void)filename, (void)map_id;
+  (void)autodump;
+}
+
+uint8_t* get_mapped_data_pointer_by_address(struct emulator_config* c, uint32_t address) {
+  (void)c;
+  (void)address;
+  return NULL;
+}
+
+unsigned int m68k_read_memory_8(unsigned int address) {
+  (void)address;
+  return 0;
+}
+uint8_t ps_read_8(uint32_t address) {
+  (void)address;
+  return 0;
+}
+uint16_t ps_read_16(uint32_t address) {
+  (void)address;
+  return 0;
+}
+uint32_t ps_read_32(uint32_t address) {
+  (void)address;
+  return 0;
+}
+unsigned int m68k_get_reg(void* context, m68k_register_t reg) {
+  (void)context;
+  (void)reg;
+  return 0;
+}
+void m68k_end_timeslice(void) {
+}
+void m68k_add_ram_range(uint32_t addr, uint32_t upper, unsigned char* ptr) {
+  (void)addr, (void)upper, (void)ptr;
+}
+void m68k_set_ram_range_dirty_map(unsigned char* ptr, unsigned char* map) {
+  (void)ptr, (void)map;
+}
+void m68k_suspend_ram_range(unsigned char* ptr, int suspend) {
+  (void)ptr, (void)suspend;
+}
+
+#define CHIP_SIZE (2u * 1024u * 1024u)
+static uint8_t chip[CHIP_SIZE];
+static uint64_t bus_word_ns = 564;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void spin_until(uint64_t t) {
+  while (now_ns() < t) {
+  }
+}
+
+// The simulated bus: chip RAM contents, at bus_word_ns per word.
+void ps_read_block(uint32_t address, uint8_t* dst, uint32_t len) {
+  uint64_t end = now_ns() + bus_word_ns * (len / 2);
+  for (uint32_t i = 0; i < len; i++) {
+    dst[i] = chip[(address + i) % CHIP_SIZE];
+  }
+  spin_until(end);
+}
+
+static unsigned int failures;
+
+#define CHECK(cond, ...)                                                                           \
+  do {                                                                                             \
+    if (!(cond)) {                                                                                 \
+      printf("  FAIL %s:%d: ", __FILE__, __LINE__);                                                \
+      printf(__VA_ARGS__);                                                                         \
+      printf("\n");                                                                                \
+      failures++;                                                                                  \
+    }                                                                                              \
+  } while (0)
+
+static uint32_t rng = 0x2468ACE1;
+static uint32_t rnd(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static void put16(uint32_t addr, uint16_t v) {
+  chip[addr] = (uint8_t)(v >> 8);
+  chip[addr + 1] = (uint8_t)v;
+}
+
+/* Copper list building. */
+
+static uint32_t cop_pc;
+
+static void cop_move(uint32_t reg, uint16_t value) {
+  put16(cop_pc, (uint16_t)CUSTOM_REG_OFFSET(reg));
+  put16(cop_pc + 2, value);
+  cop_pc += 4;
+}
+
+static void cop_wait(uint8_t v, uint8_t h) {
+  put16(cop_pc, (uint16_t)(v << 8 | h | 1));
+  put16(cop_pc + 2, 0xFFFE);
+  cop_pc += 4;
+}
+
+static void cop_end(void) {
+  put16(cop_pc, 0xFFFF);
+  put16(cop_pc + 2, 0xFFFE);
+  cop_pc += 4;
+}
+
+/* Screens. */
+
+enum { LORES, HIRES, SHRES };
+
+struct screen {
+  const char* name;
+  unsigned int res, planes, width, height; // height per field
+  uint16_t extra_con0;                     // HAM, DPF, LACE
+  uint16_t bplcon2, bplcon3, bplcon4, fmode;
+  int interleaved, lace, aga;
+};
+
+static const struct screen screens[] = {
+    {"lores 5 planes", LORES, 5, 320, 256, 0, 0, 0x0C00, 0, 0, 0, 0, 0},
+    {"hires 4 planes interleaved", HIRES, 4, 640, 256, 0, 0, 0x0C00, 0, 0, 1, 0, 0},
+    {"hires interlace 2 planes", HIRES, 2, 640, 256, BPLCON0_LACE, 0, 0x0C00, 0, 0, 0, 1, 0},
+    {"lores EHB", LORES, 6, 320, 256, 0, 0, 0x0C00, 0, 0, 0, 0, 0},
+    {"lores HAM6", LORES, 6, 320, 256, BPLCON0_HAM, 0, 0x0C00, 0, 0, 0, 0, 0},
+    {"lores dual playfield", LORES, 6, 320, 256, BPLCON0_DPF, BPLCON2_PF2PRI, 0x0C00, 0, 0, 0, 0,
+     0},
+    {"AGA lores 8 planes 4x", LORES, 8, 320, 256, 0, 0, 0x0C20, 0x2200, 3, 0, 0, 1},
+    {"AGA hires HAM8 interleaved", HIRES, 8, 640, 256, BPLCON0_HAM, 0, 0x0C20, 0, 3, 1, 0, 1},
+};
+
+static uint32_t palette[256]; // what the copper loads, 0x00RRGGBB
+static uint32_t plane_pt[8];
+static int32_t plane_stride[8]; // per displayed line
+static unsigned int row_bytes;
+
+#define COPINIT 0x000400
+#define LOF_LIST 0x001000
+#define PLANES 0x010000
+
+// Lay out the bitplanes with random contents and write the copper lists.
+static void build(const struct screen* s) {
+  memset(chip, 0, 0x00100000);
+  row_bytes = s->width / 8;
+  unsigned int lines = s->lace ? s->height * 2 : s->height;
+  for (unsigned int p = 0; p < s->planes; p++) {
+    if (s->interleaved) {
+      plane_pt[p] = PLANES + p * row_bytes;
+      plane_stride[p] = (int32_t)(row_bytes * s->planes);
+    } else {
+      // Separate allocations with a gap, so they are read plane by plane.
+      plane_pt[p] = PLANES + p * (row_bytes * lines + 0x4000);
+      plane_stride[p] = (int32_t)row_bytes;
+    }
+    for (unsigned int y = 0; y < lines; y++) {
+      for (unsigned int x = 0; x < row_bytes; x++) {
+        chip[plane_pt[p] + y * (uint32_t)plane_stride[p] + x] = (uint8_t)rnd();
+      }
+    }
+  }
+  for (unsigned int i = 0; i < 256; i++) {
+    uint32_t c = rnd() & 0xFFFFFF;
+    if (!s->aga) {
+      c &= 0xF0F0F0;
+      c |= c >> 4;
+    }
+    palette[i] = c;
+  }
+
+  // copinit: point COP2LC at the LOF list and jump there.
+  cop_pc = COPINIT;
+  cop_move(COP2LCH, LOF_LIST >> 16);
+  cop_move(COP2LCL, LOF_LIST & 0xFFFF);
+  cop_move(COPJMP2, 0);
+  cop_end();
+
+  cop_pc = LOF_LIST;
+  cop_wait(0x10, 0x07);
+  cop_move(FMODE, s->fmode);
+  unsigned int colours = s->aga ? 256 : 32;
+  for (unsigned int i = 0; i < colours; i++) {
+    uint32_t c = palette[i];
+    uint16_t hi = (uint16_t)(((c >> 12) & 0xF00) | ((c >> 8) & 0xF0) | ((c >> 4) & 0xF));
+    uint16_t lo = (uint16_t)(((c >> 8) & 0xF00) | ((c >> 4) & 0xF0) | (c & 0xF));
+    uint16_t bank = (uint16_t)((i / 32) << 13);
+    if (s->aga) {
+      cop_move(BPLCON3, bank | s->bplcon3);
+    }
+    cop_move(COLOR00 + (i % 32) * 2, hi);
+    if (s->aga) {
+      cop_move(BPLCON3, bank | BPLCON3_LOCT | s->bplcon3);
+      cop_move(COLOR00 + (i % 32) * 2, lo);
+    }
+  }
+  cop_move(BPLCON3, s->bplcon3);
+  uint16_t ddfstrt = s->res == LORES ? 0x38 : 0x3C;
+  // The last fetch block starts at DDFSTOP: 8 colour clocks per block and
+  // fetch width, 16 lores or 32 hires pixels per block and width.
+  unsigned int mult = s->fmode == 3 ? 4 : s->fmode ? 2 : 1;
+  unsigned int blocks = s->width / ((s->res == LORES ? 16u : 32u) * mult);
+  uint16_t ddfstop = (uint16_t)(ddfstrt + (blocks - 1) * 8 * mult);
+  cop_move(DIWSTRT, 0x2C81);
+  cop_move(DIWSTOP, 0x2CC1);
+  cop_move(DDFSTRT, ddfstrt);
+  cop_move(DDFSTOP, ddfstop);
+  uint16_t con0 = (uint16_t)(((s->planes & 7) << 12) | (s->planes == 8 ? BPLCON0_BPU3 : 0) |
+                             (s->res == HIRES ? BPLCON0_HIRES : 0) | s->extra_con0 | 0x0200);
+  cop_move(BPLCON0, con0);
+  cop_move(BPLCON2, s->bplcon2);
+  cop_move(BPLCON4, s->bplcon4);
+  // Modulo per field: interleaved skips the other planes, interlace the
+  // other field's line.
+  int16_t mod = (int16_t)(s->interleaved ? row_bytes * (s->planes - 1) : 0);
+  if (s->lace) {
+    mod = (int16_t)(mod + (int16_t)(plane_stride[0]));
+  }
+  cop_move(BPL1MOD, (uint16_t)mod);
+  cop_move(BPL2MOD, (uint16_t)mod);
+  for (unsigned int p = 0; p < s->planes; p++) {
+    cop_move(BPL1PTH + p * 4, (uint16_t)(plane_pt[p] >> 16));
+    cop_move(BPL1PTL + p * 4, (uint16_t)plane_pt[p]);
+  }
+  cop_wait(0x2B, 0x07);
+  // Still above the window, so it applies; without LOCT it sets both nibbles.
+  cop_move(COLOR00 + 2, 0x0123);
+  palette[1] = 0x112233;
+  cop_wait(0x80, 0x07);
+  cop_move(COLOR00, 0x0F00); // inside the window: ignored
+  cop_end();
+
+  // The CPU points COP1LC at copinit, as LoadView does.
+  rtg_native_custom_write(COP1LCH, COPINIT, OP_TYPE_LONGWORD);
+}
+
+static uint32_t reference_pixel(const struct screen* s, unsigned int x, unsigned int y,
+                                uint32_t* ham) {
+  unsigned int idx = 0;
+  for (unsigned int p = 0; p < s->planes; p++) {
+    uint8_t b = chip[plane_pt[p] + y * (uint32_t)plane_stride[p] + x / 8];
+    idx |= ((b >> (7 - (x & 7))) & 1u) << p;
+  }
+  if (x == 0) {
+    *ham = palette[0];
+  }
+  if (s->extra_con0 & BPLCON0_HAM) {
+    int ham8 = s->planes == 8;
+    unsigned int v = ham8 ? idx & 63 : idx & 15, ctrl = ham8 ? idx >> 6 : idx >> 4;
+    uint32_t c8 = ham8 ? v << 2 : v * 0x11;
+    uint32_t c = *ham;
+    if (ctrl == 0) {
+      c = palette[v];
+    } else if (ctrl == 1) {
+      c = (c & 0xFFFF00) | (ham8 ? (c & 3) : 0) | c8;
+    } else if (ctrl == 2) {
+      c = (c & 0x00FFFF) | (ham8 ? (c & 0x030000) : 0) | c8 << 16;
+    } else {
+      c = (c & 0xFF00FF) | (ham8 ? (c & 0x000300) : 0) | c8 << 8;
+    }
+    *ham = c;
+    return c;
+  }
+  if (s->extra_con0 & BPLCON0_DPF) {
+    unsigned int pf1 = 0, pf2 = 0;
+    for (unsigned int p = 0; p < s->planes; p++) {
+      if (p & 1) {
+        pf2 |= ((idx >> p) & 1u) << (p / 2);
+      } else {
+        pf1 |= ((idx >> p) & 1u) << (p / 2);
+      }
+    }
+    if (pf2) {
+      return palette[8 + pf2];
+    }
+    return palette[pf1];
+  }
+  if (s->planes == 6) {
+    return idx & 32 ? (palette[idx & 31] >> 1) & 0x7F7F7F : palette[idx];
+  }
+  return palette[(idx ^ (s->bplcon4 >> 8)) & 0xFF];
+}
+
+static uint8_t rgb[2048 * 1280 * 3];
+
+static void capture_one(void) {
+  struct rtg_native_stats before, after;
+  rtg_native_get_stats(&before);
+  uint64_t deadline = now_ns() + 2000000000ull;
+  do {
+    rtg_native_step();
+    rtg_native_get_stats(&after);
+  } while (after.frames == before.frames && after.skipped == before.skipped &&
+           now_ns() < deadline);
+}
+
+static void check_screen(const struct screen* s) {
+  build(s);
+  struct rtg_native_stats before, after;
+  rtg_native_get_stats(&before);
+  capture_one();
+  rtg_native_get_stats(&after);
+  CHECK(after.frames == before.frames + 1, "%s: no frame captured", s->name);
+  unsigned int lines = s->lace ? s->height * 2 : s->height;
+  rtg_headless_render_frame();
+  uint16_t w = 0, h = 0;
+  rtg_headless_read_rgb(rgb, sizeof(rgb), &w, &h);
+  CHECK(w == s->width && h == lines, "%s: shown as %ux%u, expected %ux%u", s->name, w, h,
+        s->width, lines);
+
+  unsigned int bad = 0;
+  for (unsigned int y = 0; y < lines && w == s->width && h == lines; y++) {
+    uint32_t ham = 0;
+    for (unsigned int x = 0; x < s->width; x++) {
+      uint32_t e = reference_pixel(s, x, y, &ham);
+      const uint8_t* got = &rgb[((size_t)y * w + x) * 3];
+      uint32_t g = (uint32_t)got[0] << 16 | (uint32_t)got[1] << 8 | got[2];
+      if (g != e) {
+        if (!bad) {
+          printf("  %s: (%u,%u) shows %06X, expected %06X\n", s->name, x, y, g, e);
+        }
+        bad++;
+      }
+    }
+  }
+  CHECK(!bad, "%s: %u pixels differ", s->name, bad);
+  uint64_t frames = after.frames - before.frames;
+  if (!frames) {
+    frames = 1;
+  }
+  printf("  %-28s %4ux%-4u %5.1f KB  bus %6.2f ms (copper %.2f)  convert %5.2f ms\n", s->name,
+         w, h, (double)(after.bus_bytes - before.bus_bytes) / 1024.0 / (double)frames,
+         (double)(after.bus_ns - before.bus_ns) / 1e6 / (double)frames,
+         (double)(after.copper_ns - before.copper_ns) / 1e6 / (double)frames,
+         (double)(after.cpu_ns - before.cpu_ns) / 1e6 / (double)frames);
+}
+
+/* Picasso96 hand-over. */
+
+#define VRAM_BASE (PIGFX_RTG_BASE + PIGFX_REG_SIZE)
+
+static void switch_p96(int on) {
+  if (on) {
+    rtg_write(RTG_FORMAT, RTGFMT_RGB565_LE, OP_TYPE_WORD);
+    rtg_write(RTG_X1, 800, OP_TYPE_WORD);
+    rtg_write(RTG_Y1, 600, OP_TYPE_WORD);
+    rtg_write(RTG_Y2, 600, OP_TYPE_WORD);
+    rtg_write(RTG_U81, 0, OP_TYPE_BYTE);
+    rtg_write(RTG_COMMAND, RTGCMD_SETGC, OP_TYPE_WORD);
+    rtg_write(RTG_ADDR1, VRAM_BASE, OP_TYPE_LONGWORD);
+    rtg_write(RTG_X1, 800, OP_TYPE_WORD);
+    rtg_write(RTG_X2, 0, OP_TYPE_WORD);
+    rtg_write(RTG_Y2, 0, OP_TYPE_WORD);
+    rtg_write(RTG_COMMAND, RTGCMD_SETPAN, OP_TYPE_WORD);
+  }
+  rtg_write(RTG_X1, on ? 1 : 0, OP_TYPE_WORD);
+  rtg_write(RTG_COMMAND, RTGCMD_SETSWITCH, OP_TYPE_WORD);
+}
+
+static void check_handover(void) {
+  printf("Hand-over\n");
+  build(&screens[0]);
+  capture_one();
+  CHECK(rtg_display_width == 320 && rtg_display_format == RTGFMT_RGB32_ARGB,
+        "native frame not shown (%ux%u format %u)", rtg_display_width, rtg_display_height,
+        rtg_display_format);
+  switch_p96(1);
+  CHECK(rtg_display_width == 800 && rtg_display_height == 600 &&
+            rtg_display_format == RTGFMT_RGB565_LE,
+        "Picasso96 mode not restored (%ux%u format %u)", rtg_display_width, rtg_display_height,
+        rtg_display_format);
+  struct rtg_native_stats before, after;
+  rtg_native_get_stats(&before);
+  uint64_t end = now_ns() + 300000000ull;
+  while (now_ns() < end) {
+    rtg_native_step();
+  }
+  rtg_native_get_stats(&after);
+  CHECK(after.frames == before.frames && rtg_display_width == 800,
+        "native frames shown while Picasso96 is on");
+  switch_p96(0);
+  capture_one();
+  CHECK(rtg_display_width == 320 && rtg_display_format == RTGFMT_RGB32_ARGB,
+        "native frames not back after Picasso96 switched off");
+}
+
+/* Budget. */
+
+#define SLICE_NS 20000
+
+static void run_budget(unsigned int budget, double seconds) {
+  char b[16];
+  snprintf(b, sizeof(b), "%u", budget);
+  setenv("PISTORM_RTG_NATIVE_BUDGET", b, 1);
+  rtg_native_start(10);
+  rtg_native_reset_stats();
+
+  // Stalls in 10 us buckets. The longest one includes whatever else the
+  // machine was doing, so the 99.9th percentile is shown as well.
+  static uint64_t hist[1001];
+  memset(hist, 0, sizeof(hist));
+  uint64_t t0 = now_ns(), end = t0 + (uint64_t)(seconds * 1e9), slices = 0, max_stall = 0;
+  while (now_ns() < end) {
+    spin_until(now_ns() + SLICE_NS);
+    slices++;
+    uint64_t s0 = now_ns();
+    rtg_native_step();
+    uint64_t stall = now_ns() - s0;
+    max_stall = stall > max_stall ? stall : max_stall;
+    hist[stall / 10000 < 1000 ? stall / 10000 : 1000]++;
+  }
+  uint64_t seen = 0, p999 = 0;
+  while (p999 < 1000 && (seen += hist[p999]) < slices - slices / 1000) {
+    p999++;
+  }
+  double wall = (double)(now_ns() - t0) / 1e9;
+  struct rtg_native_stats st;
+  rtg_native_get_stats(&st);
+  double ideal = wall * 1e9 / SLICE_NS;
+  printf("  budget %3u%%  %5.1f fps  bus %5.1f%%  stall p99.9 %4u us, max %6.1f us  "
+         "CPU loop %5.1f%% slower\n",
+         budget, (double)st.frames / wall, (double)st.bus_ns / 1e9 / wall * 100.0,
+         (unsigned int)(p999 + 1) * 10, (double)max_stall / 1e3,
+         (1.0 - (double)slices / ideal) * 100.0);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    bus_word_ns = strtoull(argv[1], NULL, 0);
+  }
+  double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+  if (seconds <= 0) {
+    seconds = 2.0;
+  }
+  setenv("PISTORM_RTG_HEADLESS_FPS", "0", 1);
+  unsetenv("PISTORM_RTG_CAPTURE");
+  unsetenv("PISTORM_RTG_ASYNC");
+  unsetenv("PISTORM_RTG_NATIVE_FPS");
+  setenv("PISTORM_RTG_NATIVE_BUDGET", "100", 1);
+  rtg_set_async(0);
+  if (!init_rtg_data(NULL) || !rtg_native_start(60)) {
+    printf("Cannot set up RTG or the native capture.\n");
+    return 1;
+  }
+  emulator_exiting = 0;
+
+  printf("Modes, %llu ns per bus word\n", (unsigned long long)bus_word_ns);
+  for (size_t i = 0; i < sizeof(screens) / sizeof(screens[0]); i++) {
+    check_screen(&screens[i]);
+  }
+  check_handover();
+
+  printf("Budget, lores 5 planes at 10 fps, %u us CPU slices\n", SLICE_NS / 1000);
+  build(&screens[0]);
+  run_budget(5, seconds);
+  run_budget(20, seconds);
+  run_budget(100, seconds);
+
+  rtg_native_stop();
+  emulator_exiting = 1;
+  rtg_shutdown_display();
+  shutdown_rtg();
+  printf(failures ? "FAIL (%u)\n" : "OK\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,460 @@
+// SPDX-License-Identifier: MIT
+// tools/rtg_shader_check.c
+//
+// Checks the RTG conversion shaders (rgb16, yuv422, yuv411) against the CPU
+// converters in rtg-convert.c without a display: an EGL pbuffer/surfaceless
+// GLES2 context is enough, so Mesa llvmpipe on a build machine will do.
+// Random VRAM rows of every 16-bit and YUV format are uploaded raw the way
+// the raylib backend does it, drawn 1:1 and scaled 3x into an FBO, read back
+// and compared with the CPU output. Any pixel off by more than the tolerance
+// makes the exit code 1.
+//
+// The second part times what the RTG thread does per frame for one video
+// sized YUV422 and one RGB565_BE frame: CPU conversion plus RGBA upload
+// (the fallback) against the raw upload the shaders need. Only the calling
+// thread's CPU time is counted, as in rtg-output-raylib.c. With llvmpipe the
+// draw itself also runs on the CPU (in its own threads), so this says nothing
+// about GPU cost.
+//
+// Usage: rtg_shader_check [width height frames]   (run from the repo root,
+// or point PISTORM_ROOT at it)
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "src/platforms/amiga/rtg/rtg-convert.h"
+#include "src/platforms/amiga/rtg/rtg_enums.h"
+
+// Same attribute and varying names as raylib's GLES2 default vertex shader.
+static const char* vertex_src =
+    "#version 100\n"
+    "attribute vec2 vertexPosition;\n"
+    "attribute vec2 vertexTexCoord;\n"
+    "varying vec2 fragTexCoord;\n"
+    "varying vec4 fragColor;\n"
+    "void main() {\n"
+    "  fragTexCoord = vertexTexCoord;\n"
+    "  fragColor = vec4(1.0);\n"
+    "  gl_Position = vec4(vertexPosition, 0.0, 1.0);\n"
+    "}\n";
+
+static const char* format_names[RTGFMT_NUM] = {
+    [RTGFMT_RGB565_BE] = "RGB565_BE",   [RTGFMT_RGB555_BE] = "RGB555_BE",
+    [RTGFMT_RGB555_LE] = "RGB555_LE",   [RTGFMT_BGR565_LE] = "BGR565_LE",
+    [RTGFMT_BGR555_LE] = "BGR555_LE",   [RTGFMT_YUV422_CGX] = "YUV422_CGX",
+    [RTGFMT_YUV422] = "YUV422",         [RTGFMT_YUV422_PC] = "YUV422_PC",
+    [RTGFMT_YUV422_PA] = "YUV422_PA",   [RTGFMT_YUV422_PAPC] = "YUV422_PAPC",
+    [RTGFMT_YUV411] = "YUV411",         [RTGFMT_YUV411_PC] = "YUV411_PC",
+};
+
+static const uint16_t formats[] = {
+    RTGFMT_RGB565_BE, RTGFMT_RGB555_BE,  RTGFMT_RGB555_LE,   RTGFMT_BGR565_LE,
+    RTGFMT_BGR555_LE, RTGFMT_YUV422_CGX, RTGFMT_YUV422,      RTGFMT_YUV422_PC,
+    RTGFMT_YUV422_PA, RTGFMT_YUV422_PAPC, RTGFMT_YUV411,     RTGFMT_YUV411_PC,
+};
+
+enum { SH_RGB16, SH_YUV422, SH_YUV411, SH_NUM };
+static const char* shader_files[SH_NUM] = {"rgb16.shader", "yuv422.shader", "yuv411.shader"};
+static GLuint programs[SH_NUM];
+
+static int shader_for(uint16_t format) {
+  switch (format) {
+  case RTGFMT_YUV411:
+  case RTGFMT_YUV411_PC:
+    return SH_YUV411;
+  case RTGFMT_YUV422_CGX:
+  case RTGFMT_YUV422:
+  case RTGFMT_YUV422_PC:
+  case RTGFMT_YUV422_PA:
+  case RTGFMT_YUV422_PAPC:
+    return SH_YUV422;
+  default:
+    return SH_RGB16;
+  }
+}
+
+static uint64_t thread_cpu_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t rng = 1;
+static uint8_t rnd8(void) {
+  rng = rng * 1664525u + 1013904223u;
+  return (uint8_t)(rng >> 24);
+}
+
+static char* load_text(const char* name) {
+  char path[512];
+  const char* root = getenv("PISTORM_ROOT");
+  snprintf(path, sizeof(path), "%s/src/platforms/amiga/rtg/%s", root && *root ? root : ".",
+           name);
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char* text = calloc(1, (size_t)len + 1);
+  if (text && fread(text, 1, (size_t)len, f) != (size_t)len) {
+    free(text);
+    text = NULL;
+  }
+  fclose(f);
+  return text;
+}
+
+static GLuint compile(GLenum type, const char* src, const char* name) {
+  GLuint sh = glCreateShader(type);
+  glShaderSource(sh, 1, &src, NULL);
+  glCompileShader(sh);
+  GLint ok = 0;
+  glGetShaderiv(sh, GL_COMPILE_STATUS, &ok);
+  if (!ok) {
+    char info[1024];
+    glGetShaderInfoLog(sh, sizeof(info), NULL, info);
+    fprintf(stderr, "%s: compile failed:\n%s\n", name, info);
+    glDeleteShader(sh);
+    return 0;
+  }
+  return sh;
+}
+
+static GLuint load_program(const char* name) {
+  char* fs_src = load_text(name);
+  if (!fs_src) {
+    return 0;
+  }
+  GLuint vs = compile(GL_VERTEX_SHADER, vertex_src, "vertex");
+  GLuint fs = compile(GL_FRAGMENT_SHADER, fs_src, name);
+  free(fs_src);
+  if (!vs || !fs) {
+    return 0;
+  }
+  GLuint prog = glCreateProgram();
+  glAttachShader(prog, vs);
+  glAttachShader(prog, fs);
+  glBindAttribLocation(prog, 0, "vertexPosition");
+  glBindAttribLocation(prog, 1, "vertexTexCoord");
+  glLinkProgram(prog);
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+  GLint ok = 0;
+  glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+  if (!ok) {
+    char info[1024];
+    glGetProgramInfoLog(prog, sizeof(info), NULL, info);
+    fprintf(stderr, "%s: link failed:\n%s\n", name, info);
+    return 0;
+  }
+  return prog;
+}
+
+static int init_egl(void) {
+  EGLDisplay dpy = EGL_NO_DISPLAY;
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+  if (get_platform_display) {
+    dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+  }
+#endif
+  if (dpy == EGL_NO_DISPLAY) {
+    dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+  if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, NULL, NULL)) {
+    fprintf(stderr, "No EGL display.\n");
+    return 0;
+  }
+  eglBindAPI(EGL_OPENGL_ES_API);
+
+  static const EGLint config_attrs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE,
+                                        EGL_OPENGL_ES2_BIT, EGL_NONE};
+  static const EGLint pbuffer_attrs[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE};
+  static const EGLint context_attrs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+  EGLConfig config;
+  EGLint count = 0;
+  EGLSurface surface = EGL_NO_SURFACE;
+  if (eglChooseConfig(dpy, config_attrs, &config, 1, &count) && count > 0) {
+    surface = eglCreatePbufferSurface(dpy, config, pbuffer_attrs);
+  } else {
+    // Surfaceless displays may only offer configs without a surface type.
+    static const EGLint any_attrs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT, EGL_NONE};
+    if (!eglChooseConfig(dpy, any_attrs, &config, 1, &count) || count == 0) {
+      fprintf(stderr, "No GLES2 EGL config.\n");
+      return 0;
+    }
+  }
+  EGLContext ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, context_attrs);
+  if (ctx == EGL_NO_CONTEXT || !eglMakeCurrent(dpy, surface, surface, ctx)) {
+    fprintf(stderr, "Cannot create a GLES2 context.\n");
+    return 0;
+  }
+  printf("GL renderer: %s\n", (const char*)glGetString(GL_RENDERER));
+  return 1;
+}
+
+static GLenum raw_gl_format(uint16_t format) {
+  return rtg_pixel_size[format] == 1 ? GL_LUMINANCE : GL_LUMINANCE_ALPHA;
+}
+
+static GLuint make_texture(GLenum gl_format, int w, int h, const void* data) {
+  GLuint tex;
+  glGenTextures(1, &tex);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, (GLint)gl_format, w, h, 0, gl_format, GL_UNSIGNED_BYTE, data);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return tex;
+}
+
+// Uniforms as rtg-output-raylib.c sets them.
+static void set_uniforms(GLuint prog, uint16_t format, int width) {
+  glUseProgram(prog);
+  glUniform1i(glGetUniformLocation(prog, "texture0"), 0);
+  switch (shader_for(format)) {
+  case SH_RGB16:
+    glUniform1f(glGetUniformLocation(prog, "bigEndian"),
+                format == RTGFMT_RGB565_BE || format == RTGFMT_RGB555_BE ? 1.0f : 0.0f);
+    glUniform1f(glGetUniformLocation(prog, "rgb555"),
+                format == RTGFMT_RGB555_BE || format == RTGFMT_RGB555_LE ||
+                        format == RTGFMT_BGR555_LE
+                    ? 1.0f
+                    : 0.0f);
+    glUniform1f(glGetUniformLocation(prog, "bgr"),
+                format == RTGFMT_BGR565_LE || format == RTGFMT_BGR555_LE ? 1.0f : 0.0f);
+    break;
+  case SH_YUV422: {
+    static const char* names[4] = {"selY0", "selY1", "selU", "selV"};
+    uint8_t order[4];
+    rtg_convert_yuv422_order(format, order);
+    glUniform1f(glGetUniformLocation(prog, "texWidth"), (float)width);
+    for (int i = 0; i < 4; i++) {
+      float sel[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      sel[order[i]] = 1.0f;
+      glUniform4fv(glGetUniformLocation(prog, names[i]), 1, sel);
+    }
+    break;
+  }
+  case SH_YUV411:
+    glUniform1f(glGetUniformLocation(prog, "texWidth"), (float)width);
+    glUniform1f(glGetUniformLocation(prog, "pc"), format == RTGFMT_YUV411_PC ? 1.0f : 0.0f);
+    break;
+  }
+}
+
+static void draw_quad(void) {
+  // Texture row 0 at the top of the target, like DrawTexturePro.
+  static const GLfloat pos[] = {-1, -1, 1, -1, -1, 1, 1, 1};
+  static const GLfloat uv[] = {0, 0, 1, 0, 0, 1, 1, 1};
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, pos);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, uv);
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+// Draw the raw texture into an RGBA target of w*scale x h*scale and read it
+// back.
+static void render(GLuint prog, uint16_t format, GLuint tex, int w, int h, int scale,
+                   uint8_t* out) {
+  int tw = w * scale, th = h * scale;
+  GLuint target, fbo;
+  glGenTextures(1, &target);
+  glBindTexture(GL_TEXTURE_2D, target);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tw, th, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+  glViewport(0, 0, tw, th);
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  set_uniforms(prog, format, w);
+  draw_quad();
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, tw, th, GL_RGBA, GL_UNSIGNED_BYTE, out);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteTextures(1, &target);
+}
+
+// CPU reference for one pixel as 8-bit R, G, B.
+static void reference_rgb(uint16_t format, const void* cpu_row, int x, uint8_t rgb[3]) {
+  if (rtg_convert_dst_bpp(format) == 2) {
+    uint16_t v = ((const uint16_t*)cpu_row)[x];
+    rgb[0] = (uint8_t)(((v >> 11) * 255 + 15) / 31);
+    rgb[1] = (uint8_t)((((v >> 5) & 0x3F) * 255 + 31) / 63);
+    rgb[2] = (uint8_t)(((v & 0x1F) * 255 + 15) / 31);
+  } else {
+    uint32_t v = ((const uint32_t*)cpu_row)[x];
+    rgb[0] = (uint8_t)(v >> 16);
+    rgb[1] = (uint8_t)(v >> 8);
+    rgb[2] = (uint8_t)v;
+  }
+}
+
+// 16-bit 555 formats: the CPU path widens green to 6 bits first, the shader
+// scales the 5-bit value directly, which can differ by 2 steps.
+#define TOLERANCE_16 2
+#define TOLERANCE_YUV 1
+
+static int check_format(uint16_t format, int w, int h) {
+  size_t bpp = rtg_pixel_size[format];
+  size_t row_bytes = (size_t)w * bpp;
+  uint8_t* vram = malloc(row_bytes * h);
+  uint8_t* cpu = malloc((size_t)w * h * 4);
+  uint8_t* gpu = malloc((size_t)w * h * 4 * 9);
+  if (!vram || !cpu || !gpu) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < row_bytes * h; i++) {
+    vram[i] = rnd8();
+  }
+  rtg_convert_fn conv = rtg_convert_lookup(format, RTG_CONVERT_SCALAR);
+  size_t dst_bpp = rtg_convert_dst_bpp(format);
+  for (int y = 0; y < h; y++) {
+    conv(cpu + (size_t)y * w * dst_bpp, vram + (size_t)y * row_bytes, (size_t)w, NULL);
+  }
+
+  GLuint tex = make_texture(raw_gl_format(format), w, h, vram);
+  int tolerance = dst_bpp == 2 ? TOLERANCE_16 : TOLERANCE_YUV;
+  int fail = 0;
+  for (int scale = 1; scale <= 3; scale += 2) {
+    render(programs[shader_for(format)], format, tex, w, h, scale, gpu);
+    int max_diff = 0, bad = 0;
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+        uint8_t ref[3];
+        reference_rgb(format, cpu + (size_t)y * w * dst_bpp, x, ref);
+        // Centre of the scaled pixel; readback row 0 is texture row 0.
+        const uint8_t* px =
+            gpu + (((size_t)(y * scale + scale / 2) * w * scale) + (size_t)(x * scale + scale / 2)) * 4;
+        for (int c = 0; c < 3; c++) {
+          int d = abs((int)px[c] - (int)ref[c]);
+          if (d > max_diff) {
+            max_diff = d;
+          }
+          if (d > tolerance && bad++ < 3) {
+            printf("    %s %dx: pixel %d,%d channel %d: gpu %u cpu %u\n", format_names[format],
+                   scale, x, y, c, px[c], ref[c]);
+          }
+        }
+      }
+    }
+    printf("  %-12s %dx%d x%d  max diff %d%s\n", format_names[format], w, h, scale, max_diff,
+           bad ? "  FAIL" : "");
+    fail |= bad != 0;
+  }
+  glDeleteTextures(1, &tex);
+  free(vram);
+  free(cpu);
+  free(gpu);
+  return fail;
+}
+
+// Per-frame RTG thread CPU time: convert + RGBA upload against raw upload.
+static void time_format(uint16_t format, int w, int h, int frames) {
+  size_t bpp = rtg_pixel_size[format];
+  size_t dst_bpp = rtg_convert_dst_bpp(format);
+  uint8_t* vram = malloc((size_t)w * h * bpp);
+  uint8_t* cpu = malloc((size_t)w * h * dst_bpp);
+  if (!vram || !cpu) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < (size_t)w * h * bpp; i++) {
+    vram[i] = rnd8();
+  }
+  rtg_convert_fn conv = rtg_convert_lookup(format, RTG_CONVERT_BEST);
+  GLenum cpu_format = dst_bpp == 2 ? GL_RGB : GL_RGBA;
+  GLenum cpu_type = dst_bpp == 2 ? GL_UNSIGNED_SHORT_5_6_5 : GL_UNSIGNED_BYTE;
+  GLuint cpu_tex;
+  glGenTextures(1, &cpu_tex);
+  glBindTexture(GL_TEXTURE_2D, cpu_tex);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, (GLint)cpu_format, w, h, 0, cpu_format, cpu_type, NULL);
+  GLuint raw_tex = make_texture(raw_gl_format(format), w, h, NULL);
+
+  uint64_t before = 0, after = 0;
+  for (int f = 0; f < frames; f++) {
+    vram[(size_t)f % ((size_t)w * h * bpp)] ^= 0x5A;
+    glFinish();
+    uint64_t t0 = thread_cpu_ns();
+    for (int y = 0; y < h; y++) {
+      conv(cpu + (size_t)y * w * dst_bpp, vram + (size_t)y * w * bpp, (size_t)w, NULL);
+    }
+    glBindTexture(GL_TEXTURE_2D, cpu_tex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, cpu_format, cpu_type, cpu);
+    glFlush();
+    before += thread_cpu_ns() - t0;
+
+    glFinish();
+    t0 = thread_cpu_ns();
+    glBindTexture(GL_TEXTURE_2D, raw_tex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, raw_gl_format(format), GL_UNSIGNED_BYTE, vram);
+    glFlush();
+    after += thread_cpu_ns() - t0;
+  }
+  printf("  %-12s %dx%d  cpu convert+upload %7.3f ms/frame  raw upload %7.3f ms/frame  "
+         "(%.1f%% -> %.1f%% of a core at 25 fps)\n",
+         format_names[format], w, h, (double)before / frames / 1e6,
+         (double)after / frames / 1e6, (double)before / frames / 1e6 * 2.5,
+         (double)after / frames / 1e6 * 2.5);
+  glDeleteTextures(1, &cpu_tex);
+  glDeleteTextures(1, &raw_tex);
+  free(vram);
+  free(cpu);
+}
+
+int main(int argc, char** argv) {
+  int tw = argc > 2 ? atoi(argv[1]) : 720;
+  int th = argc > 2 ? atoi(argv[2]) : 576;
+  int frames = argc > 3 ? atoi(argv[3]) : 100;
+  if (tw <= 0 || th <= 0 || frames <= 0) {
+    fprintf(stderr, "Usage: %s [width height frames]\n", argv[0]);
+    return 2;
+  }
+
+  if (!init_egl()) {
+    return 2;
+  }
+  for (int i = 0; i < SH_NUM; i++) {
+    programs[i] = load_program(shader_files[i]);
+    if (!programs[i]) {
+      return 1;
+    }
+  }
+
+  int fail = 0;
+  printf("Shader output against the CPU converters (tolerance %d for 16-bit, %d for YUV):\n",
+         TOLERANCE_16, TOLERANCE_YUV);
+  for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+    // Odd sizes so the YUV row tails are covered too.
+    fail |= check_format(formats[i], 333, 37);
+    fail |= check_format(formats[i], 640, 16);
+  }
+
+  printf("RTG thread CPU time per frame (converters: %s):\n", rtg_convert_impl_name());
+  time_format(RTGFMT_YUV422_CGX, tw, th, frames);
+  time_format(RTGFMT_YUV411, tw, th, frames);
+  time_format(RTGFMT_RGB565_BE, tw, th, frames);
+
+  printf(fail ? "FAIL\n" : "OK: shaders match the CPU converters\n");
+  return fail;
+}
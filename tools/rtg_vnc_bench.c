@@ -0,0 +1,630 @@
+// SPDX-License-Identifier: MIT
+// tools/rtg_vnc_bench.c
+//
+// Connects a minimal RFB client to the RTG VNC server (rtg-vnc.c) on
+// localhost and checks and measures it:
+//
+//   1. Every displayable RTG format: random VRAM (and palette) on a 320x200
+//      screen must reach the client exactly as the headless output backend
+//      converts it, in the default 32-bit format and, within rounding, in a
+//      16-bit client format. A mode change must arrive as DesktopSize.
+//   2. Key and pointer events must come out as Linux key codes and PS/2
+//      buttons on the emulator's remote input hooks.
+//   3. Bandwidth and server CPU on a 1920x1080 32-bit screen for an idle
+//      screen, light drawing (a blinking cursor and a line of text at 30 Hz)
+//      and busy drawing (large fills and a moving 400x300 window at 60 Hz),
+//      each with and without the VRAM dirty map, against what copying the
+//      whole frame at the same rate would cost.
+//
+// Exit code 0 means every check passed.
+//
+// Usage: rtg_vnc_bench [seconds-per-scenario]   (default 3)
+
+#include <arpa/inet.h>
+#include <linux/input-event-codes.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_file/config_file.h"
+#include "log.h"
+#include "metrics/metrics.h"
+#include "platforms/amiga/rtg/rtg.h"
+#include "platforms/amiga/rtg/rtg-output-headless.h"
+#include "platforms/amiga/rtg/rtg-vnc.h"
+
+// What rtg.c and rtg-vnc.c link against in the emulator.
+struct emulator_config* cfg;
+struct pistorm_metrics pistorm_metrics;
+int cpu_emulation_running = 1;
+uint8_t rtg_enabled = 1;
+extern uint8_t emulator_exiting;
+extern uint8_t* rtg_mem;
+
+void log_message(int level, const char* fmt, ...) {
+  if (level > LOG_LEVEL_WARN) {
+    return;
+  }
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+void log_event(int level, const char* fmt, const uint64_t* args, unsigned int nargs) {
+  (void)level;
+  (void)fmt;
+  (void)args;
+  (void)nargs;
+}
+
+void add_mapping(struct emulator_config* c, unsigned int type, unsigned int addr, unsigned int size,
+                 unsigned int mirr_addr, char* filename, const char* map_id, unsigned int autodump) {
+  (void)c, (void)type, (void)addr, (void)size, (void)mirr_addr, (void)filename, (void)map_id;
+  (void)autodump;
+}
+
+uint8_t* get_mapped_data_pointer_by_address(struct emulator_config* c, uint32_t address) {
+  (void)c;
+  (void)address;
+  return NULL;
+}
+
+unsigned int m68k_read_memory_8(unsigned int address) {
+  (void)address;
+  return 0;
+}
+uint8_t ps_read_8(uint32_t address) {
+  (void)address;
+  return 0;
+}
+uint16_t ps_read_16(uint32_t address) {
+  (void)address;
+  return 0;
+}
+uint32_t ps_read_32(uint32_t address) {
+  (void)address;
+  return 0;
+}
+unsigned int m68k_get_reg(void* context, m68k_register_t reg) {
+  (void)context;
+  (void)reg;
+  return 0;
+}
+void m68k_end_timeslice(void) {
+}
+void m68k_add_ram_range(uint32_t addr, uint32_t upper, unsigned char* ptr) {
+  (void)addr, (void)upper, (void)ptr;
+}
+void m68k_set_ram_range_dirty_map(unsigned char* ptr, unsigned char* map) {
+  (void)ptr, (void)map;
+}
+void m68k_suspend_ram_range(unsigned char* ptr, int suspend) {
+  (void)ptr, (void)suspend;
+}
+
+// The emulator's remote input hooks, recorded for step 2.
+static uint16_t last_key;
+static uint8_t last_key_pressed;
+static unsigned int key_calls;
+static uint8_t last_buttons;
+static int8_t last_wheel;
+static int mouse_x_sum, mouse_y_sum;
+
+void emulator_remote_key(uint16_t code, uint8_t pressed) {
+  last_key = code;
+  last_key_pressed = pressed;
+  key_calls++;
+}
+
+void emulator_remote_mouse(int16_t dx, int16_t dy, uint8_t buttons, int8_t wheel) {
+  mouse_x_sum += dx;
+  mouse_y_sum += dy;
+  last_buttons = buttons;
+  if (wheel) {
+    last_wheel = wheel;
+  }
+}
+
+#define VRAM_BASE (PIGFX_RTG_BASE + PIGFX_REG_SIZE)
+
+static unsigned int failures;
+
+#define CHECK(cond, ...)                                                                           \
+  do {                                                                                             \
+    if (!(cond)) {                                                                                 \
+      printf("  FAIL %s:%d: ", __FILE__, __LINE__);                                                \
+      printf(__VA_ARGS__);                                                                         \
+      printf("\n");                                                                                \
+      failures++;                                                                                  \
+    }                                                                                              \
+  } while (0)
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void reg(uint32_t address, uint32_t value, uint8_t type) {
+  rtg_write(address, value, type);
+}
+
+// SetGC + SetPan + SetSwitch, as P96 does on a mode switch.
+static void set_mode(uint16_t format, uint16_t w, uint16_t h, uint32_t fb_offset) {
+  reg(RTG_FORMAT, format, OP_TYPE_WORD);
+  reg(RTG_X1, w, OP_TYPE_WORD);
+  reg(RTG_Y1, h, OP_TYPE_WORD);
+  reg(RTG_Y2, h, OP_TYPE_WORD);
+  reg(RTG_U81, 0, OP_TYPE_BYTE);
+  reg(RTG_COMMAND, RTGCMD_SETGC, OP_TYPE_WORD);
+  reg(RTG_ADDR1, VRAM_BASE + fb_offset, OP_TYPE_LONGWORD);
+  reg(RTG_X1, w, OP_TYPE_WORD);
+  reg(RTG_X2, 0, OP_TYPE_WORD);
+  reg(RTG_Y2, 0, OP_TYPE_WORD);
+  reg(RTG_COMMAND, RTGCMD_SETPAN, OP_TYPE_WORD);
+  reg(RTG_X1, 1, OP_TYPE_WORD);
+  reg(RTG_COMMAND, RTGCMD_SETSWITCH, OP_TYPE_WORD);
+}
+
+static void fill(uint16_t pitch_px, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+                 uint32_t color) {
+  reg(RTG_ADDR1, VRAM_BASE, OP_TYPE_LONGWORD);
+  reg(RTG_FORMAT, RTGFMT_RGB32_ARGB, OP_TYPE_WORD);
+  reg(RTG_U81, 0xFF, OP_TYPE_BYTE);
+  reg(RTG_X1, x, OP_TYPE_WORD);
+  reg(RTG_Y1, y, OP_TYPE_WORD);
+  reg(RTG_X2, w, OP_TYPE_WORD);
+  reg(RTG_Y2, h, OP_TYPE_WORD);
+  reg(RTG_X3, pitch_px * 4u, OP_TYPE_WORD);
+  reg(RTG_RGB1, color, OP_TYPE_LONGWORD);
+  reg(RTG_COMMAND, RTGCMD_FILLRECT, OP_TYPE_WORD);
+}
+
+static void blit(uint16_t pitch_px, uint16_t sx, uint16_t sy, uint16_t dx, uint16_t dy,
+                 uint16_t w, uint16_t h) {
+  reg(RTG_ADDR1, VRAM_BASE, OP_TYPE_LONGWORD);
+  reg(RTG_FORMAT, RTGFMT_RGB32_ARGB, OP_TYPE_WORD);
+  reg(RTG_X1, sx, OP_TYPE_WORD);
+  reg(RTG_Y1, sy, OP_TYPE_WORD);
+  reg(RTG_X2, dx, OP_TYPE_WORD);
+  reg(RTG_Y2, dy, OP_TYPE_WORD);
+  reg(RTG_X3, w, OP_TYPE_WORD);
+  reg(RTG_Y3, h, OP_TYPE_WORD);
+  reg(RTG_X4, pitch_px * 4u, OP_TYPE_WORD);
+  reg(RTG_U81, 0xFF, OP_TYPE_BYTE);
+  reg(RTG_COMMAND, RTGCMD_BLITRECT, OP_TYPE_WORD);
+}
+
+static void set_clut(uint8_t index, uint32_t xrgb) {
+  reg(RTG_U81, index, OP_TYPE_BYTE);
+  reg(RTG_RGB1, xrgb, OP_TYPE_LONGWORD);
+  reg(RTG_COMMAND, RTGCMD_SETCLUT, OP_TYPE_WORD);
+}
+
+static uint32_t rng = 0x12345678;
+static uint32_t rnd(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+/* A minimal RFB 3.8 client. */
+
+static int cfd = -1;
+static uint64_t client_bytes;
+static uint32_t* cfb; // what the client has, 0x00RRGGBB
+static uint16_t cfb_w, cfb_h;
+static uint8_t client_bpp = 32;
+static unsigned int desktop_resizes;
+
+static int rd(void* buf, size_t n) {
+  uint8_t* p = buf;
+  while (n) {
+    ssize_t r = recv(cfd, p, n, 0);
+    if (r <= 0) {
+      return -1;
+    }
+    p += r;
+    n -= (size_t)r;
+    client_bytes += (uint64_t)r;
+  }
+  return 0;
+}
+
+static void wr(const void* buf, size_t n) {
+  if (send(cfd, buf, n, MSG_NOSIGNAL) != (ssize_t)n) {
+    printf("  client send failed\n");
+  }
+}
+
+static uint16_t be16(const uint8_t* p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void cfb_resize(uint16_t w, uint16_t h) {
+  free(cfb);
+  cfb = calloc((size_t)w * h, sizeof(uint32_t));
+  cfb_w = w;
+  cfb_h = h;
+}
+
+static void client_connect(int port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  cfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(cfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    printf("  cannot connect to port %d\n", port);
+    exit(1);
+  }
+
+  uint8_t buf[64];
+  rd(buf, 12);
+  CHECK(!memcmp(buf, "RFB 003.008\n", 12), "server version %.11s", buf);
+  wr("RFB 003.008\n", 12);
+  rd(buf, 2);
+  CHECK(buf[0] == 1 && buf[1] == 1, "security types %u/%u", buf[0], buf[1]);
+  uint8_t none = 1;
+  wr(&none, 1);
+  rd(buf, 4);
+  CHECK(!memcmp(buf, "\0\0\0\0", 4), "security result");
+  uint8_t shared = 1;
+  wr(&shared, 1);
+  rd(buf, 24);
+  uint32_t name_len = ((uint32_t)buf[20] << 24) | ((uint32_t)buf[21] << 16) |
+                      ((uint32_t)buf[22] << 8) | buf[23];
+  uint8_t name[256];
+  rd(name, name_len < sizeof(name) ? name_len : sizeof(name));
+  cfb_resize(be16(buf), be16(buf + 2));
+  client_bpp = 32;
+
+  // SetEncodings: RRE, Raw, DesktopSize.
+  static const uint8_t enc[] = {2, 0, 0, 3, 0, 0, 0, 2, 0, 0, 0, 0, 0xFF, 0xFF, 0xFF, 0x21};
+  wr(enc, sizeof(enc));
+}
+
+static void client_set_rgb565(void) {
+  static const uint8_t pf[20] = {0, 0, 0, 0, 16, 16, 0, 1, 0, 31, 0, 63, 0, 31, 11, 5, 0, 0, 0, 0};
+  wr(pf, sizeof(pf));
+  client_bpp = 16;
+}
+
+static void client_disconnect(void) {
+  close(cfd);
+  cfd = -1;
+}
+
+static void request(int incremental) {
+  uint8_t m[10] = {3, (uint8_t)incremental, 0, 0, 0, 0, (uint8_t)(cfb_w >> 8), (uint8_t)cfb_w,
+                   (uint8_t)(cfb_h >> 8), (uint8_t)cfb_h};
+  wr(m, sizeof(m));
+}
+
+static uint32_t decode_pixel(const uint8_t* p) {
+  if (client_bpp == 32) {
+    return ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+  }
+  uint16_t v = (uint16_t)(p[0] | (p[1] << 8));
+  uint32_t r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+  return ((r * 255 + 15) / 31) << 16 | ((g * 255 + 31) / 63) << 8 | ((b * 255 + 15) / 31);
+}
+
+static uint32_t read_pixel(void) {
+  uint8_t p[4] = {0};
+  rd(p, client_bpp / 8);
+  return decode_pixel(p);
+}
+
+// Read one FramebufferUpdate if it arrives within timeout_ms and apply it.
+// Returns the number of rectangles, 0 on timeout, -1 on error.
+static int read_update(int timeout_ms) {
+  struct pollfd pfd = {cfd, POLLIN, 0};
+  if (poll(&pfd, 1, timeout_ms) <= 0) {
+    return 0;
+  }
+  uint8_t head[4];
+  if (rd(head, 4) < 0 || head[0] != 0) {
+    return -1;
+  }
+  int rects = be16(head + 2);
+  for (int i = 0; i < rects; i++) {
+    uint8_t r[12];
+    rd(r, 12);
+    uint16_t x = be16(r), y = be16(r + 2), w = be16(r + 4), h = be16(r + 6);
+    int32_t enc = (int32_t)(((uint32_t)r[8] << 24) | ((uint32_t)r[9] << 16) |
+                            ((uint32_t)r[10] << 8) | r[11]);
+    if (enc == -223) {
+      cfb_resize(w, h);
+      desktop_resizes++;
+      continue;
+    }
+    if (x + w > cfb_w || y + h > cfb_h) {
+      printf("  rect %ux%u+%u+%u outside %ux%u\n", w, h, x, y, cfb_w, cfb_h);
+      return -1;
+    }
+    if (enc == 0) {
+      static uint8_t row[RTG_VNC_TILE * 4 * 32];
+      size_t bpp = client_bpp / 8u;
+      for (uint16_t yy = 0; yy < h; yy++) {
+        size_t done = 0;
+        while (done < w) {
+          size_t n = w - done < sizeof(row) / bpp ? w - done : sizeof(row) / bpp;
+          rd(row, n * bpp);
+          for (size_t i = 0; i < n; i++) {
+            cfb[(size_t)(y + yy) * cfb_w + x + done + i] = decode_pixel(&row[i * bpp]);
+          }
+          done += n;
+        }
+      }
+    } else if (enc == 2) {
+      uint8_t n[4];
+      rd(n, 4);
+      uint32_t subrects = ((uint32_t)n[0] << 24) | ((uint32_t)n[1] << 16) |
+                          ((uint32_t)n[2] << 8) | n[3];
+      uint32_t bg = read_pixel();
+      for (uint16_t yy = 0; yy < h; yy++) {
+        for (uint16_t xx = 0; xx < w; xx++) {
+          cfb[(size_t)(y + yy) * cfb_w + x + xx] = bg;
+        }
+      }
+      for (uint32_t s = 0; s < subrects; s++) {
+        uint32_t fg = read_pixel();
+        uint8_t g[8];
+        rd(g, 8);
+        for (uint16_t yy = 0; yy < be16(g + 6); yy++) {
+          for (uint16_t xx = 0; xx < be16(g + 4); xx++) {
+            cfb[(size_t)(y + be16(g + 2) + yy) * cfb_w + x + be16(g) + xx] = fg;
+          }
+        }
+      }
+    } else {
+      printf("  unexpected encoding %d\n", enc);
+      return -1;
+    }
+  }
+  return rects ? rects : 1;
+}
+
+// Request and apply updates until nothing arrives for quiet_ms.
+static void sync_client(int quiet_ms) {
+  for (;;) {
+    request(1);
+    int r = read_update(quiet_ms);
+    if (r <= 0) {
+      // The request is still outstanding; the next read picks up its answer.
+      return;
+    }
+  }
+}
+
+/* 1. Formats. */
+
+static uint8_t* rgb;
+
+static void check_format(const char* name, uint16_t format) {
+  const uint16_t w = 320, h = 200;
+  set_mode(format, w, h, 0);
+  if (format == RTGFMT_8BIT_CLUT) {
+    for (int i = 0; i < 256; i++) {
+      set_clut((uint8_t)i, rnd() & 0xFFFFFF);
+    }
+  }
+  size_t bytes = (size_t)w * h * rtg_pixel_size[format];
+  for (size_t i = 0; i < bytes; i++) {
+    rtg_mem[i] = (uint8_t)rnd();
+  }
+  rtg_mark_dirty(0, bytes);
+  rtg_headless_render_frame();
+  uint16_t rw = 0, rh = 0;
+  rtg_headless_read_rgb(rgb, 1920u * 1080u * 3u, &rw, &rh);
+
+  sync_client(200);
+  CHECK(cfb_w == w && cfb_h == h, "%s: client is %ux%u", name, cfb_w, cfb_h);
+  int tolerance = client_bpp == 16 ? 8 : 0;
+  unsigned int bad = 0;
+  for (uint16_t y = 0; y < h && cfb_w == w && cfb_h == h; y++) {
+    for (uint16_t x = 0; x < w; x++) {
+      const uint8_t* e = &rgb[((size_t)y * rw + x) * 3];
+      uint32_t c = cfb[(size_t)y * w + x];
+      int dr = abs((int)((c >> 16) & 0xFF) - e[0]);
+      int dg = abs((int)((c >> 8) & 0xFF) - e[1]);
+      int db = abs((int)(c & 0xFF) - e[2]);
+      if (dr > tolerance || dg > tolerance || db > tolerance) {
+        if (!bad) {
+          printf("  %s: (%u,%u) client %06X, display %02X%02X%02X\n", name, x, y, c, e[0], e[1],
+                 e[2]);
+        }
+        bad++;
+      }
+    }
+  }
+  CHECK(!bad, "%s: %u pixels differ from the display output (%u-bit client)", name, bad,
+        client_bpp);
+}
+
+static void test_formats(int port) {
+  static const struct {
+    const char* name;
+    uint16_t format;
+  } formats[] = {
+      {"8BIT_CLUT", RTGFMT_8BIT_CLUT},   {"RGB565_BE", RTGFMT_RGB565_BE},
+      {"RGB565_LE", RTGFMT_RGB565_LE},   {"BGR565_LE", RTGFMT_BGR565_LE},
+      {"RGB555_BE", RTGFMT_RGB555_BE},   {"RGB555_LE", RTGFMT_RGB555_LE},
+      {"BGR555_LE", RTGFMT_BGR555_LE},   {"RGB32_ARGB", RTGFMT_RGB32_ARGB},
+      {"RGB32_ABGR", RTGFMT_RGB32_ABGR}, {"RGB32_RGBA", RTGFMT_RGB32_RGBA},
+      {"RGB32_BGRA", RTGFMT_RGB32_BGRA}, {"YUV422", RTGFMT_YUV422},
+      {"YUV422_PC", RTGFMT_YUV422_PC},   {"YUV411", RTGFMT_YUV411},
+  };
+  printf("Formats, 32-bit client\n");
+  client_connect(port);
+  request(0);
+  for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+    check_format(formats[i].name, formats[i].format);
+  }
+  printf("Formats, 16-bit client\n");
+  client_set_rgb565();
+  request(0);
+  sync_client(200);
+  for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+    check_format(formats[i].name, formats[i].format);
+  }
+  CHECK(desktop_resizes >= 1, "no DesktopSize after the mode change");
+
+  printf("Input\n");
+  const uint8_t key_down[8] = {4, 1, 0, 0, 0, 0, 0, 'a'};
+  const uint8_t key_up[8] = {4, 0, 0, 0, 0, 0, 0xFF, 0x0D};
+  const uint8_t ptr_down[6] = {5, 1 | 4, 0, 10, 0, 10};
+  const uint8_t ptr_move[6] = {5, 0, 0, 50, 0, 30};
+  const uint8_t wheel[6] = {5, 16, 0, 50, 0, 30};
+  wr(key_down, 8);
+  wr(ptr_down, 6);
+  usleep(100000);
+  CHECK(last_key == KEY_A && last_key_pressed == 1, "key %u/%u", last_key, last_key_pressed);
+  CHECK(last_buttons == 0x03, "buttons %02X", last_buttons);
+  wr(key_up, 8);
+  wr(ptr_move, 6);
+  wr(wheel, 6);
+  usleep(200000);
+  CHECK(last_key == KEY_ENTER && !last_key_pressed, "key %u/%u", last_key, last_key_pressed);
+  CHECK(last_wheel == 1, "wheel %d", last_wheel);
+  CHECK(mouse_x_sum == 40 && mouse_y_sum == 20, "pointer moved %d,%d", mouse_x_sum, mouse_y_sum);
+  client_disconnect();
+}
+
+/* 3. Bandwidth and CPU. */
+
+enum load { LOAD_IDLE, LOAD_LIGHT, LOAD_BUSY };
+
+static volatile int drawing;
+static enum load draw_load;
+
+#define BENCH_W 1920
+#define BENCH_H 1080
+
+static void* draw_thread(void* arg) {
+  (void)arg;
+  uint64_t period = draw_load == LOAD_LIGHT ? 33333333ull : 16666667ull;
+  uint64_t next = now_ns();
+  unsigned int frame = 0;
+  while (drawing) {
+    if (draw_load == LOAD_LIGHT) {
+      // A blinking cursor and a character appearing every frame.
+      fill(BENCH_W, 600, 500, 8, 16, (frame & 8) ? 0x00FFFFFF : 0x00000000);
+      fill(BENCH_W, (uint16_t)(100 + (frame % 120) * 8), 500, 8, 16, 0x00FFFFFF - frame);
+    } else if (draw_load == LOAD_BUSY) {
+      // A 400x300 window dragged across the screen over a changing backdrop.
+      uint16_t x = (uint16_t)(100 + (frame * 7) % 1200);
+      uint16_t y = (uint16_t)(100 + (frame * 3) % 600);
+      fill(BENCH_W, (uint16_t)(rnd() % 1500), (uint16_t)(rnd() % 800), 400, 250, rnd() & 0xFFFFFF);
+      blit(BENCH_W, 0, 0, x, y, 400, 300);
+    }
+    frame++;
+    next += period;
+    uint64_t now = now_ns();
+    if (next > now) {
+      usleep((useconds_t)((next - now) / 1000));
+    } else {
+      next = now;
+    }
+  }
+  return NULL;
+}
+
+static void scenario(const char* name, enum load load, int use_dirty, double seconds) {
+  uint8_t* dirty = rtg_dirty;
+  if (!use_dirty) {
+    rtg_dirty = NULL;
+  }
+  fill(BENCH_W, 0, 0, BENCH_W, BENCH_H, 0x00204060);
+  fill(BENCH_W, 0, 0, 400, 300, 0x00C0C0C0);
+  sync_client(300);
+  rtg_vnc_reset_stats();
+  client_bytes = 0;
+
+  pthread_t tid;
+  drawing = 1;
+  draw_load = load;
+  pthread_create(&tid, NULL, draw_thread, NULL);
+  uint64_t t0 = now_ns(), end = t0 + (uint64_t)(seconds * 1e9);
+  unsigned int updates = 0;
+  request(1);
+  while (now_ns() < end) {
+    int r = read_update(50);
+    if (r < 0) {
+      printf("  client error\n");
+      failures++;
+      break;
+    }
+    if (r > 0) {
+      updates++;
+      request(1);
+    }
+  }
+  drawing = 0;
+  pthread_join(tid, NULL);
+  double wall = (double)(now_ns() - t0) / 1e9;
+  struct rtg_vnc_stats s;
+  rtg_vnc_get_stats(&s);
+  rtg_dirty = dirty;
+
+  printf("  %-6s %-8s %9.1f KB/s %7.1f upd/s %8.0f rows/s %7.0f tiles/s %6.1f%% CPU\n", name,
+         use_dirty ? "damage" : "no map", (double)client_bytes / wall / 1024.0, updates / wall,
+         (double)s.rows_converted / wall, (double)s.tiles_changed / wall,
+         (double)s.cpu_ns / 1e9 / wall * 100.0);
+  sync_client(300);
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 3.0;
+  if (seconds <= 0) {
+    seconds = 3.0;
+  }
+  setenv("PISTORM_RTG_HEADLESS_FPS", "0", 1);
+  unsetenv("PISTORM_RTG_CAPTURE");
+  unsetenv("PISTORM_RTG_ASYNC");
+  unsetenv("PISTORM_RTG_VNC");
+  setenv("PISTORM_RTG_VNC_FPS", "30", 1);
+  rtg_set_async(0);
+  rgb = malloc(1920u * 1080u * 3u);
+
+  if (!init_rtg_data(NULL) || !rtg_vnc_start("127.0.0.1:0")) {
+    printf("Cannot start RTG or the VNC server.\n");
+    return 1;
+  }
+  emulator_exiting = 0;
+  int port = rtg_vnc_port();
+  test_formats(port);
+
+  printf("Bandwidth and server CPU, %ux%u 32-bit, 30 updates/s (whole frames: %.0f KB/s)\n",
+         BENCH_W, BENCH_H, BENCH_W * BENCH_H * 4.0 * 30.0 / 1024.0);
+  set_mode(RTGFMT_RGB32_ARGB, BENCH_W, BENCH_H, 0);
+  client_connect(port);
+  request(0);
+  sync_client(300);
+  scenario("idle", LOAD_IDLE, 1, seconds);
+  scenario("idle", LOAD_IDLE, 0, seconds);
+  scenario("light", LOAD_LIGHT, 1, seconds);
+  scenario("light", LOAD_LIGHT, 0, seconds);
+  scenario("busy", LOAD_BUSY, 1, seconds);
+  scenario("busy", LOAD_BUSY, 0, seconds);
+  client_disconnect();
+
+  rtg_vnc_stop();
+  emulator_exiting = 1;
+  rtg_shutdown_display();
+  shutdown_rtg();
+  printf(failures ? "FAIL (%u)\n" : "OK\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: MIT
+// tools/rtg_vram_check.c
+//
+// Startup time and resident memory of the RTG VRAM for a few rtg-vram
+// settings. For each size the VRAM is set up through init_rtg_data() and the
+// process RSS is sampled after setup, after drawing one 1920x1080 32-bit
+// screen at the top of the VRAM and after shutdown_rtg(). The same is done for
+// the old fixed 40MB calloc() for comparison.
+//
+// Each size is also checked the way the PiGFX driver sees it: RTG_VRAM_SIZE
+// reports the size, the last VRAM byte and the scratch area behind it can be
+// written and read back, and accesses past the scratch area read as zero.
+// A failed check makes the exit code 1.
+//
+// Usage: rtg_vram_check [MB ...]   (default: 32 128 247)
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_file/config_file.h"
+#include "log.h"
+#include "metrics/metrics.h"
+#include "platforms/amiga/rtg/rtg.h"
+
+#define SCREEN_W 1920
+#define SCREEN_H 1080
+
+// What rtg.c links against in the emulator, minus the output backend.
+struct emulator_config* cfg;
+struct pistorm_metrics pistorm_metrics;
+int cpu_emulation_running = 1;
+uint8_t rtg_enabled = 1;
+extern uint8_t* rtg_mem;
+
+// Called through a volatile pointer so the compiler keeps the stores into a
+// buffer that is freed right after.
+static void* (*volatile fill)(void*, int, size_t) = memset;
+
+void log_message(int level, const char* fmt, ...) {
+  if (level > LOG_LEVEL_WARN) {
+    return;
+  }
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+void log_event(int level, const char* fmt, const uint64_t* args, unsigned int nargs) {
+  (void)level;
+  (void)fmt;
+  (void)args;
+  (void)nargs;
+}
+
+void add_mapping(struct emulator_config* c, unsigned int type, unsigned int addr, unsigned int size,
+                 unsigned int mirr_addr, char* filename, const char* map_id, unsigned int autodump) {
+  (void)c, (void)type, (void)addr, (void)size, (void)mirr_addr, (void)filename, (void)map_id;
+  (void)autodump;
+}
+
+uint8_t* get_mapped_data_pointer_by_address(struct emulator_config* c, uint32_t address) {
+  (void)c;
+  (void)address;
+  return NULL;
+}
+
+unsigned int m68k_read_memory_8(unsigned int address) {
+  (void)address;
+  return 0;
+}
+uint8_t ps_read_8(uint32_t address) {
+  (void)address;
+  return 0;
+}
+uint16_t ps_read_16(uint32_t address) {
+  (void)address;
+  return 0;
+}
+uint32_t ps_read_32(uint32_t address) {
+  (void)address;
+  return 0;
+}
+unsigned int m68k_get_reg(void* context, m68k_register_t reg) {
+  (void)context;
+  (void)reg;
+  return 0;
+}
+void m68k_end_timeslice(void) {
+}
+void m68k_add_ram_range(uint32_t addr, uint32_t upper, unsigned char* ptr) {
+  (void)addr, (void)upper, (void)ptr;
+}
+void m68k_set_ram_range_dirty_map(unsigned char* ptr, unsigned char* map) {
+  (void)ptr, (void)map;
+}
+void m68k_suspend_ram_range(unsigned char* ptr, int suspend) {
+  (void)ptr, (void)suspend;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static double rss_mb(void) {
+  unsigned long size = 0, resident = 0;
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (!f) {
+    return 0;
+  }
+  if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+    resident = 0;
+  }
+  fclose(f);
+  return (double)resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+static void draw_screen(void) {
+  const uint32_t fb = PIGFX_RTG_BASE + PIGFX_REG_SIZE;
+  rtg_write(RTG_ADDR1, fb, OP_TYPE_LONGWORD);
+  rtg_write(RTG_FORMAT, RTGFMT_RGB32_ARGB, OP_TYPE_WORD);
+  rtg_write(RTG_U81, 0xFF, OP_TYPE_BYTE);
+  rtg_write(RTG_X1, 0, OP_TYPE_WORD);
+  rtg_write(RTG_Y1, 0, OP_TYPE_WORD);
+  rtg_write(RTG_X2, SCREEN_W, OP_TYPE_WORD);
+  rtg_write(RTG_Y2, SCREEN_H, OP_TYPE_WORD);
+  rtg_write(RTG_X3, SCREEN_W * 4, OP_TYPE_WORD);
+  rtg_write(RTG_RGB1, 0x00336699, OP_TYPE_LONGWORD);
+  rtg_write(RTG_COMMAND, RTGCMD_FILLRECT, OP_TYPE_WORD);
+}
+
+static int check_window(uint32_t vram) {
+  int fail = 0;
+  uint32_t reported = rtg_read(RTG_VRAM_SIZE, OP_TYPE_LONGWORD);
+  if (reported != vram) {
+    printf("    RTG_VRAM_SIZE reads %u, expected %u\n", reported, vram);
+    fail = 1;
+  }
+  // Offsets below are relative to the start of the VRAM, as rtg_read() sees
+  // them after the register window.
+  const uint32_t last = PIGFX_REG_SIZE + vram - 4;
+  const uint32_t scratch = PIGFX_REG_SIZE + vram + PIGFX_SCRATCH_SIZE - 4;
+  rtg_write(last, 0x12345678, OP_TYPE_LONGWORD);
+  rtg_write(scratch, 0x9ABCDEF0, OP_TYPE_LONGWORD);
+  if (rtg_read(last, OP_TYPE_LONGWORD) != 0x12345678) {
+    printf("    last VRAM longword does not read back\n");
+    fail = 1;
+  }
+  if (rtg_read(scratch, OP_TYPE_LONGWORD) != 0x9ABCDEF0) {
+    printf("    scratch area does not read back\n");
+    fail = 1;
+  }
+  rtg_write(scratch + 4, 0xFFFFFFFF, OP_TYPE_LONGWORD);
+  if (rtg_read(scratch + 4, OP_TYPE_LONGWORD) != 0) {
+    printf("    access past the scratch area did not read as zero\n");
+    fail = 1;
+  }
+  if (PIGFX_UPPER > 0x80000000u) {
+    printf("    window ends at $%.8X, inside PiSCSI\n", PIGFX_UPPER);
+    fail = 1;
+  }
+  return fail;
+}
+
+int main(int argc, char** argv) {
+  static const unsigned int defaults[] = {32, 128, 247};
+  unsigned int sizes[16];
+  int count = 0;
+  for (int i = 1; i < argc && count < 16; i++) {
+    sizes[count++] = (unsigned int)strtoul(argv[i], NULL, 0);
+  }
+  if (!count) {
+    memcpy(sizes, defaults, sizeof(defaults));
+    count = 3;
+  }
+  unsetenv("PISTORM_RTG_VRAM_MB");
+  unsetenv("PISTORM_RTG_ASYNC");
+  rtg_set_async(0);
+
+  printf("%-14s %9s %9s %12s %12s %12s\n", "VRAM", "window", "setup ms", "RSS setup",
+         "RSS screen", "RSS after");
+
+  // The old fixed allocation, for comparison.
+  double rss0 = rss_mb();
+  double t0 = now_ms();
+  uint8_t* old = calloc(1, 40u * SIZE_MEGA);
+  double setup = now_ms() - t0;
+  double rss_setup = rss_mb() - rss0;
+  fill(old, 0x33, (size_t)SCREEN_W * SCREEN_H * 4);
+  double rss_screen = rss_mb() - rss0;
+  free(old);
+  printf("%-14s %9s %9.3f %9.1f MB %9.1f MB %9.1f MB\n", "40MB calloc", "-", setup, rss_setup,
+         rss_screen, rss_mb() - rss0);
+
+  int fail = 0;
+  for (int i = 0; i < count; i++) {
+    uint32_t vram = rtg_set_vram_size(sizes[i]);
+    rss0 = rss_mb();
+    t0 = now_ms();
+    if (!init_rtg_data(NULL)) {
+      printf("%uMB: init_rtg_data failed\n", vram / SIZE_MEGA);
+      fail = 1;
+      continue;
+    }
+    setup = now_ms() - t0;
+    rss_setup = rss_mb() - rss0;
+    draw_screen();
+    rss_screen = rss_mb() - rss0;
+    int bad = check_window(vram);
+    shutdown_rtg();
+    char label[32];
+    snprintf(label, sizeof(label), "%uMB rtg-vram", vram / SIZE_MEGA);
+    printf("%-14s $%.8X %9.3f %9.1f MB %9.1f MB %9.1f MB%s\n", label, PIGFX_UPPER, setup,
+           rss_setup, rss_screen, rss_mb() - rss0, bad ? "  FAIL" : "");
+    fail |= bad;
+  }
+  printf(fail ? "FAIL\n" : "OK\n");
+  return fail;
+}